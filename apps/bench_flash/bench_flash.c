@@ -0,0 +1,223 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "board_api.h"
+
+/* This is an application that measures the board_flash_*() backend of the port: read, write and
+ * flush throughput, flush (erase + program) latency per size, write cache hit/miss and
+ * unchanged data behaviour and the longest single call. Results are printed as a table to UART.
+ *
+ * NOTE: the flash region used is overwritten, by default the last BENCH_REGION_SIZE bytes of flash.
+ * Timing requires board_cycle_count(), build with TINYUF2_STATS=1.
+ */
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+// Start of flash, uf2 addresses of most ports share the top byte with the application start
+#ifndef BENCH_FLASH_BASE
+#define BENCH_FLASH_BASE    (BOARD_FLASH_APP_START & 0xFF000000UL)
+#endif
+
+#ifndef BENCH_REGION_SIZE
+#define BENCH_REGION_SIZE   (64*1024)
+#endif
+
+#ifndef BENCH_REGION_ADDR
+#define BENCH_REGION_ADDR   (BENCH_FLASH_BASE + board_flash_size() - BENCH_REGION_SIZE)
+#endif
+
+// size of each board_flash_read/write() call, same as an uf2 payload
+#define BENCH_CHUNK   256
+
+static uint8_t _buf[BENCH_CHUNK] __attribute__((aligned(4)));
+static uint32_t _mhz;
+
+typedef struct {
+  uint32_t cycles;  // total
+  uint32_t max;     // longest single call
+} bench_t;
+
+static inline uint32_t now(void) {
+  return board_cycle_count();
+}
+
+static void bench_add(bench_t* b, uint32_t start) {
+  uint32_t const cycles = now() - start;
+  b->cycles += cycles;
+  if (cycles > b->max) b->max = cycles;
+}
+
+static void fill(uint32_t seed) {
+  for (uint32_t i = 0; i < BENCH_CHUNK; i++) _buf[i] = (uint8_t) (seed + i * 7);
+}
+
+static void print_row(char const* name, uint32_t bytes, bench_t const* b) {
+  uint32_t const us = b->cycles / _mhz;
+  uint32_t const kbps = us ? (uint32_t) (((uint64_t) bytes * 1000000 / 1024) / us) : 0;
+  printf("%-24s %8lu %10lu %8lu %10lu\r\n", name, (unsigned long) bytes, (unsigned long) us,
+         (unsigned long) kbps, (unsigned long) (b->max / _mhz));
+}
+
+static bench_t bench_write(uint32_t addr, uint32_t len, uint32_t seed) {
+  bench_t b = { 0, 0 };
+  for (uint32_t off = 0; off < len; off += BENCH_CHUNK) {
+    fill(seed + off);
+    uint32_t const start = now();
+    board_flash_write(addr + off, _buf, BENCH_CHUNK);
+    bench_add(&b, start);
+  }
+  return b;
+}
+
+static bench_t bench_read(uint32_t addr, uint32_t len) {
+  bench_t b = { 0, 0 };
+  for (uint32_t off = 0; off < len; off += BENCH_CHUNK) {
+    uint32_t const start = now();
+    board_flash_read(addr + off, _buf, BENCH_CHUNK);
+    bench_add(&b, start);
+  }
+  return b;
+}
+
+static bench_t bench_flush(void) {
+  bench_t b = { 0, 0 };
+  uint32_t const start = now();
+  board_flash_flush();
+  bench_add(&b, start);
+  return b;
+}
+
+// check region contents against written pattern
+static uint32_t verify(uint32_t addr, uint32_t len, uint32_t seed) {
+  uint32_t errors = 0;
+  uint8_t expected[BENCH_CHUNK];
+
+  for (uint32_t off = 0; off < len; off += BENCH_CHUNK) {
+    fill(seed + off);
+    memcpy(expected, _buf, BENCH_CHUNK);
+    board_flash_read(addr + off, _buf, BENCH_CHUNK);
+    if (memcmp(expected, _buf, BENCH_CHUNK)) errors++;
+  }
+  return errors;
+}
+
+int main(void) {
+  board_init();
+  board_flash_init();
+
+  printf("Flash Benchmark\r\n");
+
+  if (!board_cycle_count) {
+    printf("board_cycle_count() is not available, build with TINYUF2_STATS=1\r\n");
+    while (1) {}
+  }
+  _mhz = board_cycle_freq() / 1000000;
+  if (!_mhz) _mhz = 1;
+
+  uint32_t const region = BENCH_REGION_ADDR;
+  uint32_t seed = 0;
+
+  printf("Region 0x%08lX, %lu KB, core %lu MHz, %u bytes per call\r\n\r\n", (unsigned long) region,
+         (unsigned long) BENCH_REGION_SIZE / 1024, (unsigned long) _mhz, BENCH_CHUNK);
+  printf("%-24s %8s %10s %8s %10s\r\n", "operation", "bytes", "total us", "KB/s", "max us");
+
+  // whole region: cached write, flush (erase + program) and read back
+  bench_t b = bench_write(region, BENCH_REGION_SIZE, seed);
+  print_row("write (cache miss)", BENCH_REGION_SIZE, &b);
+
+  b = bench_flush();
+  print_row("flush", BENCH_REGION_SIZE, &b);
+
+  b = bench_read(region, BENCH_REGION_SIZE);
+  print_row("read", BENCH_REGION_SIZE, &b);
+
+  uint32_t errors = verify(region, BENCH_REGION_SIZE, seed);
+
+  // same data again: ports skipping unchanged sectors flush without erasing
+  b = bench_write(region, BENCH_REGION_SIZE, seed);
+  print_row("write (unchanged)", BENCH_REGION_SIZE, &b);
+
+  b = bench_flush();
+  print_row("flush (unchanged)", BENCH_REGION_SIZE, &b);
+
+  // rewrite of data still in cache, then read served from cache
+  seed += 0x55;
+  b = bench_write(region, 4096, seed);
+  print_row("write 4K (cache miss)", 4096, &b);
+
+  b = bench_write(region, 4096, seed + 1);
+  print_row("write 4K (cache hit)", 4096, &b);
+
+  b = bench_read(region, 4096);
+  print_row("read 4K (cached)", 4096, &b);
+
+  b = bench_flush();
+  print_row("flush 4K", 4096, &b);
+  errors += verify(region, 4096, seed + 1);
+
+  // flush latency, i.e erase + program, for increasing sizes
+  for (uint32_t size = 4096; size <= BENCH_REGION_SIZE; size *= 2) {
+    char name[24];
+    seed += 0x55;
+    bench_write(region, size, seed);
+    b = bench_flush();
+    snprintf(name, sizeof(name), "flush %luK", (unsigned long) size / 1024);
+    print_row(name, size, &b);
+    errors += verify(region, size, seed);
+  }
+
+  printf("\r\nVerify: %lu chunk(s) mismatched\r\n", (unsigned long) errors);
+
+  while (1) {
+    // nothing to do
+  }
+}
+
+void board_timer_handler(void) {
+
+}
+
+//--------------------------------------------------------------------+
+// Logger newlib retarget
+//--------------------------------------------------------------------+
+
+#if defined(LOGGER_RTT)
+#include "SEGGER_RTT.h"
+#endif
+
+__attribute__ ((used)) int _write(int fhdl, const void* buf, size_t count) {
+  (void) fhdl;
+
+#if defined(LOGGER_RTT)
+  SEGGER_RTT_Write(0, (char*) buf, (int) count);
+  return count;
+#else
+  return board_uart_write(buf, count);
+#endif
+}
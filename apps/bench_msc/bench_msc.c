@@ -0,0 +1,293 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "board_api.h"
+#include "tusb.h"
+
+/* This is an application that exposes a RAM disk over USB MSC, with no flash behind it, and reports
+ * READ10/WRITE10 throughput and per command latency over CDC once per second while the host transfers.
+ * The numbers are the USB ceiling of the port (controller, driver and TinyUSB MSC), to compare with
+ * bench_flash and STATS.TXT of the bootloader. Descriptors are the bootloader's (src/usb_descriptors.c).
+ *
+ * The disk is BENCH_DISK_SIZE bytes backed by BENCH_RAM_SIZE bytes of RAM: sectors wrap around the RAM
+ * buffer so that transfers are long enough to measure, only the first BENCH_RAM_SIZE bytes read back
+ * what was written. Benchmark with raw transfers instead of a file system, e.g on Linux
+ *   dd if=/dev/zero of=/dev/sdX bs=64k count=1024 oflag=direct
+ *   dd if=/dev/sdX of=/dev/null bs=64k count=1024 iflag=direct
+ *
+ * NOTE: timing requires board_cycle_count(), build with TINYUF2_STATS=1.
+ */
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#ifndef BENCH_RAM_SIZE
+#define BENCH_RAM_SIZE    (64*1024)
+#endif
+
+#ifndef BENCH_DISK_SIZE
+#define BENCH_DISK_SIZE   (64*1024*1024)
+#endif
+
+// report interval while the host is transferring
+#define BENCH_REPORT_MS   1000
+
+#define BENCH_SECTOR      512
+
+// SBC-3 command not defined by tinyusb
+#define SBC_CMD_SYNCHRONIZE_CACHE_10  0x35
+
+enum {
+  BENCH_READ = 0,
+  BENCH_WRITE,
+  BENCH_COUNT
+};
+
+typedef struct {
+  uint32_t count;   // commands completed
+  uint32_t bytes;   // data transferred
+  uint32_t busy;    // cycles from first data callback to completion, summed over commands
+  uint32_t min;     // shortest command
+  uint32_t max;     // longest command
+} bench_t;
+
+static uint8_t _disk[BENCH_RAM_SIZE] __attribute__((aligned(4)));
+
+static bench_t _bench[BENCH_COUNT];
+static uint32_t _cmd_start[BENCH_COUNT]; // cycle count of command in progress, 0 if none
+static uint32_t _cmd_bytes[BENCH_COUNT];
+
+static volatile uint32_t _ms = 0;
+static uint32_t _window_ms;              // start of report window, 0 if no command since last report
+static uint32_t _mhz;
+
+static inline uint32_t now(void) {
+  uint32_t const cycles = board_cycle_count();
+  return cycles ? cycles : 1; // 0 means no command in progress
+}
+
+static void cmd_data(uint8_t dir, uint32_t bytes) {
+  if (!board_cycle_count) return;
+
+  if (!_cmd_start[dir]) {
+    _cmd_start[dir] = now();
+    _cmd_bytes[dir] = 0;
+    if (!_window_ms) _window_ms = _ms ? _ms : 1;
+  }
+  _cmd_bytes[dir] += bytes;
+}
+
+static void cmd_complete(uint8_t dir) {
+  if (!_cmd_start[dir]) return;
+
+  uint32_t const cycles = now() - _cmd_start[dir];
+  bench_t* b = &_bench[dir];
+
+  b->count++;
+  b->bytes += _cmd_bytes[dir];
+  b->busy += cycles;
+  if (!b->min || cycles < b->min) b->min = cycles;
+  if (cycles > b->max) b->max = cycles;
+
+  _cmd_start[dir] = 0;
+}
+
+// cdc output only when a terminal is open, dropped otherwise
+static void cdc_print(char const* str) {
+  if (!tud_cdc_connected()) return;
+  tud_cdc_write_str(str);
+  tud_cdc_write_flush();
+}
+
+static void print_row(char const* name, bench_t const* b, uint32_t window_ms) {
+  char line[128];
+  uint32_t const busy_us = b->busy / _mhz;
+  uint32_t const kbps = (uint32_t) ((uint64_t) b->bytes * 1000 / 1024 / window_ms);
+
+  snprintf(line, sizeof(line), "%-7s %8lu KB/s %6lu cmd %6lu avg us %6lu min us %6lu max us %3lu%% busy\r\n",
+           name, (unsigned long) kbps, (unsigned long) b->count, (unsigned long) (busy_us / b->count),
+           (unsigned long) (b->min / _mhz), (unsigned long) (b->max / _mhz),
+           (unsigned long) ((uint64_t) busy_us / 10 / window_ms));
+  cdc_print(line);
+}
+
+static void report_task(void) {
+  if (!_window_ms) return;
+
+  uint32_t const window_ms = _ms - _window_ms;
+  if (window_ms < BENCH_REPORT_MS) return;
+
+  if (_bench[BENCH_READ].count) print_row("READ10", &_bench[BENCH_READ], window_ms);
+  if (_bench[BENCH_WRITE].count) print_row("WRITE10", &_bench[BENCH_WRITE], window_ms);
+
+  memset(_bench, 0, sizeof(_bench));
+  _window_ms = 0;
+}
+
+int main(void) {
+  board_init();
+
+  if (board_cycle_count) {
+    _mhz = board_cycle_freq ? board_cycle_freq() / 1000000 : 0;
+    if (!_mhz) _mhz = 1;
+  }
+
+  board_usb_init();
+  tud_init(BOARD_TUD_RHPORT);
+
+  board_timer_start(1);
+
+  bool warned = false;
+  while (1) {
+    tud_task();
+
+    if (board_cycle_count) {
+      report_task();
+    } else if (!warned && tud_cdc_connected()) {
+      warned = true;
+      cdc_print("board_cycle_count() is not available, build with TINYUF2_STATS=1\r\n");
+    }
+  }
+}
+
+void board_timer_handler(void) {
+  _ms++;
+}
+
+//--------------------------------------------------------------------+
+// CDC
+//--------------------------------------------------------------------+
+
+void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts) {
+  (void) itf;
+  (void) rts;
+
+  if (dtr) {
+    char line[96];
+    snprintf(line, sizeof(line), "MSC RAM Disk Benchmark: %lu MB disk on %lu KB RAM, core %lu MHz\r\n",
+             (unsigned long) BENCH_DISK_SIZE / (1024 * 1024), (unsigned long) BENCH_RAM_SIZE / 1024,
+             (unsigned long) _mhz);
+    cdc_print(line);
+  }
+}
+
+//--------------------------------------------------------------------+
+// MSC
+//--------------------------------------------------------------------+
+
+void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4]) {
+  (void) lun;
+
+  const char vid[] = "Adafruit";
+  const char pid[] = "UF2 RAM Bench";
+  const char rev[] = "1.0";
+
+  memcpy(vendor_id, vid, strlen(vid));
+  memcpy(product_id, pid, strlen(pid));
+  memcpy(product_rev, rev, strlen(rev));
+}
+
+bool tud_msc_test_unit_ready_cb(uint8_t lun) {
+  (void) lun;
+  return true;
+}
+
+void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size) {
+  (void) lun;
+  *block_count = BENCH_DISK_SIZE / BENCH_SECTOR;
+  *block_size = BENCH_SECTOR;
+}
+
+bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject) {
+  (void) lun;
+  (void) power_condition;
+  (void) start;
+  (void) load_eject;
+  return true;
+}
+
+// Copy between RAM and buffer, sectors beyond RAM wrap around
+static void disk_copy(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize, bool write) {
+  uint32_t pos = (lba * BENCH_SECTOR + offset) % BENCH_RAM_SIZE;
+
+  while (bufsize) {
+    uint32_t count = BENCH_RAM_SIZE - pos;
+    if (count > bufsize) count = bufsize;
+
+    if (write) {
+      memcpy(_disk + pos, buffer, count);
+    } else {
+      memcpy(buffer, _disk + pos, count);
+    }
+
+    pos = 0;
+    buffer += count;
+    bufsize -= count;
+  }
+}
+
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+  (void) lun;
+  cmd_data(BENCH_READ, bufsize);
+  disk_copy(lba, offset, (uint8_t*) buffer, bufsize, false);
+  return (int32_t) bufsize;
+}
+
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+  (void) lun;
+  cmd_data(BENCH_WRITE, bufsize);
+  disk_copy(lba, offset, buffer, bufsize, true);
+  return (int32_t) bufsize;
+}
+
+void tud_msc_read10_complete_cb(uint8_t lun) {
+  (void) lun;
+  cmd_complete(BENCH_READ);
+}
+
+void tud_msc_write10_complete_cb(uint8_t lun) {
+  (void) lun;
+  cmd_complete(BENCH_WRITE);
+}
+
+int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, uint16_t bufsize) {
+  (void) buffer;
+  (void) bufsize;
+
+  switch (scsi_cmd[0]) {
+    case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
+    case SBC_CMD_SYNCHRONIZE_CACHE_10:
+      // nothing cached, RAM is the medium
+      return 0;
+
+    default:
+      // Set Sense = Invalid Command Operation
+      tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
+      return -1;
+  }
+}
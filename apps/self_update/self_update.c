@@ -37,6 +37,63 @@
 extern const unsigned long bindata_len;
 extern const unsigned char bindata[];
 
+#if TINYUF2_SELF_UPDATE_LZ4
+#include "lz4.h"
+
+// bindata is compressed (tools/uf2lz4.py --carray): LZ4 blocks each prefixed by its 16-bit length
+// and decoding to SELF_UPDATE_LZ4_CHUNK bytes (last one less), bindata_len is the decoded size
+extern const unsigned long bindata_lz4_len;
+
+#define SELF_UPDATE_LZ4_CHUNK  4096
+
+// Largest bootloader sector, decoded whole before being compared and written
+#ifndef BOARD_SELF_UPDATE_SECTOR_MAX
+#define BOARD_SELF_UPDATE_SECTOR_MAX  (16*1024)
+#endif
+
+static struct {
+  uint32_t in_pos;  // bindata offset of next block
+  uint32_t len;     // decoded bytes in chunk
+  uint32_t pos;     // bytes of chunk already read
+  uint8_t chunk[SELF_UPDATE_LZ4_CHUNK];
+} _lz4;
+
+static uint8_t _sector_buf[BOARD_SELF_UPDATE_SECTOR_MAX] __attribute__((aligned(4)));
+
+static void lz4_rewind(void)
+{
+  _lz4.in_pos = _lz4.len = _lz4.pos = 0;
+}
+
+// Decode next len bytes of the bootloader into dst, false if the stream is malformed or too short
+static bool lz4_read(uint8_t* dst, uint32_t len)
+{
+  while ( len )
+  {
+    if ( _lz4.pos == _lz4.len )
+    {
+      if ( _lz4.in_pos + 2 > bindata_lz4_len ) return false;
+      uint32_t const size = bindata[_lz4.in_pos] | (bindata[_lz4.in_pos + 1] << 8);
+      _lz4.in_pos += 2;
+      if ( size > bindata_lz4_len - _lz4.in_pos ) return false;
+
+      _lz4.len = lz4_decode(bindata + _lz4.in_pos, size, _lz4.chunk, sizeof(_lz4.chunk));
+      _lz4.in_pos += size;
+      _lz4.pos = 0;
+      if ( _lz4.len == 0 ) return false;
+    }
+
+    uint32_t const count = (len < _lz4.len - _lz4.pos) ? len : (_lz4.len - _lz4.pos);
+    memcpy(dst, _lz4.chunk + _lz4.pos, count);
+    _lz4.pos += count;
+    dst += count;
+    len -= count;
+  }
+
+  return true;
+}
+#endif
+
 uint8_t const RGB_WRITING[]       = { 0xcc, 0x66, 0x00 };
 uint8_t const RGB_OFF[]           = { 0x00, 0x00, 0x00 };
 
@@ -52,8 +109,24 @@ int main(void)
   // Set indicator similar to WRITING
   board_timer_start(25);
 
+#if TINYUF2_SELF_UPDATE_LZ4
+  printf("compressed size = %ld\r\n", bindata_lz4_len);
+
+  // port only checks the start of the image (vector table), the rest is decoded by self_update_sectors()
+  uint32_t const head = (bindata_len < sizeof(_sector_buf)) ? bindata_len : sizeof(_sector_buf);
+  lz4_rewind();
+  if ( !lz4_read(_sector_buf, head) )
+  {
+    TUF2_LOG1("Self-update: compressed image is corrupted\r\n");
+    while (1) {}
+  }
+
+  // This should never return
+  board_self_update(_sector_buf, (uint32_t) bindata_len);
+#else
   // This should never return
   board_self_update((uint8_t const*) bindata, (uint32_t) bindata_len);
+#endif
 
   while(1)
   {
@@ -61,6 +134,60 @@ int main(void)
   }
 }
 
+//--------------------------------------------------------------------+
+// Sector-granular update, see board_api.h
+//--------------------------------------------------------------------+
+
+// attempts to program a sector until it reads back as the new bootloader
+#define SELF_UPDATE_SECTOR_RETRY  3
+
+bool self_update_sectors(uint32_t addr, uint8_t const* bin, uint32_t len, uint32_t sector_count,
+                         uint32_t (*sector_size)(uint32_t sector),
+                         void (*write_sector)(uint32_t sector, uint32_t addr, uint8_t const* data, uint32_t len))
+{
+  uint32_t offset = 0;
+
+#if TINYUF2_SELF_UPDATE_LZ4
+  // bin only holds the start of the image, sectors are decoded one at a time from the stream
+  (void) bin;
+  lz4_rewind();
+#endif
+
+  for ( uint32_t sector = 0; sector < sector_count && offset < len; sector++ )
+  {
+    uint32_t const size = (sector_size(sector) < len - offset) ? sector_size(sector) : (len - offset);
+    uint32_t attempt = 0;
+
+#if TINYUF2_SELF_UPDATE_LZ4
+    if ( size > sizeof(_sector_buf) || !lz4_read(_sector_buf, size) )
+    {
+      TUF2_LOG1("Self-update: sector %lu can't be decoded\r\n", sector);
+      return false;
+    }
+    uint8_t const* data = _sector_buf;
+#else
+    uint8_t const* data = bin + offset;
+#endif
+
+    // sectors already matching (unchanged or written before a reset) are left untouched
+    while ( memcmp((void const*) (addr + offset), data, size) )
+    {
+      if ( attempt++ == SELF_UPDATE_SECTOR_RETRY )
+      {
+        TUF2_LOG1("Self-update: sector %lu failed\r\n", sector);
+        return false;
+      }
+
+      TUF2_LOG1("Self-update: sector %lu at %08lX\r\n", sector, addr + offset);
+      write_sector(sector, addr + offset, data, size);
+    }
+
+    offset += size;
+  }
+
+  return offset == len;
+}
+
 void board_timer_handler(void)
 {
   _timer_count++;
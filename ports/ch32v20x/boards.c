@@ -34,6 +34,9 @@
 #define BOARD_PAGE_SIZE  0x800
 #define FLASH_ADDR_PHY_BASE  0x08000000UL
 
+// for ch32 after erased the flash value is 0xe339e339 (mentioned in RM) instead of 0xffffffff
+#define FLASH_ERASED_WORD    0xe339e339UL
+
 //--------------------------------------------------------------------+
 // MACRO TYPEDEF CONSTANT ENUM DECLARATION
 //--------------------------------------------------------------------+
@@ -132,8 +135,7 @@ void board_dfu_complete(void) {
 bool board_app_valid(void) {
   uint32_t app_start_contents = *((volatile uint32_t const*) ADDR_ABS(BOARD_FLASH_APP_START));
   TUF2_LOG1_HEX(app_start_contents);
-  // for ch32 after erased the flash value is 0xe339e339 (mentioned in RM) instead of 0xffffffff
-  return app_start_contents != 0xe339e339;
+  return app_start_contents != FLASH_ERASED_WORD;
 }
 
 // Jump to application code
@@ -182,6 +184,18 @@ void SysTick_Handler(void) {
   board_timer_handler();
 }
 
+#if TINYUF2_STATS || TINYUF2_BOOT_TRACE || TINYUF2_EVENT_LOG
+uint32_t board_cycle_count(void) {
+  uint32_t cycles;
+  __asm volatile ("csrr %0, mcycle" : "=r" (cycles));
+  return cycles;
+}
+
+uint32_t board_cycle_freq(void) {
+  return SystemCoreClock;
+}
+#endif
+
 int board_uart_write(void const* buf, int len) {
 #if CFG_TUSB_DEBUG || TUF2_LOG
   const char *bufc = (const char *) buf;
@@ -208,34 +222,128 @@ uint32_t board_flash_size(void) {
   return BOARD_FLASH_SIZE;
 }
 
+// Erase and program both work on 256-byte fast pages, see below
+board_flash_info_t const* board_flash_info(void) {
+  static flash_region_t _flash_region;
+  static board_flash_info_t info = {
+    .geometry     = { .base = BOARD_FLASH_ADDR_ZERO, .regions = &_flash_region, .region_count = 1 },
+    .xip_base     = FLASH_ADDR_PHY_BASE,
+    .erased_word  = FLASH_ERASED_WORD,
+    .program_size = 256,
+    .caps         = BOARD_FLASH_CAP_XIP,
+  };
+
+  // flash size comes from the linker script
+  _flash_region.size = 256;
+  _flash_region.count = BOARD_FLASH_SIZE / 256;
+  return &info;
+}
+
+// Writes are collected per 256-byte fast page, programmed when switching page or on flush.
+// Flash stays unlocked for fast programming from the first write until flush.
+#define FAST_PAGE_SIZE    256
+#define NO_CACHE          0xffffffffUL
+
+static uint32_t _fast_page_addr = NO_CACHE;
+static uint32_t _fast_page_buf[FAST_PAGE_SIZE / 4];
+static bool _flash_unlocked = false;
+
+static bool fast_page_blank(uint32_t const* page) {
+  for (uint32_t i = 0; i < FAST_PAGE_SIZE / 4; i++) {
+    if (page[i] != FLASH_ERASED_WORD) return false;
+  }
+  return true;
+}
+
+static void fast_page_flush(void) {
+  if (_fast_page_addr == NO_CACHE) return;
+
+  uint32_t const* flash = (uint32_t const*) _fast_page_addr;
+
+  // skip if contents is the same, erase only if not blank already
+  if (memcmp(flash, _fast_page_buf, FAST_PAGE_SIZE) != 0) {
+    if (!fast_page_blank(flash)) {
+      FLASH_ErasePage_Fast(_fast_page_addr);
+    }
+
+    if (!fast_page_blank(_fast_page_buf)) {
+      FLASH_ProgramPage_Fast(_fast_page_addr, _fast_page_buf);
+    }
+
+    // verify contents
+    if (memcmp(flash, _fast_page_buf, FAST_PAGE_SIZE) != 0) {
+      TUF2_LOG1("Failed to write\r\n");
+    }
+  }
+
+  _fast_page_addr = NO_CACHE;
+}
+
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
   memcpy(buffer, (void*) addr, len);
+
+  // overlay data not yet programmed
+  uint32_t const page_addr = ADDR_BASE0(_fast_page_addr);
+  addr = ADDR_BASE0(addr);
+  if (_fast_page_addr != NO_CACHE && addr < page_addr + FAST_PAGE_SIZE && page_addr < addr + len) {
+    uint32_t const start = (addr > page_addr) ? addr : page_addr;
+    uint32_t const end = (addr + len < page_addr + FAST_PAGE_SIZE) ? (addr + len) : (page_addr + FAST_PAGE_SIZE);
+    memcpy((uint8_t*) buffer + (start - addr), ((uint8_t*) _fast_page_buf) + (start - page_addr), end - start);
+  }
 }
 
 void board_flash_flush(void) {
-  // nothing to do
+  fast_page_flush();
+
+  if (_flash_unlocked) {
+    FLASH_Lock_Fast();
+    _flash_unlocked = false;
+  }
 }
 
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
-  TUF2_ASSERT(len == 256);
+  uint8_t const* src = (uint8_t const*) data;
 
   addr = ADDR_ABS(addr);
 
-  FLASH_Unlock_Fast();
+  if (!_flash_unlocked) {
+    FLASH_Unlock_Fast();
+    _flash_unlocked = true;
+  }
+
+  // payload may not be page aligned (e.g 476 bytes): merge into page cache
+  while (len) {
+    uint32_t const page_addr = addr & ~(FAST_PAGE_SIZE - 1);
+    uint32_t const offset = addr & (FAST_PAGE_SIZE - 1);
+    uint32_t const count = (len < FAST_PAGE_SIZE - offset) ? len : (FAST_PAGE_SIZE - offset);
+
+    if (page_addr != _fast_page_addr) {
+      fast_page_flush();
+      _fast_page_addr = page_addr;
 
-  FLASH_ErasePage_Fast(addr);
-  FLASH_ProgramPage_Fast(addr, (uint32_t*) (uintptr_t ) data);
+      // partial page: start from current contents
+      if (count != FAST_PAGE_SIZE) {
+        memcpy(_fast_page_buf, (void*) page_addr, FAST_PAGE_SIZE);
+      }
+    }
 
-  FLASH_Lock_Fast();
+    memcpy(((uint8_t*) _fast_page_buf) + offset, src, count);
 
-  // verify contents
-  if (memcmp((void*) addr, data, len) != 0) {
-    TUF2_LOG1("Failed to write\r\n");
+    addr += count;
+    src += count;
+    len -= count;
   }
 
   return true;
 }
 
+// Partially written pages start from their current contents
+bool board_flash_preserved(uint32_t addr, uint32_t len) {
+  (void) addr;
+  (void) len;
+  return true;
+}
+
 void board_flash_erase_app(void) {
   // TODO implement later
 }
@@ -36,12 +36,16 @@
 #define TINYUF2_DBL_TAP_REG       BKP->DATAR10
 #define TINYUF2_DBL_TAP_REG_SIZE  16
 
+// Volume is sized to the small flash (about 2MB) instead of CFG_UF2_NUM_BLOCKS
+#define TINYUF2_AUTO_GEOMETRY     1
+
 // symbol from linker
 extern uint32_t __flash_size[];
 extern uint32_t __flash_boot_size[];
 
 #define BOARD_FLASH_SIZE        ((uint32_t) __flash_size)
 #define BOARD_FLASH_APP_START   ((uint32_t) __flash_boot_size)
+#define BOARD_FLASH_ERASE_SIZE  2048
 
 #ifdef __cplusplus
  }
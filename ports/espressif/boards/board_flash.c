@@ -23,81 +23,899 @@
  */
 
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_partition.h"
 #include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "esp_rom_crc.h"
+#include "esp_heap_caps.h"
+#include "esp_attr.h"
+#include "esp_idf_version.h"
+#include "esp_private/system_internal.h"
 
 #include "spi_flash_chip_driver.h"
 #include "board_api.h"
+#include "uf2.h"
 
-#define FLASH_CACHE_SIZE          (64*1024)
+#define FLASH_PSRAM_STAGING       (BOARD_FLASH_PSRAM_STAGING && CONFIG_SPIRAM)
+
+#if FLASH_PSRAM_STAGING
+#include "mbedtls/sha256.h"
+#endif
+
+// Cache line size, multiple of 4KB up to 64KB. Flush erases only modified 4KB sectors of the line
+// (whole line at once if all changed), a smaller line saves DRAM at the cost of more flush calls
+#ifndef BOARD_FLASH_CACHE_SIZE
+#define BOARD_FLASH_CACHE_SIZE    (64*1024)
+#endif
+
+#define FLASH_CACHE_SIZE          BOARD_FLASH_CACHE_SIZE
 #define FLASH_CACHE_INVALID_ADDR  0xffffffff
 
-static uint32_t _fl_addr = FLASH_CACHE_INVALID_ADDR;
-static uint8_t _fl_buf[FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+#define FLASH_CACHE_BLOCK_SIZE    256
+#define FLASH_CACHE_BLOCK_COUNT   (FLASH_CACHE_SIZE / FLASH_CACHE_BLOCK_SIZE)
+
+typedef struct {
+  uint32_t addr;
+  uint8_t* buf;
+
+  // bit set for each 256-byte block of cache that holds written data, the rest is only read from
+  // flash on flush. A cache line written completely is never pre-loaded (64KB spi flash read).
+  uint32_t valid[(FLASH_CACHE_BLOCK_COUNT + 31) / 32];
+
+  // bit set for each block written since the line was cached: blocks loaded by flash_cache_fill()
+  // are flash contents already and are not read back again when checking for changes on flush
+  uint32_t dirty[(FLASH_CACHE_BLOCK_COUNT + 31) / 32];
+} flash_line_t;
+
+// line being written, the other one is being flushed by worker
+static flash_line_t _fl_lines[2];
+static flash_line_t* _fl = &_fl_lines[0];
+
+#if !CONFIG_SPIRAM
+TUF2_DFU_NOINIT static uint8_t _fl_buf[FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+#endif
+
+// flush only erases & writes the 4KB sectors of the cache line that were modified
+#define FLASH_SECTOR_SIZE         4096
+#define FLASH_SECTOR_BLOCKS       (FLASH_SECTOR_SIZE / FLASH_CACHE_BLOCK_SIZE)
+#define FLASH_SECTOR_COUNT        (FLASH_CACHE_SIZE / FLASH_SECTOR_SIZE)
+#define FLASH_BLOCK_SIZE          (64*1024)
+
+// Typical figures of the flash part. Octal parts (CONFIG_ESPTOOLPY_OCT_FLASH e.g MX25UM) erase a 4KB
+// sector and program a page faster than quad parts (W25Q, GD25Q) but their 64KB block erase is slower
+#if CONFIG_ESPTOOLPY_OCT_FLASH
+#define FLASH_SECTOR_ERASE_US     25000
+#define FLASH_BLOCK_ERASE_US      220000
+#define FLASH_PAGE_PROGRAM_US     150
+#else
+#define FLASH_SECTOR_ERASE_US     45000
+#define FLASH_BLOCK_ERASE_US      150000
+#define FLASH_PAGE_PROGRAM_US     400
+#endif
+
+#define FLASH_SECTOR_PROGRAM_US   ((FLASH_SECTOR_SIZE / 256) * FLASH_PAGE_PROGRAM_US)
+
+// Changed sectors of a 64KB line from which one block erase and programming the whole line is faster
+// than erasing and programming only those: 5 on quad, 10 on octal flash
+#define FLASH_BLOCK_ERASE_SECTORS \
+  ((FLASH_BLOCK_ERASE_US + FLASH_SECTOR_COUNT * FLASH_SECTOR_PROGRAM_US) / \
+   (FLASH_SECTOR_ERASE_US + FLASH_SECTOR_PROGRAM_US) + 1)
+
+TUF2_DFU_NOINIT static uint8_t _fl_verify[FLASH_SECTOR_SIZE] __attribute__((aligned(4)));
+
+// uf2 writes to ota0 partition, or to the ota slot not selected for boot with BOARD_FLASH_OTA_AB
+static esp_partition_t const* _part_app = NULL;
+static bool _part_app_written = false;
+
+// App partition mapped into data address space once: reads are memcpy from the MMU cache instead of a
+// locked (and possibly decrypting) spi flash driver call each. Writes and erases through the partition
+// API invalidate the cached range. NULL if mapping failed e.g no free MMU pages
+static uint8_t const* _part_app_map = NULL;
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+typedef esp_partition_mmap_handle_t part_mmap_handle_t;
+#else
+typedef spi_flash_mmap_handle_t part_mmap_handle_t;
+#endif
+
+static inline void app_read(uint32_t offset, void* buffer, uint32_t len) {
+  if (_part_app_map) {
+    memcpy(buffer, _part_app_map + offset, len);
+  } else {
+    esp_partition_read(_part_app, offset, buffer, len);
+  }
+}
+
+#if TINYUF2_EVENT_LOG
+// kept in RTC memory across software resets like the wear log
+RTC_NOINIT_ATTR board_event_log_t _board_event_log[1];
+#endif
+
+#if TINYUF2_RESUME
+// progress journal of an interrupted write, also kept in RTC memory
+RTC_NOINIT_ATTR board_resume_log_t _board_resume_log[1];
+#endif
+
+#if TINYUF2_CONFIG_TXT
+// runtime tunables saved from CONFIG.TXT, kept in RTC memory as well
+RTC_NOINIT_ATTR board_config_t _board_config[1];
+#endif
+
+#ifdef BOARD_UF2_DATA_FAMILY_ID
+// uf2 blocks with BOARD_UF2_DATA_FAMILY_ID are written to the first spiffs data partition,
+// target address is the offset within the partition
+#define DATA_CACHE_SIZE   FLASH_SECTOR_SIZE
+
+static esp_partition_t const* _part_data = NULL;
+static uint32_t _data_addr = FLASH_CACHE_INVALID_ADDR;
+static uint8_t _data_buf[DATA_CACHE_SIZE] __attribute__((aligned(4)));
+
+#if TINYUF2_WEAR_LOG
+// erase unit is the data partition sector, kept in RTC memory across software resets
+RTC_NOINIT_ATTR board_wear_log_t _board_wear_log[1];
+#endif
+#endif
+
+#if BOARD_FLASH_WORKER
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#define FLASH_WORKER_STACK_SIZE   (3*1024)
+
+#if !CONFIG_FREERTOS_UNICORE
+// usb task is pinned to core 0 with worker enabled
+#define FLASH_WORKER_CORE         1
+#else
+#define FLASH_WORKER_CORE         tskNO_AFFINITY
+#endif
+
+static StackType_t _worker_stack[FLASH_WORKER_STACK_SIZE];
+static StaticTask_t _worker_taskdef;
+
+// one filled line in flight, worker gives _worker_idle when it is flushed
+static StaticQueue_t _worker_queuedef;
+static uint8_t _worker_queue_buf[sizeof(flash_line_t*)];
+static QueueHandle_t _worker_queue = NULL;
+
+static StaticSemaphore_t _worker_idle_def;
+static SemaphoreHandle_t _worker_idle = NULL;
+
+static void flash_line_flush(flash_line_t* line);
+
+static void flash_worker_task(void* param) {
+  (void) param;
+
+  while (1) {
+    flash_line_t* line;
+    if (xQueueReceive(_worker_queue, &line, portMAX_DELAY)) {
+      flash_line_flush(line);
+      xSemaphoreGive(_worker_idle);
+    }
+  }
+}
+
+// wait until line in flight (if any) is flushed
+static void flash_worker_wait(void) {
+  if (_worker_idle == NULL) return;
+  xSemaphoreTake(_worker_idle, portMAX_DELAY);
+  xSemaphoreGive(_worker_idle);
+}
+#endif
+
+#if CONFIG_SPIRAM || BOARD_FLASH_WORKER
+// allocated in PSRAM, internal RAM if the module has no PSRAM
+static uint8_t* flash_line_alloc(void) {
+  uint8_t* buf = heap_caps_malloc(FLASH_CACHE_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (buf == NULL) buf = heap_caps_malloc(FLASH_CACHE_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  return buf;
+}
+#endif
+
+//--------------------------------------------------------------------+
+// PSRAM staging (BOARD_FLASH_PSRAM_STAGING)
+//--------------------------------------------------------------------+
+
+#if FLASH_PSRAM_STAGING
+#define STAGE_BLOCK_SIZE          256
+#define STAGE_ERASE_SIZE          (64*1024)
+#define IMAGE_CHECKSUM_INITIAL    0xEF
+
+// Whole app partition in PSRAM, bit set for each 256-byte block written since the last flush. Blocks
+// only partially written are loaded from flash first, untouched ones just before programming
+static struct {
+  uint8_t* buf;
+  uint32_t* written;
+  uint32_t first; // written blocks [first, last), empty if first >= last
+  uint32_t last;
+} _stage;
+
+static inline bool stage_written(uint32_t i) {
+  return _stage.written[i / 32] & (1UL << (i % 32));
+}
+
+static void stage_clear(void) {
+  memset(_stage.written, 0, ((_part_app->size / STAGE_BLOCK_SIZE + 31) / 32) * 4);
+  _stage.first = UINT32_MAX;
+  _stage.last = 0;
+}
+
+static void stage_init(void) {
+  if (_stage.buf == NULL) {
+    uint32_t const words = (_part_app->size / STAGE_BLOCK_SIZE + 31) / 32;
+    _stage.buf = heap_caps_malloc(_part_app->size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    _stage.written = heap_caps_malloc(words * 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+    if (_stage.buf == NULL || _stage.written == NULL) {
+      heap_caps_free(_stage.buf);
+      heap_caps_free(_stage.written);
+      _stage.buf = NULL;
+      TUF2_LOG1("No PSRAM to stage %lu KB, using cache lines\r\n", _part_app->size / 1024);
+      return;
+    }
+  }
+
+  stage_clear();
+}
+
+static bool stage_write(uint32_t addr, void const* data, uint32_t len) {
+  if (addr > _part_app->size || len > _part_app->size - addr) return false;
+
+  uint32_t const first = addr / STAGE_BLOCK_SIZE;
+  uint32_t const last = (addr + len + STAGE_BLOCK_SIZE - 1) / STAGE_BLOCK_SIZE;
+
+  for (uint32_t i = first; i < last; i++) {
+    if (stage_written(i)) continue;
 
-// uf2 will always write to ota0 partition
-static esp_partition_t const* _part_ota0 = NULL;
+    // block only partially covered keeps its current contents
+    uint32_t const start = i * STAGE_BLOCK_SIZE;
+    if (start < addr || start + STAGE_BLOCK_SIZE > addr + len) {
+      app_read(start, _stage.buf + start, STAGE_BLOCK_SIZE);
+    }
+    _stage.written[i / 32] |= 1UL << (i % 32);
+  }
+
+  memcpy(_stage.buf + addr, data, len);
+  if (first < _stage.first) _stage.first = first;
+  if (last > _stage.last) _stage.last = last;
+
+  return true;
+}
+
+// Staged data takes precedence over flash contents
+static void stage_read(uint32_t addr, uint8_t* buffer, uint32_t len) {
+  uint32_t const first = addr / STAGE_BLOCK_SIZE;
+  uint32_t const last = (addr + len + STAGE_BLOCK_SIZE - 1) / STAGE_BLOCK_SIZE;
+
+  for (uint32_t i = (first > _stage.first) ? first : _stage.first; i < last && i < _stage.last; i++) {
+    if (!stage_written(i)) continue;
+
+    uint32_t const start = (i * STAGE_BLOCK_SIZE > addr) ? i * STAGE_BLOCK_SIZE : addr;
+    uint32_t const end = ((i + 1) * STAGE_BLOCK_SIZE < addr + len) ? (i + 1) * STAGE_BLOCK_SIZE : addr + len;
+    memcpy(buffer + (start - addr), _stage.buf + start, end - start);
+  }
+}
+
+static void stage_sha256(uint8_t const* data, uint32_t len, uint8_t digest[32]) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  (void) mbedtls_sha256(data, len, digest, 0);
+#else
+  (void) mbedtls_sha256_ret(data, len, digest, 0);
+#endif
+}
+
+// App image staged from offset 0 is complete and intact: same header, checksum and appended SHA-256
+// checks as esp_image_verify() does on flash, so that a broken upload never erases the current app
+static bool stage_image_valid(void) {
+  uint8_t const* img = _stage.buf;
+  uint32_t const size = _part_app->size;
+  esp_image_header_t const* hdr = (esp_image_header_t const*) img;
+
+  if (hdr->magic != ESP_IMAGE_HEADER_MAGIC || hdr->segment_count > ESP_IMAGE_MAX_SEGMENTS) return false;
+
+  uint32_t pos = sizeof(esp_image_header_t);
+  uint8_t checksum = IMAGE_CHECKSUM_INITIAL;
+  for (uint8_t s = 0; s < hdr->segment_count; s++) {
+    esp_image_segment_header_t seg;
+    if (sizeof(seg) > size - pos) return false;
+    memcpy(&seg, img + pos, sizeof(seg));
+    pos += sizeof(seg);
+
+    if (seg.data_len > size - pos) return false;
+    for (uint32_t i = 0; i < seg.data_len; i++) checksum ^= img[pos + i];
+    pos += seg.data_len;
+  }
+
+  // checksum is the last byte of the image padded to 16 bytes, SHA-256 of everything before follows
+  pos = (pos + 16) & ~15UL;
+  uint32_t const end = pos + (hdr->hash_appended ? 32 : 0);
+  if (end > size) return false;
+
+  for (uint32_t i = 0; i < (end + STAGE_BLOCK_SIZE - 1) / STAGE_BLOCK_SIZE; i++) {
+    if (!stage_written(i)) return false;
+  }
+  if (img[pos - 1] != checksum) return false;
+
+  if (hdr->hash_appended) {
+    uint8_t digest[32];
+    stage_sha256(img, pos, digest);
+    if (0 != memcmp(digest, img + pos, 32)) return false;
+  }
+
+  return true;
+}
+
+static bool stage_unit_changed(uint32_t offset, uint32_t size) {
+  if (_part_app_map) return 0 != memcmp(_stage.buf + offset, _part_app_map + offset, size);
+
+  for (uint32_t pos = 0; pos < size; pos += FLASH_SECTOR_SIZE) {
+    esp_partition_read(_part_app, offset + pos, _fl_verify, FLASH_SECTOR_SIZE);
+    if (0 != memcmp(_stage.buf + offset + pos, _fl_verify, FLASH_SECTOR_SIZE)) return true;
+  }
+  return false;
+}
+
+// Program staged data in ascending order, each changed 64KB block with one block erase
+static void stage_flush(void) {
+  if (_stage.first >= _stage.last) return;
+
+  if (stage_written(0) && !stage_image_valid()) {
+    TUF2_LOG1("Staged image not valid, flash unchanged\r\n");
+    return;
+  }
+
+  uint32_t const end = _stage.last * STAGE_BLOCK_SIZE;
+  for (uint32_t offset = (_stage.first * STAGE_BLOCK_SIZE) & ~(STAGE_ERASE_SIZE - 1UL); offset < end;
+       offset += STAGE_ERASE_SIZE) {
+    uint32_t const size = (_part_app->size - offset < STAGE_ERASE_SIZE) ? (_part_app->size - offset) : STAGE_ERASE_SIZE;
+    uint32_t const last = (offset + size) / STAGE_BLOCK_SIZE;
+    bool any = false;
+
+    // blocks not written keep flash contents, consecutive ones are read at once
+    uint32_t i = offset / STAGE_BLOCK_SIZE;
+    while (i < last) {
+      if (stage_written(i)) {
+        any = true;
+        i++;
+        continue;
+      }
+
+      uint32_t const first = i;
+      while (i < last && !stage_written(i)) i++;
+      app_read(first * STAGE_BLOCK_SIZE, _stage.buf + first * STAGE_BLOCK_SIZE, (i - first) * STAGE_BLOCK_SIZE);
+    }
+
+    if (!any || !stage_unit_changed(offset, size)) continue;
+
+    TUF2_LOG1("Erase and Write at 0x%08lX (%lu bytes)\r\n", offset, size);
+    esp_partition_erase_range(_part_app, offset, size);
+    esp_partition_write(_part_app, offset, _stage.buf + offset, size);
+
+    // let idle task run and feed the task watchdog between blocks
+    vTaskDelay(1);
+  }
+
+  stage_clear();
+}
+#endif
 
 void board_flash_init(void) {
-  _fl_addr = FLASH_CACHE_INVALID_ADDR;
+  _fl_lines[0].addr = FLASH_CACHE_INVALID_ADDR;
+  _fl_lines[1].addr = FLASH_CACHE_INVALID_ADDR;
+
+#if CONFIG_SPIRAM
+  if (_fl_lines[0].buf == NULL) {
+    _fl_lines[0].buf = flash_line_alloc();
+    assert(_fl_lines[0].buf != NULL);
+  }
+#else
+  _fl_lines[0].buf = _fl_buf;
+#endif
+
+#if BOARD_FLASH_WORKER
+  if (_worker_idle == NULL) {
+    _fl_lines[1].buf = flash_line_alloc();
+    if (_fl_lines[1].buf != NULL) {
+      _worker_queue = xQueueCreateStatic(1, sizeof(flash_line_t*), _worker_queue_buf, &_worker_queuedef);
+      _worker_idle = xSemaphoreCreateBinaryStatic(&_worker_idle_def);
+      xSemaphoreGive(_worker_idle);
+
+      // lower priority than usb task, which only waits for the worker when both lines are full
+      (void) xTaskCreateStaticPinnedToCore(flash_worker_task, "flash", FLASH_WORKER_STACK_SIZE, NULL,
+                                           configMAX_PRIORITIES - 3, _worker_stack, &_worker_taskdef,
+                                           FLASH_WORKER_CORE);
+    } else {
+      TUF2_LOG1("No RAM for flash worker, flush is synchronous\r\n");
+    }
+  }
+#endif
 
-  _part_ota0 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
-  assert(_part_ota0 != NULL);
+#if BOARD_FLASH_OTA_AB
+  // image selected for boot stays intact until the new one is complete and valid
+  _part_app = esp_ota_get_next_update_partition(esp_ota_get_boot_partition());
+#else
+  _part_app = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+#endif
+  assert(_part_app != NULL);
+  TUF2_LOG1("App partition: %s at 0x%08lX\r\n", _part_app->label, _part_app->address);
+
+  if (_part_app_map == NULL) {
+    void const* ptr;
+    part_mmap_handle_t handle;
+    if (ESP_OK == esp_partition_mmap(_part_app, 0, _part_app->size, ESP_PARTITION_MMAP_DATA, &ptr, &handle)) {
+      _part_app_map = (uint8_t const*) ptr;
+    } else {
+      TUF2_LOG1("App partition not mapped, reads use spi flash driver\r\n");
+    }
+  }
+
+#if FLASH_PSRAM_STAGING
+  stage_init();
+#endif
+
+#ifdef BOARD_UF2_DATA_FAMILY_ID
+  _data_addr = FLASH_CACHE_INVALID_ADDR;
+  _part_data = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+#endif
 }
 
 uint32_t board_flash_size(void) {
-  return _part_ota0->size;
+  return _part_app->size;
+}
+
+// 4KB sectors of the app partition with the typical figures of the flash part, readable through the
+// partition map if there is one
+board_flash_info_t const* board_flash_info(void) {
+  static flash_region_t _flash_region;
+  static board_flash_info_t info = {
+    .geometry     = { .base = BOARD_FLASH_APP_START, .regions = &_flash_region, .region_count = 1 },
+    .erased_word  = 0xFFFFFFFFUL,
+    .program_size = 4,
+    .erase_us     = FLASH_SECTOR_ERASE_US,
+    .program_us   = FLASH_PAGE_PROGRAM_US,
+  };
+
+  // partition is only known at runtime
+  _flash_region.size = FLASH_SECTOR_SIZE;
+  _flash_region.count = _part_app->size / FLASH_SECTOR_SIZE;
+  info.xip_base = (uint32_t) (uintptr_t) _part_app_map;
+  info.caps = BOARD_FLASH_CAP_BIT_CLEAR | (_part_app_map ? BOARD_FLASH_CAP_XIP : 0);
+  return &info;
+}
+
+#if TINYUF2_PART_FILES
+// One raw file per partition (app partitions first, then data), e.g OTA_0.BIN or NVS.BIN from the label.
+// Partitions are mapped into data address space once, reads are then memcpy from the MMU cache. A
+// partition that can not be mapped (no free MMU pages) gets no file
+static struct {
+  void const* map;
+  uint32_t size;
+  char name[11];
+} _part_files[TINYUF2_PART_FILES];
+
+static void part_files_scan(void) {
+  static esp_partition_type_t const types[] = { ESP_PARTITION_TYPE_APP, ESP_PARTITION_TYPE_DATA };
+  uint32_t count = 0;
+
+  for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+    esp_partition_iterator_t it = esp_partition_find(types[t], ESP_PARTITION_SUBTYPE_ANY, NULL);
+    for (; it != NULL && count < TINYUF2_PART_FILES; it = esp_partition_next(it)) {
+      esp_partition_t const* part = esp_partition_get(it);
+      void const* ptr = (part == _part_app) ? (void const*) _part_app_map : NULL;
+      part_mmap_handle_t handle;
+      if (ptr == NULL && ESP_OK != esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &ptr, &handle)) {
+        TUF2_LOG1("Partition %s not mapped, no file\r\n", part->label);
+        continue;
+      }
+
+      // label as 8.3 name, '.' is not valid in base name
+      memset(_part_files[count].name, ' ', 11);
+      for (size_t i = 0; i < 8 && part->label[i]; i++) {
+        char const c = part->label[i];
+        _part_files[count].name[i] = (c == '.') ? '_' : ((c >= 'a' && c <= 'z') ? (char) (c - 'a' + 'A') : c);
+      }
+      memcpy(_part_files[count].name + 8, "BIN", 3);
+      _part_files[count].map = ptr;
+      _part_files[count].size = part->size;
+      count++;
+    }
+    if (it != NULL) esp_partition_iterator_release(it);
+  }
 }
 
+void const* board_part_file(uint32_t idx, char name[11], uint32_t* size) {
+  static bool scanned = false;
+  if (!scanned) {
+    scanned = true;
+    part_files_scan();
+  }
+
+  if (idx >= TINYUF2_PART_FILES || _part_files[idx].map == NULL) return NULL;
+  memcpy(name, _part_files[idx].name, 11);
+  *size = _part_files[idx].size;
+  return _part_files[idx].map;
+}
+#endif
+
+#if TINYUF2_CURRENT_UF2_EXTENT
+// Length of the app image in uf2 partition (including checksum and appended hash) from its image header
+uint32_t board_flash_app_size(void) {
+  esp_partition_pos_t const pos = {
+    .offset = _part_app->address,
+    .size   = _part_app->size
+  };
+  esp_image_metadata_t metadata;
+
+  if (ESP_OK != esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &metadata)) return 0;
+  return metadata.image_len;
+}
+#endif
+
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
-  esp_partition_read(_part_ota0, addr, buffer, len);
+#if BOARD_FLASH_WORKER
+  // line in flight is being erased and programmed
+  uint32_t const busy_addr = _fl_lines[_fl == &_fl_lines[0] ? 1 : 0].addr;
+  if (busy_addr != FLASH_CACHE_INVALID_ADDR && addr < busy_addr + FLASH_CACHE_SIZE && busy_addr < addr + len) {
+    flash_worker_wait();
+  }
+#endif
+
+  app_read(addr, buffer, len);
+
+#if FLASH_PSRAM_STAGING
+  if (_stage.buf) stage_read(addr, (uint8_t*) buffer, len);
+#endif
+}
+
+#if TINYUF2_CURRENT_CRC || TINYUF2_APP_FOOTER
+// table driven CRC32 in ROM, same convention as zlib crc32()
+static uint32_t _hash_crc;
+
+void board_hash_init(void) {
+  _hash_crc = 0;
+}
+
+void board_hash_update(void const* data, uint32_t len) {
+  _hash_crc = esp_rom_crc32_le(_hash_crc, (uint8_t const*) data, len);
+}
+
+uint32_t board_hash_final(void) {
+  return _hash_crc;
+}
+#endif
+
+static inline bool block_bit(uint32_t const* mask, uint32_t i) {
+  return mask[i / 32] & (1UL << (i % 32));
+}
+
+// Load current flash contents of blocks [first, last) that were not written, consecutive blocks are
+// read at once
+static void flash_cache_fill(flash_line_t* line, uint32_t first_block, uint32_t last_block) {
+  uint32_t i = first_block;
+  while (i < last_block) {
+    if (block_bit(line->valid, i)) {
+      i++;
+      continue;
+    }
+
+    uint32_t const first = i;
+    while (i < last_block && !block_bit(line->valid, i)) {
+      line->valid[i / 32] |= 1UL << (i % 32);
+      i++;
+    }
+
+    uint32_t const offset = first * FLASH_CACHE_BLOCK_SIZE;
+    app_read(line->addr + offset, line->buf + offset, (i - first) * FLASH_CACHE_BLOCK_SIZE);
+  }
+}
+
+// Check if written blocks of a 4K sector differ from flash, consecutive blocks are read at once
+static bool flash_sector_changed(flash_line_t const* line, uint32_t sector) {
+  uint32_t const last = (sector + 1) * FLASH_SECTOR_BLOCKS;
+  uint32_t i = sector * FLASH_SECTOR_BLOCKS;
+
+  while (i < last) {
+    if (!block_bit(line->dirty, i)) {
+      i++;
+      continue;
+    }
+
+    uint32_t const first = i;
+    while (i < last && block_bit(line->dirty, i)) i++;
+
+    uint32_t const offset = first * FLASH_CACHE_BLOCK_SIZE;
+    uint32_t const count = (i - first) * FLASH_CACHE_BLOCK_SIZE;
+    if (_part_app_map) {
+      // compare against mapped flash directly
+      if (0 != memcmp(line->buf + offset, _part_app_map + line->addr + offset, count)) return true;
+    } else {
+      esp_partition_read(_part_app, line->addr + offset, _fl_verify, count);
+      if (0 != memcmp(line->buf + offset, _fl_verify, count)) return true;
+    }
+  }
+
+  return false;
+}
+
+static void flash_line_flush(flash_line_t* line) {
+  if (line->addr == FLASH_CACHE_INVALID_ADDR) return;
+
+  uint32_t changed = 0;
+  uint32_t changed_count = 0;
+  for (uint32_t s = 0; s < FLASH_SECTOR_COUNT; s++) {
+    if (flash_sector_changed(line, s)) {
+      changed |= 1UL << s;
+      changed_count++;
+    }
+  }
+
+#if FLASH_CACHE_SIZE == FLASH_BLOCK_SIZE
+  // rewrite unchanged sectors as well with a single block erase when that is faster
+  if (changed_count >= FLASH_BLOCK_ERASE_SECTORS) changed = (1UL << FLASH_SECTOR_COUNT) - 1;
+#else
+  (void) changed_count;
+#endif
+
+  // erase & write only runs of modified sectors (erase of a whole 64KB block is faster than 16 sectors)
+  uint32_t s = 0;
+  while (s < FLASH_SECTOR_COUNT) {
+    if (!(changed & (1UL << s))) {
+      s++;
+      continue;
+    }
+
+    uint32_t const first = s;
+    while (s < FLASH_SECTOR_COUNT && (changed & (1UL << s))) s++;
+
+    uint32_t const offset = first * FLASH_SECTOR_SIZE;
+    uint32_t const size = (s - first) * FLASH_SECTOR_SIZE;
+
+    flash_cache_fill(line, first * FLASH_SECTOR_BLOCKS, s * FLASH_SECTOR_BLOCKS);
+
+    TUF2_LOG1("Erase and Write at 0x%08lX (%lu bytes)\r\n", line->addr + offset, size);
+    esp_partition_erase_range(_part_app, line->addr + offset, size);
+    esp_partition_write(_part_app, line->addr + offset, line->buf + offset, size);
+  }
+
+  line->addr = FLASH_CACHE_INVALID_ADDR;
+}
+
+// Flush filled line to start caching another one
+static void flash_line_retire(void) {
+#if BOARD_FLASH_WORKER
+  if (_worker_idle != NULL) {
+    if (_fl->addr == FLASH_CACHE_INVALID_ADDR) return;
+
+    // hand line over to worker once the previous one is done, continue with the other buffer
+    xSemaphoreTake(_worker_idle, portMAX_DELAY);
+    flash_line_t* filled = _fl;
+    _fl = (_fl == &_fl_lines[0]) ? &_fl_lines[1] : &_fl_lines[0];
+    xQueueSend(_worker_queue, &filled, portMAX_DELAY);
+    return;
+  }
+#endif
+
+  flash_line_flush(_fl);
 }
 
 void board_flash_flush(void) {
-  if (_fl_addr == FLASH_CACHE_INVALID_ADDR) return;
+#if FLASH_PSRAM_STAGING
+  if (_stage.buf) {
+    stage_flush();
+    return;
+  }
+#endif
 
-  TUF2_LOG1("Erase and Write at 0x%08lX", _fl_addr);
+#if BOARD_FLASH_WORKER
+  flash_worker_wait();
+#endif
+  flash_line_flush(_fl);
+}
 
-  // Check if contents already matched
-  bool content_matches = true;
-  uint32_t const verify_sz = 4096;
-  uint8_t* verify_buf = malloc(verify_sz);
+bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
+  uint8_t const* src = (uint8_t const*) data;
+  _part_app_written = true;
 
-  for (uint32_t count = 0; count < FLASH_CACHE_SIZE; count += verify_sz) {
-    board_flash_read(_fl_addr + count, verify_buf, verify_sz);
-    if (0 != memcmp(_fl_buf + count, verify_buf, verify_sz)) {
-      content_matches = false;
-      break;
+#if FLASH_PSRAM_STAGING
+  if (_stage.buf) return stage_write(addr, data, len);
+#endif
+
+  // payload may cross cache line boundary
+  while (len) {
+    uint32_t const new_addr = addr & ~(FLASH_CACHE_SIZE - 1);
+    uint32_t const offset = addr & (FLASH_CACHE_SIZE - 1);
+    uint32_t const count = (len < FLASH_CACHE_SIZE - offset) ? len : (FLASH_CACHE_SIZE - offset);
+
+    if (new_addr != _fl->addr) {
+      // with worker, the line in flight (if any) is done once a new one is handed over
+      flash_line_retire();
+
+      _fl->addr = new_addr;
+      // current contents is loaded lazily (on flush) for blocks not written
+      memset(_fl->valid, 0, sizeof(_fl->valid));
+      memset(_fl->dirty, 0, sizeof(_fl->dirty));
     }
+
+    // partial block write: load current contents of the blocks being written first
+    if ((offset | count) & (FLASH_CACHE_BLOCK_SIZE - 1)) {
+      flash_cache_fill(_fl, offset / FLASH_CACHE_BLOCK_SIZE, (offset + count + FLASH_CACHE_BLOCK_SIZE - 1) / FLASH_CACHE_BLOCK_SIZE);
+    }
+
+    memcpy(_fl->buf + offset, src, count);
+
+    for (uint32_t i = offset / FLASH_CACHE_BLOCK_SIZE; i < (offset + count + FLASH_CACHE_BLOCK_SIZE - 1) / FLASH_CACHE_BLOCK_SIZE; i++) {
+      _fl->valid[i / 32] |= 1UL << (i % 32);
+      _fl->dirty[i / 32] |= 1UL << (i % 32);
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
   }
-  free(verify_buf);
+
+  return true;
+}
+
+// Cache lines (and PSRAM staging) are assembled with current contents of blocks not written
+bool board_flash_preserved(uint32_t addr, uint32_t len) {
+  (void) addr;
+  (void) len;
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Data partition family
+//--------------------------------------------------------------------+
+
+#ifdef BOARD_UF2_DATA_FAMILY_ID
+static void data_flash_flush(void) {
+  if (_data_addr == FLASH_CACHE_INVALID_ADDR) return;
+
+  // compare with current partition contents, verify buffer is shared with the ota0 cache (one sector)
+#if BOARD_FLASH_WORKER
+  flash_worker_wait();
+#endif
+  esp_partition_read(_part_data, _data_addr, _fl_verify, DATA_CACHE_SIZE);
+  bool const content_matches = (0 == memcmp(_data_buf, _fl_verify, DATA_CACHE_SIZE));
 
   // skip erase & write if content already matches
   if (!content_matches) {
-    esp_partition_erase_range(_part_ota0, _fl_addr, FLASH_CACHE_SIZE);
-    esp_partition_write(_part_ota0, _fl_addr, _fl_buf, FLASH_CACHE_SIZE);
+    // program without erase if new content only clears bits, saves an erase cycle of the sector for
+    // data that is appended to or cleared in place. Encrypted flash data can't be programmed over
+    bool need_erase = _part_data->encrypted;
+    for (uint32_t i = 0; !need_erase && i < DATA_CACHE_SIZE; i += 4) {
+      uint32_t const current = *(uint32_t const*) ((void const*) (_fl_verify + i));
+      uint32_t const update = *(uint32_t const*) ((void const*) (_data_buf + i));
+      need_erase = (current & update) != update;
+    }
+
+    if (need_erase) {
+      TUF2_LOG1("Erase and Write data at 0x%08lX", _data_addr);
+#if TINYUF2_WEAR_LOG
+      uint32_t const t_erase = uf2_stats_now();
+#endif
+      esp_partition_erase_range(_part_data, _data_addr, DATA_CACHE_SIZE);
+#if TINYUF2_WEAR_LOG
+      uf2_wear_erase(_data_addr / DATA_CACHE_SIZE, uf2_stats_now() - t_erase);
+#endif
+    } else {
+      TUF2_LOG1("Write data at 0x%08lX", _data_addr);
+    }
+    esp_partition_write(_part_data, _data_addr, _data_buf, DATA_CACHE_SIZE);
   }
 
-  _fl_addr = FLASH_CACHE_INVALID_ADDR;
+  _data_addr = FLASH_CACHE_INVALID_ADDR;
 }
 
-bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
-  uint32_t new_addr = addr & ~(FLASH_CACHE_SIZE - 1);
+static bool data_flash_write(uint32_t addr, void const* data, uint32_t len) {
+  if (_part_data == NULL || addr + len > _part_data->size) return false;
 
-  if (new_addr != _fl_addr) {
-    board_flash_flush();
+  uint8_t const* src = (uint8_t const*) data;
 
-    _fl_addr = new_addr;
-    board_flash_read(new_addr, _fl_buf, FLASH_CACHE_SIZE);
-  }
+  // payload may cross sector boundary
+  while (len) {
+    uint32_t const new_addr = addr & ~(DATA_CACHE_SIZE - 1);
+    uint32_t const offset = addr & (DATA_CACHE_SIZE - 1);
+    uint32_t const count = (len < DATA_CACHE_SIZE - offset) ? len : (DATA_CACHE_SIZE - offset);
+
+    if (new_addr != _data_addr) {
+      data_flash_flush();
+
+      _data_addr = new_addr;
+      esp_partition_read(_part_data, new_addr, _data_buf, DATA_CACHE_SIZE);
+    }
 
-  memcpy(_fl_buf + (addr & (FLASH_CACHE_SIZE - 1)), data, len);
+    memcpy(_data_buf + offset, src, count);
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
 
   return true;
 }
 
+static board_uf2_family_t const _uf2_families[] = {
+  { .family_id = BOARD_UF2_DATA_FAMILY_ID, .write = data_flash_write, .flush = data_flash_flush },
+};
+
+board_uf2_family_t const* board_uf2_families(uint32_t* count) {
+  *count = sizeof(_uf2_families) / sizeof(_uf2_families[0]);
+  return _uf2_families;
+}
+#endif
+
+// Reset reason hint telling 2nd stage bootloader that the selected image is just verified, must
+// match ports/espressif/components/bootloader/subproject/main/bootloader_start.c
+#define UF2_VERIFIED_RESET_HINT   0x11F3
+
+void board_flash_boot_app(void) {
+#if BOARD_FLASH_OTA_AB
+  // nothing uploaded (e.g reset request only): keep booting the current image
+  if (!_part_app_written) return;
+#endif
+
+  // image is verified, an invalid (incomplete) upload leaves the previous image selected with A/B
+  if (ESP_OK == esp_ota_set_boot_partition(_part_app)) {
+    // first boot of the image can skip the hash check in bootloader
+    if (_part_app_written) {
+      (void) esp_reset_reason(); // required to link esp_reset_reason_set_hint()
+      esp_reset_reason_set_hint((esp_reset_reason_t) UF2_VERIFIED_RESET_HINT);
+    }
+  } else {
+    TUF2_LOG1("Invalid image in %s\r\n", _part_app->label);
+  }
+}
+
+// erase in 64KB steps, esp_partition_erase_range() uses block erase for aligned ranges
+#define FLASH_ERASE_STEP    (64*1024)
+
+// erase extent of image in partition, whole partition if headers are not valid
+static void erase_partition_image(esp_partition_t const* part) {
+  esp_partition_pos_t const pos = {
+    .offset = part->address,
+    .size   = part->size
+  };
+  esp_image_metadata_t metadata;
+  uint32_t len = part->size;
+
+  if (ESP_OK == esp_image_get_metadata(&pos, &metadata) && metadata.image_len < len) {
+    len = (metadata.image_len + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1UL);
+  }
+
+  TUF2_LOG1("Erase %s: %lu KB\r\n", part->label, len / 1024);
+
+  for (uint32_t offset = 0; offset < len; offset += FLASH_ERASE_STEP) {
+    uint32_t const size = (len - offset < FLASH_ERASE_STEP) ? (len - offset) : FLASH_ERASE_STEP;
+    esp_partition_erase_range(part, offset, size);
+
+    // let idle task run and feed the task watchdog between blocks
+    vTaskDelay(1);
+  }
+}
+
+void board_flash_erase_app(void) {
+  // cached contents belong to the application being wiped
+#if BOARD_FLASH_WORKER
+  flash_worker_wait();
+#endif
+  _fl->addr = FLASH_CACHE_INVALID_ADDR;
+#if FLASH_PSRAM_STAGING
+  if (_stage.buf) stage_clear();
+#endif
+
+  erase_partition_image(_part_app);
+
+#if BOARD_FLASH_OTA_AB
+  // image in the other slot is still bootable, wipe it as well
+  esp_partition_t const* other = esp_ota_get_next_update_partition(_part_app);
+  if (other != NULL && other != _part_app) erase_partition_image(other);
+#endif
+}
+
 bool board_flash_protect_bootloader(bool protect) {
   // TODO implement later
   (void) protect;
@@ -105,6 +923,35 @@ bool board_flash_protect_bootloader(bool protect) {
 }
 
 
+//--------------------------------------------------------------------+
+// Data LUN
+//--------------------------------------------------------------------+
+
+#if TINYUF2_DATA_LUN
+// data LUN is the first fat partition (ffat), the volume the application mounts with esp_vfs_fat
+static esp_partition_t const* _part_fat = NULL;
+
+bool board_data_init(uint32_t* size) {
+  _part_fat = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT, NULL);
+  if (!_part_fat) return false;
+
+  *size = _part_fat->size;
+  return true;
+}
+
+bool board_data_read(uint32_t offset, void* buffer, uint32_t len) {
+  return esp_partition_read(_part_fat, offset, buffer, len) == ESP_OK;
+}
+
+bool board_data_erase(uint32_t offset, uint32_t len) {
+  return esp_partition_erase_range(_part_fat, offset, len) == ESP_OK;
+}
+
+bool board_data_program(uint32_t offset, void const* data, uint32_t len) {
+  return esp_partition_write(_part_fat, offset, data, len) == ESP_OK;
+}
+#endif
+
 //--------------------------------------------------------------------+
 // Self Update
 //--------------------------------------------------------------------+
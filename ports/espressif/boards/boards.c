@@ -43,6 +43,7 @@
 
 #ifndef TINYUF2_SELF_UPDATE
 #include "tusb.h"
+#include "uf2.h"
 #endif
 
 //--------------------------------------------------------------------+
@@ -84,6 +85,15 @@ ledc_channel_config_t ledc_channel = {
 #include "lcd.h"
 #endif
 
+// Board specific bring-up in two phases:
+// - board_init_app_extension() (BOARD_INIT_CUSTOM_APP) from board_init(): what the application
+//   relies on being done before it is started, e.g PMU rails it does not configure itself
+// - board_init_extension() (BOARD_INIT_CUSTOM) from board_dfu_init(): peripherals only used in DFU
+//   mode (PMU rails for display/storage, display), skipped when the application is started
+#if BOARD_INIT_CUSTOM_APP
+extern bool board_init_app_extension();
+#endif
+
 #if BOARD_INIT_CUSTOM
 extern bool board_init_extension();
 #endif
@@ -114,9 +124,25 @@ static StaticTask_t usb_device_taskdef;
 void usb_device_task(void* param) {
   (void) param;
 
+#if TINYUF2_DEFER_FLASH_INIT
+  // usb was started by main(), events queue up meanwhile
+  uf2_deferred_init_task();
+#endif
+
   // RTOS forever loop
   while (1) {
+#if TINYUF2_ASYNC_WRITE || TINYUF2_PRE_ERASE || TINYUF2_IDLE_COMPLETE || TINYUF2_READ_AHEAD || CFG_TUD_VENDOR || CFG_TUD_DFU || TINYUF2_CDC_FLASH || TINYUF2_LOG_DEFER
+    // wake up periodically to program queued uf2 blocks, prefetch MSC reads, raw flash, DFU and CDC data, print deferred log
+    tud_task_ext(1, false);
+    msc_write_task();
+    msc_read_task();
+    vendor_task();
+    dfu_task();
+    cdc_task();
+    log_task();
+#else
     tud_task();
+#endif
   }
 }
 
@@ -124,8 +150,14 @@ void app_main(void) {
   main();
 
   // Create a task for tinyusb device stack
+#if BOARD_FLASH_WORKER && !CONFIG_FREERTOS_UNICORE
+  // flash worker runs on core 1
+  (void) xTaskCreateStaticPinnedToCore(usb_device_task, "usbd", USBD_STACK_SIZE, NULL, configMAX_PRIORITIES - 2,
+                                       usb_device_stack, &usb_device_taskdef, 0);
+#else
   (void) xTaskCreateStatic(usb_device_task, "usbd", USBD_STACK_SIZE, NULL, configMAX_PRIORITIES - 2, usb_device_stack,
                            &usb_device_taskdef);
+#endif
 }
 
 #endif
@@ -224,12 +256,21 @@ void board_init(void) {
   gpio_set_level(NEOPIXEL_POWER_PIN, NEOPIXEL_POWER_STATE);
   #endif
 
+  #if BOARD_NEOPIXEL_SPI
+  // WS2812 Neopixel driver with SPI peripheral (DMA): encoded by table, refresh does not wait for transfer
+  led_strip_spi_config_t spi_config = {
+      .clk_src = SPI_CLK_SRC_DEFAULT,
+      .spi_bus = SPI2_HOST,
+      .flags.with_dma = true,
+  };
+  #else
   // WS2812 Neopixel driver with RMT peripheral
   led_strip_rmt_config_t rmt_config = {
       .clk_src = RMT_CLK_SRC_DEFAULT, // different clock source can lead to different power consumption
       .resolution_hz = 10 * 1000 * 1000,  // RMT counter clock frequency, default = 10 Mhz
       .flags.with_dma = false,        // DMA feature is available on ESP target like ESP32-S3
   };
+  #endif
 
   led_strip_config_t strip_config = {
       .strip_gpio_num = NEOPIXEL_PIN,           // The GPIO that connected to the LED strip's data line
@@ -239,7 +280,11 @@ void board_init(void) {
       .flags.invert_out = false,                // whether to invert the output signal
   };
 
+  #if BOARD_NEOPIXEL_SPI
+  ESP_ERROR_CHECK(led_strip_new_spi_device(&strip_config, &spi_config, &led_strip));
+  #else
   ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip));
+  #endif
 
   led_strip_clear(led_strip); // off
 #endif
@@ -248,8 +293,8 @@ void board_init(void) {
   dotstar_init();
 #endif
 
-#if BOARD_INIT_CUSTOM
-  board_init_extension();
+#if BOARD_INIT_CUSTOM_APP
+  board_init_app_extension();
 #endif
 
   // Set up timer
@@ -267,6 +312,11 @@ void board_dfu_init(void) {
   };
   usb_hal_init(&hal);
   configure_pins(&hal);
+
+#if BOARD_INIT_CUSTOM
+  // DFU mode is confirmed, bring up PMU rails and display
+  board_init_extension();
+#endif
 }
 
 void board_reset(void) {
@@ -274,8 +324,8 @@ void board_reset(void) {
 }
 
 void board_dfu_complete(void) {
-  // Set partition OTA0 as bootable and reset
-  esp_ota_set_boot_partition(esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL));
+  // Set partition written by uf2 as bootable and reset
+  board_flash_boot_app();
   esp_restart();
 }
 
@@ -30,6 +30,7 @@
 #endif
 
 #include "sdkconfig.h"
+#include "esp_attr.h"
 #include "board.h"
 
 // Family ID for updating Application
@@ -48,6 +49,46 @@
 // Double Reset tap to enter DFU, for ESP this is done in bootloader subproject
 #define TINYUF2_DBL_TAP_DFU     0
 
+// Write uf2 to the ota slot not selected for boot (A/B) instead of always ota0. The slot is selected
+// on completion only if its image is valid, the previous image remains in the other slot for rollback.
+// Requires a partition table with ota_0 and ota_1
+#ifndef BOARD_FLASH_OTA_AB
+#define BOARD_FLASH_OTA_AB      0
+#endif
+
+// Flush a filled flash cache line from a worker task on the second core (lower priority task on single
+// core) while usb receives the next line into a second buffer. Costs another cache line of RAM (PSRAM if
+// available), flush stays synchronous if it can't be allocated
+#ifndef BOARD_FLASH_WORKER
+#define BOARD_FLASH_WORKER      0
+#endif
+
+// Stage everything written to the app partition in PSRAM at usb speed, flush programs it in ascending
+// order with one 64KB block erase per changed block. A staged image starting at offset 0 is checked in
+// RAM first (header, checksum, appended SHA-256): flash is left untouched if it is not a valid app.
+// Requires CONFIG_SPIRAM with room for the partition, cache lines are used otherwise
+#ifndef BOARD_FLASH_PSRAM_STAGING
+#define BOARD_FLASH_PSRAM_STAGING 0
+#endif
+
+// Drive neopixel strip with SPI2 (DMA) instead of RMT: refresh is queued and returns immediately, cost
+// does not grow with NEOPIXEL_NUMBER. SPI2 must not be used by the board (e.g display)
+#ifndef BOARD_NEOPIXEL_SPI
+#define BOARD_NEOPIXEL_SPI      0
+#endif
+
+// Raw read-only file per partition (NVS.BIN, OTA_0.BIN, FFAT.BIN ...) served from its mmap'd view,
+// enough for the partition tables in this port
+#ifndef TINYUF2_PART_FILES
+#define TINYUF2_PART_FILES      6
+#endif
+
+// DFU-only state goes to the IDF .noinit section, not zeroed by the startup code
+#define TUF2_DFU_NOINIT         __NOINIT_ATTR
+
+// Select partition written by uf2 for boot
+void board_flash_boot_app(void);
+
 #ifdef DISPLAY_PIN_SCK
  #define TINYUF2_DISPLAY 1
 #endif
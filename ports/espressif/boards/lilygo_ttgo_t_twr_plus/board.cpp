@@ -105,6 +105,9 @@ int pmu_register_write_byte(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uin
     return ret == ESP_OK ? 0 : -1;
 }
 
+static bool _pmu_ready = false;
+
+// Run from board_dfu_init(): PMU rails and OLED are only needed in DFU mode, application sets up its own
 extern "C" bool board_init_extension()
 {
   SSD1306_t dev;
@@ -124,6 +127,7 @@ extern "C" bool board_init_extension()
   if (PMU.begin(AXP2101_SLAVE_ADDRESS, pmu_register_read, pmu_register_write_byte)) {
 
     ESP_LOGI(TAG, "Init PMU SUCCESS!");
+    _pmu_ready = true;
 
     //Turn off not use power channel
     PMU.disableDC2();
@@ -198,3 +202,20 @@ extern "C" bool board_init_extension()
 
   return true;
 }
+
+// Battery percentage below which flashing without VBUS is treated as low power
+#ifndef BOARD_BATTERY_LOW_PERCENT
+#define BOARD_BATTERY_LOW_PERCENT  20
+#endif
+
+// Polled by the write engine: PMU status is read at most once a second, polls in between are
+// answered from the snapshot without i2c access
+extern "C" bool board_power_low(void)
+{
+  if (!_pmu_ready || !PMU.beginSnapshot(esp_log_timestamp(), 1000)) return false;
+
+  bool const low = !PMU.isVbusIn() && PMU.isBatteryConnect() &&
+                   PMU.getBatteryPercent() < BOARD_BATTERY_LOW_PERCENT;
+  PMU.endSnapshot();
+  return low;
+}
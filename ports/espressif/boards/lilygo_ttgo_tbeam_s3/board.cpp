@@ -19,6 +19,12 @@
 #ifdef CONFIG_XPOWERS_CHIP_AXP2102
 
 #define XPOWERS_CHIP_AXP2102
+
+// register accesses call the i2c functions below directly instead of through callbacks
+int pmu_register_read(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t len);
+int pmu_register_write_byte(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t len);
+#define XPOWERS_BUS_POLICY XPowersCallbackBus<pmu_register_read, pmu_register_write_byte>
+
 #include "XPowersLib.h"
 static const char *TAG = "AXP2101";
 
@@ -45,7 +51,8 @@ static XPowersPMU PMU;
 #define NACK_VAL                        (i2c_ack_type_t)0x1         /*!< I2C nack value */
 
 /**
- * @brief Read a sequence of bytes from a pmu registers
+ * @brief Read a sequence of bytes from a pmu registers, register address and data in one
+ *        transaction (repeated start)
  */
 int pmu_register_read(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t len)
 {
@@ -61,14 +68,6 @@ int pmu_register_read(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t l
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, (devAddr << 1) | WRITE_BIT, ACK_CHECK_EN);
     i2c_master_write_byte(cmd, regAddr, ACK_CHECK_EN);
-    i2c_master_stop(cmd);
-    esp_err_t ret =  i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "PMU i2c_master_cmd_begin FAILED! > ");
-        return ESP_FAIL;
-    }
-    cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, (devAddr << 1) | READ_BIT, ACK_CHECK_EN);
     if (len > 1) {
@@ -76,7 +75,7 @@ int pmu_register_read(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t l
     }
     i2c_master_read_byte(cmd, &data[len - 1], NACK_VAL);
     i2c_master_stop(cmd);
-    ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
+    esp_err_t ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
     i2c_cmd_link_delete(cmd);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "PMU READ FAILED! > ");
@@ -106,9 +105,13 @@ int pmu_register_write_byte(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uin
     return ret == ESP_OK ? 0 : -1;
 }
 
+static SSD1306_t dev;
+static bool _oled_ready = false;
+static bool _pmu_ready = false;
+
+// Run from board_dfu_init(): PMU rails and OLED are only needed in DFU mode, application sets up its own
 extern "C" bool board_init_extension()
 {
-  SSD1306_t dev;
 
   i2c_config_t i2c_conf ;
   memset(&i2c_conf, 0, sizeof(i2c_conf));
@@ -122,9 +125,13 @@ extern "C" bool board_init_extension()
   i2c_driver_install(I2C_MASTER_NUM, i2c_conf.mode,
                      I2C_MASTER_RX_BUF_DISABLE, I2C_MASTER_TX_BUF_DISABLE, 0);
 
-  if (PMU.begin(AXP2101_SLAVE_ADDRESS, pmu_register_read, pmu_register_write_byte)) {
+  if (PMU.begin(AXP2101_SLAVE_ADDRESS)) {
 
     ESP_LOGI(TAG, "Init PMU SUCCESS!");
+    _pmu_ready = true;
+
+    // stage the whole configuration, each register is read and written once
+    PMU.beginTransaction();
 
     //Turn off not use power channel
     PMU.disableDC2();
@@ -156,6 +163,10 @@ extern "C" bool board_init_extension()
     PMU.setBLDO1Voltage(3300);
     PMU.enableBLDO1();
 
+    if (!PMU.endTransaction()) {
+      ESP_LOGE(TAG, "PMU configuration FAILED!");
+    }
+
     // use X axis offset for SH1106 OLED
     dev._offset = CONFIG_OFFSETX;
 
@@ -189,8 +200,43 @@ extern "C" bool board_init_extension()
   ssd1306_display_text(&dev, 1, "  T-Beam  Boot  ", 16, true);
   ssd1306_display_text(&dev, 4, "Put UF2 firmware", 16, false);
   ssd1306_display_text(&dev, 6, "on " UF2_VOLUME_LABEL " Vol", 16, false);
+  _oled_ready = true;
 
   //ssd1306_clear_line(&dev, 5, false);
 
   return true;
 }
+
+// Progress bar on the bottom page, only newly filled columns are sent to the OLED
+extern "C" void board_write_progress(uint32_t done, uint32_t total)
+{
+  static uint8_t bar[128];
+  static uint32_t filled = 0;
+
+  if (!_oled_ready || !total) return;
+
+  uint32_t width = (done >= total) ? sizeof(bar) : (done * sizeof(bar)) / total;
+  if (width == filled) return;
+
+  filled = width;
+  memset(bar, 0x7E, width);
+  memset(bar + width, 0x00, sizeof(bar) - width);
+  ssd1306_display_image(&dev, 7, 0, bar, sizeof(bar));
+}
+
+// Battery percentage below which flashing without VBUS is treated as low power
+#ifndef BOARD_BATTERY_LOW_PERCENT
+#define BOARD_BATTERY_LOW_PERCENT  20
+#endif
+
+// Polled by the write engine: PMU status is read at most once a second, polls in between are
+// answered from the snapshot without i2c access
+extern "C" bool board_power_low(void)
+{
+  if (!_pmu_ready || !PMU.beginSnapshot(esp_log_timestamp(), 1000)) return false;
+
+  bool const low = !PMU.isVbusIn() && PMU.isBatteryConnect() &&
+                   PMU.getBatteryPercent() < BOARD_BATTERY_LOW_PERCENT;
+  PMU.endSnapshot();
+  return low;
+}
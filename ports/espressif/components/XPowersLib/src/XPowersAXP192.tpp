@@ -1987,6 +1987,18 @@ protected:
         return (bool)(readRegister(XPOWERS_AXP192_LDO23_DC123_EXT_CTL) & val);
     }
 
+    // Status and ADC registers read by beginSnapshot()
+    const XPowersSnapshotRange_t *getSnapshotRangesImpl(uint8_t &count) const
+    {
+        static const XPowersSnapshotRange_t ranges[] = {
+            {XPOWERS_AXP192_STATUS, 2},             // STATUS, MODE_CHGSTATUS
+            {XPOWERS_AXP192_ACIN_VOL_H8, 8},        // acin and vbus voltage, current
+            {XPOWERS_AXP192_BAT_AVERVOL_H8, 8},     // battery voltage, currents, aps voltage
+        };
+        count = sizeof(ranges) / sizeof(ranges[0]);
+        return ranges;
+    }
+
     bool initImpl()
     {
         if (getChipID() == XPOWERS_AXP192_CHIP_ID) {
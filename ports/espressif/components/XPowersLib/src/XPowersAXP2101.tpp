@@ -2942,6 +2942,18 @@ protected:
         return false;
     }
 
+    // Status and ADC registers read by beginSnapshot()
+    const XPowersSnapshotRange_t *getSnapshotRangesImpl(uint8_t &count) const
+    {
+        static const XPowersSnapshotRange_t ranges[] = {
+            {XPOWERS_AXP2101_STATUS1, 2},           // STATUS1, STATUS2
+            {XPOWERS_AXP2101_ADC_DATA_RELUST0, 10}, // battery, TS, vbus, system voltage, temperature
+            {XPOWERS_AXP2101_BAT_PERCENT_DATA, 1},
+        };
+        count = sizeof(ranges) / sizeof(ranges[0]);
+        return ranges;
+    }
+
     bool initImpl()
     {
         if (getChipID() == XPOWERS_AXP2101_CHIP_ID) {
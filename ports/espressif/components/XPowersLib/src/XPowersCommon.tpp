@@ -49,6 +49,16 @@
 
 
 #define XPOWERS_ATTR_NOT_IMPLEMENTED    __attribute__((error("Not implemented")))
+
+// Number of registers staged by a register transaction, see beginTransaction()
+#ifndef XPOWERS_SHADOW_REG_COUNT
+#define XPOWERS_SHADOW_REG_COUNT        16
+#endif
+
+// Bytes of status and ADC registers held by a snapshot, see beginSnapshot()
+#ifndef XPOWERS_SNAPSHOT_SIZE
+#define XPOWERS_SNAPSHOT_SIZE           24
+#endif
 #define IS_BIT_SET(val,mask)            (((val)&(mask)) == (mask))
 
 #if !defined(ARDUINO)
@@ -72,10 +82,74 @@
 
 #endif
 
-template <class chipType>
+typedef int (*XPowersIicCallback_t)(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t len);
+
+// Block of consecutive registers read by a snapshot
+typedef struct {
+    uint8_t reg;
+    uint8_t len;
+} XPowersSnapshotRange_t;
+
+/*
+ * I2C bus policies, second template parameter of XPowersCommon. A policy has static read() and
+ * write() transferring len bytes from/to consecutive registers, returning 0 on success. Register
+ * accessors call it directly so they inline into the bus transactions of the board.
+ *
+ * XPowersRuntimeBus is the default: callbacks given to begin() or an Arduino TwoWire, chosen at run
+ * time. A board selects another policy before including XPowersLib.h, e.g for its own I2C functions:
+ *   #define XPOWERS_BUS_POLICY XPowersCallbackBus<pmu_register_read, pmu_register_write>
+ */
+struct XPowersRuntimeBus {};
+
+// board I2C functions fixed at compile time, e.g ESP-IDF i2c driver or software I2C
+template <XPowersIicCallback_t readFn, XPowersIicCallback_t writeFn>
+struct XPowersCallbackBus
+{
+    static inline int read(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+    {
+        return readFn(addr, reg, buf, len);
+    }
+
+    static inline int write(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+    {
+        return writeFn(addr, reg, buf, len);
+    }
+};
+
+#if defined(ARDUINO)
+// a TwoWire instance fixed at compile time, e.g XPowersWireBus<Wire>
+template <TwoWire &wire>
+struct XPowersWireBus
+{
+    static int read(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+    {
+        wire.beginTransmission(addr);
+        wire.write(reg);
+        if (wire.endTransmission(false) != 0) {
+            return -1;
+        }
+        wire.requestFrom(addr, len);
+        return wire.readBytes(buf, len) == len ? 0 : -1;
+    }
+
+    static int write(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+    {
+        wire.beginTransmission(addr);
+        wire.write(reg);
+        wire.write(buf, len);
+        return (wire.endTransmission() == 0) ? 0 : -1;
+    }
+};
+#endif
+
+#ifndef XPOWERS_BUS_POLICY
+#define XPOWERS_BUS_POLICY              XPowersRuntimeBus
+#endif
+
+template <class chipType, class busType = XPOWERS_BUS_POLICY>
 class XPowersCommon
 {
-    typedef int (*iic_fptr_t)(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint8_t len);
+    typedef XPowersIicCallback_t iic_fptr_t;
 
 public:
 
@@ -91,6 +165,15 @@ public:
     }
 #endif
 
+    // bus given by a compile-time policy
+    bool begin(uint8_t addr)
+    {
+        if (__has_init)return thisChip().initImpl();
+        __has_init = true;
+        __addr = addr;
+        return thisChip().initImpl();
+    }
+
     bool begin(uint8_t addr, iic_fptr_t readRegCallback, iic_fptr_t writeRegCallback)
     {
         if (__has_init)return thisChip().initImpl();
@@ -101,78 +184,122 @@ public:
         return thisChip().initImpl();
     }
 
+    /*
+     * Register transaction: between beginTransaction() and endTransaction() each register is read
+     * once into a shadow, bit changes and writes are merged there and every modified register is
+     * written once by endTransaction(), in the order of their last modification so that e.g. a
+     * voltage setting still lands before the enable that followed it. Meant for configuration
+     * sequences: status registers are not refreshed while a transaction is open.
+     */
+    void beginTransaction()
+    {
+        __txn_active = true;
+        __txn_count = 0;
+        __txn_seq = 0;
+    }
+
+    bool endTransaction()
+    {
+        bool ok = flushTransaction();
+        __txn_active = false;
+        __txn_count = 0;
+        return ok;
+    }
+
+    /*
+     * Status snapshot: beginSnapshot() burst reads the status and ADC register blocks of the chip
+     * (getSnapshotRangesImpl()) unless the last snapshot is younger than maxAge, now and maxAge
+     * being in any unit e.g ms. Until endSnapshot() reads of those registers are served from it, so
+     * that isVbusIn(), isCharging(), getBattVoltage(), getBatteryPercent() etc. of a polling loop
+     * cost no bus access. Calls on the chip type (e.g XPowersPMU) rather than XPowersLibInterface
+     * are not virtual. Any register write drops the snapshot.
+     */
+    bool beginSnapshot(uint32_t now, uint32_t maxAge)
+    {
+        if (!__snap_valid || (uint32_t)(now - __snap_stamp) >= maxAge) {
+            if (!readSnapshot()) {
+                return false;
+            }
+            __snap_stamp = now;
+        }
+        __snap_active = true;
+        return true;
+    }
+
+    void endSnapshot()
+    {
+        __snap_active = false;
+    }
+
     int readRegister(uint8_t reg)
     {
-        uint8_t val = 0;
-        if (thisReadRegCallback) {
-            if (thisReadRegCallback(__addr, reg, &val, 1) != 0) {
-                return 0;
+        if (__snap_active && __snap_valid) {
+            int val = snapshotFind(reg);
+            if (val != -1) {
+                return val;
             }
-            return val;
         }
-#if defined(ARDUINO)
-        if (__wire) {
-            __wire->beginTransmission(__addr);
-            __wire->write(reg);
-            if (__wire->endTransmission() != 0) {
-                return -1;
+        if (__txn_active) {
+            XPowersShadowReg_t *shadow = shadowFind(reg);
+            if (shadow) {
+                return shadow->val;
             }
-            __wire->requestFrom(__addr, 1U);
-            return __wire->read();
+            int val = readRegisterBus(reg);
+            if (val != -1) {
+                shadowAdd(reg, (uint8_t)val);
+            }
+            return val;
         }
-#endif
-        return -1;
+        return readRegisterBus(reg);
     }
 
     int writeRegister(uint8_t reg, uint8_t val)
     {
-        if (thisWriteRegCallback) {
-            return thisWriteRegCallback(__addr, reg, &val, 1);
-        }
-#if defined(ARDUINO)
-        if (__wire) {
-            __wire->beginTransmission(__addr);
-            __wire->write(reg);
-            __wire->write(val);
-            return (__wire->endTransmission() == 0) ? 0 : -1;
+        if (__txn_active) {
+            XPowersShadowReg_t *shadow = shadowFind(reg);
+            if (!shadow) {
+                shadow = shadowAdd(reg, val);
+            }
+            if (!shadow) {
+                // shadow is full, write through
+                return writeRegisterBus(reg, val);
+            }
+            shadow->val = val;
+            shadow->dirty = true;
+            shadow->seq = ++__txn_seq;
+            return 0;
         }
-#endif
-        return -1;
+        return writeRegisterBus(reg, val);
+    }
+
+    // Single register bus access, bypasses an open transaction
+    int readRegisterBus(uint8_t reg)
+    {
+        return readRegisterBus(reg, (busType *)NULL);
+    }
+
+    int writeRegisterBus(uint8_t reg, uint8_t val)
+    {
+        __snap_valid = false;
+        return busWrite(reg, &val, 1, (busType *)NULL);
     }
 
     int readRegister(uint8_t reg, uint8_t *buf, uint8_t length)
     {
-        if (thisReadRegCallback) {
-            return thisReadRegCallback(__addr, reg, buf, length);
+        // block access bypasses the shadow, staged writes must land first
+        if (__txn_active && !flushTransaction()) {
+            return -1;
         }
-#if defined(ARDUINO)
-        if (__wire) {
-            __wire->beginTransmission(__addr);
-            __wire->write(reg);
-            if (__wire->endTransmission() != 0) {
-                return -1;
-            }
-            __wire->requestFrom(__addr, length);
-            return __wire->readBytes(buf, length) == length ? 0 : -1;
-        }
-#endif
-        return -1;
+        return busRead(reg, buf, length, (busType *)NULL);
     }
 
     int writeRegister(uint8_t reg, uint8_t *buf, uint8_t length)
     {
-        if (thisWriteRegCallback) {
-            return thisWriteRegCallback(__addr, reg, buf, length);
-        }
-#if defined(ARDUINO)
-        if (__wire) {
-            __wire->beginTransmission(__addr);
-            __wire->write(reg);
-            __wire->write(buf, length);
-            return (__wire->endTransmission() == 0) ? 0 : -1;
+        if (__txn_active && !flushTransaction()) {
+            return -1;
         }
-#endif
-        return -1;
+        __snap_valid = false;
+        return busWrite(reg, buf, length, (busType *)NULL);
     }
 
 
@@ -205,33 +332,29 @@ public:
 
     uint16_t inline readRegisterH8L4(uint8_t highReg, uint8_t lowReg)
     {
-        int h8 = readRegister(highReg);
-        int l4 = readRegister(lowReg);
-        if (h8 == -1 || l4 == -1)return 0;
+        int h8, l4;
+        if (!readRegisterPair(highReg, lowReg, h8, l4))return 0;
         return (h8 << 4) | (l4 & 0x0F);
     }
 
     uint16_t inline readRegisterH8L5(uint8_t highReg, uint8_t lowReg)
     {
-        int h8 = readRegister(highReg);
-        int l5 = readRegister(lowReg);
-        if (h8 == -1 || l5 == -1)return 0;
+        int h8, l5;
+        if (!readRegisterPair(highReg, lowReg, h8, l5))return 0;
         return (h8 << 5) | (l5 & 0x1F);
     }
 
     uint16_t inline readRegisterH6L8(uint8_t highReg, uint8_t lowReg)
     {
-        int h6 = readRegister(highReg);
-        int l8 = readRegister(lowReg);
-        if (h6 == -1 || l8 == -1)return 0;
+        int h6, l8;
+        if (!readRegisterPair(highReg, lowReg, h6, l8))return 0;
         return ((h6 & 0x3F) << 8) | l8;
     }
 
     uint16_t inline readRegisterH5L8(uint8_t highReg, uint8_t lowReg)
     {
-        int h5 = readRegister(highReg);
-        int l8 = readRegister(lowReg);
-        if (h5 == -1 || l8 == -1)return 0;
+        int h5, l8;
+        if (!readRegisterPair(highReg, lowReg, h5, l8))return 0;
         return ((h5 & 0x1F) << 8) | l8;
     }
 
@@ -240,6 +363,200 @@ public:
      */
 protected:
 
+    // Two registers of a value, one block read when they are adjacent (ADC results are)
+    bool readRegisterPair(uint8_t highReg, uint8_t lowReg, int &high, int &low)
+    {
+        if (__snap_active && __snap_valid) {
+            high = snapshotFind(highReg);
+            low = snapshotFind(lowReg);
+            if (high != -1 && low != -1) {
+                return true;
+            }
+        }
+        if (!__txn_active && lowReg == highReg + 1) {
+            uint8_t buf[2];
+            if (busRead(highReg, buf, 2, (busType *)NULL) != 0) {
+                return false;
+            }
+            high = buf[0];
+            low = buf[1];
+            return true;
+        }
+        high = readRegister(highReg);
+        low = readRegister(lowReg);
+        return high != -1 && low != -1;
+    }
+
+    // Burst read of the snapshot ranges of the chip
+    bool readSnapshot()
+    {
+        uint8_t count = 0;
+        const XPowersSnapshotRange_t *ranges = thisChip().getSnapshotRangesImpl(count);
+        uint8_t pos = 0;
+
+        __snap_valid = false;
+        for (uint8_t i = 0; i < count; i++) {
+            if (pos + ranges[i].len > XPOWERS_SNAPSHOT_SIZE) {
+                return false;
+            }
+            if (busRead(ranges[i].reg, &__snap_buf[pos], ranges[i].len, (busType *)NULL) != 0) {
+                return false;
+            }
+            pos += ranges[i].len;
+        }
+        __snap_valid = true;
+        return true;
+    }
+
+    // Register value from snapshot, -1 if not covered
+    int snapshotFind(uint8_t reg)
+    {
+        uint8_t count = 0;
+        const XPowersSnapshotRange_t *ranges = thisChip().getSnapshotRangesImpl(count);
+        uint8_t pos = 0;
+
+        for (uint8_t i = 0; i < count; i++) {
+            if (reg >= ranges[i].reg && reg < ranges[i].reg + ranges[i].len) {
+                return __snap_buf[pos + reg - ranges[i].reg];
+            }
+            pos += ranges[i].len;
+        }
+        return -1;
+    }
+
+    // Compile-time bus policy
+    template <class policyType>
+    int readRegisterBus(uint8_t reg, policyType *)
+    {
+        uint8_t val = 0;
+        if (policyType::read(__addr, reg, &val, 1) != 0) {
+            return -1;
+        }
+        return val;
+    }
+
+    template <class policyType>
+    int busRead(uint8_t reg, uint8_t *buf, uint8_t length, policyType *)
+    {
+        return policyType::read(__addr, reg, buf, length);
+    }
+
+    template <class policyType>
+    int busWrite(uint8_t reg, uint8_t *buf, uint8_t length, policyType *)
+    {
+        return policyType::write(__addr, reg, buf, length);
+    }
+
+    // Runtime bus: callbacks, then Arduino TwoWire
+    int readRegisterBus(uint8_t reg, XPowersRuntimeBus *)
+    {
+        uint8_t val = 0;
+        if (thisReadRegCallback) {
+            if (thisReadRegCallback(__addr, reg, &val, 1) != 0) {
+                return 0;
+            }
+            return val;
+        }
+#if defined(ARDUINO)
+        if (__wire) {
+            __wire->beginTransmission(__addr);
+            __wire->write(reg);
+            if (__wire->endTransmission() != 0) {
+                return -1;
+            }
+            __wire->requestFrom(__addr, 1U);
+            return __wire->read();
+        }
+#endif
+        return -1;
+    }
+
+    int busRead(uint8_t reg, uint8_t *buf, uint8_t length, XPowersRuntimeBus *)
+    {
+        if (thisReadRegCallback) {
+            return thisReadRegCallback(__addr, reg, buf, length);
+        }
+#if defined(ARDUINO)
+        if (__wire) {
+            __wire->beginTransmission(__addr);
+            __wire->write(reg);
+            if (__wire->endTransmission() != 0) {
+                return -1;
+            }
+            __wire->requestFrom(__addr, length);
+            return __wire->readBytes(buf, length) == length ? 0 : -1;
+        }
+#endif
+        return -1;
+    }
+
+    int busWrite(uint8_t reg, uint8_t *buf, uint8_t length, XPowersRuntimeBus *)
+    {
+        if (thisWriteRegCallback) {
+            return thisWriteRegCallback(__addr, reg, buf, length);
+        }
+#if defined(ARDUINO)
+        if (__wire) {
+            __wire->beginTransmission(__addr);
+            __wire->write(reg);
+            __wire->write(buf, length);
+            return (__wire->endTransmission() == 0) ? 0 : -1;
+        }
+#endif
+        return -1;
+    }
+
+    typedef struct {
+        uint8_t reg;
+        uint8_t val;
+        uint16_t seq;       // order of last modification
+        bool    dirty;
+    } XPowersShadowReg_t;
+
+    XPowersShadowReg_t *shadowFind(uint8_t reg)
+    {
+        for (uint8_t i = 0; i < __txn_count; i++) {
+            if (__txn_regs[i].reg == reg) {
+                return &__txn_regs[i];
+            }
+        }
+        return NULL;
+    }
+
+    XPowersShadowReg_t *shadowAdd(uint8_t reg, uint8_t val)
+    {
+        if (__txn_count >= XPOWERS_SHADOW_REG_COUNT) {
+            return NULL;
+        }
+        XPowersShadowReg_t *shadow = &__txn_regs[__txn_count++];
+        shadow->reg = reg;
+        shadow->val = val;
+        shadow->seq = 0;
+        shadow->dirty = false;
+        return shadow;
+    }
+
+    // Write modified registers of the shadow, oldest modification first. Shadow values stay cached
+    bool flushTransaction()
+    {
+        bool ok = true;
+        for (;;) {
+            XPowersShadowReg_t *next = NULL;
+            for (uint8_t i = 0; i < __txn_count; i++) {
+                if (__txn_regs[i].dirty && (!next || __txn_regs[i].seq < next->seq)) {
+                    next = &__txn_regs[i];
+                }
+            }
+            if (!next) {
+                break;
+            }
+            next->dirty = false;
+            ok &= writeRegisterBus(next->reg, next->val) == 0;
+        }
+        __txn_seq = 0;
+        return ok;
+    }
+
     bool begin()
     {
 #if defined(ARDUINO)
@@ -285,4 +602,12 @@ protected:
     uint8_t     __addr                  = 0xFF;
     iic_fptr_t  thisReadRegCallback     = NULL;
     iic_fptr_t  thisWriteRegCallback    = NULL;
+    bool        __txn_active            = false;
+    uint8_t     __txn_count             = 0;
+    uint16_t    __txn_seq               = 0;
+    XPowersShadowReg_t __txn_regs[XPOWERS_SHADOW_REG_COUNT];
+    bool        __snap_active           = false;
+    bool        __snap_valid            = false;
+    uint32_t    __snap_stamp            = 0;
+    uint8_t     __snap_buf[XPOWERS_SNAPSHOT_SIZE];
 };
@@ -9,6 +9,7 @@
 #include "bootloader_init.h"
 #include "bootloader_utility.h"
 #include "bootloader_common.h"
+#include "esp_image_format.h"
 #include "bootloader_hooks.h"
 
 #include "rom/ets_sys.h"
@@ -34,11 +35,19 @@
 // Reset Reason Hint to enter UF2. Check out esp_reset_reason_t for other Espressif pre-defined values
 #define APP_REQUEST_UF2_RESET_HINT   0x11F2
 
+// Reset Reason Hint set by UF2 after writing and verifying the image selected in otadata
+#define UF2_VERIFIED_RESET_HINT      0x11F3
+
 #ifndef UF2_DETECTION_DELAY_MS
   // Initial delay in milliseconds to detect user interaction to enter UF2.
   #define UF2_DETECTION_DELAY_MS     500
 #endif
 
+#ifndef DOTSTAR_SPI_DELAY
+  // Bit-bang SPI half clock period, APA102 is good with several MHz
+  #define DOTSTAR_SPI_DELAY          ns2cycle(250)
+#endif
+
 uint8_t const RGB_DOUBLE_TAP[] = { 0x80, 0x00, 0xff }; // Purple
 uint8_t const RGB_OFF[]        = { 0x00, 0x00, 0x00 };
 
@@ -53,6 +62,9 @@ static int selected_boot_partition(const bootloader_state_t *bs);
 static void board_led_on(void);
 static void board_led_off(void);
 
+// Image just verified by UF2, loaded without validation
+static uint32_t _verified_offset = 0;
+
 //--------------------------------------------------------------------+
 // Get Reset Reason Hint requested by Application to enter UF2
 //--------------------------------------------------------------------+
@@ -77,6 +89,26 @@ static void esp_reset_reason_clear_hint(void) {
     REG_WRITE(RTC_RESET_CAUSE_REG, 0);
 }
 
+//--------------------------------------------------------------------+
+// Skip hash check on first boot after UF2 update
+//--------------------------------------------------------------------+
+
+// bootloader_utility_load_boot_image() loads image with bootloader_load_image(), which is linked
+// with --wrap (see CMakeLists.txt) so that the image verified by UF2 is not hashed again.
+esp_err_t __real_bootloader_load_image(const esp_partition_pos_t *part, esp_image_metadata_t *data);
+
+esp_err_t __wrap_bootloader_load_image(const esp_partition_pos_t *part, esp_image_metadata_t *data) {
+#ifndef CONFIG_SECURE_BOOT
+  if ( _verified_offset != 0 && part->offset == _verified_offset ) {
+    _verified_offset = 0; // only once, fallback partitions are loaded as usual
+    ESP_LOGI(TAG, "Image verified by UF2, skip validation");
+    return bootloader_load_image_no_verify(part, data);
+  }
+#endif
+
+  return __real_bootloader_load_image(part, data);
+}
+
 /*
  * We arrive here after the ROM bootloader finished loading this second stage bootloader from flash.
  * The hardware is mostly uninitialized, flash cache is down and the app CPU is in reset.
@@ -196,6 +228,13 @@ static int selected_boot_partition(const bootloader_state_t *bs) {
               ESP_LOGI(TAG, "Detect application request to enter UF2 bootloader");
               boot_index = FACTORY_INDEX;
             }
+            else if ( UF2_VERIFIED_RESET_HINT == reset_hint ) {
+              // UF2 just wrote and verified the selected image
+              esp_reset_reason_clear_hint();
+              if ( boot_index >= 0 && boot_index < (int) bs->app_count ) {
+                _verified_offset = bs->ota[boot_index].offset;
+              }
+            }
           }
         }
 
@@ -218,8 +257,11 @@ static int selected_boot_partition(const bootloader_state_t *bs) {
 #else
           {
 #endif
+            // no waiting on first boot after UF2 update, user has just left UF2
+            uint32_t const detection_ms = _verified_offset ? 0 : UF2_DETECTION_DELAY_MS;
+
             // turn led on if there is actually waiting
-            if (UF2_DETECTION_DELAY_MS > 0){
+            if (detection_ms > 0){
               board_led_on();
             }
 
@@ -237,9 +279,11 @@ static int selected_boot_partition(const bootloader_state_t *bs) {
                 boot_index = FACTORY_INDEX;
                 break;
               }
-            } while (UF2_DETECTION_DELAY_MS > (esp_log_early_timestamp() - tm_start) );
+            } while (detection_ms > (esp_log_early_timestamp() - tm_start) );
 
-            board_led_off();
+            if (detection_ms > 0){
+              board_led_off();
+            }
           }
 
 #if PIN_DOUBLE_RESET_RC
@@ -278,7 +322,8 @@ static inline uint32_t ns2cycle(uint32_t ns) {
   tick_per_us = g_ticks_per_us_pro;
 #endif
 
-  return (tick_per_us*ns) / 1000;
+  // 64-bit since ms delays overflow at high cpu frequency
+  return (uint32_t) (((uint64_t) tick_per_us * ns) / 1000);
 }
 
 static inline uint32_t delay_cycle(uint32_t cycle) {
@@ -353,12 +398,11 @@ static void SPI_write(int32_t pin_data,uint32_t pin_sck,uint8_t c) {
     else {
       gpio_ll_set_level(&GPIO, pin_data, 1);
     }
-    delay_cycle( ns2cycle(200000) ) ;
+    delay_cycle( DOTSTAR_SPI_DELAY ) ;
     gpio_ll_set_level(&GPIO, pin_sck, 1);
     c<<=1;
-    delay_cycle( ns2cycle(200000) ) ;
+    delay_cycle( DOTSTAR_SPI_DELAY ) ;
     gpio_ll_set_level(&GPIO, pin_sck, 0);
-    delay_cycle( ns2cycle(200000) );
   }
 }
 
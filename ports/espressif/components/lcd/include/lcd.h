@@ -58,8 +58,12 @@ void lcd_spi_pre_transfer_callback(spi_transaction_t *t);
  */
 esp_err_t lcd_init(spi_device_handle_t spi);
 
+/*!< Queue lines, returns without waiting: linedata must stay valid until next call or lcd_draw_lines_wait() */
 void lcd_draw_lines(spi_device_handle_t spi, int ypos, uint16_t *linedata);
 
+/*!< Wait for lines queued by lcd_draw_lines() to be sent */
+void lcd_draw_lines_wait(spi_device_handle_t spi);
+
 #ifdef __cplusplus
 }
 #endif
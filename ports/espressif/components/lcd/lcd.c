@@ -373,11 +373,19 @@ esp_err_t lcd_init(spi_device_handle_t spi)
 }
 
 
+/*!< Transactions of lcd_draw_lines() queued but not yet finished */
+static bool _lines_pending = false;
+
 static void send_line_finish(spi_device_handle_t spi)
 {
     spi_transaction_t *rtrans;
     esp_err_t ret;
 
+    if (!_lines_pending) {
+        return;
+    }
+    _lines_pending = false;
+
     /*!< Wait for all 6 transactions to be done and get back the results. */
     for (int x = 0; x < 6; x++) {
         ret = spi_device_get_trans_result(spi, &rtrans, portMAX_DELAY);
@@ -401,6 +409,9 @@ void lcd_draw_lines(spi_device_handle_t spi, int ypos, uint16_t *linedata)
     /*!< function is finished because the SPI driver needs access to it even while we're already calculating the next line. */
     static spi_transaction_t trans[6];
 
+    /*!< trans[] and the previous line data are still in use until the previous lines are sent */
+    send_line_finish(spi);
+
     /*!< In theory, it's better to initialize trans and data only once and hang on to the initialized */
     /*!< variables. We allocate them on the stack, so we need to re-init them each call. */
     for (x = 0; x < 6; x++) {
@@ -458,7 +469,12 @@ void lcd_draw_lines(spi_device_handle_t spi, int ypos, uint16_t *linedata)
     /*!< mostly using DMA, so the CPU doesn't have much to do here. We're not going to wait for the transaction to */
     /*!< finish because we may as well spend the time calculating the next line. When that is done, we can call */
     /*!< send_line_finish, which will wait for the transfers to be done and check their status. */
+    /*!< This is done by the next lcd_draw_lines() call or lcd_draw_lines_wait(). */
+    _lines_pending = true;
+}
 
+void lcd_draw_lines_wait(spi_device_handle_t spi)
+{
     send_line_finish(spi);
 }
 
@@ -17,6 +17,33 @@ typedef union out_column_t {
 	uint8_t  u8[4];
 } PACK8 out_column_t;
 
+// Send columns seg to seg+width-1 of page: only the span differing from display RAM (last data sent)
+// goes over the bus. Display RAM is unknown until the whole page has been sent once.
+static void ssd1306_send_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int width)
+{
+	if (page >= dev->_pages) return;
+	if (seg >= dev->_width) return;
+	if (seg + width > dev->_width) width = dev->_width - seg;
+
+	PAGE_t * _page = &dev->_page[page];
+	int first = 0;
+	int last = width - 1;
+	if (_page->_valid) {
+		while (first <= last && _page->_shown[seg+first] == images[first]) first++;
+		while (last >= first && _page->_shown[seg+last] == images[last]) last--;
+		if (first > last) return;
+	} else if (seg == 0 && width == dev->_width) {
+		_page->_valid = true;
+	}
+
+	if (dev->_address == SPIAddress) {
+		spi_display_image(dev, page, seg+first, &images[first], last-first+1);
+	} else {
+		i2c_display_image(dev, page, seg+first, &images[first], last-first+1);
+	}
+	memcpy(&_page->_shown[seg+first], &images[first], last-first+1);
+}
+
 void ssd1306_init(SSD1306_t * dev, int width, int height)
 {
 	if (dev->_address == SPIAddress) {
@@ -24,9 +51,10 @@ void ssd1306_init(SSD1306_t * dev, int width, int height)
 	} else {
 		i2c_init(dev, width, height);
 	}
-	// Initialize internal buffer
+	// Initialize internal buffer, display RAM is unknown
 	for (int i=0;i<dev->_pages;i++) {
 		memset(dev->_page[i]._segs, 0, 128);
+		dev->_page[i]._valid = false;
 	}
 }
 
@@ -47,14 +75,8 @@ int ssd1306_get_pages(SSD1306_t * dev)
 
 void ssd1306_show_buffer(SSD1306_t * dev)
 {
-	if (dev->_address == SPIAddress) {
-		for (int page=0; page<dev->_pages;page++) {
-			spi_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
-		}
-	} else {
-		for (int page=0; page<dev->_pages;page++) {
-			i2c_display_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
-		}
+	for (int page=0; page<dev->_pages;page++) {
+		ssd1306_send_image(dev, page, 0, dev->_page[page]._segs, dev->_width);
 	}
 }
 
@@ -78,11 +100,7 @@ void ssd1306_get_buffer(SSD1306_t * dev, uint8_t * buffer)
 
 void ssd1306_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int width)
 {
-	if (dev->_address == SPIAddress) {
-		spi_display_image(dev, page, seg, images, width);
-	} else {
-		i2c_display_image(dev, page, seg, images, width);
-	}
+	ssd1306_send_image(dev, page, seg, images, width);
 	// Set to internal buffer
 	memcpy(&dev->_page[page]._segs[seg], images, width);
 }
@@ -154,11 +172,7 @@ ssd1306_display_text_x3(SSD1306_t * dev, int page, char * text, int text_len, bo
 			}
 			if (invert) ssd1306_invert(image, 24);
 			if (dev->_flip) ssd1306_flip(image, 24);
-			if (dev->_address == SPIAddress) {
-				spi_display_image(dev, page+yy, seg, image, 24);
-			} else {
-				i2c_display_image(dev, page+yy, seg, image, 24);
-			}
+			ssd1306_send_image(dev, page+yy, seg, image, 24);
 			memcpy(&dev->_page[page+yy]._segs[seg], image, 24);
 		}
 		seg = seg + 24;
@@ -167,18 +181,17 @@ ssd1306_display_text_x3(SSD1306_t * dev, int page, char * text, int text_len, bo
 
 void ssd1306_clear_screen(SSD1306_t * dev, bool invert)
 {
-	char space[16];
-	memset(space, 0x00, sizeof(space));
 	for (int page = 0; page < dev->_pages; page++) {
-		ssd1306_display_text(dev, page, space, sizeof(space), invert);
+		ssd1306_clear_line(dev, page, invert);
 	}
 }
 
 void ssd1306_clear_line(SSD1306_t * dev, int page, bool invert)
 {
-	char space[16];
-	memset(space, 0x00, sizeof(space));
-	ssd1306_display_text(dev, page, space, sizeof(space), invert);
+	// whole page at once, same as 16 blank characters
+	uint8_t image[128];
+	memset(image, invert ? 0xFF : 0x00, sizeof(image));
+	ssd1306_display_image(dev, page, 0, image, dev->_width);
 }
 
 void ssd1306_contrast(SSD1306_t * dev, int contrast)
@@ -212,13 +225,6 @@ void ssd1306_scroll_text(SSD1306_t * dev, char * text, int text_len, bool invert
 	ESP_LOGD(TAG, "dev->_scEnable=%d", dev->_scEnable);
 	if (dev->_scEnable == false) return;
 
-	void (*func)(SSD1306_t * dev, int page, int seg, uint8_t * images, int width);
-	if (dev->_address == SPIAddress) {
-		func = spi_display_image;
-	} else {
-		func = i2c_display_image;
-	}
-
 	int srcIndex = dev->_scEnd - dev->_scDirection;
 	while(1) {
 		int dstIndex = srcIndex + dev->_scDirection;
@@ -226,7 +232,7 @@ void ssd1306_scroll_text(SSD1306_t * dev, char * text, int text_len, bool invert
 		for(int seg = 0; seg < dev->_width; seg++) {
 			dev->_page[dstIndex]._segs[seg] = dev->_page[srcIndex]._segs[seg];
 		}
-		(*func)(dev, dstIndex, 0, dev->_page[dstIndex]._segs, sizeof(dev->_page[dstIndex]._segs));
+		ssd1306_send_image(dev, dstIndex, 0, dev->_page[dstIndex]._segs, sizeof(dev->_page[dstIndex]._segs));
 		if (srcIndex == dev->_scStart) break;
 		srcIndex = srcIndex - dev->_scDirection;
 	}
@@ -260,6 +266,10 @@ void ssd1306_hardware_scroll(SSD1306_t * dev, ssd1306_scroll_type_t scroll)
 	} else {
 		i2c_hardware_scroll(dev, scroll);
 	}
+	// scrolling moves display RAM contents
+	for (int page=0; page<dev->_pages; page++) {
+		dev->_page[page]._valid = false;
+	}
 }
 
 // delay = 0 : display with no wait
@@ -399,11 +409,7 @@ void ssd1306_wrap_arround(SSD1306_t * dev, ssd1306_scroll_type_t scroll, int sta
 
 	if (delay >= 0) {
 		for (int page=0;page<dev->_pages;page++) {
-			if (dev->_address == SPIAddress) {
-				spi_display_image(dev, page, 0, dev->_page[page]._segs, 128);
-			} else {
-				i2c_display_image(dev, page, 0, dev->_page[page]._segs, 128);
-			}
+			ssd1306_send_image(dev, page, 0, dev->_page[page]._segs, 128);
 			if (delay) vTaskDelay(delay);
 		}
 	}
@@ -580,13 +586,6 @@ uint8_t ssd1306_rotate_byte(uint8_t ch1) {
 
 void ssd1306_fadeout(SSD1306_t * dev)
 {
-	void (*func)(SSD1306_t * dev, int page, int seg, uint8_t * images, int width);
-	if (dev->_address == SPIAddress) {
-		func = spi_display_image;
-	} else {
-		func = i2c_display_image;
-	}
-
 	uint8_t image[1];
 	for(int page=0; page<dev->_pages; page++) {
 		image[0] = 0xFF;
@@ -597,7 +596,7 @@ void ssd1306_fadeout(SSD1306_t * dev)
 				image[0] = image[0] << 1;
 			}
 			for(int seg=0; seg<128; seg++) {
-				(*func)(dev, page, seg, image, 1);
+				ssd1306_send_image(dev, page, seg, image, 1);
 				dev->_page[page]._segs[seg] = image[0];
 			}
 		}
@@ -80,9 +80,10 @@ typedef enum {
 } ssd1306_scroll_type_t;
 
 typedef struct {
-	bool _valid; // Not using it anymore
+	bool _valid; // _shown holds display RAM contents
 	int _segLen; // Not using it anymore
 	uint8_t _segs[128];
+	uint8_t _shown[128]; // last data sent, only differing columns are sent again
 } PAGE_t;
 
 typedef struct {
@@ -74,6 +74,14 @@
 #define CFG_TUSB_MEM_ALIGN          __attribute__ ((aligned(4)))
 #endif
 
+// Buffer DMA of the DWC2 core (CONFIG_TINYUF2_USB_DMA), endpoint buffers must be in internal SRAM
+// which is where .bss is, they are never placed in PSRAM
+#ifdef CONFIG_TINYUF2_USB_DMA
+#define CFG_TUD_DWC2_DMA_ENABLE     1
+#else
+#define CFG_TUD_DWC2_DMA_ENABLE     0
+#endif
+
 //--------------------------------------------------------------------
 // DEVICE CONFIGURATION
 //--------------------------------------------------------------------
@@ -87,7 +95,12 @@
 #define CFG_TUD_MSC              1
 #define CFG_TUD_HID              0
 #define CFG_TUD_MIDI             0
+#ifndef CFG_TUD_VENDOR
 #define CFG_TUD_VENDOR           0
+#endif
+#ifndef CFG_TUD_DFU
+#define CFG_TUD_DFU              0
+#endif
 
 //------------- CDC -------------//
 
@@ -107,6 +120,9 @@
 // MSC Buffer size of Device Mass storage
 #define CFG_TUD_MSC_BUFSIZE      4096
 
+// DFU transfer size (wTransferSize), one flash erase unit
+#define CFG_TUD_DFU_XFER_BUFSIZE 4096
+
 //------------- HID -------------//
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_BUFSIZE      64
@@ -34,14 +34,60 @@
 
 static uint32_t bf_flash_page_addr = NO_CACHE;
 static uint8_t  bf_flash_cache[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+
+// bit set for each filesystem block of cache that holds current data (written or loaded), the rest
+// is only read from flash on flush. A page written completely is never pre-loaded.
+static uint32_t bf_flash_cache_valid = 0;
+enum { CACHE_ALL_VALID = (1UL << (FLASH_PAGE_SIZE / FILESYSTEM_BLOCK_SIZE)) - 1 };
+
+// bit set for each block written since the page was cached, blocks loaded by flash_cache_fill()
+// are flash contents already and are skipped when checking for changes on flush
+static uint32_t bf_flash_cache_dirty = 0;
+
+// Bytes [start, end) of the page written by consecutive payloads. Payloads not aligned to blocks
+// (e.g 476 bytes per uf2 block) usually cover the page completely, the flash read of partial blocks
+// is deferred to flush and skipped for bytes already written.
+static uint16_t bf_flash_run_start = 0;
+static uint16_t bf_flash_run_end = 0;
+
 /*! @brief Flash driver Structure */
 static flash_config_t bf_flash_config;
 /*! @brief Flash cache driver Structure */
 static ftfx_cache_config_t bf_cache_config;
 
+// Cache prefetch speculation is disabled once at the first erase/program of a write session and
+// restored by board_flash_flush() (completion), instead of around every page
+static bool bf_flash_session = false;
+
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
+
+// Mask of blocks overlapping bytes [start, end) of the page
+static inline uint32_t block_mask(uint32_t start, uint32_t end)
+{
+  uint32_t const first = start / FILESYSTEM_BLOCK_SIZE;
+  uint32_t const last = (end + FILESYSTEM_BLOCK_SIZE - 1) / FILESYSTEM_BLOCK_SIZE;
+  return ((1UL << last) - 1) & ~((1UL << first) - 1);
+}
+
+// Load current flash contents of blocks in mask that are not valid, keeping written bytes
+static void flash_cache_fill(uint32_t mask)
+{
+  for ( uint32_t i = 0; i < FLASH_PAGE_SIZE / FILESYSTEM_BLOCK_SIZE; i++ ) {
+    if ( !(mask & (1UL << i)) || (bf_flash_cache_valid & (1UL << i)) ) continue;
+
+    uint32_t const offset = i * FILESYSTEM_BLOCK_SIZE;
+    uint8_t const* flash = (uint8_t const*) (bf_flash_page_addr + offset);
+
+    for ( uint32_t b = 0; b < FILESYSTEM_BLOCK_SIZE; b++ ) {
+      if ( offset + b < bf_flash_run_start || offset + b >= bf_flash_run_end ) bf_flash_cache[offset + b] = flash[b];
+    }
+
+    bf_flash_cache_valid |= 1UL << i;
+  }
+}
+
 void board_flash_init(void)
 {
     uint32_t pflashBlockBase  = 0;
@@ -82,63 +128,183 @@ void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
   memcpy(buffer, (void*) addr, len);
 }
 
-void board_flash_flush(void)
+static void flash_session_begin(void)
 {
-  status_t result;
+  if ( bf_flash_session ) return;
+
+  TU_LOG1("Clear cache prefetch speculation for write session.\r\n");
+
+  /* Pre-preparation work about flash Cache/Prefetch/Speculation. */
+  FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, true);
+  bf_flash_session = true;
+}
+
+static void flash_session_end(void)
+{
+  if ( !bf_flash_session ) return;
+
+  /* Post-preparation work about flash Cache/Prefetch/Speculation. */
+  FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, false);
+  bf_flash_session = false;
+}
+
+// Drop flash controller cache lines of the page just programmed, speculation stays disabled
+static void flash_cache_clear(void)
+{
+#ifdef MCM_PLACR_CFCC_MASK
+  MCM->PLACR |= MCM_PLACR_CFCC_MASK;
+#else
+  FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, false);
+  FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, true);
+#endif
+}
+
+static bool flash_page_blank(uint32_t addr)
+{
+  uint32_t const* word = (uint32_t const*) addr;
+  for ( uint32_t i = 0; i < FLASH_PAGE_SIZE / 4; i++ ) {
+    if ( word[i] != 0xFFFFFFFFUL ) return false;
+  }
+  return true;
+}
+
+// Program cached page with Program Longword (the only program command of FTFA), longwords still
+// erased in the cache are skipped: runs of the others are programmed with one driver call each
+static status_t flash_program_page(void)
+{
+  uint32_t const* word = (uint32_t const*) (uintptr_t) bf_flash_cache;
+  status_t result = kStatus_FTFx_Success;
+
+  for ( uint32_t i = 0; i < FLASH_PAGE_SIZE / 4 && result == kStatus_FTFx_Success; ) {
+    if ( word[i] == 0xFFFFFFFFUL ) {
+      i++;
+      continue;
+    }
+
+    uint32_t const first = i;
+    while ( i < FLASH_PAGE_SIZE / 4 && word[i] != 0xFFFFFFFFUL ) i++;
+
+    result = FLASH_Program(&bf_flash_config, bf_flash_page_addr + first * 4, bf_flash_cache + first * 4, (i - first) * 4);
+  }
+
+  return result;
+}
+
+// Write back cached page: skipped if unchanged, erase skipped if the page is blank already
+static void flash_cache_flush(void)
+{
+  status_t result = kStatus_FTFx_Success;
 //  uint32_t failedAddress, failedData;
 
   if ( bf_flash_page_addr == NO_CACHE ) return;
 
+  // only written blocks are needed for comparing, the rest is loaded if the page has to be erased
+  flash_cache_fill(bf_flash_cache_dirty);
+
 //  result = FLASH_VerifyProgram(&_flash_config, _flash_page_addr, FLASH_PAGE_SIZE, (const uint8_t *)_flash_cache, &failedAddress, &failedData);
 //  if (result != kStatus_Success) {
 
   // skip matching contents
-  if ( memcmp(bf_flash_cache, (void*) bf_flash_page_addr, FLASH_PAGE_SIZE) ) {
-    TU_LOG1("Clear cache prefetch speculation for flush operation.\r\n");
+  bool changed = false;
+  for ( uint32_t i = 0; i < FLASH_PAGE_SIZE / FILESYSTEM_BLOCK_SIZE && !changed; i++ ) {
+    if ( bf_flash_cache_dirty & (1UL << i) ) {
+      uint32_t const offset = i * FILESYSTEM_BLOCK_SIZE;
+      changed = 0 != memcmp(bf_flash_cache + offset, (void*) (bf_flash_page_addr + offset), FILESYSTEM_BLOCK_SIZE);
+    }
+  }
+
+  if ( changed ) {
+    flash_cache_fill(CACHE_ALL_VALID);
+    flash_session_begin();
 
-    /* Pre-preparation work about flash Cache/Prefetch/Speculation. */
-    FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, true);
+    bool const blank = flash_page_blank(bf_flash_page_addr);
 
-    TU_LOG1("Erase and Write at address = 0x%08lX...\r\n", bf_flash_page_addr);
+    TU_LOG1("%s at address = 0x%08lX...\r\n", blank ? "Write" : "Erase and Write", bf_flash_page_addr);
     __disable_irq();
-    result = FLASH_Erase(&bf_flash_config, bf_flash_page_addr, FLASH_PAGE_SIZE, kFLASH_ApiEraseKey);
-    if (kStatus_FTFx_Success != result) {
-        TU_LOG1("FLASH_Erase failed at address = 0x%08lX\r\n",bf_flash_page_addr);
+    if ( !blank ) {
+      result = FLASH_Erase(&bf_flash_config, bf_flash_page_addr, FLASH_PAGE_SIZE, kFLASH_ApiEraseKey);
+      if (kStatus_FTFx_Success != result) {
+          TU_LOG1("FLASH_Erase failed at address = 0x%08lX\r\n",bf_flash_page_addr);
+      }
     }
-    TU_LOG1("Erased...\r\n");
-    result = FLASH_Program(&bf_flash_config, bf_flash_page_addr, bf_flash_cache, FLASH_PAGE_SIZE);
-    if (kStatus_FTFx_Success != result) {
-        TU_LOG1("FLASH_Program failed at address = 0x%08lX\r\n",bf_flash_page_addr);
+    if (kStatus_FTFx_Success == result) {
+      result = flash_program_page();
+      if (kStatus_FTFx_Success != result) {
+          TU_LOG1("FLASH_Program failed at address = 0x%08lX\r\n",bf_flash_page_addr);
+      }
     }
     __enable_irq();
     TU_LOG1("Programmed.\r\n");
 
-    /* Post-preparation work about flash Cache/Prefetch/Speculation. */
-    FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, false);
+    flash_cache_clear();
   }
 
   bf_flash_page_addr = NO_CACHE;
 }
 
+void board_flash_flush(void)
+{
+  flash_cache_flush();
+  flash_session_end();
+}
 
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
-  uint32_t newAddr = addr & ~(FLASH_PAGE_SIZE - 1);
-  // int32_t result;
-
-  if (newAddr != bf_flash_page_addr) {
-    board_flash_flush();
-    bf_flash_page_addr = newAddr;
-    board_flash_read(newAddr, bf_flash_cache, FLASH_PAGE_SIZE);
-    // result = FLASH_Read(&_flash_config, newAddr, _flash_cache, FLASH_PAGE_SIZE);
-    // if (result != kStatus_Success) {
-    //   TU_LOG1("Flash read error at address = 0x%08lX\r\n", _flash_page_addr);
-    // }
+  uint8_t const* src = (uint8_t const*) data;
+
+  // payload may cross page boundary
+  while ( len ) {
+    uint32_t newAddr = addr & ~(FLASH_PAGE_SIZE - 1);
+    uint32_t const offset = addr & (FLASH_PAGE_SIZE - 1);
+    uint32_t const count = (len < FLASH_PAGE_SIZE - offset) ? len : (FLASH_PAGE_SIZE - offset);
+
+    if (newAddr != bf_flash_page_addr) {
+      flash_cache_flush();
+      bf_flash_page_addr = newAddr;
+      // current page contents is loaded lazily (on flush) for blocks not written
+      bf_flash_cache_valid = 0;
+      bf_flash_cache_dirty = 0;
+      bf_flash_run_start = bf_flash_run_end = 0;
+    }
+
+    uint32_t const first = offset / FILESYSTEM_BLOCK_SIZE;
+    uint32_t const last = (offset + count + FILESYSTEM_BLOCK_SIZE - 1) / FILESYSTEM_BLOCK_SIZE;
+
+    if ( bf_flash_run_start == bf_flash_run_end ) {
+      bf_flash_run_start = offset;
+      bf_flash_run_end = offset;
+    } else if ( offset != bf_flash_run_end ) {
+      // not consecutive: complete blocks partially covered by current run or this payload, it starts a new run
+      flash_cache_fill(block_mask(bf_flash_run_start, bf_flash_run_end) | block_mask(offset, offset + count));
+      bf_flash_run_start = offset;
+      bf_flash_run_end = offset;
+    }
+
+    memcpy(bf_flash_cache + offset, src, count);
+    bf_flash_run_end += count;
+
+    for ( uint32_t i = first; i < last; i++ ) {
+      // block is current once completely covered by the run
+      if ( bf_flash_run_start <= i * FILESYSTEM_BLOCK_SIZE && (i + 1) * FILESYSTEM_BLOCK_SIZE <= bf_flash_run_end ) {
+        bf_flash_cache_valid |= 1UL << i;
+      }
+      bf_flash_cache_dirty |= 1UL << i;
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
   }
-  memcpy(bf_flash_cache + (addr & (FLASH_PAGE_SIZE - 1)), data, len);
 
   return true;
 }
 
+// Pages are assembled in the cache, current contents is loaded for blocks not written
+bool board_flash_preserved(uint32_t addr, uint32_t len) {
+  (void) addr;
+  (void) len;
+  return true;
+}
+
 void board_flash_erase_app(void)
 {
   // TODO implement later
@@ -35,6 +35,7 @@
 #define TINYUF2_DBL_TAP_DFU      1
 #define TINYUF2_DBL_TAP_REG      RTC->TAR
 #define BOARD_FLASH_APP_START    0x8000
+#define BOARD_FLASH_ERASE_SIZE   1024
 //#define BOARD_FLASH_SIZE         (BOARD_FLASH_TOTAL - BOARD_FLASH_APP_START)
 
 #ifdef __cplusplus
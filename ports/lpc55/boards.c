@@ -91,9 +91,97 @@ static uint8_t const _led_tricolor[3][2] = LED_TRICOLOR_GPIO;
 #define FLASH_PAGE_SIZE 512
 #define FILESYSTEM_BLOCK_SIZE 256
 
+// Writes are collected in an aligned window of pages, flushed when a write falls outside of it or on
+// completion. Changed adjacent pages are erased and programmed as runs (one FLASH_Erase and one
+// FLASH_Program per run) instead of page by page. 8KB by default, well within the SRAM of all parts
+#ifndef BOARD_FLASH_CACHE_SIZE
+#define BOARD_FLASH_CACHE_SIZE  (16*FLASH_PAGE_SIZE)
+#endif
+
+#define CACHE_PAGES           (BOARD_FLASH_CACHE_SIZE / FLASH_PAGE_SIZE)
+#define CACHE_BLOCKS          (BOARD_FLASH_CACHE_SIZE / FILESYSTEM_BLOCK_SIZE)
+#define PAGE_BLOCKS           (FLASH_PAGE_SIZE / FILESYSTEM_BLOCK_SIZE)
+
+#if (BOARD_FLASH_CACHE_SIZE % FLASH_PAGE_SIZE) || CACHE_BLOCKS > 32 || (BOARD_FLASH_CACHE_SIZE & (BOARD_FLASH_CACHE_SIZE - 1))
+  #error "BOARD_FLASH_CACHE_SIZE must be a power of 2 multiple of page size, 8KB at most"
+#endif
+
 static flash_config_t _flash_config;
-static uint32_t _flash_page_addr = NO_CACHE;
-static uint8_t  _flash_cache[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+static uint32_t _flash_cache_addr = NO_CACHE;
+static uint8_t  _flash_cache[BOARD_FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+
+// bit set for each filesystem block of cache that holds current data (written or loaded), the rest
+// is only read from flash on flush. A page written completely is never pre-loaded.
+static uint32_t _flash_cache_valid = 0;
+
+// bit set for each block written since the window was cached, only these are verified against flash
+static uint32_t _flash_cache_dirty = 0;
+
+// Erased pages cannot be read (ECC error), they are detected with FLASH_VerifyErase once per page
+// instead and their cached contents is erased value. Bit per page: checked, and erased if checked
+static uint32_t _flash_page_checked = 0;
+static uint32_t _flash_page_erased = 0;
+
+// Bytes [start, end) of the window written by consecutive payloads. Payloads not aligned to blocks
+// (e.g 476 bytes per uf2 block) usually cover the pages completely, the flash read of partial blocks
+// is deferred to flush and skipped for bytes already written.
+static uint16_t _flash_run_start = 0;
+static uint16_t _flash_run_end = 0;
+
+// Mask of blocks overlapping bytes [start, end) of the window
+static inline uint32_t block_mask(uint32_t start, uint32_t end)
+{
+  uint32_t const first = start / FILESYSTEM_BLOCK_SIZE;
+  uint32_t const last = (end + FILESYSTEM_BLOCK_SIZE - 1) / FILESYSTEM_BLOCK_SIZE;
+  return (uint32_t) (((1ULL << last) - 1) & ~((1ULL << first) - 1));
+}
+
+static inline uint32_t page_mask(uint32_t page)
+{
+  return block_mask(page * FLASH_PAGE_SIZE, (page + 1) * FLASH_PAGE_SIZE);
+}
+
+static bool flash_page_erased(uint32_t page)
+{
+  if ( !(_flash_page_checked & (1UL << page)) )
+  {
+    _flash_page_checked |= 1UL << page;
+    if ( FLASH_VerifyErase(&_flash_config, _flash_cache_addr + page * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE) == kStatus_Success )
+    {
+      _flash_page_erased |= 1UL << page;
+    }
+  }
+
+  return (_flash_page_erased & (1UL << page)) != 0;
+}
+
+// Load current flash contents of blocks in mask that are not valid, keeping written bytes
+static void flash_cache_fill(uint32_t mask)
+{
+  for ( uint32_t i = 0; i < CACHE_BLOCKS; i++ )
+  {
+    if ( !(mask & (1UL << i)) || (_flash_cache_valid & (1UL << i)) ) continue;
+
+    uint32_t const offset = i * FILESYSTEM_BLOCK_SIZE;
+    uint8_t block[FILESYSTEM_BLOCK_SIZE] __attribute__((aligned(4)));
+
+    if ( flash_page_erased(i / PAGE_BLOCKS) )
+    {
+      memset(block, 0xff, FILESYSTEM_BLOCK_SIZE);
+    }
+    else if ( FLASH_Read(&_flash_config, _flash_cache_addr + offset, block, FILESYSTEM_BLOCK_SIZE) != kStatus_Success )
+    {
+      TU_LOG1("Flash read error at address = 0x%08lX\r\n", _flash_cache_addr + offset);
+    }
+
+    for ( uint32_t b = 0; b < FILESYSTEM_BLOCK_SIZE; b++ )
+    {
+      if ( offset + b < _flash_run_start || offset + b >= _flash_run_end ) _flash_cache[offset + b] = block[b];
+    }
+
+    _flash_cache_valid |= 1UL << i;
+  }
+}
 
 //--------------------------------------------------------------------+
 //
@@ -110,45 +198,216 @@ uint32_t board_flash_size(void)
 
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
 {
-  FLASH_Read(&_flash_config, addr, buffer, len);
+  if ( FLASH_Read(&_flash_config, addr, buffer, len) == kStatus_Success ) return;
+
+  // range includes erased pages (ECC error), read page by page
+  uint8_t* dst = (uint8_t*) buffer;
+  while ( len )
+  {
+    uint32_t const page_addr = addr & ~(FLASH_PAGE_SIZE - 1);
+    uint32_t const count = (len < page_addr + FLASH_PAGE_SIZE - addr) ? len : (page_addr + FLASH_PAGE_SIZE - addr);
+
+    if ( FLASH_VerifyErase(&_flash_config, page_addr, FLASH_PAGE_SIZE) == kStatus_Success )
+    {
+      memset(dst, 0xff, count);
+    }
+    else
+    {
+      FLASH_Read(&_flash_config, addr, dst, count);
+    }
+
+    addr += count;
+    dst += count;
+    len -= count;
+  }
 }
 
-void board_flash_flush(void)
+#if TINYUF2_CURRENT_CRC || TINYUF2_APP_FOOTER
+// CRC engine in CRC-32 mode, bit reversed input and sum, complemented sum (IEEE 802.3)
+void board_hash_init(void)
+{
+  CLOCK_EnableClock(kCLOCK_Crc);
+  CRC_ENGINE->MODE = CRC_MODE_CRC_POLY(2) | CRC_MODE_BIT_RVS_WR_MASK | CRC_MODE_BIT_RVS_SUM_MASK | CRC_MODE_CMPL_SUM_MASK;
+  CRC_ENGINE->SEED = 0xFFFFFFFF;
+}
+
+void board_hash_update(void const* data, uint32_t len)
 {
-  status_t status;
+  uint8_t const* buf = (uint8_t const*) data;
+
+  // byte writes: bit reversal applies per byte as in the reflected algorithm
+  for ( uint32_t i = 0; i < len; i++ )
+  {
+    *((volatile uint8_t*) &CRC_ENGINE->WR_DATA) = buf[i];
+  }
+}
+
+uint32_t board_hash_final(void)
+{
+  return CRC_ENGINE->SUM;
+}
+#endif
+
+// Check if written blocks of page differ from flash
+static bool flash_page_changed(uint32_t page)
+{
+  uint32_t const dirty = _flash_cache_dirty & page_mask(page);
+  uint8_t const* data = _flash_cache + page * FLASH_PAGE_SIZE;
+
+  if ( flash_page_erased(page) )
+  {
+    // only needs programming if anything but erased value is written, filling is free
+    flash_cache_fill(page_mask(page));
+    for ( uint32_t i = 0; i < FLASH_PAGE_SIZE; i++ )
+    {
+      if ( data[i] != 0xff ) return true;
+    }
+    return false;
+  }
+
+  flash_cache_fill(dirty);
+
+  for ( uint32_t i = page * PAGE_BLOCKS; i < (page + 1) * PAGE_BLOCKS; i++ )
+  {
+    if ( !(dirty & (1UL << i)) ) continue;
+
+    uint32_t failedAddress, failedData;
+    uint32_t const offset = i * FILESYSTEM_BLOCK_SIZE;
+    if ( FLASH_VerifyProgram(&_flash_config, _flash_cache_addr + offset, FILESYSTEM_BLOCK_SIZE,
+                             _flash_cache + offset, &failedAddress, &failedData) != kStatus_Success )
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Erase (only pages holding data) and program a run of adjacent changed pages, then verify them
+static void flash_program_run(uint32_t first, uint32_t count, uint32_t erase_mask)
+{
+  status_t status = kStatus_Success;
+  uint32_t const addr = _flash_cache_addr + first * FLASH_PAGE_SIZE;
+  uint32_t const len = count * FLASH_PAGE_SIZE;
   uint32_t failedAddress, failedData;
 
-  if ( _flash_page_addr == NO_CACHE ) return;
+  TU_LOG1("Erase and Write at address = 0x%08lX, len = %lu\r\n", addr, len);
+
+  // erased pages of the run are programmed as they are, the others are erased in runs too
+  for ( uint32_t p = first; p < first + count && status == kStatus_Success; )
+  {
+    if ( !(erase_mask & (1UL << p)) ) { p++; continue; }
+
+    uint32_t end = p + 1;
+    while ( end < first + count && (erase_mask & (1UL << end)) ) end++;
+
+    status = FLASH_Erase(&_flash_config, _flash_cache_addr + p * FLASH_PAGE_SIZE, (end - p) * FLASH_PAGE_SIZE, kFLASH_ApiEraseKey);
+    p = end;
+  }
+
+  if ( status == kStatus_Success ) status = FLASH_Program(&_flash_config, addr, _flash_cache + first * FLASH_PAGE_SIZE, len);
+
+  if ( status == kStatus_Success )
+  {
+    status = FLASH_VerifyProgram(&_flash_config, addr, len, _flash_cache + first * FLASH_PAGE_SIZE, &failedAddress, &failedData);
+  }
+
+  if ( status != kStatus_Success )
+  {
+    TU_LOG1("Flash program failed, status = %ld\r\n", status);
+  }
+}
+
+void board_flash_flush(void)
+{
+  if ( _flash_cache_addr == NO_CACHE ) return;
+
+  // blocks not written are only read (or set to erased value) when the page needs to be programmed
+  uint32_t program = 0;
+  uint32_t erase = 0;
+  for ( uint32_t p = 0; p < CACHE_PAGES; p++ )
+  {
+    if ( !(_flash_cache_dirty & page_mask(p)) || !flash_page_changed(p) ) continue;
+
+    flash_cache_fill(page_mask(p));
+    program |= 1UL << p;
+    if ( !flash_page_erased(p) ) erase |= 1UL << p;
+  }
+
+  for ( uint32_t p = 0; p < CACHE_PAGES; )
+  {
+    if ( !(program & (1UL << p)) ) { p++; continue; }
 
-  status = FLASH_VerifyProgram(&_flash_config, _flash_page_addr, FLASH_PAGE_SIZE, (const uint8_t *)_flash_cache, &failedAddress, &failedData);
+    uint32_t end = p + 1;
+    while ( end < CACHE_PAGES && (program & (1UL << end)) ) end++;
 
-  if (status != kStatus_Success) {
-    TU_LOG1("Erase and Write at address = 0x%08lX\r\n",_flash_page_addr);
-    status = FLASH_Erase(&_flash_config, _flash_page_addr, FLASH_PAGE_SIZE, kFLASH_ApiEraseKey);
-    status = FLASH_Program(&_flash_config, _flash_page_addr, _flash_cache, FLASH_PAGE_SIZE);
+    flash_program_run(p, end - p, erase);
+    p = end;
   }
 
-  _flash_page_addr = NO_CACHE;
+  _flash_cache_addr = NO_CACHE;
 }
 
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len)
 {
-  uint32_t newAddr = addr & ~(FLASH_PAGE_SIZE - 1);
-  int32_t status;
+  uint8_t const* src = (uint8_t const*) data;
+
+  // payload may cross window boundary
+  while ( len ) {
+    uint32_t newAddr = addr & ~(BOARD_FLASH_CACHE_SIZE - 1);
+    uint32_t const offset = addr & (BOARD_FLASH_CACHE_SIZE - 1);
+    uint32_t const count = (len < BOARD_FLASH_CACHE_SIZE - offset) ? len : (BOARD_FLASH_CACHE_SIZE - offset);
+
+    if (newAddr != _flash_cache_addr) {
+      board_flash_flush();
+      _flash_cache_addr = newAddr;
+      // current window contents is loaded lazily (on flush) for blocks not written
+      _flash_cache_valid = 0;
+      _flash_cache_dirty = 0;
+      _flash_page_checked = _flash_page_erased = 0;
+      _flash_run_start = _flash_run_end = 0;
+    }
 
-  if (newAddr != _flash_page_addr) {
-    board_flash_flush();
-    _flash_page_addr = newAddr;
-    status = FLASH_Read(&_flash_config, newAddr, _flash_cache, FLASH_PAGE_SIZE);
-    if (status != kStatus_Success) {
-      TU_LOG1("Flash read error at address = 0x%08lX\r\n", _flash_page_addr);
+    uint32_t const first = offset / FILESYSTEM_BLOCK_SIZE;
+    uint32_t const last = (offset + count + FILESYSTEM_BLOCK_SIZE - 1) / FILESYSTEM_BLOCK_SIZE;
+
+    if ( _flash_run_start == _flash_run_end ) {
+      _flash_run_start = offset;
+      _flash_run_end = offset;
+    } else if ( offset != _flash_run_end ) {
+      // not consecutive: complete blocks partially covered by current run or this payload, it starts a new run
+      flash_cache_fill(block_mask(_flash_run_start, _flash_run_end) | block_mask(offset, offset + count));
+      _flash_run_start = offset;
+      _flash_run_end = offset;
     }
+
+    memcpy(_flash_cache + offset, src, count);
+    _flash_run_end += count;
+
+    for ( uint32_t i = first; i < last; i++ ) {
+      // block is current once completely covered by the run
+      if ( _flash_run_start <= i * FILESYSTEM_BLOCK_SIZE && (i + 1) * FILESYSTEM_BLOCK_SIZE <= _flash_run_end ) {
+        _flash_cache_valid |= 1UL << i;
+      }
+      _flash_cache_dirty |= 1UL << i;
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
   }
-  memcpy(_flash_cache + (addr & (FLASH_PAGE_SIZE - 1)), data, len);
 
   return true;
 }
 
+// Windows are assembled in the cache, current contents is loaded for blocks not written
+bool board_flash_preserved(uint32_t addr, uint32_t len)
+{
+  (void) addr;
+  (void) len;
+  return true;
+}
+
 void board_flash_erase_app(void)
 {
   // TODO implement later
@@ -394,11 +653,41 @@ void board_timer_stop(void)
   SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
 }
 
+#if TINYUF2_IDLE_SLEEP && !defined(BUILD_NO_TINYUSB)
+void board_idle(void)
+{
+  // with PRIMASK set, an interrupt arriving after the check still ends WFI
+  __disable_irq();
+  if ( !tud_task_event_ready() ) __WFI();
+  __enable_irq();
+}
+#endif
+
 void SysTick_Handler (void)
 {
   board_timer_handler();
 }
 
+#if TINYUF2_STATS || TINYUF2_BOOT_TRACE || TINYUF2_EVENT_LOG
+uint32_t board_cycle_count(void)
+{
+  // enable DWT cycle counter on first use
+  if ( !(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) )
+  {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+
+  return DWT->CYCCNT;
+}
+
+uint32_t board_cycle_freq(void)
+{
+  return SystemCoreClock;
+}
+#endif
+
 int board_uart_write(void const * buf, int len)
 {
   USART_WriteBlocking(UART_DEV, (uint8_t *)buf, len);
@@ -34,6 +34,7 @@
 
 // Flash Start Address of Application
 #define BOARD_FLASH_APP_START    0x10000
+#define BOARD_FLASH_ERASE_SIZE   512
 
 #define TINYUF2_DBL_TAP_DFU      1
 #define TINYUF2_DBL_TAP_REG      RTC->GPREG[7]
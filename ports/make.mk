@@ -77,12 +77,26 @@ CFLAGS += \
 
 # Bootloader src, board folder and TinyUSB stack
 SRC_C += \
+  src/aes_ctr.c \
+  src/arena.c \
+  src/cdc.c \
+  src/config.c \
+  src/data_lun.c \
+  src/dfu.c \
   src/ghostfat.c \
   src/images.c \
   src/main.c \
   src/msc.c \
+  src/profile.c \
   src/screen.c \
+  src/sd_flash.c \
+  src/service.c \
+  src/sfdp.c \
+  src/signature.c \
+  src/staged.c \
+  src/uas.c \
   src/usb_descriptors.c \
+  src/vendor.c \
   $(subst $(TOP)/,,$(wildcard $(TOP)/$(BOARD_DIR)/*.c))
 
 endif # BUILD_APPLICATION
@@ -110,6 +124,7 @@ SRC_C += \
 	$(TINYUSB_DIR)/device/usbd.c \
 	$(TINYUSB_DIR)/device/usbd_control.c \
 	$(TINYUSB_DIR)/class/cdc/cdc_device.c \
+	$(TINYUSB_DIR)/class/dfu/dfu_device.c \
 	$(TINYUSB_DIR)/class/dfu/dfu_rt_device.c \
 	$(TINYUSB_DIR)/class/hid/hid_device.c \
 	$(TINYUSB_DIR)/class/msc/msc_device.c \
@@ -119,6 +134,31 @@ INC += $(TOP)/$(TINYUSB_DIR)
 
 endif # BUILD_NO_TINYUSB
 
+# Flash firmware from SD card, board implements board_sd_init() and board_sd_read()
+ifeq ($(SD_FLASH),1)
+  CFLAGS += -DTINYUF2_SD_FLASH=1
+  INC   += $(TOP)/lib/fatfs/source
+  SRC_C += lib/fatfs/source/ff.c
+endif
+
+# Only accept signed uf2 images, board folder provides sign_key.h (see tools/uf2sign.py).
+# micro-ecc is built for verify speed with secp256r1 only: level 3 unrolls the 8-word multiply and
+# square in ARM assembly (umaal on Cortex-M4/M7). Verify cycles are reported in STATS.TXT (STATS=1)
+ifeq ($(SIGNED_UF2),1)
+  UECC_DIR = ports/espressif/components/bootloader/subproject/components/micro-ecc/micro-ecc
+  CFLAGS += \
+    -DTINYUF2_SIGNED_UF2=1 \
+    -DuECC_OPTIMIZATION_LEVEL=3 \
+    -DuECC_SQUARE_FUNC=1 \
+    -DuECC_SUPPORTS_secp160r1=0 \
+    -DuECC_SUPPORTS_secp192r1=0 \
+    -DuECC_SUPPORTS_secp224r1=0 \
+    -DuECC_SUPPORTS_secp256k1=0 \
+    -DuECC_SUPPORT_COMPRESSED_POINT=0
+  INC   += $(TOP)/$(UECC_DIR)
+  SRC_C += $(UECC_DIR)/uECC.c
+endif
+
 #-------------- Debug & Log --------------
 
 # Debugging
@@ -132,7 +172,7 @@ endif
 LOG ?= 0
 CFLAGS += -DTUF2_LOG=$(LOG) -DCFG_TUSB_DEBUG=$(LOG)
 
-# Logger: default is uart, can be set to rtt or swo
+# Logger: default is uart, can be set to rtt, swo or cdc
 ifeq ($(LOGGER),rtt)
   RTT_SRC = lib/SEGGER_RTT
   CFLAGS += -DLOGGER_RTT -DSEGGER_RTT_MODE_DEFAULT=SEGGER_RTT_MODE_BLOCK_IF_FIFO_FULL
@@ -140,6 +180,8 @@ ifeq ($(LOGGER),rtt)
   SRC_C += $(RTT_SRC)/RTT/SEGGER_RTT.c
 else ifeq ($(LOGGER),swo)
   CFLAGS += -DLOGGER_SWO
+else ifeq ($(LOGGER),cdc)
+  CFLAGS += -DTINYUF2_CDC_LOG=1 -DCFG_TUD_CDC=1
 endif
 
 #-------------- Common Compiler Flags --------------
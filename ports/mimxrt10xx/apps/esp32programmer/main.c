@@ -42,8 +42,24 @@
 // i.e "--before no_reset" should not be include in the esptool.py command
 #define ESP32_DTR_RTS_BOOT_RESET_SUPPORT    0
 
-// optional API, not included in board_api.h
-int board_uart_read(uint8_t* buf, int len);
+// UART interrupt of UART_DEV
+#ifndef UART_IRQn
+  #define UART_IRQn         LPUART1_IRQn
+  #define UART_IRQHandler   LPUART1_IRQHandler
+#endif
+
+// UART -> USB: received by interrupt into a ring buffer so that no byte is lost (4-byte rx fifo) while
+// main loop services usb. Must be power of 2
+#define UART_RX_BUFSIZE     4096
+
+// USB -> UART: cdc data waiting to be fed into the tx fifo, without blocking main loop
+#define UART_TX_BUFSIZE     512
+
+// pending cdc data is sent once the uart line is idle, a SLIP frame (esptool/ROM bootloader protocol)
+// ends or after this many ms, full packets are sent by tud_cdc_write() right away
+#define CDC_FLUSH_MS        1
+
+#define SLIP_END            0xC0
 
 //--------------------------------------------------------------------+
 // MACRO TYPEDEF CONSTANT ENUM DECLARATION
@@ -55,6 +71,15 @@ int board_uart_read(uint8_t* buf, int len);
 static volatile uint32_t _timer_count = 0;
 static uint32_t baud_rate = 115200;
 
+static uint8_t _rx_buf[UART_RX_BUFSIZE];
+static volatile uint32_t _rx_wr = 0;
+static volatile uint32_t _rx_rd = 0;
+static volatile bool _rx_flush = false;
+
+static uint8_t _tx_buf[UART_TX_BUFSIZE];
+static uint32_t _tx_len = 0;
+static uint32_t _tx_pos = 0;
+
 //--------------------------------------------------------------------+
 // Timer
 //--------------------------------------------------------------------+
@@ -78,6 +103,106 @@ void board_timer_handler(void)
   _timer_count++;
 }
 
+//--------------------------------------------------------------------+
+// UART
+//--------------------------------------------------------------------+
+
+void UART_IRQHandler(void)
+{
+  static bool in_frame = false;
+  uint32_t const status = LPUART_GetStatusFlags(UART_DEV);
+
+  while ( LPUART_GetRxFifoCount(UART_DEV) )
+  {
+    uint8_t const ch = LPUART_ReadByte(UART_DEV);
+
+    // response of ROM bootloader is complete, esptool waits for it before sending next command
+    if ( ch == SLIP_END )
+    {
+      if ( in_frame ) _rx_flush = true;
+      in_frame = !in_frame;
+    }
+
+    // drop on overflow, host is not reading
+    if ( _rx_wr - _rx_rd < UART_RX_BUFSIZE )
+    {
+      _rx_buf[_rx_wr & (UART_RX_BUFSIZE - 1)] = ch;
+      _rx_wr++;
+    }
+  }
+
+  // end of a burst, main loop flushes cdc without waiting for more
+  if ( status & kLPUART_IdleLineFlag ) _rx_flush = true;
+
+  LPUART_ClearStatusFlags(UART_DEV, status & (kLPUART_IdleLineFlag | kLPUART_RxOverrunFlag | kLPUART_ParityErrorFlag |
+                                              kLPUART_FramingErrorFlag | kLPUART_NoiseErrorFlag));
+  SDK_ISR_EXIT_BARRIER;
+}
+
+static void uart_rx_start(void)
+{
+  LPUART_EnableInterrupts(UART_DEV, kLPUART_RxDataRegFullInterruptEnable | kLPUART_IdleLineInterruptEnable |
+                                    kLPUART_RxOverrunInterruptEnable);
+  EnableIRQ(UART_IRQn);
+}
+
+// UART -> USB, return true if data is moved
+static bool uart_to_cdc(void)
+{
+  static bool pending = false;
+  static uint32_t pending_ms;
+  bool moved = false;
+
+  uint32_t const avail = _rx_wr - _rx_rd;
+  if ( avail )
+  {
+    uint32_t const idx = _rx_rd & (UART_RX_BUFSIZE - 1);
+    uint32_t const contiguous = tu_min32(avail, UART_RX_BUFSIZE - idx);
+    uint32_t const count = tud_cdc_write(&_rx_buf[idx], contiguous);
+
+    if ( count )
+    {
+      _rx_rd += count;
+      moved = true;
+      if ( !pending )
+      {
+        pending = true;
+        pending_ms = millis();
+      }
+    }
+  }
+
+  // coalesce short packets: flush at end of burst/frame (once all is queued) or data waited long enough
+  if ( pending && ((_rx_flush && _rx_wr == _rx_rd) || (millis() - pending_ms >= CDC_FLUSH_MS)) )
+  {
+    _rx_flush = false;
+    pending = false;
+    tud_cdc_write_flush();
+  }
+
+  return moved;
+}
+
+// USB -> UART, feed tx fifo without waiting. Return true if data is moved
+static bool cdc_to_uart(void)
+{
+  bool moved = false;
+
+  if ( _tx_pos == _tx_len && tud_cdc_available() )
+  {
+    _tx_len = tud_cdc_read(_tx_buf, sizeof(_tx_buf));
+    _tx_pos = 0;
+  }
+
+  while ( _tx_pos < _tx_len && LPUART_GetTxFifoCount(UART_DEV) < FSL_FEATURE_LPUART_FIFO_SIZEn(UART_DEV) )
+  {
+    LPUART_WriteByte(UART_DEV, _tx_buf[_tx_pos++]);
+    moved = true;
+  }
+
+  return moved;
+}
+
 //--------------------------------------------------------------------+
 // ESP32 Helper
 //--------------------------------------------------------------------+
@@ -126,6 +251,7 @@ int main(void)
   GPIO_PinInit(ESP32_RESET_PORT, ESP32_RESET_PIN, &pin_config);
 
   board_uart_init(115200);
+  uart_rx_start();
   board_usb_init();
   tusb_init();
 
@@ -135,32 +261,18 @@ int main(void)
   esp32_manual_enter_dfu();
 #endif
 
+  bool led_on = false;
+
   while(1)
   {
-    uint8_t serial_buf[512];
-    uint32_t count;
+    bool active = uart_to_cdc();
+    active |= cdc_to_uart();
 
-    // UART -> USB
-    count = (uint32_t) board_uart_read(serial_buf, sizeof(serial_buf));
-    if (count)
+    // LED shows activity, only written on change
+    if ( active != led_on )
     {
-      board_led_write(0xff);
-
-      tud_cdc_write(serial_buf, count);
-      tud_cdc_write_flush();
-
-      board_led_write(0);
-    }
-
-    // USB -> UART
-    while ( tud_cdc_available() )
-    {
-      board_led_write(0xff);
-
-      count = tud_cdc_read(serial_buf, sizeof(serial_buf));
-      board_uart_write(serial_buf, count);
-
-      board_led_write(0);
+      led_on = active;
+      board_led_write(led_on ? 0xff : 0);
     }
 
     tud_task();
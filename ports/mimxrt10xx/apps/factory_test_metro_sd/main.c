@@ -66,6 +66,7 @@ bool testpins(uint8_t a, uint8_t b, uint8_t *allpins, uint8_t num_allpins);
 void test_print_adc(void);
 
 bool test_sd(void);
+void test_sd_speed(void);
 
 //--------------------------------------------------------------------+
 // MACRO TYPEDEF CONSTANT ENUM DECLARATION
@@ -413,12 +414,60 @@ bool test_sd(void) {
   if (status == kStatus_Success) {
     uint32_t card_size_mb = sdcard.blockCount / 2 / 1024;
     printf("Card size: %lu MB\r\n", card_size_mb);
+    tud_cdc_write_flush();
+
+    test_sd_speed();
   }
   tud_cdc_write_flush();
 
   return true;
 }
 
+// Bulk throughput with multi-block commands (CMD18/CMD25), SD_SPEED_CHUNK blocks per command.
+// Write test writes back the data just read to the same blocks, card contents are not changed
+#define SD_SPEED_CHUNK    32
+#define SD_SPEED_BLOCKS   256
+
+static uint8_t sd_speed_buf[SD_SPEED_CHUNK * 512] __attribute__((aligned(4)));
+
+static uint32_t sd_speed_kbps(uint32_t ms) {
+  return ms ? (SD_SPEED_BLOCKS / 2 * 1000UL / ms) : 0;
+}
+
+void test_sd_speed(void) {
+  uint32_t read_ms = 0;
+  uint32_t write_ms = 0;
+  bool write_ok = true;
+
+  for (uint32_t block = 0; block < SD_SPEED_BLOCKS; block += SD_SPEED_CHUNK) {
+    uint32_t start = millis();
+    status_t status = SDSPI_ReadBlocks(&sdcard, sd_speed_buf, block, SD_SPEED_CHUNK);
+    read_ms += millis() - start;
+
+    if (status != kStatus_Success) {
+      printf("SD read block %lu: %ld\r\n", block, status);
+      return;
+    }
+
+    if (write_ok) {
+      start = millis();
+      status = SDSPI_WriteBlocks(&sdcard, sd_speed_buf, block, SD_SPEED_CHUNK);
+      write_ms += millis() - start;
+
+      if (status != kStatus_Success) {
+        // e.g write protected, keep measuring read
+        printf("SD write block %lu: %ld\r\n", block, status);
+        write_ok = false;
+      }
+    }
+  }
+
+  printf("SD read: %lu KB/s\r\n", sd_speed_kbps(read_ms));
+  if (write_ok) {
+    printf("SD write: %lu KB/s\r\n", sd_speed_kbps(write_ms));
+  }
+}
+
 //--------------------------------------------------------------------+
 // Logger newlib retarget
 //--------------------------------------------------------------------+
@@ -24,9 +24,7 @@
 
 #include "board_api.h"
 #include "romapi_flash.h"
-
-#define FLASH_CACHE_SIZE          4096
-#define FLASH_CACHE_INVALID_ADDR  0xffffffff
+#include "compile_date.h"
 
 // FLASH
 #define NO_CACHE        0xffffffff
@@ -34,16 +32,61 @@
 #define SECTOR_SIZE     (4*1024)
 #define FLASH_PAGE_SIZE 256
 
+// Writes are collected in a write-back cache of sector slots with LRU eviction, so interleaved host
+// writes do not flush and reload the same sector repeatedly. A slot is flushed when evicted (together
+// with the cached sectors adjacent to it) or on completion. Changed adjacent sectors are flushed as a run:
+// one erase (64KB block erase when a run covers a block) and one D-Cache invalidate per run.
+// Parts with 128KB+ DTCM cache 16 sectors, the others a single sector.
+#ifndef BOARD_FLASH_CACHE_SIZE
+  #if defined(MIMXRT1042_SERIES) || defined(MIMXRT1052_SERIES) || defined(MIMXRT1062_SERIES) || \
+      defined(MIMXRT1064_SERIES) || defined(MIMXRT1176_cm7_SERIES)
+    #define BOARD_FLASH_CACHE_SIZE  (64*1024)
+  #else
+    #define BOARD_FLASH_CACHE_SIZE  SECTOR_SIZE
+  #endif
+#endif
+
+#define FLASH_CACHE_SECTORS   (BOARD_FLASH_CACHE_SIZE / SECTOR_SIZE)
+#define SECTOR_PAGES          (SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+#if (BOARD_FLASH_CACHE_SIZE % SECTOR_SIZE) || BOARD_FLASH_CACHE_SIZE < SECTOR_SIZE
+  #error "BOARD_FLASH_CACHE_SIZE must be a multiple of sector size"
+#endif
+
 // on-board flash is connected to FLEXSPI2 on rt1064
 #if defined(MIMXRT1064_SERIES)
   #define FLEXSPI_INSTANCE    1
   #define FLEXSPI_FLASH_BASE  FlexSPI2_AMBA_BASE
+  #define FLEXSPI_PERIPH      FLEXSPI2
 #elif defined(MIMXRT1176_cm7_SERIES)
   #define FLEXSPI_INSTANCE    1
   #define FLEXSPI_FLASH_BASE  FlexSPI1_AMBA_BASE
+  #define FLEXSPI_PERIPH      FLEXSPI1
 #else
   #define FLEXSPI_INSTANCE    0
   #define FLEXSPI_FLASH_BASE  FlexSPI_AMBA_BASE
+  #define FLEXSPI_PERIPH      FLEXSPI
+#endif
+
+// AHB RX buffer space given to the CPU for readback (CURRENT.UF2, verify), 0 keeps the FCFB/ROM setup
+#ifndef BOARD_FLEXSPI_AHB_BUF_SIZE
+  #define BOARD_FLEXSPI_AHB_BUF_SIZE  1024
+#endif
+
+// TinyUF2 code, vectors and data are all in RAM and the usb ISR with the tinyusb event queue in ITCM
+// (linker/common.ld): nothing touches FlexSPI while a command is in flight, so usb keeps being serviced
+// during erase and program. Set to 1 if a board adds interrupt handlers or data located in flash, each
+// erase unit and page is then done with interrupts masked
+#ifndef BOARD_FLASH_IRQ_MASK
+  #define BOARD_FLASH_IRQ_MASK  0
+#endif
+
+#if BOARD_FLASH_IRQ_MASK
+  #define FLASH_IRQ_DISABLE()   __disable_irq()
+  #define FLASH_IRQ_ENABLE()    __enable_irq()
+#else
+  #define FLASH_IRQ_DISABLE()
+  #define FLASH_IRQ_ENABLE()
 #endif
 
 // defined in linker
@@ -57,29 +100,285 @@ extern uint32_t _fcfb_length[];
 extern flexspi_nor_config_t const qspiflash_config;
 static flexspi_nor_config_t* flash_cfg = (flexspi_nor_config_t*)(uintptr_t) &qspiflash_config;
 
-static uint32_t _flash_page_addr = NO_CACHE;
-static uint8_t  _flash_cache[SECTOR_SIZE] __attribute__((aligned(4)));
+TUF2_DFU_NOINIT static uint8_t _flash_cache[FLASH_CACHE_SECTORS][SECTOR_SIZE] __attribute__((aligned(4)));
+
+typedef struct
+{
+  uint32_t addr;  // sector address, NO_CACHE if slot is free
+  uint32_t used;  // LRU stamp
+
+  // bit set for each 256-byte page that holds written data, the rest is only read from
+  // flash on flush. A sector written completely is never pre-loaded.
+  uint16_t valid;
+
+  // bit set for each page written since the sector was cached: pages loaded by flash_cache_fill()
+  // are flash contents already and are skipped when checking for changes on flush
+  uint16_t dirty;
+} flash_slot_t;
+
+static flash_slot_t _flash_slot[FLASH_CACHE_SECTORS] = { [0 ... FLASH_CACHE_SECTORS-1] = { .addr = NO_CACHE } };
+static uint32_t _flash_lru_stamp = 0;
+
+TUF2_HOT static int flash_slot_find(uint32_t sector_addr)
+{
+  for ( int i = 0; i < FLASH_CACHE_SECTORS; ++i )
+  {
+    if ( _flash_slot[i].addr == sector_addr ) return i;
+  }
+  return -1;
+}
+
+// Load current flash contents of pages [first, last) of a slot that were not written
+TUF2_HOT static void flash_cache_fill(uint32_t slot, uint32_t first, uint32_t last)
+{
+  flash_slot_t* fs = &_flash_slot[slot];
+
+  for ( uint32_t i = first; i < last; ++i )
+  {
+    if ( !(fs->valid & (1UL << i)) )
+    {
+      memcpy(_flash_cache[slot] + i * FLASH_PAGE_SIZE, (void*) (fs->addr + i * FLASH_PAGE_SIZE), FLASH_PAGE_SIZE);
+      fs->valid |= 1UL << i;
+    }
+  }
+}
+
+// Check if written pages of a slot differ from flash
+TUF2_HOT static bool flash_sector_changed(uint32_t slot)
+{
+  flash_slot_t const* fs = &_flash_slot[slot];
+
+  for ( uint32_t i = 0; i < SECTOR_PAGES; ++i )
+  {
+    if ( (fs->dirty & (1UL << i)) &&
+         0 != memcmp(_flash_cache[slot] + i * FLASH_PAGE_SIZE, (void*) (fs->addr + i * FLASH_PAGE_SIZE), FLASH_PAGE_SIZE) )
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// AHB RX buffers may still hold (prefetched) contents of programmed flash, software reset drops them.
+// Configuration registers are kept.
+static void flexspi_ahb_flush(void)
+{
+  while ( !(FLEXSPI_PERIPH->STS0 & FLEXSPI_STS0_ARBIDLE_MASK) ) {}
+  FLEXSPI_PERIPH->MCR0 |= FLEXSPI_MCR0_SWRESET_MASK;
+  while ( FLEXSPI_PERIPH->MCR0 & FLEXSPI_MCR0_SWRESET_MASK ) {}
+}
+
+// Invalidate AHB RX buffers then D-Cache of [addr, addr+len): in this order so that a cache line refill
+// in between can not pick up stale buffer contents
+static void flash_invalidate(uint32_t addr, uint32_t len)
+{
+  flexspi_ahb_flush();
+
+  uint32_t const start = addr & ~(__SCB_DCACHE_LINE_SIZE - 1U);
+  uint32_t const end = (addr + len + __SCB_DCACHE_LINE_SIZE - 1U) & ~(__SCB_DCACHE_LINE_SIZE - 1U);
+  SCB_InvalidateDCache_by_Addr((uint32_t *) start, (int32_t) (end - start));
+}
+
+// Readback setup: ROM init applies the AHB setup of the boot FCFB, which is tuned for booting the
+// application (usually small buffers split between masters). TinyUF2 runs from SRAM so the AHB
+// window is only used for reading flash contents: give the whole RX buffer to the CPU (master 0)
+// with prefetch, so that sequential memcpy of CURRENT.UF2 streams whole buffer fills.
+static void flexspi_ahb_readback_init(void)
+{
+#if BOARD_FLEXSPI_AHB_BUF_SIZE
+  FLEXSPI_Type* const base = FLEXSPI_PERIPH;
+  uint32_t const buf_count = sizeof(base->AHBRXBUFCR0) / sizeof(base->AHBRXBUFCR0[0]);
+
+  __disable_irq();
+  while ( !(base->STS0 & FLEXSPI_STS0_ARBIDLE_MASK) || !(base->STS0 & FLEXSPI_STS0_SEQIDLE_MASK) ) {}
+
+  base->MCR0 |= FLEXSPI_MCR0_MDIS_MASK;
+
+  for ( uint32_t i = 0; i < buf_count; i++ )
+  {
+    uint32_t cr0 = base->AHBRXBUFCR0[i] & ~(FLEXSPI_AHBRXBUFCR0_BUFSZ_MASK | FLEXSPI_AHBRXBUFCR0_MSTRID_MASK |
+                                            FLEXSPI_AHBRXBUFCR0_PRIORITY_MASK);
+    if ( i == buf_count - 1 )
+    {
+      // BUFSZ is in 64-bit units
+      cr0 |= FLEXSPI_AHBRXBUFCR0_BUFSZ(BOARD_FLEXSPI_AHB_BUF_SIZE / 8) | FLEXSPI_AHBRXBUFCR0_MSTRID(0) |
+             FLEXSPI_AHBRXBUFCR0_PRIORITY(0);
+#ifdef FLEXSPI_AHBRXBUFCR0_PREFETCHEN_MASK
+      cr0 |= FLEXSPI_AHBRXBUFCR0_PREFETCHEN_MASK;
+#endif
+    }
+    else
+    {
+      // unused, no master matches
+      cr0 |= FLEXSPI_AHBRXBUFCR0_MSTRID(FLEXSPI_AHBRXBUFCR0_MSTRID_MASK >> FLEXSPI_AHBRXBUFCR0_MSTRID_SHIFT);
+    }
+    base->AHBRXBUFCR0[i] = cr0;
+  }
+
+  // prefetch, cacheable and read address optimization (align reads to the buffer size)
+  base->AHBCR |= FLEXSPI_AHBCR_PREFETCHEN_MASK | FLEXSPI_AHBCR_CACHABLEEN_MASK |
+                 FLEXSPI_AHBCR_BUFFERABLEEN_MASK | FLEXSPI_AHBCR_READADDROPT_MASK;
+
+  base->MCR0 &= ~FLEXSPI_MCR0_MDIS_MASK;
+  __enable_irq();
+
+  flash_invalidate(FLEXSPI_FLASH_BASE, BOARD_FLASH_SIZE);
+#endif
+}
+
+// Erase and program a run of slots holding adjacent sectors (ascending address)
+static bool flash_program_run(uint8_t const* slots, uint32_t count)
+{
+  status_t status;
+  uint32_t const run_addr = _flash_slot[slots[0]].addr;
+  uint32_t const run_len = count * SECTOR_SIZE;
+  uint32_t const offset = run_addr - FLEXSPI_FLASH_BASE;
+
+  TUF2_LOG1("Erase and Write at address = 0x%08lX, len = %lu\r\n", run_addr, run_len);
+
+  for ( uint32_t s = 0; s < count; ++s ) flash_cache_fill(slots[s], 0, SECTOR_PAGES);
+
+  // one erase unit per call (block where the run covers an aligned one), so that any masked window
+  // is a single erase and usb events queued meanwhile are handled between units
+  status = kStatus_Success;
+  for ( uint32_t pos = 0; pos < run_len && status == kStatus_Success; )
+  {
+    uint32_t const block_size = flash_cfg->blockSize;
+    uint32_t len = SECTOR_SIZE;
+    if ( block_size > SECTOR_SIZE && ((offset + pos) % block_size) == 0 && run_len - pos >= block_size ) len = block_size;
+
+    FLASH_IRQ_DISABLE();
+    status = ROM_FLEXSPI_NorFlash_Erase(FLEXSPI_INSTANCE, flash_cfg, offset + pos, len);
+    FLASH_IRQ_ENABLE();
+    pos += len;
+  }
+
+  if ( status != kStatus_Success )
+  {
+    TUF2_LOG1("Erase failed: status = %ld!\r\n", status);
+  }
+
+  for ( uint32_t s = 0; s < count && status == kStatus_Success; ++s )
+  {
+    for ( uint32_t i = 0; i < SECTOR_PAGES && status == kStatus_Success; ++i )
+    {
+      FLASH_IRQ_DISABLE();
+      status = ROM_FLEXSPI_NorFlash_ProgramPage(FLEXSPI_INSTANCE, flash_cfg, offset + s * SECTOR_SIZE + i * FLASH_PAGE_SIZE,
+                                                (uint32_t*) (_flash_cache[slots[s]] + i * FLASH_PAGE_SIZE));
+      FLASH_IRQ_ENABLE();
+    }
+
+    if ( status != kStatus_Success )
+    {
+      TUF2_LOG1("Page program failed: status = %ld!\r\n", status);
+    }
+  }
+
+  // AMBA view of the run is stale (also after a failure)
+  flash_invalidate(run_addr, run_len);
+
+  return status == kStatus_Success;
+}
+
+// Write back and free cached sectors in [start, end): unchanged ones are dropped,
+// changed ones are programmed in runs of adjacent sectors
+static void flash_cache_flush_range(uint32_t start, uint32_t end)
+{
+  uint8_t slots[FLASH_CACHE_SECTORS];
+  uint32_t count = 0;
+
+  // changed slots in range, sorted by address
+  for ( uint8_t i = 0; i < FLASH_CACHE_SECTORS; ++i )
+  {
+    flash_slot_t* fs = &_flash_slot[i];
+    if ( fs->addr == NO_CACHE || fs->addr < start || fs->addr >= end ) continue;
+
+    if ( !flash_sector_changed(i) )
+    {
+      fs->addr = NO_CACHE;
+      continue;
+    }
+
+    uint32_t j = count++;
+    while ( j > 0 && _flash_slot[slots[j - 1]].addr > fs->addr )
+    {
+      slots[j] = slots[j - 1];
+      j--;
+    }
+    slots[j] = i;
+  }
+
+  bool ok = true;
+  for ( uint32_t first = 0; first < count; )
+  {
+    uint32_t last = first + 1;
+    while ( last < count && _flash_slot[slots[last]].addr == _flash_slot[slots[last - 1]].addr + SECTOR_SIZE ) last++;
+
+    if ( ok ) ok = flash_program_run(slots + first, last - first);
+    first = last;
+  }
+
+  for ( uint32_t i = 0; i < count; ++i ) _flash_slot[slots[i]].addr = NO_CACHE;
+}
+
+// Get a slot for sector: free slot or evict least recently used one
+static uint32_t flash_slot_alloc(uint32_t sector_addr)
+{
+  int slot = flash_slot_find(NO_CACHE);
+
+  if ( slot < 0 )
+  {
+    slot = 0;
+    for ( int i = 1; i < FLASH_CACHE_SECTORS; ++i )
+    {
+      if ( (int32_t) (_flash_slot[i].used - _flash_slot[slot].used) < 0 ) slot = i;
+    }
+
+    // flush the victim together with cached sectors adjacent to it to keep runs (and block erase)
+    uint32_t start = _flash_slot[slot].addr;
+    uint32_t end = start + SECTOR_SIZE;
+    while ( flash_slot_find(start - SECTOR_SIZE) >= 0 ) start -= SECTOR_SIZE;
+    while ( flash_slot_find(end) >= 0 ) end += SECTOR_SIZE;
+
+    flash_cache_flush_range(start, end);
+  }
+
+  // Current contents of the sector is loaded lazily (on flush) for pages not written
+  _flash_slot[slot].addr = sector_addr;
+  _flash_slot[slot].valid = 0;
+  _flash_slot[slot].dirty = 0;
+
+  return (uint32_t) slot;
+}
 
 // compare and write tinyuf2 to flash every time it is running
 #define COMPARE_AND_WRITE_TINYUF2   0
 
+// Build stamp of the image: it is part of the image both in SRAM and on flash, comparing it (and the
+// first sector holding FCFB, IVT and vector table) instead of the whole image keeps the check O(1)
+__attribute__((used)) static char const _tinyuf2_stamp[] = UF2_VERSION " " COMPILE_DATE " " COMPILE_TIME;
+
+// flash address of data in the running image
+static inline uint32_t image_to_flash(void const* ram_addr)
+{
+  return FCFB_START_ADDRESS + ((uint32_t) ram_addr - (uint32_t) &qspiflash_config);
+}
+
 // Check if TinyUF2 running in SRAM matches the on flash contents
 static bool compare_tinyuf2_ram_vs_flash(void)
 {
 #if COMPARE_AND_WRITE_TINYUF2
   uint8_t const* image_data = (uint8_t const *) &qspiflash_config;
-  uint32_t flash_addr = FCFB_START_ADDRESS;
-
-  // fcfb + bootloader (ivt, interrupt, text)
-  uint32_t const end_addr = FLEXSPI_FLASH_BASE + BOARD_BOOT_LENGTH;
+  uint32_t const head_len = SECTOR_SIZE - (FCFB_START_ADDRESS & (SECTOR_SIZE - 1));
 
-  return 0 == memcmp((void const*) flash_addr, image_data, end_addr-flash_addr);
+  return 0 == memcmp((void const*) FCFB_START_ADDRESS, image_data, head_len) &&
+         0 == memcmp((void const*) image_to_flash(_tinyuf2_stamp), _tinyuf2_stamp, sizeof(_tinyuf2_stamp));
 #else
   return true;
 #endif
 }
 
-// Write TinyUF2 from SRAM to Flash
+// Write TinyUF2 from SRAM to Flash, only sectors that differ are rewritten
 static void write_tinyuf2_to_flash(void)
 {
   uint8_t const* image_data = (uint8_t const *) &qspiflash_config;
@@ -87,21 +386,84 @@ static void write_tinyuf2_to_flash(void)
 
   // fcfb + bootloader (ivt, interrupt, text)
   uint32_t const end_addr = FLEXSPI_FLASH_BASE + BOARD_BOOT_LENGTH;
+  uint32_t count = 0;
 
   TUF2_LOG1("Writing TinyUF2 image to flash.\r\n");
   while ( flash_addr < end_addr )
   {
-    board_flash_write(flash_addr, image_data, FLASH_PAGE_SIZE);
-    flash_addr += FLASH_PAGE_SIZE;
-    image_data += FLASH_PAGE_SIZE;
+    // up to the next sector boundary
+    uint32_t const len = SECTOR_SIZE - (flash_addr & (SECTOR_SIZE - 1));
+
+    if ( 0 != memcmp((void const*) flash_addr, image_data, len) )
+    {
+      board_flash_write(flash_addr, image_data, len);
+      count++;
+    }
+    flash_addr += len;
+    image_data += len;
   }
   board_flash_flush();
-  TUF2_LOG1("TinyUF2 copied to flash.\r\n");
+  TUF2_LOG1("TinyUF2 copied to flash, %lu sectors rewritten.\r\n", count);
 }
 
+// Fast read profile: the boot FCFB stays conservative so that the BootROM can always boot, a board may
+// name a faster serial clock (BOARD_FLEXSPI_FAST_CLK, e.g kFlexSpiSerialClk_100MHz) and read sample
+// source (BOARD_FLEXSPI_FAST_SAMPLE) for its flash. The profile is only kept if the start of flash reads
+// back the same as with the boot FCFB, otherwise FlexSPI is initialized with the boot FCFB again.
+// Applied on DFU entry and before jumping to the application, which then runs XIP at the faster clock.
+#ifdef BOARD_FLEXSPI_FAST_CLK
+
+#ifndef BOARD_FLEXSPI_FAST_SAMPLE
+  #define BOARD_FLEXSPI_FAST_SAMPLE   kFlexSPIReadSampleClk_LoopbackFromDqsPad
+#endif
+
+static flexspi_nor_config_t _flash_fast_cfg;
+
+void board_flash_fast_read_init(void)
+{
+  if ( flash_cfg == &_flash_fast_cfg ) return;
+
+  // reference contents read with the boot FCFB, cache is not in use: init or jump to application
+  uint8_t* const ref = _flash_cache[0];
+  flash_invalidate(FLEXSPI_FLASH_BASE, SECTOR_SIZE);
+  memcpy(ref, (void const*) FLEXSPI_FLASH_BASE, SECTOR_SIZE);
+
+  memcpy(&_flash_fast_cfg, &qspiflash_config, sizeof(_flash_fast_cfg));
+  _flash_fast_cfg.memConfig.serialClkFreq = BOARD_FLEXSPI_FAST_CLK;
+  _flash_fast_cfg.memConfig.readSampleClkSrc = BOARD_FLEXSPI_FAST_SAMPLE;
+
+  bool matched = false;
+  if ( kStatus_Success == ROM_FLEXSPI_NorFlash_Init(FLEXSPI_INSTANCE, &_flash_fast_cfg) )
+  {
+    flash_invalidate(FLEXSPI_FLASH_BASE, SECTOR_SIZE);
+    matched = (0 == memcmp(ref, (void const*) FLEXSPI_FLASH_BASE, SECTOR_SIZE));
+  }
+
+  if ( matched )
+  {
+    flash_cfg = &_flash_fast_cfg;
+  }
+  else
+  {
+    ROM_FLEXSPI_NorFlash_Init(FLEXSPI_INSTANCE, flash_cfg);
+  }
+  flash_invalidate(FLEXSPI_FLASH_BASE, BOARD_FLASH_SIZE);
+
+  TUF2_LOG1("FlexSPI fast read profile %s\r\n", matched ? "enabled" : "failed, boot FCFB kept");
+}
+
+#else
+
+void board_flash_fast_read_init(void)
+{
+}
+
+#endif
+
 void board_flash_init(void)
 {
   ROM_FLEXSPI_NorFlash_Init(FLEXSPI_INSTANCE, flash_cfg);
+  flexspi_ahb_readback_init();
 
   // TinyUF2 will copy its image to flash if one of conditions meets:
   // - Boot Mode is '01' i.e Serial Download Mode (BootRom)
@@ -117,88 +479,127 @@ void board_flash_init(void)
   {
     write_tinyuf2_to_flash();
   }
+
+  // after the image check so that a blank flash is not used as read-back reference
+  board_flash_fast_read_init();
+  flexspi_ahb_readback_init();
 }
 
 uint32_t board_flash_size(void)
 {
+#if TINYUF2_CURRENT_UF2_EXTENT
+  // CURRENT.UF2 only covers the programmed application, no need to limit flash size
+  return BOARD_FLASH_SIZE;
+#else
   // TODO currently limit at 8MB since the CURRENT.UF2 can occupies all 32MB virtual disk
   uint32_t const max_size = 8*1024*1024;
   return (BOARD_FLASH_SIZE < max_size) ? BOARD_FLASH_SIZE : max_size;
+#endif
 }
 
-void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
+board_flash_info_t const* board_flash_info(void)
 {
-  // Must write out anything in cache before trying to read.
-  //board_flash_flush();
+  // QSPI NOR, figures of a typical part (e.g W25Q): 4KB sector erase, 256 bytes page program
+  static flash_region_t const regions[] = { { SECTOR_SIZE, BOARD_FLASH_SIZE / SECTOR_SIZE } };
+  static board_flash_info_t const info =
+  {
+    .geometry     = FLASH_GEOMETRY(FLEXSPI_FLASH_BASE, regions),
+    .xip_base     = FLEXSPI_FLASH_BASE,
+    .erased_word  = 0xFFFFFFFFUL,
+    .program_size = FLASH_PAGE_SIZE,
+    .caps         = BOARD_FLASH_CAP_BIT_CLEAR | BOARD_FLASH_CAP_XIP,
+    .erase_us     = 45000,
+    .program_us   = 400,
+  };
+  return &info;
+}
 
+TUF2_HOT void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
+{
   memcpy(buffer, (uint8_t*) addr, len);
+
+  // overlay written data still in cache
+  for ( uint32_t slot = 0; slot < FLASH_CACHE_SECTORS; ++slot )
+  {
+    flash_slot_t const* fs = &_flash_slot[slot];
+    if ( fs->addr == NO_CACHE || fs->addr >= addr + len || fs->addr + SECTOR_SIZE <= addr ) continue;
+
+    for ( uint32_t i = 0; i < SECTOR_PAGES; ++i )
+    {
+      uint32_t const page_addr = fs->addr + i * FLASH_PAGE_SIZE;
+      if ( !(fs->valid & (1UL << i)) || page_addr >= addr + len || page_addr + FLASH_PAGE_SIZE <= addr ) continue;
+
+      uint32_t const start = (page_addr > addr) ? page_addr : addr;
+      uint32_t const end = (page_addr + FLASH_PAGE_SIZE < addr + len) ? (page_addr + FLASH_PAGE_SIZE) : (addr + len);
+      memcpy((uint8_t*) buffer + (start - addr), _flash_cache[slot] + (start - fs->addr), end - start);
+    }
+  }
 }
 
-void board_flash_flush(void)
+// FlexSPI window is readable by the usb DMA as it is by the CPU, unless written data is still cached
+void const* board_flash_mapped(uint32_t addr, uint32_t len)
 {
-  status_t status;
+  if ( addr & 3 ) return NULL;
+
+  for ( uint32_t slot = 0; slot < FLASH_CACHE_SECTORS; ++slot )
+  {
+    flash_slot_t const* fs = &_flash_slot[slot];
+    if ( fs->addr != NO_CACHE && fs->valid && fs->addr < addr + len && fs->addr + SECTOR_SIZE > addr ) return NULL;
+  }
 
-  if ( _flash_page_addr == NO_CACHE ) return;
+  return (void const*) addr;
+}
 
-  TUF2_LOG1("Erase and Write at address = 0x%08lX\r\n",_flash_page_addr);
+void board_flash_flush(void)
+{
+  flash_cache_flush_range(0, NO_CACHE);
+}
 
-  // Skip if data is the same
-  if ( memcmp(_flash_cache, (void*) _flash_page_addr, SECTOR_SIZE) != 0 )
+TUF2_HOT bool board_flash_write (uint32_t addr, void const *src, uint32_t len)
+{
+  uint8_t const* src8 = (uint8_t const*) src;
+
+  // payload may cross sector boundary
+  while ( len )
   {
-    uint32_t const sector_addr = (_flash_page_addr - FLEXSPI_FLASH_BASE);
+    uint32_t const sector_addr = addr & ~(SECTOR_SIZE - 1);
+    uint32_t const offset = addr & (SECTOR_SIZE - 1);
+    uint32_t const count = (len < SECTOR_SIZE - offset) ? len : (SECTOR_SIZE - offset);
 
-    __disable_irq();
-    status = ROM_FLEXSPI_NorFlash_Erase(FLEXSPI_INSTANCE, flash_cfg, sector_addr, SECTOR_SIZE);
-    __enable_irq();
+    int found = flash_slot_find(sector_addr);
+    uint32_t const slot = (found >= 0) ? (uint32_t) found : flash_slot_alloc(sector_addr);
+    flash_slot_t* fs = &_flash_slot[slot];
 
-    SCB_InvalidateDCache_by_Addr((uint32_t *)sector_addr, SECTOR_SIZE);
+    fs->used = ++_flash_lru_stamp;
 
-    if ( status != kStatus_Success )
+    // Partial page write: load current contents of the touched pages into the cache first
+    if ( (offset | count) & (FLASH_PAGE_SIZE - 1) )
     {
-      TUF2_LOG1("Erase failed: status = %ld!\r\n", status);
-      return;
+      flash_cache_fill(slot, offset / FLASH_PAGE_SIZE, (offset + count + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE);
     }
 
-    for ( int i = 0; i < SECTOR_SIZE / FLASH_PAGE_SIZE; ++i )
+    // Overwrite part or all of the page cache with the src data.
+    memcpy(_flash_cache[slot] + offset, src8, count);
+
+    for ( uint32_t i = offset / FLASH_PAGE_SIZE; i < (offset + count + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE; i++ )
     {
-      uint32_t const page_addr = sector_addr + i * FLASH_PAGE_SIZE;
-      void* page_data =  _flash_cache + i * FLASH_PAGE_SIZE;
-
-      __disable_irq();
-      status = ROM_FLEXSPI_NorFlash_ProgramPage(FLEXSPI_INSTANCE, flash_cfg, page_addr, (uint32_t*) page_data);
-      __enable_irq();
-
-      if ( status != kStatus_Success )
-      {
-        TUF2_LOG1("Page program failed: status = %ld!\r\n", status);
-        return;
-      }
+      fs->valid |= 1UL << i;
+      fs->dirty |= 1UL << i;
     }
 
-    SCB_InvalidateDCache_by_Addr((uint32_t *)sector_addr, SECTOR_SIZE);
+    addr += count;
+    src8 += count;
+    len  -= count;
   }
 
-  _flash_page_addr = NO_CACHE;
+  return true;
 }
 
-bool board_flash_write (uint32_t addr, void const *src, uint32_t len)
+// Sectors are assembled in the cache, current contents is loaded for what is not written
+bool board_flash_preserved(uint32_t addr, uint32_t len)
 {
-  uint32_t const page_addr = addr & ~(SECTOR_SIZE - 1);
-
-  if ( page_addr != _flash_page_addr )
-  {
-    // Write out anything in cache before overwriting it.
-    board_flash_flush();
-
-    _flash_page_addr = page_addr;
-
-    // Copy the current contents of the entire page into the cache.
-    memcpy(_flash_cache, (void*) page_addr, SECTOR_SIZE);
-  }
-
-  // Overwrite part or all of the page cache with the src data.
-  memcpy(_flash_cache + (addr & (SECTOR_SIZE - 1)), src, len);
-
+  (void) addr;
+  (void) len;
   return true;
 }
 
@@ -208,7 +609,9 @@ void board_flash_erase_app(void)
 
   // Perform chip erase first
   ROM_FLEXSPI_NorFlash_Init(FLEXSPI_INSTANCE, flash_cfg);
+  flexspi_ahb_readback_init();
   ROM_FLEXSPI_NorFlash_EraseAll(FLEXSPI_INSTANCE, flash_cfg);
+  flash_invalidate(FLEXSPI_FLASH_BASE, BOARD_FLASH_SIZE);
 
   // write bootloader to flash
   TUF2_LOG1("Erase app firmware: ");
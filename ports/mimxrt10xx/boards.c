@@ -44,8 +44,22 @@ static bool _dfu_mode = false;
 // needed by fsl_flexspi_nor_boot
 const uint8_t dcd_data[] = { 0x00 };
 
+// ITCM code (TUF2_HOT, usb driver, memcpy), see linker/common.ld
+extern uint32_t __itcm_start__[], __itcm_end__[], __ITCM_ROM[];
+
+// Copy ITCM code before anything calls it, memcpy itself is located there
+static void itcm_init(void)
+{
+  uint32_t const* src = __ITCM_ROM;
+  for ( volatile uint32_t* dst = __itcm_start__; dst < __itcm_end__; ) *dst++ = *src++;
+  __DSB();
+  __ISB();
+}
+
 void board_init(void)
 {
+  itcm_init();
+
 #if defined(__DCACHE_PRESENT) && __DCACHE_PRESENT
   if (SCB_CCR_DC_Msk != (SCB_CCR_DC_Msk & SCB->CCR)) SCB_EnableDCache();
 #endif
@@ -87,6 +101,9 @@ void board_init(void)
 
 void board_teardown(void)
 {
+  // application runs XIP with the fast read profile of the board
+  board_flash_fast_read_init();
+
   // no GPIO deinit for GPIO: LED, Neopixel, Button
 #if TUF2_LOG && defined(UART_DEV)
   LPUART_Deinit(UART_DEV);
@@ -255,11 +272,42 @@ void board_timer_stop(void)
   SysTick->CTRL = 0;
 }
 
+#if TINYUF2_IDLE_SLEEP && !defined(BUILD_NO_TINYUSB)
+void board_idle(void)
+{
+  // with PRIMASK set, an interrupt arriving after the check still ends WFI
+  __disable_irq();
+  if ( !tud_task_event_ready() ) __WFI();
+  __enable_irq();
+}
+#endif
+
 void SysTick_Handler(void)
 {
   board_timer_handler();
 }
 
+#if TINYUF2_STATS || TINYUF2_BOOT_TRACE || TINYUF2_EVENT_LOG || defined(BOARD_UF2_ESP32_FAMILY_ID)
+uint32_t board_cycle_count(void)
+{
+  // enable DWT cycle counter on first use, Cortex-M7 requires unlocking DWT access first
+  if ( !(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) )
+  {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+
+  return DWT->CYCCNT;
+}
+
+uint32_t board_cycle_freq(void)
+{
+  return SystemCoreClock;
+}
+#endif
+
 //--------------------------------------------------------------------+
 // LED / RGB
 //--------------------------------------------------------------------+
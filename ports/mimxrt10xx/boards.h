@@ -56,6 +56,15 @@ extern uint32_t _board_boot_length[];
 #endif
 #endif
 
+// Hot path runs from ITCM, placed by linker/common.ld and copied by board_init()
+#define TUF2_HOT                __attribute__((section(".hotfunc")))
+
+// DFU-only state is not zeroed by the startup code, placed by linker/common.ld
+#define TUF2_DFU_NOINIT         __attribute__((section(".dfu_noinit")))
+
+// Switch FlexSPI to the board's fast read profile (BOARD_FLEXSPI_FAST_CLK) if it reads back correctly
+void board_flash_fast_read_init(void);
+
 // Double Reset tap to enter DFU
 #define TINYUF2_DBL_TAP_DFU     1
 #define TINYUF2_DBL_TAP_REG     SNVS->LPGPR[3]
@@ -31,6 +31,10 @@
 // Size of on-board external flash
 #define BOARD_FLASH_SIZE      (8*1024*1024)
 
+// Fast read profile, probed at runtime (boot FCFB keeps the conservative setup)
+#define BOARD_FLEXSPI_FAST_CLK     kFlexSpiSerialClk_100MHz
+#define BOARD_FLEXSPI_FAST_SAMPLE  kFlexSPIReadSampleClk_LoopbackFromDqsPad
+
 //--------------------------------------------------------------------+
 // LED
 //--------------------------------------------------------------------+
@@ -31,6 +31,9 @@
 // Size of on-chip 4MB flash
 #define BOARD_FLASH_SIZE      (4*1024*1024)
 
+// Fast read profile, probed at runtime (boot FCFB keeps the conservative setup)
+#define BOARD_FLEXSPI_FAST_CLK     kFlexSpiSerialClk_100MHz
+
 //--------------------------------------------------------------------+
 // LED
 //--------------------------------------------------------------------+
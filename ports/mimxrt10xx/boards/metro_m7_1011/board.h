@@ -88,5 +88,8 @@
 #define ESP32_RESET_PORT      GPIO1
 #define ESP32_RESET_PIN       21
 
+// uf2 blocks of the ESP32 family are flashed to the co-processor through its ROM bootloader
+#define BOARD_UF2_ESP32_FAMILY_ID  0x1c5f21b0
+
 
 #endif /* BOARD_H_ */
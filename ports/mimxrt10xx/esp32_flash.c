@@ -0,0 +1,569 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "board_api.h"
+
+// ESP32 co-processor flashed by uf2 family BOARD_UF2_ESP32_FAMILY_ID through its ROM bootloader on
+// UART_DEV (same protocol as esptool, see apps/esp32programmer). On the first block the ESP32 is reset
+// into the ROM with GPIO0/EN, synced at 115200 and switched to BOARD_ESP32_BAUD. Payloads are collected
+// per ESP32_CHUNK_SIZE unit of ESP32 flash, each unit is deflated (greedy matches, fixed Huffman,
+// stored if that does not pay off) and sent with FLASH_DEFL_BEGIN/DATA, so transfer time is
+// bound by the UART line rate. Bytes of a unit the file does not cover are written as erased (0xFF).
+// Flush sends the last unit and resets the ESP32 into the new firmware. UART_DEV is also the log
+// output: log lines fall between SLIP frames and are ignored by the ROM.
+#ifdef BOARD_UF2_ESP32_FAMILY_ID
+
+#include "fsl_gpio.h"
+#include "fsl_iomuxc.h"
+#include "fsl_lpuart.h"
+
+// highest rate of the ROM bootloader
+#ifndef BOARD_ESP32_BAUD
+#define BOARD_ESP32_BAUD    921600
+#endif
+
+#ifndef BOARD_ESP32_FLASH_SIZE
+#define BOARD_ESP32_FLASH_SIZE  (4*1024*1024)
+#endif
+
+#define ESP32_CHUNK_SIZE    (4*1024)   // erase unit of ESP32 flash
+#define ESP32_BLOCK_SIZE    0x400      // FLASH_WRITE_SIZE of the ROM
+#define ESP32_ROM_BAUD      115200
+#define ESP32_INVALID_ADDR  0xffffffff
+
+// zlib header, adler32 and a stored block header on top of the data
+#define DEFL_MAX_SIZE       (ESP32_CHUNK_SIZE + 16)
+
+enum
+{
+  ESP_SYNC           = 0x08,
+  ESP_SPI_SET_PARAMS = 0x0B,
+  ESP_SPI_ATTACH     = 0x0D,
+  ESP_CHANGE_BAUD    = 0x0F,
+  ESP_DEFL_BEGIN     = 0x10,
+  ESP_DEFL_DATA      = 0x11,
+  ESP_DEFL_END       = 0x12,
+};
+
+#define SLIP_END      0xC0
+#define SLIP_ESC      0xDB
+#define SLIP_ESC_END  0xDC
+#define SLIP_ESC_ESC  0xDD
+
+static uint8_t _esp_chunk[ESP32_CHUNK_SIZE];
+static uint8_t _esp_defl[DEFL_MAX_SIZE];
+static uint32_t _esp_addr = ESP32_INVALID_ADDR; // ESP32 flash offset of the unit in _esp_chunk
+static bool _esp_ready = false;                 // ROM bootloader synced at BOARD_ESP32_BAUD
+static bool _esp_failed = false;                // no answer, remaining blocks are rejected
+
+//--------------------------------------------------------------------+
+// Timing and UART
+//--------------------------------------------------------------------+
+
+static inline uint32_t ms_cycles(uint32_t ms)
+{
+  return ms * (board_cycle_freq() / 1000);
+}
+
+static void esp32_delay(uint32_t ms)
+{
+  uint32_t const start = board_cycle_count();
+  while ( board_cycle_count() - start < ms_cycles(ms) ) {}
+}
+
+static void uart_drain(void)
+{
+  while ( LPUART_GetRxFifoCount(UART_DEV) ) (void) LPUART_ReadByte(UART_DEV);
+  LPUART_ClearStatusFlags(UART_DEV, kLPUART_RxOverrunFlag | kLPUART_ParityErrorFlag | kLPUART_FramingErrorFlag |
+                                    kLPUART_NoiseErrorFlag);
+}
+
+static void slip_write(uint8_t const* data, uint32_t len)
+{
+  for ( uint32_t i = 0; i < len; i++ )
+  {
+    uint8_t const ch = data[i];
+    if ( ch == SLIP_END )
+    {
+      uint8_t const esc[2] = { SLIP_ESC, SLIP_ESC_END };
+      LPUART_WriteBlocking(UART_DEV, esc, 2);
+    }
+    else if ( ch == SLIP_ESC )
+    {
+      uint8_t const esc[2] = { SLIP_ESC, SLIP_ESC_ESC };
+      LPUART_WriteBlocking(UART_DEV, esc, 2);
+    }
+    else
+    {
+      LPUART_WriteBlocking(UART_DEV, &ch, 1);
+    }
+  }
+}
+
+//--------------------------------------------------------------------+
+// ROM bootloader protocol
+//--------------------------------------------------------------------+
+
+static inline void put_u32(uint8_t* buf, uint32_t value)
+{
+  buf[0] = (uint8_t) value;
+  buf[1] = (uint8_t) (value >> 8);
+  buf[2] = (uint8_t) (value >> 16);
+  buf[3] = (uint8_t) (value >> 24);
+}
+
+// Wait for the response frame of cmd, true if its status is success
+static bool esp_response(uint8_t cmd, uint32_t timeout_ms)
+{
+  uint8_t resp[16];
+  uint32_t len = 0;
+  bool in_frame = false;
+  bool escaped = false;
+  uint32_t const start = board_cycle_count();
+
+  while ( board_cycle_count() - start < ms_cycles(timeout_ms) )
+  {
+    if ( !LPUART_GetRxFifoCount(UART_DEV) ) continue;
+    uint8_t ch = LPUART_ReadByte(UART_DEV);
+
+    if ( ch == SLIP_END )
+    {
+      // header: direction, command, size, value, then status bytes (4 for the ESP32 ROM)
+      if ( in_frame && len >= 12 && resp[0] == 0x01 && resp[1] == cmd )
+      {
+        uint32_t const size = resp[2] | ((uint32_t) resp[3] << 8);
+        uint32_t const status = 8 + size - 4;
+        return size >= 4 && status < len && status < sizeof(resp) && resp[status] == 0;
+      }
+      in_frame = true;
+      len = 0;
+      continue;
+    }
+
+    if ( !in_frame ) continue;
+    if ( escaped )
+    {
+      ch = (ch == SLIP_ESC_END) ? SLIP_END : SLIP_ESC;
+      escaped = false;
+    }
+    else if ( ch == SLIP_ESC )
+    {
+      escaped = true;
+      continue;
+    }
+
+    // only the header and status bytes are of interest, e.g SYNC responses are short
+    if ( len < sizeof(resp) ) resp[len] = ch;
+    len++;
+  }
+
+  return false;
+}
+
+// Send request with header then data (e.g DEFL_DATA payload, part of the checksum)
+static bool esp_command(uint8_t cmd, uint8_t const* hdr, uint32_t hdr_len, uint8_t const* data, uint32_t data_len,
+                        uint32_t timeout_ms)
+{
+  uint8_t checksum = 0xEF;
+  for ( uint32_t i = 0; i < data_len; i++ ) checksum ^= data[i];
+
+  uint8_t head[8] = { 0x00, cmd };
+  uint32_t const size = hdr_len + data_len;
+  head[2] = (uint8_t) size;
+  head[3] = (uint8_t) (size >> 8);
+  put_u32(head + 4, data ? checksum : 0);
+
+  uart_drain();
+
+  uint8_t const end = SLIP_END;
+  LPUART_WriteBlocking(UART_DEV, &end, 1);
+  slip_write(head, sizeof(head));
+  slip_write(hdr, hdr_len);
+  if ( data ) slip_write(data, data_len);
+  LPUART_WriteBlocking(UART_DEV, &end, 1);
+
+  return esp_response(cmd, timeout_ms);
+}
+
+static void esp32_reset(bool bootloader)
+{
+  GPIO_PinWrite(ESP32_GPIO0_PORT, ESP32_GPIO0_PIN, 1);
+  GPIO_PinWrite(ESP32_RESET_PORT, ESP32_RESET_PIN, 0);
+  esp32_delay(100);
+
+  GPIO_PinWrite(ESP32_GPIO0_PORT, ESP32_GPIO0_PIN, bootloader ? 0 : 1);
+  GPIO_PinWrite(ESP32_RESET_PORT, ESP32_RESET_PIN, 1);
+  esp32_delay(50);
+
+  GPIO_PinWrite(ESP32_GPIO0_PORT, ESP32_GPIO0_PIN, 1);
+}
+
+// Reset ESP32 into its ROM bootloader (esp32_manual_enter_dfu of apps/esp32programmer) and prepare it
+static bool esp32_begin(void)
+{
+  static bool pins_init = false;
+  if ( !pins_init )
+  {
+    pins_init = true;
+    gpio_pin_config_t pin_config = { kGPIO_DigitalOutput, 1, kGPIO_NoIntmode };
+
+    IOMUXC_SetPinMux(ESP32_GPIO0_PINMUX, 0);
+    IOMUXC_SetPinConfig(ESP32_GPIO0_PINMUX, 0x10B0U);
+    GPIO_PinInit(ESP32_GPIO0_PORT, ESP32_GPIO0_PIN, &pin_config);
+
+    IOMUXC_SetPinMux(ESP32_RESET_PINMUX, 0);
+    IOMUXC_SetPinConfig(ESP32_RESET_PINMUX, 0x10B0U);
+    GPIO_PinInit(ESP32_RESET_PORT, ESP32_RESET_PIN, &pin_config);
+  }
+
+  board_uart_init(ESP32_ROM_BAUD);
+  esp32_reset(true);
+
+  static uint8_t const sync[36] = {
+    0x07, 0x07, 0x12, 0x20,
+    0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
+    0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
+  };
+
+  bool synced = false;
+  for ( uint32_t i = 0; i < 10 && !synced; i++ ) synced = esp_command(ESP_SYNC, sync, sizeof(sync), NULL, 0, 100);
+  if ( !synced ) return false;
+
+  // ROM answers a SYNC several times
+  esp32_delay(20);
+
+  // new baud then 0 for the ROM (stub would expect the current one)
+  uint8_t baud[8] = { 0 };
+  put_u32(baud, BOARD_ESP32_BAUD);
+  if ( !esp_command(ESP_CHANGE_BAUD, baud, sizeof(baud), NULL, 0, 100) ) return false;
+
+  board_uart_init(BOARD_ESP32_BAUD);
+  esp32_delay(50);
+  uart_drain();
+
+  uint8_t attach[8] = { 0 };
+  if ( !esp_command(ESP_SPI_ATTACH, attach, sizeof(attach), NULL, 0, 100) ) return false;
+
+  // id, total size, block, sector, page size and status mask
+  uint8_t params[24];
+  put_u32(params +  0, 0);
+  put_u32(params +  4, BOARD_ESP32_FLASH_SIZE);
+  put_u32(params +  8, 64*1024);
+  put_u32(params + 12, ESP32_CHUNK_SIZE);
+  put_u32(params + 16, 256);
+  put_u32(params + 20, 0xFFFF);
+  if ( !esp_command(ESP_SPI_SET_PARAMS, params, sizeof(params), NULL, 0, 100) ) return false;
+
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Deflate (zlib stream) of a unit
+//--------------------------------------------------------------------+
+
+static struct
+{
+  uint8_t* out;
+  uint32_t len;
+  uint32_t bits;
+  uint32_t count;
+} _bw;
+
+static inline bool bw_put(uint32_t value, uint32_t nbits)
+{
+  _bw.bits |= value << _bw.count;
+  _bw.count += nbits;
+  while ( _bw.count >= 8 )
+  {
+    if ( _bw.len >= DEFL_MAX_SIZE ) return false;
+    _bw.out[_bw.len++] = (uint8_t) _bw.bits;
+    _bw.bits >>= 8;
+    _bw.count -= 8;
+  }
+  return true;
+}
+
+// Huffman codes are sent most significant bit first
+static inline bool bw_put_code(uint32_t code, uint32_t nbits)
+{
+  uint32_t rev = 0;
+  for ( uint32_t i = 0; i < nbits; i++ ) rev |= ((code >> i) & 1) << (nbits - 1 - i);
+  return bw_put(rev, nbits);
+}
+
+static inline bool put_fixed_symbol(uint32_t sym)
+{
+  if ( sym < 144 ) return bw_put_code(0x30 + sym, 8);
+  if ( sym < 256 ) return bw_put_code(0x190 + sym - 144, 9);
+  if ( sym < 280 ) return bw_put_code(sym - 256, 7);
+  return bw_put_code(0xC0 + sym - 280, 8);
+}
+
+static uint16_t const _len_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static uint8_t const _len_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static uint16_t const _dist_base[24] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073
+};
+
+// last position of each 3-byte hash within the unit
+#define DEFL_HASH_BITS  10
+static uint16_t _defl_hash[1 << DEFL_HASH_BITS];
+
+static inline uint32_t defl_hash(uint8_t const* p)
+{
+  uint32_t const v = p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16);
+  return (uint32_t) (v * 2654435761u) >> (32 - DEFL_HASH_BITS);
+}
+
+static inline uint32_t match_len(uint8_t const* data, uint32_t pos, uint32_t ref, uint32_t len)
+{
+  uint32_t n = 0;
+  while ( pos + n < len && n < 258 && data[ref + n] == data[pos + n] ) n++;
+  return n;
+}
+
+static bool put_match(uint32_t mlen, uint32_t dist)
+{
+  uint32_t code = 28;
+  while ( _len_base[code] > mlen ) code--;
+  if ( !put_fixed_symbol(257 + code) ) return false;
+  if ( _len_extra[code] && !bw_put(mlen - _len_base[code], _len_extra[code]) ) return false;
+
+  uint32_t dcode = 23;
+  while ( _dist_base[dcode] > dist ) dcode--;
+  if ( !bw_put_code(dcode, 5) ) return false;
+  uint32_t const dextra = (dcode < 4) ? 0 : (dcode / 2 - 1);
+  return !dextra || bw_put(dist - _dist_base[dcode], dextra);
+}
+
+// Single fixed Huffman block with greedy matches (last position of the hash and the previous byte
+// repeated), false if it does not fit the output buffer
+static bool deflate_fixed(uint8_t const* data, uint32_t len)
+{
+  if ( !bw_put(1, 1) || !bw_put(1, 2) ) return false; // BFINAL, BTYPE fixed
+
+  memset(_defl_hash, 0xFF, sizeof(_defl_hash));
+
+  uint32_t i = 0;
+  while ( i < len )
+  {
+    uint32_t best = 0;
+    uint32_t dist = 0;
+
+    if ( i + 3 <= len )
+    {
+      uint32_t const h = defl_hash(data + i);
+      uint32_t const ref = _defl_hash[h];
+      _defl_hash[h] = (uint16_t) i;
+
+      if ( ref != 0xFFFF )
+      {
+        best = match_len(data, i, ref, len);
+        dist = i - ref;
+      }
+      if ( i && best < 258 )
+      {
+        uint32_t const run = match_len(data, i, i - 1, len);
+        if ( run > best )
+        {
+          best = run;
+          dist = 1;
+        }
+      }
+    }
+
+    if ( best >= 3 )
+    {
+      if ( !put_match(best, dist) ) return false;
+      for ( uint32_t k = 1; k < best && i + k + 3 <= len; k++ ) _defl_hash[defl_hash(data + i + k)] = (uint16_t) (i + k);
+      i += best;
+    }
+    else
+    {
+      if ( !put_fixed_symbol(data[i]) ) return false;
+      i++;
+    }
+  }
+
+  // end of block, then pad to byte
+  return put_fixed_symbol(256) && bw_put(0, 7);
+}
+
+// zlib stream of data into _esp_defl, return its size
+static uint32_t deflate_unit(uint8_t const* data, uint32_t len)
+{
+  _bw.out = _esp_defl;
+  _bw.out[0] = 0x78;
+  _bw.out[1] = 0x01;
+  _bw.len = 2;
+  _bw.bits = 0;
+  _bw.count = 0;
+
+  // data meant to stay the same size (e.g compressed assets) goes in a stored block
+  if ( !deflate_fixed(data, len) || _bw.len > 2 + 5 + len )
+  {
+    _bw.len = 2;
+    uint8_t* out = _bw.out + 2;
+    out[0] = 0x01; // BFINAL, BTYPE stored
+    out[1] = (uint8_t) len;
+    out[2] = (uint8_t) (len >> 8);
+    out[3] = (uint8_t) ~len;
+    out[4] = (uint8_t) (~len >> 8);
+    memcpy(out + 5, data, len);
+    _bw.len += 5 + len;
+  }
+
+  uint32_t a = 1, b = 0;
+  for ( uint32_t i = 0; i < len; i++ )
+  {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  uint32_t const adler = (b << 16) | a;
+
+  _bw.out[_bw.len++] = (uint8_t) (adler >> 24);
+  _bw.out[_bw.len++] = (uint8_t) (adler >> 16);
+  _bw.out[_bw.len++] = (uint8_t) (adler >> 8);
+  _bw.out[_bw.len++] = (uint8_t) adler;
+
+  return _bw.len;
+}
+
+//--------------------------------------------------------------------+
+// UF2 family
+//--------------------------------------------------------------------+
+
+static bool esp32_send_unit(void)
+{
+  if ( !_esp_ready )
+  {
+    _esp_ready = esp32_begin();
+    if ( !_esp_ready )
+    {
+      TUF2_LOG1("ESP32: no answer from ROM bootloader\r\n");
+      _esp_failed = true;
+      return false;
+    }
+  }
+
+  uint32_t const size = deflate_unit(_esp_chunk, ESP32_CHUNK_SIZE);
+  uint32_t const num_blocks = (size + ESP32_BLOCK_SIZE - 1) / ESP32_BLOCK_SIZE;
+
+  // erase size, packet count, packet size and offset
+  uint8_t begin[16];
+  put_u32(begin +  0, ESP32_CHUNK_SIZE);
+  put_u32(begin +  4, num_blocks);
+  put_u32(begin +  8, ESP32_BLOCK_SIZE);
+  put_u32(begin + 12, _esp_addr);
+  if ( !esp_command(ESP_DEFL_BEGIN, begin, sizeof(begin), NULL, 0, 3000) ) return false;
+
+  for ( uint32_t seq = 0; seq < num_blocks; seq++ )
+  {
+    uint32_t const offset = seq * ESP32_BLOCK_SIZE;
+    uint32_t const count = (size - offset < ESP32_BLOCK_SIZE) ? (size - offset) : ESP32_BLOCK_SIZE;
+
+    uint8_t hdr[16] = { 0 };
+    put_u32(hdr + 0, count);
+    put_u32(hdr + 4, seq);
+    if ( !esp_command(ESP_DEFL_DATA, hdr, sizeof(hdr), _esp_defl + offset, count, 1000) ) return false;
+  }
+
+  return true;
+}
+
+static void esp32_flash_flush(void)
+{
+  if ( _esp_addr == ESP32_INVALID_ADDR ) return;
+
+  if ( !_esp_failed && !esp32_send_unit() ) TUF2_LOG1("ESP32: failed to write 0x%08lX\r\n", _esp_addr);
+  _esp_addr = ESP32_INVALID_ADDR;
+
+  // run the new firmware, next block starts another session
+  if ( _esp_ready )
+  {
+    // stay in the ROM, hard reset below also works when the last unit failed
+    uint8_t end[4] = { 1 };
+    (void) esp_command(ESP_DEFL_END, end, sizeof(end), NULL, 0, 100);
+    esp32_reset(false);
+    _esp_ready = false;
+
+#if TUF2_LOG
+    board_uart_init(BOARD_UART_BAUDRATE);
+#endif
+  }
+
+  // next file tries again
+  _esp_failed = false;
+}
+
+static bool esp32_flash_write(uint32_t addr, void const* data, uint32_t len)
+{
+  if ( _esp_failed || addr >= BOARD_ESP32_FLASH_SIZE || len > BOARD_ESP32_FLASH_SIZE - addr ) return false;
+
+  uint8_t const* src = (uint8_t const*) data;
+
+  // payload may cross unit boundary
+  while ( len )
+  {
+    uint32_t const unit = addr & ~(ESP32_CHUNK_SIZE - 1);
+    uint32_t const offset = addr & (ESP32_CHUNK_SIZE - 1);
+    uint32_t const count = (len < ESP32_CHUNK_SIZE - offset) ? len : (ESP32_CHUNK_SIZE - offset);
+
+    if ( unit != _esp_addr )
+    {
+      if ( _esp_addr != ESP32_INVALID_ADDR && !esp32_send_unit() )
+      {
+        TUF2_LOG1("ESP32: failed to write 0x%08lX\r\n", _esp_addr);
+      }
+      _esp_addr = unit;
+      memset(_esp_chunk, 0xFF, ESP32_CHUNK_SIZE);
+    }
+
+    memcpy(_esp_chunk + offset, src, count);
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+
+  return true;
+}
+
+static board_uf2_family_t const _uf2_families[] =
+{
+  { .family_id = BOARD_UF2_ESP32_FAMILY_ID, .write = esp32_flash_write, .flush = esp32_flash_flush },
+};
+
+board_uf2_family_t const* board_uf2_families(uint32_t* count)
+{
+  *count = sizeof(_uf2_families) / sizeof(_uf2_families[0]);
+  return _uf2_families;
+}
+
+#endif
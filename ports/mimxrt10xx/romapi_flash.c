@@ -175,7 +175,8 @@ status_t ROM_FLEXSPI_NorFlash_Init (uint32_t instance, flexspi_nor_config_t *con
   return status;
 }
 
-status_t ROM_FLEXSPI_NorFlash_EraseSector (uint32_t instance, flexspi_nor_config_t *config, uint32_t address)
+// Erase sector or block at address with erase sequence from LUT
+static status_t flexspi_nor_erase(uint32_t instance, flexspi_nor_config_t *config, uint32_t address, uint32_t seqId)
 {
   status_t status;
   flexspi_xfer_t flashXfer;
@@ -194,7 +195,7 @@ status_t ROM_FLEXSPI_NorFlash_EraseSector (uint32_t instance, flexspi_nor_config
     flashXfer.baseAddress = address;
     flashXfer.operation = kFlexSpiOperation_Command;
     flashXfer.seqNum = 1;
-    flashXfer.seqId = NOR_CMD_LUT_SEQ_IDX_ERASESECTOR;
+    flashXfer.seqId = seqId;
     flashXfer.isParallelModeEnable = isParallelMode;
 
     status = flexspi_command_xfer(instance, &flashXfer);
@@ -203,7 +204,7 @@ status_t ROM_FLEXSPI_NorFlash_EraseSector (uint32_t instance, flexspi_nor_config
       break;
     }
 
-    // Wait until the sector erase operation completes on Serial NOR Flash side.
+    // Wait until the erase operation completes on Serial NOR Flash side.
     status = flexspi_device_wait_busy(instance, memCfg, isParallelMode, address);
     if ( status != kStatus_Success )
     {
@@ -217,6 +218,16 @@ status_t ROM_FLEXSPI_NorFlash_EraseSector (uint32_t instance, flexspi_nor_config
   return status;
 }
 
+status_t ROM_FLEXSPI_NorFlash_EraseSector (uint32_t instance, flexspi_nor_config_t *config, uint32_t address)
+{
+  return flexspi_nor_erase(instance, config, address, NOR_CMD_LUT_SEQ_IDX_ERASESECTOR);
+}
+
+status_t ROM_FLEXSPI_NorFlash_EraseBlock (uint32_t instance, flexspi_nor_config_t *config, uint32_t address)
+{
+  return flexspi_nor_erase(instance, config, address, NOR_CMD_LUT_SEQ_IDX_ERASEBLOCK);
+}
+
 status_t ROM_FLEXSPI_NorFlash_Erase (uint32_t instance, flexspi_nor_config_t *config, uint32_t start, uint32_t length)
 {
   uint32_t aligned_start;
@@ -236,12 +247,23 @@ status_t ROM_FLEXSPI_NorFlash_Erase (uint32_t instance, flexspi_nor_config_t *co
 
     while ( aligned_start < aligned_end )
     {
-      status = ROM_FLEXSPI_NorFlash_EraseSector(instance, config, aligned_start);
+      // block erase (LUT sequence 8) where the range covers a whole aligned block
+      uint32_t const block_size = config->blockSize;
+      if ( block_size > config->sectorSize && (aligned_start % block_size) == 0 && aligned_end - aligned_start >= block_size )
+      {
+        status = ROM_FLEXSPI_NorFlash_EraseBlock(instance, config, aligned_start);
+        aligned_start += block_size;
+      }
+      else
+      {
+        status = ROM_FLEXSPI_NorFlash_EraseSector(instance, config, aligned_start);
+        aligned_start += config->sectorSize;
+      }
+
       if ( status != kStatus_Success )
       {
         return status;
       }
-      aligned_start += config->sectorSize;
     }
   } while ( 0 );
 
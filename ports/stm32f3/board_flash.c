@@ -23,6 +23,7 @@
  */
 
 #include "board_api.h"
+#include "flash_geometry.h"
 
 #ifndef BUILD_NO_TINYUSB
 #include "tusb.h"
@@ -44,8 +45,23 @@ enum {
   BOOTLOADER_SECTOR_COUNT = ((BOARD_FLASH_APP_START - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE)
 };
 
+static flash_region_t const _flash_regions[] = {
+  { BOARD_PAGE_SIZE, SECTOR_COUNT },
+};
+
+static flash_geometry_t const _flash_geo = FLASH_GEOMETRY(FLASH_BASE_ADDR, _flash_regions);
+
 static uint8_t erased_sectors[SECTOR_COUNT] = {0};
 
+#if TINYUF2_FLASH_CACHE
+// cache one page (erase unit) in RAM, then program on flush only if contents differ
+#define FLASH_CACHE_SIZE          BOARD_PAGE_SIZE
+#define FLASH_CACHE_INVALID_ADDR  0xffffffff
+
+static uint32_t _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+static uint8_t  _flash_cache[FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+#endif
+
 //--------------------------------------------------------------------+
 // Internal Helper
 //--------------------------------------------------------------------+
@@ -55,40 +71,100 @@ static inline uint32_t flash_sector_size(uint32_t sector) {
   return BOARD_PAGE_SIZE;
 }
 
-static bool is_blank(uint32_t addr, uint32_t size) {
-  for (uint32_t i = 0; i < size; i += sizeof(uint32_t)) {
-    if (*(uint32_t*) (addr + i) != 0xffffffff) {
-      return false;
+static inline bool is_blank(uint32_t addr, uint32_t size) {
+  return flash_is_blank(addr, size);
+}
+
+// Wait for the operation at addr up to its deadline (TINYUF2_FLASH_TIMEOUT), waited for again after
+// a backoff when overrun, HAL_TIMEOUT once TINYUF2_FLASH_RETRIES are exhausted
+static HAL_StatusTypeDef flash_wait(uint32_t deadline_ms, uint32_t addr) {
+  HAL_StatusTypeDef status = FLASH_WaitForLastOperation(deadline_ms);
+  for (uint32_t attempt = 1; status == HAL_TIMEOUT; attempt++) {
+    bool const failed = attempt > TINYUF2_FLASH_RETRIES;
+    uf2_flash_timeout(addr, failed);
+    if (failed) break;
+    HAL_Delay(uf2_flash_backoff_ms(attempt));
+    status = FLASH_WaitForLastOperation(deadline_ms);
+  }
+  return status;
+}
+
+#if TINYUF2_FLASH_VERIFY_CRC
+// Consecutive writes within a page form a run verified once: source words are fed to the CRC unit
+// as they are programmed and its running value is saved every VERIFY_BLOCK_SIZE bytes. When the run
+// ends (page complete, non-consecutive write or flush) flash is fed through the unit again, the
+// first saved value that differs locates the bad block.
+#define VERIFY_BLOCK_SIZE   256
+#define VERIFY_BLOCK_COUNT  (BOARD_PAGE_SIZE / VERIFY_BLOCK_SIZE)
+
+static uint32_t _verify_addr;
+static uint32_t _verify_len; // 0: no run
+static uint32_t _verify_crc[VERIFY_BLOCK_COUNT];
+
+static void flash_verify_finish(void) {
+  if (!_verify_len) return;
+
+  uint32_t const len = _verify_len;
+  uint32_t const expected = CRC->DR;
+  _verify_len = 0;
+
+  CRC->CR = CRC_CR_RESET;
+  uint32_t const* word = (uint32_t const*) _verify_addr;
+  for (uint32_t offset = 0; offset < len;) {
+    CRC->DR = word[offset / 4];
+    offset += 4;
+
+    if ((offset % VERIFY_BLOCK_SIZE) == 0 || offset == len) {
+      uint32_t const crc = (offset == len) ? expected : _verify_crc[offset / VERIFY_BLOCK_SIZE - 1];
+      if (CRC->DR != crc) {
+        TUF2_LOG1("Failed to write: %08lX\r\n", _verify_addr + (offset - 1) / VERIFY_BLOCK_SIZE * VERIFY_BLOCK_SIZE);
+        return;
+      }
     }
   }
-  return true;
 }
 
+// Add programmed words to the run, dst and len are word aligned
+static void flash_verify_add(uint32_t dst, uint8_t const* src, uint32_t len) {
+  for (uint32_t i = 0; i < len; i += 4) {
+    if (_verify_len && dst + i != _verify_addr + _verify_len) flash_verify_finish();
+    if (!_verify_len) {
+      _verify_addr = dst + i;
+      CRC->CR = CRC_CR_RESET;
+    }
+
+    uint32_t word;
+    memcpy(&word, src + i, 4);
+    CRC->DR = word;
+    _verify_len += 4;
+    if ((_verify_len % VERIFY_BLOCK_SIZE) == 0) _verify_crc[_verify_len / VERIFY_BLOCK_SIZE - 1] = CRC->DR;
+
+    // page complete
+    if (((dst + i + 4) & (BOARD_PAGE_SIZE - 1)) == 0) flash_verify_finish();
+  }
+}
+#endif
+
 static bool flash_erase_sector(uint32_t addr) {
 #ifndef TINYUF2_SELF_UPDATE
   // skip erasing bootloader if not self-update
   TUF2_ASSERT(addr >= BOARD_FLASH_APP_START);
 #endif
 
-  // starting address from 0x08000000
-  uint32_t sector_addr = FLASH_BASE_ADDR;
-  bool erased = false;
-  uint32_t size = 0;
+  flash_sector_t info;
+  TUF2_ASSERT(flash_sector_find(&_flash_geo, addr, &info));
 
-  for (uint32_t i = 0; i < SECTOR_COUNT; i++) {
-    TUF2_ASSERT(sector_addr < FLASH_BASE_ADDR + BOARD_FLASH_SIZE);
-
-    size = flash_sector_size(i);
-    if (sector_addr + size > addr) {
-      erased = erased_sectors[i];
-      erased_sectors[i] = 1;    // don't erase anymore - we will continue writing here!
-      break;
-    }
-    sector_addr += size;
-  }
+  uint32_t const sector_addr = info.addr;
+  uint32_t const size = info.size;
+  bool const erased = erased_sectors[info.index];
+  erased_sectors[info.index] = 1;    // don't erase anymore - we will continue writing here!
 
   if (!erased && !is_blank(sector_addr, size)) {
     TUF2_LOG1("Erase: %08lX size = %lu KB ... ", sector_addr, size / 1024);
+#if TINYUF2_FLASH_VERIFY_CRC
+    // pending run may be in this page (next session)
+    flash_verify_finish();
+#endif
 
     FLASH_EraseInitTypeDef EraseInit;
     EraseInit.TypeErase = FLASH_TYPEERASE_PAGES;
@@ -97,7 +173,7 @@ static bool flash_erase_sector(uint32_t addr) {
 
     uint32_t SectorError = 0;
     HAL_FLASHEx_Erase(&EraseInit, &SectorError);
-    FLASH_WaitForLastOperation(HAL_MAX_DELAY);
+    (void) flash_wait(uf2_flash_erase_deadline_ms(size), sector_addr);
     TUF2_ASSERT(SectorError == 0xFFFFFFFF);
 
     TUF2_LOG1("OK\r\n");
@@ -107,60 +183,156 @@ static bool flash_erase_sector(uint32_t addr) {
 }
 
 static void flash_write(uint32_t dst, const uint8_t* src, int len) {
-  flash_erase_sector(dst);
-
   TUF2_LOG1("Write flash at address %08lX\r\n", dst);
   for (int i = 0; i < len; i += 4) {
+    // payload may cross page boundary, erase each page when entering it
+    if (i == 0 || ((dst + i) & (BOARD_PAGE_SIZE - 1)) == 0) {
+      flash_erase_sector(dst + i);
+    }
+
     uint32_t data = *((uint32_t*) ((void*) (src + i)));
 
+    // erased value (padding, gaps) reads the same without programming
+    if (data == 0xFFFFFFFFUL) continue;
+
     if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, dst + i, (uint64_t) data) != HAL_OK) {
       TUF2_LOG1("Failed to write flash at address %08lX\r\n", dst + i);
       break;
     }
 
-    if (FLASH_WaitForLastOperation(HAL_MAX_DELAY) != HAL_OK) {
+    if (flash_wait(uf2_flash_program_deadline_ms(4), dst + i) != HAL_OK) {
       TUF2_LOG1("Waiting on last operation failed\r\n");
       return;
     }
   }
 
+#if TINYUF2_FLASH_VERIFY_CRC
+  flash_verify_add(dst, src, (uint32_t) len);
+#else
   // verify contents
   if (memcmp((void*) dst, src, len) != 0) {
     TUF2_LOG1("Failed to write\r\n");
   }
+#endif
 }
 
 //--------------------------------------------------------------------+
 // Board API
 //--------------------------------------------------------------------+
 void board_flash_init(void) {
-  // nothing to do
+#if TINYUF2_FLASH_VERIFY_CRC
+  __HAL_RCC_CRC_CLK_ENABLE();
+#endif
 }
 
 uint32_t board_flash_size(void) {
   return BOARD_FLASH_SIZE;
 }
 
+board_flash_info_t const* board_flash_info(void) {
+  // half-word programming, page erase takes 20-40 ms
+  static board_flash_info_t const info = {
+    .geometry     = FLASH_GEOMETRY(FLASH_BASE_ADDR, _flash_regions),
+    .xip_base     = FLASH_BASE_ADDR,
+    .erased_word  = 0xFFFFFFFFUL,
+    .program_size = 2,
+    .caps         = BOARD_FLASH_CAP_XIP,
+    .erase_us     = 30000,
+    .program_us   = 53 * (256 / 2),
+  };
+  return &info;
+}
+
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
   memcpy(buffer, (void*) addr, len);
 }
 
 void board_flash_flush(void) {
-  // nothing to do
+#if TINYUF2_FLASH_VERIFY_CRC
+  // partially written page
+  flash_verify_finish();
+#endif
+
+#if TINYUF2_FLASH_CACHE
+  if (_flash_cache_addr == FLASH_CACHE_INVALID_ADDR) return;
+
+  // skip programming if contents is identical
+  if (memcmp(_flash_cache, (void*) _flash_cache_addr, FLASH_CACHE_SIZE) != 0) {
+    // cache holds the whole page image, always erase it (if not blank) before programming
+    erased_sectors[(_flash_cache_addr - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE] = 0;
+
+    HAL_FLASH_Unlock();
+    flash_write(_flash_cache_addr, _flash_cache, FLASH_CACHE_SIZE);
+    HAL_FLASH_Lock();
+  } else {
+    TUF2_LOG1("Skip page %08lX: contents matched\r\n", _flash_cache_addr);
+  }
+
+  _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+#endif
+}
+
+void board_flash_session_reset(void) {
+  memset(erased_sectors, 0, sizeof(erased_sectors));
 }
 
 // TODO not working quite yet
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
+#if TINYUF2_FLASH_CACHE
+  uint8_t const* src = (uint8_t const*) data;
+
+  while (len) {
+    uint32_t const page_addr = addr & ~(FLASH_CACHE_SIZE - 1);
+    uint32_t const offset = addr & (FLASH_CACHE_SIZE - 1);
+    uint32_t const count = (len < FLASH_CACHE_SIZE - offset) ? len : (FLASH_CACHE_SIZE - offset);
+
+    if (page_addr != _flash_cache_addr) {
+      // flush previous page and load current flash contents so that partial writes are preserved
+      board_flash_flush();
+      _flash_cache_addr = page_addr;
+      memcpy(_flash_cache, (void*) page_addr, FLASH_CACHE_SIZE);
+    }
+
+    memcpy(_flash_cache + offset, src, count);
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+#else
   // TODO skip matching contents
   HAL_FLASH_Unlock();
   flash_write(addr, data, len);
   HAL_FLASH_Lock();
+#endif
+
+  return true;
+}
 
+#if TINYUF2_FLASH_CACHE
+// Pages are loaded into the cache with their contents before being written
+bool board_flash_preserved(uint32_t addr, uint32_t len) {
+  (void) addr;
+  (void) len;
   return true;
 }
+#endif
 
 void board_flash_erase_app(void) {
-  // TODO implement later
+  // cached contents belong to the application being wiped
+#if TINYUF2_FLASH_CACHE
+  _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+#endif
+
+  HAL_FLASH_Unlock();
+
+  // erase page by page, pages already blank are skipped
+  for (uint32_t addr = BOARD_FLASH_APP_START; addr < FLASH_BASE_ADDR + BOARD_FLASH_SIZE; addr += BOARD_PAGE_SIZE) {
+    erased_sectors[(addr - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE] = 0;
+    flash_erase_sector(addr);
+  }
+
+  HAL_FLASH_Lock();
 }
 
 bool board_flash_protect_bootloader(bool protect) {
@@ -217,6 +389,15 @@ bool is_new_bootloader_valid(const uint8_t* bootloader_bin, uint32_t bootloader_
   return false;
 }
 
+static void self_update_write_sector(uint32_t sector, uint32_t addr, uint8_t const* data, uint32_t len) {
+  // erase again, also when retrying a sector already written in this session
+  erased_sectors[sector] = 0;
+  board_flash_write(addr, data, len);
+
+  // write out cached contents (if any) before comparing
+  board_flash_flush();
+}
+
 void board_self_update(const uint8_t* bootloader_bin, uint32_t bootloader_len) {
   // check if the bootloader payload is valid
   if (is_new_bootloader_valid(bootloader_bin, bootloader_len)) {
@@ -226,20 +407,10 @@ void board_self_update(const uint8_t* bootloader_bin, uint32_t bootloader_len) {
     board_flash_protect_bootloader(false);
 #endif
 
-    // keep writing until flash contents matches new bootloader data
-    while (memcmp((const void*) FLASH_BASE_ADDR, bootloader_bin, bootloader_len)) {
-      uint32_t sector_addr = FLASH_BASE_ADDR;
-      const uint8_t* data = bootloader_bin;
-      uint32_t len = bootloader_len;
-
-      for (uint32_t i = 0; i < BOOTLOADER_SECTOR_COUNT && len > 0; i++) {
-        uint32_t const size = (flash_sector_size(i) < len ? flash_sector_size(i) : len);
-        board_flash_write(sector_addr, data, size);
-
-        sector_addr += size;
-        data += size;
-        len -= size;
-      }
+    // rewrite differing sectors only, keep self-update application to retry if one fails
+    if (!self_update_sectors(FLASH_BASE_ADDR, bootloader_bin, bootloader_len, BOOTLOADER_SECTOR_COUNT,
+                             flash_sector_size, self_update_write_sector)) {
+      NVIC_SystemReset();
     }
   }
 
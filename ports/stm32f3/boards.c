@@ -309,6 +309,16 @@ void board_timer_stop(void)
   SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
 }
 
+#if TINYUF2_IDLE_SLEEP && !defined(BUILD_NO_TINYUSB)
+void board_idle(void)
+{
+  // with PRIMASK set, an interrupt arriving after the check still ends WFI
+  __disable_irq();
+  if ( !tud_task_event_ready() ) __WFI();
+  __enable_irq();
+}
+#endif
+
 void SysTick_Handler (void)
 {
   board_timer_handler();
@@ -42,6 +42,7 @@
 #endif
 
 #define BOARD_PAGE_SIZE 0x800
+#define BOARD_FLASH_ERASE_SIZE BOARD_PAGE_SIZE
 
 #define BOARD_RAM_START 0x20000000
 #define BOARD_RAM_SIZE 0x9FFF
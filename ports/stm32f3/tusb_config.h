@@ -77,18 +77,32 @@
 #endif
 
 //------------- CLASS -------------//
+#ifndef CFG_TUD_CDC
 #define CFG_TUD_CDC               0
+#endif
 #define CFG_TUD_MSC               1
 #define CFG_TUD_HID               0
 #define CFG_TUD_MIDI              0
+#ifndef CFG_TUD_VENDOR
 #define CFG_TUD_VENDOR            0
+#endif
+#ifndef CFG_TUD_DFU
+#define CFG_TUD_DFU               0
+#endif
 
 // MSC Buffer size of Device Mass storage
 #define CFG_TUD_MSC_BUFSIZE     512
 
+// DFU transfer size (wTransferSize), one flash erase unit
+#define CFG_TUD_DFU_XFER_BUFSIZE 2048
+
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_BUFSIZE      64
 
+// CDC FIFO size of TX and RX
+#define CFG_TUD_CDC_RX_BUFSIZE   256
+#define CFG_TUD_CDC_TX_BUFSIZE   256
+
 #ifdef __cplusplus
  }
 #endif
@@ -23,6 +23,8 @@
  */
 
 #include "board_api.h"
+#include "flash_geometry.h"
+#include "uf2.h"
 
 #ifndef BUILD_NO_TINYUSB
 #include "tusb.h"
@@ -37,145 +39,599 @@
 // TinyUF2 resides in the first 2 flash sectors on STM32F4s, therefore these are write protected
 #define BOOTLOADER_SECTOR_MASK  0x3UL
 
+// Supply voltage range determines the program parallelism (PSIZE): x32 for 2.7-3.6V (range 3),
+// x64 requires external Vpp (range 4). Board can override if it is powered accordingly.
+#ifndef BOARD_FLASH_VOLTAGE_RANGE
+#define BOARD_FLASH_VOLTAGE_RANGE FLASH_VOLTAGE_RANGE_3
+#endif
+
+#if BOARD_FLASH_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_4
+  #define FLASH_PROGRAM_TYPE    FLASH_TYPEPROGRAM_DOUBLEWORD
+  #define FLASH_PROGRAM_WIDTH   8
+#else
+  #define FLASH_PROGRAM_TYPE    FLASH_TYPEPROGRAM_WORD
+  #define FLASH_PROGRAM_WIDTH   4
+#endif
+
+// Background erase needs dual bank flash (F42x/F43x), bank 2 starts at sector 12
+#if TINYUF2_FLASH_BG_ERASE && defined(FLASH_SECTOR_12)
+  #define FLASH_BG_ERASE        1
+  #define FLASH_BANK2_SECTOR    12
+#else
+  #define FLASH_BG_ERASE        0
+#endif
+
 /* flash parameters that we should not really know */
-static const uint32_t sector_size[] =
-{
-  // First 4 sectors are for bootloader (64KB)
-  16 * 1024,
-	16 * 1024,
-	16 * 1024,
-	16 * 1024,
-	// Application (BOARD_FLASH_APP_START)
-	64 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-
-	// flash sectors only in 1 MB devices
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-
-	// flash sectors only in 2 MB devices
-	16 * 1024,
-	16 * 1024,
-	16 * 1024,
-	16 * 1024,
-	64 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024
+static flash_region_t const _flash_regions[] =
+{
+  { 16 * 1024, 4 },   // First 4 sectors are for bootloader (64KB)
+  { 64 * 1024, 1 },   // Application (BOARD_FLASH_APP_START)
+  { 128 * 1024, 7 },  // sectors 8-11 only in 1 MB devices
+
+  // flash sectors only in 2 MB devices
+  { 16 * 1024, 4 },
+  { 64 * 1024, 1 },
+  { 128 * 1024, 7 },
 };
 
+static flash_geometry_t const _flash_geo = FLASH_GEOMETRY(FLASH_BASE_ADDR, _flash_regions);
+
 enum
 {
-  SECTOR_COUNT = sizeof(sector_size)/sizeof(sector_size[0])
+  SECTOR_COUNT = 24
 };
 
 static uint8_t erased_sectors[SECTOR_COUNT] = { 0 };
 
+#if TINYUF2_FLASH_CACHE
+// Cache a whole sector in RAM and only program it on flush if contents differ. Only 16KB sectors
+// fit into RAM, larger (64KB/128KB) sectors are programmed directly as without the cache.
+#define FLASH_CACHE_SIZE          (16*1024)
+#define FLASH_CACHE_INVALID_ADDR  0xffffffff
+
+static uint32_t _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+TUF2_DFU_NOINIT static uint8_t _flash_cache[FLASH_CACHE_SIZE] __attribute__((aligned(8)));
+
+// F4 flash has no ECC, bits can be cleared (1 -> 0) by programming without erasing the sector
+static bool is_program_only(uint32_t addr, uint8_t const* data, uint32_t size)
+{
+  for ( uint32_t i = 0; i < size; i += sizeof(uint32_t) )
+  {
+    uint32_t const current = *(uint32_t*) (addr + i);
+    uint32_t const update = *(uint32_t const*) ((void const*) (data + i));
+    if ( (current & update) != update )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
 //--------------------------------------------------------------------+
 // Internal Helper
 //--------------------------------------------------------------------+
 
 static inline uint32_t flash_sector_size(uint32_t sector)
 {
-  return sector_size[sector];
+  flash_sector_t info;
+  return flash_sector_get(&_flash_geo, sector, &info) ? info.size : 0;
 }
 
-static bool is_blank(uint32_t addr, uint32_t size)
+static inline bool is_blank(uint32_t addr, uint32_t size)
 {
-  for ( uint32_t i = 0; i < size; i += sizeof(uint32_t) )
+  return flash_is_blank(addr, size);
+}
+
+// Sector containing the most recent write, consecutive payloads mostly fall into the same sector
+static uint32_t _cur_sector = SECTOR_COUNT;
+static uint32_t _cur_sector_addr = 0;
+static uint32_t _cur_sector_size = 0;
+
+// Look up sector of addr, only when addr leaves the current sector
+static bool flash_sector_lookup(uint32_t addr)
+{
+  if ( (_cur_sector < SECTOR_COUNT) && (_cur_sector_addr <= addr) && (addr < _cur_sector_addr + _cur_sector_size) )
   {
-    if ( *(uint32_t*) (addr + i) != 0xffffffff )
-    {
-      return false;
-    }
+    return true;
   }
+
+  flash_sector_t info;
+  if ( !flash_sector_find(&_flash_geo, addr, &info) || info.index >= SECTOR_COUNT ) return false;
+  TUF2_ASSERT(info.addr < FLASH_BASE_ADDR + BOARD_FLASH_SIZE);
+
+  _cur_sector = info.index;
+  _cur_sector_addr = info.addr;
+  _cur_sector_size = info.size;
   return true;
 }
 
-static bool flash_erase(uint32_t addr)
+#if TINYUF2_FLASH_RAMFUNC
+// Erase/program loops run from RAM: register access only, no HAL or libc calls into flash.
+// x32 parallelism (valid for all voltage ranges). Flash must be unlocked, returns false on error flags.
+#define FLASH_SR_ERRORS   (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)
+
+TINYUF2_RAMFUNC static bool flash_ram_erase_sector(uint32_t sector)
+{
+  while ( FLASH->SR & FLASH_SR_BSY ) {}
+  FLASH->SR = FLASH_FLAG_EOP | FLASH_SR_ERRORS;
+
+#ifdef FLASH_SECTOR_12
+  // sectors of bank 2 start at SNB 16
+  if ( sector > 11 ) sector += 4;
+#endif
+
+  FLASH->CR = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_SNB)) | FLASH_PSIZE_WORD | FLASH_CR_SER | (sector << FLASH_CR_SNB_Pos);
+  FLASH->CR |= FLASH_CR_STRT;
+
+  while ( FLASH->SR & FLASH_SR_BSY ) {}
+  FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+
+  return !(FLASH->SR & FLASH_SR_ERRORS);
+}
+
+// dst and len must be word aligned
+TINYUF2_RAMFUNC static bool flash_ram_program(uint32_t dst, uint8_t const* src, uint32_t len)
 {
-  // starting address from 0x08000000
-  uint32_t sector_addr = FLASH_BASE_ADDR;
-  bool erased = false;
+  while ( FLASH->SR & FLASH_SR_BSY ) {}
+  FLASH->SR = FLASH_FLAG_EOP | FLASH_SR_ERRORS;
 
-  uint32_t sector = 0;
-  uint32_t size = 0;
+  FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_PSIZE_WORD | FLASH_CR_PG;
 
-  for ( uint32_t i = 0; i < SECTOR_COUNT; i++ )
+  bool ok = true;
+  for ( uint32_t i = 0; i < len && ok; i += 4 )
   {
-    TUF2_ASSERT(sector_addr < FLASH_BASE_ADDR + BOARD_FLASH_SIZE);
+    // src may be unaligned (payload). Programming the erased value changes no bit, it is skipped
+    uint32_t const word = src[i] | (src[i + 1] << 8) | (src[i + 2] << 16) | ((uint32_t) src[i + 3] << 24);
+    if ( word == 0xFFFFFFFFUL ) continue;
+    *(volatile uint32_t*) (dst + i) = word;
 
-    size = flash_sector_size(i);
-    if ( sector_addr + size > addr )
+    while ( FLASH->SR & FLASH_SR_BSY ) {}
+    ok = !(FLASH->SR & FLASH_SR_ERRORS);
+  }
+
+  FLASH->CR &= ~FLASH_CR_PG;
+
+  return ok;
+}
+#endif
+
+#if TINYUF2_FLASH_VERIFY_CRC
+// Consecutive writes within a sector form a run verified once: source words are fed to the CRC unit
+// as they are programmed and its running value is saved every VERIFY_BLOCK_SIZE bytes. When the run
+// ends (sector complete, non-consecutive write, flush or board_hash_init) flash is fed through the
+// unit again, the first saved value that differs locates the bad block.
+#define VERIFY_BLOCK_SIZE   1024
+#define VERIFY_BLOCK_COUNT  (128 * 1024 / VERIFY_BLOCK_SIZE) // largest sector
+
+static uint32_t _verify_addr;
+static uint32_t _verify_len; // 0: no run
+static uint32_t _verify_end; // end of sector (or of saved values) of the run
+static uint32_t _verify_crc[VERIFY_BLOCK_COUNT];
+
+static void flash_verify_finish(void)
+{
+  if ( !_verify_len ) return;
+
+  uint32_t const len = _verify_len;
+  uint32_t const expected = CRC->DR;
+  _verify_len = 0;
+
+  CRC->CR = CRC_CR_RESET;
+  uint32_t const* word = (uint32_t const*) _verify_addr;
+  for ( uint32_t offset = 0; offset < len; )
+  {
+    CRC->DR = word[offset / 4];
+    offset += 4;
+
+    if ( (offset % VERIFY_BLOCK_SIZE) == 0 || offset == len )
     {
-      sector = i;
-      erased = erased_sectors[i];
-      erased_sectors[i] = 1;    // don't erase anymore - we will continue writing here!
-      break;
+      uint32_t const crc = (offset == len) ? expected : _verify_crc[offset / VERIFY_BLOCK_SIZE - 1];
+      if ( CRC->DR != crc )
+      {
+        TUF2_LOG1("Failed to write: %08lX\r\n", _verify_addr + (offset - 1) / VERIFY_BLOCK_SIZE * VERIFY_BLOCK_SIZE);
+        return;
+      }
     }
-    sector_addr += size;
   }
+}
+
+// Add programmed words to the run, dst and len are word aligned
+static void flash_verify_add(uint32_t dst, uint8_t const* src, uint32_t len)
+{
+  while ( len )
+  {
+    if ( _verify_len && dst != _verify_addr + _verify_len ) flash_verify_finish();
+    if ( !_verify_len )
+    {
+      flash_sector_t info;
+      if ( !flash_sector_find(&_flash_geo, dst, &info) ) return;
+
+      _verify_addr = dst;
+      _verify_end = info.addr + info.size;
+      if ( _verify_end - dst > VERIFY_BLOCK_COUNT * VERIFY_BLOCK_SIZE ) _verify_end = dst + VERIFY_BLOCK_COUNT * VERIFY_BLOCK_SIZE;
+      CRC->CR = CRC_CR_RESET;
+    }
+
+    uint32_t const count = (len < _verify_end - dst) ? len : (_verify_end - dst);
+    for ( uint32_t i = 0; i < count; i += 4 )
+    {
+      uint32_t word;
+      memcpy(&word, src + i, 4);
+      CRC->DR = word;
+      _verify_len += 4;
+      if ( (_verify_len % VERIFY_BLOCK_SIZE) == 0 ) _verify_crc[_verify_len / VERIFY_BLOCK_SIZE - 1] = CRC->DR;
+    }
+
+    dst += count;
+    src += count;
+    len -= count;
+
+    if ( dst == _verify_end ) flash_verify_finish();
+  }
+}
+#endif
+
+// Erase sector of addr unless done in this session: HAL_TIMEOUT if it overran its deadline and may
+// still be running (TINYUF2_FLASH_TIMEOUT)
+static HAL_StatusTypeDef flash_erase(uint32_t addr)
+{
+  if ( !flash_sector_lookup(addr) ) return HAL_ERROR;
+
+  uint32_t const sector = _cur_sector;
+  uint32_t const sector_addr = _cur_sector_addr;
+  uint32_t const size = _cur_sector_size;
 
 #ifndef TINYUF2_SELF_UPDATE
   // skip erasing sector0 if not self-update
-  TUF2_ASSERT(sector);
+  if ( !sector ) return HAL_ERROR;
 #endif
 
-  if ( !erased && !is_blank(sector_addr, size) )
+  if ( erased_sectors[sector] ) return HAL_OK;
+  erased_sectors[sector] = 1;    // don't erase anymore - we will continue writing here!
+
+  if ( !is_blank(sector_addr, size) )
   {
     TUF2_LOG1("Erase: %08lX size = %lu KB ... ", sector_addr, size / 1024);
-    FLASH_Erase_Sector(sector, FLASH_VOLTAGE_RANGE_3);
-    FLASH_WaitForLastOperation(HAL_MAX_DELAY);
+#if TINYUF2_FLASH_VERIFY_CRC
+    // pending run may be in this sector (next session)
+    flash_verify_finish();
+#endif
+#if TINYUF2_STATS || TINYUF2_WEAR_LOG
+    uint32_t const t_erase = uf2_stats_now();
+#endif
+#if TINYUF2_FLASH_RAMFUNC
+    // RAM loop polls BSY without deadline, HAL tick is not available while flash is busy
+    HAL_StatusTypeDef const status = flash_ram_erase_sector(sector) ? HAL_OK : HAL_ERROR;
+#else
+    FLASH_Erase_Sector(sector, BOARD_FLASH_VOLTAGE_RANGE);
+    HAL_StatusTypeDef const status = FLASH_WaitForLastOperation(uf2_flash_erase_deadline_ms(size));
+#endif
+#if TINYUF2_STATS
+    uf2_stats_erase(uf2_stats_now() - t_erase);
+#endif
+#if TINYUF2_WEAR_LOG
+    uf2_wear_erase(sector, uf2_stats_now() - t_erase);
+#endif
+    // Controller flags a failed erase, the sector is known blank otherwise and is not read back
+    // (up to 128KB). Programmed data is still verified by flash_write()
+    if ( status != HAL_OK )
+    {
+      TUF2_LOG1("%s\r\n", (status == HAL_TIMEOUT) ? "timeout" : "failed");
+      return status;
+    }
     TUF2_LOG1("OK\r\n");
-    TUF2_ASSERT( is_blank(sector_addr, size) );
   }
 
-  return true;
+  return HAL_OK;
 }
 
-static void flash_write(uint32_t dst, const uint8_t *src, int len)
-{
-  flash_erase(dst);
 
+// Flash must be unlocked by caller. dst and len must be word aligned, data can span multiple sectors.
+// HAL_TIMEOUT if erase or program overran its deadline, the whole payload can be written again then
+static HAL_StatusTypeDef flash_write(uint32_t dst, const uint8_t *src, int len)
+{
   TUF2_LOG1("Write flash at address %08lX\r\n", dst);
-  for ( int i = 0; i < len; i += 4 )
+
+#if TINYUF2_FLASH_RAMFUNC
+  for ( int i = 0; i < len; )
   {
-    uint32_t data = *((uint32_t*) ((void*) (src + i)));
+    // erase and program sector by sector
+    flash_erase(dst + i);
+
+    uint32_t const sector_end = _cur_sector_addr + _cur_sector_size;
+    int const count = (dst + len <= sector_end) ? (len - i) : (int) (sector_end - (dst + i));
 
-    if ( HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, dst + i, (uint64_t) data) != HAL_OK )
+    if ( !flash_ram_program(dst + i, src + i, (uint32_t) count) )
     {
       TUF2_LOG1("Failed to write flash at address %08lX\r\n", dst + i);
-      break;
+      return HAL_ERROR;
     }
+    i += count;
+  }
+#else
+  // an operation given up earlier may still be running, HAL_FLASH_Program() would wait 50s for it
+  HAL_StatusTypeDef status = FLASH_WaitForLastOperation(uf2_flash_program_deadline_ms((uint32_t) len));
+  if ( status != HAL_OK ) return status;
+#if FLASH_BG_ERASE
+  CLEAR_BIT(FLASH->CR, FLASH_CR_SER | FLASH_CR_SNB);
+#endif
 
-    if ( FLASH_WaitForLastOperation(HAL_MAX_DELAY) != HAL_OK )
+  for ( int i = 0; i < len; )
+  {
+    // erase when entering a new sector, also only walk the sector table there
+    if ( (i == 0) || (dst + i >= _cur_sector_addr + _cur_sector_size) )
     {
-      TUF2_LOG1("Waiting on last operation failed\r\n");
-      return;
+      status = flash_erase(dst + i);
+      if ( status == HAL_TIMEOUT ) return status;
+    }
+
+    // HAL_FLASH_Program() already waits for the previous operation to complete. Programming the
+    // erased value changes no bit (padding, gaps), it is skipped
+    uint32_t const addr = dst + i;
+    if ( (FLASH_PROGRAM_WIDTH == 8) && (len - i >= 8) && !(addr & 7) )
+    {
+      uint64_t data;
+      memcpy(&data, src + i, 8);
+      status = (data != UINT64_MAX) ? HAL_FLASH_Program(FLASH_PROGRAM_TYPE, addr, data) : HAL_OK;
+      i += 8;
+    }
+    else
+    {
+      uint32_t data;
+      memcpy(&data, src + i, 4);
+      status = (data != UINT32_MAX) ? HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr, (uint64_t) data) : HAL_OK;
+      i += 4;
+    }
+
+    if ( status != HAL_OK )
+    {
+      TUF2_LOG1("Failed to write flash at address %08lX\r\n", addr);
+      return status;
     }
   }
 
+  // wait for the last word to be programmed before verifying
+  status = FLASH_WaitForLastOperation(uf2_flash_program_deadline_ms((uint32_t) len));
+  if ( status != HAL_OK )
+  {
+    TUF2_LOG1("Waiting on last operation failed\r\n");
+    return status;
+  }
+#endif
+
+#if TINYUF2_FLASH_VERIFY_CRC
+  flash_verify_add(dst, src, (uint32_t) len);
+#else
   // verify contents
   if ( memcmp((void*) dst, src, len) != 0 )
   {
     TUF2_LOG1("Failed to write\r\n");
+    return HAL_ERROR;
+  }
+#endif
+
+  return HAL_OK;
+}
+
+#if TINYUF2_FLASH_TIMEOUT
+// Payloads whose erase or program overran the deadline are queued instead of stalling USB, they are
+// attempted again after a backoff by the next writes and completed by flush. While the queue is not
+// empty new payloads are queued behind so that flash is written in order. Writing FLASH_CR stalls
+// the bus until BSY is cleared, flash is therefore only locked once the controller is idle.
+#define FLASH_RETRY_DEPTH  4
+
+typedef struct
+{
+  uint32_t addr;
+  uint32_t due;       // HAL_GetTick() of next attempt
+  uint16_t len;
+  uint8_t  attempt;   // overruns so far
+  uint8_t  data[476] __attribute__((aligned(4))); // largest uf2 payload
+} flash_retry_t;
+
+static flash_retry_t _retry[FLASH_RETRY_DEPTH];
+static uint8_t _retry_head = 0;
+static uint8_t _retry_count = 0;
+
+static void flash_retry_push(uint32_t addr, uint8_t const* src, uint32_t len, uint8_t attempt)
+{
+  flash_retry_t* r = &_retry[(_retry_head + _retry_count) % FLASH_RETRY_DEPTH];
+  r->addr = addr;
+  r->len = (uint16_t) len;
+  r->attempt = attempt;
+  r->due = HAL_GetTick() + (attempt ? uf2_flash_backoff_ms(attempt) : 0);
+  memcpy(r->data, src, len);
+  _retry_count++;
+}
+
+// Attempt queued payloads in order as they become due, waiting for them only while more than keep
+// are queued. Flash is unlocked
+static void flash_retry_poll(uint32_t keep)
+{
+  while ( _retry_count )
+  {
+    flash_retry_t* r = &_retry[_retry_head];
+    uint32_t const now = HAL_GetTick();
+    if ( (int32_t) (r->due - now) > 0 )
+    {
+      if ( _retry_count <= keep ) return;
+      HAL_Delay(r->due - now);
+    }
+
+    HAL_StatusTypeDef const status = flash_write(r->addr, r->data, r->len);
+    if ( status == HAL_TIMEOUT )
+    {
+      bool const failed = (r->attempt >= TINYUF2_FLASH_RETRIES);
+      uf2_flash_timeout(r->addr, failed);
+      if ( !failed )
+      {
+        r->attempt++;
+        r->due = HAL_GetTick() + uf2_flash_backoff_ms(r->attempt);
+        continue;
+      }
+    }
+
+    _retry_head = (uint8_t) ((_retry_head + 1) % FLASH_RETRY_DEPTH);
+    _retry_count--;
   }
 }
 
+// Program payload behind the queued ones, queued itself if it overruns. False if it failed
+static bool flash_retry_write(uint32_t addr, uint8_t const* src, uint32_t len)
+{
+  flash_retry_poll(FLASH_RETRY_DEPTH);
+
+  if ( _retry_count )
+  {
+    if ( _retry_count == FLASH_RETRY_DEPTH ) flash_retry_poll(FLASH_RETRY_DEPTH - 1);
+    if ( _retry_count )
+    {
+      flash_retry_push(addr, src, len, 0);
+      return true;
+    }
+  }
+
+  HAL_StatusTypeDef const status = flash_write(addr, src, (int) len);
+  if ( status == HAL_TIMEOUT )
+  {
+    uf2_flash_timeout(addr, false);
+    flash_retry_push(addr, src, len, 1);
+  }
+  return status != HAL_ERROR;
+}
+#endif
+
+// Lock flash unless an operation that was given up or is queued for retry may still be running
+static void flash_lock(void)
+{
+#if TINYUF2_FLASH_TIMEOUT
+  if ( _retry_count || (FLASH->SR & FLASH_SR_BSY) ) return;
+#endif
+  HAL_FLASH_Lock();
+}
+
+#if FLASH_BG_ERASE
+// Erase of a bank 2 sector is only started, bootloader keeps executing from bank 1 and USB keeps
+// receiving. The payload entering the sector is held in RAM and programmed when the erase completes.
+static uint32_t _bg_sector = SECTOR_COUNT;
+static uint32_t _bg_addr;
+static uint32_t _bg_len;
+static uint8_t  _bg_payload[476] __attribute__((aligned(4))); // largest uf2 payload
+static bool     _bg_dcache;
+#if TINYUF2_STATS || TINYUF2_WEAR_LOG
+static uint32_t _bg_start;
+#endif
+
+// Start erasing the (bank 2) sector of addr, return false if payload is to be written right away
+static bool flash_bg_erase_start(uint32_t addr, uint8_t const* src, uint32_t len)
+{
+  if ( len > sizeof(_bg_payload) || !flash_sector_lookup(addr) ) return false;
+#if TINYUF2_FLASH_TIMEOUT
+  // controller may be busy, erase would be started from the retry queue
+  if ( _retry_count ) return false;
+#endif
+  if ( _cur_sector < FLASH_BANK2_SECTOR || erased_sectors[_cur_sector] ) return false;
+  if ( addr + len > _cur_sector_addr + _cur_sector_size ) return false;
+
+  erased_sectors[_cur_sector] = 1;
+  if ( is_blank(_cur_sector_addr, _cur_sector_size) ) return false;
+
+  TUF2_LOG1("Erase: %08lX size = %lu KB in background\r\n", _cur_sector_addr, _cur_sector_size / 1024);
+#if TINYUF2_STATS || TINYUF2_WEAR_LOG
+  _bg_start = uf2_stats_now();
+#endif
+  // data cache is off while erasing so that reads of the sector stall instead of returning stale data
+  _bg_dcache = READ_BIT(FLASH->ACR, FLASH_ACR_DCEN) != 0;
+  __HAL_FLASH_DATA_CACHE_DISABLE();
+
+#if TINYUF2_FLASH_VERIFY_CRC
+  flash_verify_finish();
+#endif
+  // only sets STRT, does not wait for completion
+  FLASH_Erase_Sector(_cur_sector, BOARD_FLASH_VOLTAGE_RANGE);
+
+  _bg_sector = _cur_sector;
+  _bg_addr = addr;
+  _bg_len = len;
+  memcpy(_bg_payload, src, len);
+
+  return true;
+}
+
+// Wait for the background erase and program the held payload. Flash is still unlocked
+static void flash_bg_erase_finish(void)
+{
+  if ( _bg_sector == SECTOR_COUNT ) return;
+
+  HAL_StatusTypeDef const status = FLASH_WaitForLastOperation(uf2_flash_erase_deadline_ms(flash_sector_size(_bg_sector)));
+#if TINYUF2_FLASH_TIMEOUT
+  if ( status == HAL_TIMEOUT )
+  {
+    // still erasing: held payload goes to the (empty) retry queue, erase statistics are lost and
+    // data cache stays off until reset
+    uf2_flash_timeout(_bg_addr, false);
+    _bg_sector = SECTOR_COUNT;
+    flash_retry_push(_bg_addr, _bg_payload, _bg_len, 1);
+    return;
+  }
+#else
+  (void) status;
+#endif
+  CLEAR_BIT(FLASH->CR, FLASH_CR_SER | FLASH_CR_SNB);
+
+  if ( _bg_dcache )
+  {
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+  }
+#if TINYUF2_STATS
+  uf2_stats_erase(uf2_stats_now() - _bg_start);
+#endif
+#if TINYUF2_WEAR_LOG
+  uf2_wear_erase(_bg_sector, uf2_stats_now() - _bg_start);
+#endif
+  _bg_sector = SECTOR_COUNT;
+
+#if TINYUF2_FLASH_TIMEOUT
+  (void) flash_retry_write(_bg_addr, _bg_payload, _bg_len);
+#else
+  (void) flash_write(_bg_addr, _bg_payload, (int) _bg_len);
+#endif
+}
+#endif
+
+// Program payload without cache, false if it failed
+static bool flash_write_direct(uint32_t addr, uint8_t const* src, uint32_t len)
+{
+  // single unlock/lock for the whole payload
+  HAL_FLASH_Unlock();
+
+#if FLASH_BG_ERASE
+  flash_bg_erase_finish();
+
+  // leave flash unlocked while erasing: writing FLASH_CR stalls the bus until BSY is cleared
+  if ( flash_bg_erase_start(addr, src, len) ) return true;
+#endif
+
+#if TINYUF2_FLASH_TIMEOUT
+  bool const ok = flash_retry_write(addr, src, len);
+#else
+  bool const ok = (flash_write(addr, src, (int) len) == HAL_OK);
+#endif
+  flash_lock();
+
+  return ok;
+}
+
 //--------------------------------------------------------------------+
 // Board API
 //--------------------------------------------------------------------+
 void board_flash_init(void)
 {
-
+#if TINYUF2_FLASH_VERIFY_CRC
+  __HAL_RCC_CRC_CLK_ENABLE();
+#endif
 }
 
 uint32_t board_flash_size(void)
@@ -183,29 +639,340 @@ uint32_t board_flash_size(void)
   return BOARD_FLASH_SIZE;
 }
 
+board_flash_info_t const* board_flash_info(void)
+{
+  // typical x32 (range 3) figures: 16KB sector erase, word program
+  static board_flash_info_t const info =
+  {
+    .geometry     = FLASH_GEOMETRY(FLASH_BASE_ADDR, _flash_regions),
+    .xip_base     = FLASH_BASE_ADDR,
+    .erased_word  = 0xFFFFFFFFUL,
+    .program_size = FLASH_PROGRAM_WIDTH,
+    .caps         = BOARD_FLASH_CAP_BIT_CLEAR | BOARD_FLASH_CAP_XIP,
+    .erase_us     = 250000,
+    .program_us   = 16 * (256 / 4),
+  };
+  return &info;
+}
+
+#if TINYUF2_CURRENT_CRC || TINYUF2_APP_FOOTER
+// CRC unit computes CRC-32/MPEG-2 over words: bit reverse input and result to get IEEE 802.3 CRC32
+void board_hash_init(void)
+{
+#if TINYUF2_FLASH_VERIFY_CRC
+  // unit holds the running value of a pending run
+  flash_verify_finish();
+#endif
+  __HAL_RCC_CRC_CLK_ENABLE();
+  CRC->CR = CRC_CR_RESET;
+}
+
+void board_hash_update(void const* data, uint32_t len)
+{
+  uint32_t const* word = (uint32_t const*) data;
+  for ( uint32_t i = 0; i < len / 4; i++ )
+  {
+    CRC->DR = __RBIT(word[i]);
+  }
+}
+
+uint32_t board_hash_final(void)
+{
+  return ~__RBIT(CRC->DR);
+}
+#endif
+
+#if FLASH_BG_ERASE
+// True if [addr, addr + len) overlaps the payload held until its sector is erased
+static inline bool flash_bg_overlaps(uint32_t addr, uint32_t len)
+{
+  return _bg_sector != SECTOR_COUNT && addr < _bg_addr + _bg_len && _bg_addr < addr + len;
+}
+#endif
+
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
 {
+  // reading the sector being erased in background stalls until it is erased
   memcpy(buffer, (void*) addr, len);
+
+#if FLASH_BG_ERASE
+  // held payload is not programmed yet
+  if ( flash_bg_overlaps(addr, len) )
+  {
+    uint32_t const start = (addr > _bg_addr) ? addr : _bg_addr;
+    uint32_t const end = (addr + len < _bg_addr + _bg_len) ? (addr + len) : (_bg_addr + _bg_len);
+    memcpy((uint8_t*) buffer + (start - addr), _bg_payload + (start - _bg_addr), end - start);
+  }
+#endif
+}
+
+// Internal flash is read in place by the CPU and the OTG_HS DMA alike, as board_flash_read() does
+void const* board_flash_mapped(uint32_t addr, uint32_t len)
+{
+#if FLASH_BG_ERASE
+  // held payload is only seen by board_flash_read()
+  if ( flash_bg_overlaps(addr, len) ) return NULL;
+#else
+  (void) len;
+#endif
+  return (addr & 3) ? NULL : (void const*) addr;
 }
 
 void board_flash_flush(void)
 {
+#if FLASH_BG_ERASE
+  if ( _bg_sector != SECTOR_COUNT )
+  {
+    flash_bg_erase_finish();
+    flash_lock();
+  }
+#endif
+
+#if TINYUF2_FLASH_TIMEOUT
+  if ( _retry_count )
+  {
+    // bounded by TINYUF2_FLASH_RETRIES deadlines and backoffs per payload
+    HAL_FLASH_Unlock();
+    flash_retry_poll(0);
+    flash_lock();
+  }
+#endif
+
+#if TINYUF2_FLASH_VERIFY_CRC
+  // partially written sector
+  flash_verify_finish();
+#endif
+
+#if TINYUF2_FLASH_CACHE
+  if ( _flash_cache_addr == FLASH_CACHE_INVALID_ADDR ) return;
+
+  // skip programming if contents is identical
+  if ( memcmp(_flash_cache, (void*) _flash_cache_addr, FLASH_CACHE_SIZE) != 0 )
+  {
+    if ( flash_sector_lookup(_flash_cache_addr) )
+    {
+      // cache holds the whole sector image: erase it (if not blank) before programming,
+      // unless the update only clears bits
+      erased_sectors[_cur_sector] = is_program_only(_flash_cache_addr, _flash_cache, FLASH_CACHE_SIZE) ? 1 : 0;
+
+      HAL_FLASH_Unlock();
+      HAL_StatusTypeDef status = flash_write(_flash_cache_addr, _flash_cache, FLASH_CACHE_SIZE);
+#if TINYUF2_FLASH_TIMEOUT
+      // cache is about to be reused, the sector image is retried in place
+      for ( uint32_t attempt = 1; status == HAL_TIMEOUT; attempt++ )
+      {
+        uf2_flash_timeout(_flash_cache_addr, attempt > TINYUF2_FLASH_RETRIES);
+        if ( attempt > TINYUF2_FLASH_RETRIES ) break;
+        HAL_Delay(uf2_flash_backoff_ms(attempt));
+        status = flash_write(_flash_cache_addr, _flash_cache, FLASH_CACHE_SIZE);
+      }
+#else
+      (void) status;
+#endif
+      flash_lock();
+    }
+  }
+  else
+  {
+    TUF2_LOG1("Skip sector %08lX: contents matched\r\n", _flash_cache_addr);
+  }
+
+  _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+#endif
+}
+
+void board_flash_session_reset(void)
+{
+  memset(erased_sectors, 0, sizeof(erased_sectors));
 }
 
 // TODO not working quite yet
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len)
 {
+  bool ok = true;
+#if TINYUF2_FLASH_CACHE
+  uint8_t const* src = (uint8_t const*) data;
+
+  while ( len )
+  {
+    TUF2_ASSERT( flash_sector_lookup(addr) );
+
+    uint32_t const sector_addr = _cur_sector_addr;
+    uint32_t const sector_size = _cur_sector_size;
+    uint32_t const offset = addr - sector_addr;
+    uint32_t const count = (len < sector_size - offset) ? len : (sector_size - offset);
+
+    if ( sector_size > FLASH_CACHE_SIZE )
+    {
+      // sector does not fit into cache: program directly, erased once on first write.
+      // Only flush a cached sector, a background erase is completed by the next direct write
+      if ( _flash_cache_addr != FLASH_CACHE_INVALID_ADDR ) board_flash_flush();
+
+      if ( !flash_write_direct(addr, src, count) ) ok = false;
+    }
+    else
+    {
+      if ( sector_addr != _flash_cache_addr )
+      {
+        // flush previous sector and load current flash contents so that partial writes are preserved
+        board_flash_flush();
+        _flash_cache_addr = sector_addr;
+        memcpy(_flash_cache, (void*) sector_addr, FLASH_CACHE_SIZE);
+      }
+
+      memcpy(_flash_cache + offset, src, count);
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+#else
   // TODO skip matching contents
-  HAL_FLASH_Unlock();
-  flash_write(addr, data, len);
-  HAL_FLASH_Lock();
+  ok = flash_write_direct(addr, data, len);
+#endif
+
+  return ok;
+}
+
+// Directly programmed sectors are erased (or found blank) by their first write or erase ahead, what
+// is not written since is still erased. A cached sector is loaded with its previous contents and
+// may only have been programmed over by its flush
+bool board_flash_erased(uint32_t addr, uint32_t len)
+{
+  uint32_t const end = addr + len;
+
+  while ( addr < end )
+  {
+    if ( !flash_sector_lookup(addr) || !erased_sectors[_cur_sector] ) return false;
+#if TINYUF2_FLASH_CACHE
+    if ( _cur_sector_size <= FLASH_CACHE_SIZE ) return false;
+#endif
+    addr = _cur_sector_addr + _cur_sector_size;
+  }
 
   return true;
 }
 
+#if TINYUF2_FLASH_CACHE
+// Sectors that fit into the cache are loaded with their contents before being written, larger ones
+// are erased by their first write
+bool board_flash_preserved(uint32_t addr, uint32_t len)
+{
+  uint32_t const end = addr + len;
+
+  while ( addr < end )
+  {
+    if ( !flash_sector_lookup(addr) || _cur_sector_size > FLASH_CACHE_SIZE ) return false;
+    addr = _cur_sector_addr + _cur_sector_size;
+  }
+
+  return true;
+}
+#endif
+
+#ifdef FLASH_BANK_2
+// Mass erase bank 2 (sector 12 at addr) unless blank. Flash must be unlocked
+static void flash_erase_bank2(uint32_t addr)
+{
+  if ( !is_blank(addr, FLASH_BASE_ADDR + BOARD_FLASH_SIZE - addr) )
+  {
+    TUF2_LOG1("Erase: bank 2 ... ");
+    FLASH_EraseInitTypeDef erase = {
+      .TypeErase    = FLASH_TYPEERASE_MASSERASE,
+      .Banks        = FLASH_BANK_2,
+      .VoltageRange = BOARD_FLASH_VOLTAGE_RANGE,
+    };
+    uint32_t sector_error = 0;
+    if ( HAL_FLASHEx_Erase(&erase, &sector_error) == HAL_OK )
+    {
+      TUF2_LOG1("OK\r\n");
+    }
+    else
+    {
+      TUF2_LOG1("failed\r\n");
+    }
+  }
+
+  memset(erased_sectors + 12, 1, SECTOR_COUNT - 12);
+}
+#endif
+
+#if TINYUF2_PRE_ERASE
+uint32_t board_flash_erase_ahead(uint32_t addr, uint32_t len)
+{
+  if ( !flash_sector_lookup(addr) ) return 0;
+
+  uint32_t const covered = _cur_sector_addr + _cur_sector_size - addr;
+
+#if TINYUF2_FLASH_CACHE
+  // cached sector is erased (or only programmed) by its flush
+  if ( _cur_sector_addr == _flash_cache_addr ) return covered;
+#endif
+
+  HAL_FLASH_Unlock();
+#if FLASH_BG_ERASE
+  flash_bg_erase_finish();
+#endif
+
+#ifdef FLASH_BANK_2
+  // extent covers the whole bank 2 and none of it is written yet: single bank erase
+  uint32_t const bank_len = FLASH_BASE_ADDR + BOARD_FLASH_SIZE - addr;
+  if ( (_cur_sector == 12) && (BOARD_FLASH_SIZE == 2*1024*1024) && (len >= bank_len) &&
+       !memchr(erased_sectors + 12, 1, SECTOR_COUNT - 12) )
+  {
+    flash_erase_bank2(addr);
+    HAL_FLASH_Lock();
+    return bank_len;
+  }
+#else
+  (void) len;
+#endif
+
+  // skipped if already erased in this session, an overrun is completed by the next write
+  if ( flash_erase(addr) == HAL_TIMEOUT ) uf2_flash_timeout(addr, false);
+  flash_lock();
+
+  return covered;
+}
+#endif
+
 void board_flash_erase_app(void)
 {
-  // TODO implement later
+  // cached contents belong to the application being wiped, pending background erase is completed
+#if TINYUF2_FLASH_CACHE
+  _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+#endif
+  board_flash_flush();
+
+  HAL_FLASH_Unlock();
+
+  uint32_t const flash_end = FLASH_BASE_ADDR + BOARD_FLASH_SIZE;
+  flash_sector_t info;
+
+  for ( uint32_t addr = BOARD_FLASH_APP_START; addr < flash_end && flash_sector_find(&_flash_geo, addr, &info);
+        addr = info.addr + info.size )
+  {
+#ifdef FLASH_BANK_2
+    // 2MB dual bank parts: bootloader is in bank 1, bank 2 is wiped with a single bank erase
+    if ( (info.index == 12) && (BOARD_FLASH_SIZE == 2*1024*1024) )
+    {
+      flash_erase_bank2(info.addr);
+      break;
+    }
+#endif
+
+    // erase sector unless already blank. Writing FLASH_CR for the next one would stall while an
+    // overrun erase is still running
+    erased_sectors[info.index] = 0;
+    if ( flash_erase(addr) == HAL_TIMEOUT )
+    {
+      uf2_flash_timeout(addr, true);
+      break;
+    }
+  }
+
+  flash_lock();
 }
 
 bool board_flash_protect_bootloader(bool protect)
@@ -245,6 +1012,18 @@ bool board_flash_protect_bootloader(bool protect)
   return ret;
 }
 
+#if TINYUF2_SERVICE_TABLE
+// defined by linker script
+extern uint32_t _sidata[], _sdata[], _edata[], _sbss[], _ebss[];
+
+// Same as Reset_Handler: copy .data (including TINYUF2_FLASH_RAMFUNC code) and clear .bss
+void board_service_ram_init(void)
+{
+  memcpy(_sdata, _sidata, (uint32_t) _edata - (uint32_t) _sdata);
+  memset(_sbss, 0, (uint32_t) _ebss - (uint32_t) _sbss);
+}
+#endif
+
 #ifdef TINYUF2_SELF_UPDATE
 
 bool is_new_bootloader_valid(const uint8_t * bootloader_bin, uint32_t bootloader_len)
@@ -268,6 +1047,16 @@ bool is_new_bootloader_valid(const uint8_t * bootloader_bin, uint32_t bootloader
   return true;
 }
 
+static void self_update_write_sector(uint32_t sector, uint32_t addr, uint8_t const* data, uint32_t len)
+{
+  // erase again, also when retrying a sector already written in this session
+  erased_sectors[sector] = 0;
+  board_flash_write(addr, data, len);
+
+  // write out cached contents (if any) before comparing
+  board_flash_flush();
+}
+
 void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len)
 {
   // check if the bootloader payload is valid
@@ -279,22 +1068,11 @@ void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len)
     board_flash_protect_bootloader(false);
 #endif
 
-    // keep writing until flash contents matches new bootloader data
-    while( memcmp((const void*) FLASH_BASE_ADDR, bootloader_bin, bootloader_len) )
+    // rewrite differing sectors only, keep self-update application to retry if one fails
+    if ( !self_update_sectors(FLASH_BASE_ADDR, bootloader_bin, bootloader_len, 4,
+                              flash_sector_size, self_update_write_sector) )
     {
-      uint32_t sector_addr = FLASH_BASE_ADDR;
-      const uint8_t * data = bootloader_bin;
-      uint32_t len = bootloader_len;
-
-      for ( uint32_t i = 0; i < 4 && len > 0; i++ )
-      {
-        uint32_t const size = (flash_sector_size(i) < len ? flash_sector_size(i) : len);
-        board_flash_write(sector_addr, data, size);
-
-        sector_addr += size;
-        data += size;
-        len -= size;
-      }
+      NVIC_SystemReset();
     }
   }
 
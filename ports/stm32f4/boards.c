@@ -36,11 +36,84 @@
 
 UART_HandleTypeDef UartHandle;
 
+static void board_peripheral_init(void);
+
 void board_init(void)
 {
   clock_init();
   SystemCoreClockUpdate();
+  board_peripheral_init();
+}
+
+#if TINYUF2_WARM_DFU
+// PLL 48 MHz output (PLLQ) as needed by USB, 0 if PLL is not the system clock
+static uint32_t pll_usb_clock(void)
+{
+  if ( (RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL ) return 0;
+
+#ifdef RCC_DCKCFGR2_CK48MSEL
+  // 48 MHz from PLLSAI
+  if ( RCC->DCKCFGR2 & RCC_DCKCFGR2_CK48MSEL ) return 0;
+#endif
+
+  uint32_t const cfgr = RCC->PLLCFGR;
+  uint32_t const input = (cfgr & RCC_PLLCFGR_PLLSRC) ? HSE_VALUE : HSI_VALUE;
+  uint32_t const pllm = cfgr & RCC_PLLCFGR_PLLM;
+  uint32_t const plln = (cfgr & RCC_PLLCFGR_PLLN) >> RCC_PLLCFGR_PLLN_Pos;
+  uint32_t const pllq = (cfgr & RCC_PLLCFGR_PLLQ) >> RCC_PLLCFGR_PLLQ_Pos;
+  if ( !pllm || !pllq ) return 0;
+
+  return (uint32_t) (((uint64_t) input * plln) / pllm / pllq);
+}
+
+// Clocks of the application are kept when USB gets its 48 MHz from the PLL, waiting for HSE and
+// PLL lock again is most of board_init()
+void board_init_warm(void)
+{
+  if ( pll_usb_clock() != 48000000UL )
+  {
+    // back to HSI, clock_init() expects reset state
+    HAL_RCC_DeInit();
+    clock_init();
+  }
+  SystemCoreClockUpdate();
+  board_peripheral_init();
+}
+
+extern uint32_t _estack[];
 
+void board_dfu_warm_enter(void (*entry)(void))
+{
+  __disable_irq();
+
+  SysTick->CTRL = 0;
+  for ( uint32_t i = 0; i < sizeof(NVIC->ICER) / sizeof(NVIC->ICER[0]); i++ )
+  {
+    NVIC->ICER[i] = 0xFFFFFFFF;
+    NVIC->ICPR[i] = 0xFFFFFFFF;
+  }
+
+  /* switch exception handlers to the bootloader */
+  SCB->VTOR = (uint32_t) BOARD_FLASH_ADDR_ZERO;
+  __DSB();
+  __ISB();
+
+  // bootloader stack on MSP (application may run threads on PSP), FPU context dropped
+  __asm volatile (
+    "msr msp, %0      \n"
+    "movs r3, #0      \n"
+    "msr control, r3  \n"
+    "isb              \n"
+    "cpsie i          \n"
+    "bx %1            \n"
+    :: "r" (_estack), "r" (entry) : "r3", "memory");
+
+  while (1) {}
+}
+#endif
+
+static void board_peripheral_init(void)
+{
   // disable systick
   board_timer_stop();
 
@@ -101,6 +174,62 @@ void board_init(void)
 #endif
 }
 
+#if defined(BOARD_USB_ULPI) && BOARD_USB_ULPI
+// ULPI pins of the external high speed PHY on OTG_HS, DIR and NXT have alternate pins (PI11, PH4)
+#ifndef BOARD_ULPI_DIR_PORT
+#define BOARD_ULPI_DIR_PORT   GPIOC
+#define BOARD_ULPI_DIR_PIN    GPIO_PIN_2
+#endif
+
+#ifndef BOARD_ULPI_NXT_PORT
+#define BOARD_ULPI_NXT_PORT   GPIOC
+#define BOARD_ULPI_NXT_PIN    GPIO_PIN_3
+#endif
+
+static void ulpi_pin_init(GPIO_TypeDef* port, uint32_t pins)
+{
+  GPIO_InitTypeDef GPIO_InitStruct;
+
+  GPIO_InitStruct.Pin = pins;
+  GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+  GPIO_InitStruct.Alternate = GPIO_AF10_OTG_HS;
+  HAL_GPIO_Init(port, &GPIO_InitStruct);
+}
+
+void board_dfu_init(void)
+{
+#ifdef __HAL_RCC_GPIOH_CLK_ENABLE
+  __HAL_RCC_GPIOH_CLK_ENABLE();
+#endif
+#ifdef __HAL_RCC_GPIOI_CLK_ENABLE
+  __HAL_RCC_GPIOI_CLK_ENABLE();
+#endif
+
+  // PA5- CK, PA3- D0, PB0- D1, PB1- D2, PB10- D3, PB11- D4, PB12- D5, PB13- D6, PB5- D7, PC0- STP
+  ulpi_pin_init(GPIOA, GPIO_PIN_3 | GPIO_PIN_5);
+  ulpi_pin_init(GPIOB, GPIO_PIN_0 | GPIO_PIN_1 | GPIO_PIN_5 | GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12 | GPIO_PIN_13);
+  ulpi_pin_init(GPIOC, GPIO_PIN_0);
+  ulpi_pin_init(BOARD_ULPI_DIR_PORT, BOARD_ULPI_DIR_PIN);
+  ulpi_pin_init(BOARD_ULPI_NXT_PORT, BOARD_ULPI_NXT_PIN);
+
+  // Core and the 60 MHz ULPI clock driven by the PHY
+  __HAL_RCC_USB_OTG_HS_CLK_ENABLE();
+  __HAL_RCC_USB_OTG_HS_ULPI_CLK_ENABLE();
+
+  // VBUS is watched by the PHY, the internal sensing only belongs to the embedded FS PHY
+#if defined(USB_OTG_GCCFG_VBDEN)
+  USB_OTG_HS->GCCFG &= ~USB_OTG_GCCFG_VBDEN;
+  USB_OTG_HS->GOTGCTL |= USB_OTG_GOTGCTL_BVALOEN;
+  USB_OTG_HS->GOTGCTL |= USB_OTG_GOTGCTL_BVALOVAL;
+#else
+  USB_OTG_HS->GCCFG |= USB_OTG_GCCFG_NOVBUSSENS;
+#endif
+}
+
+#else
+
 void board_dfu_init(void)
 {
   GPIO_InitTypeDef  GPIO_InitStruct;
@@ -167,6 +296,8 @@ void board_dfu_init(void)
 #endif
 }
 
+#endif // BOARD_USB_ULPI
+
 void board_reset(void)
 {
   NVIC_SystemReset();
@@ -359,11 +490,74 @@ void board_timer_stop(void)
   SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
 }
 
+#if TINYUF2_IDLE_SLEEP && !defined(BUILD_NO_TINYUSB)
+void board_idle(void)
+{
+  // with PRIMASK set, an interrupt arriving after the check still ends WFI
+  __disable_irq();
+  if ( !tud_task_event_ready() ) __WFI();
+  __enable_irq();
+}
+#endif
+
 void SysTick_Handler(void)
 {
   board_timer_handler();
 }
 
+#if TINYUF2_PROFILE
+// TIM11 is present on all STM32F4 and unused by the bootloader, shares its vector with TIM1 TRG/COM
+void board_profile_start(uint32_t hz)
+{
+  __HAL_RCC_TIM11_CLK_ENABLE();
+
+  // APB2 timer clock is twice PCLK2 when APB2 is divided
+  uint32_t clk = HAL_RCC_GetPCLK2Freq();
+  if ( RCC->CFGR & RCC_CFGR_PPRE2_2 ) clk *= 2;
+
+  TIM11->PSC  = clk / 1000000 - 1; // 1 MHz
+  TIM11->ARR  = 1000000 / hz - 1;
+  TIM11->EGR  = TIM_EGR_UG;
+  TIM11->SR   = 0;
+  TIM11->DIER = TIM_DIER_UIE;
+
+  NVIC_SetPriority(TIM1_TRG_COM_TIM11_IRQn, 0);
+  NVIC_EnableIRQ(TIM1_TRG_COM_TIM11_IRQn);
+  TIM11->CR1 = TIM_CR1_CEN;
+}
+
+void board_profile_ack(void)
+{
+  TIM11->SR = 0;
+}
+
+__attribute__((naked)) void TIM1_TRG_COM_TIM11_IRQHandler(void)
+{
+  __asm volatile ("b uf2_profile_isr");
+}
+#endif
+
+#if TINYUF2_STATS || TINYUF2_BOOT_TRACE || TINYUF2_EVENT_LOG
+// DWT keeps counting after the jump, application can continue from the boot trace timestamps
+uint32_t board_cycle_count(void)
+{
+  // enable DWT cycle counter on first use
+  if ( !(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) )
+  {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+
+  return DWT->CYCCNT;
+}
+
+uint32_t board_cycle_freq(void)
+{
+  return SystemCoreClock;
+}
+#endif
+
 int board_uart_write(void const * buf, int len)
 {
 #if defined(UART_DEV) && CFG_TUSB_DEBUG
@@ -382,6 +576,11 @@ void OTG_FS_IRQHandler(void)
 {
   tud_int_handler(0);
 }
+
+void OTG_HS_IRQHandler(void)
+{
+  tud_int_handler(1);
+}
 #endif
 
 // Required by __libc_init_array in startup code if we are compiling using
@@ -41,9 +41,15 @@
 #define BOARD_FLASH_APP_START   0x08010000
 #endif
 
+// Sector 0-3 (per bank), following sectors are 64 and 128 KB
+#define BOARD_FLASH_ERASE_SIZE  (16*1024)
+
 // Double Reset tap to enter DFU
 #define TINYUF2_DBL_TAP_DFU  1
 
+// DFU-only state is not zeroed by the startup code, placed by linker/stm32f4_boot.ld
+#define TUF2_DFU_NOINIT      __attribute__((section(".dfu_noinit")))
+
 // Enable write protection
 #ifndef TINYUF2_PROTECT_BOOTLOADER
 #define TINYUF2_PROTECT_BOOTLOADER    1
@@ -7,16 +7,70 @@
 
 #ifdef W25Qx_QSPI
 #include "components/w25qxx/w25qxx_qspi.h"
+#include "sfdp.h"
 #endif // W25Qx_QSPI
 
 #if BOARD_QSPI_FLASH_EN
 QSPI_HandleTypeDef _qspi_flash;
 #endif // BOARD_QSPI_FLASH_EN
 
+// With both SPI and QSPI flash, erase and program operations are queued per device and a scheduler
+// starts the next one on whichever chip is ready: an uf2 spanning both regions programs them
+// concurrently (each region is flushed in background once writes move to the other one)
+#if BOARD_SPI_FLASH_EN && BOARD_QSPI_FLASH_EN
+  #define FLASH_STRIPE  1
+#else
+  #define FLASH_STRIPE  0
+#endif
+
+// Reads during a queued sector or block erase suspend it (W25Qxx 75h/7Ah) instead of waiting for it
+#ifndef BOARD_FLASH_ERASE_SUSPEND
+#define BOARD_FLASH_ERASE_SUSPEND  1
+#endif
+
 #if BOARD_SPI_FLASH_EN
 SPI_HandleTypeDef _spi_flash;
 #endif // BOARD_SPI_FLASH_EN
 
+#if BOARD_QSPI_FLASH_EN
+// QSPI writes are collected per 64KB block in the upper half of AXI SRAM, which is used neither for
+// app staging (AXISRAM_SIZE) nor by the bootloader (DTCM). On flush only the modified 4KB sectors
+// are erased, or the whole block at once with a 64KB block erase if enough of them need erasing.
+#ifndef QSPI_CACHE_ADDR
+#define QSPI_CACHE_ADDR         (AXISRAM_BASE_ADDR + AXISRAM_SIZE)
+#endif
+
+// erase of modified sectors needed for block erase to be faster (45ms sector vs 150ms block typical),
+// used when SFDP of the part does not report erase times
+#ifndef QSPI_BLOCK_ERASE_MIN
+#define QSPI_BLOCK_ERASE_MIN    4
+#endif
+
+#define QSPI_CACHE_INVALID_ADDR 0xffffffff
+#define QSPI_PAGE_COUNT         (W25X_BLOCK_SIZE / W25X_PAGE_SIZE)
+#define QSPI_SECTOR_COUNT       (W25X_BLOCK_SIZE / W25X_SECTOR_SIZE)
+#define QSPI_SECTOR_PAGES       (W25X_SECTOR_SIZE / W25X_PAGE_SIZE)
+
+static uint8_t* const _qspi_cache = (uint8_t*) QSPI_CACHE_ADDR;
+static uint32_t _qspi_cache_addr = QSPI_CACHE_INVALID_ADDR; // offset in flash of cached block
+
+// bit set for each page holding current data (written or loaded from flash) / written since cached
+static uint32_t _qspi_valid[QSPI_PAGE_COUNT / 32];
+static uint32_t _qspi_dirty[QSPI_PAGE_COUNT / 32];
+
+// QSPI is kept memory-mapped while no write is in progress, reads are then a plain memcpy.
+// Range modified since last mapped is invalidated from D-Cache when mapping again.
+static bool _qspi_mapped = false;
+static uint8_t _qspi_read_mode = w25qxx_DTRMode; // falls back to w25qxx_NormalMode if DTR reads fail
+static uint32_t _qspi_stale_start = UINT32_MAX;
+static uint32_t _qspi_stale_end = 0;
+
+// 4KB sector and 64KB block erase, replaced by erase types probed from SFDP (opcode 0 if not supported)
+static sfdp_erase_t _qspi_sector_erase = { W25X_SECTOR_SIZE, 45, W25X_SectorErase };
+static sfdp_erase_t _qspi_block_erase = { W25X_BLOCK_SIZE, 150, W25X_BlockErase };
+static uint32_t _qspi_block_erase_min = QSPI_BLOCK_ERASE_MIN;
+#endif // BOARD_QSPI_FLASH_EN
+
 //--------------------------------------------------------------------+
 // Board Memory Callouts
 //--------------------------------------------------------------------+
@@ -42,6 +96,261 @@ uint32_t W25Qx_GetTick(void)
 }
 #endif // W25Qx_SPI
 
+//--------------------------------------------------------------------+
+// Per device operation queues
+//--------------------------------------------------------------------+
+#if FLASH_STRIPE
+#define FLASH_OP_DEPTH  32
+
+// An erase runs at least this long after a resume before it is suspended again, so that reads
+// interleaved with writes cannot starve it (ticks are 1ms: 2 ticks apart is at least 1ms)
+#define FLASH_ERASE_RUN_TICKS  2
+
+typedef struct
+{
+  uint8_t* data;    // NULL for erase
+  uint32_t addr;    // offset in flash device
+  uint16_t len;
+  uint8_t  opcode;  // erase instruction (QSPI)
+} flash_op_t;
+
+typedef struct
+{
+  flash_op_t ops[FLASH_OP_DEPTH];
+  uint8_t head;
+  uint8_t count;
+  bool    active;   // operation at head is started, device busy
+  bool    hold;     // do not start the next one, e.g device is about to be read
+  bool    suspended; // erase at head is suspended, resumed by the next poll once released
+  uint32_t resumed; // tick of the last resume
+  uint8_t (*start)(flash_op_t const* op);
+  uint8_t (*is_busy)(void);
+  uint8_t (*suspend)(void);
+  uint8_t (*resume)(void);
+} flash_dev_t;
+
+static uint8_t spi_op_start(flash_op_t const* op)
+{
+  return op->data ? W25Qx_PageProgramStart(op->data, op->addr, op->len) : W25Qx_EraseStart(op->addr);
+}
+
+static uint8_t qspi_op_start(flash_op_t const* op)
+{
+  return op->data ? W25qxx_PageProgramStart(op->data, op->addr, op->len) : W25qxx_EraseStart(op->opcode, op->addr);
+}
+
+static flash_dev_t _spi_dev = { .start = spi_op_start, .is_busy = W25Qx_IsBusy,
+                                .suspend = W25Qx_EraseSuspend, .resume = W25Qx_EraseResume };
+static flash_dev_t _qspi_dev = { .start = qspi_op_start, .is_busy = W25qxx_IsBusy,
+                                 .suspend = W25qxx_EraseSuspend, .resume = W25qxx_EraseResume };
+
+// Bytes of flash changed by an operation
+static uint32_t flash_op_size(flash_op_t const* op)
+{
+  if ( op->data ) return op->len;
+  return (op->opcode && op->opcode == _qspi_block_erase.opcode) ? _qspi_block_erase.size : W25X_SECTOR_SIZE;
+}
+
+// Retire the operation in progress once the device is ready and start the next one
+static void flash_dev_poll(flash_dev_t* dev)
+{
+  if ( dev->suspended )
+  {
+    // device is not busy while suspended, erase is not complete
+    if ( dev->hold ) return;
+    if ( dev->resume() != 0 ) __asm("bkpt #9");
+    dev->suspended = false;
+    dev->resumed = HAL_GetTick();
+    return;
+  }
+
+  if ( dev->active )
+  {
+    if ( dev->is_busy() ) return;
+    dev->active = false;
+    dev->head = (uint8_t) ((dev->head + 1) % FLASH_OP_DEPTH);
+    dev->count--;
+  }
+
+  while ( dev->count && !dev->hold )
+  {
+    flash_op_t const* op = &dev->ops[dev->head];
+    if ( dev->start(op) == 0 )
+    {
+      dev->active = true;
+      return;
+    }
+
+    TUF2_LOG1("Flash %s failed at 0x%08lX\r\n", op->data ? "program" : "erase", op->addr);
+    __asm("bkpt #9");
+    dev->head = (uint8_t) ((dev->head + 1) % FLASH_OP_DEPTH);
+    dev->count--;
+  }
+}
+
+static void flash_stripe_poll(void)
+{
+  flash_dev_poll(&_spi_dev);
+  flash_dev_poll(&_qspi_dev);
+}
+
+static void flash_dev_push(flash_dev_t* dev, uint8_t* data, uint32_t addr, uint32_t len, uint8_t opcode)
+{
+  // keep the other device going while this queue is full
+  while ( dev->count == FLASH_OP_DEPTH ) flash_stripe_poll();
+
+  flash_op_t* op = &dev->ops[(dev->head + dev->count) % FLASH_OP_DEPTH];
+  op->data = data;
+  op->addr = addr;
+  op->len = (uint16_t) len;
+  op->opcode = opcode;
+  dev->count++;
+
+  flash_dev_poll(dev);
+}
+
+// Wait until all queued operations of device are completed
+static void flash_dev_drain(flash_dev_t* dev)
+{
+  while ( dev->count ) flash_stripe_poll();
+}
+
+// Wait until no queued operation of device uses data in [buf, buf+len)
+static void flash_dev_release(flash_dev_t* dev, uint8_t const* buf, uint32_t len)
+{
+  for ( bool used = true; used; )
+  {
+    used = false;
+    for ( uint32_t i = 0; i < dev->count && !used; i++ )
+    {
+      uint8_t const* data = dev->ops[(dev->head + i) % FLASH_OP_DEPTH].data;
+      used = data && data >= buf && data < buf + len;
+    }
+    if ( used ) flash_stripe_poll();
+  }
+}
+
+// Make [addr, addr+len) of device readable without waiting for the whole queue: the next operations
+// are held, a page program in progress completes (a few ms) and an erase is suspended (20us). Queued
+// operations covering the range are completed first, flash contents are not final until then
+static void flash_dev_read_begin(flash_dev_t* dev, uint32_t addr, uint32_t len)
+{
+  for ( uint32_t i = 0; i < dev->count; i++ )
+  {
+    flash_op_t const* op = &dev->ops[(dev->head + i) % FLASH_OP_DEPTH];
+    if ( op->addr < addr + len && addr < op->addr + flash_op_size(op) )
+    {
+      flash_dev_drain(dev);
+      break;
+    }
+  }
+
+  dev->hold = true;
+  while ( dev->active && !dev->suspended )
+  {
+    if ( BOARD_FLASH_ERASE_SUSPEND && !dev->ops[dev->head].data &&
+         HAL_GetTick() - dev->resumed >= FLASH_ERASE_RUN_TICKS )
+    {
+      // no longer suspended when erase completed just before: retired by the poll below
+      dev->suspended = (dev->suspend() != 0);
+    }
+    if ( !dev->suspended ) flash_stripe_poll();
+  }
+}
+
+// Release device after reads, a suspended erase is resumed with the next poll (e.g next write): it
+// stays suspended across a burst of reads
+static void flash_dev_read_end(flash_dev_t* dev)
+{
+  dev->hold = false;
+}
+
+// SPI flash writes are collected per 4KB sector alternating between two buffers: programming of one
+// sector is queued while the next one is filled. Buffer holds flash contents overlaid with payloads.
+#define SPI_SECTOR_SIZE         4096U
+#define SPI_PAGE_SIZE           256U
+#define SPI_SECTOR_INVALID_ADDR 0xffffffff
+
+static uint8_t  _spi_sector[2][SPI_SECTOR_SIZE] __attribute__((aligned(4)));
+static uint32_t _spi_sector_addr = SPI_SECTOR_INVALID_ADDR;
+static uint8_t  _spi_sector_buf = 0;
+static uint16_t _spi_sector_dirty;  // bit per changed page
+static bool     _spi_sector_erase;  // a payload sets bits cleared in flash
+
+// Queue erase (if needed) and program of the collected sector
+static void spi_sector_commit(void)
+{
+  if ( _spi_sector_addr == SPI_SECTOR_INVALID_ADDR ) return;
+
+  uint8_t* const buf = _spi_sector[_spi_sector_buf];
+
+  if ( _spi_sector_erase )
+  {
+    TUF2_LOG1("SPI sector erase at 0x%08lX\r\n", _spi_sector_addr);
+    flash_dev_push(&_spi_dev, NULL, _spi_sector_addr, 0, 0);
+  }
+
+  for ( uint32_t i = 0; i < SPI_SECTOR_SIZE / SPI_PAGE_SIZE; i++ )
+  {
+    uint8_t* const page = buf + i * SPI_PAGE_SIZE;
+
+    // after erase all non blank pages, otherwise only changed pages (program only clears bits)
+    bool program = (_spi_sector_dirty & (1U << i)) != 0;
+    if ( _spi_sector_erase )
+    {
+      program = false;
+      for ( uint32_t b = 0; b < SPI_PAGE_SIZE && !program; b += 4 ) program = *(uint32_t const*) (page + b) != 0xFFFFFFFFUL;
+    }
+
+    if ( program ) flash_dev_push(&_spi_dev, page, _spi_sector_addr + i * SPI_PAGE_SIZE, SPI_PAGE_SIZE, 0);
+  }
+
+  _spi_sector_addr = SPI_SECTOR_INVALID_ADDR;
+  _spi_sector_buf ^= 1;
+}
+
+static void spi_sector_write(uint32_t addr, uint8_t const* src, uint32_t len)
+{
+  // payload may cross sector boundary
+  while ( len )
+  {
+    uint32_t const sector_addr = addr & ~(SPI_SECTOR_SIZE - 1);
+    uint32_t const offset = addr & (SPI_SECTOR_SIZE - 1);
+    uint32_t const count = (len < SPI_SECTOR_SIZE - offset) ? len : (SPI_SECTOR_SIZE - offset);
+
+    if ( sector_addr != _spi_sector_addr )
+    {
+      spi_sector_commit();
+
+      // buffer may still be programmed from two sectors ago, then load current contents
+      uint8_t* const buf = _spi_sector[_spi_sector_buf];
+      flash_dev_release(&_spi_dev, buf, SPI_SECTOR_SIZE);
+      flash_dev_read_begin(&_spi_dev, sector_addr, SPI_SECTOR_SIZE);
+      (void) W25Qx_Read(buf, sector_addr, SPI_SECTOR_SIZE);
+      flash_dev_read_end(&_spi_dev);
+      flash_dev_poll(&_spi_dev);
+
+      _spi_sector_addr = sector_addr;
+      _spi_sector_dirty = 0;
+      _spi_sector_erase = false;
+    }
+
+    uint8_t* const dst = _spi_sector[_spi_sector_buf] + offset;
+    for ( uint32_t b = 0; b < count; b++ )
+    {
+      if ( dst[b] == src[b] ) continue;
+      if ( (dst[b] & src[b]) != src[b] ) _spi_sector_erase = true;
+      _spi_sector_dirty |= (uint16_t) (1U << ((offset + b) / SPI_PAGE_SIZE));
+      dst[b] = src[b];
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+}
+#endif // FLASH_STRIPE
+
 //--------------------------------------------------------------------+
 // Flash LL for tinyuf2
 //--------------------------------------------------------------------+
@@ -77,6 +386,56 @@ void board_clear_temp_boot_addr(void)
   TMP_BOOT_ADDR = 0x00U;
 }
 
+#if BOARD_QSPI_FLASH_EN
+static bool qspi_sfdp_read(uint32_t addr, void* buffer, uint32_t len)
+{
+  return W25qxx_ReadSFDP((uint8_t*) buffer, addr, len) == w25qxx_OK;
+}
+
+// Pick sector/block erase from SFDP, must be called in SPI mode (before entering QPI)
+static void qspi_sfdp_probe(void)
+{
+  sfdp_flash_t sfdp;
+
+  if ( !sfdp_probe(&sfdp, qspi_sfdp_read) )
+  {
+    TUF2_LOG1("QSPI no SFDP, using W25Qxx defaults\r\n");
+    return;
+  }
+
+  sfdp_erase_t sector = { 0 };
+  sfdp_erase_t block = { 0 };
+
+  for ( uint32_t i = 0; i < SFDP_ERASE_TYPES; i++ )
+  {
+    if ( sfdp.erase[i].size == W25X_SECTOR_SIZE ) sector = sfdp.erase[i];
+    if ( sfdp.erase[i].size == W25X_BLOCK_SIZE ) block = sfdp.erase[i];
+  }
+
+  // neither granularity usable by the cache: keep defaults
+  if ( !sector.opcode && !block.opcode ) return;
+
+  _qspi_sector_erase = sector;
+  _qspi_block_erase = block;
+
+  if ( !sector.opcode )
+  {
+    _qspi_block_erase_min = 1; // any erase wipes the whole block
+  }
+  else if ( !block.opcode )
+  {
+    _qspi_block_erase_min = UINT32_MAX;
+  }
+  else if ( sector.time_ms && block.time_ms )
+  {
+    _qspi_block_erase_min = (block.time_ms + sector.time_ms - 1) / sector.time_ms;
+  }
+
+  TUF2_LOG1("QSPI SFDP: %lu KB, sector erase 0x%02X %lums, block erase 0x%02X %lums\r\n", sfdp.size / 1024,
+            sector.opcode, sector.time_ms, block.opcode, block.time_ms);
+}
+#endif // BOARD_QSPI_FLASH_EN
+
 void board_flash_early_init(void)
 {
 #if BOARD_QSPI_FLASH_EN
@@ -84,6 +443,8 @@ void board_flash_early_init(void)
   qspi_flash_init(&_qspi_flash);
   // Initialize QSPI driver
   w25qxx_Init();
+  // Erase commands from SFDP, only readable in SPI mode
+  qspi_sfdp_probe();
   // SPI -> QPI
   w25qxx_EnterQPI();
 #endif // BOARD_QSPI_FLASH_EN
@@ -99,12 +460,131 @@ void board_flash_init(void)
 #endif // BOARD_SPI_FLASH_EN
 }
 
+#if BOARD_QSPI_FLASH_EN
+static void qspi_stale(uint32_t offset, uint32_t len)
+{
+  if ( offset < _qspi_stale_start ) _qspi_stale_start = offset;
+  if ( offset + len > _qspi_stale_end ) _qspi_stale_end = offset + len;
+}
+
+// Switch between memory-mapped (read only) and indirect mode (commands, erase & program)
+static void qspi_mem_mapped(bool enable)
+{
+  if ( enable == _qspi_mapped ) return;
+
+  if ( enable )
+  {
+#if FLASH_STRIPE
+    // background flush of the last block must be completed
+    flash_dev_drain(&_qspi_dev);
+#endif
+
+    // QSPI flash will be available at 0x90000000U (readonly)
+    if ( _qspi_stale_end > _qspi_stale_start )
+    {
+      uint32_t const start = _qspi_stale_start & ~31UL;
+      SCB_InvalidateDCache_by_Addr((uint32_t*) (QSPI_BASE_ADDR + start), (int32_t) (_qspi_stale_end - start));
+      _qspi_stale_start = UINT32_MAX;
+      _qspi_stale_end = 0;
+    }
+    _qspi_mapped = (w25qxx_Startup(_qspi_read_mode) == w25qxx_OK);
+  }
+  else
+  {
+    // abort terminates memory-mapped mode
+    (void) HAL_QSPI_Abort(&_qspi_flash);
+    _qspi_mapped = false;
+  }
+}
+#endif // BOARD_QSPI_FLASH_EN
+
+#if BOARD_QSPI_FLASH_EN
+#define QSPI_HANDOFF_MPU_REGION   MPU_REGION_NUMBER7
+#define QSPI_VALIDATE_SIZE        256
+
+extern volatile board_qspi_handoff_t _board_qspi_handoff[];
+
+// Validate memory-mapped reads against an indirect (SDR) read of the start of flash (app vectors),
+// fall back to SDR memory-mapped mode on mismatch
+static void qspi_read_mode_validate(void)
+{
+  uint8_t ref[QSPI_VALIDATE_SIZE] __attribute__((aligned(32)));
+
+  qspi_mem_mapped(false);
+  if ( W25qxx_Read(ref, 0, sizeof(ref)) != w25qxx_OK ) return;
+
+  for ( uint8_t mode = _qspi_read_mode; ; mode = w25qxx_NormalMode )
+  {
+    _qspi_read_mode = mode;
+    SCB_InvalidateDCache_by_Addr((uint32_t*) QSPI_BASE_ADDR, sizeof(ref));
+    qspi_mem_mapped(true);
+
+    if ( _qspi_mapped && 0 == memcmp((void const*) QSPI_BASE_ADDR, ref, sizeof(ref)) ) return;
+    if ( mode == w25qxx_NormalMode ) break;
+
+    TUF2_LOG1("QSPI DTR read mismatch, using SDR\r\n");
+    qspi_mem_mapped(false);
+  }
+}
+
+// Window as normal memory: cacheable write-through, read only, executable
+static void qspi_mpu_config(void)
+{
+  MPU_Region_InitTypeDef region = { 0 };
+
+  HAL_MPU_Disable();
+
+  region.Enable           = MPU_REGION_ENABLE;
+  region.Number           = QSPI_HANDOFF_MPU_REGION;
+  region.BaseAddress      = QSPI_BASE_ADDR;
+  region.Size             = (uint8_t) (31 - __CLZ(QSPI_FLASH_SIZE) - 1); // MPU_REGION_SIZE_xx is log2(size) - 1
+  region.SubRegionDisable = 0x00;
+  region.TypeExtField     = MPU_TEX_LEVEL0;
+  region.AccessPermission = MPU_REGION_PRIV_RO_URO;
+  region.DisableExec      = MPU_INSTRUCTION_ACCESS_ENABLE;
+  region.IsShareable      = MPU_ACCESS_NOT_SHAREABLE;
+  region.IsCacheable      = MPU_ACCESS_CACHEABLE;
+  region.IsBufferable     = MPU_ACCESS_NOT_BUFFERABLE;
+  HAL_MPU_ConfigRegion(&region);
+
+  HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+}
+
+static void qspi_handoff(void)
+{
+  // stale descriptor of a previous boot
+  _board_qspi_handoff[0].magic = 0;
+
+  qspi_read_mode_validate();
+  if ( !_qspi_mapped ) return;
+
+  qspi_mpu_config();
+
+  board_qspi_handoff_t* const desc = (board_qspi_handoff_t*) (uintptr_t) &_board_qspi_handoff[0];
+  bool const dtr = (_qspi_read_mode == w25qxx_DTRMode);
+  uint32_t const prescaler = (QUADSPI->CR & QUADSPI_CR_PRESCALER_Msk) >> QUADSPI_CR_PRESCALER_Pos;
+
+  memset(desc, 0, sizeof(board_qspi_handoff_t));
+  desc->version      = BOARD_QSPI_HANDOFF_VERSION;
+  desc->base         = QSPI_BASE_ADDR;
+  desc->size         = QSPI_FLASH_SIZE;
+  desc->clock_hz     = HAL_RCC_GetHCLKFreq() / (prescaler + 1);
+  desc->qpi          = (w25qxx_Mode == w25qxx_QPIMode);
+  desc->dtr          = dtr;
+  desc->read_opcode  = dtr ? W25X_QUAD_INOUT_FAST_READ_DTR_CMD : W25X_QUAD_INOUT_FAST_READ_CMD;
+  desc->dummy_cycles = dtr ? W25X_DUMMY_CYCLES_READ_QUAD_DTR :
+                       ((w25qxx_Mode == w25qxx_QPIMode) ? W25X_DUMMY_CYCLES_READ_QUAD : W25X_DUMMY_CYCLES_READ_QUAD - 2);
+  desc->prescaler    = (uint8_t) prescaler;
+  desc->mpu_region   = (uint8_t) QSPI_HANDOFF_MPU_REGION;
+  desc->magic        = BOARD_QSPI_HANDOFF_MAGIC;
+}
+#endif // BOARD_QSPI_FLASH_EN
+
 void board_flash_deinit(void)
 {
 #if BOARD_QSPI_FLASH_EN
-  // Enable Memory Mapped Mode
-  // QSPI flash will be available at 0x90000000U (readonly)
-  w25qxx_Startup(w25qxx_DTRMode);
+  // Enable Memory Mapped Mode in the fastest validated read mode, described for the app
+  qspi_handoff();
 #endif // BOARD_QSPI_FLASH_EN
 }
 
@@ -114,20 +594,392 @@ uint32_t board_flash_size(void)
   return 8*1024*1024;
 }
 
+#if BOARD_QSPI_FLASH_EN
+static inline bool page_bit(uint32_t const* mask, uint32_t i)
+{
+  return mask[i / 32] & (1UL << (i % 32));
+}
+
+// Load current flash contents of pages [first, last) that were not written
+static void qspi_cache_fill(uint32_t first, uint32_t last)
+{
+  for ( uint32_t i = first; i < last; i++ )
+  {
+    if ( !page_bit(_qspi_valid, i) )
+    {
+      (void) W25qxx_Read(_qspi_cache + i * W25X_PAGE_SIZE, _qspi_cache_addr + i * W25X_PAGE_SIZE, W25X_PAGE_SIZE);
+      _qspi_valid[i / 32] |= 1UL << (i % 32);
+    }
+  }
+}
+
+enum
+{
+  SECTOR_UNCHANGED = 0,
+  SECTOR_PROGRAM, // written pages only clear bits, no erase needed
+  SECTOR_ERASE
+};
+
+// Compare written pages of a sector with flash, loaded pages are flash contents already
+static uint8_t qspi_sector_state(uint32_t sector)
+{
+  uint8_t page[W25X_PAGE_SIZE] __attribute__((aligned(4)));
+  uint8_t state = SECTOR_UNCHANGED;
+
+  for ( uint32_t i = sector * QSPI_SECTOR_PAGES; i < (sector + 1) * QSPI_SECTOR_PAGES; i++ )
+  {
+    if ( !page_bit(_qspi_dirty, i) ) continue;
+
+    uint8_t const* data = _qspi_cache + i * W25X_PAGE_SIZE;
+    (void) W25qxx_Read(page, _qspi_cache_addr + i * W25X_PAGE_SIZE, W25X_PAGE_SIZE);
+    if ( memcmp(page, data, W25X_PAGE_SIZE) == 0 ) continue;
+
+    for ( uint32_t b = 0; b < W25X_PAGE_SIZE; b++ )
+    {
+      if ( (page[b] & data[b]) != data[b] ) return SECTOR_ERASE;
+    }
+    state = SECTOR_PROGRAM;
+  }
+
+  return state;
+}
+
+static uint8_t qspi_erase(uint8_t opcode, uint32_t addr)
+{
+#if FLASH_STRIPE
+  flash_dev_push(&_qspi_dev, NULL, addr, 0, opcode);
+  return w25qxx_OK;
+#else
+  return W25qxx_Erase(opcode, addr, W25X_BLOCK_ERASE_MAX_TIME);
+#endif
+}
+
+static uint8_t qspi_program(uint8_t* data, uint32_t addr, uint32_t len)
+{
+#if FLASH_STRIPE
+  // queued per page, blank pages are skipped as with W25qxx_ProgramPages()
+  for ( uint32_t offset = 0; offset < len; offset += W25X_PAGE_SIZE )
+  {
+    uint32_t const* word = (uint32_t const*) (data + offset);
+    uint32_t i;
+    for ( i = 0; i < W25X_PAGE_SIZE / 4 && word[i] == 0xFFFFFFFFUL; i++ ) {}
+
+    if ( i < W25X_PAGE_SIZE / 4 ) flash_dev_push(&_qspi_dev, data + offset, addr + offset, W25X_PAGE_SIZE, 0);
+  }
+  return w25qxx_OK;
+#else
+  return W25qxx_ProgramPages(data, addr, len);
+#endif
+}
+
+// Erase and program modified sectors of the cached block. With FLASH_STRIPE operations are only
+// queued: they are drained before the cache is reused or flash is memory-mapped
+static void qspi_cache_flush(void)
+{
+  if ( _qspi_cache_addr == QSPI_CACHE_INVALID_ADDR ) return;
+
+  uint8_t state[QSPI_SECTOR_COUNT];
+  uint32_t erase_count = 0;
+
+  for ( uint32_t s = 0; s < QSPI_SECTOR_COUNT; s++ )
+  {
+    state[s] = qspi_sector_state(s);
+    if ( state[s] == SECTOR_ERASE ) erase_count++;
+  }
+
+  for ( uint32_t s = 0; s < QSPI_SECTOR_COUNT; s++ )
+  {
+    if ( state[s] != SECTOR_UNCHANGED ) qspi_stale(_qspi_cache_addr + s * W25X_SECTOR_SIZE, W25X_SECTOR_SIZE);
+  }
+
+  if ( erase_count && erase_count >= _qspi_block_erase_min )
+  {
+    // block erase also wipes unchanged sectors, reprogram the whole block
+    TUF2_LOG1("QSPI block erase at 0x%08lX\r\n", _qspi_cache_addr);
+    qspi_cache_fill(0, QSPI_PAGE_COUNT);
+    if ( qspi_erase(_qspi_block_erase.opcode, _qspi_cache_addr) != w25qxx_OK ||
+         qspi_program(_qspi_cache, _qspi_cache_addr, W25X_BLOCK_SIZE) != w25qxx_OK )
+    {
+      __asm("bkpt #9");
+    }
+  }
+  else
+  {
+    // all reads first: flash is busy once the first (queued) erase starts
+    for ( uint32_t s = 0; s < QSPI_SECTOR_COUNT; s++ )
+    {
+      if ( state[s] == SECTOR_ERASE ) qspi_cache_fill(s * QSPI_SECTOR_PAGES, (s + 1) * QSPI_SECTOR_PAGES);
+    }
+
+    for ( uint32_t s = 0; s < QSPI_SECTOR_COUNT; s++ )
+    {
+      uint32_t const offset = s * W25X_SECTOR_SIZE;
+      uint8_t result = w25qxx_OK;
+
+      if ( state[s] == SECTOR_ERASE )
+      {
+        TUF2_LOG1("QSPI sector erase at 0x%08lX\r\n", _qspi_cache_addr + offset);
+        result = qspi_erase(_qspi_sector_erase.opcode, _qspi_cache_addr + offset);
+        if ( result == w25qxx_OK ) result = qspi_program(_qspi_cache + offset, _qspi_cache_addr + offset, W25X_SECTOR_SIZE);
+      }
+      else if ( state[s] == SECTOR_PROGRAM )
+      {
+        // written pages only clear bits: program them over current contents (matching ones are harmless)
+        for ( uint32_t i = s * QSPI_SECTOR_PAGES; i < (s + 1) * QSPI_SECTOR_PAGES && result == w25qxx_OK; i++ )
+        {
+          if ( page_bit(_qspi_dirty, i) )
+          {
+            result = qspi_program(_qspi_cache + i * W25X_PAGE_SIZE, _qspi_cache_addr + i * W25X_PAGE_SIZE, W25X_PAGE_SIZE);
+          }
+        }
+      }
+
+      if ( result != w25qxx_OK )
+      {
+        __asm("bkpt #9");
+      }
+    }
+  }
+
+  _qspi_cache_addr = QSPI_CACHE_INVALID_ADDR;
+}
+
+TUF2_HOT static void qspi_cache_write(uint32_t addr, uint8_t const* src, uint32_t len)
+{
+  // payload may cross block boundary
+  while ( len )
+  {
+    uint32_t const block_addr = addr & ~(W25X_BLOCK_SIZE - 1);
+    uint32_t const offset = addr & (W25X_BLOCK_SIZE - 1);
+    uint32_t const count = (len < W25X_BLOCK_SIZE - offset) ? len : (W25X_BLOCK_SIZE - offset);
+
+    if ( block_addr != _qspi_cache_addr )
+    {
+      // write starts: leave memory-mapped mode
+      qspi_mem_mapped(false);
+      qspi_cache_flush();
+#if FLASH_STRIPE
+      // queued programming of the previous block still reads from the cache
+      flash_dev_drain(&_qspi_dev);
+#endif
+      _qspi_cache_addr = block_addr;
+
+      // current contents is loaded lazily (on flush) for pages not written
+      memset(_qspi_valid, 0, sizeof(_qspi_valid));
+      memset(_qspi_dirty, 0, sizeof(_qspi_dirty));
+    }
+
+    uint32_t const first = offset / W25X_PAGE_SIZE;
+    uint32_t const last = (offset + count + W25X_PAGE_SIZE - 1) / W25X_PAGE_SIZE;
+
+    // partial page write: load current contents of the pages first
+    if ( (offset | count) & (W25X_PAGE_SIZE - 1) )
+    {
+      qspi_cache_fill(first, last);
+    }
+
+    memcpy(_qspi_cache + offset, src, count);
+
+    for ( uint32_t i = first; i < last; i++ )
+    {
+      _qspi_valid[i / 32] |= 1UL << (i % 32);
+      _qspi_dirty[i / 32] |= 1UL << (i % 32);
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+}
+#endif // BOARD_QSPI_FLASH_EN
+
+//--------------------------------------------------------------------+
+// Internal flash (PFLASH)
+//--------------------------------------------------------------------+
+
+// PFLASH has ECC per flash word (32 bytes, 16 on H7A3/B0): each one is programmed once after erase.
+// Payloads are gathered into the current flash word, which is programmed once complete, when a payload
+// moves on to another word, or on flush (missing bytes left erased). A sector is erased when first
+// entered in a session unless it holds TinyUF2: on the H750 the only 128KB sector is shared with the
+// bootloader, the application half can then only be programmed while blank.
+#define PFLASH_WORD_SIZE      (FLASH_NB_32BITWORD_IN_FLASHWORD * 4U)
+#define PFLASH_SECTOR_COUNT   (((PFLASH_SIZE) + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE)
+#define PFLASH_WORD_NONE      0xffffffff
+
+// Sector holding the end of TinyUF2, this and the ones before it are never erased
+#define PFLASH_BOOT_SECTORS   (((PFLASH_OFFS) + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE)
+
+static uint8_t  _pflash_erased[PFLASH_SECTOR_COUNT];
+static uint32_t _pflash_word_addr = PFLASH_WORD_NONE;
+static uint32_t _pflash_word_mask; // bit set for each byte of the flash word written
+static uint8_t  _pflash_word[PFLASH_WORD_SIZE] __attribute__((aligned(4)));
+
+static bool pflash_is_blank(uint32_t addr, uint32_t len)
+{
+  for ( uint32_t i = 0; i < len; i += 4 )
+  {
+    if ( *(uint32_t const volatile *) (addr + i) != 0xFFFFFFFFU ) return false;
+  }
+  return true;
+}
+
+// Erase sector of addr when first entered, flash must be unlocked
+static bool pflash_sector_enter(uint32_t addr)
+{
+  uint32_t const sector = (addr - PFLASH_BASE_ADDR) / FLASH_SECTOR_SIZE;
+  uint32_t const sector_addr = PFLASH_BASE_ADDR + sector * FLASH_SECTOR_SIZE;
+
+  if ( _pflash_erased[sector] || sector < PFLASH_BOOT_SECTORS ) return true;
+  _pflash_erased[sector] = 1;
+
+  if ( pflash_is_blank(sector_addr, FLASH_SECTOR_SIZE) ) return true;
+
+  TUF2_LOG1("PFLASH sector erase at 0x%08lX\r\n", sector_addr);
+
+  FLASH_EraseInitTypeDef erase = { 0 };
+  erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+#ifdef DUAL_BANK
+  erase.Banks = (sector_addr < FLASH_BANK2_BASE) ? FLASH_BANK_1 : FLASH_BANK_2;
+  erase.Sector = ((sector_addr - PFLASH_BASE_ADDR) % FLASH_BANK_SIZE) / FLASH_SECTOR_SIZE;
+#else
+  erase.Banks = FLASH_BANK_1;
+  erase.Sector = sector;
+#endif
+  erase.NbSectors = 1;
+  erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+  uint32_t sector_error = 0;
+  bool const ok = (HAL_FLASHEx_Erase(&erase, &sector_error) == HAL_OK);
+  SCB_InvalidateDCache_by_Addr((uint32_t*) sector_addr, FLASH_SECTOR_SIZE);
+
+  if ( !ok ) TUF2_LOG1("PFLASH erase failed\r\n");
+  return ok;
+}
+
+// Program the gathered flash word
+static bool pflash_word_program(void)
+{
+  if ( _pflash_word_addr == PFLASH_WORD_NONE ) return true;
+
+  uint32_t const addr = _pflash_word_addr;
+  _pflash_word_addr = PFLASH_WORD_NONE;
+
+  HAL_FLASH_Unlock();
+
+  bool ok = pflash_sector_enter(addr);
+
+  // unchanged word (only possible in a sector that is not erased), else it must still be blank
+  if ( ok && 0 == memcmp((void const*) addr, _pflash_word, PFLASH_WORD_SIZE) )
+  {
+    HAL_FLASH_Lock();
+    return true;
+  }
+
+  if ( ok && !pflash_is_blank(addr, PFLASH_WORD_SIZE) )
+  {
+    TUF2_LOG1("PFLASH word at 0x%08lX is not blank\r\n", addr);
+    ok = false;
+  }
+
+  if ( ok )
+  {
+    ok = (HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, addr, (uint32_t) _pflash_word) == HAL_OK);
+    SCB_InvalidateDCache_by_Addr((uint32_t*) addr, PFLASH_WORD_SIZE);
+    if ( !ok ) TUF2_LOG1("PFLASH program failed at 0x%08lX\r\n", addr);
+  }
+
+  HAL_FLASH_Lock();
+  return ok;
+}
+
+static bool pflash_write(uint32_t addr, uint8_t const* src, uint32_t len)
+{
+  bool ok = true;
+
+  while ( len )
+  {
+    uint32_t const word_addr = addr & ~(PFLASH_WORD_SIZE - 1);
+    uint32_t const offset = addr & (PFLASH_WORD_SIZE - 1);
+    uint32_t const count = (len < PFLASH_WORD_SIZE - offset) ? len : (PFLASH_WORD_SIZE - offset);
+
+    if ( word_addr != _pflash_word_addr )
+    {
+      ok = pflash_word_program() && ok;
+      _pflash_word_addr = word_addr;
+      _pflash_word_mask = 0;
+      memset(_pflash_word, 0xff, PFLASH_WORD_SIZE);
+    }
+
+    memcpy(_pflash_word + offset, src, count);
+    _pflash_word_mask |= (uint32_t) (((1ULL << count) - 1) << offset);
+
+    // complete word: program right away
+    if ( _pflash_word_mask == (uint32_t) ((1ULL << PFLASH_WORD_SIZE) - 1) )
+    {
+      ok = pflash_word_program() && ok;
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+
+  return ok;
+}
+
 void board_flash_flush(void)
 {
-  // TODO: do we need to implement this if there no caching involved?
-  // maybe flush cached RAM here?
+#if BOARD_QSPI_FLASH_EN
+  qspi_cache_flush();
+#endif
+
+#if FLASH_STRIPE
+  // both devices complete their queues concurrently
+  spi_sector_commit();
+  flash_dev_drain(&_spi_dev);
+  flash_dev_drain(&_qspi_dev);
+#endif
+
+  (void) pflash_word_program();
 }
 
-void board_flash_read(uint32_t addr, void * data, uint32_t len)
+void board_flash_session_reset(void)
+{
+  memset(_pflash_erased, 0, sizeof(_pflash_erased));
+}
+
+TUF2_HOT void board_flash_read(uint32_t addr, void * data, uint32_t len)
 {
   TUF2_LOG1("Reading %lu byte(s) from 0x%08lx\r\n", len, addr);
 #if BOARD_QSPI_FLASH_EN
   // addr += QSPI_BASE_ADDR;
   if (IS_QSPI_ADDR(addr))
   {
-    (void) W25qxx_Read(data, addr - QSPI_BASE_ADDR, len);
+#if FLASH_STRIPE
+    // erase or program in background: indirect read in between, rather than draining the queue
+    if (_qspi_cache_addr != QSPI_CACHE_INVALID_ADDR || _qspi_dev.count)
+    {
+      flash_dev_read_begin(&_qspi_dev, addr - QSPI_BASE_ADDR, len);
+      (void) W25qxx_Read(data, addr - QSPI_BASE_ADDR, len);
+      flash_dev_read_end(&_qspi_dev);
+      return;
+    }
+#endif
+
+    // memory-mapped unless a write is in progress
+    if (_qspi_cache_addr == QSPI_CACHE_INVALID_ADDR)
+    {
+      qspi_mem_mapped(true);
+    }
+
+    if (_qspi_mapped)
+    {
+      memcpy(data, (void const *) addr, len);
+    }
+    else
+    {
+      (void) W25qxx_Read(data, addr - QSPI_BASE_ADDR, len);
+    }
     return;
   }
 #endif
@@ -143,6 +995,16 @@ void board_flash_read(uint32_t addr, void * data, uint32_t len)
   if (IS_PFLASH_ADDR(addr))
   {
     memcpy(data, (void *) addr, len);
+
+    // overlay flash word not programmed yet
+    if (_pflash_word_addr != PFLASH_WORD_NONE && _pflash_word_addr < addr + len && addr < _pflash_word_addr + PFLASH_WORD_SIZE)
+    {
+      for (uint32_t i = 0; i < PFLASH_WORD_SIZE; i++)
+      {
+        uint32_t const a = _pflash_word_addr + i;
+        if ((_pflash_word_mask & (1UL << i)) && a >= addr && a < addr + len) ((uint8_t *) data)[a - addr] = _pflash_word[i];
+      }
+    }
     return;
   }
 
@@ -152,10 +1014,15 @@ void board_flash_read(uint32_t addr, void * data, uint32_t len)
   }
 }
 
-bool board_flash_write(uint32_t addr, void const * data, uint32_t len)
+TUF2_HOT bool board_flash_write(uint32_t addr, void const * data, uint32_t len)
 {
   TUF2_LOG1("Programming %lu byte(s) at 0x%08lx\r\n", len, addr);
 
+#if FLASH_STRIPE
+  // queued operations advance with every payload
+  flash_stripe_poll();
+#endif
+
   // For external flash, W25Qx
   // TODO: these should be configurable parameters
   // Page size = 256 bytes
@@ -163,7 +1030,13 @@ bool board_flash_write(uint32_t addr, void const * data, uint32_t len)
 #if (BOARD_SPI_FLASH_EN == 1U)
   if (IS_SPI_ADDR(addr) && IS_SPI_ADDR(addr + len - 1))
   {
+#if FLASH_STRIPE
+    // QSPI block is programmed in background while SPI is written
+    qspi_cache_flush();
+    spi_sector_write(addr - SPI_BASE_ADDR, (uint8_t const *) data, len);
+#else
     W25Qx_Write((uint8_t *) data, (addr - SPI_BASE_ADDR), len);
+#endif
     return true;
   }
 #endif
@@ -171,12 +1044,13 @@ bool board_flash_write(uint32_t addr, void const * data, uint32_t len)
 #if (BOARD_QSPI_FLASH_EN == 1)
   if (IS_QSPI_ADDR(addr) && IS_QSPI_ADDR(addr + len - 1))
   {
+#if FLASH_STRIPE
+    // and the SPI sector while QSPI is written
+    spi_sector_commit();
+#endif
     // SET_BOOT_ADDR(BOARD_AXISRAM_APP_ADDR);
-    // handles erasing internally
-    if (W25qxx_Write((uint8_t *)data, (addr - QSPI_BASE_ADDR), len) != w25qxx_OK)
-    {
-      __asm("bkpt #9");
-    }
+    // cached per 64KB block, erased and programmed on flush
+    qspi_cache_write(addr - QSPI_BASE_ADDR, (uint8_t const *) data, len);
     return true;
   }
 #endif
@@ -191,15 +1065,12 @@ bool board_flash_write(uint32_t addr, void const * data, uint32_t len)
   }
 #endif // BOARD_AXISRAM_EN
 
-  // This is not a good idea for the h750 port because
-  // - There is only one flash bank available
-  // - There is only one sector available
-  // - It will also need a config section in flash to store the boot address
+  // On the h750 there is only one sector shared with TinyUF2, which is never erased: the application
+  // half can only be programmed while blank (e.g after erasing it with a debugger)
   if (IS_PFLASH_ADDR(addr) && IS_PFLASH_ADDR(addr + len - 1))
   {
-    // TODO: Implement this
-    // SET_BOOT_ADDR(BOARD_PFLASH_APP_ADDR);
-    return false;
+    SET_BOOT_ADDR(BOARD_PFLASH_APP_ADDR);
+    return pflash_write(addr, (uint8_t const *) data, len);
   }
 
   // Invalid address write
@@ -207,13 +1078,56 @@ bool board_flash_write(uint32_t addr, void const * data, uint32_t len)
   return false;
 }
 
+#if BOARD_QSPI_FLASH_EN
+TUF2_HOT bool board_flash_write_v(board_flash_vec_t const * vec, uint32_t count)
+{
+  // payloads of a WRITE10 buffer target the same region nearly always, decode it once
+  bool all_qspi = true;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    all_qspi = all_qspi && IS_QSPI_ADDR(vec[i].addr) && IS_QSPI_ADDR(vec[i].addr + vec[i].len - 1);
+  }
+
+  if (!all_qspi)
+  {
+    bool ret = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      ret = board_flash_write(vec[i].addr, vec[i].data, vec[i].len) && ret;
+    }
+    return ret;
+  }
+
+  TUF2_LOG1("Programming %lu payload(s) at 0x%08lx\r\n", count, vec[0].addr);
+#if FLASH_STRIPE
+  flash_stripe_poll();
+  spi_sector_commit();
+#endif
+  for (uint32_t i = 0; i < count; i++)
+  {
+    qspi_cache_write(vec[i].addr - QSPI_BASE_ADDR, (uint8_t const *) vec[i].data, vec[i].len);
+  }
+  return true;
+}
+#endif
+
 void board_flash_erase_app(void)
 {
   board_flash_init();
 
+#if FLASH_STRIPE
+  // written data belongs to the application being wiped, in flight operations must complete
+  _spi_sector_addr = SPI_SECTOR_INVALID_ADDR;
+  _qspi_cache_addr = QSPI_CACHE_INVALID_ADDR;
+  flash_dev_drain(&_spi_dev);
+  flash_dev_drain(&_qspi_dev);
+#endif
+
 #if BOARD_QSPI_FLASH_EN
   TUF2_LOG1("Erasing QSPI Flash\r\n");
   // Erase QSPI Flash
+  qspi_mem_mapped(false);
+  qspi_stale(0, QSPI_FLASH_SIZE);
   (void) W25qxx_EraseChip();
 #endif
 
@@ -223,6 +1137,15 @@ void board_flash_erase_app(void)
   (void) W25Qx_Erase_Chip();
 #endif
 
-  // TODO: Implement PFLASH erase for non-tinyuf2 sectors
+  // PFLASH sectors after the ones holding TinyUF2
+  _pflash_word_addr = PFLASH_WORD_NONE;
+  memset(_pflash_erased, 0, sizeof(_pflash_erased));
+  HAL_FLASH_Unlock();
+  for (uint32_t s = PFLASH_BOOT_SECTORS; s < PFLASH_SECTOR_COUNT; s++)
+  {
+    (void) pflash_sector_enter(PFLASH_BASE_ADDR + s * FLASH_SECTOR_SIZE);
+  }
+  HAL_FLASH_Lock();
+
   board_reset();
 }
@@ -24,6 +24,10 @@ void ST7735_Delay(uint32_t ms)
 void board_display_init(void)
 {
 #if (TINYUF2_DISPLAY == 1U)
+  // screen.c buffers (TUF2_DISPLAY_RAM) and DMA2D
+  __HAL_RCC_D2SRAM1_CLK_ENABLE();
+  __HAL_RCC_DMA2D_CLK_ENABLE();
+
   display_init(&_display_spi);
   ST7735_Init();
   // Clear previous screen
@@ -36,13 +40,89 @@ void board_display_init(void)
 void board_display_draw_line(int y, uint16_t* pixel_color, uint32_t pixel_num)
 {
 #if (TINYUF2_DISPLAY == 1U)
+  // one address window and transfer per line instead of per pixel, bytes are sent in the
+  // same order as ST7735_DrawPixel() did with each pixel_color[] value
+  static uint16_t line[ST7735_HEIGHT];
+  if (pixel_num > ST7735_HEIGHT) pixel_num = ST7735_HEIGHT;
+
   for (uint32_t x = 0; x < pixel_num; x += 1) {
-    ST7735_DrawPixel(y, x, pixel_color[x]);
+    line[x] = __REV16(pixel_color[x]);
   }
+
+  ST7735_DrawImage(y, 0, 1, pixel_num, line);
 #endif // TINYUF2_DISPLAY == 1U
 }
 
 
+#if (TINYUF2_DISPLAY == 1U)
+// CLUT of the palette, loaded by DMA2D from memory it can reach
+TUF2_DISPLAY_RAM static uint32_t _dma2d_clut[16];
+static uint16_t const* _dma2d_palette;
+
+static bool dma2d_wait(uint32_t done_flag)
+{
+  uint32_t const errors = DMA2D_ISR_TEIF | DMA2D_ISR_CAEIF | DMA2D_ISR_CEIF;
+  uint32_t const start = HAL_GetTick();
+
+  while ( !(DMA2D->ISR & (done_flag | errors)) )
+  {
+    if ( HAL_GetTick() - start > 10 )
+    {
+      DMA2D->CR |= DMA2D_CR_ABORT;
+      return false;
+    }
+  }
+
+  bool const ok = !(DMA2D->ISR & errors);
+  DMA2D->IFCR = DMA2D_IFCR_CTCIF | DMA2D_IFCR_CTEIF | DMA2D_IFCR_CCTCIF | DMA2D_IFCR_CAECIF | DMA2D_IFCR_CCEIF;
+  return ok;
+}
+
+// Memory to memory with pixel format conversion: L4 through the CLUT to RGB565, bytes of each pixel
+// swapped by the output stage for the big-endian line format
+bool board_display_expand(uint8_t* dst, uint8_t const* src, uint32_t count, uint16_t const palette[16])
+{
+  if ( count & 1 ) return false;
+
+  uint32_t const fg_format = (0xAUL << DMA2D_FGPFCCR_CM_Pos) | (15UL << DMA2D_FGPFCCR_CS_Pos); // L4, 16 ARGB8888 entries
+
+  if ( palette != _dma2d_palette )
+  {
+    for ( uint32_t i = 0; i < 16; i++ )
+    {
+      uint32_t const c = palette[i];
+      _dma2d_clut[i] = 0xFF000000UL | ((c >> 11) << 19) | (((c >> 5) & 0x3f) << 10) | ((c & 0x1f) << 3);
+    }
+    SCB_CleanDCache_by_Addr(_dma2d_clut, sizeof(_dma2d_clut));
+
+    DMA2D->FGCMAR = (uint32_t) _dma2d_clut;
+    DMA2D->FGPFCCR = fg_format;
+    DMA2D->FGPFCCR = fg_format | DMA2D_FGPFCCR_START;
+    if ( !dma2d_wait(DMA2D_ISR_CTCIF) ) return false;
+    _dma2d_palette = palette;
+  }
+
+  // source is written by the CPU, destination must not be overwritten by a dirty line eviction
+  SCB_CleanDCache_by_Addr((uint32_t*) (uintptr_t) src, (int32_t) ((count + 1) / 2));
+  SCB_CleanInvalidateDCache_by_Addr((uint32_t*) dst, (int32_t) (count * 2));
+
+  DMA2D->CR      = DMA2D_CR_MODE_0; // memory to memory with PFC
+  DMA2D->FGMAR   = (uint32_t) src;
+  DMA2D->FGOR    = 0;
+  DMA2D->FGPFCCR = fg_format;
+  DMA2D->OMAR    = (uint32_t) dst;
+  DMA2D->OOR     = 0;
+  DMA2D->OPFCCR  = (2UL << DMA2D_OPFCCR_CM_Pos) | DMA2D_OPFCCR_SB; // RGB565, bytes swapped
+  DMA2D->NLR     = (count << DMA2D_NLR_PL_Pos) | 1;
+  DMA2D->CR     |= DMA2D_CR_START;
+
+  if ( !dma2d_wait(DMA2D_ISR_TCIF) ) return false;
+
+  SCB_InvalidateDCache_by_Addr((uint32_t*) dst, (int32_t) (count * 2));
+  return true;
+}
+#endif // TINYUF2_DISPLAY == 1U
+
 //--------------------------------------------------------------------+
 // LED pattern
 //--------------------------------------------------------------------+
@@ -1,10 +1,30 @@
 #include "stm32h7xx_hal.h"
 #include "board_api.h"
 
+#ifndef BUILD_NO_TINYUSB
+#include "tusb.h"
+#endif
+
 #define STM32_UUID ((uint32_t *)0x1FF1E800)
 
+// USB transfer buffers in D2 SRAM1 for the OTG DMA, see linker/common.ld
+extern uint8_t _susb_ram[], _eusb_ram[];
+
+// ITCM code (TUF2_HOT, usb driver, memcpy), see linker/common.ld
+extern uint32_t _sitcm[], _eitcm[], _siitcm[];
+
+// Copy ITCM code before anything calls it, memcpy itself is located there
+static void itcm_init(void)
+{
+  uint32_t const* src = _siitcm;
+  for ( volatile uint32_t* dst = _sitcm; dst < _eitcm; ) *dst++ = *src++;
+  __DSB();
+  __ISB();
+}
+
 void board_init(void)
 {
+  itcm_init();
   SCB_EnableICache();
 #ifndef RAMCODE
   SCB_EnableDCache();
@@ -50,9 +70,34 @@ void board_init(void)
 }
 
 // Configure USB for DFU
+#if BOARD_TUD_RHPORT == 1
+// ULPI pins of the external high speed PHY on OTG1_HS, DIR and NXT have alternate pins (PI11, PH4)
+#ifndef BOARD_ULPI_DIR_PORT
+#define BOARD_ULPI_DIR_PORT   GPIOC
+#define BOARD_ULPI_DIR_PIN    GPIO_PIN_2
+#endif
+
+#ifndef BOARD_ULPI_NXT_PORT
+#define BOARD_ULPI_NXT_PORT   GPIOC
+#define BOARD_ULPI_NXT_PIN    GPIO_PIN_3
+#endif
+
+static void ulpi_pin_init(GPIO_TypeDef* port, uint32_t pins)
+{
+  GPIO_InitTypeDef GPIO_InitStruct;
+
+  GPIO_InitStruct.Pin = pins;
+  GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+  GPIO_InitStruct.Alternate = GPIO_AF10_OTG1_HS;
+  HAL_GPIO_Init(port, &GPIO_InitStruct);
+}
+#endif
+
 void board_dfu_init(void)
 {
-  // Not quite sure what an RHPORT is :/
+  // RHPORT 0 is the OTG2 full speed core on PA11/PA12, RHPORT 1 the OTG1_HS core with ULPI PHY
 #if BOARD_TUD_RHPORT == 0
   GPIO_InitTypeDef GPIO_InitStruct;
 
@@ -82,11 +127,46 @@ void board_dfu_init(void)
   USB_OTG_FS->GOTGCTL |= USB_OTG_GOTGCTL_BVALOVAL;
 
 #elif BOARD_TUD_RHPORT == 1
-  // TODO: implement whatever this is
-  #error "Sorry, not implemented yet"
+  // PA5- CK, PA3- D0, PB0- D1, PB1- D2, PB10- D3, PB11- D4, PB12- D5, PB13- D6, PB5- D7, PC0- STP
+  ulpi_pin_init(GPIOA, GPIO_PIN_3 | GPIO_PIN_5);
+  ulpi_pin_init(GPIOB, GPIO_PIN_0 | GPIO_PIN_1 | GPIO_PIN_5 | GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12 | GPIO_PIN_13);
+  ulpi_pin_init(GPIOC, GPIO_PIN_0);
+  ulpi_pin_init(BOARD_ULPI_DIR_PORT, BOARD_ULPI_DIR_PIN);
+  ulpi_pin_init(BOARD_ULPI_NXT_PORT, BOARD_ULPI_NXT_PIN);
+
+  // Core and the 60 MHz ULPI clock driven by the PHY
+  HAL_PWREx_EnableUSBVoltageDetector();
+  __HAL_RCC_USB1_OTG_HS_CLK_ENABLE();
+  __HAL_RCC_USB1_OTG_HS_ULPI_CLK_ENABLE();
+
+  // VBUS is watched by the PHY, the internal sensing only belongs to the embedded FS PHY
+  USB_OTG_HS->GCCFG &= ~USB_OTG_GCCFG_VBDEN;
+  USB_OTG_HS->GOTGCTL |= USB_OTG_GOTGCTL_BVALOEN;
+  USB_OTG_HS->GOTGCTL |= USB_OTG_GOTGCTL_BVALOVAL;
 #endif
 
+#if CFG_TUD_DWC2_DMA_ENABLE
+  // D2 SRAM1 holding .usb_ram is not clocked out of reset, nor cleared by the startup code
+  __HAL_RCC_D2SRAM1_CLK_ENABLE();
+  memset(_susb_ram, 0, (size_t) (_eusb_ram - _susb_ram));
+#endif
+}
+
+#ifdef BOARD_CLOCK_BOOST
+void board_dfu_clock_boost(void)
+{
+  clock_boost(true);
+  SystemCoreClockUpdate();
+  SysTick_Config( (SystemCoreClock/1000) );
+}
+
+void board_clock_restore(void)
+{
+  clock_boost(false);
+  SystemCoreClockUpdate();
+  SysTick_Config( (SystemCoreClock/1000) );
 }
+#endif
 
 void board_reset(void)
 {
@@ -97,11 +177,28 @@ void board_reset(void)
 
 void board_dfu_complete(void)
 {
+  if (board_clock_restore) board_clock_restore();
+
   // Clean Cache
   SCB_CleanDCache();
   NVIC_SystemReset();
 }
 
+#if TINYUF2_RAM_APP
+#if !BOARD_AXISRAM_EN
+#error "TINYUF2_RAM_APP requires BOARD_AXISRAM_EN"
+#endif
+
+void board_ram_app_start(uint32_t addr)
+{
+  // AXISRAM is retained across reset, boot address selects it for board_app_valid()/board_app_jump()
+  SET_BOOT_ADDR(addr);
+  if (board_clock_restore) board_clock_restore();
+  SCB_CleanDCache();
+  NVIC_SystemReset();
+}
+#endif
+
 bool board_app_valid(void)
 {
   uint32_t app_addr = board_get_app_start_address();
@@ -215,6 +312,58 @@ void board_timer_stop(void)
   SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
 }
 
+#if TINYUF2_IDLE_SLEEP && !defined(BUILD_NO_TINYUSB)
+void board_idle(void)
+{
+  // with PRIMASK set, an interrupt arriving after the check still ends WFI
+  __disable_irq();
+  if ( !tud_task_event_ready() ) __WFI();
+  __enable_irq();
+}
+#endif
+
+#if CFG_TUD_MEM_DCACHE_ENABLE && !defined(BUILD_NO_TINYUSB)
+// Cache maintenance of DMA transfer buffers for dcd_dwc2, buffers are cache line aligned and sized
+bool dcd_dcache_clean(void const* addr, uint32_t data_size)
+{
+  SCB_CleanDCache_by_Addr((uint32_t*) (uintptr_t) addr, (int32_t) data_size);
+  return true;
+}
+
+bool dcd_dcache_invalidate(void const* addr, uint32_t data_size)
+{
+  SCB_InvalidateDCache_by_Addr((uint32_t*) (uintptr_t) addr, (int32_t) data_size);
+  return true;
+}
+
+bool dcd_dcache_clean_invalidate(void const* addr, uint32_t data_size)
+{
+  SCB_CleanInvalidateDCache_by_Addr((uint32_t*) (uintptr_t) addr, (int32_t) data_size);
+  return true;
+}
+#endif
+
+#if TINYUF2_STATS || TINYUF2_BOOT_TRACE || TINYUF2_EVENT_LOG
+uint32_t board_cycle_count(void)
+{
+  // enable DWT cycle counter on first use, Cortex-M7 requires unlocking DWT access first
+  if ( !(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) )
+  {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+
+  return DWT->CYCCNT;
+}
+
+uint32_t board_cycle_freq(void)
+{
+  return SystemCoreClock;
+}
+#endif
+
 int board_uart_write(void const * buf, int len)
 {
   (void) buf;
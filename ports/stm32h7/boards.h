@@ -61,7 +61,9 @@
 
 #define SPI_FLASH_SIZE    8*1024*1024 // 8Mbytes
 #define QSPI_FLASH_SIZE   8*1024*1024 // 8Mbytes
-#define PFLASH_SIZE       128*1024 // 128Kbytes
+#ifndef PFLASH_SIZE
+#define PFLASH_SIZE       (128*1024) // 128Kbytes
+#endif
 #define AXISRAM_SIZE      256*1024 // 512Kbytes
 
 #define SPI_FLASH_OFFS  0U
@@ -71,11 +73,46 @@
 
 #define IS_SPI_ADDR(x)      (((x) >= SPI_BASE_ADDR) && ((x) < (SPI_BASE_ADDR + SPI_FLASH_SIZE)))
 #define IS_QSPI_ADDR(x)     (((x) >= QSPI_BASE_ADDR) && ((x) < (QSPI_BASE_ADDR + QSPI_FLASH_SIZE)))
-#define IS_PFLASH_ADDR(x)   (((x) >= (PFLASH_BASE_ADDR + PFLASH_SIZE/2)) && ((x) < (PFLASH_BASE_ADDR + PFLASH_SIZE)))
+#define IS_PFLASH_ADDR(x)   (((x) >= (PFLASH_BASE_ADDR + PFLASH_OFFS)) && ((x) < (PFLASH_BASE_ADDR + PFLASH_SIZE)))
 #define IS_AXISRAM_ADDR(x)  (((x) >= (AXISRAM_BASE_ADDR + AXISRAM_OFFS)) && ((x) < (AXISRAM_BASE_ADDR + AXISRAM_SIZE)))
 
 #define SET_BOOT_ADDR(x) board_save_app_start_address(x)
 
+// QSPI handoff: before jumping to an application the bootloader leaves the QSPI flash memory-mapped
+// in the fastest read mode that read back correctly, with the window cacheable in the MPU, and
+// describes it here (no-init DTCM after the boot address words, see linker/common.ld). An app
+// finding the magic can execute in place without re-probing the flash. Clocks are reset to HSI
+// by the jump: the app must keep the QSPI clock at or below clock_hz when raising HCLK3.
+#define BOARD_QSPI_HANDOFF_MAGIC    0x51535049U // "QSPI"
+#define BOARD_QSPI_HANDOFF_VERSION  1
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t base;          // memory-mapped window, QSPI_BASE_ADDR
+  uint32_t size;          // flash size
+  uint32_t clock_hz;      // QSPI clock the read mode was validated at
+  uint8_t  qpi;           // 1: flash in QPI mode (instruction on 4 lines)
+  uint8_t  dtr;           // 1: double transfer rate read
+  uint8_t  read_opcode;   // memory-mapped read instruction
+  uint8_t  dummy_cycles;
+  uint8_t  prescaler;     // QUADSPI_CR PRESCALER
+  uint8_t  mpu_region;    // MPU region configured for the window
+  uint8_t  reserved[2];
+} board_qspi_handoff_t;
+
+// Images linked for AXISRAM are run without flashing (TINYUF2_RAM_APP), requires BOARD_AXISRAM_EN
+#define BOARD_RAM_APP_ADDR  BOARD_AXISRAM_APP_ADDR
+#define BOARD_RAM_APP_SIZE  (AXISRAM_SIZE - AXISRAM_OFFS)
+
+// Hot path runs from ITCM, placed by linker/common.ld and copied by board_init()
+#define TUF2_HOT  __attribute__((section(".hotfunc")))
+
+// Display columns are expanded by DMA2D (board_display_expand), which cannot reach DTCM holding .bss:
+// screen.c buffers go to D2 SRAM1 with the USB transfer buffers (.usb_ram, see linker/common.ld)
+#define TUF2_DISPLAY_RAM  __attribute__((section(".usb_ram.display"), aligned(32)))
+
 // Double Reset tap to enter DFU
 #define TINYUF2_DBL_TAP_DFU  1
 
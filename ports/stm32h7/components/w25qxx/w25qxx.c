@@ -35,31 +35,36 @@ static void	W25Qx_Reset(void)
 }
 
 /**
-  * @brief  Reads current status of the W25QXXXX.
+  * @brief  Wait until the W25QXXXX is no longer busy. Status register 1 is output continuously
+  *         while chip select stays low: polled back to back with a single command.
+  * @param  Timeout: maximum wait time in ms
   * @retval W25QXXXX memory status
   */
-static uint8_t W25Qx_GetStatus(void)
+static uint8_t W25Qx_WaitReady(uint32_t Timeout)
 {
   uint8_t cmd[] = {READ_STATUS_REG1_CMD};
   uint8_t status;
+  uint8_t result = W25Qx_OK;
+  uint32_t tickstart = W25Qx_GetTick();
 
   SPI_FLASH_EN();
-
   /* Send the read status command */
   W25Qx_SPI_Transmit(cmd, 1, W25QXXXX_TIMEOUT_VALUE);
-  /* Reception of the data */
-  W25Qx_SPI_Receive(&status, 1, W25QXXXX_TIMEOUT_VALUE);
+  do
+  {
+    /* Reception of the data */
+    W25Qx_SPI_Receive(&status, 1, W25QXXXX_TIMEOUT_VALUE);
+
+    /* Check for the Timeout */
+    if((status & W25QXXXX_FSR_BUSY) && (W25Qx_GetTick() - tickstart) > Timeout)
+    {
+      result = W25Qx_TIMEOUT;
+      break;
+    }
+  } while(status & W25QXXXX_FSR_BUSY);
   SPI_FLASH_DIS();
 
-  /* Check the value of the register */
-  if((status & W25QXXXX_FSR_BUSY) != 0)
-  {
-    return W25Qx_BUSY;
-  }
-  else
-  {
-    return W25Qx_OK;
-  }
+  return result;
 }
 
 /**
@@ -69,7 +74,6 @@ static uint8_t W25Qx_GetStatus(void)
 uint8_t W25Qx_WriteEnable(void)
 {
   uint8_t cmd[] = {WRITE_ENABLE_CMD};
-  uint32_t tickstart = W25Qx_GetTick();
 
   /*Select the FLASH: Chip Select low */
   SPI_FLASH_EN();
@@ -79,17 +83,7 @@ uint8_t W25Qx_WriteEnable(void)
   SPI_FLASH_DIS();
 
   /* Wait the end of Flash writing */
-  while(W25Qx_GetStatus() == W25Qx_BUSY)
-  {
-    /* Check for the Timeout */
-    if((W25Qx_GetTick() - tickstart) > W25QXXXX_TIMEOUT_VALUE)
-    {
-      return W25Qx_TIMEOUT;
-    }
-    W25Qx_Delay(1);
-  }
-
-  return W25Qx_OK;
+  return W25Qx_WaitReady(W25QXXXX_TIMEOUT_VALUE);
 }
 
 /**
@@ -188,7 +182,6 @@ uint8_t W25Qx_WriteNoCheck(uint8_t* pData, uint32_t WriteAddr, uint32_t Size)
 {
   uint8_t cmd[4];
   uint32_t end_addr, current_size, current_addr;
-  uint32_t tickstart = W25Qx_GetTick();
 
   /* Calculation of the size between the write address and the end of the page */
   current_addr = 0;
@@ -234,15 +227,10 @@ uint8_t W25Qx_WriteNoCheck(uint8_t* pData, uint32_t WriteAddr, uint32_t Size)
       return W25Qx_ERROR;
     }
     SPI_FLASH_DIS();
-      /* Wait the end of Flash writing */
-    while(W25Qx_GetStatus() == W25Qx_BUSY)
+    /* Wait the end of Flash writing */
+    if (W25Qx_WaitReady(W25QXXXX_TIMEOUT_VALUE) != W25Qx_OK)
     {
-      /* Check for the Timeout */
-      if((W25Qx_GetTick() - tickstart) > W25QXXXX_TIMEOUT_VALUE)
-      {
-        return W25Qx_TIMEOUT;
-      }
-      //delay(1);
+      return W25Qx_TIMEOUT;
     }
 
     /* Update the address and size variables for next page programming */
@@ -255,6 +243,112 @@ uint8_t W25Qx_WriteNoCheck(uint8_t* pData, uint32_t WriteAddr, uint32_t Size)
   return W25Qx_OK;
 }
 
+/**
+  * @brief  Start programming a page without waiting for completion, poll with W25Qx_IsBusy().
+  *         Memory must not be busy.
+  * @param  pData: Pointer to data to be written
+  * @param  WriteAddr: Write start address
+  * @param  Size: Size of data to write, must not cross a page boundary
+  * @retval SPI memory status
+  */
+uint8_t W25Qx_PageProgramStart(uint8_t* pData, uint32_t WriteAddr, uint32_t Size)
+{
+  uint8_t cmd[4] = {PAGE_PROG_CMD, (uint8_t)(WriteAddr >> 16), (uint8_t)(WriteAddr >> 8), (uint8_t)(WriteAddr)};
+  uint8_t result = W25Qx_OK;
+
+  /* Enable write operations */
+  W25Qx_WriteEnable();
+
+  SPI_FLASH_EN();
+  if (W25Qx_SPI_Transmit(cmd, 4, W25QXXXX_TIMEOUT_VALUE) != 0U ||
+      W25Qx_SPI_Transmit(pData, (uint16_t) Size, W25QXXXX_TIMEOUT_VALUE) != 0U)
+  {
+    result = W25Qx_ERROR;
+  }
+  SPI_FLASH_DIS();
+
+  return result;
+}
+
+/**
+  * @brief  Start erasing a 4KB sector without waiting for completion, poll with W25Qx_IsBusy().
+  * @param  Address: Sector address to erase
+  * @retval SPI memory status
+  */
+uint8_t W25Qx_EraseStart(uint32_t Address)
+{
+  uint8_t cmd[4] = {SECTOR_ERASE_CMD, (uint8_t)(Address >> 16), (uint8_t)(Address >> 8), (uint8_t)(Address)};
+  uint8_t result = W25Qx_OK;
+
+  /* Enable write operations */
+  W25Qx_WriteEnable();
+
+  SPI_FLASH_EN();
+  if (W25Qx_SPI_Transmit(cmd, 4, W25QXXXX_TIMEOUT_VALUE) != 0U) result = W25Qx_ERROR;
+  SPI_FLASH_DIS();
+
+  return result;
+}
+
+/**
+  * @brief  Read status register once.
+  * @retval non zero while a program or erase is in progress
+  */
+uint8_t W25Qx_IsBusy(void)
+{
+  uint8_t cmd[] = {READ_STATUS_REG1_CMD};
+  uint8_t status = 0;
+
+  SPI_FLASH_EN();
+  W25Qx_SPI_Transmit(cmd, 1, W25QXXXX_TIMEOUT_VALUE);
+  W25Qx_SPI_Receive(&status, 1, W25QXXXX_TIMEOUT_VALUE);
+  SPI_FLASH_DIS();
+
+  return status & W25QXXXX_FSR_BUSY;
+}
+
+/**
+  * @brief  Suspend the sector erase in progress, flash can then be read except for the sector
+  *         being erased. Ignored by the device when no erase is running.
+  * @retval non zero if an erase is suspended
+  */
+uint8_t W25Qx_EraseSuspend(void)
+{
+  uint8_t cmd[] = {PROG_ERASE_SUSPEND_CMD};
+  uint8_t status = 0;
+
+  SPI_FLASH_EN();
+  W25Qx_SPI_Transmit(cmd, 1, W25QXXXX_TIMEOUT_VALUE);
+  SPI_FLASH_DIS();
+
+  /* device is ready within tSUS (20us) */
+  if (W25Qx_WaitReady(W25QXXXX_TIMEOUT_VALUE) != W25Qx_OK) return 0;
+
+  cmd[0] = READ_STATUS_REG2_CMD;
+  SPI_FLASH_EN();
+  W25Qx_SPI_Transmit(cmd, 1, W25QXXXX_TIMEOUT_VALUE);
+  W25Qx_SPI_Receive(&status, 1, W25QXXXX_TIMEOUT_VALUE);
+  SPI_FLASH_DIS();
+
+  return status & W25QXXXX_FSR_SUS;
+}
+
+/**
+  * @brief  Resume a suspended erase, poll with W25Qx_IsBusy().
+  * @retval SPI memory status
+  */
+uint8_t W25Qx_EraseResume(void)
+{
+  uint8_t cmd[] = {PROG_ERASE_RESUME_CMD};
+  uint8_t result = W25Qx_OK;
+
+  SPI_FLASH_EN();
+  if (W25Qx_SPI_Transmit(cmd, 1, W25QXXXX_TIMEOUT_VALUE) != 0U) result = W25Qx_ERROR;
+  SPI_FLASH_DIS();
+
+  return result;
+}
+
 /**
   * @brief  Erases and Writes an amount of data to the SPI memory.
   * @param  pData: Pointer to data to be written
@@ -327,7 +421,6 @@ uint8_t W25Qx_Write(uint8_t* pData, uint32_t WriteAddr, uint32_t Size)
 uint8_t W25Qx_Erase_Block(uint32_t Address)
 {
   uint8_t cmd[4];
-  uint32_t tickstart = W25Qx_GetTick();
   cmd[0] = SECTOR_ERASE_CMD;
   cmd[1] = (uint8_t)(Address >> 16);
   cmd[2] = (uint8_t)(Address >> 8);
@@ -344,16 +437,7 @@ uint8_t W25Qx_Erase_Block(uint32_t Address)
   SPI_FLASH_DIS();
 
   /* Wait the end of Flash writing */
-  while(W25Qx_GetStatus() == W25Qx_BUSY)
-  {
-    /* Check for the Timeout */
-    if((W25Qx_GetTick() - tickstart) > W25QXXXX_SECTOR_ERASE_MAX_TIME)
-    {
-      return W25Qx_TIMEOUT;
-    }
-    //delay(1);
-  }
-  return W25Qx_OK;
+  return W25Qx_WaitReady(W25QXXXX_SECTOR_ERASE_MAX_TIME);
 }
 
 /**
@@ -363,7 +447,6 @@ uint8_t W25Qx_Erase_Block(uint32_t Address)
 uint8_t W25Qx_Erase_Chip(void)
 {
   uint8_t cmd[4];
-  uint32_t tickstart = W25Qx_GetTick();
   cmd[0] = CHIP_ERASE_CMD;
 
   /* Enable write operations */
@@ -377,14 +460,5 @@ uint8_t W25Qx_Erase_Chip(void)
   SPI_FLASH_DIS();
 
   /* Wait the end of Flash writing */
-  while(W25Qx_GetStatus() == W25Qx_BUSY)
-  {
-    /* Check for the Timeout */
-    if((W25Qx_GetTick() - tickstart) > W25QXXXX_BULK_ERASE_MAX_TIME)
-    {
-      return W25Qx_TIMEOUT;
-    }
-    //delay(1);
-  }
-  return W25Qx_OK;
+  return W25Qx_WaitReady(W25QXXXX_BULK_ERASE_MAX_TIME);
 }
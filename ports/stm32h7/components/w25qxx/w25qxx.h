@@ -82,6 +82,7 @@
 #define W25QXXXX_FSR_BUSY                    ((uint8_t)0x01)    /*!< busy */
 #define W25QXXXX_FSR_WREN                    ((uint8_t)0x02)    /*!< write enable */
 #define W25QXXXX_FSR_QE                      ((uint8_t)0x02)    /*!< quad enable */
+#define W25QXXXX_FSR_SUS                     ((uint8_t)0x80)    /*!< erase/program suspended (status register 2) */
 
 #define W25Qx_OK            ((uint8_t)0x00)
 #define W25Qx_ERROR         ((uint8_t)0x01)
@@ -112,6 +113,11 @@ uint8_t   W25Qx_Read(uint8_t* pData, uint32_t ReadAddr, uint32_t Size);
 uint8_t   W25Qx_WriteNoCheck(uint8_t* pData, uint32_t WriteAddr, uint32_t Size);
 uint8_t   W25Qx_Write(uint8_t* pData, uint32_t WriteAddr, uint32_t Size);
 uint8_t   W25Qx_Erase_Block(uint32_t Address);
+uint8_t   W25Qx_PageProgramStart(uint8_t* pData, uint32_t WriteAddr, uint32_t Size);
+uint8_t   W25Qx_EraseStart(uint32_t Address);
+uint8_t   W25Qx_IsBusy(void);
+uint8_t   W25Qx_EraseSuspend(void);
+uint8_t   W25Qx_EraseResume(void);
 uint8_t   W25Qx_Erase_Chip(void);
 uint8_t   W25Qx_Get_Parameter(W25Qx_Parameter *Para);
 
@@ -134,45 +134,91 @@ uint8_t W25qxx_WriteEnable(void)
   */
 uint8_t W25qxx_EraseSector(uint32_t SectorAddress)
 {
-  uint8_t result;
+  return W25qxx_Erase(W25X_SectorErase, SectorAddress, W25X_BLOCK_ERASE_MAX_TIME);
+}
 
-  W25qxx_WriteEnable();
-  W25QXX_Wait_Busy();
+/**
+  * @brief  Erase 64KB Sector of the OSPI memory.
+  * @param  SectorAddress: Sector address to erase
+  * @retval QSPI memory status
+  */
+uint8_t W25qxx_EraseBlock(uint32_t BlockAddress)
+{
+  return W25qxx_Erase(W25X_BlockErase, BlockAddress, W25X_BLOCK_ERASE_MAX_TIME);
+}
 
-  if(w25qxx_Mode == w25qxx_SPIMode)
-    result = QSPI_Send_CMD(&_qspi_flash,W25X_SectorErase,SectorAddress,QSPI_ADDRESS_24_BITS,0,QSPI_INSTRUCTION_1_LINE,QSPI_ADDRESS_1_LINE,QSPI_DATA_NONE,0);
-  else
-    result = QSPI_Send_CMD(&_qspi_flash,W25X_SectorErase,SectorAddress,QSPI_ADDRESS_24_BITS,0,QSPI_INSTRUCTION_4_LINES,QSPI_ADDRESS_4_LINES,QSPI_DATA_NONE,0);
+/**
+  * @brief  Erase with given erase instruction (e.g from SFDP erase types).
+  * @param  Opcode: erase instruction
+  * @param  Address: address of the erase unit
+  * @param  Timeout: max erase time in ms
+  * @retval QSPI memory status
+  */
+uint8_t W25qxx_Erase(uint8_t Opcode, uint32_t Address, uint32_t Timeout)
+{
+  uint8_t result = W25qxx_EraseStart(Opcode, Address);
 
-  /* 等待擦除完成 */
+  /* wait for erase completion with QSPI automatic polling */
   if(result == w25qxx_OK)
-    W25QXX_Wait_Busy();
+    result = QSPI_AutoPollingMemReady(&_qspi_flash, Timeout);
 
   return result;
 }
 
 /**
-  * @brief  Erase 64KB Sector of the OSPI memory.
-  * @param  SectorAddress: Sector address to erase
+  * @brief  Start an erase without waiting for completion, poll with W25qxx_IsBusy().
+  * @param  Opcode: erase instruction
+  * @param  Address: address of the erase unit
   * @retval QSPI memory status
   */
-uint8_t W25qxx_EraseBlock(uint32_t BlockAddress)
+uint8_t W25qxx_EraseStart(uint8_t Opcode, uint32_t Address)
 {
-  uint8_t result;
-
   W25qxx_WriteEnable();
-  W25QXX_Wait_Busy();
 
   if(w25qxx_Mode == w25qxx_SPIMode)
-    result = QSPI_Send_CMD(&_qspi_flash,W25X_BlockErase,BlockAddress,QSPI_ADDRESS_24_BITS,0,QSPI_INSTRUCTION_1_LINE,QSPI_ADDRESS_1_LINE,QSPI_DATA_NONE,0);
+    return QSPI_Send_CMD(&_qspi_flash,Opcode,Address,QSPI_ADDRESS_24_BITS,0,QSPI_INSTRUCTION_1_LINE,QSPI_ADDRESS_1_LINE,QSPI_DATA_NONE,0);
   else
-    result = QSPI_Send_CMD(&_qspi_flash,W25X_BlockErase,BlockAddress,QSPI_ADDRESS_24_BITS,0,QSPI_INSTRUCTION_4_LINES,QSPI_ADDRESS_4_LINES,QSPI_DATA_NONE,0);
+    return QSPI_Send_CMD(&_qspi_flash,Opcode,Address,QSPI_ADDRESS_24_BITS,0,QSPI_INSTRUCTION_4_LINES,QSPI_ADDRESS_4_LINES,QSPI_DATA_NONE,0);
+}
 
-  /* 等待擦除完成 */
-  if(result == w25qxx_OK)
-    W25QXX_Wait_Busy();
+/**
+  * @brief  Read status register 1 once.
+  * @retval non zero while a program or erase is in progress
+  */
+uint8_t W25qxx_IsBusy(void)
+{
+  return w25qxx_ReadSR(W25X_ReadStatusReg1) & W25X_SR_WIP;
+}
 
-  return result;
+/**
+  * @brief  Suspend the sector or block erase in progress (not chip erase), flash can then be read
+  *         except for the sector being erased. Ignored by the device when no erase is running.
+  * @retval non zero if an erase is suspended
+  */
+uint8_t W25qxx_EraseSuspend(void)
+{
+  if(w25qxx_Mode == w25qxx_SPIMode)
+    QSPI_Send_CMD(&_qspi_flash,W25X_EraseSuspend,0x00,QSPI_ADDRESS_8_BITS,0,QSPI_INSTRUCTION_1_LINE,QSPI_ADDRESS_NONE,QSPI_DATA_NONE,0);
+  else
+    QSPI_Send_CMD(&_qspi_flash,W25X_EraseSuspend,0x00,QSPI_ADDRESS_8_BITS,0,QSPI_INSTRUCTION_4_LINES,QSPI_ADDRESS_NONE,QSPI_DATA_NONE,0);
+
+  /* device is ready within tSUS (20us) */
+  if(QSPI_AutoPollingMemReady(&_qspi_flash, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != w25qxx_OK)
+    return 0;
+
+  return w25qxx_ReadSR(W25X_ReadStatusReg2) & W25X_SR2_SUS;
+}
+
+/**
+  * @brief  Resume a suspended erase, poll with W25qxx_IsBusy().
+  * @retval QSPI memory status
+  */
+uint8_t W25qxx_EraseResume(void)
+{
+  if(w25qxx_Mode == w25qxx_SPIMode)
+    return QSPI_Send_CMD(&_qspi_flash,W25X_EraseResume,0x00,QSPI_ADDRESS_8_BITS,0,QSPI_INSTRUCTION_1_LINE,QSPI_ADDRESS_NONE,QSPI_DATA_NONE,0);
+  else
+    return QSPI_Send_CMD(&_qspi_flash,W25X_EraseResume,0x00,QSPI_ADDRESS_8_BITS,0,QSPI_INSTRUCTION_4_LINES,QSPI_ADDRESS_NONE,QSPI_DATA_NONE,0);
 }
 
 /**
@@ -207,6 +253,24 @@ uint8_t W25qxx_EraseChip(void)
   * @retval QSPI memory status
   */
 uint8_t W25qxx_PageProgram(uint8_t *pData, uint32_t WriteAddr, uint32_t Size)
+{
+  uint8_t result = W25qxx_PageProgramStart(pData, WriteAddr, Size);
+
+  /* wait for program completion with QSPI automatic polling */
+  if(result == w25qxx_OK)
+    result = QSPI_AutoPollingMemReady(&_qspi_flash, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+
+  return result;
+}
+
+/**
+  * @brief  Start programming a page without waiting for completion, poll with W25qxx_IsBusy().
+  * @param  pData Pointer to data to be written
+  * @param  WriteAddr Write start address
+  * @param  Size Size of data to write. Range 1 ~ W25qxx page size
+  * @retval QSPI memory status
+  */
+uint8_t W25qxx_PageProgramStart(uint8_t *pData, uint32_t WriteAddr, uint32_t Size)
 {
   uint8_t result;
 
@@ -220,13 +284,59 @@ uint8_t W25qxx_PageProgram(uint8_t *pData, uint32_t WriteAddr, uint32_t Size)
   if(result == w25qxx_OK)
     result = HAL_QSPI_Transmit(&_qspi_flash,pData,HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
 
-  /* 等待写入完成 */
+  return result;
+}
+
+/**
+  * @brief  Read SFDP parameters (JESD216), only available in SPI mode.
+  * @param  pData: pointer to data to be read
+  * @param  ReadAddr: SFDP address
+  * @param  Size: size of data to read
+  * @retval QSPI memory status
+  */
+uint8_t W25qxx_ReadSFDP(uint8_t *pData, uint32_t ReadAddr, uint32_t Size)
+{
+  uint8_t result;
+
+  if(w25qxx_Mode != w25qxx_SPIMode)
+    return w25qxx_ERROR;
+
+  result = QSPI_Send_CMD(&_qspi_flash,W25X_ReadSFDP,ReadAddr,QSPI_ADDRESS_24_BITS,8,QSPI_INSTRUCTION_1_LINE,QSPI_ADDRESS_1_LINE,QSPI_DATA_1_LINE,Size);
+
   if(result == w25qxx_OK)
-    W25QXX_Wait_Busy();
+    result = HAL_QSPI_Receive(&_qspi_flash,pData,HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
 
   return result;
 }
 
+/**
+  * @brief  Program page aligned data, pages that are all 0xFF are skipped (nothing to program).
+  *         Target must be erased, or only have bits cleared by the new data
+  * @param  pData Pointer to data to be written
+  * @param  WriteAddr Write start address, page aligned
+  * @param  Size Size of data to write, multiple of W25qxx page size
+  * @retval QSPI memory status
+  */
+uint8_t W25qxx_ProgramPages(uint8_t *pData, uint32_t WriteAddr, uint32_t Size)
+{
+  for (uint32_t offset = 0; offset < Size; offset += W25X_PAGE_SIZE)
+  {
+    uint32_t const* word = (uint32_t const*) (pData + offset);
+    uint32_t i;
+
+    for (i = 0; i < W25X_PAGE_SIZE / 4; i++)
+    {
+      if (word[i] != 0xFFFFFFFFUL) break;
+    }
+    if (i == W25X_PAGE_SIZE / 4) continue;
+
+    uint8_t const result = W25qxx_PageProgram(pData + offset, WriteAddr + offset, W25X_PAGE_SIZE);
+    if (result != w25qxx_OK) return result;
+  }
+
+  return w25qxx_OK;
+}
+
 //读取SPI FLASH,仅支持QPI模式
 //在指定地址开始读取指定长度的数据
 //pBuffer:数据存储区
@@ -344,7 +454,7 @@ uint8_t W25qxx_Write(uint8_t* pBuffer, uint32_t WriteAddr, uint16_t NumByteToWri
     }
     if (i < secremain) //需要擦除
     {
-      if (W25qxx_EraseSector(secpos) != w25qxx_OK) {
+      if (W25qxx_EraseSector(secpos * 4096) != w25qxx_OK) {
         return w25qxx_ERROR;
       } //擦除这个扇区
       for (i = 0; i < secremain; i++) //复制
@@ -22,6 +22,8 @@ typedef enum
 
 } w25qxx_StatusTypeDef;
 
+extern w25qxx_StatusTypeDef w25qxx_Mode;
+
 /* =============== W25Qxx CMD ================ */
 #define W25X_WriteEnable         0x06
 #define W25X_WriteDisable        0x04
@@ -51,6 +53,9 @@ typedef enum
 
 #define W25X_EnableReset         0x66
 #define W25X_ResetDevice         0x99
+#define W25X_ReadSFDP            0x5A
+#define W25X_EraseSuspend        0x75
+#define W25X_EraseResume         0x7A
 
 #define W25X_QUAD_INOUT_FAST_READ_CMD             0xEB
 #define W25X_QUAD_INOUT_FAST_READ_DTR_CMD         0xED
@@ -63,6 +68,12 @@ typedef enum
 #define W25X_ENTER_4_BYTE_ADDR_MODE_CMD           0xB7
 #define W25X_EXIT_4_BYTE_ADDR_MODE_CMD            0xE9
 
+/* Geometry and timing */
+#define W25X_PAGE_SIZE           256U
+#define W25X_SECTOR_SIZE         4096U
+#define W25X_BLOCK_SIZE          (64U*1024U)
+#define W25X_BLOCK_ERASE_MAX_TIME 2000U   /* ms, 64KB block erase max (datasheet) */
+
 /* Dummy cycles for DTR read mode */
 #define W25X_DUMMY_CYCLES_READ_QUAD_DTR  4U
 #define W25X_DUMMY_CYCLES_READ_QUAD      6U
@@ -75,6 +86,7 @@ typedef enum
 /* Status Register */
 #define W25X_SR_WIP              (0x01)    /*!< Write in progress */
 #define W25X_SR_WREN             (0x02)    /*!< Write enable latch */
+#define W25X_SR2_SUS             (0x80)    /*!< Erase/program suspended (status register 2) */
 
 void      w25qxx_Init(void);
 uint16_t  w25qxx_GetID(void);
@@ -87,9 +99,17 @@ uint8_t   w25qxx_Startup(uint8_t DTRMode);
 uint8_t   W25qxx_WriteEnable(void);
 uint8_t   W25qxx_EraseSector(uint32_t SectorAddress);
 uint8_t   W25qxx_EraseBlock(uint32_t BlockAddress);
+uint8_t   W25qxx_Erase(uint8_t Opcode, uint32_t Address, uint32_t Timeout);
+uint8_t   W25qxx_EraseStart(uint8_t Opcode, uint32_t Address);
+uint8_t   W25qxx_IsBusy(void);
+uint8_t   W25qxx_EraseSuspend(void);
+uint8_t   W25qxx_EraseResume(void);
 uint8_t   W25qxx_EraseChip(void);
 uint8_t   W25qxx_PageProgram(uint8_t *pData, uint32_t WriteAddr, uint32_t Size);
+uint8_t   W25qxx_PageProgramStart(uint8_t *pData, uint32_t WriteAddr, uint32_t Size);
+uint8_t   W25qxx_ProgramPages(uint8_t *pData, uint32_t WriteAddr, uint32_t Size);
 uint8_t   W25qxx_Read(uint8_t *pData, uint32_t ReadAddr, uint32_t Size);
+uint8_t   W25qxx_ReadSFDP(uint8_t *pData, uint32_t ReadAddr, uint32_t Size);
 void      W25qxx_WriteNoCheck(uint8_t *pBuffer,uint32_t WriteAddr,uint32_t NumByteToWrite);
 uint8_t     W25qxx_Write(uint8_t* pBuffer, uint32_t WriteAddr, uint16_t NumByteToWrite);
 
@@ -43,10 +43,21 @@
 // Enable Device stack
 #define CFG_TUD_ENABLED          1
 
+// External ULPI PHY on the OTG_HS core (RHPORT 1) for high speed, set by board.mk
+#ifndef BOARD_USB_ULPI
+#define BOARD_USB_ULPI           0
+#endif
+
 #ifndef BOARD_TUD_RHPORT
-#define BOARD_TUD_RHPORT         0
+#define BOARD_TUD_RHPORT         (BOARD_USB_ULPI ? 1 : 0)
+#endif
+
+#if BOARD_USB_ULPI && BOARD_TUD_RHPORT != 1
+#error "ULPI PHY is only wired to the OTG_HS core, BOARD_TUD_RHPORT must be 1"
 #endif
 
+#define CFG_TUD_MAX_SPEED        (BOARD_USB_ULPI ? OPT_MODE_HIGH_SPEED : OPT_MODE_FULL_SPEED)
+
 // can be defined by compiler in DEBUG build
 #ifndef CFG_TUSB_DEBUG
 #define CFG_TUSB_DEBUG           0
@@ -59,13 +70,33 @@
  * - CFG_TUSB_MEM SECTION : __attribute__ (( section(".usb_ram") ))
  * - CFG_TUSB_MEM_ALIGN   : __attribute__ ((aligned(4)))
  */
+// Buffer DMA of the DWC2 core moves endpoint data instead of the CPU copying every packet through
+// the FIFOs. DTCM holding .bss is not reachable by the OTG masters, transfer buffers go to D2 SRAM1
+// (.usb_ram, see linker/common.ld) aligned and cache maintained per cache line
+#ifndef CFG_TUD_DWC2_DMA_ENABLE
+#define CFG_TUD_DWC2_DMA_ENABLE     1
+#endif
+
+#if CFG_TUD_DWC2_DMA_ENABLE
+#define CFG_TUD_MEM_DCACHE_ENABLE     1
+#define CFG_TUD_MEM_DCACHE_LINE_SIZE  32
+#endif
+
 #ifndef CFG_TUSB_MEM_SECTION
+#if CFG_TUD_DWC2_DMA_ENABLE
+#define CFG_TUSB_MEM_SECTION        __attribute__ ((section(".usb_ram")))
+#else
 #define CFG_TUSB_MEM_SECTION
 #endif
+#endif
 
 #ifndef CFG_TUSB_MEM_ALIGN
+#if CFG_TUD_DWC2_DMA_ENABLE
+#define CFG_TUSB_MEM_ALIGN          __attribute__ ((aligned(32)))
+#else
 #define CFG_TUSB_MEM_ALIGN          __attribute__ ((aligned(4)))
 #endif
+#endif
 
 //--------------------------------------------------------------------
 // DEVICE CONFIGURATION
@@ -76,14 +107,24 @@
 #endif
 
 //------------- CLASS -------------//
+#ifndef CFG_TUD_CDC
 #define CFG_TUD_CDC              0
+#endif
 #define CFG_TUD_MSC              1
 #define CFG_TUD_HID              0
 #define CFG_TUD_MIDI             0
+#ifndef CFG_TUD_VENDOR
 #define CFG_TUD_VENDOR           0
+#endif
+#ifndef CFG_TUD_DFU
+#define CFG_TUD_DFU              0
+#endif
 
-// MSC Buffer size of Device Mass storage
-#define CFG_TUD_MSC_BUFSIZE      4096
+// MSC Buffer size of Device Mass storage, larger on high speed to keep more of each WRITE10 in one transfer
+#define CFG_TUD_MSC_BUFSIZE      (TUD_OPT_HIGH_SPEED ? 16384 : 4096)
+
+// DFU transfer size (wTransferSize), one flash erase unit
+#define CFG_TUD_DFU_XFER_BUFSIZE 4096
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_BUFSIZE      64
@@ -93,6 +134,10 @@
 #define CFG_TUD_VENDOR_RX_BUFSIZE 64
 #define CFG_TUD_VENDOR_TX_BUFSIZE 64
 
+// CDC FIFO size of TX and RX
+#define CFG_TUD_CDC_RX_BUFSIZE   256
+#define CFG_TUD_CDC_TX_BUFSIZE   256
+
 #ifdef __cplusplus
  }
 #endif
@@ -23,6 +23,8 @@
  */
 
 #include "board_api.h"
+#include "flash_geometry.h"
+#include "uf2.h"
 
 #ifndef BUILD_NO_TINYUSB
 #include "tusb.h"
@@ -39,112 +41,507 @@ enum
   SECTOR_COUNT = 2048/4
 };
 
+// Dual bank (L4+ with DBANK, 4KB pages): page number is relative to its bank, bank 2 starts halfway
+#ifdef FLASH_BANK_2
+  #define FLASH_BANK_PAGES  (BOARD_FLASH_SIZE / 2 / BOARD_PAGE_SIZE)
+#endif
+
+// Staged update (TINYUF2_STAGED_UPDATE) is applied by booting the other bank (BFB2)
+#if TINYUF2_STAGED_UPDATE && defined(FLASH_BANK_2)
+  #define FLASH_BANK_SWAP   1
+#else
+  #define FLASH_BANK_SWAP   0
+#endif
+
+// Background erase of bank 2 pages, payloads are programmed directly only without cache
+#if TINYUF2_FLASH_BG_ERASE && defined(FLASH_BANK_2) && !TINYUF2_FLASH_CACHE
+  #define FLASH_BG_ERASE    1
+#else
+  #define FLASH_BG_ERASE    0
+#endif
+
+static flash_region_t const _flash_regions[] =
+{
+  { BOARD_PAGE_SIZE, SECTOR_COUNT },
+};
+
+static flash_geometry_t const _flash_geo = FLASH_GEOMETRY(FLASH_BASE_ADDR, _flash_regions);
+
 static uint8_t erased_sectors[SECTOR_COUNT] = { 0 };
 
+#if TINYUF2_FLASH_CACHE
+// cache one page (erase unit) in RAM, then program on flush only if contents differ
+#define FLASH_CACHE_SIZE          BOARD_PAGE_SIZE
+#define FLASH_CACHE_INVALID_ADDR  0xffffffff
+
+static uint32_t _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+static uint8_t  _flash_cache[FLASH_CACHE_SIZE] __attribute__((aligned(8)));
+#endif
+
 //--------------------------------------------------------------------+
 // Internal Helper
 //--------------------------------------------------------------------+
 
-static inline uint32_t flash_sector_size(uint32_t sector)
+static inline bool is_blank(uint32_t addr, uint32_t size)
 {
-  (void) sector;
-  return BOARD_PAGE_SIZE;
+  return flash_is_blank(addr, size);
 }
 
-static bool is_blank(uint32_t addr, uint32_t size)
+// Wait for the operation at addr up to its deadline (TINYUF2_FLASH_TIMEOUT), waited for again after
+// a backoff when overrun, HAL_TIMEOUT once TINYUF2_FLASH_RETRIES are exhausted
+static HAL_StatusTypeDef flash_wait(uint32_t deadline_ms, uint32_t addr)
 {
-  for ( uint32_t i = 0; i < size; i += sizeof(uint32_t) )
+  HAL_StatusTypeDef status = FLASH_WaitForLastOperation(deadline_ms);
+  for ( uint32_t attempt = 1; status == HAL_TIMEOUT; attempt++ )
   {
-    if ( *(uint32_t*) (addr + i) != 0xffffffff )
-    {
-      return false;
-    }
+    bool const failed = attempt > TINYUF2_FLASH_RETRIES;
+    uf2_flash_timeout(addr, failed);
+    if ( failed ) break;
+    HAL_Delay(uf2_flash_backoff_ms(attempt));
+    status = FLASH_WaitForLastOperation(deadline_ms);
   }
-  return true;
+  return status;
 }
 
-static bool flash_erase(uint32_t addr)
+#ifdef FLASH_BANK_2
+// Physical bank of a page for erase: once booted from bank 2 (FB_MODE) it is mapped at FLASH_BASE_ADDR
+// and bank 1 is the upper half
+static inline uint32_t flash_bank_of(uint32_t page)
+{
+  bool const upper = page >= FLASH_BANK_PAGES;
+  bool const swapped = READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE) != 0;
+  return (upper != swapped) ? FLASH_BANK_2 : FLASH_BANK_1;
+}
+#endif
+
+#if TINYUF2_FLASH_VERIFY_CRC
+// Consecutive writes within a page form a run verified once: source words are fed to the CRC unit
+// as they are programmed and its running value is saved every VERIFY_BLOCK_SIZE bytes. When the run
+// ends (page complete, non-consecutive write or flush) flash is fed through the unit again, the
+// first saved value that differs locates the bad block.
+#define VERIFY_BLOCK_SIZE   256
+#define VERIFY_BLOCK_COUNT  (BOARD_PAGE_SIZE / VERIFY_BLOCK_SIZE)
+
+static uint32_t _verify_addr;
+static uint32_t _verify_len; // 0: no run
+static uint32_t _verify_crc[VERIFY_BLOCK_COUNT];
+
+static void flash_verify_finish(void)
 {
-  // starting address from 0x08000000
-  uint32_t sector_addr = FLASH_BASE_ADDR;
-  bool erased = false;
+  if ( !_verify_len ) return;
 
-  uint32_t sector = 0;
-  uint32_t size = 0;
+  uint32_t const len = _verify_len;
+  uint32_t const expected = CRC->DR;
+  _verify_len = 0;
 
-  for ( uint32_t i = 0; i < SECTOR_COUNT; i++ )
+  CRC->CR = CRC_CR_RESET;
+  uint32_t const* word = (uint32_t const*) _verify_addr;
+  for ( uint32_t offset = 0; offset < len; )
   {
-    TUF2_ASSERT(sector_addr < FLASH_BASE_ADDR + BOARD_FLASH_SIZE);
+    CRC->DR = word[offset / 4];
+    offset += 4;
 
-    size = flash_sector_size(i);
-    if ( sector_addr + size > addr )
+    if ( (offset % VERIFY_BLOCK_SIZE) == 0 || offset == len )
     {
-      sector = i;
-      erased = erased_sectors[i];
-      erased_sectors[i] = 1;    // don't erase anymore - we will continue writing here!
-      break;
+      uint32_t const crc = (offset == len) ? expected : _verify_crc[offset / VERIFY_BLOCK_SIZE - 1];
+      if ( CRC->DR != crc )
+      {
+        TUF2_LOG1("Failed to write: %08lX\r\n", _verify_addr + (offset - 1) / VERIFY_BLOCK_SIZE * VERIFY_BLOCK_SIZE);
+        return;
+      }
     }
-    sector_addr += size;
   }
+}
+
+// Add programmed words to the run, dst and len are word aligned
+static void flash_verify_add(uint32_t dst, uint8_t const* src, uint32_t len)
+{
+  for ( uint32_t i = 0; i < len; i += 4 )
+  {
+    if ( _verify_len && dst + i != _verify_addr + _verify_len ) flash_verify_finish();
+    if ( !_verify_len )
+    {
+      _verify_addr = dst + i;
+      CRC->CR = CRC_CR_RESET;
+    }
+
+    uint32_t word;
+    memcpy(&word, src + i, 4);
+    CRC->DR = word;
+    _verify_len += 4;
+    if ( (_verify_len % VERIFY_BLOCK_SIZE) == 0 ) _verify_crc[_verify_len / VERIFY_BLOCK_SIZE - 1] = CRC->DR;
+
+    // page complete
+    if ( ((dst + i + 4) & (BOARD_PAGE_SIZE - 1)) == 0 ) flash_verify_finish();
+  }
+}
+#endif
+
+static bool flash_erase(uint32_t addr)
+{
+  flash_sector_t info;
+  TUF2_ASSERT( flash_sector_find(&_flash_geo, addr, &info) );
+  TUF2_ASSERT( info.addr < FLASH_BASE_ADDR + BOARD_FLASH_SIZE );
+
+  uint32_t const sector = info.index;
+  uint32_t const sector_addr = info.addr;
+  uint32_t const size = info.size;
+  bool const erased = erased_sectors[sector];
+  erased_sectors[sector] = 1;    // don't erase anymore - we will continue writing here!
 
   TUF2_ASSERT(sector);
 
   if ( !erased && !is_blank(sector_addr, size) )
   {
     TUF2_LOG1("Erase: %08lX size = %lu KB ... ", sector_addr, size / 1024);
+#if TINYUF2_FLASH_VERIFY_CRC
+    // pending run may be in this page (next session)
+    flash_verify_finish();
+#endif
 
     FLASH_EraseInitTypeDef EraseInit = {};
     EraseInit.TypeErase = TYPEERASE_PAGES;
+#ifdef FLASH_BANK_2
+    EraseInit.Banks = flash_bank_of(sector);
+    EraseInit.Page = sector % FLASH_BANK_PAGES;
+#else
     EraseInit.Banks = FLASH_BANK_1;
     EraseInit.Page = sector;
+#endif
     EraseInit.NbPages = 1;
 
     // erase the sector
     uint32_t SectorError = 0;
-    HAL_FLASHEx_Erase(&EraseInit, &SectorError);
-    FLASH_WaitForLastOperation(HAL_MAX_DELAY);
+    bool const ok = (HAL_FLASHEx_Erase(&EraseInit, &SectorError) == HAL_OK) && (SectorError == 0xFFFFFFFF);
+
+    // HAL reports a failed erase, the page is known blank otherwise and is not read back
+    if ( !ok )
+    {
+      TUF2_LOG1("failed\r\n");
+      return false;
+    }
     TUF2_LOG1("OK\r\n");
-    TUF2_ASSERT( is_blank(sector_addr, size) );
   }
 
   return true;
 }
 
-static void flash_write(uint32_t dst, const uint8_t *src, int len)
+// L4 flash has ECC: each doubleword can only be programmed once after erase. A payload starting or
+// ending in the middle of a doubleword (e.g 476 bytes) holds that half until the payload on the
+// other side arrives, in any order, or until flush which programs it with the other half erased.
+// Should that other half arrive after all, its page is rewritten with both.
+#define FLASH_HALF_MAX  8
+
+typedef struct {
+  uint32_t addr;      // doubleword
+  uint32_t word[2];   // lower and upper half
+  uint8_t  held;      // bit 0: lower half, bit 1: upper half, 0 if entry is free
+} flash_half_t;
+
+static flash_half_t _flash_half[FLASH_HALF_MAX];
+static uint32_t _flash_half_next = 0; // entry programmed to make room when all are in use
+static uint8_t  _flash_half_page[BOARD_PAGE_SIZE] __attribute__((aligned(8)));
+
+static void flash_program_dword(uint32_t addr, uint64_t data)
 {
-  flash_erase(dst);
+  if ( HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr, data) != HAL_OK ||
+       flash_wait(uf2_flash_program_deadline_ms(8), addr) != HAL_OK )
+  {
+    TUF2_LOG1("Failed to write flash at address %08lX\r\n", addr);
+  }
+}
+
+#ifdef FLASH_TYPEPROGRAM_FAST
+// Fast programming writes a row of 32 doublewords (one 256-byte uf2 payload) with a single
+// operation instead of one program and wait per doubleword. It is only used for blank rows of a
+// page erased (or found blank) in this session; if the flash rejects it (PGSERR, e.g parts that
+// require a mass erase first) double word programming is used for the rest of the session.
+#define FLASH_ROW_SIZE  256
 
+static uint8_t _row_buf[FLASH_ROW_SIZE] __attribute__((aligned(8)));
+static bool _row_fast_failed = false;
+
+// Program a row with fast programming, return false if it is to be programmed by doubleword
+static bool flash_program_row(uint32_t addr, uint8_t const* src)
+{
+  uint32_t const page = (addr - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE;
+  if ( _row_fast_failed || !erased_sectors[page] || !is_blank(addr, FLASH_ROW_SIZE) ) return false;
+
+  // HAL reads source by word
+  memcpy(_row_buf, src, FLASH_ROW_SIZE);
+
+  if ( HAL_FLASH_Program(FLASH_TYPEPROGRAM_FAST, addr, (uint32_t) _row_buf) == HAL_OK ) return true;
+
+  TUF2_LOG1("Fast programming rejected at %08lX, use doubleword\r\n", addr);
+  _row_fast_failed = true;
+
+  // nothing programmed on a rejected row, otherwise it can only be reported
+  if ( !is_blank(addr, FLASH_ROW_SIZE) )
+  {
+    TUF2_LOG1("Failed to write flash at address %08lX\r\n", addr);
+    return true;
+  }
+  return false;
+}
+#endif
+
+// Program doubleword of held halves, a missing half is left erased. Flash must be unlocked
+static void flash_half_program(flash_half_t* half)
+{
+  uint32_t const lo = (half->held & 1) ? half->word[0] : 0xffffffff;
+  uint32_t const hi = (half->held & 2) ? half->word[1] : 0xffffffff;
+
+  if ( !is_blank(half->addr, 8) )
+  {
+    // other half was programmed alone earlier: programming again is an ECC error, rewrite the page
+    uint32_t const page_addr = FLASH_BASE_ADDR + (half->addr - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE * BOARD_PAGE_SIZE;
+    uint8_t* dword = _flash_half_page + (half->addr - page_addr);
+
+    TUF2_LOG1("Rewrite page %08lX: doubleword %08lX programmed already\r\n", page_addr, half->addr);
+    memcpy(_flash_half_page, (void*) page_addr, BOARD_PAGE_SIZE);
+    if ( half->held & 1 ) memcpy(dword, &lo, 4);
+    if ( half->held & 2 ) memcpy(dword + 4, &hi, 4);
+
+    erased_sectors[(page_addr - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE] = 0;
+    flash_erase(page_addr);
+
+    // no fast row programming: erased doublewords of payloads yet to come must stay programmable
+    for ( uint32_t i = 0; i < BOARD_PAGE_SIZE; i += 8 )
+    {
+      uint64_t data;
+      memcpy(&data, _flash_half_page + i, 8);
+      if ( data != UINT64_MAX ) flash_program_dword(page_addr + i, data);
+    }
+
+#if TINYUF2_FLASH_VERIFY_CRC
+    flash_verify_add(page_addr, _flash_half_page, BOARD_PAGE_SIZE);
+#else
+    if ( memcmp((void*) page_addr, _flash_half_page, BOARD_PAGE_SIZE) != 0 )
+    {
+      TUF2_LOG1("Failed to write\r\n");
+    }
+#endif
+  }
+  else if ( (lo & hi) != 0xffffffff )
+  {
+    flash_program_dword(half->addr, ((uint64_t) hi << 32) | lo);
+#if TINYUF2_FLASH_VERIFY_CRC
+    if ( half->held & 1 ) flash_verify_add(half->addr, (uint8_t const*) &half->word[0], 4);
+    if ( half->held & 2 ) flash_verify_add(half->addr + 4, (uint8_t const*) &half->word[1], 4);
+#endif
+  }
+
+  half->held = 0;
+}
+
+// Hold word at addr, half of a doubleword, programmed once the other half is held too
+static void flash_half_add(uint32_t addr, uint8_t const* src)
+{
+  uint32_t const dword = addr & ~7UL;
+  uint8_t const bit = (addr & 4) ? 2 : 1;
+  flash_half_t* half = NULL;
+
+  for ( uint32_t i = 0; i < FLASH_HALF_MAX && !half; i++ )
+  {
+    if ( _flash_half[i].held && _flash_half[i].addr == dword ) half = &_flash_half[i];
+  }
+
+  for ( uint32_t i = 0; i < FLASH_HALF_MAX && !half; i++ )
+  {
+    if ( !_flash_half[i].held ) half = &_flash_half[i];
+  }
+
+  if ( !half )
+  {
+    half = &_flash_half[_flash_half_next];
+    _flash_half_next = (_flash_half_next + 1) % FLASH_HALF_MAX;
+    flash_half_program(half);
+  }
+
+  half->addr = dword;
+  memcpy(&half->word[bit >> 1], src, 4);
+  half->held |= bit;
+
+  if ( half->held == 3 ) flash_half_program(half);
+}
+
+// Program all held halves, flash must be unlocked
+static void flash_half_flush(void)
+{
+  for ( uint32_t i = 0; i < FLASH_HALF_MAX; i++ )
+  {
+    if ( _flash_half[i].held ) flash_half_program(&_flash_half[i]);
+  }
+}
+
+static bool flash_half_any(void)
+{
+  for ( uint32_t i = 0; i < FLASH_HALF_MAX; i++ )
+  {
+    if ( _flash_half[i].held ) return true;
+  }
+  return false;
+}
+
+// Copy part of src (at src_addr) overlapping [addr, addr + len) into buffer
+static void flash_read_overlay(uint32_t addr, uint8_t* buffer, uint32_t len, uint32_t src_addr,
+                               uint8_t const* src, uint32_t src_len)
+{
+  uint32_t const start = (addr > src_addr) ? addr : src_addr;
+  uint32_t const end = (addr + len < src_addr + src_len) ? (addr + len) : (src_addr + src_len);
+  if ( start < end ) memcpy(buffer + (start - addr), src + (start - src_addr), end - start);
+}
+
+static void flash_write(uint32_t dst, const uint8_t *src, int len)
+{
   TUF2_LOG1("Write flash at address %08lX\r\n", dst);
-  for ( int i = 0; i < len; i += 8 )
+
+  int i = 0;
+
+  if ( dst & 7 )
   {
-    uint64_t data = *((uint64_t*) ((void*) (src + i)));
+    // upper half of a doubleword, its lower half comes with the previous payload
+    flash_erase(dst);
+    flash_half_add(dst, src);
+    i = 4;
+  }
+  int const first = i;
 
-    if ( HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, dst + i, data) != HAL_OK )
+  for ( ; i + 8 <= len; i += 8 )
+  {
+    // payload may cross page boundary, erase each page when entering it
+    if ( i == 0 || ((dst + i) & (BOARD_PAGE_SIZE - 1)) == 0 )
     {
-      TUF2_LOG1("Failed to write flash at address %08lX\r\n", dst + i);
-      break;
+      flash_erase(dst + i);
+    }
+
+#ifdef FLASH_TYPEPROGRAM_FAST
+    // whole row: page is entered (and erased) at row boundary already
+    if ( ((dst + i) & (FLASH_ROW_SIZE - 1)) == 0 && i + FLASH_ROW_SIZE <= len &&
+         flash_program_row(dst + i, src + i) )
+    {
+      i += FLASH_ROW_SIZE - 8;
+      continue;
     }
+#endif
+
+    // erased doubleword (padding, gaps) is left erased, it stays programmable
+    uint64_t data;
+    memcpy(&data, src + i, 8);
+    if ( data != UINT64_MAX ) flash_program_dword(dst + i, data);
+  }
 
-    if ( FLASH_WaitForLastOperation(HAL_MAX_DELAY) != HAL_OK )
+  if ( i < len )
+  {
+    // lower half of the last doubleword, its upper half comes with the next payload
+    if ( i == 0 || ((dst + i) & (BOARD_PAGE_SIZE - 1)) == 0 )
     {
-      TUF2_LOG1("Waiting on last operation failed\r\n");
-      return;
+      flash_erase(dst + i);
     }
+    flash_half_add(dst + i, src + i);
   }
 
-  // verify contents
-  if (memcmp((void*)dst, src, len) != 0)
+#if TINYUF2_FLASH_VERIFY_CRC
+  flash_verify_add(dst + first, src + first, (uint32_t) (i - first));
+#else
+  // verify contents (excluding held halves)
+  if ( memcmp((void*) (dst + first), src + first, i - first) != 0 )
   {
     TUF2_LOG1("Failed to write\r\n");
   }
+#endif
 }
 
+#if FLASH_BG_ERASE
+// Erase of a bank 2 page is only started, bootloader keeps executing from bank 1 and USB keeps
+// receiving. The payload entering the page is held in RAM and programmed when the erase completes.
+static uint32_t _bg_page = SECTOR_COUNT;
+static uint32_t _bg_addr;
+static uint32_t _bg_len;
+static uint8_t  _bg_payload[476] __attribute__((aligned(4))); // largest uf2 payload
+static bool     _bg_dcache;
+
+// Start erasing the (bank 2) page of addr, return false if payload is to be written right away
+static bool flash_bg_erase_start(uint32_t addr, uint8_t const* src, uint32_t len)
+{
+  uint32_t const page = (addr - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE;
+  uint32_t const page_addr = FLASH_BASE_ADDR + page * BOARD_PAGE_SIZE;
+
+  if ( len > sizeof(_bg_payload) || page < FLASH_BANK_PAGES || page >= SECTOR_COUNT ) return false;
+  if ( erased_sectors[page] || (addr + len > page_addr + BOARD_PAGE_SIZE) ) return false;
+
+  erased_sectors[page] = 1;
+  if ( is_blank(page_addr, BOARD_PAGE_SIZE) ) return false;
+
+  TUF2_LOG1("Erase: %08lX size = %lu KB in background\r\n", page_addr, (uint32_t) (BOARD_PAGE_SIZE / 1024));
+
+  // data cache is off while erasing so that reads of the page stall instead of returning stale data
+  _bg_dcache = READ_BIT(FLASH->ACR, FLASH_ACR_DCEN) != 0;
+  __HAL_FLASH_DATA_CACHE_DISABLE();
+
+#if TINYUF2_FLASH_VERIFY_CRC
+  flash_verify_finish();
+#endif
+  // only sets STRT, does not wait for completion
+  FLASH_PageErase(page - FLASH_BANK_PAGES, flash_bank_of(page));
+
+  _bg_page = page;
+  _bg_addr = addr;
+  _bg_len = len;
+  memcpy(_bg_payload, src, len);
+
+  return true;
+}
+
+// Wait for the background erase and program the held payload. Flash is still unlocked
+static void flash_bg_erase_finish(void)
+{
+  if ( _bg_page == SECTOR_COUNT ) return;
+
+  (void) flash_wait(uf2_flash_erase_deadline_ms(BOARD_PAGE_SIZE), _bg_addr);
+  CLEAR_BIT(FLASH->CR, FLASH_CR_PER | FLASH_CR_PNB);
+
+  if ( _bg_dcache )
+  {
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+  }
+  _bg_page = SECTOR_COUNT;
+
+  flash_write(_bg_addr, _bg_payload, (int) _bg_len);
+}
+#endif
+
+#if !TINYUF2_FLASH_CACHE
+// Program payload without cache
+static void flash_write_direct(uint32_t addr, uint8_t const* src, uint32_t len)
+{
+  HAL_FLASH_Unlock();
+
+#if FLASH_BG_ERASE
+  flash_bg_erase_finish();
+
+  // leave flash unlocked while erasing: writing FLASH_CR stalls the bus until BSY is cleared
+  if ( flash_bg_erase_start(addr, src, len) ) return;
+#endif
+
+  flash_write(addr, src, (int) len);
+  HAL_FLASH_Lock();
+}
+#endif
+
 //--------------------------------------------------------------------+
 // Board API
 //--------------------------------------------------------------------+
 void board_flash_init(void)
 {
-
+#ifdef FLASH_BANK_2
+  // FB_MODE is read to find the physical bank to erase
+  __HAL_RCC_SYSCFG_CLK_ENABLE();
+#endif
+#if TINYUF2_FLASH_VERIFY_CRC
+  __HAL_RCC_CRC_CLK_ENABLE();
+#endif
 }
 
 uint32_t board_flash_size(void)
@@ -152,30 +549,239 @@ uint32_t board_flash_size(void)
   return BOARD_FLASH_SIZE;
 }
 
+board_flash_info_t const* board_flash_info(void)
+{
+  // ECC flash: a double word is only programmed once after erase
+  static board_flash_info_t const info =
+  {
+    .geometry     = FLASH_GEOMETRY(FLASH_BASE_ADDR, _flash_regions),
+    .xip_base     = FLASH_BASE_ADDR,
+    .erased_word  = 0xFFFFFFFFUL,
+    .program_size = 8,
+    .caps         = BOARD_FLASH_CAP_XIP,
+    .erase_us     = 22000,
+    .program_us   = 82 * (256 / 8),
+  };
+  return &info;
+}
+
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
 {
+  // reading the page being erased in background stalls until it is erased
   memcpy(buffer, (void*) addr, len);
+
+#if FLASH_BG_ERASE
+  // payload held until its page is erased
+  if ( _bg_page != SECTOR_COUNT ) flash_read_overlay(addr, buffer, len, _bg_addr, _bg_payload, _bg_len);
+#endif
+
+  // held halves are not programmed yet
+  for ( uint32_t i = 0; i < FLASH_HALF_MAX; i++ )
+  {
+    flash_half_t const* half = &_flash_half[i];
+    if ( half->held & 1 ) flash_read_overlay(addr, buffer, len, half->addr, (uint8_t const*) &half->word[0], 4);
+    if ( half->held & 2 ) flash_read_overlay(addr, buffer, len, half->addr + 4, (uint8_t const*) &half->word[1], 4);
+  }
 }
 
 void board_flash_flush(void)
 {
+#if FLASH_BG_ERASE
+  if ( _bg_page != SECTOR_COUNT )
+  {
+    flash_bg_erase_finish();
+    HAL_FLASH_Lock();
+  }
+#endif
+
+  // program halves of doublewords whose other half did not arrive
+  if ( flash_half_any() )
+  {
+    HAL_FLASH_Unlock();
+    flash_half_flush();
+    HAL_FLASH_Lock();
+  }
+
+#if TINYUF2_FLASH_VERIFY_CRC
+  // partially written page
+  flash_verify_finish();
+#endif
+
+#if TINYUF2_FLASH_CACHE
+  if ( _flash_cache_addr == FLASH_CACHE_INVALID_ADDR ) return;
+
+  // skip programming if contents is identical
+  if ( memcmp(_flash_cache, (void*) _flash_cache_addr, FLASH_CACHE_SIZE) != 0 )
+  {
+    // cache holds the whole page image, always erase it (if not blank) before programming
+    erased_sectors[(_flash_cache_addr - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE] = 0;
+
+    HAL_FLASH_Unlock();
+    flash_write(_flash_cache_addr, _flash_cache, FLASH_CACHE_SIZE);
+    HAL_FLASH_Lock();
+  }
+  else
+  {
+    TUF2_LOG1("Skip page %08lX: contents matched\r\n", _flash_cache_addr);
+  }
+
+  _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+#endif
+}
+
+void board_flash_session_reset(void)
+{
+  memset(erased_sectors, 0, sizeof(erased_sectors));
 }
 
 // TODO not working quite yet
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len)
 {
+#if TINYUF2_FLASH_CACHE
+  uint8_t const* src = (uint8_t const*) data;
+
+  while ( len )
+  {
+    uint32_t const page_addr = addr & ~(FLASH_CACHE_SIZE - 1);
+    uint32_t const offset = addr & (FLASH_CACHE_SIZE - 1);
+    uint32_t const count = (len < FLASH_CACHE_SIZE - offset) ? len : (FLASH_CACHE_SIZE - offset);
+
+    if ( page_addr != _flash_cache_addr )
+    {
+      // flush previous page and load current flash contents so that partial writes are preserved
+      board_flash_flush();
+      _flash_cache_addr = page_addr;
+      memcpy(_flash_cache, (void*) page_addr, FLASH_CACHE_SIZE);
+    }
+
+    memcpy(_flash_cache + offset, src, count);
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+#else
   // TODO skip matching contents
-  HAL_FLASH_Unlock();
-  flash_write(addr, data, len);
-  HAL_FLASH_Lock();
+  flash_write_direct(addr, data, len);
+#endif
+
+  return true;
+}
 
+#if TINYUF2_FLASH_CACHE
+// Pages are loaded into the cache with their contents before being written
+bool board_flash_preserved(uint32_t addr, uint32_t len)
+{
+  (void) addr;
+  (void) len;
   return true;
 }
+#endif
 
 void board_flash_erase_app(void)
 {
-  // TODO implement later
+  // cached and pending contents belong to the application being wiped
+#if TINYUF2_FLASH_CACHE
+  _flash_cache_addr = FLASH_CACHE_INVALID_ADDR;
+#endif
+  memset(_flash_half, 0, sizeof(_flash_half));
+  board_flash_flush();
+
+  HAL_FLASH_Unlock();
+
+  uint32_t const flash_end = FLASH_BASE_ADDR + BOARD_FLASH_SIZE;
+
+  for ( uint32_t addr = BOARD_FLASH_APP_START; addr < flash_end; addr += BOARD_PAGE_SIZE )
+  {
+    uint32_t const page = (addr - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE;
+
+#ifdef FLASH_BANK_2
+    // bootloader is in bank 1, bank 2 is wiped with a single bank erase
+    if ( page == FLASH_BANK_PAGES )
+    {
+      if ( !is_blank(addr, flash_end - addr) )
+      {
+        TUF2_LOG1("Erase: bank 2 ... ");
+        FLASH_EraseInitTypeDef erase = {
+          .TypeErase = FLASH_TYPEERASE_MASSERASE,
+          .Banks     = flash_bank_of(page),
+        };
+        uint32_t page_error = 0;
+        if ( HAL_FLASHEx_Erase(&erase, &page_error) == HAL_OK )
+        {
+          TUF2_LOG1("OK\r\n");
+        }
+        else
+        {
+          TUF2_LOG1("failed\r\n");
+        }
+      }
+
+      memset(erased_sectors + page, 1, SECTOR_COUNT - page);
+      break;
+    }
+#endif
+
+    // erase page unless already blank
+    erased_sectors[page] = 0;
+    flash_erase(addr);
+  }
+
+  HAL_FLASH_Lock();
+}
+
+#if FLASH_BANK_SWAP
+// Staged image is in the upper bank at the application offset (BOARD_STAGING_ADDR). Bootloader pages
+// of that bank are brought up to date, then it is booted with BFB2: system memory maps it at
+// FLASH_BASE_ADDR (FB_MODE) with the old application now in the upper bank. The next staged update
+// clears BFB2 again to return to bank 1.
+bool board_staged_swap(uint32_t len)
+{
+  (void) len;
+  uint32_t const bank_size = BOARD_FLASH_SIZE / 2;
+
+  if ( BOARD_STAGING_ADDR != BOARD_FLASH_APP_START + bank_size ) return false;
+
+  for ( uint32_t addr = FLASH_BASE_ADDR; addr < BOARD_FLASH_APP_START; addr += BOARD_PAGE_SIZE )
+  {
+    if ( memcmp((void*) addr, (void*) (addr + bank_size), BOARD_PAGE_SIZE) != 0 )
+    {
+      board_flash_write(addr + bank_size, (void const*) addr, BOARD_PAGE_SIZE);
+    }
+  }
+  board_flash_flush();
+
+  if ( memcmp((void*) FLASH_BASE_ADDR, (void*) (FLASH_BASE_ADDR + bank_size), BOARD_FLASH_APP_START - FLASH_BASE_ADDR) != 0 )
+  {
+    TUF2_LOG1("Bootloader copy to upper bank failed\r\n");
+    return false;
+  }
+
+  bool const swapped = READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE) != 0;
+  FLASH_OBProgramInitTypeDef ob =
+  {
+    .OptionType = OPTIONBYTE_USER,
+    .USERType   = OB_USER_BFB2,
+    .USERConfig = swapped ? OB_BFB2_DISABLE : OB_BFB2_ENABLE,
+  };
+
+  uf2_staged_invalidate();
+  TUF2_LOG1("Boot from bank %u\r\n", swapped ? 1 : 2);
+
+  HAL_FLASH_Unlock();
+  HAL_FLASH_OB_Unlock();
+  if ( HAL_FLASHEx_OBProgram(&ob) == HAL_OK )
+  {
+    // reloads option bytes with a system reset
+    HAL_FLASH_OB_Launch();
+  }
+  HAL_FLASH_OB_Lock();
+  HAL_FLASH_Lock();
+
+  // footer is gone: the image is copied in this boot instead
+  return false;
 }
+#endif
 
 #ifdef TINYUF2_SELF_UPDATE
 /**
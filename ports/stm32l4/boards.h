@@ -43,6 +43,13 @@
 
 #define BOARD_PAGE_SIZE 0x1000
 
+// Staged update (TINYUF2_STAGED_UPDATE) in the upper bank at the application offset, applied by
+// booting that bank. Its last page holds the staging footer
+#if defined(FLASH_BANK_2) && !defined(BOARD_STAGING_ADDR)
+#define BOARD_STAGING_ADDR  (BOARD_FLASH_APP_START + BOARD_FLASH_SIZE / 2)
+#define BOARD_STAGING_SIZE  (BOARD_FLASH_SIZE / 2 - (BOARD_FLASH_APP_START - BOARD_FLASH_ADDR_ZERO))
+#endif
+
 // Double Reset tap to enter DFU
 #define TINYUF2_DBL_TAP_DFU  1
 
@@ -0,0 +1,200 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board_api.h"
+#include "uf2.h"
+#include "mock_flash.h"
+
+// Host benchmark of a port flash driver (ports/<port>/board_flash.c) built against timed mocks of its
+// HAL / ROM API / esp_partition layer (mock/<port>).
+//
+// Streams each UF2 through uf2_write_block() and board_flash_flush() as a copy to the drive does, then
+// reads it back with board_flash_read(). Reports virtual flash time, erases and programmed bytes per
+// pass. Every pass is a new flashing session on top of the previous one: the second pass of the same
+// image shows what the driver does when contents already match.
+//
+//   flash-<port>-<board>.elf [-n passes] [-s size_kb] [-t max_ms] [file.uf2 ...]
+//
+// Without a file a synthetic image of size_kb (default 256) at BOARD_FLASH_APP_START is written. Exits
+// non-zero if a block is rejected, read back differs, flash is programmed without being erased, or a
+// pass takes longer than max_ms.
+
+#define STREAM_PAYLOAD  256
+
+static WriteState _wr_state;
+
+static UF2_Block* _image = NULL;
+static uint32_t _image_count = 0;
+
+static uint32_t _rand_state = 1;
+
+static uint32_t next_rand(void) {
+  _rand_state = _rand_state * 1103515245 + 12345;
+  return _rand_state >> 8;
+}
+
+static void make_image(uint32_t size) {
+  uint32_t const num = (size + STREAM_PAYLOAD - 1) / STREAM_PAYLOAD;
+  _image = calloc(num, sizeof(UF2_Block));
+
+  for (uint32_t i = 0; i < num; i++) {
+    UF2_Block* bl = &_image[i];
+    bl->magicStart0 = UF2_MAGIC_START0;
+    bl->magicStart1 = UF2_MAGIC_START1;
+    bl->magicEnd    = UF2_MAGIC_END;
+    bl->flags       = UF2_FLAG_FAMILYID;
+    bl->targetAddr  = BOARD_FLASH_APP_START + i * STREAM_PAYLOAD;
+    bl->payloadSize = STREAM_PAYLOAD;
+    bl->blockNo     = i;
+    bl->numBlocks   = num;
+    bl->familyID    = BOARD_UF2_FAMILY_ID;
+    for (uint32_t k = 0; k < STREAM_PAYLOAD; k++) {
+      bl->data[k] = (uint8_t) next_rand();
+    }
+  }
+  _image_count = num;
+}
+
+static bool load_image(char const* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    printf("cannot open %s\n", path);
+    return false;
+  }
+
+  fseek(file, 0L, SEEK_END);
+  long const size = ftell(file);
+  fseek(file, 0L, SEEK_SET);
+
+  uint32_t const num = (uint32_t) (size / UF2_BLOCK_SIZE);
+  free(_image);
+  _image = malloc(num * sizeof(UF2_Block));
+  bool ok = (_image != NULL) && (num > 0) && (fread(_image, UF2_BLOCK_SIZE, num, file) == num);
+  fclose(file);
+
+  if (!ok) printf("cannot read %s\n", path);
+  _image_count = ok ? num : 0;
+  return ok;
+}
+
+// payload is not stored as is
+#define UF2_FLAG_NOT_RAW  (UF2_FLAG_NOFLASH | UF2_FLAG_LZ4 | UF2_FLAG_AES | UF2_FLAG_FILL)
+
+// Plain payloads of the board family read back as written, later blocks take precedence
+static bool verify_image(void) {
+  static uint8_t buf[476];
+
+  for (uint32_t i = 0; i < _image_count; i++) {
+    UF2_Block const* bl = &_image[i];
+    if (bl->familyID != BOARD_UF2_FAMILY_ID || (bl->flags & UF2_FLAG_NOT_RAW) || bl->payloadSize > sizeof(buf)) continue;
+
+    bool overwritten = false;
+    for (uint32_t k = i + 1; k < _image_count && !overwritten; k++) {
+      overwritten = (_image[k].targetAddr < bl->targetAddr + bl->payloadSize) &&
+                    (bl->targetAddr < _image[k].targetAddr + _image[k].payloadSize);
+    }
+    if (overwritten) continue;
+
+    board_flash_read(bl->targetAddr, buf, bl->payloadSize);
+    if (memcmp(buf, bl->data, bl->payloadSize)) {
+      printf("read back differs at 0x%08" PRIX32 "\n", bl->targetAddr);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool run_pass(char const* name, uint32_t pass, uint32_t max_ms) {
+  mock_flash_stats_t st;
+  mock_flash_stats(&st); // clear
+
+  memset(&_wr_state, 0, sizeof(_wr_state));
+  if (board_flash_session_reset) board_flash_session_reset();
+
+  uint64_t const start = mock_time_us();
+  uint32_t bytes = 0;
+
+  for (uint32_t i = 0; i < _image_count; i++) {
+    if (uf2_write_block(0, (uint8_t*) &_image[i], &_wr_state) != UF2_BLOCK_SIZE || _wr_state.rewriteConflict ||
+        _wr_state.untracked) {
+      printf("%s: block %" PRIu32 " rejected%s\n", name, i,
+             _wr_state.rewriteConflict ? " (rewrite over this session's data)" :
+             _wr_state.untracked ? " (too many partially written groups)" : "");
+      return false;
+    }
+    bytes += _image[i].payloadSize;
+  }
+  board_flash_flush();
+
+  uint64_t const ms = (mock_time_us() - start) / 1000;
+  mock_flash_stats(&st);
+
+  printf("%-20s pass %" PRIu32 ": %6" PRIu32 " KB %8" PRIu64 " ms, %4" PRIu32 " erases %6" PRIu32 " KB %8" PRIu64
+         " ms, %6" PRIu32 " KB program %8" PRIu64 " ms\n",
+         name, pass, bytes / 1024, ms, st.erase_count, st.erase_bytes / 1024, st.erase_us / 1000,
+         st.program_bytes / 1024, st.program_us / 1000);
+
+  bool ok = verify_image();
+  if (st.overprograms) {
+    printf("%s: %" PRIu32 " program operations on flash not erased\n", name, st.overprograms);
+    ok = false;
+  }
+  if (st.errors) {
+    printf("%s: %" PRIu32 " operations outside of flash\n", name, st.errors);
+    ok = false;
+  }
+  if (max_ms && ms > max_ms) {
+    printf("%s: %" PRIu64 " ms exceeds limit of %" PRIu32 " ms\n", name, ms, max_ms);
+    ok = false;
+  }
+
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  uint32_t passes = 1;
+  uint32_t size_kb = 256;
+  uint32_t max_ms = 0;
+  int first_file = argc;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && !strcmp(argv[i], "-n")) {
+      passes = (uint32_t) strtoul(argv[++i], NULL, 0);
+    } else if (i + 1 < argc && !strcmp(argv[i], "-s")) {
+      size_kb = (uint32_t) strtoul(argv[++i], NULL, 0);
+    } else if (i + 1 < argc && !strcmp(argv[i], "-t")) {
+      max_ms = (uint32_t) strtoul(argv[++i], NULL, 0);
+    } else {
+      first_file = i;
+      break;
+    }
+  }
+
+  if (!mock_port_init()) return 1;
+  uf2_init();
+
+  printf("%s: flash %" PRIu32 " KB at 0x%08" PRIX32 ", app at 0x%08" PRIX32 "\n", mock_port_name(),
+         mock_flash_size() / 1024, mock_flash_base(), (uint32_t) BOARD_FLASH_APP_START);
+
+  bool ok = true;
+  if (first_file == argc) {
+    make_image(size_kb * 1024);
+    for (uint32_t p = 1; p <= passes; p++) ok = run_pass("synthetic", p, max_ms) && ok;
+  }
+
+  for (int f = first_file; f < argc; f++) {
+    if (!load_image(argv[f])) {
+      ok = false;
+      continue;
+    }
+
+    char const* name = strrchr(argv[f], '/');
+    name = name ? name + 1 : argv[f];
+    for (uint32_t p = 1; p <= passes; p++) ok = run_pass(name, p, max_ms) && ok;
+  }
+
+  return ok ? 0 : 1;
+}
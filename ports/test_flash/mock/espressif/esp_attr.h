@@ -0,0 +1,10 @@
+#ifndef MOCK_ESP_ATTR_H
+#define MOCK_ESP_ATTR_H
+
+// no retained memory on the host, plain zeroed data
+
+#define __NOINIT_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef MOCK_ESP_IMAGE_FORMAT_H
+#define MOCK_ESP_IMAGE_FORMAT_H
+
+#include "esp_err.h"
+
+// Image metadata is not modeled: verify and get_metadata fail as for a blank partition
+
+typedef struct {
+  uint32_t offset;
+  uint32_t size;
+} esp_partition_pos_t;
+
+typedef struct {
+  uint32_t start_addr;
+  uint32_t image_len;
+} esp_image_metadata_t;
+
+typedef enum {
+  ESP_IMAGE_VERIFY,
+  ESP_IMAGE_VERIFY_SILENT,
+} esp_image_load_mode_t;
+
+esp_err_t esp_image_verify(esp_image_load_mode_t mode, esp_partition_pos_t const* part, esp_image_metadata_t* data);
+esp_err_t esp_image_get_metadata(esp_partition_pos_t const* part, esp_image_metadata_t* metadata);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef MOCK_ESP_LOG_H
+#define MOCK_ESP_LOG_H
+
+// Included by the driver, logging goes through TUF2_LOG
+
+#endif
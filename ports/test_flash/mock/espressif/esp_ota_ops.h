@@ -0,0 +1,10 @@
+#ifndef MOCK_ESP_OTA_OPS_H
+#define MOCK_ESP_OTA_OPS_H
+
+#include "esp_partition.h"
+
+esp_partition_t const* esp_ota_get_boot_partition(void);
+esp_partition_t const* esp_ota_get_next_update_partition(esp_partition_t const* start_from);
+esp_err_t esp_ota_set_boot_partition(esp_partition_t const* partition);
+
+#endif
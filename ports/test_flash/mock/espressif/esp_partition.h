@@ -0,0 +1,62 @@
+#ifndef MOCK_ESP_PARTITION_H
+#define MOCK_ESP_PARTITION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+// Partition API as of IDF 5.x, table of mock_espressif.c
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP  = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_APP_FACTORY = 0x00,
+  ESP_PARTITION_SUBTYPE_APP_OTA_0   = 0x10,
+  ESP_PARTITION_SUBTYPE_APP_OTA_1   = 0x11,
+  ESP_PARTITION_SUBTYPE_DATA_OTA    = 0x00,
+  ESP_PARTITION_SUBTYPE_DATA_NVS    = 0x02,
+  ESP_PARTITION_SUBTYPE_DATA_FAT    = 0x81,
+  ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+  ESP_PARTITION_SUBTYPE_ANY         = 0xff,
+} esp_partition_subtype_t;
+
+typedef enum {
+  ESP_PARTITION_MMAP_DATA,
+  ESP_PARTITION_MMAP_INST,
+} esp_partition_mmap_memory_t;
+
+typedef uint32_t esp_partition_mmap_handle_t;
+
+typedef struct {
+  void* flash_chip;
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  uint32_t address;
+  uint32_t size;
+  uint32_t erase_size;
+  char label[17];
+  bool encrypted;
+  bool readonly;
+} esp_partition_t;
+
+typedef struct esp_partition_iterator_opaque_* esp_partition_iterator_t;
+
+esp_partition_t const* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, char const* label);
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, char const* label);
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t iterator);
+esp_partition_t const* esp_partition_get(esp_partition_iterator_t iterator);
+void esp_partition_iterator_release(esp_partition_iterator_t iterator);
+
+esp_err_t esp_partition_read(esp_partition_t const* partition, size_t src_offset, void* dst, size_t size);
+esp_err_t esp_partition_write(esp_partition_t const* partition, size_t dst_offset, void const* src, size_t size);
+esp_err_t esp_partition_erase_range(esp_partition_t const* partition, size_t offset, size_t size);
+esp_err_t esp_partition_mmap(esp_partition_t const* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, void const** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle);
+
+#endif
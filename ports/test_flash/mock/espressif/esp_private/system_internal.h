@@ -0,0 +1,8 @@
+#ifndef MOCK_ESP_SYSTEM_INTERNAL_H
+#define MOCK_ESP_SYSTEM_INTERNAL_H
+
+#include "esp_system.h"
+
+void esp_reset_reason_set_hint(esp_reset_reason_t hint);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef MOCK_FREERTOS_TASK_H
+#define MOCK_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+// advances the virtual clock by the ticks (1 ms each)
+void vTaskDelay(TickType_t ticks);
+
+#endif
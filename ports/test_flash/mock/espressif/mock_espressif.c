@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board_api.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "esp_private/system_internal.h"
+#include "freertos/task.h"
+#include "mock_flash.h"
+
+// Partition API on a serial NOR model of a 4MB chip, each call takes the time of the flash commands it
+// issues (esp_flash waits for completion)
+
+#if BOARD_FLASH_WORKER || BOARD_FLASH_PSRAM_STAGING
+#error "BOARD_FLASH_WORKER and BOARD_FLASH_PSRAM_STAGING are not modeled"
+#endif
+
+#define MOCK_CHIP_SIZE  (4*1024*1024)
+
+// partitions-4MB.csv
+static esp_partition_t const _parts[] = {
+  { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_NVS,    .address = 0x9000,   .size = 20*1024,   .label = "nvs"     },
+  { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_OTA,    .address = 0xe000,   .size = 8*1024,    .label = "otadata" },
+  { .type = ESP_PARTITION_TYPE_APP,  .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0,   .address = 0x10000,  .size = 1408*1024, .label = "ota_0"   },
+  { .type = ESP_PARTITION_TYPE_APP,  .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_1,   .address = 0x170000, .size = 1408*1024, .label = "ota_1"   },
+  { .type = ESP_PARTITION_TYPE_APP,  .subtype = ESP_PARTITION_SUBTYPE_APP_FACTORY, .address = 0x2d0000, .size = 256*1024,  .label = "uf2"     },
+  { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_FAT,    .address = 0x310000, .size = 960*1024,  .label = "ffat"    },
+};
+
+#define PART_COUNT  (sizeof(_parts) / sizeof(_parts[0]))
+
+static esp_partition_t const* _part_boot = &_parts[4];
+
+static bool part_match(esp_partition_t const* part, esp_partition_type_t type, esp_partition_subtype_t subtype,
+                       char const* label) {
+  return part->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || part->subtype == subtype) &&
+         (label == NULL || !strcmp(part->label, label));
+}
+
+static bool range_valid(esp_partition_t const* part, size_t offset, size_t size) {
+  return offset <= part->size && size <= part->size - offset;
+}
+
+//--------------------------------------------------------------------+
+// esp_partition
+//--------------------------------------------------------------------+
+esp_partition_t const* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, char const* label) {
+  for (size_t i = 0; i < PART_COUNT; i++) {
+    if (part_match(&_parts[i], type, subtype, label)) return &_parts[i];
+  }
+  return NULL;
+}
+
+// iterator is the partition itself, only the first match is returned
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, char const* label) {
+  return (esp_partition_iterator_t) (uintptr_t) esp_partition_find_first(type, subtype, label);
+}
+
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t iterator) {
+  return NULL;
+}
+
+esp_partition_t const* esp_partition_get(esp_partition_iterator_t iterator) {
+  return (esp_partition_t const*) (uintptr_t) iterator;
+}
+
+void esp_partition_iterator_release(esp_partition_iterator_t iterator) {
+}
+
+esp_err_t esp_partition_read(esp_partition_t const* partition, size_t src_offset, void* dst, size_t size) {
+  if (!range_valid(partition, src_offset, size)) return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, mock_flash_ptr(partition->address + src_offset, size), size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(esp_partition_t const* partition, size_t dst_offset, void const* src, size_t size) {
+  if (!range_valid(partition, dst_offset, size)) return ESP_ERR_INVALID_SIZE;
+  mock_nor_program(partition->address + dst_offset, src, size);
+  return ESP_OK;
+}
+
+// block erase for aligned 64KB blocks within range, sector erase otherwise (as esp_flash_erase_region)
+esp_err_t esp_partition_erase_range(esp_partition_t const* partition, size_t offset, size_t size) {
+  if (!range_valid(partition, offset, size)) return ESP_ERR_INVALID_SIZE;
+  if ((offset | size) % MOCK_NOR_SECTOR_SIZE) return ESP_ERR_INVALID_SIZE;
+  mock_nor_erase(partition->address + offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(esp_partition_t const* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, void const** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle) {
+  if (!range_valid(partition, offset, size)) return ESP_ERR_INVALID_SIZE;
+  *out_ptr = mock_flash_ptr(partition->address + offset, size);
+  *out_handle = 0;
+  return ESP_OK;
+}
+
+//--------------------------------------------------------------------+
+// OTA, image and system
+//--------------------------------------------------------------------+
+esp_partition_t const* esp_ota_get_boot_partition(void) {
+  return _part_boot;
+}
+
+esp_partition_t const* esp_ota_get_next_update_partition(esp_partition_t const* start_from) {
+  if (start_from == NULL) start_from = _part_boot;
+  return esp_partition_find_first(ESP_PARTITION_TYPE_APP,
+                                  (start_from->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_0) ? ESP_PARTITION_SUBTYPE_APP_OTA_1
+                                                                                           : ESP_PARTITION_SUBTYPE_APP_OTA_0,
+                                  NULL);
+}
+
+esp_err_t esp_ota_set_boot_partition(esp_partition_t const* partition) {
+  _part_boot = partition;
+  return ESP_OK;
+}
+
+esp_err_t esp_image_verify(esp_image_load_mode_t mode, esp_partition_pos_t const* part, esp_image_metadata_t* data) {
+  return ESP_FAIL;
+}
+
+esp_err_t esp_image_get_metadata(esp_partition_pos_t const* part, esp_image_metadata_t* metadata) {
+  return ESP_FAIL;
+}
+
+esp_reset_reason_t esp_reset_reason(void) {
+  return ESP_RST_POWERON;
+}
+
+void esp_reset_reason_set_hint(esp_reset_reason_t hint) {
+}
+
+void esp_restart(void) {
+  printf("esp_restart()\n");
+  exit(1);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  mock_time_advance((uint64_t) ticks * 1000);
+}
+
+//--------------------------------------------------------------------+
+// Port
+//--------------------------------------------------------------------+
+
+// addresses of the driver are offsets in the app partition, only the partition API accesses the chip
+bool mock_port_init(void) {
+  if (!mock_flash_init(0, MOCK_CHIP_SIZE, false)) return false;
+
+  board_flash_init();
+  return true;
+}
+
+char const* mock_port_name(void) {
+  return "espressif";
+}
@@ -0,0 +1,9 @@
+#ifndef MOCK_SDKCONFIG_H
+#define MOCK_SDKCONFIG_H
+
+// Host stand-in of the IDF project configuration: no PSRAM, dual core
+
+#define CONFIG_SPIRAM             0
+#define CONFIG_FREERTOS_UNICORE   0
+
+#endif
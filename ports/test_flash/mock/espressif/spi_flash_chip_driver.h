@@ -0,0 +1,6 @@
+#ifndef MOCK_SPI_FLASH_CHIP_DRIVER_H
+#define MOCK_SPI_FLASH_CHIP_DRIVER_H
+
+// Included by the driver, flash is only accessed with the partition API
+
+#endif
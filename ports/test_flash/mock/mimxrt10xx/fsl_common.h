@@ -0,0 +1,29 @@
+#ifndef MOCK_FSL_COMMON_H
+#define MOCK_FSL_COMMON_H
+
+// Host stand-in of the SDK common header: status codes used by bl_flexspi.h and flexspi_nor_flash.h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef int32_t status_t;
+
+#define MAKE_STATUS(group, code)  ((((group) * 100) + (code)))
+
+enum {
+  kStatusGroup_Generic = 0,
+  kStatusGroup_FLEXSPI = 70,
+};
+
+enum {
+  kStatus_Success         = MAKE_STATUS(kStatusGroup_Generic, 0),
+  kStatus_Fail            = MAKE_STATUS(kStatusGroup_Generic, 1),
+  kStatus_ReadOnly        = MAKE_STATUS(kStatusGroup_Generic, 2),
+  kStatus_OutOfRange      = MAKE_STATUS(kStatusGroup_Generic, 3),
+  kStatus_InvalidArgument = MAKE_STATUS(kStatusGroup_Generic, 4),
+  kStatus_Timeout         = MAKE_STATUS(kStatusGroup_Generic, 5),
+};
+
+#endif
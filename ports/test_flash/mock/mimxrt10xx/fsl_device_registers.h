@@ -0,0 +1,94 @@
+#ifndef MOCK_FSL_DEVICE_REGISTERS_H
+#define MOCK_FSL_DEVICE_REGISTERS_H
+
+// Host stand-in of the SDK device header: only what ports/mimxrt10xx/board_flash.c uses. Registers are
+// plain memory, flash operations go through the ROM API mock (mock_mimxrt10xx.c). The ROM API is
+// always declared by romapi_flash.h (as for RT1011), the mock implements it for every part
+
+#include "fsl_common.h"
+
+#if defined(CPU_MIMXRT1011DAE5A)
+  #define MIMXRT1011_SERIES
+#elif defined(CPU_MIMXRT1015DAF5A)
+  #define MIMXRT1015_SERIES
+#elif defined(CPU_MIMXRT1021DAG5A)
+  #define MIMXRT1021_SERIES
+#elif defined(CPU_MIMXRT1024DAG5A)
+  #define MIMXRT1024_SERIES
+#elif defined(CPU_MIMXRT1042XJM5B)
+  #define MIMXRT1042_SERIES
+#elif defined(CPU_MIMXRT1052DVL6B)
+  #define MIMXRT1052_SERIES
+#elif defined(CPU_MIMXRT1062DVL6A)
+  #define MIMXRT1062_SERIES
+#elif defined(CPU_MIMXRT1064DVL6A)
+  #define MIMXRT1064_SERIES
+#else
+  #error "unknown CPU_MIMXRT part"
+#endif
+
+#define FSL_FEATURE_BOOT_ROM_HAS_ROMAPI   0
+
+#define FlexSPI_AMBA_BASE   0x60000000u
+#if defined(MIMXRT1064_SERIES)
+  #define FlexSPI2_AMBA_BASE  0x70000000u
+#endif
+
+#define __IO volatile
+
+typedef struct {
+  __IO uint32_t MCR0;
+  __IO uint32_t AHBCR;
+  __IO uint32_t AHBRXBUFCR0[4];
+  __IO uint32_t STS0;
+} FLEXSPI_Type;
+
+extern FLEXSPI_Type mock_flexspi_regs;
+
+#define FLEXSPI   (&mock_flexspi_regs)
+#define FLEXSPI2  (&mock_flexspi_regs)
+
+#define FLEXSPI_MCR0_MDIS_MASK                (0x2U)
+// software reset completes right away, the mask keeps it from being waited on
+#define FLEXSPI_MCR0_SWRESET_MASK             (0x0U)
+
+#define FLEXSPI_AHBCR_CACHABLEEN_MASK         (0x8U)
+#define FLEXSPI_AHBCR_BUFFERABLEEN_MASK       (0x10U)
+#define FLEXSPI_AHBCR_PREFETCHEN_MASK         (0x20U)
+#define FLEXSPI_AHBCR_READADDROPT_MASK        (0x40U)
+
+#define FLEXSPI_AHBRXBUFCR0_BUFSZ_MASK        (0xFFU)
+#define FLEXSPI_AHBRXBUFCR0_BUFSZ(x)          ((uint32_t) (x) & FLEXSPI_AHBRXBUFCR0_BUFSZ_MASK)
+#define FLEXSPI_AHBRXBUFCR0_MSTRID_MASK       (0xF0000U)
+#define FLEXSPI_AHBRXBUFCR0_MSTRID_SHIFT      (16U)
+#define FLEXSPI_AHBRXBUFCR0_MSTRID(x)         (((uint32_t) (x) << FLEXSPI_AHBRXBUFCR0_MSTRID_SHIFT) & FLEXSPI_AHBRXBUFCR0_MSTRID_MASK)
+#define FLEXSPI_AHBRXBUFCR0_PRIORITY_MASK     (0x3000000U)
+#define FLEXSPI_AHBRXBUFCR0_PRIORITY(x)       (((uint32_t) (x) << 24U) & FLEXSPI_AHBRXBUFCR0_PRIORITY_MASK)
+#define FLEXSPI_AHBRXBUFCR0_PREFETCHEN_MASK   (0x80000000U)
+
+#define FLEXSPI_STS0_SEQIDLE_MASK             (0x1U)
+#define FLEXSPI_STS0_ARBIDLE_MASK             (0x2U)
+
+typedef struct {
+  __IO uint32_t SBMR2;
+} SRC_Type;
+
+extern SRC_Type mock_src_regs;
+
+#define SRC   (&mock_src_regs)
+
+#define SRC_SBMR2_BMOD_MASK   (0x3000000U)
+#define SRC_SBMR2_BMOD_SHIFT  (24U)
+
+#define __SCB_DCACHE_LINE_SIZE  32U
+
+// flash contents are not cached on the host
+static inline void SCB_InvalidateDCache_by_Addr(void* addr, int32_t dsize) {
+  (void) addr;
+  (void) dsize;
+}
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+#endif
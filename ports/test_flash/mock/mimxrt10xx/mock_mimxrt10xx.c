@@ -0,0 +1,86 @@
+#include <stdio.h>
+
+#include "board_api.h"
+#include "romapi_flash.h"
+#include "mock_flash.h"
+
+// ROM API of the FlexSPI NOR driver on a serial NOR model: offsets are relative to the FlexSPI window,
+// each call takes the time of the flash commands it issues (the ROM waits for completion)
+
+FLEXSPI_Type mock_flexspi_regs = { .STS0 = 0xFFFFFFFFUL };
+SRC_Type mock_src_regs;
+
+// FCFB of the image as far as the driver uses it
+flexspi_nor_config_t const qspiflash_config = {
+  .memConfig = { .tag = FLEXSPI_CFG_BLK_TAG },
+  .pageSize = MOCK_NOR_PAGE_SIZE,
+  .sectorSize = MOCK_NOR_SECTOR_SIZE,
+  .blockSize = MOCK_NOR_BLOCK_SIZE,
+};
+
+// linker symbols, only used by the image self copy of board_flash_init()
+uint32_t _fcfb_length[1];
+uint32_t _ivt_origin[1];
+uint32_t _board_boot_length[1];
+
+status_t ROM_FLEXSPI_NorFlash_Init(uint32_t instance, flexspi_nor_config_t* config) {
+  return kStatus_Success;
+}
+
+status_t ROM_FLEXSPI_NorFlash_EraseSector(uint32_t instance, flexspi_nor_config_t* config, uint32_t address) {
+  if (address % MOCK_NOR_SECTOR_SIZE) return kStatus_InvalidArgument;
+  mock_nor_erase(mock_flash_base() + address, MOCK_NOR_SECTOR_SIZE);
+  return kStatus_Success;
+}
+
+status_t ROM_FLEXSPI_NorFlash_EraseBlock(uint32_t instance, flexspi_nor_config_t* config, uint32_t address) {
+  if (address % MOCK_NOR_BLOCK_SIZE) return kStatus_InvalidArgument;
+  mock_nor_erase(mock_flash_base() + address, MOCK_NOR_BLOCK_SIZE);
+  return kStatus_Success;
+}
+
+// block erase for aligned 64KB blocks within range, sector erase otherwise (as romapi_flash.c)
+status_t ROM_FLEXSPI_NorFlash_Erase(uint32_t instance, flexspi_nor_config_t* config, uint32_t start, uint32_t length) {
+  if ((start | length) % MOCK_NOR_SECTOR_SIZE) return kStatus_InvalidArgument;
+  mock_nor_erase(mock_flash_base() + start, length);
+  return kStatus_Success;
+}
+
+status_t ROM_FLEXSPI_NorFlash_EraseAll(uint32_t instance, flexspi_nor_config_t* config) {
+  uint32_t const us = (uint32_t) (((uint64_t) MOCK_NOR_CHIP_US_PER_MB * mock_flash_size()) >> 20);
+  mock_flash_erase(mock_flash_base(), mock_flash_size(), us);
+  mock_time_advance(us);
+  return kStatus_Success;
+}
+
+status_t ROM_FLEXSPI_NorFlash_ProgramPage(uint32_t instance, flexspi_nor_config_t* config, uint32_t dstAddr,
+                                          const uint32_t* src) {
+  if (dstAddr % config->pageSize) return kStatus_InvalidArgument;
+  mock_nor_program(mock_flash_base() + dstAddr, src, config->pageSize);
+  return kStatus_Success;
+}
+
+//--------------------------------------------------------------------+
+// Port
+//--------------------------------------------------------------------+
+
+// board_flash_init() is not run: it checks and copies the running image (FCFB, IVT) which only exists
+// on the target. The driver works on the blank flash without it
+bool mock_port_init(void) {
+#ifdef FlexSPI2_AMBA_BASE
+  uint32_t const base = FlexSPI2_AMBA_BASE;
+#else
+  uint32_t const base = FlexSPI_AMBA_BASE;
+#endif
+
+  if (BOARD_FLASH_APP_START < base || BOARD_FLASH_APP_START - base >= BOARD_FLASH_SIZE) {
+    printf("application at 0x%08X is not in flash at 0x%08X\n", (uint32_t) BOARD_FLASH_APP_START, base);
+    return false;
+  }
+
+  return mock_flash_init(base, BOARD_FLASH_SIZE, true);
+}
+
+char const* mock_port_name(void) {
+  return "mimxrt10xx";
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "mock_flash.h"
+
+static uint8_t* _mem = NULL;
+static uint32_t _base = 0;
+static uint32_t _size = 0;
+
+static mock_flash_stats_t _stats;
+static uint64_t _now_us = 0;
+
+bool mock_flash_init(uint32_t base, uint32_t size, bool fixed) {
+  if (fixed) {
+    // hint only: an existing mapping at base must not be replaced
+    void* ptr = mmap((void*) (uintptr_t) base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return false;
+    if (ptr != (void*) (uintptr_t) base) {
+      munmap(ptr, size);
+      printf("flash at 0x%08X can not be mapped in place\n", base);
+      return false;
+    }
+    _mem = ptr;
+  } else {
+    _mem = malloc(size);
+    if (_mem == NULL) return false;
+  }
+
+  _base = base;
+  _size = size;
+  memset(_mem, 0xff, size);
+  memset(&_stats, 0, sizeof(_stats));
+
+  return true;
+}
+
+uint32_t mock_flash_base(void) { return _base; }
+uint32_t mock_flash_size(void) { return _size; }
+
+uint8_t* mock_flash_ptr(uint32_t addr, uint32_t len) {
+  if (addr < _base || len > _size || addr - _base > _size - len) return NULL;
+  return _mem + (addr - _base);
+}
+
+void mock_flash_erase(uint32_t addr, uint32_t len, uint32_t us) {
+  uint8_t* ptr = mock_flash_ptr(addr, len);
+  if (ptr == NULL) {
+    _stats.errors++;
+    return;
+  }
+
+  memset(ptr, 0xff, len);
+  _stats.erase_count++;
+  _stats.erase_bytes += len;
+  _stats.erase_us += us;
+}
+
+void mock_flash_program(uint32_t addr, void const* data, uint32_t len, uint32_t us) {
+  uint8_t* ptr = mock_flash_ptr(addr, len);
+  if (ptr == NULL) {
+    _stats.errors++;
+    return;
+  }
+
+  uint8_t const* src = (uint8_t const*) data;
+  bool over = false;
+  for (uint32_t i = 0; i < len; i++) {
+    if ((ptr[i] & src[i]) != src[i]) over = true;
+    ptr[i] &= src[i];
+  }
+
+  if (over) _stats.overprograms++;
+  _stats.program_count++;
+  _stats.program_bytes += len;
+  _stats.program_us += us;
+}
+
+void mock_flash_stats(mock_flash_stats_t* stats) {
+  *stats = _stats;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+uint64_t mock_time_us(void) { return _now_us; }
+
+void mock_time_advance(uint64_t us) { _now_us += us; }
+
+//--------------------------------------------------------------------+
+// Serial NOR
+//--------------------------------------------------------------------+
+void mock_nor_erase(uint32_t addr, uint32_t len) {
+  uint32_t const end = addr + len;
+
+  while (addr < end) {
+    uint32_t const offset = addr - _base;
+    if (!(offset % MOCK_NOR_BLOCK_SIZE) && end - addr >= MOCK_NOR_BLOCK_SIZE) {
+      mock_flash_erase(addr, MOCK_NOR_BLOCK_SIZE, MOCK_NOR_BLOCK_US);
+      mock_time_advance(MOCK_NOR_BLOCK_US);
+      addr += MOCK_NOR_BLOCK_SIZE;
+    } else {
+      // partial sector is erased as a whole
+      uint32_t const sector = addr - (offset % MOCK_NOR_SECTOR_SIZE);
+      mock_flash_erase(sector, MOCK_NOR_SECTOR_SIZE, MOCK_NOR_SECTOR_US);
+      mock_time_advance(MOCK_NOR_SECTOR_US);
+      addr = sector + MOCK_NOR_SECTOR_SIZE;
+    }
+  }
+}
+
+void mock_nor_program(uint32_t addr, void const* data, uint32_t len) {
+  uint8_t const* src = (uint8_t const*) data;
+
+  while (len) {
+    uint32_t const page_left = MOCK_NOR_PAGE_SIZE - ((addr - _base) % MOCK_NOR_PAGE_SIZE);
+    uint32_t const count = (len < page_left) ? len : page_left;
+
+    mock_flash_program(addr, src, count, MOCK_NOR_PAGE_US);
+    mock_time_advance(MOCK_NOR_PAGE_US);
+    addr += count;
+    src += count;
+    len -= count;
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef MOCK_FLASH_H
+#define MOCK_FLASH_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//--------------------------------------------------------------------+
+// NOR flash model with virtual clock, shared by the port mocks
+// Contents are kept in host memory: programming only clears bits (1 -> 0), erasing sets an erase unit
+// to 0xFF. Only flash operations take time (not reads or CPU): the port mock advances the virtual
+// clock by their latency, right away or when the driver waits for completion.
+//--------------------------------------------------------------------+
+typedef struct {
+  uint32_t erase_count;
+  uint32_t erase_bytes;
+  uint64_t erase_us;
+  uint32_t program_count;   // program operations (words, pages)
+  uint32_t program_bytes;
+  uint64_t program_us;
+  uint32_t overprograms;    // programs that needed a 0 -> 1 change i.e not erased before
+  uint32_t errors;          // operations outside of flash
+} mock_flash_stats_t;
+
+// Allocate flash of size at base, erased. With fixed the memory is mapped at host address base so
+// that the driver can read it in place (XIP), false if that range is not available
+bool mock_flash_init(uint32_t base, uint32_t size, bool fixed);
+
+uint32_t mock_flash_base(void);
+uint32_t mock_flash_size(void);
+
+// Host pointer of flash address, NULL if [addr, addr+len) is outside of flash
+uint8_t* mock_flash_ptr(uint32_t addr, uint32_t len);
+
+// Erase/program, us of busy time is accounted to the statistics but the clock is not advanced
+void mock_flash_erase(uint32_t addr, uint32_t len, uint32_t us);
+void mock_flash_program(uint32_t addr, void const* data, uint32_t len, uint32_t us);
+
+// Get and clear accumulated statistics
+void mock_flash_stats(mock_flash_stats_t* stats);
+
+// Virtual clock
+uint64_t mock_time_us(void);
+void mock_time_advance(uint64_t us);
+
+//--------------------------------------------------------------------+
+// Serial NOR used by the FlexSPI and esp_partition mocks: typical figures of the datasheet, W25Q class
+// quad part or MX25UM class octal part with CONFIG_ESPTOOLPY_OCT_FLASH
+//--------------------------------------------------------------------+
+#define MOCK_NOR_SECTOR_SIZE    4096
+#define MOCK_NOR_BLOCK_SIZE     (64*1024)
+#define MOCK_NOR_PAGE_SIZE      256
+
+#if defined(CONFIG_ESPTOOLPY_OCT_FLASH) && CONFIG_ESPTOOLPY_OCT_FLASH
+#define MOCK_NOR_SECTOR_US      25000     // 4KB sector erase
+#define MOCK_NOR_BLOCK_US       220000    // 64KB block erase
+#define MOCK_NOR_CHIP_US_PER_MB 6000000   // chip erase, 150s for 256Mb
+#define MOCK_NOR_PAGE_US        150       // page program
+#else
+#define MOCK_NOR_SECTOR_US      45000     // 4KB sector erase
+#define MOCK_NOR_BLOCK_US       150000    // 64KB block erase
+#define MOCK_NOR_CHIP_US_PER_MB 2500000   // chip erase, 40s for 16MB
+#define MOCK_NOR_PAGE_US        400       // page program
+#endif
+
+// Synchronous: clock is advanced by each command
+// Erase [addr, addr+len) sector aligned: 64KB block erase for aligned blocks, sector erase otherwise
+void mock_nor_erase(uint32_t addr, uint32_t len);
+
+// Program with one page program per (partial) page touched
+void mock_nor_program(uint32_t addr, void const* data, uint32_t len);
+
+//--------------------------------------------------------------------+
+// Implemented by mock/<port>/mock_<port>.c
+//--------------------------------------------------------------------+
+
+// Set up flash of the board and run the parts of board_flash_init() that work on the host.
+// False if flash could not be mapped
+bool mock_port_init(void);
+
+char const* mock_port_name(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "board_api.h"
+#include "mock_flash.h"
+
+// Only the HAL paths of the driver are modeled, register level loops would bypass the mock
+#if TINYUF2_FLASH_RAMFUNC || TINYUF2_FLASH_BG_ERASE || TINYUF2_FLASH_VERIFY_CRC
+#error "TINYUF2_FLASH_RAMFUNC, TINYUF2_FLASH_BG_ERASE and TINYUF2_FLASH_VERIFY_CRC are not modeled"
+#endif
+
+FLASH_TypeDef mock_flash_regs = { .CR = FLASH_CR_LOCK };
+CRC_TypeDef mock_crc_regs;
+
+// typical figures of the datasheet (STM32F405/407 DS8626) per parallelism x8, x16, x32 and x64
+static uint32_t const _erase_16k_us[] = { 400000, 300000, 250000, 250000 };
+static uint32_t const _erase_64k_us[] = { 1200000, 700000, 550000, 550000 };
+static uint32_t const _erase_128k_us[] = { 2000000, 1300000, 1000000, 1000000 };
+static uint32_t const _mass_erase_us[] = { 16000000, 11000000, 8000000, 8000000 };
+
+#define PROGRAM_US  16
+
+// end of the operation in flight, FLASH_SR_BSY while the clock has not reached it
+static uint64_t _busy_until = 0;
+
+static uint64_t _ob_wrp = 0xfff;
+
+// sector layout of each 1MB bank: 4x 16KB, 64KB, 7x 128KB
+static bool sector_info(uint32_t sector, uint32_t* addr, uint32_t* size) {
+  uint32_t const bank = sector / 12;
+  uint32_t const index = sector % 12;
+  uint32_t const bank_addr = 0x08000000UL + bank * 0x100000UL;
+
+  if (index < 4) {
+    *addr = bank_addr + index * 0x4000;
+    *size = 0x4000;
+  } else if (index == 4) {
+    *addr = bank_addr + 0x10000;
+    *size = 0x10000;
+  } else {
+    *addr = bank_addr + (index - 4) * 0x20000;
+    *size = 0x20000;
+  }
+
+  return *addr + *size <= 0x08000000UL + BOARD_FLASH_SIZE;
+}
+
+static uint32_t erase_us(uint32_t size, uint8_t range) {
+  range &= 3;
+  return (size == 0x4000) ? _erase_16k_us[range] : (size == 0x10000) ? _erase_64k_us[range] : _erase_128k_us[range];
+}
+
+static bool is_locked(void) {
+  return (FLASH->CR & FLASH_CR_LOCK) != 0;
+}
+
+static void start_operation(uint32_t us) {
+  _busy_until = mock_time_us() + us;
+  FLASH->SR |= FLASH_SR_BSY;
+}
+
+//--------------------------------------------------------------------+
+// HAL
+//--------------------------------------------------------------------+
+uint32_t HAL_GetTick(void) {
+  return (uint32_t) (mock_time_us() / 1000);
+}
+
+void HAL_Delay(uint32_t Delay) {
+  mock_time_advance((uint64_t) Delay * 1000);
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+  FLASH->CR &= ~FLASH_CR_LOCK;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+  FLASH->CR |= FLASH_CR_LOCK;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef FLASH_WaitForLastOperation(uint32_t Timeout) {
+  uint64_t const now = mock_time_us();
+
+  if (_busy_until > now) {
+    if (_busy_until - now > (uint64_t) Timeout * 1000) {
+      mock_time_advance((uint64_t) Timeout * 1000);
+      return HAL_TIMEOUT;
+    }
+    mock_time_advance(_busy_until - now);
+  }
+
+  FLASH->SR &= ~FLASH_SR_BSY;
+  return HAL_OK;
+}
+
+// Synchronous as in the HAL: waits for the previous operation and for completion
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+  HAL_StatusTypeDef status = FLASH_WaitForLastOperation(50000);
+  if (status != HAL_OK) return status;
+
+  if (is_locked()) {
+    FLASH->SR |= FLASH_SR_WRPERR;
+    return HAL_ERROR;
+  }
+
+  uint32_t const len = 1UL << (TypeProgram & 3);
+  if (Address & (len - 1) || !mock_flash_ptr(Address, len)) {
+    FLASH->SR |= FLASH_SR_PGAERR;
+    return HAL_ERROR;
+  }
+
+  mock_flash_program(Address, &Data, len, PROGRAM_US);
+  start_operation(PROGRAM_US);
+
+  return FLASH_WaitForLastOperation(50000);
+}
+
+// Only starts the erase, as the HAL function does
+void FLASH_Erase_Sector(uint32_t Sector, uint8_t VoltageRange) {
+  uint32_t addr, size;
+  if (is_locked() || !sector_info(Sector, &addr, &size)) {
+    FLASH->SR |= FLASH_SR_WRPERR;
+    return;
+  }
+
+  uint32_t const us = erase_us(size, VoltageRange);
+  mock_flash_erase(addr, size, us);
+  start_operation(us);
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* pEraseInit, uint32_t* SectorError) {
+  HAL_StatusTypeDef status = FLASH_WaitForLastOperation(50000);
+  if (status != HAL_OK) return status;
+
+  *SectorError = 0xFFFFFFFFU;
+
+  if (pEraseInit->TypeErase == FLASH_TYPEERASE_MASSERASE) {
+    if (is_locked()) return HAL_ERROR;
+
+    uint32_t const first = (pEraseInit->Banks == FLASH_BANK_1) ? 0 : 12;
+    uint32_t addr, size;
+    (void) sector_info(first, &addr, &size);
+
+    uint32_t const bank_size = (BOARD_FLASH_SIZE > 0x100000UL) ? 0x100000UL : BOARD_FLASH_SIZE;
+    uint32_t const us = _mass_erase_us[pEraseInit->VoltageRange & 3];
+    mock_flash_erase(addr, bank_size, us);
+    start_operation(us);
+
+    return FLASH_WaitForLastOperation(50000);
+  }
+
+  for (uint32_t s = pEraseInit->Sector; s < pEraseInit->Sector + pEraseInit->NbSectors; s++) {
+    FLASH_Erase_Sector(s, (uint8_t) pEraseInit->VoltageRange);
+    status = FLASH_WaitForLastOperation(50000);
+    if (status != HAL_OK) {
+      *SectorError = s;
+      return status;
+    }
+  }
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_OB_Unlock(void) { return HAL_OK; }
+HAL_StatusTypeDef HAL_FLASH_OB_Lock(void) { return HAL_OK; }
+HAL_StatusTypeDef HAL_FLASH_OB_Launch(void) { return HAL_OK; }
+
+void HAL_FLASHEx_OBGetConfig(FLASH_OBProgramInitTypeDef* pOBInit) {
+  pOBInit->WRPSector = (uint32_t) _ob_wrp;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_OBProgram(FLASH_OBProgramInitTypeDef* pOBInit) {
+  // sector is protected if its bit is cleared
+  if (pOBInit->WRPState == OB_WRPSTATE_ENABLE) {
+    _ob_wrp &= ~pOBInit->WRPSector;
+  } else {
+    _ob_wrp |= pOBInit->WRPSector;
+  }
+  return HAL_OK;
+}
+
+void NVIC_SystemReset(void) {
+  printf("NVIC_SystemReset()\n");
+  exit(1);
+}
+
+//--------------------------------------------------------------------+
+// Port
+//--------------------------------------------------------------------+
+bool mock_port_init(void) {
+  if (!mock_flash_init(BOARD_FLASH_ADDR_ZERO, BOARD_FLASH_SIZE, true)) return false;
+
+  board_flash_init();
+  return true;
+}
+
+char const* mock_port_name(void) {
+  return "stm32f4";
+}
@@ -0,0 +1,77 @@
+#ifndef MOCK_STM32F4XX_H
+#define MOCK_STM32F4XX_H
+
+// Host stand-in of the CMSIS device header: only what ports/stm32f4/board_flash.c uses. Registers are
+// plain memory, flash operations go through the HAL mock (stm32f4xx_hal_flash.h)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define __IO volatile
+
+typedef struct {
+  __IO uint32_t ACR;
+  __IO uint32_t KEYR;
+  __IO uint32_t OPTKEYR;
+  __IO uint32_t SR;
+  __IO uint32_t CR;
+  __IO uint32_t OPTCR;
+  __IO uint32_t OPTCR1;
+} FLASH_TypeDef;
+
+typedef struct {
+  __IO uint32_t DR;
+  __IO uint8_t  IDR;
+  uint8_t       RESERVED0;
+  uint16_t      RESERVED1;
+  __IO uint32_t CR;
+} CRC_TypeDef;
+
+extern FLASH_TypeDef mock_flash_regs;
+extern CRC_TypeDef mock_crc_regs;
+
+#define FLASH   (&mock_flash_regs)
+#define CRC     (&mock_crc_regs)
+
+#define FLASH_ACR_DCEN      (1UL << 10)
+#define FLASH_ACR_DCRST     (1UL << 12)
+
+#define FLASH_SR_EOP        (1UL << 0)
+#define FLASH_SR_OPERR      (1UL << 1)
+#define FLASH_SR_WRPERR     (1UL << 4)
+#define FLASH_SR_PGAERR     (1UL << 5)
+#define FLASH_SR_PGPERR     (1UL << 6)
+#define FLASH_SR_PGSERR     (1UL << 7)
+#define FLASH_SR_BSY        (1UL << 16)
+
+#define FLASH_CR_PG         (1UL << 0)
+#define FLASH_CR_SER        (1UL << 1)
+#define FLASH_CR_MER        (1UL << 2)
+#define FLASH_CR_SNB_Pos    3U
+#define FLASH_CR_SNB        (0x1FUL << FLASH_CR_SNB_Pos)
+#define FLASH_CR_PSIZE      (3UL << 8)
+#define FLASH_CR_STRT       (1UL << 16)
+#define FLASH_CR_LOCK       (1UL << 31)
+
+#define CRC_CR_RESET        (1UL << 0)
+
+#define SET_BIT(REG, BIT)     ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)   ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)    ((REG) & (BIT))
+
+static inline uint32_t __RBIT(uint32_t value) {
+  uint32_t result = 0;
+  for (uint32_t i = 0; i < 32; i++) {
+    result = (result << 1) | (value & 1);
+    value >>= 1;
+  }
+  return result;
+}
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+void NVIC_SystemReset(void);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef MOCK_STM32F4XX_HAL_FLASH_H
+#define MOCK_STM32F4XX_HAL_FLASH_H
+
+// Timed mock of the HAL flash (and flash_ex) driver, implemented by mock_stm32f4.c. Erase only starts
+// the operation like the HAL does, FLASH_WaitForLastOperation() waits for it on the virtual clock
+
+#include "stm32f4xx.h"
+
+typedef enum {
+  HAL_OK      = 0x00U,
+  HAL_ERROR   = 0x01U,
+  HAL_BUSY    = 0x02U,
+  HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef struct {
+  uint32_t TypeErase;
+  uint32_t Banks;
+  uint32_t Sector;
+  uint32_t NbSectors;
+  uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+typedef struct {
+  uint32_t OptionType;
+  uint32_t WRPState;
+  uint32_t WRPSector;
+  uint32_t Banks;
+  uint32_t RDPLevel;
+  uint32_t BORLevel;
+  uint8_t  USERConfig;
+} FLASH_OBProgramInitTypeDef;
+
+#define FLASH_VOLTAGE_RANGE_1       0x00U   // 1.8-2.1V, x8
+#define FLASH_VOLTAGE_RANGE_2       0x01U   // 2.1-2.7V, x16
+#define FLASH_VOLTAGE_RANGE_3       0x02U   // 2.7-3.6V, x32
+#define FLASH_VOLTAGE_RANGE_4       0x03U   // 2.7-3.6V + Vpp, x64
+
+#define FLASH_TYPEPROGRAM_BYTE      0x00U
+#define FLASH_TYPEPROGRAM_HALFWORD  0x01U
+#define FLASH_TYPEPROGRAM_WORD      0x02U
+#define FLASH_TYPEPROGRAM_DOUBLEWORD 0x03U
+
+#define FLASH_TYPEERASE_SECTORS     0x00U
+#define FLASH_TYPEERASE_MASSERASE   0x01U
+
+#define FLASH_PSIZE_WORD            0x00000200U
+
+#define FLASH_FLAG_EOP              FLASH_SR_EOP
+#define FLASH_FLAG_OPERR            FLASH_SR_OPERR
+#define FLASH_FLAG_WRPERR           FLASH_SR_WRPERR
+#define FLASH_FLAG_PGAERR           FLASH_SR_PGAERR
+#define FLASH_FLAG_PGPERR           FLASH_SR_PGPERR
+#define FLASH_FLAG_PGSERR           FLASH_SR_PGSERR
+
+#define OPTIONBYTE_WRP              0x01U
+#define OB_WRPSTATE_DISABLE         0x00U
+#define OB_WRPSTATE_ENABLE          0x01U
+
+#define FLASH_BANK_1                1U
+
+// dual bank parts, bank 2 starts at sector 12
+#if defined(STM32F427xx) || defined(STM32F437xx) || defined(STM32F429xx) || defined(STM32F439xx) || \
+    defined(STM32F469xx) || defined(STM32F479xx)
+#define FLASH_BANK_2                2U
+#define FLASH_SECTOR_12             12U
+#endif
+
+#define __HAL_FLASH_DATA_CACHE_DISABLE()  CLEAR_BIT(FLASH->ACR, FLASH_ACR_DCEN)
+#define __HAL_FLASH_DATA_CACHE_ENABLE()   SET_BIT(FLASH->ACR, FLASH_ACR_DCEN)
+#define __HAL_FLASH_DATA_CACHE_RESET()    do {} while (0)
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* pEraseInit, uint32_t* SectorError);
+void FLASH_Erase_Sector(uint32_t Sector, uint8_t VoltageRange);
+HAL_StatusTypeDef FLASH_WaitForLastOperation(uint32_t Timeout);
+
+HAL_StatusTypeDef HAL_FLASH_OB_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_OB_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_OB_Launch(void);
+void HAL_FLASHEx_OBGetConfig(FLASH_OBProgramInitTypeDef* pOBInit);
+HAL_StatusTypeDef HAL_FLASHEx_OBProgram(FLASH_OBProgramInitTypeDef* pOBInit);
+
+// stm32f4xx_hal.h, tick is the virtual clock in ms
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+#endif
@@ -0,0 +1 @@
+// Included by ports/stm32f4/stm32f4xx_hal_conf.h, not used by the flash driver
@@ -0,0 +1,2 @@
+// Included by ports/stm32f4/stm32f4xx_hal_conf.h, CRC unit clock only
+#define __HAL_RCC_CRC_CLK_ENABLE()  do {} while (0)
@@ -0,0 +1,480 @@
+#include "boards.h"
+#include <inttypes.h>
+#include <time.h>
+
+// Host benchmark for GhostFAT read/write paths.
+//
+// Times uf2_read_block() / uf2_read_blocks() across the whole volume and uf2_write_block() over
+// UF2 streams using the flash stub from boards.c. Exits non-zero if a stream is not accepted as
+// expected, if ghostfat allocates heap memory, or if an optional limit is exceeded:
+//
+//   bench-<board>.elf [-n passes] [-r max_read_ns] [-w max_write_ns] [-f flash_profile] [-u file.uf2]
+//                     [-t trace.txt]
+//
+// Streams are synthetic unless a UF2 file is given. With a flash profile, simulated erase/program
+// time of each stream is reported as well. A write pattern captured from a host by
+// tools/msc_bench.py (TINYUF2_WRITE_TRACE) is replayed as an additional stream, it should be used
+// with the UF2 file that was copied when capturing. Every stream starts from the same previous flash
+// contents, each pass is a new flashing session on top of the previous one.
+
+#define SECTOR_SIZE     CFG_UF2_SECTOR_SIZE
+
+// number of sectors per uf2_read_blocks() call, matching a typical MSC endpoint buffer
+#define READ_MULTI_SIZE 4096
+#define READ_MULTI_COUNT ((READ_MULTI_SIZE < SECTOR_SIZE) ? 1 : (READ_MULTI_SIZE / SECTOR_SIZE))
+
+// synthetic image size, capped to keep huge boards quick
+#define STREAM_PAYLOAD  256
+#define STREAM_MAX      16384
+
+// shuffled stream is reordered within windows, so that CFG_UF2_WRITTEN_GROUPS partially written groups
+// are enough (hosts write mostly in order). Random stream goes beyond them: blocks refused are sent
+// again as by a host copying the file again
+#define SHUFFLE_WINDOW  (WRITTEN_GROUP_SIZE * CFG_UF2_WRITTEN_GROUPS / 2)
+
+//--------------------------------------------------------------------+
+// Heap allocation counter (linked with -Wl,--wrap)
+//--------------------------------------------------------------------+
+static uint32_t _alloc_count = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    _alloc_count++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    _alloc_count++;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    _alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+//--------------------------------------------------------------------+
+// Helper
+//--------------------------------------------------------------------+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+// deterministic so runs are comparable
+static uint32_t _rand_state = 0x12345678;
+static uint32_t next_rand(void) {
+    _rand_state = _rand_state * 1103515245u + 12345u;
+    return _rand_state >> 8;
+}
+
+typedef struct {
+    char const* name;
+    uint32_t count;   // sectors or blocks processed
+    uint64_t ns;
+    uint32_t allocs;
+} BenchResult;
+
+// average time per item in 1/10 ns
+static uint64_t result_avg(BenchResult const* r) {
+    return r->count ? (r->ns * 10) / r->count : 0;
+}
+
+static void print_result(BenchResult const* r, char const* unit) {
+    uint64_t const avg = result_avg(r);
+    printf("%-16s %10" PRIu32 " %-8s %8" PRIu64 ".%" PRIu64 " ns/%s %6" PRIu32 " allocs\n",
+           r->name, r->count, unit, avg / 10, avg % 10, unit, r->allocs);
+}
+
+//--------------------------------------------------------------------+
+// Read
+//--------------------------------------------------------------------+
+static uint8_t _read_buf[READ_MULTI_COUNT * SECTOR_SIZE];
+
+static BenchResult bench_read_single(uint32_t passes) {
+    BenchResult r = { "read_block", 0, 0, 0 };
+    uint32_t const allocs = _alloc_count;
+    uint64_t const start = now_ns();
+
+    for (uint32_t p = 0; p < passes; p++) {
+        for (uint32_t i = 0; i < UF2_NUM_SECTORS; i++) {
+            uf2_read_block(i, _read_buf);
+        }
+        r.count += UF2_NUM_SECTORS;
+    }
+
+    r.ns = now_ns() - start;
+    r.allocs = _alloc_count - allocs;
+    return r;
+}
+
+static BenchResult bench_read_multi(uint32_t passes) {
+    BenchResult r = { "read_blocks", 0, 0, 0 };
+    uint32_t const allocs = _alloc_count;
+    uint64_t const start = now_ns();
+
+    for (uint32_t p = 0; p < passes; p++) {
+        for (uint32_t i = 0; i < UF2_NUM_SECTORS; i += READ_MULTI_COUNT) {
+            uint32_t const count = (UF2_NUM_SECTORS - i < READ_MULTI_COUNT) ? (UF2_NUM_SECTORS - i) : READ_MULTI_COUNT;
+            uf2_read_blocks(i, count, _read_buf);
+        }
+        r.count += UF2_NUM_SECTORS;
+    }
+
+    r.ns = now_ns() - start;
+    r.allocs = _alloc_count - allocs;
+    return r;
+}
+
+//--------------------------------------------------------------------+
+// Write
+//--------------------------------------------------------------------+
+typedef enum {
+    STREAM_SEQUENTIAL,
+    STREAM_REVERSED,
+    STREAM_SHUFFLED,
+    STREAM_RANDOM,     // whole image in random order
+    STREAM_DUPLICATED, // whole image sent twice, as some hosts do
+    STREAM_TRACE,      // order captured from a host, if given
+} StreamType;
+
+static char const* const _stream_name[] = {
+    [STREAM_SEQUENTIAL] = "write_sequential",
+    [STREAM_REVERSED  ] = "write_reversed",
+    [STREAM_SHUFFLED  ] = "write_shuffled",
+    [STREAM_RANDOM    ] = "write_random",
+    [STREAM_DUPLICATED] = "write_duplicated",
+    [STREAM_TRACE     ] = "write_trace",
+};
+
+// order entry of a non-uf2 block (host filesystem metadata) in a captured trace
+#define TRACE_NOT_UF2   UINT32_MAX
+
+static uint32_t* _trace = NULL;
+static uint32_t _trace_count = 0;
+static UF2_Block _non_uf2_block;
+
+static WriteState _wr_state;
+
+// blocks of the image to flash, synthetic or loaded from file
+static UF2_Block* _image = NULL;
+static uint32_t _image_count = 0;
+static char const* _sim_profile = "none";
+
+static void make_image(uint32_t num) {
+    uint32_t const base = sim_flash_base() + BOARD_FLASH_APP_START;
+
+    for (uint32_t i = 0; i < num; i++) {
+        UF2_Block* bl = &_image[i];
+        memset(bl, 0, sizeof(UF2_Block));
+        bl->magicStart0 = UF2_MAGIC_START0;
+        bl->magicStart1 = UF2_MAGIC_START1;
+        bl->magicEnd    = UF2_MAGIC_END;
+        bl->flags       = UF2_FLAG_FAMILYID;
+        bl->targetAddr  = base + i * STREAM_PAYLOAD;
+        bl->payloadSize = STREAM_PAYLOAD;
+        bl->blockNo     = i;
+        bl->numBlocks   = num;
+        bl->familyID    = BOARD_UF2_FAMILY_ID;
+        for (uint32_t k = 0; k < STREAM_PAYLOAD; k++) {
+            bl->data[k] = (uint8_t) next_rand();
+        }
+    }
+    _image_count = num;
+}
+
+static bool load_image(char const* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("cannot open %s\n", path);
+        return false;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    long const size = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    uint32_t const num = (uint32_t) (size / UF2_BLOCK_SIZE);
+    _image = malloc(num * sizeof(UF2_Block));
+    bool ok = (_image != NULL) && (num > 0) && (fread(_image, UF2_BLOCK_SIZE, num, file) == num);
+    fclose(file);
+
+    // family check is not under test, image is accepted as if it was built for this board
+    for (uint32_t i = 0; ok && i < num; i++) {
+        if (_image[i].flags & UF2_FLAG_FAMILYID) {
+            _image[i].familyID = BOARD_UF2_FAMILY_ID;
+        }
+    }
+
+    if (!ok) {
+        printf("cannot read %s\n", path);
+        return false;
+    }
+    _image_count = num;
+    return true;
+}
+
+// Trace lines are "block uf2_block count flags" (uf2_block -1 for non-uf2 blocks), # starts a comment
+static bool load_trace(char const* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("cannot open %s\n", path);
+        return false;
+    }
+
+    char line[128];
+    uint32_t capacity = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        unsigned long block, count, flags;
+        long uf2_block;
+        if (line[0] == '#' || sscanf(line, "%lu %ld %lu %lu", &block, &uf2_block, &count, &flags) != 4) continue;
+
+        if (_trace_count + count > capacity) {
+            capacity = 2 * (_trace_count + count);
+            uint32_t* grown = realloc(_trace, capacity * sizeof(uint32_t));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            _trace = grown;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t const idx = (uf2_block < 0) ? TRACE_NOT_UF2 : (uint32_t) uf2_block + i;
+            if (idx != TRACE_NOT_UF2 && idx >= _image_count) {
+                printf("%s: uf2 block %" PRIu32 " is not in image\n", path, idx);
+                ok = false;
+                break;
+            }
+            _trace[_trace_count++] = idx;
+        }
+    }
+    fclose(file);
+
+    if (ok && !_trace_count) {
+        printf("%s: no runs\n", path);
+        ok = false;
+    }
+    return ok;
+}
+
+static uint32_t synthetic_num_blocks(void) {
+    uint32_t const flash_size = sim_flash_enabled() ? (sim_flash_size() - BOARD_FLASH_APP_START) : CFG_UF2_FLASH_SIZE;
+    uint32_t n = flash_size / STREAM_PAYLOAD;
+    if (n > STREAM_MAX) n = STREAM_MAX;
+    if (n > MAX_BLOCKS - 1) n = MAX_BLOCKS - 1;
+    return n;
+}
+
+static uint32_t make_order(uint32_t* order, uint32_t num, StreamType type) {
+    if (type == STREAM_TRACE) {
+        memcpy(order, _trace, _trace_count * sizeof(uint32_t));
+        return _trace_count;
+    }
+
+    uint32_t const total = (type == STREAM_DUPLICATED) ? 2 * num : num;
+    for (uint32_t i = 0; i < total; i++) {
+        order[i] = (type == STREAM_REVERSED) ? (num - 1 - i) : (i % num);
+    }
+
+    if (type == STREAM_SHUFFLED || type == STREAM_RANDOM) {
+        uint32_t const window = (type == STREAM_SHUFFLED) ? SHUFFLE_WINDOW : num;
+        for (uint32_t base = 0; base < num; base += window) {
+            uint32_t const count = (num - base < window) ? (num - base) : window;
+            for (uint32_t i = count - 1; i > 0; i--) {
+                uint32_t const j = next_rand() % (i + 1);
+                uint32_t const tmp = order[base + i];
+                order[base + i] = order[base + j];
+                order[base + j] = tmp;
+            }
+        }
+    }
+
+    return total;
+}
+
+static void print_sim(sim_flash_stats_t const* st) {
+    printf("%-16s flash %8" PRIu64 " ms: %5" PRIu32 " erases %8" PRIu64 " ms, %7" PRIu32 " KB program %8" PRIu64 " ms\n",
+           "", (st->erase_us + st->program_us) / 1000, st->erase_count, st->erase_us / 1000,
+           st->program_bytes / 1024, st->program_us / 1000);
+}
+
+static bool bench_write(StreamType type, uint32_t* order, uint32_t* retry, uint32_t passes, BenchResult* r) {
+    uint32_t const num = _image_count;
+    uint32_t const total = make_order(order, num, type);
+
+    r->name = _stream_name[type];
+    r->count = 0;
+    r->ns = 0;
+    r->allocs = 0;
+
+    // same previous contents for every stream
+    sim_flash_select(_sim_profile);
+
+    for (uint32_t p = 0; p < passes; p++) {
+        memset(&_wr_state, 0, sizeof(_wr_state));
+        sim_flash_session();
+
+        uint32_t const allocs = _alloc_count;
+        uint64_t const start = now_ns();
+
+        uint32_t const* list = order;
+        uint32_t count = total;
+
+        // each round sends the blocks refused by the previous one, which completes all groups it had
+        for (uint32_t round = 0; count; round++) {
+            uint32_t refused = 0;
+
+            for (uint32_t i = 0; i < count; i++) {
+                if (list[i] == TRACE_NOT_UF2) {
+                    (void) uf2_write_block(0, (uint8_t*) &_non_uf2_block, &_wr_state);
+                } else if (uf2_write_block(0, (uint8_t*) &_image[list[i]], &_wr_state) != UF2_BLOCK_SIZE) {
+                    printf("%s: block %" PRIu32 " rejected\n", r->name, list[i]);
+                    return false;
+                } else if (_wr_state.untracked) {
+                    _wr_state.untracked = false;
+                    retry[refused++] = list[i];
+                }
+            }
+
+            r->count += count;
+            list = retry;
+            count = refused;
+
+            if (round > num) {
+                printf("%s: %" PRIu32 " blocks still refused\n", r->name, count);
+                return false;
+            }
+        }
+
+        r->ns += now_ns() - start;
+        r->allocs += _alloc_count - allocs;
+
+        if (_wr_state.numBlocks != _image[0].numBlocks || _wr_state.numWritten != num) {
+            printf("%s: written %" PRIu32 " of %" PRIu32 " blocks\n", r->name, _wr_state.numWritten, num);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------+
+// Main
+//--------------------------------------------------------------------+
+int main(int argc, char** argv) {
+    uint32_t passes = 1;
+    uint32_t max_read_ns = 0;
+    uint32_t max_write_ns = 0;
+    char const* uf2_file = NULL;
+    char const* trace_file = NULL;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-n")) {
+            passes = (uint32_t) strtoul(argv[i + 1], NULL, 0);
+        } else if (!strcmp(argv[i], "-r")) {
+            max_read_ns = (uint32_t) strtoul(argv[i + 1], NULL, 0);
+        } else if (!strcmp(argv[i], "-w")) {
+            max_write_ns = (uint32_t) strtoul(argv[i + 1], NULL, 0);
+        } else if (!strcmp(argv[i], "-f")) {
+            _sim_profile = argv[i + 1];
+        } else if (!strcmp(argv[i], "-u")) {
+            uf2_file = argv[i + 1];
+        } else if (!strcmp(argv[i], "-t")) {
+            trace_file = argv[i + 1];
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (passes == 0) passes = 1;
+
+    if (!sim_flash_select(_sim_profile)) {
+        printf("unknown flash profile %s, available: ", _sim_profile);
+        sim_flash_list();
+        return 1;
+    }
+
+    if (uf2_file) {
+        if (!load_image(uf2_file)) return 1;
+    } else {
+        uint32_t const num = synthetic_num_blocks();
+        _image = malloc(num * sizeof(UF2_Block));
+        if (!_image) {
+            printf("out of memory\n");
+            return 1;
+        }
+        make_image(num);
+    }
+
+    if (trace_file && !load_trace(trace_file)) return 1;
+
+    uint32_t const order_max = (_trace_count > 2 * _image_count) ? _trace_count : 2 * _image_count;
+    // refused blocks of the random stream are collected after the order
+    uint32_t* order = malloc((order_max + _image_count) * sizeof(uint32_t));
+    if (!order) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    uint32_t const init_allocs = _alloc_count;
+    uf2_init();
+    bool ok = (_alloc_count == init_allocs);
+
+    printf("board %s: %" PRIu32 " sectors of %u bytes, %" PRIu32 " blocks per stream, %" PRIu32 " pass(es), flash %s\n",
+           UF2_BOARD_ID, (uint32_t) UF2_NUM_SECTORS, SECTOR_SIZE, _image_count, passes, _sim_profile);
+
+    BenchResult results[2 + 5];
+    memset(results, 0, sizeof(results));
+    results[0] = bench_read_single(passes);
+    results[1] = bench_read_multi(passes);
+    print_result(&results[0], "sector");
+    print_result(&results[1], "sector");
+
+    StreamType const last = trace_file ? STREAM_TRACE : STREAM_DUPLICATED;
+    for (StreamType t = STREAM_SEQUENTIAL; t <= last; t++) {
+        BenchResult* r = &results[2 + t];
+        if (!bench_write(t, order, order + order_max, passes, r)) {
+            ok = false;
+            continue;
+        }
+        print_result(r, "block");
+
+        if (sim_flash_enabled()) {
+            sim_flash_stats_t st;
+            sim_flash_stats(&st);
+            print_sim(&st);
+            if (st.errors) {
+                printf("%s: %" PRIu32 " writes outside of simulated flash\n", r->name, st.errors);
+                ok = false;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+        BenchResult const* r = &results[i];
+        uint64_t const avg = result_avg(r);
+        uint32_t const limit = (i < 2) ? max_read_ns : max_write_ns;
+
+        if (r->allocs) {
+            printf("%s: unexpected heap allocation\n", r->name);
+            ok = false;
+        }
+        if (limit && avg > (uint64_t) limit * 10) {
+            printf("%s: %" PRIu64 ".%" PRIu64 " ns exceeds limit %" PRIu32 " ns\n", r->name, avg / 10, avg % 10, limit);
+            ok = false;
+        }
+    }
+
+    free(_image);
+    free(_trace);
+    free(order);
+    sim_flash_select("none");
+
+    printf("%s: Ghostfat benchmark\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -26,8 +26,13 @@
 //------------- Flash -------------//
 uint32_t board_flash_size(void) { return CFG_UF2_FLASH_SIZE; }
 
-// not supported
+static bool sim_flash_write(uint32_t addr, void const* data, uint32_t len);
+static void sim_flash_read(uint32_t addr, void* buffer, uint32_t len);
+
+// only supported with flash simulator
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
+  if (sim_flash_enabled()) return sim_flash_write(addr, data, len);
+
   (void) addr;
   (void) data;
   (void) len;
@@ -43,6 +48,10 @@ void board_self_update(const uint8_t* bootloader_bin, uint32_t bootloader_len) {
 // not supported
 void board_flash_flush(void) {}
 
+void board_flash_session_reset(void) {
+  sim_flash_session();
+}
+
 // not supported
 bool board_flash_protect_bootloader(bool protect) {
   (void) protect;
@@ -51,10 +60,16 @@ bool board_flash_protect_bootloader(bool protect) {
 
 //------------- Interesting part of flash support for this test -------------//
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
-  if ((addr & 7) != 0) {
-    // TODO - need to copy part of the first eight bytes
+  if (sim_flash_enabled()) {
+    sim_flash_read(addr, buffer, len);
+    return;
+  }
+
+  // word aligned is enough since the address is embedded per 32 bits (dense CURRENT.UF2 uses 476-byte payloads)
+  if ((addr & 3) != 0) {
+    // TODO - need to copy part of the first four bytes
     exit(1); // failure exit
-    addr += 8 - (addr & 7);
+    addr += 4 - (addr & 3);
   }
 
   // EMBED address in each 32 bits of the FLASH
@@ -70,3 +85,177 @@ void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
     currentAddress += incBytes;
   }
 }
+
+//--------------------------------------------------------------------+
+// Flash timing simulator
+//--------------------------------------------------------------------+
+
+// Consecutive erase units of the same size
+typedef struct {
+  uint32_t size;
+  uint32_t count;
+  uint32_t erase_us;
+} sim_flash_region_t;
+
+typedef struct {
+  char const* name;
+  uint32_t base;
+  uint32_t program_unit;    // program granularity (word or page) in bytes
+  uint32_t program_us;      // time to program one unit
+  sim_flash_region_t regions[4];
+} sim_flash_profile_t;
+
+// Typical datasheet figures
+static sim_flash_profile_t const _sim_profiles[] = {
+  // STM32F405/407 1MB, x32 parallelism, same sector table as ports/stm32f4/board_flash.c
+  {
+    .name = "stm32f4", .base = 0x08000000, .program_unit = 4, .program_us = 16,
+    .regions = { { 16*1024, 4, 250000 }, { 64*1024, 1, 550000 }, { 128*1024, 7, 1000000 } }
+  },
+
+  // nRF52840 1MB internal flash, 4KB pages
+  {
+    .name = "nrf52840", .base = 0, .program_unit = 4, .program_us = 41,
+    .regions = { { 4*1024, 256, 85000 } }
+  },
+
+  // W25Q128JV 16MB QSPI: 4KB sector erase, 256 bytes page program
+  {
+    .name = "w25q_4k", .base = 0, .program_unit = 256, .program_us = 400,
+    .regions = { { 4*1024, 4096, 45000 } }
+  },
+
+  // W25Q128JV 16MB QSPI: 64KB block erase, 256 bytes page program
+  {
+    .name = "w25q_64k", .base = 0, .program_unit = 256, .program_us = 400,
+    .regions = { { 64*1024, 256, 150000 } }
+  },
+};
+
+enum { SIM_PROFILE_COUNT = sizeof(_sim_profiles) / sizeof(_sim_profiles[0]) };
+
+static sim_flash_profile_t const* _sim = NULL;
+static uint8_t* _sim_mem = NULL;
+static uint8_t* _sim_erased = NULL; // erase unit already erased in this session
+static uint32_t _sim_size = 0;
+static uint32_t _sim_units = 0;
+static sim_flash_stats_t _sim_stats;
+
+bool sim_flash_select(char const* name) {
+  free(_sim_mem);
+  free(_sim_erased);
+  _sim = NULL;
+  _sim_mem = NULL;
+  _sim_erased = NULL;
+  _sim_size = _sim_units = 0;
+  memset(&_sim_stats, 0, sizeof(_sim_stats));
+
+  if (!strcmp(name, "none")) return true;
+
+  for (uint32_t i = 0; i < SIM_PROFILE_COUNT; i++) {
+    if (!strcmp(name, _sim_profiles[i].name)) {
+      _sim = &_sim_profiles[i];
+    }
+  }
+  if (!_sim) return false;
+
+  for (sim_flash_region_t const* r = _sim->regions; r->count; r++) {
+    _sim_size += r->size * r->count;
+    _sim_units += r->count;
+  }
+
+  // previous contents, so that first session has to erase everything it writes
+  _sim_mem = malloc(_sim_size);
+  _sim_erased = calloc(_sim_units, 1);
+  if (!_sim_mem || !_sim_erased) exit(1);
+  memset(_sim_mem, 0x00, _sim_size);
+
+  return true;
+}
+
+void sim_flash_list(void) {
+  printf("none");
+  for (uint32_t i = 0; i < SIM_PROFILE_COUNT; i++) {
+    printf(" %s", _sim_profiles[i].name);
+  }
+  printf("\n");
+}
+
+bool sim_flash_enabled(void) { return _sim != NULL; }
+uint32_t sim_flash_base(void) { return _sim ? _sim->base : 0; }
+uint32_t sim_flash_size(void) { return _sim_size; }
+
+void sim_flash_session(void) {
+  if (_sim_erased) memset(_sim_erased, 0, _sim_units);
+}
+
+void sim_flash_stats(sim_flash_stats_t* stats) {
+  *stats = _sim_stats;
+  memset(&_sim_stats, 0, sizeof(_sim_stats));
+}
+
+// Erase unit containing offset on its first write in this session, skipped if it is already blank
+static void sim_flash_erase_unit(uint32_t offset) {
+  uint32_t start = 0;
+  uint32_t index = 0;
+
+  for (sim_flash_region_t const* r = _sim->regions; r->count; r++) {
+    if (offset < start + r->size * r->count) {
+      uint32_t const n = (offset - start) / r->size;
+      index += n;
+      start += n * r->size;
+
+      if (_sim_erased[index]) return;
+      _sim_erased[index] = 1;
+
+      for (uint32_t i = 0; i < r->size; i++) {
+        if (_sim_mem[start + i] != 0xff) {
+          memset(_sim_mem + start, 0xff, r->size);
+          _sim_stats.erase_count++;
+          _sim_stats.erase_us += r->erase_us;
+          break;
+        }
+      }
+      return;
+    }
+
+    start += r->size * r->count;
+    index += r->count;
+  }
+}
+
+static bool sim_flash_write(uint32_t addr, void const* data, uint32_t len) {
+  if (addr < _sim->base || addr - _sim->base + len > _sim_size) {
+    _sim_stats.errors++;
+    return false;
+  }
+
+  uint32_t const offset = addr - _sim->base;
+  uint8_t const* src = data;
+
+  // erase units are at least 4KB, checking every 256 bytes covers all units touched
+  for (uint32_t i = 0; i < len; i += 256) {
+    sim_flash_erase_unit(offset + i);
+  }
+  sim_flash_erase_unit(offset + len - 1);
+
+  // NOR flash can only clear bits
+  for (uint32_t i = 0; i < len; i++) {
+    _sim_mem[offset + i] &= src[i];
+  }
+
+  uint32_t const first = offset / _sim->program_unit;
+  uint32_t const last = (offset + len - 1) / _sim->program_unit;
+  _sim_stats.program_bytes += len;
+  _sim_stats.program_us += (uint64_t) (last - first + 1) * _sim->program_us;
+
+  return true;
+}
+
+static void sim_flash_read(uint32_t addr, void* buffer, uint32_t len) {
+  if (addr < _sim->base || addr - _sim->base + len > _sim_size) {
+    memset(buffer, 0xff, len);
+    return;
+  }
+  memcpy(buffer, _sim_mem + addr - _sim->base, len);
+}
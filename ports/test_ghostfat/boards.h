@@ -17,6 +17,36 @@
 // From board_api.h
 #define BOARD_FLASH_APP_START  0
 
+//--------------------------------------------------------------------+
+// Flash timing simulator (boards.c)
+// When a profile is selected, flash contents are kept in RAM and erase/program latencies of the
+// profile are accumulated instead of embedding addresses in read data.
+//--------------------------------------------------------------------+
+typedef struct {
+  uint32_t erase_count;
+  uint64_t erase_us;
+  uint32_t program_bytes;
+  uint64_t program_us;
+  uint32_t errors;        // writes outside of simulated flash
+} sim_flash_stats_t;
+
+// Select profile by name e.g "stm32f4", "w25q_4k", return false if unknown. "none" disables simulator
+bool sim_flash_select(char const* name);
+
+// Print available profile names
+void sim_flash_list(void);
+
+bool sim_flash_enabled(void);
+uint32_t sim_flash_base(void);
+uint32_t sim_flash_size(void);
+
+// Start a new flashing session: every erase unit is erased again (if not blank) on its first write.
+// Contents are kept across sessions so that rewriting the same image can be evaluated.
+void sim_flash_session(void);
+
+// Get and clear accumulated statistics
+void sim_flash_stats(sim_flash_stats_t* stats);
+
 #ifdef __cplusplus
  }
 #endif
@@ -0,0 +1,6 @@
+function(update_board TARGET)
+  target_compile_definitions(${TARGET} PUBLIC
+    CFG_UF2_SECTOR_SIZE=4096
+    CFG_UF2_SECTORS_PER_CLUSTER=1
+    )
+endfunction()
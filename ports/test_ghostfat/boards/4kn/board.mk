@@ -0,0 +1,5 @@
+CFLAGS += \
+  -DCFG_UF2_SECTOR_SIZE=4096 \
+  -DCFG_UF2_SECTORS_PER_CLUSTER=1 \
+  -DCOMPILE_DATE=\"Mar\ 11\ 2020\" \
+  -DCOMPILE_TIME=\"17:35:07\"
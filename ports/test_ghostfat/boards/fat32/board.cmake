@@ -0,0 +1,9 @@
+set(CFG_UF2_FLASH_SIZE 0x2000000)
+
+function(update_board TARGET)
+  target_compile_definitions(${TARGET} PUBLIC
+    CFG_UF2_FAT32=1
+    CFG_UF2_NUM_BLOCKS=0x30000
+    CFG_UF2_SECTORS_PER_CLUSTER=1
+    )
+endfunction()
@@ -0,0 +1,8 @@
+CFG_UF2_FLASH_SIZE = 0x2000000
+CFLAGS += \
+  -DCFG_UF2_FAT32=1 \
+  -DCFG_UF2_NUM_BLOCKS=0x30000 \
+  -DCFG_UF2_SECTORS_PER_CLUSTER=1 \
+  -DCFG_UF2_FLASH_SIZE=0x2000000 \
+  -DCOMPILE_DATE=\"Mar\ 11\ 2020\" \
+  -DCOMPILE_TIME=\"17:35:07\"
@@ -0,0 +1,548 @@
+#include "boards.h"
+#include <inttypes.h>
+#include <endian.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+// Host emulator of the TinyUF2 drive for end-to-end benchmarks with a real host filesystem.
+//
+// The GhostFAT volume is served as a network block device (NBD, fixed newstyle handshake), writes go
+// through uf2_write_block() to the flash stub of boards.c just as the MSC WRITE10 callback would do:
+//
+//   emu-<board>.elf [-p port] [-f flash_profile] [-d 1] [-c connections] [-t trace.txt]
+//
+//   sudo nbd-client -b 512 localhost 10809 /dev/nbd0 && sudo mount /dev/nbd0 /mnt
+//   cp firmware.uf2 /mnt && sync && sudo umount /mnt && sudo nbd-client -d /dev/nbd0
+//
+// Per connection the mount phase (time and sectors read before the first write), sectors read more
+// than once (host cache misses), uf2 blocks written out of order and simulated flash time are
+// reported. With -d 1 every write is delayed by its simulated flash time so that the host sees
+// device latency. The device would reset once the file is complete, the connection is kept instead
+// so that unmount is included. -t saves the write pattern in the format of tools/msc_bench.py
+// --capture, for replay by bench-<board>.elf.
+
+#define SECTOR_SIZE     CFG_UF2_SECTOR_SIZE
+#define DEFAULT_PORT    10809
+
+// largest request accepted, Linux nbd sends at most max_sectors_kb
+#define REQUEST_MAX     (32u * 1024 * 1024)
+
+#define NBD_MAGIC              0x4e42444d41474943ull  // "NBDMAGIC"
+#define NBD_OPTS_MAGIC         0x49484156454f5054ull  // "IHAVEOPT"
+#define NBD_REP_MAGIC          0x0003e889045565a9ull
+#define NBD_REQUEST_MAGIC      0x25609513u
+#define NBD_REPLY_MAGIC        0x67446698u
+
+#define NBD_FLAG_FIXED_NEWSTYLE  (1u << 0)
+#define NBD_FLAG_NO_ZEROES       (1u << 1)
+
+#define NBD_FLAG_HAS_FLAGS       (1u << 0)
+#define NBD_FLAG_SEND_FLUSH      (1u << 2)
+
+enum {
+    NBD_OPT_EXPORT_NAME = 1,
+    NBD_OPT_ABORT       = 2,
+    NBD_OPT_INFO        = 6,
+    NBD_OPT_GO          = 7,
+};
+
+enum {
+    NBD_REP_ACK         = 1,
+    NBD_REP_INFO        = 3,
+    NBD_REP_ERR_UNSUP   = 0x80000001u,
+};
+
+enum {
+    NBD_INFO_EXPORT     = 0,
+    NBD_INFO_BLOCK_SIZE = 3,
+};
+
+enum {
+    NBD_CMD_READ  = 0,
+    NBD_CMD_WRITE = 1,
+    NBD_CMD_DISC  = 2,
+    NBD_CMD_FLUSH = 3,
+};
+
+typedef struct {
+    uint64_t start_ns;       // transmission phase started
+    uint64_t mount_ns;       // first write, 0 while mounting
+    uint32_t mount_sectors;  // sectors read before first write
+    uint64_t first_uf2_ns;   // first uf2 block accepted
+    uint64_t complete_ns;    // all blocks of the file written
+
+    uint32_t read_cmds;
+    uint32_t read_sectors;
+    uint32_t reread_sectors;
+    uint32_t write_cmds;
+    uint32_t uf2_blocks;
+    uint32_t other_blocks;   // host filesystem metadata
+    uint32_t out_of_order;   // uf2 block not following the previous one
+    uint32_t flushes;
+
+    uint32_t last_uf2;
+    sim_flash_stats_t flash;
+} EmuStats;
+
+static char const* _sim_profile = "none";
+static bool _delay = false;
+static FILE* _trace_file = NULL;
+
+static WriteState _wr_state;
+static EmuStats _stats;
+static uint8_t* _read_map = NULL;   // one bit per sector read, for re-read count
+
+static uint8_t* _buf = NULL;
+static uint32_t _buf_size = 0;
+
+// trace run being extended, same rules as trace_block() of msc.c
+static struct {
+    uint32_t block;
+    uint32_t uf2_block;
+    uint32_t count;
+    uint32_t flags;
+} _run;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t since_ms(uint64_t ns) {
+    return ns ? (ns - _stats.start_ns) / 1000000 : 0;
+}
+
+//--------------------------------------------------------------------+
+// Socket I/O
+//--------------------------------------------------------------------+
+static bool recv_all(int fd, void* data, size_t len) {
+    uint8_t* p = data;
+    while (len) {
+        ssize_t const n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static bool send_all(int fd, void const* data, size_t len) {
+    uint8_t const* p = data;
+    while (len) {
+        ssize_t const n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static bool buf_reserve(uint32_t size) {
+    if (size <= _buf_size) return true;
+    uint8_t* grown = realloc(_buf, size);
+    if (!grown) return false;
+    _buf = grown;
+    _buf_size = size;
+    return true;
+}
+
+static void put_be16(uint8_t* p, uint16_t v) { v = htobe16(v); memcpy(p, &v, 2); }
+static void put_be32(uint8_t* p, uint32_t v) { v = htobe32(v); memcpy(p, &v, 4); }
+static void put_be64(uint8_t* p, uint64_t v) { v = htobe64(v); memcpy(p, &v, 8); }
+static uint16_t get_be16(uint8_t const* p) { uint16_t v; memcpy(&v, p, 2); return be16toh(v); }
+static uint32_t get_be32(uint8_t const* p) { uint32_t v; memcpy(&v, p, 4); return be32toh(v); }
+static uint64_t get_be64(uint8_t const* p) { uint64_t v; memcpy(&v, p, 8); return be64toh(v); }
+
+//--------------------------------------------------------------------+
+// Handshake
+//--------------------------------------------------------------------+
+static uint64_t export_size(void) {
+    return (uint64_t) uf2_num_sectors() * SECTOR_SIZE;
+}
+
+static bool send_option_reply(int fd, uint32_t option, uint32_t type, void const* data, uint32_t len) {
+    uint8_t hdr[20];
+    put_be64(hdr, NBD_REP_MAGIC);
+    put_be32(hdr + 8, option);
+    put_be32(hdr + 12, type);
+    put_be32(hdr + 16, len);
+    return send_all(fd, hdr, sizeof(hdr)) && (!len || send_all(fd, data, len));
+}
+
+static bool send_info(int fd, uint32_t option) {
+    uint16_t const tflags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH;
+
+    uint8_t ex[12];
+    put_be16(ex, NBD_INFO_EXPORT);
+    put_be64(ex + 2, export_size());
+    put_be16(ex + 10, tflags);
+
+    // whole sectors only, uf2 blocks are never split across requests
+    uint8_t bs[14];
+    put_be16(bs, NBD_INFO_BLOCK_SIZE);
+    put_be32(bs + 2, SECTOR_SIZE);
+    put_be32(bs + 6, SECTOR_SIZE);
+    put_be32(bs + 10, REQUEST_MAX);
+
+    return send_option_reply(fd, option, NBD_REP_INFO, ex, sizeof(ex)) &&
+           send_option_reply(fd, option, NBD_REP_INFO, bs, sizeof(bs)) &&
+           send_option_reply(fd, option, NBD_REP_ACK, NULL, 0);
+}
+
+// Negotiate export, false if client aborted or failed
+static bool handshake(int fd) {
+    uint8_t hello[18];
+    put_be64(hello, NBD_MAGIC);
+    put_be64(hello + 8, NBD_OPTS_MAGIC);
+    put_be16(hello + 16, NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    if (!send_all(fd, hello, sizeof(hello))) return false;
+
+    uint8_t cflags[4];
+    if (!recv_all(fd, cflags, sizeof(cflags))) return false;
+    bool const no_zeroes = get_be32(cflags) & NBD_FLAG_NO_ZEROES;
+
+    while (1) {
+        uint8_t hdr[16];
+        if (!recv_all(fd, hdr, sizeof(hdr)) || get_be64(hdr) != NBD_OPTS_MAGIC) return false;
+        uint32_t const option = get_be32(hdr + 8);
+        uint32_t const len = get_be32(hdr + 12);
+
+        // export name and info requests are ignored, there is a single export
+        if (len > 4096 || !buf_reserve(len) || !recv_all(fd, _buf, len)) return false;
+
+        switch (option) {
+            case NBD_OPT_EXPORT_NAME: {
+                uint8_t reply[10 + 124] = {0};
+                put_be64(reply, export_size());
+                put_be16(reply + 8, NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH);
+                return send_all(fd, reply, no_zeroes ? 10 : sizeof(reply));
+            }
+
+            case NBD_OPT_INFO:
+            case NBD_OPT_GO:
+                if (!send_info(fd, option)) return false;
+                if (option == NBD_OPT_GO) return true;
+                break;
+
+            case NBD_OPT_ABORT:
+                (void) send_option_reply(fd, option, NBD_REP_ACK, NULL, 0);
+                return false;
+
+            default:
+                if (!send_option_reply(fd, option, NBD_REP_ERR_UNSUP, NULL, 0)) return false;
+                break;
+        }
+    }
+}
+
+//--------------------------------------------------------------------+
+// Device
+//--------------------------------------------------------------------+
+static void trace_flush(void) {
+    if (_trace_file && _run.count) {
+        long const uf2 = (_run.uf2_block == UINT32_MAX) ? -1 : (long) _run.uf2_block;
+        fprintf(_trace_file, "%" PRIu32 " %ld %" PRIu32 " %" PRIu32 "\n", _run.block, uf2, _run.count, _run.flags);
+    }
+    _run.count = 0;
+}
+
+static void trace_block(uint32_t block, uint32_t uf2_block, bool new_cmd) {
+    if (!_trace_file) return;
+
+    bool const next = (uf2_block == UINT32_MAX) ? (_run.uf2_block == UINT32_MAX)
+                                                : (_run.uf2_block != UINT32_MAX && uf2_block == _run.uf2_block + _run.count);
+    if (_run.count && !new_cmd && next && block == _run.block + _run.count && _run.count < UINT16_MAX) {
+        _run.count++;
+        return;
+    }
+
+    trace_flush();
+    _run.block = block;
+    _run.uf2_block = uf2_block;
+    _run.count = 1;
+    _run.flags = new_cmd ? 1 : 0;   // MSC_TRACE_FLAG_CMD
+}
+
+// Account simulated flash time of the last request, optionally making the host wait for it
+static void flash_account(void) {
+    if (!sim_flash_enabled()) return;
+
+    sim_flash_stats_t st;
+    sim_flash_stats(&st);
+    _stats.flash.erase_count += st.erase_count;
+    _stats.flash.erase_us += st.erase_us;
+    _stats.flash.program_bytes += st.program_bytes;
+    _stats.flash.program_us += st.program_us;
+    _stats.flash.errors += st.errors;
+
+    uint64_t const us = st.erase_us + st.program_us;
+    if (_delay && us) {
+        struct timespec ts = { .tv_sec = (time_t) (us / 1000000), .tv_nsec = (long) (us % 1000000) * 1000 };
+        while (nanosleep(&ts, &ts) && errno == EINTR) {}
+    }
+}
+
+static void emu_read(uint32_t lba, uint32_t count) {
+    if (!_stats.mount_ns) _stats.mount_sectors += count;
+    _stats.read_cmds++;
+    _stats.read_sectors += count;
+
+    for (uint32_t i = lba; i < lba + count; i++) {
+        uint8_t const bit = (uint8_t) (1u << (i & 7));
+        if (_read_map[i >> 3] & bit) _stats.reread_sectors++;
+        _read_map[i >> 3] |= bit;
+    }
+
+    uf2_read_blocks(lba, count, _buf);
+}
+
+static void emu_write(uint32_t lba, uint32_t count) {
+    uint64_t const now = now_ns();
+    if (!_stats.mount_ns) _stats.mount_ns = now;
+    _stats.write_cmds++;
+
+    uint32_t const blocks = count * UF2_BLOCKS_PER_SECTOR;
+    for (uint32_t i = 0; i < blocks; i++) {
+        uint8_t* data = _buf + i * UF2_BLOCK_SIZE;
+        UF2_Block const* bl = (UF2_Block const*) data;
+        uint32_t const block = lba * UF2_BLOCKS_PER_SECTOR + i;
+
+        // host keeps writing while the stub would be busy, nothing is retried
+        int const result = uf2_write_block(block / UF2_BLOCKS_PER_SECTOR, data, &_wr_state);
+        if (result < 0) {
+            _stats.other_blocks++;
+            trace_block(block, UINT32_MAX, i == 0);
+            continue;
+        }
+
+        if (!_stats.first_uf2_ns) _stats.first_uf2_ns = now;
+        if (_stats.uf2_blocks && bl->blockNo != _stats.last_uf2 + 1) _stats.out_of_order++;
+        _stats.last_uf2 = bl->blockNo;
+        _stats.uf2_blocks++;
+        trace_block(block, bl->blockNo, i == 0);
+    }
+
+    if (!_stats.complete_ns && _wr_state.numBlocks && _wr_state.numWritten >= _wr_state.numBlocks) {
+        _stats.complete_ns = now_ns();
+        printf("complete: %" PRIu32 " blocks after %" PRIu64 " ms, device would reset now\n",
+               _wr_state.numBlocks, since_ms(_stats.complete_ns));
+    }
+
+    flash_account();
+}
+
+static void print_stats(void) {
+    EmuStats const* st = &_stats;
+    printf("mount     %8" PRIu64 " ms, %7" PRIu32 " sectors read\n",
+           since_ms(st->mount_ns), st->mount_sectors);
+    printf("read      %8" PRIu32 " cmds, %7" PRIu32 " sectors, %7" PRIu32 " read again\n",
+           st->read_cmds, st->read_sectors, st->reread_sectors);
+    printf("write     %8" PRIu32 " cmds, %7" PRIu32 " uf2 blocks, %7" PRIu32 " other, %7" PRIu32 " out of order, %" PRIu32 " flushes\n",
+           st->write_cmds, st->uf2_blocks, st->other_blocks, st->out_of_order, st->flushes);
+    printf("uf2       %8" PRIu64 " ms first block, %" PRIu64 " ms complete, %" PRIu32 " of %" PRIu32 " written\n",
+           since_ms(st->first_uf2_ns), since_ms(st->complete_ns), _wr_state.numWritten, _wr_state.numBlocks);
+    if (sim_flash_enabled()) {
+        printf("flash     %8" PRIu64 " ms: %5" PRIu32 " erases %8" PRIu64 " ms, %7" PRIu32 " KB program %8" PRIu64 " ms\n",
+               (st->flash.erase_us + st->flash.program_us) / 1000, st->flash.erase_count, st->flash.erase_us / 1000,
+               st->flash.program_bytes / 1024, st->flash.program_us / 1000);
+    }
+}
+
+//--------------------------------------------------------------------+
+// Transmission
+//--------------------------------------------------------------------+
+static bool send_reply(int fd, uint8_t const* handle, uint32_t error, uint32_t len) {
+    uint8_t hdr[16];
+    put_be32(hdr, NBD_REPLY_MAGIC);
+    put_be32(hdr + 4, error);
+    memcpy(hdr + 8, handle, 8);
+    return send_all(fd, hdr, sizeof(hdr)) && (!len || send_all(fd, _buf, len));
+}
+
+// Serve requests until the client disconnects
+static void serve(int fd) {
+    while (1) {
+        uint8_t req[28];
+        if (!recv_all(fd, req, sizeof(req)) || get_be32(req) != NBD_REQUEST_MAGIC) return;
+
+        uint16_t const type = get_be16(req + 6);
+        uint8_t const* handle = req + 8;
+        uint64_t const offset = get_be64(req + 16);
+        uint32_t const len = get_be32(req + 24);
+
+        bool const in_range = !(offset % SECTOR_SIZE) && !(len % SECTOR_SIZE) && len <= REQUEST_MAX &&
+                              offset <= export_size() && len <= export_size() - offset;
+        uint32_t const lba = (uint32_t) (offset / SECTOR_SIZE);
+        uint32_t const count = len / SECTOR_SIZE;
+
+        switch (type) {
+            case NBD_CMD_READ:
+                if (!in_range || !buf_reserve(len)) {
+                    if (!send_reply(fd, handle, EINVAL, 0)) return;
+                    break;
+                }
+                emu_read(lba, count);
+                if (!send_reply(fd, handle, 0, len)) return;
+                break;
+
+            case NBD_CMD_WRITE:
+                // payload follows the request even if it is rejected
+                if (len > REQUEST_MAX || !buf_reserve(len) || !recv_all(fd, _buf, len)) return;
+                if (in_range) emu_write(lba, count);
+                if (!send_reply(fd, handle, in_range ? 0 : EINVAL, 0)) return;
+                break;
+
+            case NBD_CMD_FLUSH:
+                _stats.flushes++;
+                uf2_flush();
+                flash_account();
+                if (!send_reply(fd, handle, 0, 0)) return;
+                break;
+
+            case NBD_CMD_DISC:
+                return;
+
+            default:
+                if (!send_reply(fd, handle, EINVAL, 0)) return;
+                break;
+        }
+    }
+}
+
+static int listen_on(uint16_t port) {
+    int const fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    int const on = 1;
+    int const off = 0;
+    (void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    (void) setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    struct sockaddr_in6 addr = { .sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = in6addr_any };
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) || listen(fd, 1)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//--------------------------------------------------------------------+
+// Main
+//--------------------------------------------------------------------+
+static void usage(char const* name) {
+    printf("usage: %s [-p port] [-f flash_profile] [-d 1] [-c connections] [-t trace.txt]\n", name);
+    printf("flash profiles: ");
+    sim_flash_list();
+}
+
+int main(int argc, char** argv) {
+    uint16_t port = DEFAULT_PORT;
+    uint32_t connections = 1;
+    char const* trace_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-h")) {
+            usage(argv[0]);
+            return 0;
+        }
+
+        // every other option takes a value
+        char const* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!value) {
+            printf("missing value of %s\n", argv[i]);
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (!strcmp(argv[i], "-p")) {
+            port = (uint16_t) strtoul(value, NULL, 0);
+        } else if (!strcmp(argv[i], "-f")) {
+            _sim_profile = value;
+        } else if (!strcmp(argv[i], "-d")) {
+            _delay = strtoul(value, NULL, 0) != 0;
+        } else if (!strcmp(argv[i], "-c")) {
+            connections = (uint32_t) strtoul(value, NULL, 0);
+        } else if (!strcmp(argv[i], "-t")) {
+            trace_path = value;
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    if (!sim_flash_select(_sim_profile)) {
+        printf("unknown flash profile %s, available: ", _sim_profile);
+        sim_flash_list();
+        return 1;
+    }
+
+    if (trace_path) {
+        _trace_file = fopen(trace_path, "w");
+        if (!_trace_file) {
+            printf("cannot open %s\n", trace_path);
+            return 1;
+        }
+        fprintf(_trace_file, "# block uf2_block count flags (test_ghostfat emu), uf2_block -1 for non-uf2 blocks\n");
+    }
+
+    _read_map = malloc((UF2_NUM_SECTORS + 7) / 8);
+    int const lfd = listen_on(port);
+    if (!_read_map || lfd < 0) {
+        printf("cannot %s\n", _read_map ? "listen" : "allocate read map");
+        return 1;
+    }
+
+    uf2_init();
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("board %s: %" PRIu32 " sectors of %u bytes, flash %s%s, listening on port %u\n",
+           UF2_BOARD_ID, uf2_num_sectors(), SECTOR_SIZE, _sim_profile, _delay ? " (delayed)" : "", port);
+
+    // 0 connections: serve until killed
+    for (uint32_t n = 0; !connections || n < connections; n++) {
+        int const fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        int const on = 1;
+        (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        // every connection is a new flashing session on top of the previous flash contents
+        memset(&_wr_state, 0, sizeof(_wr_state));
+        memset(&_stats, 0, sizeof(_stats));
+        memset(_read_map, 0, (UF2_NUM_SECTORS + 7) / 8);
+        sim_flash_session();
+        if (sim_flash_enabled()) {
+            sim_flash_stats_t discard;
+            sim_flash_stats(&discard);
+        }
+
+        if (handshake(fd)) {
+            _stats.start_ns = now_ns();
+            printf("connection %" PRIu32 "\n", n + 1);
+            serve(fd);
+            uf2_flush();
+            flash_account();
+            trace_flush();
+            print_stats();
+        }
+        close(fd);
+    }
+
+    close(lfd);
+    if (_trace_file) fclose(_trace_file);
+    free(_read_map);
+    free(_buf);
+    sim_flash_select("none");
+    return 0;
+}
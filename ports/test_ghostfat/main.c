@@ -1,5 +1,9 @@
 #include "boards.h"
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifndef COMPILE_DATE
   #error "Reproducible build requirement - COMPILE_DATE"
@@ -9,9 +13,8 @@
   #error "Reproducible build requirement - COMPILE_TIME"
 #endif
 
-// If the sector size changes, such as to support 4kn sectors in the generated FAT filesystem,
-// then this will need to change also.
-#define GHOSTFAT_SECTOR_SIZE 512
+// Logical sector size of the generated FAT filesystem (512 or 4kn)
+#define GHOSTFAT_SECTOR_SIZE CFG_UF2_SECTOR_SIZE
 
 typedef enum {
     ERR_NONE = 0,
@@ -112,10 +115,8 @@ void DumpBuffer(uint64_t startingOffset, const void * sectorBuffer, uint16_t byt
 #define STRIFY(x) #x
 #define X_STRIFY(x) STRIFY(x)
 
-static char const * const knownGoodFilename = "knowngood.img";
-static char const * const defaultFilename = "ghostfat.img";
+static char const * const defaultKnownGoodFilename = "knowngood.img";
 static uint8_t singleSectorBuffer [GHOSTFAT_SECTOR_SIZE];
-static uint8_t anotherSectorBuffer[GHOSTFAT_SECTOR_SIZE];
 static char const * const infoUf2File =
     "TinyUF2 Bootloader " UF2_VERSION "\r\n"
     "Model: " UF2_PRODUCT_NAME "\r\n"
@@ -208,137 +209,211 @@ bool Are_accepted_INFO_UF2_Files(void const * sector1, void const * sector2) {
     }
     return true;
 }
-// TODO: use gzopen() to open compressed known good image directly
-int CompareDiskImages(void) {
-    // open both files for binary read
-    FILE * newFile = NULL;
-    FILE * knownGoodFile = NULL;
-    int retVal; // code must set this value
-
-    newFile = fopen( defaultFilename, "r" );
-    if (!newFile) {
-        retVal = ERR_CANNOT_OPEN_NEW_IMAGE_FILE;
-        goto cleanup;
+//--------------------------------------------------------------------+
+// Known good image, mapped when uncompressed, otherwise streamed through gzip -dc (once per .gz
+// suffix, knowngood.img.gz.gz is stored in the board directory). Sectors are read in order
+//--------------------------------------------------------------------+
+typedef struct {
+    uint8_t const * map;    // mapped image, NULL when streamed
+    size_t mapSize;
+    FILE * pipe;
+    uint8_t buf[2][GHOSTFAT_SECTOR_SIZE]; // streamed sector and its predecessor
+} KnownGood;
+
+static KnownGood knownGood;
+
+int KnownGoodOpen(char const * filename) {
+    size_t len = strlen(filename);
+    uint32_t levels = 0;
+    while (len >= 3 + 3 * levels && !strncmp(filename + len - 3 * (levels + 1), ".gz", 3)) {
+        levels++;
     }
-    // TODO: use gzopen() to open compressed file...
-    knownGoodFile = fopen( knownGoodFilename, "r" );
-    if (!knownGoodFile) {
-        retVal = ERR_CANNOT_OPEN_KNOWN_GOOD_IMAGE_FILE;
-        goto cleanup;
+
+    if (!levels) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) { return ERR_CANNOT_OPEN_KNOWN_GOOD_IMAGE_FILE; }
+        struct stat st;
+        if (fstat(fd, &st)) {
+            close(fd);
+            return ERR_CANNOT_OPEN_KNOWN_GOOD_IMAGE_FILE;
+        }
+        if ((uint64_t) st.st_size != ((uint64_t) GHOSTFAT_SECTOR_SIZE) * UF2_NUM_SECTORS) {
+            close(fd);
+            return ERR_UNEXPECTED_KNOWN_GOOD_FILE_SIZE;
+        }
+        void * map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) { return ERR_CANNOT_OPEN_KNOWN_GOOD_IMAGE_FILE; }
+        knownGood.map = map;
+        knownGood.mapSize = (size_t) st.st_size;
+        return ERR_NONE;
     }
-    if (fseek(newFile, 0L, SEEK_END) || fseek(knownGoodFile, 0L, SEEK_END)) {
-        retVal = ERR_CANNOT_SEEK_TO_FILE_END;
-        goto cleanup;
+
+    if (access(filename, R_OK)) { return ERR_CANNOT_OPEN_KNOWN_GOOD_IMAGE_FILE; }
+    char command[512];
+    int pos = snprintf(command, sizeof(command), "gzip -dc < '%s'", filename);
+    for (uint32_t i = 1; i < levels && pos > 0 && (size_t) pos < sizeof(command); i++) {
+        pos += snprintf(command + pos, sizeof(command) - pos, " | gzip -dc");
     }
+    if (pos <= 0 || (size_t) pos >= sizeof(command)) { return ERR_INVALID_FILENAME; }
 
-    // verify both files have same size, using method that works with GZ'd file
-    long int newFileSize = ftell(newFile);
-    long int knownGoodFileSize = ftell(knownGoodFile);
-    long int expectedFileSize = ((long int)GHOSTFAT_SECTOR_SIZE) * CFG_UF2_NUM_BLOCKS;
-    if (newFileSize != expectedFileSize) {
-        retVal = ERR_UNEXPECTED_NEW_FILE_SIZE;
-        goto cleanup;
+    knownGood.pipe = popen(command, "r");
+    return knownGood.pipe ? ERR_NONE : ERR_CANNOT_OPEN_KNOWN_GOOD_IMAGE_FILE;
+}
+
+// Sector i of the known good image, the previously returned sector stays valid
+uint8_t const * KnownGoodSector(uint32_t i) {
+    if (knownGood.map) {
+        return knownGood.map + ((uint64_t) GHOSTFAT_SECTOR_SIZE) * i;
     }
-    if (knownGoodFileSize != expectedFileSize) {
-        retVal = ERR_UNEXPECTED_KNOWN_GOOD_FILE_SIZE;
-        goto cleanup;
+    uint8_t * buf = knownGood.buf[i & 1];
+    if (fread(buf, 1, GHOSTFAT_SECTOR_SIZE, knownGood.pipe) != GHOSTFAT_SECTOR_SIZE) { return NULL; }
+    return buf;
+}
+
+// Close image, a streamed image must end with the last sector
+int KnownGoodClose(void) {
+    int retVal = ERR_NONE;
+    if (knownGood.map) {
+        munmap((void *) knownGood.map, knownGood.mapSize);
+    }
+    if (knownGood.pipe) {
+        if (fgetc(knownGood.pipe) != EOF) { retVal = ERR_UNEXPECTED_KNOWN_GOOD_FILE_SIZE; }
+        if (pclose(knownGood.pipe) && retVal == ERR_NONE) { retVal = ERR_FAILED_READ_DURING_COMPARE; }
+    }
+    memset(&knownGood, 0, sizeof(knownGood));
+    return retVal;
+}
+
+//--------------------------------------------------------------------+
+// Compare
+//--------------------------------------------------------------------+
+
+// The commit ID is embedded within the generated file system.
+// This is not a violation of deterministic build.
+// However, it causes the following allowed changes to the file system:
+// [ ] Contents of the file INFO_UF2.TXT has variable-sized string in the middle of the content
+// [ ] Directory entry for INFO_UF2.TXT list correspondingly different file size
+// Therefore, check for (and allow) these two changes relative to the known good image
+static int64_t mismatchedDirectoryEntry = -1;
+static int64_t mismatchedInfoUF2Contents = -1;
+
+// Generate sector i and compare it with the known good one
+int CompareSector(uint32_t i, uint8_t const * expected) {
+    uint64_t fileOffset = ((uint64_t)GHOSTFAT_SECTOR_SIZE) * i;
+
+    memset(singleSectorBuffer, 0xAA, GHOSTFAT_SECTOR_SIZE); // TODO: make this be random data...
+    uf2_read_block(i, singleSectorBuffer);
+
+    if (!memcmp(singleSectorBuffer, expected, GHOSTFAT_SECTOR_SIZE)) {
+        return ERR_NONE;
     }
 
-    if (fseek(newFile, 0L, SEEK_SET) || fseek(knownGoodFile, 0L, SEEK_SET)) {
-        retVal = ERR_CANNOT_SEEK_TO_FILE_START;
-        goto cleanup;
+    if ((mismatchedInfoUF2Contents == -1) && (mismatchedDirectoryEntry == -1) &&
+        IdenticalDirEntriesExcludingFileSizes(singleSectorBuffer, expected)) {
+        printf(
+            "INFO: Allowed differences in DirEntry for INFO_UF2 @ sector %" PRId32
+            " (byte offset 0x%" PRIx64 ")\n",
+            i, fileOffset
+            );
+        // mismatched directory entry, if exists, must occur prior to mismatched UF2 contents
+        mismatchedDirectoryEntry = i;
+    } else if ((mismatchedInfoUF2Contents == -1) &&
+               Are_accepted_INFO_UF2_Files(singleSectorBuffer, expected)) {
+        printf(
+            "INFO: Allowed differences in INFO_UF2.TXT contents @ sector %" PRId32
+            " (byte offset 0x%" PRIx64 ")\n",
+            i, fileOffset
+            );
+        // once get to mismatched INFO_UF2.TXT files,
+        // cannot later have mismatched directory entries
+        mismatchedDirectoryEntry = -2;
+        mismatchedInfoUF2Contents = i;
+    } else {
+        printf("FAIL: Mismatched data at sector %" PRIu32 " (byte offset 0x%" PRIx64 ")\n", i, fileOffset);
+        printf("Expected sector data:\n");
+        DumpBuffer(fileOffset, expected, GHOSTFAT_SECTOR_SIZE);
+        printf("Actual   sector data:\n");
+        DumpBuffer(fileOffset, singleSectorBuffer,  GHOSTFAT_SECTOR_SIZE);
+        return ERR_FILES_NOT_IDENTICAL;
     }
+    return ERR_NONE;
+}
 
-    // The commit ID is embedded within the generated file system.
-    // This is not a violation of deterministic build.
-    // However, it causes the following allowed changes to the file system:
-    // [ ] Contents of the file INFO_UF2.TXT has variable-sized string in the middle of the content
-    // [ ] Directory entry for INFO_UF2.TXT list correspondingly different file size
-    // Therefore, check for (and allow) these two changes relative to the known good image
-    int64_t mismatchedDirectoryEntry = -1;
-    int64_t mismatchedInfoUF2Contents = -1;
-
-    // loop through all sectors of both files, ensure they compare as equal
-    for (uint32_t i = 0; i < CFG_UF2_NUM_BLOCKS; i++) {
-        uint64_t fileOffset = ((uint64_t)GHOSTFAT_SECTOR_SIZE) * i;
-
-        memset(singleSectorBuffer,  0xAA, GHOSTFAT_SECTOR_SIZE); // TODO: make this be random data...
-        memset(anotherSectorBuffer, 0x55, GHOSTFAT_SECTOR_SIZE); // TODO: make this be random data...
-
-        size_t read1 = fread(singleSectorBuffer,  1, GHOSTFAT_SECTOR_SIZE, newFile);
-        size_t read2 = fread(anotherSectorBuffer, 1, GHOSTFAT_SECTOR_SIZE, knownGoodFile);
-        if ((read1 != GHOSTFAT_SECTOR_SIZE) || (read2 != GHOSTFAT_SECTOR_SIZE)) {
-            retVal = ERR_FAILED_READ_DURING_COMPARE;
+// Generate sectors straight from ghostfat and compare them with the known good image, no image file
+// is written. Unless allSectors is set, only representatives of each sector class are generated: a
+// run of identical known good sectors (e.g FAT sectors of the same kind, unused data region) is
+// checked at its first and last sector
+int CompareDiskImage(char const * knownGoodFilename, bool allSectors) {
+    int retVal = KnownGoodOpen(knownGoodFilename);
+    if (retVal) { return retVal; }
+
+    mismatchedDirectoryEntry = -1;
+    mismatchedInfoUF2Contents = -1;
+
+    uint8_t const * previous = NULL;
+    bool previousChecked = true;
+    uint32_t checked = 0;
+
+    for (uint32_t i = 0; i < UF2_NUM_SECTORS; i++) {
+        uint8_t const * expected = KnownGoodSector(i);
+        if (!expected) {
+            retVal = ERR_UNEXPECTED_KNOWN_GOOD_FILE_SIZE;
             goto cleanup;
         }
 
-        if (memcmp(singleSectorBuffer, anotherSectorBuffer, GHOSTFAT_SECTOR_SIZE)) {
-
-            if ((mismatchedInfoUF2Contents == -1) && (mismatchedDirectoryEntry == -1) &&
-                IdenticalDirEntriesExcludingFileSizes(singleSectorBuffer, anotherSectorBuffer)) {
-                printf(
-                    "INFO: Allowed differences in DirEntry for INFO_UF2 @ sector %" PRId32
-                    " (byte offset 0x%" PRIx64 ")\n",
-                    i, fileOffset
-                    );
-                // mismatched directory entry, if exists, must occur prior to mismatched UF2 contents
-                mismatchedDirectoryEntry = i;
-            } else if ((mismatchedInfoUF2Contents == -1) &&
-                       Are_accepted_INFO_UF2_Files(singleSectorBuffer, anotherSectorBuffer)) {
-                printf(
-                    "INFO: Allowed differences in INFO_UF2.TXT contents @ sector %" PRId32
-                    " (byte offset 0x%" PRIx64 ")\n",
-                    i, fileOffset
-                    );
-                // once get to mismatched INFO_UF2.TXT files,
-                // cannot later have mismatched directory entries
-                mismatchedDirectoryEntry = -2;
-                mismatchedInfoUF2Contents = i;
-            } else {
-                printf("FAIL: Mismatched data at sector %" PRIu32 " (byte offset 0x%" PRIx64 ")\n", i, fileOffset);
-                printf("Expected sector data:\n");
-                DumpBuffer(fileOffset, anotherSectorBuffer, GHOSTFAT_SECTOR_SIZE);
-                printf("Actual   sector data:\n");
-                DumpBuffer(fileOffset, singleSectorBuffer,  GHOSTFAT_SECTOR_SIZE);
-                retVal = ERR_FILES_NOT_IDENTICAL;
-                goto cleanup;
+        if (allSectors || !previous || memcmp(expected, previous, GHOSTFAT_SECTOR_SIZE)) {
+            // close the previous run at its last sector
+            if (!previousChecked) {
+                retVal = CompareSector(i - 1, previous);
+                if (retVal) { goto cleanup; }
+                checked++;
             }
+            retVal = CompareSector(i, expected);
+            if (retVal) { goto cleanup; }
+            checked++;
+            previousChecked = true;
+        } else {
+            previousChecked = false;
         }
-        // else compared OK for this sector... check next
+        previous = expected;
+    }
+    if (!previousChecked) {
+        retVal = CompareSector(UF2_NUM_SECTORS - 1, previous);
+        if (retVal) { goto cleanup; }
+        checked++;
     }
-    // SUCCESS!
-    retVal = ERR_NONE;
 
-cleanup:
-    if (knownGoodFile) { fclose(knownGoodFile); }
-    if (newFile) { fclose(newFile); }
+    printf("INFO: %" PRIu32 " of %" PRIu32 " sectors generated and compared\n", checked, (uint32_t) UF2_NUM_SECTORS);
 
-    // verify both files are same sized
+cleanup:
+    {
+        int closeVal = KnownGoodClose();
+        if (!retVal) { retVal = closeVal; }
+    }
     return retVal;
 }
 
-int DumpDiskImage(void) {
+int DumpDiskImage(char const * filename) {
 
     // Generally:
     // 1. Opens a file for the disk image results
-    // 2. initializes UF2
-    // 3. loops through each sector of the disk image:
+    // 2. loops through each sector of the disk image:
     //    reads the sector via uf2_read_block()
     //    write the sector to the disk image file
-    // 4. close the disk image file
+    // 3. close the disk image file
 
-    FILE * file = fopen( defaultFilename, "w" ); // create / overwrite existing file
+    FILE * file = fopen( filename, "w" ); // create / overwrite existing file
     if (!file) { return ERR_CANNOT_OPEN_NEW_IMAGE_FILE; }
 
-
-    // this creates an image file in the current directory
-    uint32_t countOfSectors_UF2 = CFG_UF2_NUM_BLOCKS;
+    uint32_t countOfSectors_UF2 = UF2_NUM_SECTORS;
 
     for (uint32_t i = 0; i < countOfSectors_UF2; i++) {
         memset(singleSectorBuffer, 0xAA, GHOSTFAT_SECTOR_SIZE); // TODO: make this be random data...
         uf2_read_block(i, singleSectorBuffer);
         size_t written = fwrite (singleSectorBuffer, 1, GHOSTFAT_SECTOR_SIZE, file );
         if (written != GHOSTFAT_SECTOR_SIZE) {
+            fclose(file);
             return ERR_FAILED_WRITE_FILE;
         }
     }
@@ -349,22 +424,50 @@ int DumpDiskImage(void) {
     return ERR_NONE;
 }
 
-int main(void)
+// tinyuf2-<board>.elf [-k knowngood.img[.gz.gz]] [-a] [-o ghostfat.img]
+//   -k  known good image to compare with, knowngood.img by default
+//   -a  generate and compare every sector instead of sector class representatives
+//   -o  write the generated image (e.g for mk-knowngood), compared only if -k is given as well
+int main(int argc, char** argv)
 {
     int r;
+    char const * knownGoodFilename = NULL;
+    char const * imageFilename = NULL;
+    bool allSectors = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-a")) {
+            allSectors = true;
+        } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+            knownGoodFilename = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            imageFilename = argv[++i];
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return ERR_INVALID_FILENAME;
+        }
+    }
+    if (!knownGoodFilename && !imageFilename) {
+        knownGoodFilename = defaultKnownGoodFilename;
+    }
 
     printf("initializing UF2\n"); fflush(stdout);
     uf2_init();
 
-    printf("generating new disk image\n"); fflush(stdout);
-    r = DumpDiskImage();
-    if (r) { goto errorExit; }
-
-    printf("comparing against known good disk image\n"); fflush(stdout);
-    r = CompareDiskImages();
-    if (r) { goto errorExit; }
+    if (imageFilename) {
+        printf("generating new disk image %s\n", imageFilename); fflush(stdout);
+        r = DumpDiskImage(imageFilename);
+        if (r) { goto errorExit; }
+    }
 
-    printf("PASS: Ghostfat generation validation completed successfully.\n");
+    if (knownGoodFilename) {
+        printf("comparing against known good disk image %s\n", knownGoodFilename); fflush(stdout);
+        r = CompareDiskImage(knownGoodFilename, allSectors);
+        if (r) { goto errorExit; }
+        printf("PASS: Ghostfat generation validation completed successfully.\n");
+    } else {
+        printf("PASS: Ghostfat image written.\n");
+    }
     return ERR_NONE;
 
 errorExit:
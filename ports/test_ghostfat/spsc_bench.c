@@ -0,0 +1,152 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spsc.h"
+
+// Host stress benchmark of the SPSC payload ring and buffer pool (src/spsc.h).
+//
+// A producer thread takes a buffer from the pool, fills it with a pattern derived from a sequence
+// number and queues its descriptor, a consumer thread checks order and contents then returns the
+// buffer. Both spin when the ring is full (empty) or the pool is exhausted, as a usb callback and
+// flash worker would. Exits non-zero if a payload is lost, reordered or corrupted:
+//
+//   spsc-bench.elf [-n payloads] [-d ring_depth] [-b buffers] [-s buffer_size]
+//
+// Ordering bugs only show up on hosts with a weakly ordered memory model (e.g aarch64), x86 keeps
+// stores in order.
+
+static spsc_ring_t _ring;
+static spsc_payload_t* _slots;
+static spsc_pool_t _pool;
+
+static uint32_t _count = 10000000;
+static uint32_t _buf_size = 64;
+
+// waits of each side on the other, i.e ring full / pool empty for producer and ring empty for consumer
+static uint64_t _producer_spins = 0;
+static uint64_t _consumer_spins = 0;
+static uint32_t _errors = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+// let the other side run on a host with fewer cores than threads
+static inline void spin(uint64_t* count) {
+    (*count)++;
+    sched_yield();
+}
+
+static inline uint8_t pattern(uint32_t seq, uint32_t i) {
+    return (uint8_t) (seq * 31u + i);
+}
+
+static void* producer(void* arg) {
+    (void) arg;
+
+    for (uint32_t seq = 0; seq < _count; seq++) {
+        uint8_t* buf;
+        while ((buf = spsc_pool_get(&_pool)) == NULL) spin(&_producer_spins);
+
+        uint32_t const len = 1 + (seq % _buf_size);
+        for (uint32_t i = 0; i < len; i++) buf[i] = pattern(seq, i);
+
+        uint32_t slot;
+        while ((slot = spsc_write_slot(&_ring)) == SPSC_NONE) spin(&_producer_spins);
+
+        _slots[slot] = (spsc_payload_t) { .addr = seq, .len = len, .buf = buf };
+        spsc_write_commit(&_ring);
+    }
+
+    return NULL;
+}
+
+static void* consumer(void* arg) {
+    (void) arg;
+
+    for (uint32_t seq = 0; seq < _count; seq++) {
+        uint32_t slot;
+        while ((slot = spsc_read_slot(&_ring)) == SPSC_NONE) spin(&_consumer_spins);
+
+        spsc_payload_t const pl = _slots[slot];
+        spsc_read_release(&_ring);
+
+        uint8_t const* buf = (uint8_t const*) pl.buf;
+        bool ok = (pl.addr == seq) && (pl.len == 1 + (seq % _buf_size));
+        for (uint32_t i = 0; ok && i < pl.len; i++) ok = (buf[i] == pattern(seq, i));
+
+        if (!ok && _errors++ < 10) {
+            printf("payload %" PRIu32 ": got seq %" PRIu32 " len %" PRIu32 "\n", seq, pl.addr, pl.len);
+        }
+
+        spsc_pool_put(&_pool, buf);
+    }
+
+    return NULL;
+}
+
+static bool is_pow2(uint32_t v) {
+    return v && !(v & (v - 1));
+}
+
+int main(int argc, char** argv) {
+    uint32_t depth = 16;
+    uint32_t buffers = 32;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        uint32_t const v = (uint32_t) strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "-n")) {
+            _count = v;
+        } else if (!strcmp(argv[i], "-d")) {
+            depth = v;
+        } else if (!strcmp(argv[i], "-b")) {
+            buffers = v;
+        } else if (!strcmp(argv[i], "-s")) {
+            _buf_size = v;
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (!is_pow2(depth) || !is_pow2(buffers) || buffers > 65536 || !_buf_size) {
+        printf("ring depth and buffers must be powers of 2 (buffers up to 65536), size not 0\n");
+        return 1;
+    }
+
+    _slots = calloc(depth, sizeof(spsc_payload_t));
+    uint8_t* mem = malloc((size_t) buffers * _buf_size);
+    uint16_t* ids = malloc(buffers * sizeof(uint16_t));
+    if (!_slots || !mem || !ids) return 1;
+
+    spsc_init(&_ring, depth);
+    spsc_pool_init(&_pool, mem, _buf_size, buffers, ids);
+
+    pthread_t prod, cons;
+    uint64_t const start = now_ns();
+    pthread_create(&cons, NULL, consumer, NULL);
+    pthread_create(&prod, NULL, producer, NULL);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    uint64_t const ns = now_ns() - start;
+
+    printf("spsc: %" PRIu32 " payloads, depth %" PRIu32 ", %" PRIu32 " x %" PRIu32 " byte buffers: %.1f ns/payload, "
+           "spins producer %" PRIu64 " consumer %" PRIu64 "\n",
+           _count, depth, buffers, _buf_size, _count ? (double) ns / _count : 0.0, _producer_spins, _consumer_spins);
+
+    // everything consumed, all buffers back in the pool
+    if (spsc_count(&_ring) || spsc_count(&_pool.ring) != buffers) {
+        printf("ring not empty or buffers missing from pool\n");
+        _errors++;
+    }
+
+    if (_errors) printf("FAIL: %" PRIu32 " payloads lost, reordered or corrupted\n", _errors);
+    return _errors ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Encrypted uf2 payloads (TINYUF2_UF2_AES), see tools/uf2aes.py
+//
+// Payload of a UF2_FLAG_AES block is AES-128-CTR encrypted over the address space: byte at address
+// X uses the key stream of counter block nonce || big endian (X / 16). It is decrypted in place in
+// the uf2 block before being programmed. The key is set up once per session: board_aes_ctr_init()
+// loads it into a crypto peripheral, otherwise board_aes_key() provides it to the software AES.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_UF2_AES
+
+static struct {
+  bool     ready;           // key set up for this session
+  bool     hw;              // board_aes_ctr_crypt() is used
+  uint8_t  round_key[176];  // software key schedule
+} _aes;
+
+//--------------------------------------------------------------------+
+// AES-128 encryption (FIPS 197), only the forward cipher is needed for CTR
+//--------------------------------------------------------------------+
+
+static uint8_t const _aes_sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static inline uint8_t aes_xtime(uint8_t x) {
+  return (uint8_t) ((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+static void aes_key_expand(uint8_t rk[176], uint8_t const key[16]) {
+  memcpy(rk, key, 16);
+
+  uint8_t rcon = 1;
+  for ( uint32_t i = 16; i < 176; i += 4 ) {
+    uint8_t t[4] = { rk[i-4], rk[i-3], rk[i-2], rk[i-1] };
+    if ( (i & 15) == 0 ) {
+      // RotWord + SubWord + Rcon
+      uint8_t const t0 = t[0];
+      t[0] = _aes_sbox[t[1]] ^ rcon;
+      t[1] = _aes_sbox[t[2]];
+      t[2] = _aes_sbox[t[3]];
+      t[3] = _aes_sbox[t0];
+      rcon = aes_xtime(rcon);
+    }
+    for ( uint32_t j = 0; j < 4; j++ ) rk[i+j] = rk[i+j-16] ^ t[j];
+  }
+}
+
+static void aes_encrypt(uint8_t const rk[176], uint8_t const in[16], uint8_t out[16]) {
+  uint8_t s[16];
+  for ( uint32_t i = 0; i < 16; i++ ) s[i] = in[i] ^ rk[i];
+
+  for ( uint32_t round = 1; round <= 10; round++ ) {
+    // SubBytes + ShiftRows, state is column major
+    uint8_t t[16];
+    for ( uint32_t c = 0; c < 4; c++ ) {
+      for ( uint32_t r = 0; r < 4; r++ ) t[4*c + r] = _aes_sbox[s[4*((c + r) & 3) + r]];
+    }
+
+    if ( round < 10 ) {
+      // MixColumns
+      for ( uint32_t c = 0; c < 4; c++ ) {
+        uint8_t* col = t + 4*c;
+        uint8_t const all = col[0] ^ col[1] ^ col[2] ^ col[3];
+        uint8_t const c0 = col[0];
+        col[0] ^= all ^ aes_xtime(col[0] ^ col[1]);
+        col[1] ^= all ^ aes_xtime(col[1] ^ col[2]);
+        col[2] ^= all ^ aes_xtime(col[2] ^ col[3]);
+        col[3] ^= all ^ aes_xtime(col[3] ^ c0);
+      }
+    }
+
+    for ( uint32_t i = 0; i < 16; i++ ) s[i] = t[i] ^ rk[16*round + i];
+  }
+
+  memcpy(out, s, 16);
+}
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+void uf2_aes_reset(void) {
+  // key schedule is not kept in RAM past the session
+  memset(&_aes, 0, sizeof(_aes));
+}
+
+static void aes_counter_set(uint8_t counter[16], uint32_t ctr) {
+  counter[12] = (uint8_t) (ctr >> 24);
+  counter[13] = (uint8_t) (ctr >> 16);
+  counter[14] = (uint8_t) (ctr >> 8);
+  counter[15] = (uint8_t) ctr;
+}
+
+static bool aes_setup(void) {
+  if ( board_aes_ctr_init && board_aes_ctr_crypt ) {
+    _aes.hw = board_aes_ctr_init();
+  }
+
+  if ( !_aes.hw ) {
+    uint8_t key[16];
+    if ( !board_aes_key || !board_aes_key(key) ) {
+      TUF2_LOG1("AES: no key\r\n");
+      return false;
+    }
+    aes_key_expand(_aes.round_key, key);
+    memset(key, 0, sizeof(key));
+  }
+
+  _aes.ready = true;
+  return true;
+}
+
+bool uf2_aes_decrypt(uint32_t addr, uint8_t* data, uint32_t len, uint8_t const nonce[UF2_AES_NONCE_SIZE]) {
+  // key stream blocks are aligned to the address space
+  if ( addr & 15 ) return false;
+  if ( !_aes.ready && !aes_setup() ) return false;
+
+  uint8_t counter[16];
+  memcpy(counter, nonce, UF2_AES_NONCE_SIZE);
+  uint32_t ctr = addr >> 4;
+
+  if ( _aes.hw ) {
+    aes_counter_set(counter, ctr);
+    board_aes_ctr_crypt(counter, data, len);
+    return true;
+  }
+
+  for ( uint32_t pos = 0; pos < len; pos += 16, ctr++ ) {
+    uint8_t stream[16];
+    aes_counter_set(counter, ctr);
+    aes_encrypt(_aes.round_key, counter, stream);
+
+    uint32_t const count = (len - pos < 16) ? (len - pos) : 16;
+    for ( uint32_t i = 0; i < count; i++ ) data[pos + i] ^= stream[i];
+  }
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "board_api.h"
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Buffer arena (TINYUF2_ARENA_SIZE)
+//
+// Large buffers only needed in one phase of the bootloader share a single static arena instead of
+// each having its own storage, e.g the SD card read buffer before usb is started and the async write
+// queue afterwards. Allocation bumps the arena top, all buffers of a phase are released at once when
+// the next one starts. There is no heap and nothing to fragment.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_ARENA_SIZE
+
+TUF2_DFU_NOINIT static uint8_t _arena[TINYUF2_ARENA_SIZE] __attribute__((aligned(8)));
+static uint32_t _arena_top = 0;
+static uint8_t _arena_cur = UF2_PHASE_BOOT;
+
+void uf2_arena_phase(uint8_t phase) {
+  TUF2_LOG1("Arena: phase %u used %lu of %u bytes\r\n", _arena_cur, _arena_top, TINYUF2_ARENA_SIZE);
+  _arena_cur = phase;
+  _arena_top = 0;
+}
+
+void* uf2_arena_alloc(uint32_t size) {
+  uint32_t const top = (_arena_top + 7) & ~7UL;
+  if ( top > TINYUF2_ARENA_SIZE || size > TINYUF2_ARENA_SIZE - top ) {
+    TUF2_LOG1("Arena: no room for %lu bytes in phase %u\r\n", size, _arena_cur);
+    return NULL;
+  }
+
+  _arena_top = top + size;
+  return _arena + top;
+}
+
+#endif
@@ -29,6 +29,11 @@
 #include <stdint.h>
 #include <string.h>
 #include "boards.h"
+#include "flash_geometry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 //--------------------------------------------------------------------+
 // Compiler
@@ -60,6 +65,17 @@
 #define BOARD_FLASH_APP_START  0
 #endif
 
+// Address of the application footer (TINYUF2_APP_FOOTER), default is the last 16 bytes of flash
+#ifndef BOARD_APP_FOOTER_ADDR
+#define BOARD_APP_FOOTER_ADDR  (BOARD_FLASH_ADDR_ZERO + board_flash_size() - 16)
+#endif
+
+// Flash erase unit in bytes (the smallest one if sectors are not uniform), advertised to the host
+// as physical block size in MSC READ CAPACITY(16)
+#ifndef BOARD_FLASH_ERASE_SIZE
+#define BOARD_FLASH_ERASE_SIZE 4096
+#endif
+
 
 #ifndef TUF2_LOG
   #define TUF2_LOG 2
@@ -80,6 +96,13 @@
 #define TINYUF2_DBL_TAP_DELAY    500
 #endif
 
+// Jump to application immediately instead of waiting TINYUF2_DBL_TAP_DELAY for a second reset.
+// The double tap magic is left in TINYUF2_DBL_TAP_REG, application must clear it once its own
+// TINYUF2_DBL_TAP_DELAY has passed, otherwise any following reset enters DFU (once)
+#ifndef TINYUF2_DBL_TAP_DEFERRED
+#define TINYUF2_DBL_TAP_DEFERRED 0
+#endif
+
 #ifndef TINYUF2_DBL_TAP_REG_SIZE
 #define TINYUF2_DBL_TAP_REG_SIZE  32
 #endif
@@ -99,6 +122,463 @@
 #define TINYUF2_CONST
 #endif
 
+// Queue uf2 blocks received by WRITE10 and program them from the main loop (usb task for RTOS)
+// so that USB reception overlaps with flash erase/program
+#ifndef TINYUF2_ASYNC_WRITE
+#define TINYUF2_ASYNC_WRITE 0
+#endif
+
+// Predict the image extent from numBlocks once the first generic family blocks agree on its start,
+// and erase it ahead of writing with board_flash_erase_ahead() while waiting for the host. Pays off
+// most with TINYUF2_ASYNC_WRITE. Incompatible with TINYUF2_DELTA_FLASH
+#ifndef TINYUF2_PRE_ERASE
+#define TINYUF2_PRE_ERASE 0
+#endif
+
+// Complete flashing this many ms after the last WRITE10 (or on SYNCHRONIZE CACHE / eject) when the
+// blocks missing from numWritten were all received but rejected, e.g unsupported family. Caches are
+// flushed and the image read back against TINYUF2_CURRENT_CRC if tracked. 0 to disable
+#ifndef TINYUF2_IDLE_COMPLETE
+#define TINYUF2_IDLE_COMPLETE 0
+#endif
+
+// Stay in DFU after a uf2 file is complete: write state is cleared and the next file is written as in
+// a new session (e.g bootloader update, application, then data region). Device resets once the drive
+// is ejected or a file named REBOOT is created in the root directory. Ports tracking erased units per
+// session must implement board_flash_session_reset()
+#ifndef TINYUF2_MULTI_SESSION
+#define TINYUF2_MULTI_SESSION 0
+#endif
+
+// Prefetch the next span of a sequential MSC read (CURRENT.UF2, raw LUN readback) into a second
+// CFG_TUD_MSC_BUFSIZE buffer from the main loop (usb task for RTOS) while usb sends the current one
+#ifndef TINYUF2_READ_AHEAD
+#define TINYUF2_READ_AHEAD 0
+#endif
+
+// Second MSC LUN mapping flash from BOARD_FLASH_APP_START 1:1 (512-byte sectors, no uf2 or FAT),
+// only exposed when DFU mode is entered with DBL_TAP_MAGIC_RAW_LUN set by the application.
+// Ejecting it after a write completes like a uf2 file
+#ifndef TINYUF2_RAW_LUN
+#define TINYUF2_RAW_LUN 0
+#endif
+
+// MSC LUN 1 exposing the data region of the port (board_data_*(), e.g ESP ffat partition) as a writable
+// drive for a FAT volume, with a write-back cache of one BOARD_DATA_ERASE_SIZE unit flushed on
+// SYNCHRONIZE CACHE, eject and before reset, see src/data_lun.c. Raw flash LUN becomes LUN 2
+#ifndef TINYUF2_DATA_LUN
+#define TINYUF2_DATA_LUN 0
+#endif
+
+#ifndef BOARD_DATA_ERASE_SIZE
+#define BOARD_DATA_ERASE_SIZE 4096
+#endif
+
+// USB Attached SCSI (UAS) as alternate setting 1 of the MSC interface for high speed ports, see src/uas.c.
+// Host queues commands while the current one is processed, WRITE10 data feeds the write pipeline
+// (TINYUF2_ASYNC_WRITE) as it arrives. Hosts without UAS keep using Bulk-Only Transport
+#ifndef TINYUF2_UAS
+#define TINYUF2_UAS 0
+#endif
+
+// Size in bytes of a static arena shared by buffers that are never live at the same time, see
+// src/arena.c: SD card read buffer (TINYUF2_SD_FLASH) before usb starts, async write queue
+// (TINYUF2_ASYNC_WRITE) and read-ahead buffer (TINYUF2_READ_AHEAD) afterwards. 0 gives each buffer
+// its own static storage
+#ifndef TINYUF2_ARENA_SIZE
+#define TINYUF2_ARENA_SIZE 0
+#endif
+
+// Collect payloads in a RAM cache per erase unit and only program it on flush when contents
+// differ from flash. Used by ports that otherwise program each payload directly (stm32)
+#ifndef TINYUF2_FLASH_CACHE
+#define TINYUF2_FLASH_CACHE 0
+#endif
+
+// Compare each payload against current flash and skip writing unchanged ones, an erase unit whose
+// payloads all match is never erased. Only done in erase units reported by board_flash_preserved():
+// others are erased by their first write, which would also wipe payloads skipped before in the unit,
+// so all their payloads are programmed
+#ifndef TINYUF2_DELTA_FLASH
+#define TINYUF2_DELTA_FLASH 0
+#endif
+
+// Generate CURRENT.UF2 with 476-byte payloads instead of 256, nearly halving readback transfer.
+// Resulting file is only accepted by bootloaders/tools supporting payloads larger than 256 bytes
+#ifndef TINYUF2_DENSE_CURRENT_UF2
+#define TINYUF2_DENSE_CURRENT_UF2 0
+#endif
+
+// Expose CURRENT.BIN: raw application flash contents without uf2 wrapping.
+// CFG_UF2_NUM_BLOCKS must be large enough for both CURRENT.BIN and CURRENT.UF2
+#ifndef TINYUF2_CURRENT_BIN
+#define TINYUF2_CURRENT_BIN 0
+#endif
+
+// Up to this many read-only raw files in the root directory (e.g one per partition: OTA_0.BIN, NVS.BIN)
+// from board_part_file(), served by memcpy from the memory mapped contents it returns. A file that does
+// not fit next to CURRENT.UF2 and an upload of the whole flash is left out. Not available with
+// TINYUF2_STATIC_LAYOUT
+#ifndef TINYUF2_PART_FILES
+#define TINYUF2_PART_FILES 0
+#endif
+
+// Expose CURRENT.CRC: CRC32 and length of the application image. Computed incrementally while
+// a sequential uf2 is flashed, otherwise lazily from flash (whole application region) on read
+#ifndef TINYUF2_CURRENT_CRC
+#define TINYUF2_CURRENT_CRC 0
+#endif
+
+// Expose SECTORS.CRC: address, size and CRC32 of each erase unit of the application region, at most
+// this many units. CRCs are computed on read and kept until the unit is written, tools/uf2sync.py
+// compares them with an image to send only the units that changed. 0 to disable
+#ifndef TINYUF2_SECTORS_CRC
+#define TINYUF2_SECTORS_CRC 0
+#endif
+
+// Compute CURRENT.CRC and SECTORS.CRC in the background while usb is idle (uf2_hash_task()), one
+// SECTORS.CRC unit or TINYUF2_IDLE_HASH_STEP bytes of CURRENT.CRC per call, restarted when flash is
+// written, so that reading them is usually instant
+#ifndef TINYUF2_IDLE_HASH
+#define TINYUF2_IDLE_HASH 0
+#endif
+
+#ifndef TINYUF2_IDLE_HASH_STEP
+#define TINYUF2_IDLE_HASH_STEP 4096
+#endif
+
+// Size CURRENT.UF2 (and CURRENT.BIN/CURRENT.CRC) by the application extent instead of the whole
+// flash: board_flash_app_size() if implemented, otherwise the last non-erased byte of flash
+#ifndef TINYUF2_CURRENT_UF2_EXTENT
+#define TINYUF2_CURRENT_UF2_EXTENT 0
+#endif
+
+// Collect flashing statistics (throughput, erase/write time, host wait, block latency), exposed as
+// STATS.TXT and over CDC if enabled. Timing uses board_cycle_count()
+#ifndef TINYUF2_STATS
+#define TINYUF2_STATS 0
+#endif
+
+// Keep erase count and latest erase duration of each erase unit (port defined, e.g sector) across
+// DFU sessions in TINYUF2_WEAR_LOG_PTR, exposed as WEAR.TXT. Log is no-init RAM by default (lost on
+// power loss, application must not use it), port may point it to a backup domain instead.
+// Units beyond TINYUF2_WEAR_UNITS are ignored
+#ifndef TINYUF2_WEAR_LOG
+#define TINYUF2_WEAR_LOG 0
+#endif
+
+#ifndef TINYUF2_WEAR_UNITS
+#define TINYUF2_WEAR_UNITS 16
+#endif
+
+// Write a footer with image length and CRC32 after flashing completes and require it at boot:
+// 1 check footer only, 2 also verify image CRC (board_hash_*() if available). Footer is invalidated
+// (0xFF) by the first flash write and rewritten in the same session at completion: board_flash_write()
+// must support this (RAM cache ports, stm32 without ECC). Application must not use its location
+#ifndef TINYUF2_APP_FOOTER
+#define TINYUF2_APP_FOOTER 0
+#endif
+
+// Record boot phase timestamps (board_cycle_count) in no-init RAM for the application to read
+// after the jump, see board_boot_trace_t. Linker script must reserve _board_boot_trace
+#ifndef TINYUF2_BOOT_TRACE
+#define TINYUF2_BOOT_TRACE 0
+#endif
+
+// Record boot and DFU decisions (double tap value, app checks, bootloader protection, rejected uf2
+// blocks, flash write failures) as 12-byte events in a ring of TINYUF2_EVENT_COUNT entries at
+// TINYUF2_EVENT_LOG_PTR, exposed as EVENTS.TXT. No-init RAM by default (linker script reserves
+// _board_event_log), kept across resets until power loss. Events are timestamped with board_cycle_count()
+#ifndef TINYUF2_EVENT_LOG
+#define TINYUF2_EVENT_LOG 0
+#endif
+
+// must be a power of 2
+#ifndef TINYUF2_EVENT_COUNT
+#define TINYUF2_EVENT_COUNT 16
+#endif
+
+// Run flash erase/program loops from RAM on ports supporting it, so the CPU does not fetch code from
+// the flash array being written. Interrupt handlers still in flash wait for the operation to finish
+#ifndef TINYUF2_FLASH_RAMFUNC
+#define TINYUF2_FLASH_RAMFUNC 0
+#endif
+
+// On dual bank flash (stm32f42x/f43x 2MB, stm32l4+) start erasing a bank 2 sector without waiting and
+// hold the payload that entered it until the next write/flush, code keeps running from bank 1 meanwhile
+#ifndef TINYUF2_FLASH_BG_ERASE
+#define TINYUF2_FLASH_BG_ERASE 0
+#endif
+
+// Verify programmed data once per erase unit instead of comparing each write: source words are fed to
+// the CRC unit while programming and flash is read back through it when the unit is complete (stm32)
+#ifndef TINYUF2_FLASH_VERIFY_CRC
+#define TINYUF2_FLASH_VERIFY_CRC 0
+#endif
+
+// Bound flash operations to this many times their typical duration (board_flash_info(), at least
+// 1ms more), an operation overrunning it is retried with backoff up to TINYUF2_FLASH_RETRIES times
+// and then given up, see uf2_flash_timeout(). 0 waits forever
+#ifndef TINYUF2_FLASH_TIMEOUT
+#define TINYUF2_FLASH_TIMEOUT 0
+#endif
+
+#ifndef TINYUF2_FLASH_RETRIES
+#define TINYUF2_FLASH_RETRIES 3
+#endif
+
+// Framed flash protocol (info/write/read/erase/hash/stats) on the CDC interface, see src/cdc.c.
+// Requires CFG_TUD_CDC, replaces sending statistics on any CDC input
+#ifndef TINYUF2_CDC_FLASH
+#define TINYUF2_CDC_FLASH 0
+#endif
+
+// Export a board_service_t table of flash calls (write/flush/erase/hash) in section .tinyuf2_service,
+// placed at a fixed address by the port linker script, so that the application can stream OTA data
+// through the flash engine of the bootloader. Requires board_service_ram_init(), see src/service.c
+#ifndef TINYUF2_SERVICE_TABLE
+#define TINYUF2_SERVICE_TABLE 0
+#endif
+
+// Apply an image staged by the application at BOARD_STAGING_ADDR (BOARD_STAGING_SIZE bytes, defined by
+// port or board) at the next reset: bank swap with board_staged_swap() or copy of the erase units
+// that differ, see src/staged.c. Not with TINYUF2_SIGNED_UF2, the staged image is only CRC checked
+#ifndef TINYUF2_STAGED_UPDATE
+#define TINYUF2_STAGED_UPDATE 0
+#endif
+
+// Fast DFU entry requested by the application: DBL_TAP_MAGIC_WARM set before reset skips the app checks,
+// dfu() of the service table (TINYUF2_SERVICE_TABLE) starts DFU mode without reset through
+// board_dfu_warm_enter(), keeping clocks handed over by the application with board_init_warm()
+#ifndef TINYUF2_WARM_DFU
+#define TINYUF2_WARM_DFU 0
+#endif
+
+// Log over CDC (LOGGER=cdc): log output is copied into a RAM ring buffer of TINYUF2_CDC_LOG_SIZE bytes
+// and sent from the main loop instead of waiting for board_uart_write(). Output is dropped when full
+#ifndef TINYUF2_CDC_LOG
+#define TINYUF2_CDC_LOG 0
+#endif
+
+#ifndef TINYUF2_CDC_LOG_SIZE
+#define TINYUF2_CDC_LOG_SIZE 1024
+#endif
+
+// Defer log formatting: TUF2_LOG1/2 only record the format string and up to 5 integer arguments into
+// a ring of TINYUF2_LOG_DEFER_COUNT entries, printed by log_task() when usb is idle. Format must be
+// a literal, arguments integers or pointers to constant strings. Entries are dropped (counted) when full
+#ifndef TINYUF2_LOG_DEFER
+#define TINYUF2_LOG_DEFER 0
+#endif
+
+#ifndef TINYUF2_LOG_DEFER_COUNT
+#define TINYUF2_LOG_DEFER_COUNT 32
+#endif
+
+// Accept LZ4 compressed uf2 payloads (UF2_FLAG_LZ4, see tools/uf2lz4.py). Each block is decoded into
+// a UF2_LZ4_MAX_SIZE RAM buffer then programmed, cutting the amount of data sent over usb
+#ifndef TINYUF2_UF2_LZ4
+#define TINYUF2_UF2_LZ4 0
+#endif
+
+// Accept fill blocks (UF2_FLAG_FILL, tools/uf2opt.py --fill) standing for a range of a repeated word, so
+// that gaps and padding of sparse images are not sent. Whole erase units of erased value are only
+// erased with board_flash_erase_ahead() when the port has it
+#ifndef TINYUF2_UF2_FILL
+#define TINYUF2_UF2_FILL 0
+#endif
+
+// Compare blocks flagged UF2_FLAG_VERIFY (tools/uf2opt.py --verify) against flash instead of writing
+// them, nothing is erased or programmed and the drive stays mounted. Result is in VERIFY.TXT
+#ifndef TINYUF2_VERIFY_UF2
+#define TINYUF2_VERIFY_UF2 0
+#endif
+
+// Keep a progress journal of the file being written in TINYUF2_RESUME_PTR: image ID from the SHA-2 tag of its
+// blocks (tools/uf2opt.py --image-id) and the number of leading blocks known to be in flash, advanced with a
+// flush whenever the file moves on to the next erase unit. After an interrupted write, INFO_UF2.TXT has the
+// Resume line and a file with the same image ID is taken as written up to that block, so that only the rest
+// has to be sent (tools/uf2raw.py --resume). Needs files in order of increasing addresses and a port erasing
+// each unit on its first write. Journal is no-init RAM by default, port may point it to a backup domain
+#ifndef TINYUF2_RESUME
+#define TINYUF2_RESUME 0
+#endif
+
+// Runtime tunables (read_ahead, pre_erase, clock_boost, log) in a writable CONFIG.TXT, see src/config.c.
+// A block written by the host starting with the file's header line is parsed into TINYUF2_CONFIG_PTR,
+// no-init RAM by default (linker script reserves it), and reading CONFIG.TXT shows the effective values
+#ifndef TINYUF2_CONFIG_TXT
+#define TINYUF2_CONFIG_TXT 0
+#endif
+
+// Run an application linked for RAM without flashing it: uf2 blocks of BOARD_UF2_FAMILY_ID targeting
+// [BOARD_RAM_APP_ADDR, BOARD_RAM_APP_ADDR + BOARD_RAM_APP_SIZE) are copied there, and once the file is
+// complete board_ram_app_start() is invoked instead of board_dfu_complete(). The region must not be
+// used by the bootloader, contents only survive until power off
+#ifndef TINYUF2_RAM_APP
+#define TINYUF2_RAM_APP 0
+#endif
+
+// Blink RGB while writing: a strip update (bit-banged or RMT on some boards) from timer context every
+// 25 ms. With 0 RGB stays solid while writing and only the LED blinks, no strip update until finished
+#ifndef TINYUF2_RGB_WRITING_BLINK
+#define TINYUF2_RGB_WRITING_BLINK 1
+#endif
+
+// Sleep in the main loop (without RTOS) when no work is pending: board_idle() is called until the next
+// usb event or interrupt (e.g timer) instead of spinning on tud_task()
+#ifndef TINYUF2_IDLE_SLEEP
+#define TINYUF2_IDLE_SLEEP 0
+#endif
+
+// Timer interrupt only counts the tick, indicator (LED/RGB) is updated from the main loop (without RTOS)
+// at most once per iteration, so that usb interrupt is not delayed by a strip update
+#ifndef TINYUF2_TIMER_DEFER
+#define TINYUF2_TIMER_DEFER 0
+#endif
+
+// Flash TINYUF2_SD_FLASH_FILE from a FAT formatted SD card when entering DFU mode, before usb is
+// started. Requires lib/fatfs and board_sd_init()/board_sd_read(), see src/sd_flash.c
+#ifndef TINYUF2_SD_FLASH
+#define TINYUF2_SD_FLASH 0
+#endif
+
+#ifndef TINYUF2_SD_FLASH_FILE
+#define TINYUF2_SD_FLASH_FILE "FIRMWARE.UF2"
+#endif
+
+// Only accept images signed with tools/uf2sign.py: a UF2_FLAG_SIGNATURE block carries the ECDSA P-256
+// signature of the image SHA-256, checked with micro-ecc once the file is complete. Application is
+// erased if it is missing or invalid. TINYUF2_SIGN_KEY_HEADER must define TINYUF2_SIGN_PUBKEY, see
+// src/signature.c. Only BOARD_UF2_FAMILY_ID flash payloads are covered (not TINYUF2_RAM_APP, DFU or CDC)
+#ifndef TINYUF2_SIGNED_UF2
+#define TINYUF2_SIGNED_UF2 0
+#endif
+
+#ifndef TINYUF2_SIGN_KEY_HEADER
+#define TINYUF2_SIGN_KEY_HEADER "sign_key.h"
+#endif
+
+// Accept AES-128-CTR encrypted uf2 payloads (UF2_FLAG_AES, see tools/uf2aes.py), decrypted in place in
+// the uf2 block before programming. Key comes from board_aes_key() or stays in the crypto peripheral
+// driven by board_aes_ctr_init()/board_aes_ctr_crypt(), see src/aes_ctr.c
+#ifndef TINYUF2_UF2_AES
+#define TINYUF2_UF2_AES 0
+#endif
+
+// Reject uf2 files built for another board from their extension tags (UF2_FLAG_EXTENSION_TAGS, see
+// tools/uf2opt.py --board-id): a description tag must equal UF2_BOARD_ID, a device type tag must equal
+// BOARD_UF2_DEVICE_TYPE if the port defines it. Once a block is rejected, no block of that file is
+// programmed, so nothing is erased. Files without tags are accepted as before
+#ifndef TINYUF2_UF2_TAGS
+#define TINYUF2_UF2_TAGS 0
+#endif
+
+// Resolve the whole GhostFAT layout (file table, FAT sector classes, CURRENT.UF2 size) at compile time
+// for ports with a fixed flash size TINYUF2_FLASH_SIZE (BOARD_FLASH_SIZE by default), the file table is
+// then const and uf2_init() only resets write tracking. Not available with TINYUF2_STATS and
+// TINYUF2_CURRENT_UF2_EXTENT whose sizes are only known at runtime
+#ifndef TINYUF2_STATIC_LAYOUT
+#define TINYUF2_STATIC_LAYOUT 0
+#endif
+
+// Size the exposed volume at uf2_init() to the smallest FAT layout holding all files plus an uploaded
+// uf2 of the whole flash, instead of always CFG_UF2_NUM_BLOCKS which then becomes the upper bound.
+// Cluster count is kept within the compatibility margins of the FAT type, so small parts still get
+// about 2MB with 512-byte clusters. Not available with TINYUF2_STATIC_LAYOUT
+#ifndef TINYUF2_AUTO_GEOMETRY
+#define TINYUF2_AUTO_GEOMETRY 0
+#endif
+
+// Fast mount profile, shortens the time from reset to a mounted drive: string descriptors (serial from
+// board_usb_get_serial() included) are built once when DFU mode starts instead of on every request,
+// MODE SENSE(10) reports the caching page so that hosts stop probing, and the FAT sectors read at mount
+// are kept in TINYUF2_META_CACHE (2 by default). Mount timing is reported by TINYUF2_STATS
+#ifndef TINYUF2_FAST_MOUNT
+#define TINYUF2_FAST_MOUNT 0
+#endif
+
+// Number of generated FAT sectors (head and tail, the ones with end-of-chain markers) kept in RAM for
+// repeated host reads, each takes CFG_UF2_SECTOR_SIZE bytes. Dropped when uf2_init() lays out files
+#ifndef TINYUF2_META_CACHE
+  #if TINYUF2_FAST_MOUNT
+    #define TINYUF2_META_CACHE 2
+  #else
+    #define TINYUF2_META_CACHE 0
+  #endif
+#endif
+
+// Start usb before board_flash_init() and uf2_init(), which run from the main loop (usb task with RTOS)
+// right after: enumeration does not wait for slow flash bring up (self copy, QSPI reset, partition
+// lookup). MSC reports the medium becoming ready until it is done. Not with TINYUF2_SD_FLASH
+#ifndef TINYUF2_DEFER_FLASH_INIT
+#define TINYUF2_DEFER_FLASH_INIT 0
+#endif
+
+#if TINYUF2_DEFER_FLASH_INIT && TINYUF2_SD_FLASH
+#error "TINYUF2_SD_FLASH needs flash before usb starts, TINYUF2_DEFER_FLASH_INIT is not supported"
+#endif
+
+// List diagnostic files (STATS.TXT, WEAR.TXT, CURRENT.CRC) in a DIAG subdirectory with long name
+// "Diagnostics" instead of the root directory. Directory entries are still built once in uf2_init()
+#ifndef TINYUF2_DIAG_DIR
+#define TINYUF2_DIAG_DIR 0
+#endif
+
+// Number of non-uf2 512-byte blocks written by host (its own filesystem metadata) kept in RAM and
+// served back on read, e.g 8 for 4 KB. Dropped when uf2_init() lays out files
+#ifndef TINYUF2_WRITE_OVERLAY
+#define TINYUF2_WRITE_OVERLAY 0
+#endif
+
+// Number of runs of the host MSC write pattern recorded (msc_trace_t, 12 bytes each), read back with
+// CDC_CMD_TRACE (TINYUF2_CDC_FLASH) e.g by tools/msc_bench.py. Runs beyond that are only counted
+#ifndef TINYUF2_WRITE_TRACE
+#define TINYUF2_WRITE_TRACE 0
+#endif
+
+// Sampling profiler at TINYUF2_PROFILE Hz, see src/profile.c: board_profile_start() timer records the
+// interrupted PC into a ring of TINYUF2_PROFILE_SAMPLES, drained over RTT channel 1 (LOGGER_RTT) or
+// CDC_CMD_PROFILE (TINYUF2_CDC_FLASH) and symbolized by tools/pcprofile.py
+#ifndef TINYUF2_PROFILE
+#define TINYUF2_PROFILE 0
+#endif
+
+#ifndef TINYUF2_PROFILE_SAMPLES
+#define TINYUF2_PROFILE_SAMPLES 512
+#endif
+
+// Add "Raw-Write" line to INFO_UF2.TXT: first LBA and chunk size for writing an uf2 straight to the
+// block device (tools/uf2raw.py). Uf2 blocks are accepted at any LBA, chunk covers whole erase units
+#ifndef TINYUF2_RAW_WRITE_HINT
+#define TINYUF2_RAW_WRITE_HINT 0
+#endif
+
+// Place a function in RAM: linker script must put .ramfunc* in an executable RAM output section
+// copied by the startup code (e.g .data). Callees must be in RAM too (TINYUF2_RAMFUNC or inline)
+#ifndef TINYUF2_RAMFUNC
+#define TINYUF2_RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#endif
+
+// Hot path of uf2 block read/write. Ports with a tightly coupled memory (e.g ITCM on Cortex-M7)
+// define it in boards.h as a section their linker script places there, nothing by default
+#ifndef TUF2_HOT
+#define TUF2_HOT
+#endif
+
+// DFU-only state (write state, flash caches) that the C runtime should not zero on every boot, it is
+// cleared on DFU entry by uf2_init(), msc_init() and board_flash_init() instead. Ports define it in
+// boards.h as a section their linker script keeps out of .bss (NOLOAD), ordinary .bss by default
+#ifndef TUF2_DFU_NOINIT
+#define TUF2_DFU_NOINIT
+#endif
+
+// Band and line buffers of src/screen.c. Ports expanding columns with a 2D accelerator define it in
+// boards.h as a section of RAM its bus master can reach, cache line aligned if the data cache is on
+#ifndef TUF2_DISPLAY_RAM
+#define TUF2_DISPLAY_RAM
+#endif
+
 // Use favicon.ico + autorun.inf (only works with windows)
 // define TINYUF2_FAVICON_HEADER to enable this feature
 
@@ -123,9 +603,107 @@ extern DBL_TAP_TYPE _board_dfu_dbl_tap[];
 #define TINYUF2_DBL_TAP_REG   _board_dfu_dbl_tap[0]
 #endif
 
+// Boot phase timestamps in board_cycle_count() ticks, only valid if magic matches.
+// Application must exclude this region from its RAM to read it after the jump
+typedef struct {
+  uint32_t magic;       // BOOT_TRACE_MAGIC, written right before jumping to application
+  uint32_t start;       // main() entered
+  uint32_t init;        // board_init() and board_init2() done
+  uint32_t dfu_check;   // application checked, double tap window elapsed
+  uint32_t jump;        // teardown done, board_app_jump() is next
+} board_boot_trace_t;
+
+#define BOOT_TRACE_MAGIC  0xb0077ace
+
+// Erase wear log (TINYUF2_WEAR_LOG), reset when magic does not match
+typedef struct {
+  uint32_t magic;       // WEAR_LOG_MAGIC
+  uint32_t sessions;    // DFU sessions since log was reset
+  struct {
+    uint32_t count;     // erases
+    uint32_t cycles;    // duration of latest erase in board_cycle_count() cycles
+  } unit[TINYUF2_WEAR_UNITS];
+} board_wear_log_t;
+
+#define WEAR_LOG_MAGIC  0x3ea5106e
+
+// Event log (TINYUF2_EVENT_LOG), reset when magic does not match
+typedef struct {
+  uint32_t magic;       // EVENT_LOG_MAGIC
+  uint32_t boots;       // bootloader starts since log was reset
+  uint32_t head;        // events recorded, the next one goes to event[head % TINYUF2_EVENT_COUNT]
+  struct {
+    uint32_t time;      // board_cycle_count() when recorded
+    uint32_t arg;       // event specific, see UF2_EVENT_* in uf2.h
+    uint16_t id;        // UF2_EVENT_*
+    uint16_t boot;      // low 16 bits of boots when recorded
+  } event[TINYUF2_EVENT_COUNT];
+} board_event_log_t;
+
+#define EVENT_LOG_MAGIC  0xe7e27106
+
+// Progress journal (TINYUF2_RESUME), only valid if magic and check match
+typedef struct {
+  uint32_t magic;       // RESUME_LOG_MAGIC
+  uint32_t image_id[2]; // first 8 bytes of the UF2_TAG_SHA2 tag of the file
+  uint32_t num_blocks;  // numBlocks of the file
+  uint32_t done;        // blocks 0 to done - 1 are in flash
+  uint32_t addr;        // erase unit of block done, first one left to write
+  uint32_t check;       // ~(magic ^ image_id[0] ^ image_id[1] ^ num_blocks ^ done ^ addr)
+} board_resume_log_t;
+
+#define RESUME_LOG_MAGIC  0x4e5e7a11
+
+// Runtime tunables (TINYUF2_CONFIG_TXT), only valid if magic and check match
+typedef struct {
+  uint32_t magic;       // CONFIG_MAGIC
+  uint32_t read_ahead;  // prefetch sequential reads (TINYUF2_READ_AHEAD)
+  uint32_t pre_erase;   // blocks agreeing on the image start before erasing ahead (TINYUF2_PRE_ERASE), 0 disables
+  uint32_t clock_boost; // board_dfu_clock_boost() at DFU entry
+  uint32_t log;         // log output (TUF2_LOG)
+  uint32_t check;       // ~(magic ^ read_ahead ^ pre_erase ^ clock_boost ^ log)
+} board_config_t;
+
+#define CONFIG_MAGIC  0xc0f1e0a5
+
+// Effective tunables, loaded by uf2_config_init() (TINYUF2_CONFIG_TXT)
+board_config_t const* uf2_config(void);
+
+#if TINYUF2_WEAR_LOG && !defined(TINYUF2_WEAR_LOG_PTR)
+// defined by linker script
+extern board_wear_log_t _board_wear_log[];
+#define TINYUF2_WEAR_LOG_PTR  _board_wear_log
+#endif
+
+#if TINYUF2_EVENT_LOG && !defined(TINYUF2_EVENT_LOG_PTR)
+// defined by linker script
+extern board_event_log_t _board_event_log[];
+#define TINYUF2_EVENT_LOG_PTR  _board_event_log
+#endif
+
+#if TINYUF2_RESUME && !defined(TINYUF2_RESUME_PTR)
+// defined by linker script
+extern board_resume_log_t _board_resume_log[];
+#define TINYUF2_RESUME_PTR  _board_resume_log
+#endif
+
+#if TINYUF2_CONFIG_TXT && !defined(TINYUF2_CONFIG_PTR)
+// defined by linker script
+extern board_config_t _board_config[];
+#define TINYUF2_CONFIG_PTR  _board_config
+#endif
+
+#if TINYUF2_BOOT_TRACE && !defined(TINYUF2_BOOT_TRACE_PTR)
+// defined by linker script
+extern board_boot_trace_t _board_boot_trace[];
+#define TINYUF2_BOOT_TRACE_PTR  _board_boot_trace
+#endif
+
 #define DBL_TAP_MAGIC            (0xf01669ef >> (32 - TINYUF2_DBL_TAP_REG_SIZE)) // Enter DFU magic
 #define DBL_TAP_MAGIC_QUICK_BOOT (0xf02669ef >> (32 - TINYUF2_DBL_TAP_REG_SIZE)) // Skip double tap delay detection
 #define DBL_TAP_MAGIC_ERASE_APP  (0xf5e80ab4 >> (32 - TINYUF2_DBL_TAP_REG_SIZE)) // Erase entire application !!
+#define DBL_TAP_MAGIC_RAW_LUN    (0xf03669ef >> (32 - TINYUF2_DBL_TAP_REG_SIZE)) // Enter DFU with raw flash LUN (TINYUF2_RAW_LUN)
+#define DBL_TAP_MAGIC_WARM       (0xf04669ef >> (32 - TINYUF2_DBL_TAP_REG_SIZE)) // Enter DFU without app checks (TINYUF2_WARM_DFU)
 
 //--------------------------------------------------------------------+
 // Basic API
@@ -149,6 +727,15 @@ void board_teardown(void) __attribute__ ((weak));
 // board_teardown2() is called immediately after board_init()
 void board_teardown2(void) __attribute__ ((weak));
 
+// Replaces board_init() when DFU is entered from the application without reset (TINYUF2_WARM_DFU):
+// keep clocks and power as left by the application if they are in the state board_init() sets up,
+// otherwise do a full board_init(). Peripherals used by the bootloader must still be set up (optional)
+void board_init_warm(void) __attribute__ ((weak));
+
+// Warm DFU entry from the application (TINYUF2_WARM_DFU): mask and clear all interrupts, switch to the
+// bootloader vector table and stack, then call entry. No return, privileged mode required (optional)
+void board_dfu_warm_enter(void (*entry)(void)) __attribute__ ((weak));
+
 // Reset board, no return
 void board_reset(void);
 
@@ -173,6 +760,12 @@ void board_timer_stop(void);
 // timer event handler, must be called by port/board
 extern void board_timer_handler(void);
 
+// Free running cycle counter for statistics e.g DWT on Cortex-M, mcycle on RISC-V (optional)
+uint32_t board_cycle_count(void) __attribute__ ((weak));
+
+// Frequency of board_cycle_count() in Hz, used to report throughput (optional)
+uint32_t board_cycle_freq(void) __attribute__ ((weak));
+
 // Check if application is valid
 bool board_app_valid(void);
 
@@ -191,6 +784,54 @@ void board_dfu_init(void);
 // DFU is complete, should reset or jump to application mode and not return
 void board_dfu_complete(void);
 
+// Raise core/flash clocks above board_init() settings while in DFU mode (optional).
+// Called right before board_dfu_init() so that usb clock setup sees the final clock
+void board_dfu_clock_boost(void) __attribute__ ((weak));
+
+// Undo board_dfu_clock_boost(), should be called by board_dfu_complete() before handing over
+// to the application so that it starts with the clocks of board_init() (optional)
+void board_clock_restore(void) __attribute__ ((weak));
+
+// Flashing progress through MSC, done out of total uf2 blocks, e.g to draw a bar on a small display (optional).
+// Called after every write, board should only redraw what changed
+void board_write_progress(uint32_t done, uint32_t total) __attribute__ ((weak));
+
+// Supply may not last through an erase, e.g no VBUS and battery low on a PMU board (optional).
+// Polled by the write engine between blocks, must be cheap (rate limit bus accesses). While true,
+// cached data is committed whenever the host pauses and speculative pre-erase is deferred
+bool board_power_low(void) __attribute__ ((weak));
+
+// Cut flash peak current e.g with a lower flash clock while power is low (true), restore full
+// speed (false). Called on board_power_low() transitions (optional)
+void board_flash_power_save(bool enable) __attribute__ ((weak));
+
+// Start application copied to RAM at addr (TINYUF2_RAM_APP), should not return
+void board_ram_app_start(uint32_t addr);
+
+// Detect and initialize SD card (TINYUF2_SD_FLASH), false if there is no (usable) card
+bool board_sd_init(void);
+
+// Read count 512-byte blocks starting at lba from SD card (TINYUF2_SD_FLASH), multi-block read preferred
+bool board_sd_read(uint32_t lba, uint8_t* buf, uint32_t count);
+
+// Data region of the data LUN (TINYUF2_DATA_LUN): size in bytes, false if the board has none.
+// Offsets are from region start, erase takes whole BOARD_DATA_ERASE_SIZE units, program an erased range
+bool board_data_init(uint32_t* size);
+bool board_data_read(uint32_t offset, void* buffer, uint32_t len);
+bool board_data_erase(uint32_t offset, uint32_t len);
+bool board_data_program(uint32_t offset, void const* data, uint32_t len);
+
+// Start the profiler timer at hz with highest interrupt priority (TINYUF2_PROFILE). On Cortex-M its
+// handler is naked and only branches to uf2_profile_isr(), other cores call uf2_profile_sample()
+void board_profile_start(uint32_t hz);
+
+// Clear the profiler timer interrupt, called by uf2_profile_isr()
+void board_profile_ack(void);
+
+// Nothing to do (TINYUF2_IDLE_SLEEP): sleep until an interrupt unless tud_task_event_ready(). Check and
+// sleep must not race with usb interrupt e.g __disable_irq(), check, __WFI(), __enable_irq() on Cortex-M
+void board_idle(void);
+
 // Fill Serial Number and return its length (limit to 16 bytes)
 uint8_t board_usb_get_serial(uint8_t serial_id[16]);
 
@@ -207,35 +848,224 @@ void board_flash_init(void);
 // Get size of flash
 uint32_t board_flash_size(void);
 
-// Read from flash
+// Get size of the application image starting at BOARD_FLASH_APP_START (optional), 0 if unknown
+uint32_t board_flash_app_size(void) __attribute__ ((weak));
+
+// Raw file idx of TINYUF2_PART_FILES (optional): fill its 8.3 name (space padded, upper case) and size,
+// return its memory mapped contents or NULL if there is no such file. Called by every uf2_init()
+void const* board_part_file(uint32_t idx, char name[11], uint32_t* size) __attribute__ ((weak));
+
+// Read from flash, len may span several uf2 payloads (up to CFG_TUD_MSC_BUFSIZE)
 void board_flash_read (uint32_t addr, void* buffer, uint32_t len);
 
-// Write to flash, len is uf2's payload size (often 256 bytes)
+// Address at which len bytes of flash from addr can be sent in place by the usb controller (optional):
+// memory mapped, reachable by its DMA, word aligned and holding no data still cached for writing.
+// NULL otherwise. Lets UAS readback of CURRENT.BIN and the raw LUN skip board_flash_read()
+void const* board_flash_mapped(uint32_t addr, uint32_t len) __attribute__ ((weak));
+
+// Streaming CRC32 (IEEE 802.3, same as CURRENT.CRC) with a hash/CRC peripheral (optional, all three
+// or none). Used for flash contents hashing, software CRC is used otherwise. update() data is word
+// aligned and len is a multiple of 4
+void     board_hash_init(void) __attribute__ ((weak));
+void     board_hash_update(void const* data, uint32_t len) __attribute__ ((weak));
+uint32_t board_hash_final(void) __attribute__ ((weak));
+
+// Streaming SHA-256 with a hash peripheral for signed images (optional, all three or none), software
+// SHA-256 is used otherwise. update() data is word aligned
+void board_sha256_init(void) __attribute__ ((weak));
+void board_sha256_update(void const* data, uint32_t len) __attribute__ ((weak));
+void board_sha256_final(uint8_t hash[32]) __attribute__ ((weak));
+
+// AES-128 key of encrypted uf2 payloads (TINYUF2_UF2_AES) read from secure storage, false if not
+// provisioned. Only used when a crypto peripheral is not set up by board_aes_ctr_init()
+bool board_aes_key(uint8_t key[16]) __attribute__ ((weak));
+
+// AES-128-CTR with a crypto peripheral (optional, both or none). init() loads the key once per session,
+// false to fall back to software. crypt() decrypts data in place, counter is the first counter block
+// (low 32 bits big endian incremented per 16 bytes)
+bool board_aes_ctr_init(void) __attribute__ ((weak));
+void board_aes_ctr_crypt(uint8_t const counter[16], uint8_t* data, uint32_t len) __attribute__ ((weak));
+
+// Write to flash, len is uf2's payload size (often 256 bytes, up to 476 bytes and multiple of 4).
+// addr is word aligned, data may span several pages/sectors
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len);
 
+// Payload of board_flash_write_v(), same constraints as board_flash_write() parameters
+typedef struct {
+  uint32_t addr;
+  void const* data;
+  uint32_t len;
+} board_flash_vec_t;
+
+// Write count payloads of one WRITE10 buffer in order (optional), so that address decode and
+// unlock are done once. Payloads are usually but not always contiguous, board_flash_write() is
+// called per payload if not implemented
+bool board_flash_write_v(board_flash_vec_t const* vec, uint32_t count) __attribute__ ((weak));
+
+// Erase flash at addr ahead of writing (TINYUF2_PRE_ERASE) with the largest erase that fits in len
+// (e.g bank or 64KB block), at least the erase unit at addr. Units erased or written earlier in this
+// session must be skipped, erased ones are not erased again by board_flash_write(). Return bytes
+// covered from addr (may go beyond len), 0 to stop
+uint32_t board_flash_erase_ahead(uint32_t addr, uint32_t len) __attribute__ ((weak));
+
+// True if addr to addr + len lies in erase units erased (or found blank) in this session whose bytes
+// not written since still read erased (optional). Payloads made of the erased value are then skipped
+// instead of programmed. Units assembled in a write cache loaded with their previous contents must
+// report false
+bool board_flash_erased(uint32_t addr, uint32_t len) __attribute__ ((weak));
+
+// True if board_flash_write() keeps the bytes it is not given of the erase units of addr to addr + len,
+// e.g by loading them into a RAM cache first (optional). TINYUF2_DELTA_FLASH only skips payloads
+// matching flash in such units
+bool board_flash_preserved(uint32_t addr, uint32_t len) __attribute__ ((weak));
+
 // Flush/Sync flash contents
 void board_flash_flush(void);
 
+// Forget erase units erased in this session, next file is written as in a new one (TINYUF2_MULTI_SESSION).
+// Called after the completed file is flushed
+void board_flash_session_reset(void) __attribute__ ((weak));
+
 // Erase application
 void board_flash_erase_app(void);
 
 // Protect bootloader in flash
 bool board_flash_protect_bootloader(bool protect);
 
+// Flash capabilities
+enum {
+  BOARD_FLASH_CAP_BIT_CLEAR = 0x01, // programmed bits can be cleared (1 -> 0) again without erase
+  BOARD_FLASH_CAP_XIP       = 0x02, // contents are memory mapped at xip_base while in bootloader
+};
+
+typedef struct {
+  flash_geometry_t geometry;  // erase units, base is the uf2 address of the first one
+  uint32_t xip_base;          // address geometry.base is readable at (BOARD_FLASH_CAP_XIP)
+  uint32_t erased_word;       // value read from an erased word, 0xFFFFFFFF on most parts
+  uint16_t program_size;      // smallest programmable unit in bytes
+  uint16_t caps;              // BOARD_FLASH_CAP_*
+  uint32_t erase_us;          // typical erase time of the smallest erase unit, 0 if unknown
+  uint32_t program_us;        // typical program time of 256 bytes, 0 if unknown
+} board_flash_info_t;
+
+// Describe flash to the core (optional)
+board_flash_info_t const* board_flash_info(void) __attribute__ ((weak));
+
+// Provided by the core: board_flash_info(), otherwise uniform BOARD_FLASH_ERASE_SIZE units
+// from BOARD_FLASH_ADDR_ZERO erased to 0xFF
+board_flash_info_t const* uf2_flash_info(void);
+
+// Deadline in ms of an operation typically taking typical_us (TINYUF2_FLASH_TIMEOUT), UINT32_MAX
+// (HAL_MAX_DELAY) if disabled or typical time is unknown
+uint32_t uf2_flash_deadline_ms(uint32_t typical_us);
+
+// Deadlines of erasing and programming len bytes, from the typical times of uf2_flash_info()
+uint32_t uf2_flash_erase_deadline_ms(uint32_t len);
+uint32_t uf2_flash_program_deadline_ms(uint32_t len);
+
+// Wait in ms before retry attempt (1 .. TINYUF2_FLASH_RETRIES) of an operation that overran
+uint32_t uf2_flash_backoff_ms(uint32_t attempt);
+
+// Report operation at addr that overran its deadline (UF2_EVENT_FLASH_TIMEOUT, STATS.TXT), failed
+// once retries are exhausted and it is given up
+void uf2_flash_timeout(uint32_t addr, bool failed);
+
+// Flash service table (TINYUF2_SERVICE_TABLE) found by the application at the address the port linker
+// script gives section .tinyuf2_service. Calls appended in later versions are beyond size of older
+// bootloaders. init() must be called first, RAM from ram_start to ram_end then belongs to the
+// bootloader until reset
+typedef struct {
+  uint32_t magic;       // SERVICE_MAGIC
+  uint16_t version;     // SERVICE_VERSION
+  uint16_t size;        // sizeof(board_service_t) of the bootloader
+  void* ram_start;      // bootloader .data/.bss used by the calls
+  void* ram_end;
+
+  bool (*init)(void);                                             // set up bootloader RAM and flash
+  bool (*write)(uint32_t addr, void const* data, uint32_t len);   // word aligned, outside bootloader
+  void (*flush)(void);                                            // program all cached data
+  uint32_t (*erase)(uint32_t addr, uint32_t len);                 // erase ahead, bytes covered or 0
+  uint32_t (*hash)(uint32_t addr, uint32_t len);                  // CRC32 same as CURRENT.CRC
+  void (*read)(uint32_t addr, void* buffer, uint32_t len);
+  board_flash_info_t const* (*info)(void);
+
+  // version 2
+  bool (*stage)(uint32_t len);    // mark len bytes at staging_addr for update at next reset, or NULL
+  uint32_t staging_addr;          // staging region (TINYUF2_STAGED_UPDATE), size 0 without
+  uint32_t staging_size;
+
+  // version 3
+  void (*dfu)(void);              // enter DFU mode (TINYUF2_WARM_DFU), no return, or NULL
+} board_service_t;
+
+#define SERVICE_MAGIC    0x5e271ce5
+#define SERVICE_VERSION  3
+
+// Re-initialize bootloader .data/.bss (ram_start to ram_end) when the service table is entered from
+// the application, as its own startup code would (TINYUF2_SERVICE_TABLE)
+void board_service_ram_init(void);
+
+#if TINYUF2_SERVICE_TABLE
+// defined by linker script
+extern uint8_t _board_service_ram_start[];
+extern uint8_t _board_service_ram_end[];
+#endif
+
+// Make the staged image (TINYUF2_STAGED_UPDATE) the application without copying (optional), e.g a bank
+// swap. Must call uf2_staged_invalidate() right before the switch takes effect, usually by reset, and
+// return false before that if the switch is not possible so that the image is copied instead
+bool board_staged_swap(uint32_t len) __attribute__ ((weak));
+
+// Provided by the core: erase the staging footer so that the staged image is not applied again
+void uf2_staged_invalidate(void);
+
+// Additional uf2 family with its own flash backend, e.g a data partition or external flash.
+// write() receives uf2 target address as is and does its own address translation.
+typedef struct {
+  uint32_t family_id;
+  bool (*write)(uint32_t addr, void const* data, uint32_t len);
+  void (*flush)(void);
+} board_uf2_family_t;
+
+// Return table of additional uf2 families supported by board (optional).
+// Blocks of all families in an uf2 file share the same blockNo/numBlocks sequence.
+board_uf2_family_t const* board_uf2_families(uint32_t* count) __attribute__ ((weak));
+
 //--------------------------------------------------------------------+
 // Display API
 //--------------------------------------------------------------------+
 
 #if TINYUF2_DISPLAY
 void board_display_init(void);
+
+// Draw column y. Transfer can still be in progress on return: pixel_color stays valid until the
+// call after next, port only needs to wait for the previous transfer before starting a new one.
 void board_display_draw_line(int y, uint16_t* pixel_color, uint32_t pixel_num);
 
+// Expand count pixels of 4-bit palette indices (two per byte, low nibble first) into big-endian 565
+// colors with 2D hardware, e.g DMA2D with a CLUT of palette (native 565, same array on every call).
+// Returns false to have screen.c expand them in software (optional)
+bool board_display_expand(uint8_t* dst, uint8_t const* src, uint32_t count, uint16_t const palette[16]) __attribute__ ((weak));
+
 void screen_draw_drag(void);
+
+// Redraw progress bar of drag & drop screen, only changed columns are sent to display
+void screen_draw_progress(uint32_t done, uint32_t total);
 #endif
 
 // perform self-update on bootloader
 void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len);
 
+// Helper for board_self_update() provided by apps/self_update: sector by sector, rewrite only sectors whose
+// contents differ from bin, verified by reading back. write_sector() must erase and program one sector.
+// Flash contents are the progress record: rerunning after a reset resumes at the first differing sector.
+// Return false if a sector can't be verified, the application (self-update) should then be kept to retry.
+// With TINYUF2_SELF_UPDATE_LZ4 bin only holds the start of the image, sectors are decoded from the
+// compressed stream embedded in the application, ports must not read bin beyond the vector table
+bool self_update_sectors(uint32_t addr, uint8_t const* bin, uint32_t len, uint32_t sector_count,
+                         uint32_t (*sector_size)(uint32_t sector),
+                         void (*write_sector)(uint32_t sector, uint32_t addr, uint8_t const* data, uint32_t len));
+
 //--------------------------------------------------------------------+
 // LOG
 //--------------------------------------------------------------------+
@@ -258,7 +1088,16 @@ void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len);
 #include <stdio.h>
 
 #ifndef tuf2_printf
-#define tuf2_printf printf
+#if TINYUF2_LOG_DEFER
+  #define tuf2_printf tuf2_log_defer
+  int tuf2_log_defer(char const* format, ...);
+#elif TINYUF2_CONFIG_TXT
+  // muted by log = 0 in CONFIG.TXT
+  #define tuf2_printf tuf2_log_config
+  int tuf2_log_config(char const* format, ...);
+#else
+  #define tuf2_printf printf
+#endif
 #endif
 
 // Log with debug level 1
@@ -321,6 +1160,22 @@ static inline void rgb_brightness(uint8_t out[3], uint8_t const in[3], uint8_t b
   }
 }
 
+// Append an event to the event log (TINYUF2_EVENT_LOG), id is UF2_EVENT_* from uf2.h. Only a few
+// stores so that it can be used on hot paths
+static inline void uf2_event(uint32_t id, uint32_t arg) {
+#if TINYUF2_EVENT_LOG
+  board_event_log_t* log = TINYUF2_EVENT_LOG_PTR;
+  uint32_t const i = log->head++ & (TINYUF2_EVENT_COUNT - 1);
+  log->event[i].time = board_cycle_count ? board_cycle_count() : 0;
+  log->event[i].arg  = arg;
+  log->event[i].id   = (uint16_t) id;
+  log->event[i].boot = (uint16_t) log->boots;
+#else
+  (void) id;
+  (void) arg;
+#endif
+}
+
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
@@ -366,4 +1221,8 @@ static inline void rgb_brightness(uint8_t out[3], uint8_t const in[3], uint8_t b
 #define TFT_MADCTL_RGB 0x00  ///< Red-Green-Blue pixel order
 #define TFT_MADCTL_BGR 0x08  ///< Blue-Green-Red pixel order
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,419 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tusb.h"
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// CDC interface (CFG_TUD_CDC)
+//
+// Flash protocol (TINYUF2_CDC_FLASH), all fields little endian. Host sends a 16-byte command:
+// magic, cmd, addr, len
+// - CDC_CMD_INFO  : reply payload cdc_info_t
+// - CDC_CMD_WRITE : followed by len bytes to program at addr, both word aligned and within the
+//                   application region. Replied once the last byte is programmed, host is held off
+//                   by usb flow control while the rx fifo is full
+// - CDC_CMD_READ  : reply payload len bytes of flash at addr
+// - CDC_CMD_ERASE : board_flash_erase_app(), addr and len are ignored
+// - CDC_CMD_HASH  : reply value CRC32 (same as CURRENT.CRC) of len bytes of flash at addr
+// - CDC_CMD_STATS : reply payload flashing statistics text (TINYUF2_STATS)
+// - CDC_CMD_FLUSH : board_flash_flush()
+// - CDC_CMD_RESET : board_flash_flush() then board_dfu_complete(), no reply
+// - CDC_CMD_TRACE : reply payload msc_trace_t runs of host MSC writes (TINYUF2_WRITE_TRACE),
+//                   value is the number of runs dropped
+// - CDC_CMD_PROFILE: reply payload oldest profiler samples (TINYUF2_PROFILE), 32-bit PC each, at most
+//                   len bytes. Value is the number of samples dropped since the previous command
+// Reply is magic, error, value, len followed by len bytes of payload. Log output (TINYUF2_CDC_LOG)
+// is only sent between replies, host finds the reply by scanning for the magic. Anything else than
+// a valid command is answered with CDC_ERR_CMD and pending input is discarded.
+//
+// Without TINYUF2_CDC_FLASH any input is answered with the statistics text (TINYUF2_STATS)
+//--------------------------------------------------------------------+
+
+#if TINYUF2_CDC_LOG && !CFG_TUD_CDC
+  #error "TINYUF2_CDC_LOG requires CFG_TUD_CDC"
+#endif
+
+#if CFG_TUD_CDC
+
+#define CDC_MAGIC   0x43465554 // "TUFC"
+
+enum {
+  CDC_CMD_INFO = 0,
+  CDC_CMD_WRITE,
+  CDC_CMD_READ,
+  CDC_CMD_ERASE,
+  CDC_CMD_HASH,
+  CDC_CMD_STATS,
+  CDC_CMD_FLUSH,
+  CDC_CMD_RESET,
+  CDC_CMD_TRACE,
+  CDC_CMD_PROFILE,
+};
+
+enum {
+  CDC_ERR_OK = 0,
+  CDC_ERR_CMD,      // invalid magic or command
+  CDC_ERR_ADDR,     // address/length unaligned or outside flash (application region for write)
+};
+
+typedef struct TU_ATTR_PACKED {
+  uint32_t magic;
+  uint32_t cmd;
+  uint32_t addr;
+  uint32_t len;
+} cdc_cmd_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint32_t magic;
+  uint32_t error;
+  uint32_t value;
+  uint32_t len;     // bytes of payload following
+} cdc_reply_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint32_t flash_addr;  // BOARD_FLASH_ADDR_ZERO
+  uint32_t flash_size;
+  uint32_t app_start;   // BOARD_FLASH_APP_START
+  uint32_t family_id;   // BOARD_UF2_FAMILY_ID
+  uint32_t erase_size;  // erase unit at app_start (uf2_flash_info)
+  uint32_t erased_word;
+  uint16_t program_size;
+  uint16_t caps;        // BOARD_FLASH_CAP_*
+} cdc_info_t;
+
+TU_VERIFY_STATIC(sizeof(cdc_cmd_t) == 16, "cdc command must be 16 bytes");
+
+// Output being sent as tx fifo drains: reply header then payload, from memory if data is set or
+// from flash at addr otherwise
+static struct {
+  cdc_reply_t reply;
+  uint32_t reply_len;   // bytes of reply header not yet sent
+  uint8_t const* data;
+  uint32_t addr;
+  uint32_t len;         // bytes of payload not yet sent
+} _cdc_tx;
+
+//--------------------------------------------------------------------+
+// Log
+//--------------------------------------------------------------------+
+#if TINYUF2_CDC_LOG
+
+TU_VERIFY_STATIC((TINYUF2_CDC_LOG_SIZE & (TINYUF2_CDC_LOG_SIZE - 1)) == 0, "TINYUF2_CDC_LOG_SIZE must be power of 2");
+
+// indices are free running, masked on access
+static struct {
+  uint32_t wr;
+  uint32_t rd;
+  char buf[TINYUF2_CDC_LOG_SIZE];
+} _cdc_log;
+
+int cdc_log_write(void const* buf, int len) {
+  char const* text = (char const*) buf;
+
+  for ( int i = 0; i < len && (_cdc_log.wr - _cdc_log.rd) < sizeof(_cdc_log.buf); i++ ) {
+    _cdc_log.buf[_cdc_log.wr++ & (sizeof(_cdc_log.buf) - 1)] = text[i];
+  }
+
+  // rest is dropped when full, report everything written so that caller does not retry
+  return len;
+}
+
+static void cdc_log_task(void) {
+  while ( _cdc_log.rd != _cdc_log.wr ) {
+    uint32_t const rd = _cdc_log.rd & (sizeof(_cdc_log.buf) - 1);
+    uint32_t const count = tu_min32(_cdc_log.wr - _cdc_log.rd, sizeof(_cdc_log.buf) - rd);
+
+    uint32_t const written = tud_cdc_write(_cdc_log.buf + rd, count);
+    if ( !written ) break;
+    _cdc_log.rd += written;
+  }
+}
+
+#endif
+
+//--------------------------------------------------------------------+
+// Output
+//--------------------------------------------------------------------+
+
+static void cdc_tx_task(void) {
+  if ( _cdc_tx.reply_len ) {
+    uint8_t const* head = (uint8_t const*) &_cdc_tx.reply;
+    _cdc_tx.reply_len -= tud_cdc_write(head + sizeof(_cdc_tx.reply) - _cdc_tx.reply_len, _cdc_tx.reply_len);
+  }
+
+  while ( !_cdc_tx.reply_len && _cdc_tx.len ) {
+    uint32_t count = tu_min32(_cdc_tx.len, tud_cdc_write_available());
+    if ( !count ) break;
+
+    if ( _cdc_tx.data ) {
+      tud_cdc_write(_cdc_tx.data, count);
+      _cdc_tx.data += count;
+    } else {
+      uint8_t buf[64] TU_ATTR_ALIGNED(4);
+      count = tu_min32(count, sizeof(buf));
+      board_flash_read(_cdc_tx.addr, buf, count);
+      tud_cdc_write(buf, count);
+      _cdc_tx.addr += count;
+    }
+    _cdc_tx.len -= count;
+  }
+
+#if TINYUF2_CDC_LOG
+  // log is kept until a terminal opens the port
+  if ( !_cdc_tx.reply_len && !_cdc_tx.len && tud_cdc_connected() ) cdc_log_task();
+#endif
+
+  tud_cdc_write_flush();
+}
+
+void tud_cdc_tx_complete_cb(uint8_t itf) {
+  (void) itf;
+  cdc_tx_task();
+}
+
+//--------------------------------------------------------------------+
+// Flash protocol
+//--------------------------------------------------------------------+
+#if TINYUF2_CDC_FLASH
+
+// Current write command. Payload is programmed in chunks not crossing 256-byte boundaries,
+// the same as uf2 payloads so that every backend handles them
+static struct {
+  uint32_t addr;    // address of chunk being received
+  uint32_t remain;  // bytes of command not yet programmed
+  uint32_t done;    // bytes of command programmed
+  uint32_t count;   // bytes of chunk received so far
+  uint8_t chunk[256] TU_ATTR_ALIGNED(4);
+} _cdc_write;
+
+static cdc_info_t _cdc_info;
+
+#if TINYUF2_PROFILE
+// samples taken out of the profiler ring for the reply being sent
+static uint32_t _cdc_profile[64];
+#endif
+
+static void cdc_reply(uint32_t error, uint32_t value, void const* data, uint32_t len) {
+  _cdc_tx.reply = (cdc_reply_t) { .magic = CDC_MAGIC, .error = error, .value = value, .len = len };
+  _cdc_tx.reply_len = sizeof(cdc_reply_t);
+  _cdc_tx.data = (uint8_t const*) data;
+  _cdc_tx.len = len;
+}
+
+static bool cdc_addr_valid(uint32_t addr, uint32_t len) {
+  uint32_t const offset = addr - BOARD_FLASH_ADDR_ZERO;
+  return (offset < board_flash_size()) && (len <= board_flash_size() - offset);
+}
+
+static void cdc_command(cdc_cmd_t const* cmd) {
+  if ( cmd->magic != CDC_MAGIC ) {
+    TUF2_LOG1("CDC: invalid command\r\n");
+    tud_cdc_read_flush();
+    cdc_reply(CDC_ERR_CMD, 0, NULL, 0);
+    return;
+  }
+
+  switch ( cmd->cmd ) {
+    case CDC_CMD_INFO: {
+      board_flash_info_t const* flash = uf2_flash_info();
+      flash_sector_t sector = { 0, 0, 0 };
+      flash_sector_find(&flash->geometry, BOARD_FLASH_APP_START, &sector);
+
+      _cdc_info = (cdc_info_t) {
+        .flash_addr   = BOARD_FLASH_ADDR_ZERO,
+        .flash_size   = board_flash_size(),
+        .app_start    = BOARD_FLASH_APP_START,
+        .family_id    = BOARD_UF2_FAMILY_ID,
+        .erase_size   = sector.size,
+        .erased_word  = flash->erased_word,
+        .program_size = flash->program_size,
+        .caps         = flash->caps,
+      };
+      cdc_reply(CDC_ERR_OK, 0, &_cdc_info, sizeof(_cdc_info));
+      break;
+    }
+
+    case CDC_CMD_WRITE:
+      if ( cmd->len == 0 || ((cmd->addr | cmd->len) & 3) || cmd->addr < BOARD_FLASH_APP_START ||
+           !cdc_addr_valid(cmd->addr, cmd->len) ) {
+        TUF2_LOG1("CDC: invalid write %08lX len %lu\r\n", cmd->addr, cmd->len);
+        tud_cdc_read_flush();
+        cdc_reply(CDC_ERR_ADDR, 0, NULL, 0);
+        break;
+      }
+
+      indicator_set(STATE_WRITING_STARTED);
+      _cdc_write.addr = cmd->addr;
+      _cdc_write.remain = cmd->len;
+      _cdc_write.done = 0;
+      _cdc_write.count = 0;
+      break;
+
+    case CDC_CMD_READ:
+      if ( !cdc_addr_valid(cmd->addr, cmd->len) ) {
+        cdc_reply(CDC_ERR_ADDR, 0, NULL, 0);
+        break;
+      }
+
+      cdc_reply(CDC_ERR_OK, 0, NULL, cmd->len);
+      _cdc_tx.addr = cmd->addr;
+      break;
+
+    case CDC_CMD_ERASE:
+      TUF2_LOG1("CDC: erase app\r\n");
+      indicator_set(STATE_WRITING_STARTED);
+      board_flash_erase_app();
+      indicator_set(STATE_WRITING_FINISHED);
+      cdc_reply(CDC_ERR_OK, 0, NULL, 0);
+      break;
+
+    case CDC_CMD_HASH:
+      if ( !cdc_addr_valid(cmd->addr, cmd->len) ) {
+        cdc_reply(CDC_ERR_ADDR, 0, NULL, 0);
+        break;
+      }
+
+      cdc_reply(CDC_ERR_OK, uf2_flash_crc32(cmd->addr, cmd->len), NULL, 0);
+      break;
+
+#if TINYUF2_STATS
+    case CDC_CMD_STATS: {
+      char const* text;
+      uint32_t const len = uf2_stats_text(&text);
+      cdc_reply(CDC_ERR_OK, 0, text, len);
+      break;
+    }
+#endif
+
+#if TINYUF2_WRITE_TRACE
+    case CDC_CMD_TRACE: {
+      msc_trace_t const* runs;
+      uint32_t dropped;
+      uint32_t const count = msc_write_trace(&runs, &dropped);
+      cdc_reply(CDC_ERR_OK, dropped, runs, count * sizeof(msc_trace_t));
+      break;
+    }
+#endif
+
+#if TINYUF2_PROFILE
+    case CDC_CMD_PROFILE: {
+      uint32_t dropped;
+      uint32_t const count = uf2_profile_read(_cdc_profile, tu_min32(cmd->len / 4, TU_ARRAY_SIZE(_cdc_profile)), &dropped);
+      cdc_reply(CDC_ERR_OK, dropped, _cdc_profile, 4 * count);
+      break;
+    }
+#endif
+
+    case CDC_CMD_FLUSH:
+      board_flash_flush();
+      cdc_reply(CDC_ERR_OK, 0, NULL, 0);
+      break;
+
+    case CDC_CMD_RESET:
+      TUF2_LOG1("CDC: writing finished\r\n");
+      board_flash_flush();
+      indicator_set(STATE_WRITING_FINISHED);
+      board_dfu_complete();
+
+      // board_dfu_complete() should not return
+      while (1) {}
+      break;
+
+    default:
+      TUF2_LOG1("CDC: unknown command %lu\r\n", cmd->cmd);
+      tud_cdc_read_flush();
+      cdc_reply(CDC_ERR_CMD, 0, NULL, 0);
+      break;
+  }
+}
+
+// receive payload of current write command, program one chunk per call
+static void cdc_write_task(void) {
+  uint32_t const size = tu_min32(_cdc_write.remain, sizeof(_cdc_write.chunk) - (_cdc_write.addr & (sizeof(_cdc_write.chunk) - 1)));
+
+  _cdc_write.count += tud_cdc_read(_cdc_write.chunk + _cdc_write.count, size - _cdc_write.count);
+  if ( _cdc_write.count < size ) return;
+
+  board_flash_write(_cdc_write.addr, _cdc_write.chunk, size);
+
+  _cdc_write.addr += size;
+  _cdc_write.remain -= size;
+  _cdc_write.done += size;
+  _cdc_write.count = 0;
+
+  if ( _cdc_write.remain == 0 ) cdc_reply(CDC_ERR_OK, _cdc_write.done, NULL, 0);
+}
+
+#elif TINYUF2_STATS
+
+// Flashing statistics are sent on any input
+void tud_cdc_rx_cb(uint8_t itf) {
+  (void) itf;
+  tud_cdc_read_flush();
+
+  char const* text;
+  _cdc_tx.len = uf2_stats_text(&text);
+  _cdc_tx.data = (uint8_t const*) text;
+  cdc_tx_task();
+}
+
+#endif
+
+#endif
+
+bool cdc_task(void) {
+#if CFG_TUD_CDC
+  if ( !tud_mounted() ) {
+#if TINYUF2_CDC_FLASH
+    _cdc_write.remain = 0;
+#endif
+    _cdc_tx.reply_len = 0;
+    _cdc_tx.len = 0;
+    return false;
+  }
+
+#if TINYUF2_CDC_FLASH
+  if ( _cdc_write.remain ) {
+    cdc_write_task();
+  } else if ( !_cdc_tx.reply_len && !_cdc_tx.len && tud_cdc_available() >= sizeof(cdc_cmd_t) ) {
+    cdc_cmd_t cmd;
+    tud_cdc_read(&cmd, sizeof(cmd));
+    cdc_command(&cmd);
+  }
+#endif
+
+  cdc_tx_task();
+
+#if TINYUF2_CDC_FLASH
+  // received data not processed yet, sending continues on tx complete event
+  if ( _cdc_write.remain ) return tud_cdc_available() > 0;
+  return !_cdc_tx.reply_len && !_cdc_tx.len && tud_cdc_available() >= sizeof(cdc_cmd_t);
+#else
+  return false;
+#endif
+#else
+  return false;
+#endif
+}
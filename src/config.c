@@ -0,0 +1,165 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "board_api.h"
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Runtime tunables (TINYUF2_CONFIG_TXT)
+//
+// CONFIG.TXT lists the effective value of each tunable. A host saving an edited copy writes it
+// to some free cluster: any non-uf2 block starting with the header line is taken as the new
+// contents, "key = value" lines (decimal) update the tunables named, others are ignored. Values
+// are kept in TINYUF2_CONFIG_PTR across resets, so that A/B runs only need a file copy and a
+// reset. read_ahead, pre_erase and log apply at once, clock_boost at the next DFU entry.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_CONFIG_TXT
+
+typedef struct {
+  char const* key;
+  uint32_t offset;  // of value in board_config_t
+  uint32_t max;     // larger values are clamped
+  uint32_t init;    // default
+} config_key_t;
+
+static config_key_t const _config_keys[] = {
+  { "read_ahead" , offsetof(board_config_t, read_ahead) , 1  , 1 },
+  { "pre_erase"  , offsetof(board_config_t, pre_erase)  , 255, UF2_PRE_ERASE_CONFIRM },
+  { "clock_boost", offsetof(board_config_t, clock_boost), 1  , 1 },
+  { "log"        , offsetof(board_config_t, log)        , 1  , 1 },
+};
+
+_Static_assert(sizeof(_config_keys) / sizeof(_config_keys[0]) == UF2_CONFIG_KEYS, "UF2_CONFIG_KEYS mismatch");
+
+static board_config_t _config;
+
+static inline uint32_t* config_value(board_config_t* cfg, uint32_t i) {
+  return (uint32_t*) ((uint8_t*) cfg + _config_keys[i].offset);
+}
+
+static uint32_t config_check(board_config_t const* cfg) {
+  return ~(cfg->magic ^ cfg->read_ahead ^ cfg->pre_erase ^ cfg->clock_boost ^ cfg->log);
+}
+
+static void config_save(void) {
+  _config.magic = CONFIG_MAGIC;
+  _config.check = config_check(&_config);
+  *TINYUF2_CONFIG_PTR = _config;
+}
+
+void uf2_config_init(void) {
+  board_config_t const* saved = TINYUF2_CONFIG_PTR;
+  if ( saved->magic == CONFIG_MAGIC && saved->check == config_check(saved) ) {
+    _config = *saved;
+    return;
+  }
+
+  for ( uint32_t i = 0; i < UF2_CONFIG_KEYS; i++ ) *config_value(&_config, i) = _config_keys[i].init;
+  config_save();
+}
+
+board_config_t const* uf2_config(void) {
+  return &_config;
+}
+
+// Skip spaces and tabs, return position of the first other character
+static uint32_t skip_blank(char const* text, uint32_t pos, uint32_t len) {
+  while ( pos < len && (text[pos] == ' ' || text[pos] == '\t') ) pos++;
+  return pos;
+}
+
+bool uf2_config_parse(uint8_t const* data, uint32_t len) {
+  char const* text = (char const*) data;
+  uint32_t const header_len = strlen(UF2_CONFIG_HEADER "") - 2; // without line end
+  if ( len < header_len || memcmp(text, UF2_CONFIG_HEADER, header_len) ) return false;
+
+  uint32_t pos = header_len;
+  while ( pos < len && text[pos] ) {
+    // one line: key, '=', value
+    uint32_t const key_pos = skip_blank(text, pos, len);
+    uint32_t key_end = key_pos;
+    while ( key_end < len && text[key_end] != '=' && text[key_end] != ' ' && text[key_end] != '\n' && text[key_end] ) key_end++;
+
+    uint32_t value_pos = skip_blank(text, key_end, len);
+    bool const assigned = value_pos < len && text[value_pos] == '=';
+    if ( assigned ) value_pos = skip_blank(text, value_pos + 1, len);
+
+    uint32_t value = 0;
+    uint32_t digits = 0;
+    while ( value_pos < len && text[value_pos] >= '0' && text[value_pos] <= '9' && digits < 10 ) {
+      value = value * 10 + (uint32_t) (text[value_pos++] - '0');
+      digits++;
+    }
+
+    for ( uint32_t i = 0; assigned && digits && i < UF2_CONFIG_KEYS; i++ ) {
+      config_key_t const* k = &_config_keys[i];
+      if ( key_end - key_pos == strlen(k->key) && !memcmp(text + key_pos, k->key, key_end - key_pos) ) {
+        *config_value(&_config, i) = (value > k->max) ? k->max : value;
+      }
+    }
+
+    // next line
+    pos = key_end;
+    while ( pos < len && text[pos] && text[pos] != '\n' ) pos++;
+    if ( pos < len && text[pos] == '\n' ) pos++;
+  }
+
+  config_save();
+  TUF2_LOG1("Config: read_ahead %lu, pre_erase %lu, clock_boost %lu, log %lu\r\n",
+            _config.read_ahead, _config.pre_erase, _config.clock_boost, _config.log);
+  return true;
+}
+
+void uf2_config_render(char* buf) {
+  memcpy(buf, UF2_CONFIG_HEADER, sizeof(UF2_CONFIG_HEADER) - 1);
+  buf += sizeof(UF2_CONFIG_HEADER) - 1;
+
+  for ( uint32_t i = 0; i < UF2_CONFIG_KEYS; i++ ) {
+    char line[UF2_CONFIG_LINE_LEN + 1];
+    snprintf(line, sizeof(line), "%-12s= %-10lu\r\n", _config_keys[i].key, (unsigned long) *config_value(&_config, i));
+    memcpy(buf, line, UF2_CONFIG_LINE_LEN);
+    buf += UF2_CONFIG_LINE_LEN;
+  }
+}
+
+#if TUF2_LOG && !TINYUF2_LOG_DEFER
+int tuf2_log_config(char const* format, ...) {
+  // output before uf2_config_init() is kept
+  if ( _config.magic == CONFIG_MAGIC && !_config.log ) return 0;
+
+  va_list ap;
+  va_start(ap, format);
+  int const count = vprintf(format, ap);
+  va_end(ap);
+  return count;
+}
+#endif
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Data LUN (TINYUF2_DATA_LUN)
+//
+// The data region of the port (board_data_*()) is a plain drive of CFG_UF2_SECTOR_SIZE sectors, the
+// FAT volume on it is the host's (or the application's, e.g FatFs or the ESP-IDF ffat partition), so
+// sector semantics are those of a disk: a read returns what was last written. Writes land in a
+// write-back cache of one erase unit, consecutive sectors of a unit are coalesced there and the unit
+// is programmed once when writes move to another unit or on data_lun_flush() (SYNCHRONIZE CACHE,
+// eject, idle and before reset). Flush only erases if a changed sector is not blank on flash: a host
+// filling free space of a freshly formatted volume programs without erasing, a rewritten FAT sector
+// costs one erase of its unit. Sectors of the unit that were not written are read back from flash
+// only when the unit has to be erased.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_DATA_LUN
+
+#define DATA_UNIT_SECTORS   (BOARD_DATA_ERASE_SIZE / CFG_UF2_SECTOR_SIZE)
+#define DATA_INVALID_UNIT   0xffffffff
+
+#if (BOARD_DATA_ERASE_SIZE % CFG_UF2_SECTOR_SIZE) || (DATA_UNIT_SECTORS > 32)
+  #error "BOARD_DATA_ERASE_SIZE must be 1 to 32 sectors"
+#endif
+
+TUF2_DFU_NOINIT static uint8_t _data_cache[BOARD_DATA_ERASE_SIZE] __attribute__((aligned(4)));
+TUF2_DFU_NOINIT static uint8_t _data_sector[CFG_UF2_SECTOR_SIZE] __attribute__((aligned(4)));
+
+static uint32_t _data_size;                     // bytes of data region, 0 if the board has none
+static uint32_t _data_unit = DATA_INVALID_UNIT; // region offset of cached unit
+static uint32_t _data_valid;                    // bit set for each sector of the unit held in cache
+static uint32_t _data_dirty;                    // bit set for each sector written since it was cached
+
+static bool data_ready(void) {
+  static bool probed = false;
+  if (!probed) {
+    probed = true;
+    if (!board_data_init(&_data_size)) _data_size = 0;
+    _data_size -= _data_size % BOARD_DATA_ERASE_SIZE;
+    TUF2_LOG1("Data LUN: %lu KB\r\n", _data_size / 1024);
+  }
+  return _data_size != 0;
+}
+
+static bool is_blank(uint8_t const* data, uint32_t len) {
+  uint32_t const* word = (uint32_t const*) data;
+  for (uint32_t i = 0; i < len / 4; i++) {
+    if (word[i] != 0xFFFFFFFFUL) return false;
+  }
+  return true;
+}
+
+uint32_t data_lun_sectors(void) {
+  return data_ready() ? (_data_size / CFG_UF2_SECTOR_SIZE) : 0;
+}
+
+bool data_lun_flush(void) {
+  if (_data_unit == DATA_INVALID_UNIT || !_data_dirty) return true;
+
+  uint32_t const dirty = _data_dirty;
+  bool erase = false;
+  uint32_t changed = 0;
+
+  // sectors written with their current contents cost nothing, the others only need an erase if not blank
+  for (uint32_t i = 0; i < DATA_UNIT_SECTORS; i++) {
+    if (!(dirty & (1UL << i))) continue;
+
+    uint8_t const* data = _data_cache + i * CFG_UF2_SECTOR_SIZE;
+    if (!board_data_read(_data_unit + i * CFG_UF2_SECTOR_SIZE, _data_sector, CFG_UF2_SECTOR_SIZE)) return false;
+    if (!memcmp(_data_sector, data, CFG_UF2_SECTOR_SIZE)) continue;
+
+    changed |= 1UL << i;
+    if (!is_blank(_data_sector, CFG_UF2_SECTOR_SIZE)) erase = true;
+  }
+
+  _data_dirty = 0;
+  if (!changed) return true;
+
+  if (erase) {
+    // rest of the unit is read back before it is erased
+    for (uint32_t i = 0; i < DATA_UNIT_SECTORS; i++) {
+      if (_data_valid & (1UL << i)) continue;
+      uint32_t const pos = i * CFG_UF2_SECTOR_SIZE;
+      if (!board_data_read(_data_unit + pos, _data_cache + pos, CFG_UF2_SECTOR_SIZE)) return false;
+    }
+    _data_valid = (DATA_UNIT_SECTORS == 32) ? UINT32_MAX : ((1UL << DATA_UNIT_SECTORS) - 1);
+
+    if (!board_data_erase(_data_unit, BOARD_DATA_ERASE_SIZE)) return false;
+
+    // erased sectors stay as they are, e.g free clusters
+    changed = 0;
+    for (uint32_t i = 0; i < DATA_UNIT_SECTORS; i++) {
+      if (!is_blank(_data_cache + i * CFG_UF2_SECTOR_SIZE, CFG_UF2_SECTOR_SIZE)) changed |= 1UL << i;
+    }
+  }
+
+  // runs of consecutive sectors are programmed at once
+  uint32_t i = 0;
+  while (i < DATA_UNIT_SECTORS) {
+    if (!(changed & (1UL << i))) {
+      i++;
+      continue;
+    }
+
+    uint32_t const first = i;
+    while (i < DATA_UNIT_SECTORS && (changed & (1UL << i))) i++;
+
+    uint32_t const pos = first * CFG_UF2_SECTOR_SIZE;
+    if (!board_data_program(_data_unit + pos, _data_cache + pos, (i - first) * CFG_UF2_SECTOR_SIZE)) return false;
+  }
+
+  return true;
+}
+
+// Region offset of byte offset within lba, false if len bytes from there exceed the region
+static bool data_offset(uint32_t lba, uint32_t offset, uint32_t len, uint32_t* pos) {
+  if (!data_ready() || lba >= _data_size / CFG_UF2_SECTOR_SIZE) return false;
+
+  *pos = lba * CFG_UF2_SECTOR_SIZE + offset;
+  return (*pos <= _data_size) && (len <= _data_size - *pos);
+}
+
+bool data_lun_read(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t len) {
+  uint32_t pos;
+  if (!data_offset(lba, offset, len, &pos)) return false;
+
+  while (len) {
+    uint32_t const unit = pos - pos % BOARD_DATA_ERASE_SIZE;
+    uint32_t const in_unit = pos - unit;
+    uint32_t const sector = in_unit / CFG_UF2_SECTOR_SIZE;
+    uint32_t const sector_left = CFG_UF2_SECTOR_SIZE - in_unit % CFG_UF2_SECTOR_SIZE;
+    uint32_t const count = (len < sector_left) ? len : sector_left;
+
+    if (unit == _data_unit && (_data_valid & (1UL << sector))) {
+      memcpy(buffer, _data_cache + in_unit, count);
+    } else if (!board_data_read(pos, buffer, count)) {
+      return false;
+    }
+
+    pos += count;
+    buffer += count;
+    len -= count;
+  }
+
+  return true;
+}
+
+bool data_lun_write(uint32_t lba, uint32_t offset, uint8_t const* buffer, uint32_t len) {
+  uint32_t pos;
+  if (!data_offset(lba, offset, len, &pos)) return false;
+
+  while (len) {
+    uint32_t const unit = pos - pos % BOARD_DATA_ERASE_SIZE;
+    uint32_t const in_unit = pos - unit;
+    uint32_t const sector = in_unit / CFG_UF2_SECTOR_SIZE;
+    uint32_t const sector_pos = in_unit % CFG_UF2_SECTOR_SIZE;
+    uint32_t const sector_left = CFG_UF2_SECTOR_SIZE - sector_pos;
+    uint32_t const count = (len < sector_left) ? len : sector_left;
+
+    if (unit != _data_unit) {
+      if (!data_lun_flush()) return false;
+      _data_unit = unit;
+      _data_valid = 0;
+    }
+
+    // partially written sector is completed from flash first
+    uint32_t const bit = 1UL << sector;
+    uint8_t* cached = _data_cache + sector * CFG_UF2_SECTOR_SIZE;
+    if (!(_data_valid & bit) && count < CFG_UF2_SECTOR_SIZE &&
+        !board_data_read(unit + sector * CFG_UF2_SECTOR_SIZE, cached, CFG_UF2_SECTOR_SIZE)) {
+      return false;
+    }
+
+    memcpy(cached + sector_pos, buffer, count);
+    _data_valid |= bit;
+    _data_dirty |= bit;
+
+    pos += count;
+    buffer += count;
+    len -= count;
+  }
+
+  return true;
+}
+
+#endif
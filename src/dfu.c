@@ -0,0 +1,165 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tusb.h"
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// DFU 1.1 (CFG_TUD_DFU), e.g dfu-util -D app.bin
+//
+// Alt 0 is the application region: block n is at BOARD_FLASH_APP_START + n * wTransferSize,
+// wTransferSize (CFG_TUD_DFU_XFER_BUFSIZE) is the port's erase unit. A downloaded block is
+// programmed by dfu_task() from the main loop (usb task for RTOS) while the device reports
+// dfuDNBUSY, so that usb is serviced in between. Upload reads back the application region.
+// Device is manifestation tolerant and resets into application on DFU_DETACH or on the
+// usb reset that follows a completed download (dfu-util -R).
+//--------------------------------------------------------------------+
+
+#if CFG_TUD_DFU
+
+// Block being programmed, split in chunks not crossing 256-byte boundaries like uf2 payloads.
+// Data stays in tinyusb's transfer buffer until tud_dfu_finish_flashing()
+static struct {
+  uint8_t const* data;
+  uint32_t addr;
+  uint32_t remain;      // bytes of block not yet programmed
+  bool manifested;      // download completed
+} _dfu;
+
+// last chunk of an image not multiple of word size, padded with erased value
+static uint8_t _dfu_tail[4] TU_ATTR_ALIGNED(4);
+
+// Invoked right before tud_dfu_download_cb() (state=DFU_DNBUSY) or tud_dfu_manifest_cb() (state=DFU_MANIFEST)
+// Application return timeout in milliseconds (bwPollTimeout) for the next download/manifest operation.
+uint32_t tud_dfu_get_timeout_cb(uint8_t alt, uint8_t state) {
+  (void) alt;
+  (void) state;
+
+  // dfu_task() programs the block, host only needs to poll for completion
+  return 1;
+}
+
+// Invoked when received DFU_DNLOAD (wLength>0) following by DFU_GETSTATUS (state=DFU_DNBUSY) requests
+// This callback could be returned before flashing op is complete (async).
+// Once finished flashing, application must call tud_dfu_finish_flashing()
+void tud_dfu_download_cb(uint8_t alt, uint16_t block_num, uint8_t const* data, uint16_t length) {
+  (void) alt;
+
+  uint32_t const addr = BOARD_FLASH_APP_START + block_num * CFG_TUD_DFU_XFER_BUFSIZE;
+  uint32_t const flash_end = BOARD_FLASH_ADDR_ZERO + board_flash_size();
+
+  if ( addr >= flash_end || length > flash_end - addr ) {
+    TUF2_LOG1("DFU: block %u out of flash\r\n", block_num);
+    tud_dfu_finish_flashing(DFU_STATUS_ERR_ADDRESS);
+    return;
+  }
+
+  if ( block_num == 0 ) {
+    _dfu.manifested = false;
+    indicator_set(STATE_WRITING_STARTED);
+  }
+
+  _dfu.data = data;
+  _dfu.addr = addr;
+  _dfu.remain = length;
+}
+
+// Invoked when download process is complete, received DFU_DNLOAD (wLength=0) following by DFU_GETSTATUS (state=Manifest)
+// Application can do checksum, or actual flashing if buffered entire image previously.
+// Once finished flashing, application must call tud_dfu_finish_flashing()
+void tud_dfu_manifest_cb(uint8_t alt) {
+  (void) alt;
+
+  TUF2_LOG1("DFU: writing finished\r\n");
+  board_flash_flush();
+  indicator_set(STATE_WRITING_FINISHED);
+
+  _dfu.manifested = true;
+  tud_dfu_finish_flashing(DFU_STATUS_OK);
+}
+
+// Invoked when received DFU_UPLOAD request
+// Application must populate data with up to length bytes and return the number of written bytes
+uint16_t tud_dfu_upload_cb(uint8_t alt, uint16_t block_num, uint8_t* data, uint16_t length) {
+  (void) alt;
+
+  uint32_t const addr = BOARD_FLASH_APP_START + block_num * CFG_TUD_DFU_XFER_BUFSIZE;
+  uint32_t const flash_end = BOARD_FLASH_ADDR_ZERO + board_flash_size();
+
+  // short (or zero length) block ends the upload
+  if ( addr >= flash_end ) return 0;
+  uint16_t const count = (uint16_t) tu_min32(length, flash_end - addr);
+
+  board_flash_read(addr, data, count);
+  return count;
+}
+
+// Invoked when the Host has terminated a download or upload transfer
+void tud_dfu_abort_cb(uint8_t alt) {
+  (void) alt;
+  _dfu.remain = 0;
+}
+
+// Invoked when a DFU_DETACH request is received
+void tud_dfu_detach_cb(void) {
+  board_flash_flush();
+  board_dfu_complete();
+}
+
+#endif
+
+bool dfu_task(void) {
+#if CFG_TUD_DFU
+  if ( _dfu.manifested && !tud_mounted() ) {
+    // host reset the bus after download
+    board_dfu_complete();
+  }
+
+  if ( !_dfu.remain ) return false;
+
+  // program one chunk per call so that tud_task() is serviced in between
+  uint32_t const count = tu_min32(_dfu.remain, 256 - (_dfu.addr & 0xff));
+
+  if ( count & 3 ) {
+    // end of image, words are programmed from the last aligned position
+    uint32_t const aligned = count & ~3UL;
+    if ( aligned ) board_flash_write(_dfu.addr, _dfu.data, aligned);
+
+    memset(_dfu_tail, 0xff, sizeof(_dfu_tail));
+    memcpy(_dfu_tail, _dfu.data + aligned, count - aligned);
+    board_flash_write(_dfu.addr + aligned, _dfu_tail, sizeof(_dfu_tail));
+  } else {
+    board_flash_write(_dfu.addr, _dfu.data, count);
+  }
+
+  _dfu.data += count;
+  _dfu.addr += count;
+  _dfu.remain -= count;
+
+  if ( !_dfu.remain ) tud_dfu_finish_flashing(DFU_STATUS_OK);
+  return _dfu.remain != 0;
+#else
+  return false;
+#endif
+}
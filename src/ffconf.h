@@ -0,0 +1,67 @@
+/*---------------------------------------------------------------------------/
+/  FatFs configuration for TinyUF2 flash from SD card (TINYUF2_SD_FLASH)
+/
+/  Read-only access to the first FAT12/16/32 volume, short file names only,
+/  see lib/fatfs/source/00readme.txt for a description of each option.
+/---------------------------------------------------------------------------*/
+
+#define FFCONF_DEF  80286 /* Revision ID */
+
+/*---------------------------------------------------------------------------/
+/ Function Configurations
+/---------------------------------------------------------------------------*/
+
+#define FF_FS_READONLY    1
+#define FF_FS_MINIMIZE    2 /* only f_open/f_read/f_lseek/f_close are used */
+#define FF_USE_FIND       0
+#define FF_USE_MKFS       0
+#define FF_USE_FASTSEEK   1 /* cluster link map, no FAT lookup while reading */
+#define FF_USE_EXPAND     0
+#define FF_USE_CHMOD      0
+#define FF_USE_LABEL      0
+#define FF_USE_FORWARD    0
+#define FF_USE_STRFUNC    0
+#define FF_PRINT_LLI      0
+#define FF_PRINT_FLOAT    0
+#define FF_STRF_ENCODE    0
+
+/*---------------------------------------------------------------------------/
+/ Locale and Namespace Configurations
+/---------------------------------------------------------------------------*/
+
+#define FF_CODE_PAGE      437
+#define FF_USE_LFN        0
+#define FF_MAX_LFN        255
+#define FF_LFN_UNICODE    0
+#define FF_LFN_BUF        255
+#define FF_SFN_BUF        12
+#define FF_FS_RPATH       0
+
+/*---------------------------------------------------------------------------/
+/ Drive/Volume Configurations
+/---------------------------------------------------------------------------*/
+
+#define FF_VOLUMES        1
+#define FF_STR_VOLUME_ID  0
+#define FF_VOLUME_STRS    "SD"
+#define FF_MULTI_PARTITION 0
+#define FF_MIN_SS         512
+#define FF_MAX_SS         512
+#define FF_LBA64          0
+#define FF_MIN_GPT        0x10000000
+#define FF_USE_TRIM       0
+
+/*---------------------------------------------------------------------------/
+/ System Configurations
+/---------------------------------------------------------------------------*/
+
+#define FF_FS_TINY        1 /* sector buffer is shared, file data is read into the caller's buffer */
+#define FF_FS_EXFAT       0
+#define FF_FS_NORTC       1
+#define FF_NORTC_MON      1
+#define FF_NORTC_MDAY     1
+#define FF_NORTC_YEAR     2024
+#define FF_FS_NOFSINFO    0
+#define FF_FS_LOCK        0
+#define FF_FS_REENTRANT   0
+#define FF_FS_TIMEOUT     1000
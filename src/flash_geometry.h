@@ -0,0 +1,129 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef FLASH_GEOMETRY_H_
+#define FLASH_GEOMETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//--------------------------------------------------------------------+
+// Internal flash layout shared by the sector based ports (stm32f3/f4/l4).
+// Layout is a constant table of runs of equally sized sectors, e.g F4 { 16KB x 4, 64KB x 1, 128KB x 7 }.
+// Lookup walks the runs (a handful at most) and divides within one, instead of walking every sector.
+// Header only since self-update applications only build port sources.
+//--------------------------------------------------------------------+
+
+typedef struct {
+  uint32_t size;        // sector size in bytes
+  uint32_t count;       // consecutive sectors of this size
+} flash_region_t;
+
+typedef struct {
+  uint32_t base;                  // address of sector 0
+  flash_region_t const* regions;
+  uint32_t region_count;
+} flash_geometry_t;
+
+typedef struct {
+  uint32_t index;       // sector number as used by the erase operation
+  uint32_t addr;
+  uint32_t size;
+} flash_sector_t;
+
+#define FLASH_GEOMETRY(_base, _regions) \
+  { .base = (_base), .regions = (_regions), .region_count = sizeof(_regions) / sizeof((_regions)[0]) }
+
+// Total number of sectors
+static inline uint32_t flash_geometry_count(flash_geometry_t const* geo) {
+  uint32_t count = 0;
+  for (uint32_t r = 0; r < geo->region_count; r++) count += geo->regions[r].count;
+  return count;
+}
+
+// Sector containing addr, false if addr is outside of flash
+static inline bool flash_sector_find(flash_geometry_t const* geo, uint32_t addr, flash_sector_t* sector) {
+  uint32_t offset = addr - geo->base; // wraps for addresses below base
+  uint32_t index = 0;
+
+  for (uint32_t r = 0; r < geo->region_count; r++) {
+    flash_region_t const* region = &geo->regions[r];
+    uint32_t const region_size = region->size * region->count;
+
+    if (offset < region_size) {
+      uint32_t const i = offset / region->size;
+      sector->index = index + i;
+      sector->size = region->size;
+      sector->addr = addr - (offset - i * region->size);
+      return true;
+    }
+
+    offset -= region_size;
+    index += region->count;
+  }
+
+  return false;
+}
+
+// Sector by number, false if there is no such sector
+static inline bool flash_sector_get(flash_geometry_t const* geo, uint32_t index, flash_sector_t* sector) {
+  uint32_t addr = geo->base;
+  uint32_t first = 0;
+
+  for (uint32_t r = 0; r < geo->region_count; r++) {
+    flash_region_t const* region = &geo->regions[r];
+
+    if (index < first + region->count) {
+      sector->index = index;
+      sector->size = region->size;
+      sector->addr = addr + (index - first) * region->size;
+      return true;
+    }
+
+    addr += region->size * region->count;
+    first += region->count;
+  }
+
+  return false;
+}
+
+// Check erased state (all 0xFF) of memory mapped flash, addr and size must be 8-byte aligned.
+// Reads 4 doublewords per compare, exits at the first block containing a programmed bit
+static inline bool flash_is_blank(uint32_t addr, uint32_t size) {
+  uint64_t const* p = (uint64_t const*) (uintptr_t) addr;
+  uint64_t const* const end = (uint64_t const*) (uintptr_t) (addr + size);
+
+  for (; (end - p) >= 4; p += 4) {
+    if ((p[0] & p[1] & p[2] & p[3]) != UINT64_MAX) return false;
+  }
+
+  for (; p < end; p++) {
+    if (*p != UINT64_MAX) return false;
+  }
+
+  return true;
+}
+
+#endif
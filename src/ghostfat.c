@@ -36,9 +36,34 @@
 //
 //--------------------------------------------------------------------+
 
+#if TINYUF2_STATIC_LAYOUT
+// Whole layout is known at compile time, board_flash_size() must return TINYUF2_FLASH_SIZE
+#if TINYUF2_STATS || TINYUF2_CURRENT_UF2_EXTENT
+  #error "TINYUF2_STATIC_LAYOUT requires fixed file sizes, incompatible with TINYUF2_STATS and TINYUF2_CURRENT_UF2_EXTENT"
+#endif
+#if TINYUF2_AUTO_GEOMETRY
+  #error "TINYUF2_STATIC_LAYOUT has a fixed volume size, incompatible with TINYUF2_AUTO_GEOMETRY"
+#endif
+#if TINYUF2_PART_FILES
+  #error "TINYUF2_STATIC_LAYOUT requires fixed file sizes, incompatible with TINYUF2_PART_FILES"
+#endif
+
+#ifndef TINYUF2_FLASH_SIZE
+  #define TINYUF2_FLASH_SIZE BOARD_FLASH_SIZE
+#endif
+
+#define _flash_size   ((uint32_t) TINYUF2_FLASH_SIZE)
+#define _uf2_size     _flash_size
+#define _uf2_end      (BOARD_FLASH_ADDR_ZERO + _flash_size)
+#else
 // ota0 partition size
 static uint32_t _flash_size;
 
+// flash covered by CURRENT.UF2: number of bytes and end address
+static uint32_t _uf2_size;
+static uint32_t _uf2_end;
+#endif
+
 #define STATIC_ASSERT(_exp) _Static_assert(_exp, "static assert failed")
 
 #define STR0(x) #x
@@ -62,6 +87,15 @@ typedef struct {
     uint16_t Heads;
     uint32_t HiddenSectors;
     uint32_t TotalSectors32;
+#if CFG_UF2_FAT32
+    uint32_t SectorsPerFAT32;
+    uint16_t ExtFlags;
+    uint16_t FSVersion;
+    uint32_t RootCluster;
+    uint16_t FSInfoSector;
+    uint16_t BackupBootSector;
+    uint8_t Reserved0[12];
+#endif
     uint8_t PhysicalDriveNum;
     uint8_t Reserved;
     uint8_t ExtendedBootSig;
@@ -87,58 +121,205 @@ typedef struct {
 } __attribute__((packed)) DirEntry;
 STATIC_ASSERT(sizeof(DirEntry) == 32);
 
+// Long file name entry, precedes the short entry. Name is split in UTF-16 pieces of 13 characters
+typedef struct {
+    uint8_t order;        // 1-based piece number, LFN_LAST_ENTRY set on the last (first stored) piece
+    uint16_t name1[5];
+    uint8_t attrs;        // always 0x0F
+    uint8_t type;
+    uint8_t checksum;     // of the short name
+    uint16_t name2[6];
+    uint16_t startCluster;
+    uint16_t name3[2];
+} __attribute__((packed)) LfnEntry;
+STATIC_ASSERT(sizeof(LfnEntry) == 32);
+
+#define LFN_LAST_ENTRY  0x40
+#define LFN_PIECE_CHARS 13
+
+#define ATTR_DIRECTORY  0x10
+
+// Directories, files are listed in the one given by FileContent.dir
+enum {
+  DIR_ROOT = 0,
+#if TINYUF2_DIAG_DIR
+  DIR_DIAG,
+#endif
+  NUM_DIRS
+};
+
 typedef struct FileContent {
-  char const name[11];
+  char name[11];       // empty if the file is absent (TINYUF2_PART_FILES)
   void const * content;
   uint32_t size;       // OK to use uint32_T b/c FAT32 limits filesize to (4GiB - 2)
 
+  uint8_t dir;            // parent directory, DIR_ROOT by default
+  uint8_t subdir;         // non zero if entry is this directory, size is then its cluster
+  char const* long_name;  // optional, ASCII
+
   // computing fields based on index and size
-  uint16_t cluster_start;
-  uint16_t cluster_end;
+  uint32_t cluster_start;
+  uint32_t cluster_end;
 } FileContent_t;
 
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
 
-#define BPB_SECTOR_SIZE           ( 512)
+#define BPB_SECTOR_SIZE           (CFG_UF2_SECTOR_SIZE)
 #define BPB_SECTORS_PER_CLUSTER   (CFG_UF2_SECTORS_PER_CLUSTER)
-#define BPB_RESERVED_SECTORS      (   1)
 #define BPB_NUMBER_OF_FATS        (   2)
-#define BPB_ROOT_DIR_ENTRIES      (  64)
-#define BPB_TOTAL_SECTORS         CFG_UF2_NUM_BLOCKS
 #define BPB_MEDIA_DESCRIPTOR_BYTE (0xF8)
+
+#if CFG_UF2_FAT32
+// FAT32: boot sector and FSInfo, with backup copies at sector 6 and 7.
+// Root directory is a regular (single) cluster right at the start of the data region
+#define BPB_RESERVED_SECTORS      (  32)
+#define BPB_ROOT_DIR_ENTRIES      (   0)
+#define BPB_FSINFO_SECTOR         (   1)
+#define BPB_BACKUP_BOOT_SECTOR    (   6)
+#define FAT_ROOT_DIR_CLUSTERS     (   1)
+#define FAT_ENTRY_SIZE            (4)
+#define FAT_END_OF_CHAIN          (0x0FFFFFFF)
+#define FAT_RESERVED_CLUSTER      (0x0FFFFFF0)
+typedef uint32_t fat_entry_t;
+#else
+#define BPB_RESERVED_SECTORS      (   1)
+#define BPB_ROOT_DIR_ENTRIES      ((BPB_SECTOR_SIZE == 512) ? 64 : (BPB_SECTOR_SIZE / 32)) // at least one sector
+#define FAT_ROOT_DIR_CLUSTERS     (   0)
 #define FAT_ENTRY_SIZE            (2)
-#define FAT_ENTRIES_PER_SECTOR    (BPB_SECTOR_SIZE / FAT_ENTRY_SIZE)
 #define FAT_END_OF_CHAIN          (0xFFFF)
+#define FAT_RESERVED_CLUSTER      (0xFFF0)
+typedef uint16_t fat_entry_t;
+#endif
+
+#define FAT_ENTRIES_PER_SECTOR    (BPB_SECTOR_SIZE / FAT_ENTRY_SIZE)
 
 // NOTE: MS specification explicitly allows FAT to be larger than necessary
-#define TOTAL_CLUSTERS_ROUND_UP   UF2_DIV_CEIL(BPB_TOTAL_SECTORS, BPB_SECTORS_PER_CLUSTER)
-#define BPB_SECTORS_PER_FAT       UF2_DIV_CEIL(TOTAL_CLUSTERS_ROUND_UP, FAT_ENTRIES_PER_SECTOR)
+#define TOTAL_CLUSTERS_ROUND_UP   UF2_DIV_CEIL(UF2_NUM_SECTORS, BPB_SECTORS_PER_CLUSTER)
+#define LAYOUT_SECTORS_PER_FAT    UF2_DIV_CEIL(TOTAL_CLUSTERS_ROUND_UP, FAT_ENTRIES_PER_SECTOR)
+
+#if TINYUF2_AUTO_GEOMETRY
+// volume size is set by geometry_init(), the configured layout is the upper bound
+static uint32_t _total_sectors   = UF2_NUM_SECTORS;
+static uint32_t _sectors_per_fat = LAYOUT_SECTORS_PER_FAT;
+
+#define BPB_TOTAL_SECTORS         _total_sectors
+#define BPB_SECTORS_PER_FAT       _sectors_per_fat
+#else
+#define BPB_TOTAL_SECTORS         UF2_NUM_SECTORS
+#define BPB_SECTORS_PER_FAT       LAYOUT_SECTORS_PER_FAT
+#endif
+
 #define DIRENTRIES_PER_SECTOR     (BPB_SECTOR_SIZE/sizeof(DirEntry))
 #define ROOT_DIR_SECTOR_COUNT     UF2_DIV_CEIL(BPB_ROOT_DIR_ENTRIES, DIRENTRIES_PER_SECTOR)
 #define BPB_BYTES_PER_CLUSTER     (BPB_SECTOR_SIZE * BPB_SECTORS_PER_CLUSTER)
 
+#define FS_START_FAT0_SECTOR      BPB_RESERVED_SECTORS
+#define FS_START_FAT1_SECTOR      (FS_START_FAT0_SECTOR + BPB_SECTORS_PER_FAT)
+#define FS_START_ROOTDIR_SECTOR   (FS_START_FAT1_SECTOR + BPB_SECTORS_PER_FAT)
+#define FS_START_CLUSTERS_SECTOR  (FS_START_ROOTDIR_SECTOR + ROOT_DIR_SECTOR_COUNT)
+
 STATIC_ASSERT((BPB_SECTORS_PER_CLUSTER & (BPB_SECTORS_PER_CLUSTER-1)) == 0); // sectors per cluster must be power of two
-STATIC_ASSERT(BPB_SECTOR_SIZE                              ==       512); // GhostFAT does not support other sector sizes (currently)
+STATIC_ASSERT(BPB_SECTOR_SIZE == 512 || BPB_SECTOR_SIZE == 4096);       // GhostFAT supports 512 and 4096 byte sectors
 STATIC_ASSERT(BPB_NUMBER_OF_FATS                           ==         2); // FAT highest compatibility
 STATIC_ASSERT(sizeof(DirEntry)                             ==        32); // FAT requirement
 STATIC_ASSERT(BPB_SECTOR_SIZE % sizeof(DirEntry)           ==         0); // FAT requirement
 STATIC_ASSERT(BPB_ROOT_DIR_ENTRIES % DIRENTRIES_PER_SECTOR ==         0); // FAT requirement
 STATIC_ASSERT(BPB_BYTES_PER_CLUSTER                        <= (32*1024)); // FAT requirement (64k+ has known compatibility problems)
-STATIC_ASSERT(FAT_ENTRIES_PER_SECTOR                       ==       256); // FAT requirement
+STATIC_ASSERT(FAT_ENTRIES_PER_SECTOR * FAT_ENTRY_SIZE      ==  BPB_SECTOR_SIZE); // FAT requirement
+STATIC_ASSERT(sizeof(fat_entry_t)                          == FAT_ENTRY_SIZE);
+
+#if TINYUF2_DENSE_CURRENT_UF2
+  #define UF2_FIRMWARE_BYTES_PER_SECTOR 476 // largest payload fitting into an uf2 block
+#else
+  #define UF2_FIRMWARE_BYTES_PER_SECTOR 256
+#endif
+
+// last block may carry a partial payload when flash size is not a multiple of payload size
+#define UF2_SECTOR_COUNT                ((_uf2_size + UF2_FIRMWARE_BYTES_PER_SECTOR - 1) / UF2_FIRMWARE_BYTES_PER_SECTOR)
+#define UF2_BYTE_COUNT                  (UF2_SECTOR_COUNT * UF2_BLOCK_SIZE) // always a multiple of 512, per UF2 spec
+
+#define INFO_UF2_TEXT \
+    "TinyUF2 Bootloader " UF2_VERSION "\r\n" \
+    "Model: " UF2_PRODUCT_NAME "\r\n" \
+    "Board-ID: " UF2_BOARD_ID "\r\n" \
+    "Date: " COMPILE_DATE "\r\n" \
+    "Flash Size: 0x"
+
+#if TINYUF2_DELTA_FLASH
+// "Unchanged" and "Written" counters are placed at fixed offsets of the template
+#define INFO_DELTA_TEMPLATE   "\r\nDelta: 0x00000000 of 0x00000000 blocks unchanged"
+#define INFO_DELTA_UNCHANGED  11
+#define INFO_DELTA_WRITTEN    25
+#endif
+
+#if TINYUF2_RAW_WRITE_HINT
+// standard 256-byte payloads of one erase unit, whole sectors, starting at an aligned data region LBA
+#define RAW_WRITE_SECTORS     UF2_DIV_CEIL(UF2_DIV_CEIL(BOARD_FLASH_ERASE_SIZE, 256) * UF2_BLOCK_SIZE, BPB_SECTOR_SIZE)
+#define RAW_WRITE_CHUNK       (RAW_WRITE_SECTORS * BPB_SECTOR_SIZE)
+#define RAW_WRITE_LBA         (UF2_DIV_CEIL(FS_START_CLUSTERS_SECTOR, RAW_WRITE_SECTORS) * RAW_WRITE_SECTORS)
+#define INFO_RAW_WRITE_LBA    "\r\nRaw-Write: LBA 0x"
+#define INFO_RAW_WRITE_CHUNK  ", chunk 0x"
+#endif
 
-#define UF2_FIRMWARE_BYTES_PER_SECTOR   256
-#define UF2_SECTOR_COUNT                (_flash_size / UF2_FIRMWARE_BYTES_PER_SECTOR)
-#define UF2_BYTE_COUNT                  (UF2_SECTOR_COUNT * BPB_SECTOR_SIZE) // always a multiple of sector size, per UF2 spec
+#if TINYUF2_RESUME
+// image ID and block fields are placed at fixed offsets of the template, all zero if nothing to resume
+#define INFO_RESUME_TEMPLATE  "\r\nResume: image 0x0000000000000000, block 0x00000000 of 0x00000000"
+#define INFO_RESUME_IMAGE     18
+#define INFO_RESUME_BLOCK     44
+#define INFO_RESUME_TOTAL     58
+#endif
 
+#if TINYUF2_STATIC_LAYOUT
+#define HEX_DIGIT(_v, _shift)  ((char) ((((_v) >> (_shift)) & 0xF) + (((((_v) >> (_shift)) & 0xF) < 10) ? '0' : 'A' - 10)))
+#define HEX_STR8(_v)  { HEX_DIGIT(_v, 28), HEX_DIGIT(_v, 24), HEX_DIGIT(_v, 20), HEX_DIGIT(_v, 16), \
+                        HEX_DIGIT(_v, 12), HEX_DIGIT(_v,  8), HEX_DIGIT(_v,  4), HEX_DIGIT(_v,  0) }
+
+// Same text as uf2_init() builds at runtime, laid out as consecutive char arrays
+static struct {
+  char text[sizeof(INFO_UF2_TEXT) - 1];
+  char flash_size[8];
+  char unit[6];
+#if TINYUF2_DELTA_FLASH
+  char delta[sizeof(INFO_DELTA_TEMPLATE) - 1];
+#endif
+#if TINYUF2_RAW_WRITE_HINT
+  char raw_lba_text[sizeof(INFO_RAW_WRITE_LBA) - 1];
+  char raw_lba[8];
+  char raw_chunk_text[sizeof(INFO_RAW_WRITE_CHUNK) - 1];
+  char raw_chunk[8];
+  char raw_unit[6];
+#endif
+#if TINYUF2_RESUME
+  char resume[sizeof(INFO_RESUME_TEMPLATE) - 1];
+#endif
+  char nul;
+} _info_uf2 = {
+  .text       = INFO_UF2_TEXT,
+  .flash_size = HEX_STR8(TINYUF2_FLASH_SIZE),
+  .unit       = " bytes",
+#if TINYUF2_DELTA_FLASH
+  .delta      = INFO_DELTA_TEMPLATE,
+#endif
+#if TINYUF2_RAW_WRITE_HINT
+  .raw_lba_text   = INFO_RAW_WRITE_LBA,
+  .raw_lba        = HEX_STR8(RAW_WRITE_LBA),
+  .raw_chunk_text = INFO_RAW_WRITE_CHUNK,
+  .raw_chunk      = HEX_STR8(RAW_WRITE_CHUNK),
+  .raw_unit       = " bytes",
+#endif
+#if TINYUF2_RESUME
+  .resume         = INFO_RESUME_TEMPLATE,
+#endif
+};
 
-char infoUf2File[128*3] =
-    "TinyUF2 Bootloader " UF2_VERSION "\r\n"
-    "Model: " UF2_PRODUCT_NAME "\r\n"
-    "Board-ID: " UF2_BOARD_ID "\r\n"
-    "Date: " COMPILE_DATE "\r\n"
-    "Flash Size: 0x";
+#define infoUf2File   ((char*) &_info_uf2)
+#define INFO_UF2_SIZE (sizeof(_info_uf2) - 1)
+#else
+char infoUf2File[128*3] = INFO_UF2_TEXT;
+#define INFO_UF2_SIZE (sizeof(infoUf2File) - 1)
+#endif
 
 TINYUF2_CONST char indexFile[] =
     "<!doctype html>\n"
@@ -155,16 +336,174 @@ TINYUF2_CONST char indexFile[] =
 const char autorunFile[] = "[Autorun]\r\nIcon=FAVICON.ICO\r\n";
 #endif
 
+#if TINYUF2_STATS
+// Rendered on read, one "Label: 0x00000000" line per counter
+char statsFile[640];
+#endif
+
+#if TINYUF2_CONFIG_TXT
+// Rendered on read, effective runtime tunables, a saved copy is parsed by uf2_config_parse()
+char configFile[UF2_CONFIG_TXT_SIZE];
+#endif
+
+#if TINYUF2_VERIFY_UF2
+// Rendered on read, result of the last UF2_FLAG_VERIFY file
+#define VERIFY_TEXT \
+  "Verify: NONE    \r\n" \
+  "Blocks: 0x00000000 of 0x00000000\r\n" \
+  "Mismatched: 0x00000000\r\n" \
+  "Unchecked: 0x00000000\r\n" \
+  "First mismatch: 0x00000000\r\n"
+char verifyFile[sizeof(VERIFY_TEXT) - 1];
+#endif
+
+#if TINYUF2_WEAR_LOG
+// Rendered on read, header line then one fixed width line per erase unit
+#define WEAR_HEADER   "Sessions: 0x00000000\r\n"
+#define WEAR_LINE     "Unit 0x00000000: 0x00000000 erases, 0x00000000 cycles\r\n"
+#define WEAR_LINE_LEN (sizeof(WEAR_LINE) - 1)
+char wearFile[sizeof(WEAR_HEADER) - 1 + TINYUF2_WEAR_UNITS * WEAR_LINE_LEN];
+#endif
+
+#if TINYUF2_EVENT_LOG
+// Rendered on read, header line then one fixed width line per ring entry, oldest first
+#define EVENTS_HEADER   "Boots: 0x00000000, events: 0x00000000\r\n"
+#define EVENTS_LINE     "Boot 0x0000 at 0x00000000: BLOCK_INVALID 0x00000000\r\n"
+#define EVENTS_LINE_LEN (sizeof(EVENTS_LINE) - 1)
+#define EVENTS_NAME_LEN 13
+char eventsFile[sizeof(EVENTS_HEADER) - 1 + TINYUF2_EVENT_COUNT * EVENTS_LINE_LEN];
+#endif
+
+#if TINYUF2_CURRENT_CRC
+// CRC32 and Length are placed at fixed offsets, updated in place
+#define CURRENT_CRC_VALUE   9
+#define CURRENT_CRC_LENGTH  29
+char currentCrcFile[] = "CRC32: 0x00000000\r\nLength: 0x00000000\r\n";
+#endif
+
+#if TINYUF2_SECTORS_CRC
+// One fixed width line per erase unit from application start: address, size and CRC32. Lines are
+// rendered when read, lines past the last unit of flash are left with a zero size
+#define SECTORS_LINE      "0x00000000 0x00000000 0x00000000\r\n"
+#define SECTORS_LINE_LEN  (sizeof(SECTORS_LINE) - 1)
+char sectorsCrcFile[TINYUF2_SECTORS_CRC * SECTORS_LINE_LEN];
+#endif
+
+#if TINYUF2_STATIC_LAYOUT
+#define FILE_CLUSTERS(_size)  UF2_DIV_CEIL(_size, BPB_BYTES_PER_CLUSTER)
+
+// First cluster of each file, files are contiguous in table order. An absent file takes no cluster
+enum {
+  CLUSTER_INFO    = 2 + FAT_ROOT_DIR_CLUSTERS,
+  CLUSTER_INDEX   = CLUSTER_INFO + FILE_CLUSTERS(INFO_UF2_SIZE),
+  CLUSTER_AUTORUN = CLUSTER_INDEX + FILE_CLUSTERS(sizeof(indexFile) - 1),
+#ifdef TINYUF2_FAVICON_HEADER
+  CLUSTER_FAVICON = CLUSTER_AUTORUN + FILE_CLUSTERS(sizeof(autorunFile) - 1),
+  CLUSTER_CONFIG  = CLUSTER_FAVICON + FILE_CLUSTERS(sizeof(favicon_data)),
+#else
+  CLUSTER_CONFIG  = CLUSTER_AUTORUN,
+#endif
+#if TINYUF2_CONFIG_TXT
+  CLUSTER_DIAG    = CLUSTER_CONFIG + FILE_CLUSTERS(sizeof(configFile)),
+#else
+  CLUSTER_DIAG    = CLUSTER_CONFIG,
+#endif
+  CLUSTER_SECTORS = CLUSTER_DIAG + TINYUF2_DIAG_DIR,
+#if TINYUF2_SECTORS_CRC
+  CLUSTER_VERIFY  = CLUSTER_SECTORS + FILE_CLUSTERS(sizeof(sectorsCrcFile)),
+#else
+  CLUSTER_VERIFY  = CLUSTER_SECTORS,
+#endif
+#if TINYUF2_VERIFY_UF2
+  CLUSTER_WEAR    = CLUSTER_VERIFY + FILE_CLUSTERS(sizeof(verifyFile)),
+#else
+  CLUSTER_WEAR    = CLUSTER_VERIFY,
+#endif
+#if TINYUF2_WEAR_LOG
+  CLUSTER_EVENTS  = CLUSTER_WEAR + FILE_CLUSTERS(sizeof(wearFile)),
+#else
+  CLUSTER_EVENTS  = CLUSTER_WEAR,
+#endif
+#if TINYUF2_EVENT_LOG
+  CLUSTER_CRC     = CLUSTER_EVENTS + FILE_CLUSTERS(sizeof(eventsFile)),
+#else
+  CLUSTER_CRC     = CLUSTER_EVENTS,
+#endif
+#if TINYUF2_CURRENT_CRC
+  CLUSTER_BIN     = CLUSTER_CRC + FILE_CLUSTERS(sizeof(currentCrcFile) - 1),
+#else
+  CLUSTER_BIN     = CLUSTER_CRC,
+#endif
+#if TINYUF2_CURRENT_BIN
+  CLUSTER_UF2     = CLUSTER_BIN + FILE_CLUSTERS(_uf2_end - BOARD_FLASH_APP_START),
+#else
+  CLUSTER_UF2     = CLUSTER_BIN,
+#endif
+  CLUSTER_END     = CLUSTER_UF2 + FILE_CLUSTERS(UF2_BYTE_COUNT),
+};
+
+#define FILE_SIZE(_size)            (_size)
+#define FILE_LAYOUT(_start, _next)  , .cluster_start = (_start), .cluster_end = (_next) - 1
+#define FILE_TABLE_CONST            const
+#else
+// flash backed sizes and cluster ranges are computed by uf2_init()
+#define FILE_SIZE(_size)            0
+#define FILE_LAYOUT(_start, _next)
+#define FILE_TABLE_CONST
+#endif
+
+#ifdef TINYUF2_FAVICON_HEADER
+  #define PART_FILE_FIRST  4
+#else
+  #define PART_FILE_FIRST  2
+#endif
+
 // size of CURRENT.UF2:
-static FileContent_t info[] = {
-    {.name = "INFO_UF2TXT", .content = infoUf2File , .size = sizeof(infoUf2File) - 1},
-    {.name = "INDEX   HTM", .content = indexFile   , .size = sizeof(indexFile  ) - 1},
+static FILE_TABLE_CONST FileContent_t info[] = {
+    {.name = "INFO_UF2TXT", .content = infoUf2File , .size = INFO_UF2_SIZE            FILE_LAYOUT(CLUSTER_INFO, CLUSTER_INDEX)},
+    {.name = "INDEX   HTM", .content = indexFile   , .size = sizeof(indexFile  ) - 1  FILE_LAYOUT(CLUSTER_INDEX, CLUSTER_AUTORUN)},
 #ifdef TINYUF2_FAVICON_HEADER
-    {.name = "AUTORUN INF", .content = autorunFile , .size = sizeof(autorunFile) - 1},
-    {.name = "FAVICON ICO", .content = favicon_data, .size = favicon_len            },
+    {.name = "AUTORUN INF", .content = autorunFile , .size = sizeof(autorunFile) - 1  FILE_LAYOUT(CLUSTER_AUTORUN, CLUSTER_FAVICON)},
+    {.name = "FAVICON ICO", .content = favicon_data, .size = sizeof(favicon_data)     FILE_LAYOUT(CLUSTER_FAVICON, CLUSTER_CONFIG)},
+#endif
+#if TINYUF2_PART_FILES
+    // raw files of the board, named, sized and mapped by part_files_init()
+    [PART_FILE_FIRST ... PART_FILE_FIRST + TINYUF2_PART_FILES - 1] = {.name = ""},
+#endif
+#if TINYUF2_CONFIG_TXT
+    {.name = "CONFIG  TXT", .content = configFile  , .size = sizeof(configFile)       FILE_LAYOUT(CLUSTER_CONFIG, CLUSTER_DIAG)},
+#endif
+#if TINYUF2_DIAG_DIR
+    // diagnostic files below are listed in this directory
+    {.name = "DIAG       ", .content = NULL        , .size = BPB_BYTES_PER_CLUSTER, .subdir = DIR_DIAG, .long_name = "Diagnostics" FILE_LAYOUT(CLUSTER_DIAG, CLUSTER_SECTORS)},
+    #define DIAG_FILE   , .dir = DIR_DIAG
+#else
+    #define DIAG_FILE
+#endif
+#if TINYUF2_SECTORS_CRC
+    {.name = "SECTORS CRC", .content = sectorsCrcFile, .size = sizeof(sectorsCrcFile) DIAG_FILE FILE_LAYOUT(CLUSTER_SECTORS, CLUSTER_VERIFY)},
+#endif
+#if TINYUF2_STATS
+    {.name = "STATS   TXT", .content = statsFile   , .size = 0                        DIAG_FILE},
+#endif
+#if TINYUF2_VERIFY_UF2
+    {.name = "VERIFY  TXT", .content = verifyFile  , .size = sizeof(verifyFile)       DIAG_FILE FILE_LAYOUT(CLUSTER_VERIFY, CLUSTER_WEAR)},
+#endif
+#if TINYUF2_WEAR_LOG
+    {.name = "WEAR    TXT", .content = wearFile    , .size = sizeof(wearFile)         DIAG_FILE FILE_LAYOUT(CLUSTER_WEAR, CLUSTER_EVENTS)},
+#endif
+#if TINYUF2_EVENT_LOG
+    {.name = "EVENTS  TXT", .content = eventsFile  , .size = sizeof(eventsFile)       DIAG_FILE FILE_LAYOUT(CLUSTER_EVENTS, CLUSTER_CRC)},
+#endif
+#if TINYUF2_CURRENT_CRC
+    {.name = "CURRENT CRC", .content = currentCrcFile, .size = sizeof(currentCrcFile) - 1 DIAG_FILE FILE_LAYOUT(CLUSTER_CRC, CLUSTER_BIN)},
+#endif
+#if TINYUF2_CURRENT_BIN
+    // raw flash contents, generated on-the-fly
+    {.name = "CURRENT BIN", .content = NULL       , .size = FILE_SIZE(_uf2_end - BOARD_FLASH_APP_START) FILE_LAYOUT(CLUSTER_BIN, CLUSTER_UF2)},
 #endif
     // current.uf2 must be the last element and its content must be NULL
-    {.name = "CURRENT UF2", .content = NULL       , .size = 0                       },
+    {.name = "CURRENT UF2", .content = NULL       , .size = FILE_SIZE(UF2_BYTE_COUNT) FILE_LAYOUT(CLUSTER_UF2, CLUSTER_END)},
 };
 
 enum {
@@ -172,53 +511,117 @@ enum {
   NUM_DIRENTRIES = NUM_FILES + 1 // including volume label as first root directory entry
 };
 
+// Entries of each directory are built by uf2_init() (long names included) and served with a memcpy
+// from the directory's first sector, following sectors are empty
+#if TINYUF2_DIAG_DIR
+#define DIR_MAX_ENTRIES DIRENTRIES_PER_SECTOR
+#else
+#define DIR_MAX_ENTRIES NUM_DIRENTRIES
+#endif
+
 enum {
   FID_INFO = 0,
   FID_INDEX = 1,
   FID_UF2 = NUM_FILES - 1,
+#if TINYUF2_CONFIG_TXT
+  FID_CONFIG = PART_FILE_FIRST + TINYUF2_PART_FILES,
+#endif
+#if TINYUF2_CURRENT_BIN
+  FID_BIN = NUM_FILES - 2,
+#endif
+#if TINYUF2_CURRENT_CRC
+  FID_CRC = NUM_FILES - 2 - TINYUF2_CURRENT_BIN,
+#endif
+#if TINYUF2_EVENT_LOG
+  FID_EVENTS = NUM_FILES - 2 - TINYUF2_CURRENT_BIN - TINYUF2_CURRENT_CRC,
+#endif
+#if TINYUF2_WEAR_LOG
+  FID_WEAR = NUM_FILES - 2 - TINYUF2_CURRENT_BIN - TINYUF2_CURRENT_CRC - TINYUF2_EVENT_LOG,
+#endif
+#if TINYUF2_VERIFY_UF2
+  FID_VERIFY = NUM_FILES - 2 - TINYUF2_CURRENT_BIN - TINYUF2_CURRENT_CRC - TINYUF2_EVENT_LOG - TINYUF2_WEAR_LOG,
+#endif
+#if TINYUF2_STATS
+  FID_STATS = NUM_FILES - 2 - TINYUF2_CURRENT_BIN - TINYUF2_CURRENT_CRC - TINYUF2_EVENT_LOG - TINYUF2_WEAR_LOG -
+              TINYUF2_VERIFY_UF2,
+#endif
+#if TINYUF2_SECTORS_CRC
+  FID_SECTORS = NUM_FILES - 2 - TINYUF2_CURRENT_BIN - TINYUF2_CURRENT_CRC - TINYUF2_EVENT_LOG - TINYUF2_WEAR_LOG -
+                TINYUF2_VERIFY_UF2 - TINYUF2_STATS,
+#endif
 };
 
+#if CFG_UF2_FAT32
+STATIC_ASSERT(NUM_DIRENTRIES < FAT_ROOT_DIR_CLUSTERS * BPB_SECTORS_PER_CLUSTER * DIRENTRIES_PER_SECTOR); // root directory cluster holds all files
+#else
 STATIC_ASSERT(NUM_DIRENTRIES < BPB_ROOT_DIR_ENTRIES);  // FAT requirement -- Ensures BPB reserves sufficient entries for all files
+#endif
 STATIC_ASSERT(NUM_DIRENTRIES < DIRENTRIES_PER_SECTOR); // GhostFAT bug workaround -- else, code overflows buffer
 
 #define NUM_SECTORS_IN_DATA_REGION (BPB_TOTAL_SECTORS - BPB_RESERVED_SECTORS - (BPB_NUMBER_OF_FATS * BPB_SECTORS_PER_FAT) - ROOT_DIR_SECTOR_COUNT)
 #define CLUSTER_COUNT              (NUM_SECTORS_IN_DATA_REGION / BPB_SECTORS_PER_CLUSTER)
 
+// configured layout, checked at compile time
+#define LAYOUT_CLUSTER_COUNT       ((UF2_NUM_SECTORS - BPB_RESERVED_SECTORS - (BPB_NUMBER_OF_FATS * LAYOUT_SECTORS_PER_FAT) - \
+                                     ROOT_DIR_SECTOR_COUNT) / BPB_SECTORS_PER_CLUSTER)
+
+#if CFG_UF2_FAT32
+// Ensure cluster count results in a valid FAT32 volume!
+STATIC_ASSERT( LAYOUT_CLUSTER_COUNT >= 0xFFF5 && LAYOUT_CLUSTER_COUNT < 0x0FFFFFF5 );
+
+// Same as FAT16, avoid being within 32 of those limits for even greater compatibility.
+STATIC_ASSERT( LAYOUT_CLUSTER_COUNT >= 0x10015 && LAYOUT_CLUSTER_COUNT < 0x0FFFFFD5 );
+#define LAYOUT_MIN_CLUSTERS        0x10015
+#else
 // Ensure cluster count results in a valid FAT16 volume!
-STATIC_ASSERT( CLUSTER_COUNT >= 0x0FF5 && CLUSTER_COUNT < 0xFFF5 );
+STATIC_ASSERT( LAYOUT_CLUSTER_COUNT >= 0x0FF5 && LAYOUT_CLUSTER_COUNT < 0xFFF5 );
 
 // Many existing FAT implementations have small (1-16) off-by-one style errors
 // So, avoid being within 32 of those limits for even greater compatibility.
-STATIC_ASSERT( CLUSTER_COUNT >= 0x1015 && CLUSTER_COUNT < 0xFFD5 );
-
-#define FS_START_FAT0_SECTOR      BPB_RESERVED_SECTORS
-#define FS_START_FAT1_SECTOR      (FS_START_FAT0_SECTOR + BPB_SECTORS_PER_FAT)
-#define FS_START_ROOTDIR_SECTOR   (FS_START_FAT1_SECTOR + BPB_SECTORS_PER_FAT)
-#define FS_START_CLUSTERS_SECTOR  (FS_START_ROOTDIR_SECTOR + ROOT_DIR_SECTOR_COUNT)
+STATIC_ASSERT( LAYOUT_CLUSTER_COUNT >= 0x1015 && LAYOUT_CLUSTER_COUNT < 0xFFD5 );
+#define LAYOUT_MIN_CLUSTERS        0x1015
+#endif
 
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
 
 static FAT_BootBlock TINYUF2_CONST BootBlock = {
+#if CFG_UF2_FAT32
+    .JumpInstruction      = {0xeb, 0x58, 0x90},
+#else
     .JumpInstruction      = {0xeb, 0x3c, 0x90},
+#endif
     .OEMInfo              = "UF2 UF2 ",
     .SectorSize           = BPB_SECTOR_SIZE,
     .SectorsPerCluster    = BPB_SECTORS_PER_CLUSTER,
     .ReservedSectors      = BPB_RESERVED_SECTORS,
     .FATCopies            = BPB_NUMBER_OF_FATS,
     .RootDirectoryEntries = BPB_ROOT_DIR_ENTRIES,
-    .TotalSectors16       = (BPB_TOTAL_SECTORS > 0xFFFF) ? 0 : BPB_TOTAL_SECTORS,
     .MediaDescriptor      = BPB_MEDIA_DESCRIPTOR_BYTE,
-    .SectorsPerFAT        = BPB_SECTORS_PER_FAT,
     .SectorsPerTrack      = 1,
     .Heads                = 1,
-    .TotalSectors32       = (BPB_TOTAL_SECTORS > 0xFFFF) ? BPB_TOTAL_SECTORS : 0,
+#if CFG_UF2_FAT32
+    // FAT32 always uses the 32-bit fields
+    .TotalSectors32       = UF2_NUM_SECTORS,
+    .SectorsPerFAT32      = LAYOUT_SECTORS_PER_FAT,
+    .RootCluster          = 2,
+    .FSInfoSector         = BPB_FSINFO_SECTOR,
+    .BackupBootSector     = BPB_BACKUP_BOOT_SECTOR,
+#else
+    .TotalSectors16       = (UF2_NUM_SECTORS > 0xFFFF) ? 0 : UF2_NUM_SECTORS,
+    .SectorsPerFAT        = LAYOUT_SECTORS_PER_FAT,
+    .TotalSectors32       = (UF2_NUM_SECTORS > 0xFFFF) ? UF2_NUM_SECTORS : 0,
+#endif
     .PhysicalDriveNum     = 0x80, // to match MediaDescriptor of 0xF8
     .ExtendedBootSig      = 0x29,
     .VolumeSerialNumber   = 0x00420042,
     .VolumeLabel          = UF2_VOLUME_LABEL,
+#if CFG_UF2_FAT32
+    .FilesystemIdentifier = "FAT32   ",
+#else
     .FilesystemIdentifier = "FAT16   ",
+#endif
 };
 
 //--------------------------------------------------------------------+
@@ -226,26 +629,70 @@ static FAT_BootBlock TINYUF2_CONST BootBlock = {
 //--------------------------------------------------------------------+
 
 static inline bool is_uf2_block (UF2_Block const *bl) {
+  uint32_t noflash = UF2_FLAG_NOFLASH;
+#if TINYUF2_UF2_LZ4
+  // compressed blocks are marked NOFLASH for bootloaders that can't decode them
+  if ( bl->flags & UF2_FLAG_LZ4 ) noflash = 0;
+#endif
+#if TINYUF2_UF2_AES
+  // encrypted blocks are marked NOFLASH for bootloaders that can't decrypt them
+  if ( bl->flags & UF2_FLAG_AES ) noflash = 0;
+#endif
+#if TINYUF2_SIGNED_UF2
+  // signature block is never flashed but must be counted
+  if ( bl->flags & UF2_FLAG_SIGNATURE ) noflash = 0;
+#endif
+#if TINYUF2_VERIFY_UF2
+  // compared only, marked NOFLASH so that bootloaders without support don't program it either
+  if ( bl->flags & UF2_FLAG_VERIFY ) noflash = 0;
+#endif
+#if TINYUF2_UF2_FILL
+  // fill descriptor is marked NOFLASH for bootloaders that would program it as data
+  if ( bl->flags & UF2_FLAG_FILL ) noflash = 0;
+#endif
+
   return (bl->magicStart0 == UF2_MAGIC_START0) &&
          (bl->magicStart1 == UF2_MAGIC_START1) &&
          (bl->magicEnd == UF2_MAGIC_END) &&
          (bl->flags & UF2_FLAG_FAMILYID) &&
-         !(bl->flags & UF2_FLAG_NOFLASH);
+         !(bl->flags & noflash);
 }
 
+#if !TINYUF2_STATIC_LAYOUT
 // cache the cluster start offset for each file
 // this allows more flexible algorithms w/o O(n) time
 static void init_starting_clusters(void) {
   // +2 because FAT decided first data sector would be in cluster number 2, rather than zero
-  uint16_t start_cluster = 2;
+  // FAT32 root directory occupies the first cluster(s)
+  uint32_t start_cluster = 2 + FAT_ROOT_DIR_CLUSTERS;
 
-  for (uint16_t i = 0; i < NUM_FILES; i++) {
+  for (uint32_t i = 0; i < NUM_FILES; i++) {
     info[i].cluster_start = start_cluster;
     info[i].cluster_end = start_cluster + UF2_DIV_CEIL(info[i].size, BPB_SECTOR_SIZE*BPB_SECTORS_PER_CLUSTER) - 1;
 
     start_cluster = info[i].cluster_end + 1;
   }
 }
+#endif
+
+// FAT sectors are classified once all file clusters are known:
+// - head : sectors up to the one holding the last static file's final cluster,
+//          these contain reserved clusters 0/1 and end-of-chain markers
+// - chain: every entry is (cluster+1), generated without per-entry checks
+// - tail : sector holding CURRENT.UF2's final cluster (chain, end-of-chain, then free)
+// - free : past the last used cluster, all entries zero
+#if TINYUF2_STATIC_LAYOUT
+#define _fat_head_last_sector ((CLUSTER_UF2 - 1) / FAT_ENTRIES_PER_SECTOR)
+#define _fat_tail_sector      ((CLUSTER_END - 1) / FAT_ENTRIES_PER_SECTOR)
+#else
+static uint32_t _fat_head_last_sector;
+static uint32_t _fat_tail_sector;
+
+static void init_fat_sector_classes(void) {
+  _fat_head_last_sector = info[FID_UF2 - 1].cluster_end / FAT_ENTRIES_PER_SECTOR;
+  _fat_tail_sector      = info[FID_UF2].cluster_end / FAT_ENTRIES_PER_SECTOR;
+}
+#endif
 
 // get file index for file that uses the cluster
 // if cluster is past last file, returns ( NUM_FILES-1 ).
@@ -254,20 +701,33 @@ static void init_starting_clusters(void) {
 // contains data from the file's contents, as there
 // are often padding sectors, including all the unused
 // sectors past the end of the media.
+//
+// Lookup time does not grow with NUM_FILES: CURRENT.UF2 (the hot path for
+// readback) is answered with a single compare, other files by binary search
+// over cluster_end since files are laid out contiguously in table order.
 static uint32_t info_index_of(uint32_t cluster) {
   // default results for invalid requests is the index of the last file (CURRENT.UF2)
-  if (cluster >= 0xFFF0) return FID_UF2;
-
-  for (uint32_t i = 0; i < NUM_FILES; i++) {
-    if ( (info[i].cluster_start <= cluster) && (cluster <= info[i].cluster_end) ) {
-      return i;
+  if (cluster >= FAT_RESERVED_CLUSTER) return FID_UF2;
+  if (cluster < info[0].cluster_start) return FID_UF2;
+  if (cluster >= info[FID_UF2].cluster_start) return FID_UF2;
+
+  // find first file whose last cluster is at or after the requested cluster
+  uint32_t lo = 0;
+  uint32_t hi = FID_UF2;
+  while (lo < hi) {
+    uint32_t const mid = (lo + hi) / 2;
+    if (info[mid].cluster_end < cluster) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
   }
 
-  return FID_UF2;
+  return lo;
 }
 
-static void u32_to_hexstr(uint32_t value, char* buffer) {
+// unused with TINYUF2_STATIC_LAYOUT unless a file is updated in place
+__attribute__((unused)) static void u32_to_hexstr(uint32_t value, char* buffer) {
   const char hexDigits[] = "0123456789ABCDEF";
   size_t i;
 
@@ -277,252 +737,2537 @@ static void u32_to_hexstr(uint32_t value, char* buffer) {
   buffer[i] = '\0';
 }
 
-void uf2_init(void) {
-  // TODO maybe limit to application size only if possible board_flash_app_size()
-  _flash_size = board_flash_size();
-
-  // update CURRENT.UF2 file size
-  info[FID_UF2].size = UF2_BYTE_COUNT;
+// check if payload is already in flash, compare by chunk to limit stack usage
+static bool flash_matches(uint32_t addr, uint8_t const *data, uint32_t len) {
+  uint8_t buf[64] __attribute__((aligned(4)));
 
-  // update INFO_UF2.TXT with flash size if having enough space (8 bytes)
-  size_t txt_len = strlen(infoUf2File);
-  size_t const max_len = sizeof(infoUf2File) - 1;
-  if ( max_len - txt_len > 8) {
-    u32_to_hexstr(_flash_size, infoUf2File + txt_len);
-    txt_len += 8;
+  while (len) {
+    uint32_t const count = (len < sizeof(buf)) ? len : sizeof(buf);
+    board_flash_read(addr, buf, count);
+    if (memcmp(buf, data, count)) return false;
 
-    if (max_len - txt_len > 6) {
-      strcpy(infoUf2File + txt_len, " bytes");
-      txt_len += 6;
-    }
+    addr += count;
+    data += count;
+    len  -= count;
   }
-  info[FID_INFO].size = txt_len;
 
-  init_starting_clusters();
+  return true;
 }
 
-/*------------------------------------------------------------------*/
-/* Read CURRENT.UF2
- *------------------------------------------------------------------*/
-void padded_memcpy (char *dst, char const *src, int len) {
-  for ( int i = 0; i < len; ++i ) {
-    if ( *src ) {
-      *dst = *src++;
-    } else {
-      *dst = ' ';
-    }
-    dst++;
+// Payload is made of the erased value, little endian byte order of the erased word
+static bool is_erased_payload(uint32_t addr, uint8_t const *data, uint32_t len) {
+  uint32_t const erased_word = uf2_flash_info()->erased_word;
+
+  for (uint32_t i = 0; i < len; i++) {
+    if (data[i] != (uint8_t) (erased_word >> (8 * ((addr + i) & 3)))) return false;
   }
+
+  return true;
 }
 
-void uf2_read_block (uint32_t block_no, uint8_t *data) {
-  memset(data, 0, BPB_SECTOR_SIZE);
-  uint32_t sectionRelativeSector = block_no;
+#if TINYUF2_DELTA_FLASH
+#if TINYUF2_STATIC_LAYOUT
+#define _info_delta_pos  ((size_t) (_info_uf2.delta - infoUf2File))
+#else
+static size_t _info_delta_pos = 0;
+#endif
 
-  if ( block_no == 0 ) {
-    // Request was for the Boot block
-    memcpy(data, &BootBlock, sizeof(BootBlock));
-    data[510] = 0x55;    // Always at offsets 510/511, even when BPB_SECTOR_SIZE is larger
-    data[511] = 0xaa;    // Always at offsets 510/511, even when BPB_SECTOR_SIZE is larger
-  }
-  else if ( block_no < FS_START_ROOTDIR_SECTOR ) {
-    // Request was for a FAT table sector
-    sectionRelativeSector -= FS_START_FAT0_SECTOR;
-
-    // second FAT is same as the first... use sectionRelativeSector to write data
-    if ( sectionRelativeSector >= BPB_SECTORS_PER_FAT ) {
-      sectionRelativeSector -= BPB_SECTORS_PER_FAT;
-    }
-
-    uint16_t* data16 = (uint16_t*) (void*) data;
-    uint32_t sectorFirstCluster = sectionRelativeSector * FAT_ENTRIES_PER_SECTOR;
-    uint32_t firstUnusedCluster = info[FID_UF2].cluster_end + 1;
-
-    // OPTIMIZATION:
-    // Because all files are contiguous, the FAT CHAIN entries
-    // are all set to (cluster+1) to point to the next cluster.
-    // All clusters past the last used cluster of the last file
-    // are set to zero.
-    //
-    // EXCEPTIONS:
-    // 1. Clusters 0 and 1 require special handling
-    // 2. Final cluster of each file must be set to END_OF_CHAIN
-    //
-
-    // Set default FAT values first.
-    for (uint16_t i = 0; i < FAT_ENTRIES_PER_SECTOR; i++) {
-      uint32_t cluster = i + sectorFirstCluster;
-      if (cluster >= firstUnusedCluster) {
-        data16[i] = 0;
-      }
-      else {
-        data16[i] = cluster + 1;
-      }
-    }
+static void update_info_delta(WriteState const *state) {
+  if (!_info_delta_pos) return;
 
-    // Exception #1: clusters 0 and 1 need special handling
-    if (sectionRelativeSector == 0) {
-      data[0] = BPB_MEDIA_DESCRIPTOR_BYTE;
-      data[1] = 0xff;
-      data16[1] = FAT_END_OF_CHAIN; // cluster 1 is reserved
-    }
+  // u32_to_hexstr() appends a null terminator, restore the following character
+  char* str = infoUf2File + _info_delta_pos;
+  u32_to_hexstr(state->numUnchanged, str + INFO_DELTA_UNCHANGED);
+  str[INFO_DELTA_UNCHANGED + 8] = ' ';
+  u32_to_hexstr(state->numWritten, str + INFO_DELTA_WRITTEN);
+  str[INFO_DELTA_WRITTEN + 8] = ' ';
+}
 
-    // Exception #2: the final cluster of each file must be set to END_OF_CHAIN
-    for (uint32_t i = 0; i < NUM_FILES; i++) {
-      uint32_t lastClusterOfFile = info[i].cluster_end;
-      if (lastClusterOfFile >= sectorFirstCluster) {
-        uint32_t idx = lastClusterOfFile - sectorFirstCluster;
-        if (idx < FAT_ENTRIES_PER_SECTOR) {
-          // that last cluster of the file is in this sector
-          data16[idx] = FAT_END_OF_CHAIN;
-        }
-      }
-    }
-  }
-  else if ( block_no < FS_START_CLUSTERS_SECTOR ) {
-    // Request was for a (root) directory sector .. root because not supporting subdirectories (yet)
-    sectionRelativeSector -= FS_START_ROOTDIR_SECTOR;
-
-    DirEntry *d = (void*) data;                   // pointer to next free DirEntry this sector
-    int remainingEntries = DIRENTRIES_PER_SECTOR; // remaining count of DirEntries this sector
-
-    uint32_t startingFileIndex;
-
-    if ( sectionRelativeSector == 0 ) {
-      // volume label is first directory entry
-      padded_memcpy(d->name, (char const*) BootBlock.VolumeLabel, 11);
-      d->attrs = 0x28;
-      d++;
-      remainingEntries--;
-
-      startingFileIndex = 0;
-    }else {
-      // -1 to account for volume label in first sector
-      startingFileIndex = DIRENTRIES_PER_SECTOR * sectionRelativeSector - 1;
-    }
-
-    for ( uint32_t fileIndex = startingFileIndex;
-          remainingEntries > 0 && fileIndex < NUM_FILES; // while space remains in buffer and more files to add...
-          fileIndex++, d++ ) {
-      // WARNING -- code presumes all files take exactly one directory entry (no long file names!)
-      uint32_t const startCluster = info[fileIndex].cluster_start;
-
-      FileContent_t const *inf = &info[fileIndex];
-      padded_memcpy(d->name, inf->name, 11);
-      d->createTimeFine   = COMPILE_SECONDS_INT % 2 * 100;
-      d->createTime       = COMPILE_DOS_TIME;
-      d->createDate       = COMPILE_DOS_DATE;
-      d->lastAccessDate   = COMPILE_DOS_DATE;
-      d->highStartCluster = startCluster >> 16;
-      d->updateTime       = COMPILE_DOS_TIME;
-      d->updateDate       = COMPILE_DOS_DATE;
-      d->startCluster     = startCluster & 0xFFFF;
-      d->size             = (inf->content ? inf->size : UF2_BYTE_COUNT);
-    }
-  }
-  else if ( block_no < BPB_TOTAL_SECTORS ) {
-    // Request was to read from the data area (files, unused space, ...)
-    sectionRelativeSector -= FS_START_CLUSTERS_SECTOR;
-
-    // plus 2 for first data cluster offset
-    uint32_t fid = info_index_of(2 + sectionRelativeSector / BPB_SECTORS_PER_CLUSTER);
-    FileContent_t const * inf = &info[fid];
-
-    uint32_t fileRelativeSector = sectionRelativeSector - (info[fid].cluster_start-2) * BPB_SECTORS_PER_CLUSTER;
-
-    if ( fid != FID_UF2 ) {
-      // Handle all files other than CURRENT.UF2
-      size_t fileContentStartOffset = fileRelativeSector * BPB_SECTOR_SIZE;
-      size_t fileContentLength = inf->size;
-
-      // nothing to copy if already past the end of the file (only when >1 sector per cluster)
-      if (fileContentLength > fileContentStartOffset) {
-        // obviously, 2nd and later sectors should not copy data from the start
-        const void * dataStart = (inf->content) + fileContentStartOffset;
-        // limit number of bytes of data to be copied to remaining valid bytes
-        size_t bytesToCopy = fileContentLength - fileContentStartOffset;
-        // and further limit that to a single sector at a time
-        if (bytesToCopy > BPB_SECTOR_SIZE) {
-          bytesToCopy = BPB_SECTOR_SIZE;
-        }
-        memcpy(data, dataStart, bytesToCopy);
-      }
-    }
-    else {
-      // CURRENT.UF2: generate data on-the-fly
-      uint32_t addr = BOARD_FLASH_APP_START + (fileRelativeSector * UF2_FIRMWARE_BYTES_PER_SECTOR);
-      if ( addr < (BOARD_FLASH_ADDR_ZERO + _flash_size) ) {
-        UF2_Block *bl = (void*) data;
-        bl->magicStart0 = UF2_MAGIC_START0;
-        bl->magicStart1 = UF2_MAGIC_START1;
-        bl->magicEnd = UF2_MAGIC_END;
-        bl->blockNo = fileRelativeSector;
-        bl->numBlocks = UF2_SECTOR_COUNT;
-        bl->targetAddr = addr;
-        bl->payloadSize = UF2_FIRMWARE_BYTES_PER_SECTOR;
-        bl->flags = UF2_FLAG_FAMILYID;
-        bl->familyID = BOARD_UF2_FAMILY_ID;
-
-        board_flash_read(addr, bl->data, bl->payloadSize);
-      }
-    }
-  }
+#endif
+
+#if TINYUF2_RESUME
+#if TINYUF2_STATIC_LAYOUT
+#define _info_resume_pos  ((size_t) (_info_uf2.resume - infoUf2File))
+#else
+static size_t _info_resume_pos = 0;
+#endif
+
+static uint32_t resume_check(board_resume_log_t const* log) {
+  return ~(log->magic ^ log->image_id[0] ^ log->image_id[1] ^ log->num_blocks ^ log->done ^ log->addr);
 }
 
-/*------------------------------------------------------------------*/
-/* Write UF2
- *------------------------------------------------------------------*/
+static bool resume_valid(board_resume_log_t const* log) {
+  return log->magic == RESUME_LOG_MAGIC && log->check == resume_check(log);
+}
 
-/**
- * Write an uf2 block wrapped by 512 sector.
- * @return number of bytes processed, only 3 following values
- *  -1 : if not an uf2 block
- * 512 : write is successful (BPB_SECTOR_SIZE == 512)
- *   0 : is busy with flashing, tinyusb stack will call write_block again with the same parameters later on
- */
-int uf2_write_block (uint32_t block_no, uint8_t *data, WriteState *state) {
-  (void) block_no;
-  UF2_Block *bl = (void*) data;
+// Resume line of INFO_UF2.TXT from the journal of an interrupted write, left at zero otherwise
+static void resume_render(void) {
+  board_resume_log_t const* log = TINYUF2_RESUME_PTR;
+  if ( !_info_resume_pos || !resume_valid(log) || !log->done ) return;
+
+  // u32_to_hexstr() appends a null terminator, restore the following character
+  char* str = infoUf2File + _info_resume_pos;
+  char const last = str[INFO_RESUME_TOTAL + 8];
+  u32_to_hexstr(log->image_id[0], str + INFO_RESUME_IMAGE);
+  u32_to_hexstr(log->image_id[1], str + INFO_RESUME_IMAGE + 8);
+  str[INFO_RESUME_IMAGE + 16] = ',';
+  u32_to_hexstr(log->done, str + INFO_RESUME_BLOCK);
+  str[INFO_RESUME_BLOCK + 8] = ' ';
+  u32_to_hexstr(log->num_blocks, str + INFO_RESUME_TOTAL);
+  str[INFO_RESUME_TOTAL + 8] = last;
+}
+#endif
 
-  if ( !is_uf2_block(bl) ) return -1;
+#if TINYUF2_STATS || TINYUF2_WEAR_LOG
+uint32_t uf2_stats_now(void) {
+  return board_cycle_count ? board_cycle_count() : 0;
+}
+#endif
 
-  if (bl->familyID == BOARD_UF2_FAMILY_ID) {
-    // generic family ID
-    board_flash_write(bl->targetAddr, bl->data, bl->payloadSize);
-  }else {
-    // TODO family matches VID/PID
-    return -1;
+#if TINYUF2_STATS
+static struct {
+  uint32_t blocks;          // uf2 blocks processed
+  uint32_t bytes;           // payload bytes written to flash
+  uint32_t skipped;         // blocks not written since flash already matches
+  uint32_t retries;         // blocks sent again by host
+  uint32_t erase_count;
+  uint32_t erase_cycles;    // reported by port, part of write_cycles
+  uint32_t write_cycles;    // spent in flash write backends
+  uint32_t usb_wait_cycles; // between WRITE10 callbacks, i.e waiting for host/bus
+  uint32_t block_min;
+  uint32_t block_max;
+  uint32_t block_total;
+  uint32_t block_last;      // end of previous block
+  uint32_t elapsed_cycles;  // from start of first block to end of last one
+  uint32_t verify_cycles;   // signature check of TINYUF2_SIGNED_UF2, hashing from flash included
+  uint32_t flash_timeouts;  // operations overrunning their deadline (TINYUF2_FLASH_TIMEOUT)
+  uint32_t flash_failed;    // given up after retries
+  uint32_t mount[UF2_MOUNT_COUNT]; // UF2_MOUNT_BOOT timestamp, then cycles since boot of each phase
+  uint32_t mount_seen;      // bit per phase already recorded
+} _stats;
+
+void uf2_stats_mount(uint32_t phase) {
+  if ( _stats.mount_seen & (1UL << phase) ) return;
+  _stats.mount_seen |= 1UL << phase;
+
+  uint32_t const now = uf2_stats_now();
+  _stats.mount[phase] = (phase == UF2_MOUNT_BOOT) ? now : (now - _stats.mount[UF2_MOUNT_BOOT]);
+}
+
+void uf2_stats_erase(uint32_t cycles) {
+  _stats.erase_count++;
+  _stats.erase_cycles += cycles;
+}
+
+void uf2_stats_usb_wait(uint32_t cycles) {
+  _stats.usb_wait_cycles += cycles;
+}
+
+void uf2_stats_verify(uint32_t cycles) {
+  _stats.verify_cycles = cycles;
+}
+
+static void stats_block(uint32_t start, uint32_t end) {
+  uint32_t const cycles = end - start;
+
+  if ( !_stats.blocks || cycles < _stats.block_min ) _stats.block_min = cycles;
+  if ( cycles > _stats.block_max ) _stats.block_max = cycles;
+  _stats.block_total += cycles;
+
+  // accumulated per block so that the counter wrapping during a long transfer does not matter
+  _stats.elapsed_cycles += _stats.blocks ? (end - _stats.block_last) : cycles;
+  _stats.block_last = end;
+  _stats.blocks++;
+}
+
+// payload throughput of the transfer, 0 if cycle frequency is unknown
+static uint32_t stats_throughput_kbps(void) {
+  if ( !board_cycle_freq || !_stats.elapsed_cycles ) return 0;
+  return (uint32_t) (((uint64_t) _stats.bytes * board_cycle_freq()) / _stats.elapsed_cycles / 1024);
+}
+
+// Render all counters, text has fixed length since values are fixed width hex
+static uint32_t stats_render(void) {
+  struct { char const* label; uint32_t value; } const lines[] = {
+    { "Blocks: 0x"          , _stats.blocks },
+    { "Bytes written: 0x"   , _stats.bytes },
+    { "Skipped: 0x"         , _stats.skipped },
+    { "Retries: 0x"         , _stats.retries },
+    { "Erase count: 0x"     , _stats.erase_count },
+    { "Erase cycles: 0x"    , _stats.erase_cycles },
+    { "Write cycles: 0x"    , _stats.write_cycles },
+    { "USB wait cycles: 0x" , _stats.usb_wait_cycles },
+    { "Block min cycles: 0x", _stats.block_min },
+    { "Block avg cycles: 0x", _stats.blocks ? (_stats.block_total / _stats.blocks) : 0 },
+    { "Block max cycles: 0x", _stats.block_max },
+    { "Elapsed cycles: 0x"  , _stats.elapsed_cycles },
+    { "Throughput KB/s: 0x" , stats_throughput_kbps() },
+#if TINYUF2_SIGNED_UF2
+    { "Verify cycles: 0x"   , _stats.verify_cycles },
+#endif
+#if TINYUF2_FLASH_TIMEOUT
+    { "Flash timeouts: 0x"  , _stats.flash_timeouts },
+    { "Flash failed: 0x"    , _stats.flash_failed },
+#endif
+    { "Mount configured cycles: 0x", _stats.mount[UF2_MOUNT_CONFIGURED] },
+    { "Mount capacity cycles: 0x"  , _stats.mount[UF2_MOUNT_CAPACITY] },
+    { "Mount root dir cycles: 0x"  , _stats.mount[UF2_MOUNT_ROOT_DIR] },
+  };
+
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < UF2_ARRAY_SIZE(lines); i++) {
+    size_t const label_len = strlen(lines[i].label);
+    if (len + label_len + 8 + 2 >= sizeof(statsFile)) break;
+
+    memcpy(statsFile + len, lines[i].label, label_len);
+    len += label_len;
+    u32_to_hexstr(lines[i].value, statsFile + len);
+    len += 8;
+    memcpy(statsFile + len, "\r\n", 2);
+    len += 2;
   }
 
-  //------------- Update written blocks -------------//
-  if ( bl->numBlocks ) {
-    // Update state num blocks if needed
-    if ( state->numBlocks != bl->numBlocks ) {
-      if ( bl->numBlocks >= MAX_BLOCKS || state->numBlocks ) {
-        state->numBlocks = 0xffffffff;
-      }
-      else {
-        state->numBlocks = bl->numBlocks;
-      }
-    }
+  return len;
+}
 
-    if ( bl->blockNo < MAX_BLOCKS ) {
-      uint8_t const mask = 1 << (bl->blockNo % 8);
-      uint32_t const pos = bl->blockNo / 8;
+uint32_t uf2_stats_text(char const** text) {
+  *text = statsFile;
+  return stats_render();
+}
+#endif
 
-      // only increase written number with new write (possibly prevent overwriting from OS)
-      if ( !(state->writtenMask[pos] & mask) ) {
-        state->writtenMask[pos] |= mask;
-        state->numWritten++;
-      }
+#if TINYUF2_WEAR_LOG
+static void wear_init(void) {
+  board_wear_log_t* log = TINYUF2_WEAR_LOG_PTR;
 
-      // flush last blocks
-      // TODO numWritten can be smaller than numBlocks if return early
-      if ( state->numWritten >= state->numBlocks ) {
-        board_flash_flush();
-      }
-    }
+  if ( log->magic != WEAR_LOG_MAGIC ) {
+    memset(log, 0, sizeof(board_wear_log_t));
+    log->magic = WEAR_LOG_MAGIC;
   }
+  log->sessions++;
+}
+
+void uf2_wear_erase(uint32_t unit, uint32_t cycles) {
+  board_wear_log_t* log = TINYUF2_WEAR_LOG_PTR;
+  if ( unit >= TINYUF2_WEAR_UNITS ) return;
+
+  log->unit[unit].count++;
+  log->unit[unit].cycles = cycles;
+}
+
+// u32_to_hexstr() appends a null terminator, text is rendered in order so it is overwritten by the next part
+static void wear_render(void) {
+  board_wear_log_t const* log = TINYUF2_WEAR_LOG_PTR;
+  char* str = wearFile;
+
+  memcpy(str, WEAR_HEADER, sizeof(WEAR_HEADER) - 1);
+  u32_to_hexstr(log->sessions, str + 12);
+  str[20] = '\r';
+  str += sizeof(WEAR_HEADER) - 1;
+
+  for (uint32_t i = 0; i < TINYUF2_WEAR_UNITS; i++) {
+    memcpy(str, WEAR_LINE, WEAR_LINE_LEN);
+    u32_to_hexstr(i, str + 7);
+    str[15] = ':';
+    u32_to_hexstr(log->unit[i].count, str + 19);
+    str[27] = ' ';
+    u32_to_hexstr(log->unit[i].cycles, str + 38);
+    str[46] = ' ';
+    str += WEAR_LINE_LEN;
+  }
+}
+#endif
 
-  return BPB_SECTOR_SIZE;
+#if TINYUF2_EVENT_LOG
+STATIC_ASSERT((TINYUF2_EVENT_COUNT & (TINYUF2_EVENT_COUNT - 1)) == 0);
+
+void uf2_event_init(void) {
+  board_event_log_t* log = TINYUF2_EVENT_LOG_PTR;
+
+  if ( log->magic != EVENT_LOG_MAGIC ) {
+    memset(log, 0, sizeof(board_event_log_t));
+    log->magic = EVENT_LOG_MAGIC;
+  }
+  log->boots++;
+  uf2_event(UF2_EVENT_BOOT, log->boots);
+}
+
+// padded to EVENTS_NAME_LEN with spaces when rendered
+static char const event_names[UF2_EVENT_COUNT][EVENTS_NAME_LEN + 1] = {
+  [UF2_EVENT_NONE         ] = "-",
+  [UF2_EVENT_BOOT         ] = "BOOT",
+  [UF2_EVENT_DBL_TAP      ] = "DBL_TAP",
+  [UF2_EVENT_APP_INVALID  ] = "APP_INVALID",
+  [UF2_EVENT_PROTECT      ] = "PROTECT",
+  [UF2_EVENT_APP_JUMP     ] = "APP_JUMP",
+  [UF2_EVENT_DFU          ] = "DFU",
+  [UF2_EVENT_BLOCK_INVALID] = "BLOCK_INVALID",
+  [UF2_EVENT_FAMILY       ] = "FAMILY",
+  [UF2_EVENT_WRONG_BOARD  ] = "WRONG_BOARD",
+  [UF2_EVENT_WRITE_FAIL   ] = "WRITE_FAIL",
+  [UF2_EVENT_SIGN_REJECT  ] = "SIGN_REJECT",
+  [UF2_EVENT_COMPLETE     ] = "COMPLETE",
+  [UF2_EVENT_FLASH_TIMEOUT] = "FLASH_TIMEOUT",
+  [UF2_EVENT_FLASH_FAILED ] = "FLASH_FAILED",
+  [UF2_EVENT_RESUME       ] = "RESUME",
+};
+
+// u32_to_hexstr() appends a null terminator, text is rendered in order so it is overwritten by the next part
+static void events_render(void) {
+  board_event_log_t const* log = TINYUF2_EVENT_LOG_PTR;
+  char* str = eventsFile;
+
+  memcpy(str, EVENTS_HEADER, sizeof(EVENTS_HEADER) - 1);
+  u32_to_hexstr(log->boots, str + 9);
+  str[17] = ',';
+  u32_to_hexstr(log->head, str + 29);
+  str[37] = '\r';
+  str += sizeof(EVENTS_HEADER) - 1;
+
+  // ring is only full once it wrapped, oldest entry is then the next one to be overwritten
+  uint32_t const first = (log->head > TINYUF2_EVENT_COUNT) ? log->head : 0;
+
+  for (uint32_t i = 0; i < TINYUF2_EVENT_COUNT; i++) {
+    __typeof__(log->event[0]) const* ev = &log->event[(first + i) & (TINYUF2_EVENT_COUNT - 1)];
+    char const* name = event_names[(ev->id < UF2_EVENT_COUNT) ? ev->id : UF2_EVENT_NONE];
+    size_t const name_len = strlen(name);
+
+    memcpy(str, EVENTS_LINE, EVENTS_LINE_LEN);
+    // 16-bit value: its four leading zero digits are overwritten by the label
+    u32_to_hexstr(ev->boot, str + 3);
+    memcpy(str, "Boot 0x", 7);
+    str[11] = ' ';
+    u32_to_hexstr(ev->time, str + 17);
+    str[25] = ':';
+    memset(str + 27, ' ', EVENTS_NAME_LEN);
+    memcpy(str + 27, name, name_len);
+    u32_to_hexstr(ev->arg, str + 43);
+    str[51] = '\r';
+    str += EVENTS_LINE_LEN;
+  }
 }
+#endif
+
+#if TINYUF2_VERIFY_UF2
+enum {
+  VERIFY_NONE = 0,
+  VERIFY_RUNNING,
+  VERIFY_PASS,
+  VERIFY_FAIL,
+};
+
+static struct {
+  uint8_t result;
+  uint32_t blocks;          // distinct blocks received
+  uint32_t total;           // numBlocks of the file
+  uint32_t mismatched;      // payloads differing from flash
+  uint32_t unchecked;       // other family or outside flash, nothing to compare with
+  uint32_t first_mismatch;  // address of first differing payload
+} _verify;
+
+static void verify_render(void) {
+  static char const result_names[][8] = { "NONE    ", "RUNNING ", "PASS    ", "FAIL    " };
+  char* str = verifyFile;
+
+  // u32_to_hexstr() null terminator overwrites the following character, restored after each value
+  memcpy(str, VERIFY_TEXT, sizeof(verifyFile));
+  memcpy(str + 8, result_names[_verify.result], 8);
+  u32_to_hexstr(_verify.blocks, str + 28);
+  str[36] = ' ';
+  u32_to_hexstr(_verify.total, str + 42);
+  str[50] = '\r';
+  u32_to_hexstr(_verify.mismatched, str + 66);
+  str[74] = '\r';
+  u32_to_hexstr(_verify.unchecked, str + 89);
+  str[97] = '\r';
+  u32_to_hexstr(_verify.first_mismatch, str + 117);
+  str[125] = '\r';
+}
+#endif
+
+#if TINYUF2_CURRENT_CRC || TINYUF2_APP_FOOTER || TINYUF2_CDC_FLASH || TINYUF2_SERVICE_TABLE || TINYUF2_STAGED_UPDATE || \
+    TINYUF2_SECTORS_CRC
+// CRC32 (IEEE 802.3, reflected), nibble-wise to keep the bootloader small
+static uint32_t crc32_update(uint32_t crc, uint8_t const *data, uint32_t len) {
+  static uint32_t const table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+// CRC32 of flash contents, with hash/CRC peripheral if the board has one
+static uint32_t flash_crc32(uint32_t addr, uint32_t len) {
+  uint8_t buf[256] __attribute__((aligned(4)));
+  bool const hw = board_hash_init && board_hash_update && board_hash_final;
+  uint32_t crc = 0;
+
+  if (hw) board_hash_init();
+
+  for (uint32_t offset = 0; offset < len; offset += sizeof(buf)) {
+    uint32_t const count = (len - offset < sizeof(buf)) ? (len - offset) : sizeof(buf);
+    board_flash_read(addr + offset, buf, count);
+
+    if (hw) {
+      // peripheral takes whole words only, any remaining bytes (last chunk) continue in software
+      uint32_t const words = count & ~3UL;
+      board_hash_update(buf, words);
+      if (words != count) crc = crc32_update(board_hash_final(), buf + words, count - words);
+    } else {
+      crc = crc32_update(crc, buf, count);
+    }
+  }
+
+  return (hw && !(len & 3)) ? board_hash_final() : crc;
+}
+
+uint32_t uf2_flash_crc32(uint32_t addr, uint32_t len) {
+  return flash_crc32(addr, len);
+}
+#endif
+
+board_flash_info_t const* uf2_flash_info(void) {
+  if (board_flash_info) return board_flash_info();
+
+  // uniform erase units, filled in on first use since flash size is only known at runtime
+  static flash_region_t _flash_region;
+  static board_flash_info_t _flash_info = {
+    .geometry     = { .base = BOARD_FLASH_ADDR_ZERO, .regions = &_flash_region, .region_count = 1 },
+    .erased_word  = 0xFFFFFFFFUL,
+    .program_size = 4,
+  };
+
+  if (!_flash_region.size) {
+    _flash_region.size = BOARD_FLASH_ERASE_SIZE;
+    _flash_region.count = board_flash_size() / BOARD_FLASH_ERASE_SIZE;
+  }
+
+  return &_flash_info;
+}
+
+uint32_t uf2_flash_deadline_ms(uint32_t typical_us) {
+  if ( !TINYUF2_FLASH_TIMEOUT || !typical_us ) return UINT32_MAX;
+
+  // tick may advance right after the operation started, hence 1ms more
+  uint64_t const ms = ((uint64_t) typical_us * TINYUF2_FLASH_TIMEOUT + 999) / 1000 + 1;
+  return (ms < UINT32_MAX) ? (uint32_t) ms : (UINT32_MAX - 1);
+}
+
+uint32_t uf2_flash_erase_deadline_ms(uint32_t len) {
+  board_flash_info_t const* flash = uf2_flash_info();
+
+  // larger units take about proportionally longer than the smallest one erase_us is given for
+  uint32_t unit = UINT32_MAX;
+  for ( uint32_t i = 0; i < flash->geometry.region_count; i++ ) {
+    if ( flash->geometry.regions[i].size < unit ) unit = flash->geometry.regions[i].size;
+  }
+  if ( !unit || unit == UINT32_MAX ) return UINT32_MAX;
+
+  uint64_t const us = (uint64_t) flash->erase_us * ((len + unit - 1) / unit);
+  return uf2_flash_deadline_ms((us < UINT32_MAX) ? (uint32_t) us : UINT32_MAX);
+}
+
+uint32_t uf2_flash_program_deadline_ms(uint32_t len) {
+  uint64_t const us = (uint64_t) uf2_flash_info()->program_us * ((len + 255) / 256);
+  return uf2_flash_deadline_ms((us < UINT32_MAX) ? (uint32_t) us : UINT32_MAX);
+}
+
+uint32_t uf2_flash_backoff_ms(uint32_t attempt) {
+  // 2, 4, 8 ... ms, capped
+  return 1UL << ((attempt < 10) ? attempt : 10);
+}
+
+void uf2_flash_timeout(uint32_t addr, bool failed) {
+  TUF2_LOG1("Flash %s at %08lX\r\n", failed ? "failed" : "timeout", addr);
+  uf2_event(failed ? UF2_EVENT_FLASH_FAILED : UF2_EVENT_FLASH_TIMEOUT, addr);
+#if TINYUF2_STATS
+  if ( failed ) {
+    _stats.flash_failed++;
+  } else {
+    _stats.flash_timeouts++;
+  }
+#endif
+}
+
+#if TINYUF2_IDLE_HASH
+static struct {
+  uint32_t addr;  // next address of the CURRENT.CRC run
+  uint32_t crc;   // running value up to addr
+  bool     dirty; // flash written since the last flush, data may still be in port caches
+} _idle_hash;
+
+// Flash is being changed, background run starts over once it is flushed
+static void idle_hash_invalidate(void) {
+  _idle_hash.addr = BOARD_FLASH_APP_START;
+  _idle_hash.crc = 0;
+  _idle_hash.dirty = true;
+}
+#endif
+
+#if TINYUF2_CURRENT_CRC
+static struct {
+  uint32_t crc;       // published value, valid only when 'valid' is set
+  uint32_t len;
+  bool     valid;
+
+  uint32_t run_crc;   // running value over the sequential uf2 payload being written
+  uint32_t run_addr;  // next expected target address
+  bool     run_ok;
+} _current_crc;
+
+static void current_crc_publish(uint32_t crc, uint32_t len) {
+  _current_crc.crc = crc;
+  _current_crc.len = len;
+  _current_crc.valid = true;
+
+  // u32_to_hexstr() appends a null terminator, restore the following character
+  u32_to_hexstr(crc, currentCrcFile + CURRENT_CRC_VALUE);
+  currentCrcFile[CURRENT_CRC_VALUE + 8] = '\r';
+  u32_to_hexstr(len, currentCrcFile + CURRENT_CRC_LENGTH);
+  currentCrcFile[CURRENT_CRC_LENGTH + 8] = '\r';
+}
+
+// Compute over the whole application region, only when not already known from flashing
+static void current_crc_refresh(void) {
+  if (_current_crc.valid) return;
+
+  uint32_t const len = _uf2_end - BOARD_FLASH_APP_START;
+  current_crc_publish(flash_crc32(BOARD_FLASH_APP_START, len), len);
+}
+
+// Track payload of the generic family, the running value is only usable if the image was
+// written in order starting at application start (no gap, rewrite or reordered block)
+static void current_crc_track(uint32_t addr, uint8_t const *data, uint32_t len) {
+  // flash is being changed, published value is stale
+  _current_crc.valid = false;
+#if TINYUF2_IDLE_HASH
+  idle_hash_invalidate();
+#endif
+
+  if (_current_crc.run_ok && addr == _current_crc.run_addr) {
+    _current_crc.run_crc = crc32_update(_current_crc.run_crc, data, len);
+    _current_crc.run_addr += len;
+  } else {
+    _current_crc.run_ok = false;
+  }
+}
+
+static void current_crc_complete(void) {
+  if (_current_crc.run_ok) {
+    current_crc_publish(_current_crc.run_crc, _current_crc.run_addr - BOARD_FLASH_APP_START);
+  }
+}
+#endif
+
+#if TINYUF2_SECTORS_CRC
+// Units are listed up to the end of flash rather than the image, so that a larger image can be compared
+static struct {
+  uint32_t first; // flash sector index of the unit holding application start
+  uint32_t count; // units listed
+  uint32_t valid[UF2_DIV_CEIL(TINYUF2_SECTORS_CRC, 32)]; // bit set when the line holds the unit's CRC
+} _sectors_crc;
+
+static void sectors_crc_init(void) {
+  flash_geometry_t const* geo = &uf2_flash_info()->geometry;
+  uint32_t const end = BOARD_FLASH_ADDR_ZERO + _flash_size;
+  flash_sector_t unit;
+
+  memset(&_sectors_crc, 0, sizeof(_sectors_crc));
+  for (uint32_t i = 0; i < TINYUF2_SECTORS_CRC; i++) {
+    memcpy(sectorsCrcFile + i * SECTORS_LINE_LEN, SECTORS_LINE, SECTORS_LINE_LEN);
+  }
+
+  if (!flash_sector_find(geo, BOARD_FLASH_APP_START, &unit)) return;
+  _sectors_crc.first = unit.index;
+
+  uint32_t addr = BOARD_FLASH_APP_START;
+  while (addr < end && _sectors_crc.count < TINYUF2_SECTORS_CRC && flash_sector_find(geo, addr, &unit)) {
+    addr = unit.addr + unit.size;
+    _sectors_crc.count++;
+  }
+}
+
+// Render lines overlapping len bytes of the file from offset, CRC of a unit is only computed (with the
+// hash peripheral if any) when not known since its last write
+static void sectors_crc_render(uint32_t offset, uint32_t len) {
+  flash_geometry_t const* geo = &uf2_flash_info()->geometry;
+  uint32_t const first = offset / SECTORS_LINE_LEN;
+  uint32_t const last = (offset + len - 1) / SECTORS_LINE_LEN;
+  uint32_t addr = BOARD_FLASH_APP_START;
+  flash_sector_t unit;
+
+  for (uint32_t i = 0; i < _sectors_crc.count && i <= last && flash_sector_find(geo, addr, &unit); i++) {
+    uint32_t const next = unit.addr + unit.size;
+    uint32_t const bit = 1UL << (i % 32);
+
+    if (i >= first && !(_sectors_crc.valid[i / 32] & bit)) {
+      // u32_to_hexstr() appends a null terminator, restore the following character
+      char* str = sectorsCrcFile + i * SECTORS_LINE_LEN;
+      u32_to_hexstr(addr, str + 2);
+      str[10] = ' ';
+      u32_to_hexstr(next - addr, str + 13);
+      str[21] = ' ';
+      u32_to_hexstr(flash_crc32(addr, next - addr), str + 24);
+      str[32] = '\r';
+      _sectors_crc.valid[i / 32] |= bit;
+    }
+
+    addr = next;
+  }
+}
+
+// Flash is being changed, CRC of the units overlapping the range is stale
+static void sectors_crc_invalidate(uint32_t addr, uint32_t len) {
+  flash_geometry_t const* geo = &uf2_flash_info()->geometry;
+  uint32_t const end = addr + len;
+  flash_sector_t unit;
+
+#if BOARD_FLASH_APP_START > 0
+  if (addr < BOARD_FLASH_APP_START) addr = BOARD_FLASH_APP_START;
+#endif
+#if TINYUF2_IDLE_HASH
+  idle_hash_invalidate();
+#endif
+
+  while (addr < end && flash_sector_find(geo, addr, &unit)) {
+    uint32_t const i = unit.index - _sectors_crc.first;
+    if (i >= _sectors_crc.count) break;
+
+    _sectors_crc.valid[i / 32] &= ~(1UL << (i % 32));
+    addr = unit.addr + unit.size;
+  }
+}
+#endif
+
+#if TINYUF2_IDLE_HASH
+bool uf2_hash_task(void) {
+  if (_idle_hash.dirty) return false;
+
+#if TINYUF2_SECTORS_CRC
+  // one unit at a time, with the hash peripheral if any
+  for (uint32_t i = 0; i < _sectors_crc.count; i++) {
+    if (!(_sectors_crc.valid[i / 32] & (1UL << (i % 32)))) {
+      sectors_crc_render(i * SECTORS_LINE_LEN, SECTORS_LINE_LEN);
+      return true;
+    }
+  }
+#endif
+
+#if TINYUF2_CURRENT_CRC
+  if (!_current_crc.valid) {
+    // resumable run in software, the peripheral can not continue from a given value
+    uint32_t const end = _uf2_end;
+    uint32_t const step_end = (end - _idle_hash.addr > TINYUF2_IDLE_HASH_STEP) ? (_idle_hash.addr + TINYUF2_IDLE_HASH_STEP) : end;
+    uint8_t buf[256] __attribute__((aligned(4)));
+
+    while (_idle_hash.addr < step_end) {
+      uint32_t const count = (step_end - _idle_hash.addr < sizeof(buf)) ? (step_end - _idle_hash.addr) : sizeof(buf);
+      board_flash_read(_idle_hash.addr, buf, count);
+      _idle_hash.crc = crc32_update(_idle_hash.crc, buf, count);
+      _idle_hash.addr += count;
+    }
+
+    if (_idle_hash.addr < end) return true;
+    current_crc_publish(_idle_hash.crc, end - BOARD_FLASH_APP_START);
+  }
+#endif
+
+  return false;
+}
+#endif
+
+#if TINYUF2_APP_FOOTER
+static struct {
+  uint32_t end;         // end of image written in this session
+  bool     invalidated; // footer erased by first flash write after last completion
+  bool     pending;     // footer to be written on completion, flash changed since
+} _app_footer;
+
+static void app_footer_make(UF2_AppFooter* footer, uint32_t len, uint32_t crc) {
+  footer->magic = UF2_APP_FOOTER_MAGIC;
+  footer->length = len;
+  footer->crc32 = crc;
+  footer->check = ~(footer->magic ^ footer->length ^ footer->crc32);
+}
+
+bool uf2_app_footer_valid(bool verify_image) {
+  uint32_t const footer_addr = BOARD_APP_FOOTER_ADDR;
+  UF2_AppFooter footer;
+  board_flash_read(footer_addr, &footer, sizeof(footer));
+
+  if (footer.magic != UF2_APP_FOOTER_MAGIC) return false;
+  if (footer.check != ~(footer.magic ^ footer.length ^ footer.crc32)) return false;
+  if (footer.length == 0 || footer.length > footer_addr - BOARD_FLASH_APP_START) return false;
+
+  return !verify_image || (flash_crc32(BOARD_FLASH_APP_START, footer.length) == footer.crc32);
+}
+
+// Old footer must not survive an interrupted flashing: erase it before changing flash
+static void app_footer_invalidate(void) {
+  _app_footer.pending = true;
+  if (_app_footer.invalidated) return;
+  _app_footer.invalidated = true;
+
+  uint32_t erased[sizeof(UF2_AppFooter) / 4];
+  memset(erased, 0xff, sizeof(erased));
+  board_flash_write(BOARD_APP_FOOTER_ADDR, erased, sizeof(erased));
+#if TINYUF2_SECTORS_CRC
+  sectors_crc_invalidate(BOARD_APP_FOOTER_ADDR, sizeof(erased));
+#endif
+}
+
+static void app_footer_track(uint32_t addr, uint32_t len) {
+  uint32_t const end = addr + len;
+  if (end > _app_footer.end) _app_footer.end = end;
+}
+
+// Called once all blocks are flushed to flash, also for every block rewritten afterwards
+static void app_footer_complete(void) {
+  if (_app_footer.end <= BOARD_FLASH_APP_START) return;
+  if (!_app_footer.pending) return;
+
+  _app_footer.pending = false;
+  _app_footer.invalidated = false;
+
+  uint32_t const len = _app_footer.end - BOARD_FLASH_APP_START;
+  UF2_AppFooter footer, current;
+  app_footer_make(&footer, len, flash_crc32(BOARD_FLASH_APP_START, len));
+
+  // nothing programmed (delta flash) and footer still matches
+  board_flash_read(BOARD_APP_FOOTER_ADDR, &current, sizeof(current));
+  if (memcmp(&footer, &current, sizeof(footer)) == 0) return;
+
+  board_flash_write(BOARD_APP_FOOTER_ADDR, &footer, sizeof(footer));
+  board_flash_flush();
+#if TINYUF2_SECTORS_CRC
+  sectors_crc_invalidate(BOARD_APP_FOOTER_ADDR, sizeof(footer));
+#endif
+  TUF2_LOG1("App footer: length %lu, crc32 0x%08lX\r\n", footer.length, footer.crc32);
+}
+#endif
+
+#if TINYUF2_SIGNED_UF2
+// Image failed signature check: erase it so that bootloader stays in DFU mode. CURRENT.CRC and
+// footer no longer describe flash contents
+static void sign_reject(void) {
+  uf2_event(UF2_EVENT_SIGN_REJECT, 0);
+  board_flash_erase_app();
+#if TINYUF2_IDLE_HASH
+  idle_hash_invalidate();
+#endif
+#if TINYUF2_CURRENT_CRC
+  _current_crc.valid = false;
+  _current_crc.run_ok = false;
+#endif
+#if TINYUF2_SECTORS_CRC
+  memset(_sectors_crc.valid, 0, sizeof(_sectors_crc.valid));
+#endif
+#if TINYUF2_APP_FOOTER
+  _app_footer.pending = false;
+#endif
+}
+#endif
+
+#if TINYUF2_PART_FILES
+// Raw files from board_part_file(), taken in order while they fit into the clusters left by the other
+// files, CURRENT.UF2 (and CURRENT.BIN) of the whole flash and an uploaded uf2 of 256-byte payloads
+static void part_files_init(void) {
+  uint32_t used = NUM_FILES + UF2_DIV_CEIL(UF2_DIV_CEIL(_flash_size, 256) * UF2_BLOCK_SIZE, BPB_BYTES_PER_CLUSTER) +
+                  UF2_DIV_CEIL(UF2_DIV_CEIL(_flash_size, UF2_FIRMWARE_BYTES_PER_SECTOR) * UF2_BLOCK_SIZE, BPB_BYTES_PER_CLUSTER) +
+                  TINYUF2_CURRENT_BIN * UF2_DIV_CEIL(_flash_size, BPB_BYTES_PER_CLUSTER);
+  for (uint32_t i = 0; i < FID_UF2 - TINYUF2_CURRENT_BIN; i++) {
+    if (i < PART_FILE_FIRST || i >= PART_FILE_FIRST + TINYUF2_PART_FILES) {
+      used += UF2_DIV_CEIL(info[i].size, BPB_BYTES_PER_CLUSTER);
+    }
+  }
+
+  for (uint32_t i = 0; i < TINYUF2_PART_FILES; i++) {
+    FileContent_t* inf = &info[PART_FILE_FIRST + i];
+    memset(inf->name, ' ', sizeof(inf->name));
+    inf->size = 0;
+    inf->content = board_part_file ? board_part_file(i, inf->name, &inf->size) : NULL;
+
+    uint32_t const clusters = UF2_DIV_CEIL(inf->size, BPB_BYTES_PER_CLUSTER);
+    if ( inf->content && used + clusters > LAYOUT_CLUSTER_COUNT ) {
+      TUF2_LOG1("GhostFAT: %.11s does not fit\r\n", inf->name);
+      inf->content = NULL;
+    }
+
+    if ( inf->content ) {
+      used += clusters;
+    } else {
+      inf->name[0] = 0;
+      inf->size = 0;
+    }
+  }
+}
+#endif
+
+#if TINYUF2_AUTO_GEOMETRY
+// free space left for host metadata (e.g .fseventsd) and text files rendered after the layout is set
+#define GEOMETRY_SLACK_BYTES  (64*1024)
+
+// Smallest layout for the flash size: static files, CURRENT.UF2 (and CURRENT.BIN) covering the whole
+// flash and free space for an uploaded uf2 of 256-byte payloads. Never below the cluster count margin
+// of the FAT type, the configured layout is kept if it is not larger
+static void geometry_init(void) {
+  uint32_t clusters = FAT_ROOT_DIR_CLUSTERS + UF2_DIV_CEIL(GEOMETRY_SLACK_BYTES, BPB_BYTES_PER_CLUSTER);
+  for (uint32_t i = 0; i < FID_UF2 - TINYUF2_CURRENT_BIN; i++) {
+    clusters += UF2_DIV_CEIL(info[i].size, BPB_BYTES_PER_CLUSTER);
+  }
+#if TINYUF2_CURRENT_BIN
+  clusters += UF2_DIV_CEIL(_flash_size, BPB_BYTES_PER_CLUSTER);
+#endif
+  clusters += UF2_DIV_CEIL(UF2_DIV_CEIL(_flash_size, UF2_FIRMWARE_BYTES_PER_SECTOR) * UF2_BLOCK_SIZE, BPB_BYTES_PER_CLUSTER);
+  clusters += UF2_DIV_CEIL(UF2_DIV_CEIL(_flash_size, 256) * UF2_BLOCK_SIZE, BPB_BYTES_PER_CLUSTER);
+  if (clusters < LAYOUT_MIN_CLUSTERS) clusters = LAYOUT_MIN_CLUSTERS;
+
+  // FAT covers reserved clusters 0 and 1, data region is a whole number of clusters
+  uint32_t const sectors_per_fat = UF2_DIV_CEIL(clusters + 2, FAT_ENTRIES_PER_SECTOR);
+  uint32_t const total_sectors = BPB_RESERVED_SECTORS + BPB_NUMBER_OF_FATS * sectors_per_fat + ROOT_DIR_SECTOR_COUNT +
+                                 clusters * BPB_SECTORS_PER_CLUSTER;
+
+  if (total_sectors < UF2_NUM_SECTORS) {
+    _total_sectors   = total_sectors;
+    _sectors_per_fat = sectors_per_fat;
+  } else {
+    _total_sectors   = UF2_NUM_SECTORS;
+    _sectors_per_fat = LAYOUT_SECTORS_PER_FAT;
+  }
+
+  TUF2_LOG1("GhostFAT: %lu sectors, %lu clusters\r\n", _total_sectors, CLUSTER_COUNT);
+}
+#endif
+
+uint32_t uf2_num_sectors(void) {
+  return BPB_TOTAL_SECTORS;
+}
+
+#if TINYUF2_CURRENT_UF2_EXTENT
+// Find end of programmed flash by scanning backward for the last non-erased byte
+static uint32_t app_extent_scan(void) {
+  uint8_t buf[64] __attribute__((aligned(4)));
+  uint32_t end = BOARD_FLASH_ADDR_ZERO + _flash_size;
+
+  // erased value is not 0xFF on all parts (e.g ch32), little endian byte order of the erased word
+  uint32_t const erased_word = uf2_flash_info()->erased_word;
+
+  while (end > BOARD_FLASH_APP_START) {
+    uint32_t const count = (end - BOARD_FLASH_APP_START < sizeof(buf)) ? (end - BOARD_FLASH_APP_START) : sizeof(buf);
+    uint32_t const start = end - count;
+    board_flash_read(start, buf, count);
+
+    for (uint32_t i = count; i > 0; i--) {
+      uint8_t const erased = (uint8_t) (erased_word >> (8 * ((start + i - 1) & 3)));
+      if (buf[i-1] != erased) return start + i - BOARD_FLASH_APP_START;
+    }
+    end -= count;
+  }
+
+  return 0;
+}
+
+// Application extent rounded up to 256 bytes (at least one uf2 block) and limited so that
+// all files still fit into the data region
+static uint32_t app_extent(void) {
+  uint32_t const region = BOARD_FLASH_ADDR_ZERO + _flash_size - BOARD_FLASH_APP_START;
+  uint32_t extent = board_flash_app_size ? board_flash_app_size() : 0;
+  if ( !extent ) extent = app_extent_scan();
+
+  extent = (extent + 255) & ~255UL;
+  if ( !extent ) extent = 256;
+  if ( extent > region ) extent = region;
+
+  // clusters left after static files, minus one cluster of rounding slack per flash backed file
+  uint32_t avail = CLUSTER_COUNT - 1 - TINYUF2_CURRENT_BIN;
+  for (uint32_t i = 0; i < FID_UF2; i++) {
+    avail -= UF2_DIV_CEIL(info[i].size, BPB_BYTES_PER_CLUSTER);
+  }
+
+  // each payload takes a whole sector in CURRENT.UF2 (and itself in CURRENT.BIN)
+  uint32_t const max_extent = avail * BPB_BYTES_PER_CLUSTER / (UF2_BLOCK_SIZE + TINYUF2_CURRENT_BIN * UF2_FIRMWARE_BYTES_PER_SECTOR) *
+                              UF2_FIRMWARE_BYTES_PER_SECTOR;
+  if ( extent > max_extent ) extent = max_extent & ~255UL;
+
+  return extent;
+}
+#endif
+
+static void rootdir_build(void);
+#if TINYUF2_META_CACHE
+static void meta_cache_clear(void);
+#endif
+#if TINYUF2_WRITE_OVERLAY
+static void overlay_clear(void);
+#endif
+
+// Per session tracking of the image being written
+static void write_session_init(void) {
+#if TINYUF2_APP_FOOTER
+  _app_footer.end = 0;
+  _app_footer.invalidated = false;
+  _app_footer.pending = true; // also written if nothing is programmed (delta flash)
+#endif
+
+#if TINYUF2_CURRENT_CRC
+  _current_crc.valid = false;
+  _current_crc.run_crc = 0;
+  _current_crc.run_addr = BOARD_FLASH_APP_START;
+  _current_crc.run_ok = true;
+#endif
+
+#if TINYUF2_SIGNED_UF2
+  uf2_sign_reset();
+#endif
+
+#if TINYUF2_UF2_AES
+  uf2_aes_reset();
+#endif
+}
+
+void uf2_init(void) {
+#if TINYUF2_STATIC_LAYOUT
+  if ( board_flash_size() != TINYUF2_FLASH_SIZE ) {
+    TUF2_LOG1("GhostFAT: flash size 0x%08lX does not match TINYUF2_FLASH_SIZE\r\n", board_flash_size());
+  }
+#else
+  _flash_size = board_flash_size();
+#if TINYUF2_PART_FILES
+  part_files_init();
+#endif
+#if TINYUF2_AUTO_GEOMETRY
+  geometry_init();
+#endif
+
+  // update INFO_UF2.TXT with flash size if having enough space (8 bytes)
+  size_t txt_len = strlen(infoUf2File);
+  size_t const max_len = sizeof(infoUf2File) - 1;
+  if ( max_len - txt_len > 8) {
+    u32_to_hexstr(_flash_size, infoUf2File + txt_len);
+    txt_len += 8;
+
+    if (max_len - txt_len > 6) {
+      strcpy(infoUf2File + txt_len, " bytes");
+      txt_len += 6;
+    }
+  }
+#if TINYUF2_DELTA_FLASH
+  // reserve fixed width delta statistics, updated in place as blocks are written
+  if (max_len - txt_len > strlen(INFO_DELTA_TEMPLATE)) {
+    strcpy(infoUf2File + txt_len, INFO_DELTA_TEMPLATE);
+    _info_delta_pos = txt_len;
+    txt_len += strlen(INFO_DELTA_TEMPLATE);
+  }
+#endif
+#if TINYUF2_RAW_WRITE_HINT
+  if (max_len - txt_len > strlen(INFO_RAW_WRITE_LBA INFO_RAW_WRITE_CHUNK " bytes") + 16) {
+    strcpy(infoUf2File + txt_len, INFO_RAW_WRITE_LBA);
+    txt_len += strlen(INFO_RAW_WRITE_LBA);
+    u32_to_hexstr(RAW_WRITE_LBA, infoUf2File + txt_len);
+    txt_len += 8;
+    strcpy(infoUf2File + txt_len, INFO_RAW_WRITE_CHUNK);
+    txt_len += strlen(INFO_RAW_WRITE_CHUNK);
+    u32_to_hexstr(RAW_WRITE_CHUNK, infoUf2File + txt_len);
+    txt_len += 8;
+    strcpy(infoUf2File + txt_len, " bytes");
+    txt_len += 6;
+  }
+#endif
+#if TINYUF2_RESUME
+  if (max_len - txt_len > strlen(INFO_RESUME_TEMPLATE)) {
+    strcpy(infoUf2File + txt_len, INFO_RESUME_TEMPLATE);
+    _info_resume_pos = txt_len;
+    txt_len += strlen(INFO_RESUME_TEMPLATE);
+  }
+#endif
+
+  info[FID_INFO].size = txt_len;
+
+#if TINYUF2_STATS
+  info[FID_STATS].size = stats_render();
+#endif
+
+#if TINYUF2_CURRENT_UF2_EXTENT
+  // only cover the application image, sized after the static files are final
+  _uf2_size = app_extent();
+  _uf2_end  = BOARD_FLASH_APP_START + _uf2_size;
+#else
+  _uf2_size = _flash_size;
+  _uf2_end  = BOARD_FLASH_ADDR_ZERO + _flash_size;
+#endif
+
+  // update CURRENT.UF2 file size
+  info[FID_UF2].size = UF2_BYTE_COUNT;
+
+#if TINYUF2_CURRENT_BIN
+  // CURRENT.BIN covers the same flash range as CURRENT.UF2
+  info[FID_BIN].size = _uf2_end - BOARD_FLASH_APP_START;
+#endif
+
+  init_starting_clusters();
+  init_fat_sector_classes();
+#endif
+
+#if TINYUF2_WEAR_LOG
+  wear_init();
+#endif
+
+#if TINYUF2_SECTORS_CRC
+  sectors_crc_init();
+#endif
+
+#if TINYUF2_IDLE_HASH
+  idle_hash_invalidate();
+  _idle_hash.dirty = false;
+#endif
+
+#if TINYUF2_RESUME
+  resume_render();
+#endif
+
+  rootdir_build();
+
+#if TINYUF2_META_CACHE
+  meta_cache_clear();
+#endif
+
+#if TINYUF2_WRITE_OVERLAY
+  // host written metadata refers to the previous layout
+  overlay_clear();
+#endif
+
+  write_session_init();
+}
+
+/*------------------------------------------------------------------*/
+/* Read CURRENT.UF2
+ *------------------------------------------------------------------*/
+void padded_memcpy (char *dst, char const *src, int len) {
+  for ( int i = 0; i < len; ++i ) {
+    if ( *src ) {
+      *dst = *src++;
+    } else {
+      *dst = ' ';
+    }
+    dst++;
+  }
+}
+
+static void read_boot_sector (uint8_t *data) {
+  memcpy(data, &BootBlock, sizeof(BootBlock));
+#if TINYUF2_AUTO_GEOMETRY
+  FAT_BootBlock* bb = (FAT_BootBlock*) data;
+#if CFG_UF2_FAT32
+  bb->TotalSectors32  = BPB_TOTAL_SECTORS;
+  bb->SectorsPerFAT32 = BPB_SECTORS_PER_FAT;
+#else
+  bb->TotalSectors16  = (BPB_TOTAL_SECTORS > 0xFFFF) ? 0 : BPB_TOTAL_SECTORS;
+  bb->SectorsPerFAT   = BPB_SECTORS_PER_FAT;
+  bb->TotalSectors32  = (BPB_TOTAL_SECTORS > 0xFFFF) ? BPB_TOTAL_SECTORS : 0;
+#endif
+#endif
+  data[510] = 0x55;    // Always at offsets 510/511, even when BPB_SECTOR_SIZE is larger
+  data[511] = 0xaa;    // Always at offsets 510/511, even when BPB_SECTOR_SIZE is larger
+}
+
+#if CFG_UF2_FAT32
+// FSInfo: free cluster count and next free cluster are known since all files are contiguous
+static void read_fsinfo_sector (uint8_t *data) {
+  uint32_t const used_clusters = info[FID_UF2].cluster_end - 1;
+  uint32_t const fsinfo[] = {
+    0x41615252,                       // lead signature
+    0x61417272,                       // struct signature, offset 484
+    CLUSTER_COUNT - used_clusters,    // free cluster count
+    info[FID_UF2].cluster_end + 1,    // next free cluster
+  };
+
+  memcpy(data, &fsinfo[0], 4);
+  memcpy(data + 484, &fsinfo[1], 12);
+  data[510] = 0x55;
+  data[511] = 0xaa;
+}
+
+#endif
+
+// Reserved region: boot sector, FAT32 also has FSInfo and backup copies of both
+static void read_reserved_sector (uint32_t block_no, uint8_t *data) {
+#if CFG_UF2_FAT32
+  if ( block_no >= BPB_BACKUP_BOOT_SECTOR ) block_no -= BPB_BACKUP_BOOT_SECTOR;
+
+  if ( block_no == BPB_FSINFO_SECTOR ) {
+    read_fsinfo_sector(data);
+  }
+#endif
+
+  if ( block_no == 0 ) {
+    read_boot_sector(data);
+  }
+}
+
+#if TINYUF2_META_CACHE
+// Generated head/tail FAT sectors, hosts read them again and again while mounted. Valid until
+// uf2_init() changes the layout, least recently used entry is replaced
+static struct {
+  uint32_t sector;    // FAT relative sector + 1, 0 if entry is free
+  uint32_t used;      // _meta_cache_clock at last use
+  uint8_t  data[BPB_SECTOR_SIZE] __attribute__((aligned(4)));
+} _meta_cache[TINYUF2_META_CACHE];
+
+static uint32_t _meta_cache_clock;
+
+static bool meta_cache_get(uint32_t sector, uint8_t *data) {
+  for (uint32_t i = 0; i < TINYUF2_META_CACHE; i++) {
+    if (_meta_cache[i].sector == sector + 1) {
+      _meta_cache[i].used = ++_meta_cache_clock;
+      memcpy(data, _meta_cache[i].data, BPB_SECTOR_SIZE);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void meta_cache_clear(void) {
+  memset(_meta_cache, 0, sizeof(_meta_cache));
+  _meta_cache_clock = 0;
+}
+
+static void meta_cache_put(uint32_t sector, uint8_t const *data) {
+  uint32_t lru = 0;
+  for (uint32_t i = 1; i < TINYUF2_META_CACHE; i++) {
+    if (_meta_cache[i].used < _meta_cache[lru].used) lru = i;
+  }
+
+  _meta_cache[lru].sector = sector + 1;
+  _meta_cache[lru].used = ++_meta_cache_clock;
+  memcpy(_meta_cache[lru].data, data, BPB_SECTOR_SIZE);
+}
+#endif
+
+// Head or tail FAT sector: reserved clusters and end-of-chain markers between chain entries
+static void fat_generic_sector (uint32_t sectionRelativeSector, fat_entry_t* entries) {
+  uint32_t sectorFirstCluster = sectionRelativeSector * FAT_ENTRIES_PER_SECTOR;
+  uint32_t firstUnusedCluster = info[FID_UF2].cluster_end + 1;
+
+  // OPTIMIZATION:
+  // Because all files are contiguous, the FAT CHAIN entries
+  // are all set to (cluster+1) to point to the next cluster.
+  // All clusters past the last used cluster of the last file
+  // are set to zero.
+  //
+  // EXCEPTIONS:
+  // 1. Clusters 0 and 1 require special handling
+  // 2. Final cluster of each file must be set to END_OF_CHAIN
+  //
+
+  // Set default FAT values first.
+  for (uint32_t i = 0; i < FAT_ENTRIES_PER_SECTOR; i++) {
+    uint32_t cluster = i + sectorFirstCluster;
+    if (cluster >= firstUnusedCluster) {
+      entries[i] = 0;
+    }
+    else {
+      entries[i] = cluster + 1;
+    }
+  }
+
+  // Exception #1: clusters 0 and 1 need special handling
+  if (sectionRelativeSector == 0) {
+    entries[0] = (fat_entry_t) ((FAT_END_OF_CHAIN & ~0xFFUL) | BPB_MEDIA_DESCRIPTOR_BYTE);
+    entries[1] = FAT_END_OF_CHAIN; // cluster 1 is reserved
+#if CFG_UF2_FAT32
+    entries[2] = FAT_END_OF_CHAIN; // root directory cluster
+#endif
+  }
+
+  // Exception #2: the final cluster of each file must be set to END_OF_CHAIN
+  for (uint32_t i = 0; i < NUM_FILES; i++) {
+    uint32_t lastClusterOfFile = info[i].cluster_end;
+    if (lastClusterOfFile >= sectorFirstCluster) {
+      uint32_t idx = lastClusterOfFile - sectorFirstCluster;
+      if (idx < FAT_ENTRIES_PER_SECTOR) {
+        // that last cluster of the file is in this sector
+        entries[idx] = FAT_END_OF_CHAIN;
+      }
+    }
+  }
+}
+
+static void read_fat_sector (uint32_t sectionRelativeSector, uint8_t *data) {
+  // second FAT is same as the first... use sectionRelativeSector to write data
+  if ( sectionRelativeSector >= BPB_SECTORS_PER_FAT ) {
+    sectionRelativeSector -= BPB_SECTORS_PER_FAT;
+  }
+
+  fat_entry_t* entries = (fat_entry_t*) (void*) data;
+  uint32_t sectorFirstCluster = sectionRelativeSector * FAT_ENTRIES_PER_SECTOR;
+
+  if ( sectionRelativeSector > _fat_tail_sector ) {
+    // free sector: buffer is already zeroed
+    return;
+  }
+
+  if ( sectionRelativeSector > _fat_head_last_sector && sectionRelativeSector < _fat_tail_sector ) {
+    // chain sector: contiguous CURRENT.UF2 clusters only, no exceptions
+    fat_entry_t next = (fat_entry_t) (sectorFirstCluster + 1);
+    for (uint32_t i = 0; i < FAT_ENTRIES_PER_SECTOR; i++) {
+      entries[i] = next++;
+    }
+    return;
+  }
+
+  // head or tail sector: generic generation
+#if TINYUF2_META_CACHE
+  if ( meta_cache_get(sectionRelativeSector, data) ) return;
+#endif
+
+  fat_generic_sector(sectionRelativeSector, entries);
+
+#if TINYUF2_META_CACHE
+  meta_cache_put(sectionRelativeSector, data);
+#endif
+}
+
+// Root directory fits in its first sector (see NUM_DIRENTRIES assert) and only changes in uf2_init():
+// entries are built once there, following sectors are empty
+TUF2_DFU_NOINIT static DirEntry _dir_entries[NUM_DIRS][DIR_MAX_ENTRIES];
+
+// checksum of the short name, stored in each of its long name entries
+static uint8_t lfn_checksum(char const name[11]) {
+  uint8_t sum = 0;
+  for ( uint32_t i = 0; i < 11; i++ ) {
+    sum = (uint8_t) (((sum & 1) << 7) + (sum >> 1) + (uint8_t) name[i]);
+  }
+  return sum;
+}
+
+// UTF-16 character at position of long name: NUL terminated then padded with 0xFFFF
+static uint16_t lfn_char(char const* long_name, uint32_t len, uint32_t pos) {
+  if ( pos < len ) return (uint8_t) long_name[pos];
+  return (pos == len) ? 0x0000 : 0xFFFF;
+}
+
+// Append an entry (preceded by its long name entries if any) to directory, return false if full
+static bool dir_add(uint8_t dir, uint32_t* count, char const name[11], char const* long_name,
+                    uint8_t attrs, uint32_t startCluster, uint32_t size) {
+  uint32_t const len = long_name ? strlen(long_name) : 0;
+  uint32_t const pieces = UF2_DIV_CEIL(len, LFN_PIECE_CHARS);
+
+  if ( *count + pieces + 1 > DIR_MAX_ENTRIES ) {
+    TUF2_LOG1("GhostFAT: directory %u is full\r\n", dir);
+    return false;
+  }
+
+  // long name pieces are stored last first
+  uint8_t const checksum = lfn_checksum(name);
+  for ( uint32_t p = pieces; p > 0; p-- ) {
+    LfnEntry* lfn = (LfnEntry*) &_dir_entries[dir][(*count)++];
+    uint32_t pos = (p - 1) * LFN_PIECE_CHARS;
+
+    lfn->order    = (uint8_t) (p | (p == pieces ? LFN_LAST_ENTRY : 0));
+    lfn->attrs    = 0x0F;
+    lfn->checksum = checksum;
+    for ( uint32_t i = 0; i < 5; i++ ) lfn->name1[i] = lfn_char(long_name, len, pos++);
+    for ( uint32_t i = 0; i < 6; i++ ) lfn->name2[i] = lfn_char(long_name, len, pos++);
+    for ( uint32_t i = 0; i < 2; i++ ) lfn->name3[i] = lfn_char(long_name, len, pos++);
+  }
+
+  DirEntry *d = &_dir_entries[dir][(*count)++];
+  padded_memcpy(d->name, name, 11);
+  d->attrs            = attrs;
+  d->createTimeFine   = COMPILE_SECONDS_INT % 2 * 100;
+  d->createTime       = COMPILE_DOS_TIME;
+  d->createDate       = COMPILE_DOS_DATE;
+  d->lastAccessDate   = COMPILE_DOS_DATE;
+  d->highStartCluster = startCluster >> 16;
+  d->updateTime       = COMPILE_DOS_TIME;
+  d->updateDate       = COMPILE_DOS_DATE;
+  d->startCluster     = startCluster & 0xFFFF;
+  d->size             = size;
+  return true;
+}
+
+static void rootdir_build(void) {
+  uint32_t count[NUM_DIRS] = { 0 };
+  memset(_dir_entries, 0, sizeof(_dir_entries));
+
+  // volume label is first root directory entry
+  DirEntry *d = &_dir_entries[DIR_ROOT][count[DIR_ROOT]++];
+  padded_memcpy(d->name, (char const*) BootBlock.VolumeLabel, 11);
+  d->attrs = 0x28;
+
+  // table order lists a directory before its files, so "." and ".." come first
+  for ( uint32_t fileIndex = 0; fileIndex < NUM_FILES; fileIndex++ ) {
+    FileContent_t const *inf = &info[fileIndex];
+
+    if ( !inf->name[0] ) continue;
+
+    if ( inf->subdir ) {
+      // parent is the root directory, referred to as cluster 0 by ".."
+      (void) dir_add(inf->dir, &count[inf->dir], inf->name, inf->long_name, ATTR_DIRECTORY, inf->cluster_start, 0);
+      (void) dir_add(inf->subdir, &count[inf->subdir], ".          ", NULL, ATTR_DIRECTORY, inf->cluster_start, 0);
+      (void) dir_add(inf->subdir, &count[inf->subdir], "..         ", NULL, ATTR_DIRECTORY, 0, 0);
+    } else {
+      (void) dir_add(inf->dir, &count[inf->dir], inf->name, inf->long_name, 0, inf->cluster_start, inf->size);
+    }
+  }
+}
+
+static void read_rootdir_sector (uint32_t sectionRelativeSector, uint8_t *data) {
+#if TINYUF2_STATS
+  uf2_stats_mount(UF2_MOUNT_ROOT_DIR);
+#endif
+  if ( sectionRelativeSector == 0 ) {
+    memcpy(data, _dir_entries[DIR_ROOT], sizeof(_dir_entries[DIR_ROOT]));
+  }
+}
+
+// Fill count sectors of a static file, starting at fileRelativeSector.
+// Sectors past the end of the content (cluster padding) are left zeroed.
+static void read_file_sectors (FileContent_t const *inf, uint32_t fileRelativeSector, uint32_t count, uint8_t *data) {
+  size_t fileContentStartOffset = fileRelativeSector * BPB_SECTOR_SIZE;
+  size_t fileContentLength = inf->size;
+
+  // nothing to copy if already past the end of the file (only when >1 sector per cluster)
+  if (fileContentLength > fileContentStartOffset) {
+    // obviously, 2nd and later sectors should not copy data from the start
+    const void * dataStart = (inf->content) + fileContentStartOffset;
+    // limit number of bytes of data to be copied to remaining valid bytes
+    size_t bytesToCopy = fileContentLength - fileContentStartOffset;
+    // and further limit that to the requested span
+    if (bytesToCopy > count * BPB_SECTOR_SIZE) {
+      bytesToCopy = count * BPB_SECTOR_SIZE;
+    }
+    memcpy(data, dataStart, bytesToCopy);
+  }
+}
+
+// Generate count sectors of CURRENT.UF2 on-the-fly, starting at fileRelativeSector,
+// each sector holds UF2_BLOCKS_PER_SECTOR uf2 blocks
+//
+// Flash contents for the whole span are fetched with a single board_flash_read(),
+// using the tail of the (already zeroed) sector buffer as staging area: with P
+// payload bytes per block, payload i is read to offset n*(512-P) + i*P, which
+// always lies at or after the end of block i-1 and the header of block i, so each
+// payload can be moved into place and wrapped in its UF2 header in ascending order
+// without clobbering payloads not yet processed.
+static void read_uf2_sectors (uint32_t fileRelativeSector, uint32_t count, uint8_t *data) {
+  uint32_t const first_block = fileRelativeSector * UF2_BLOCKS_PER_SECTOR;
+  uint32_t const addr = BOARD_FLASH_APP_START + (first_block * UF2_FIRMWARE_BYTES_PER_SECTOR);
+  uint32_t const flash_end = _uf2_end;
+
+  // past end of flash, sectors are padding
+  if ( addr >= flash_end ) return;
+
+  // limit span to the end of flash, remaining blocks stay zeroed
+  uint32_t const remaining = flash_end - addr;
+  uint32_t n = (remaining + UF2_FIRMWARE_BYTES_PER_SECTOR - 1) / UF2_FIRMWARE_BYTES_PER_SECTOR;
+  if (n > count * UF2_BLOCKS_PER_SECTOR) n = count * UF2_BLOCKS_PER_SECTOR;
+
+  uint32_t read_len = n * UF2_FIRMWARE_BYTES_PER_SECTOR;
+  if (read_len > remaining) read_len = remaining;
+
+  STATIC_ASSERT(UF2_FIRMWARE_BYTES_PER_SECTOR <= sizeof(((UF2_Block*) 0)->data));
+  STATIC_ASSERT((UF2_FIRMWARE_BYTES_PER_SECTOR & 3) == 0);
+  uint8_t* staging = data + n * (UF2_BLOCK_SIZE - UF2_FIRMWARE_BYTES_PER_SECTOR);
+  board_flash_read(addr, staging, read_len);
+
+  for (uint32_t i = 0; i < n; i++) {
+    UF2_Block *bl = (void*) (data + i * UF2_BLOCK_SIZE);
+    uint32_t const offset = i * UF2_FIRMWARE_BYTES_PER_SECTOR;
+    uint32_t len = read_len - offset;
+    if (len > UF2_FIRMWARE_BYTES_PER_SECTOR) len = UF2_FIRMWARE_BYTES_PER_SECTOR;
+
+    // move payload first, the header and trailer may overlap its staging location
+    memmove(bl->data, staging + offset, len);
+    memset(bl->data + len, 0, sizeof(bl->data) - len);
+
+    bl->magicStart0 = UF2_MAGIC_START0;
+    bl->magicStart1 = UF2_MAGIC_START1;
+    bl->magicEnd = UF2_MAGIC_END;
+    bl->blockNo = first_block + i;
+    bl->numBlocks = UF2_SECTOR_COUNT;
+    bl->targetAddr = addr + offset;
+    bl->payloadSize = len;
+    bl->flags = UF2_FLAG_FAMILYID;
+    bl->familyID = BOARD_UF2_FAMILY_ID;
+  }
+}
+
+#if TINYUF2_CURRENT_BIN
+// Fill count sectors of CURRENT.BIN directly from flash, sectors past the end stay zeroed
+static void read_bin_sectors (uint32_t fileRelativeSector, uint32_t count, uint8_t *data) {
+  uint32_t const offset = fileRelativeSector * BPB_SECTOR_SIZE;
+  if ( offset >= info[FID_BIN].size ) return;
+
+  uint32_t len = count * BPB_SECTOR_SIZE;
+  if ( len > info[FID_BIN].size - offset ) len = info[FID_BIN].size - offset;
+
+  board_flash_read(BOARD_FLASH_APP_START + offset, data, len);
+}
+#endif
+
+// Read sectors from the data area (files, unused space, ...).
+// Returns number of sectors filled, which never crosses a file boundary.
+static uint32_t read_data_sectors (uint32_t sectionRelativeSector, uint32_t count, uint8_t *data) {
+#if CFG_UF2_FAT32
+  // FAT32 root directory is the first cluster of the data region
+  uint32_t const rootSectorCount = FAT_ROOT_DIR_CLUSTERS * BPB_SECTORS_PER_CLUSTER;
+  if ( sectionRelativeSector < rootSectorCount ) {
+    if (count > rootSectorCount - sectionRelativeSector) {
+      count = rootSectorCount - sectionRelativeSector;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+      read_rootdir_sector(sectionRelativeSector + i, data + i * BPB_SECTOR_SIZE);
+    }
+    return count;
+  }
+#endif
+
+  // plus 2 for first data cluster offset
+  uint32_t fid = info_index_of(2 + sectionRelativeSector / BPB_SECTORS_PER_CLUSTER);
+  FileContent_t const * inf = &info[fid];
+
+  uint32_t fileRelativeSector = sectionRelativeSector - (inf->cluster_start-2) * BPB_SECTORS_PER_CLUSTER;
+
+  if ( fid != FID_UF2 ) {
+    // Handle all files other than CURRENT.UF2, limited to the file's last cluster
+    uint32_t const fileSectorCount = (inf->cluster_end - inf->cluster_start + 1) * BPB_SECTORS_PER_CLUSTER;
+    if (count > fileSectorCount - fileRelativeSector) {
+      count = fileSectorCount - fileRelativeSector;
+    }
+
+#if TINYUF2_CURRENT_CRC
+    if ( fid == FID_CRC ) current_crc_refresh();
+#endif
+
+#if TINYUF2_CONFIG_TXT
+    if ( fid == FID_CONFIG ) uf2_config_render(configFile);
+#endif
+
+#if TINYUF2_STATS
+    if ( fid == FID_STATS ) (void) stats_render();
+#endif
+
+#if TINYUF2_SECTORS_CRC
+    if ( fid == FID_SECTORS ) sectors_crc_render(fileRelativeSector * BPB_SECTOR_SIZE, count * BPB_SECTOR_SIZE);
+#endif
+
+#if TINYUF2_VERIFY_UF2
+    if ( fid == FID_VERIFY ) verify_render();
+#endif
+
+#if TINYUF2_WEAR_LOG
+    if ( fid == FID_WEAR ) wear_render();
+#endif
+
+#if TINYUF2_EVENT_LOG
+    if ( fid == FID_EVENTS ) events_render();
+#endif
+
+#if TINYUF2_CURRENT_BIN
+    if ( fid == FID_BIN ) {
+      read_bin_sectors(fileRelativeSector, count, data);
+    } else
+#endif
+#if TINYUF2_DIAG_DIR
+    if ( inf->subdir ) {
+      // directory takes a single cluster, entries are in its first sector
+      if ( fileRelativeSector == 0 ) memcpy(data, _dir_entries[inf->subdir], sizeof(_dir_entries[inf->subdir]));
+    } else
+#endif
+    {
+      read_file_sectors(inf, fileRelativeSector, count, data);
+    }
+  }
+  else {
+    // CURRENT.UF2 is the last file and extends to the end of the media
+    read_uf2_sectors(fileRelativeSector, count, data);
+  }
+
+  return count;
+}
+
+#if TINYUF2_WRITE_OVERLAY
+// Non-uf2 blocks written by host (its own metadata: directory updates, .fseventsd, System Volume
+// Information ...) are kept in RAM and read back in place of generated contents, so that host sees
+// a consistent volume. Oldest block is replaced when full.
+static struct {
+  uint32_t block; // disk position in 512-byte units, +1 so that zeroed entry is unused
+  uint8_t data[UF2_BLOCK_SIZE];
+} _overlay[TINYUF2_WRITE_OVERLAY];
+
+static uint32_t _overlay_next; // round-robin replacement
+
+static void overlay_clear(void) {
+  memset(_overlay, 0, sizeof(_overlay));
+  _overlay_next = 0;
+}
+
+void uf2_overlay_write(uint32_t block, uint8_t const *data) {
+  uint32_t slot = _overlay_next;
+
+  for (uint32_t i = 0; i < TINYUF2_WRITE_OVERLAY; i++) {
+    if (_overlay[i].block == block + 1) {
+      // rewritten in place
+      memcpy(_overlay[i].data, data, UF2_BLOCK_SIZE);
+      return;
+    }
+  }
+
+  _overlay_next = (slot + 1) % TINYUF2_WRITE_OVERLAY;
+  _overlay[slot].block = block + 1;
+  memcpy(_overlay[slot].data, data, UF2_BLOCK_SIZE);
+}
+
+#if TINYUF2_CURRENT_BIN
+// True if host wrote any block of count sectors from block_no
+static bool overlay_covers(uint32_t block_no, uint32_t count) {
+  uint32_t const first = block_no * UF2_BLOCKS_PER_SECTOR;
+  uint32_t const total = count * UF2_BLOCKS_PER_SECTOR;
+
+  for (uint32_t i = 0; i < TINYUF2_WRITE_OVERLAY; i++) {
+    if (_overlay[i].block && _overlay[i].block - 1 - first < total) return true;
+  }
+  return false;
+}
+#endif
+
+// Replace blocks of the sectors just generated with the ones written by host
+static void overlay_apply(uint32_t block_no, uint32_t count, uint8_t *data) {
+  uint32_t const first = block_no * UF2_BLOCKS_PER_SECTOR;
+  uint32_t const total = count * UF2_BLOCKS_PER_SECTOR;
+
+  for (uint32_t i = 0; i < TINYUF2_WRITE_OVERLAY; i++) {
+    // unused entries wrap around to a huge offset
+    uint32_t const offset = _overlay[i].block - 1 - first;
+    if (_overlay[i].block && offset < total) {
+      memcpy(data + offset * UF2_BLOCK_SIZE, _overlay[i].data, UF2_BLOCK_SIZE);
+    }
+  }
+}
+#endif
+
+TUF2_HOT void uf2_read_blocks (uint32_t block_no, uint32_t count, uint8_t *data) {
+  memset(data, 0, count * BPB_SECTOR_SIZE);
+
+#if TINYUF2_WRITE_OVERLAY
+  uint32_t const first_block = block_no;
+  uint32_t const total_count = count;
+  uint8_t * const first_data = data;
+#endif
+
+  // Each pass serves a span of sectors that lies within a single region
+  while (count) {
+    uint32_t span = 1;
+
+    if ( block_no < FS_START_FAT0_SECTOR ) {
+      // Request was for the Boot block (or other reserved sectors)
+      read_reserved_sector(block_no, data);
+    }
+    else if ( block_no < FS_START_ROOTDIR_SECTOR ) {
+      // Request was for FAT table sectors
+      span = FS_START_ROOTDIR_SECTOR - block_no;
+      if (span > count) span = count;
+
+      for (uint32_t i = 0; i < span; i++) {
+        read_fat_sector(block_no + i - FS_START_FAT0_SECTOR, data + i * BPB_SECTOR_SIZE);
+      }
+    }
+    else if ( block_no < FS_START_CLUSTERS_SECTOR ) {
+      // Request was for (root) directory sectors .. root because not supporting subdirectories (yet)
+      span = FS_START_CLUSTERS_SECTOR - block_no;
+      if (span > count) span = count;
+
+      for (uint32_t i = 0; i < span; i++) {
+        read_rootdir_sector(block_no + i - FS_START_ROOTDIR_SECTOR, data + i * BPB_SECTOR_SIZE);
+      }
+    }
+    else if ( block_no < BPB_TOTAL_SECTORS ) {
+      // Request was to read from the data area (files, unused space, ...)
+      span = BPB_TOTAL_SECTORS - block_no;
+      if (span > count) span = count;
+
+      span = read_data_sectors(block_no - FS_START_CLUSTERS_SECTOR, span, data);
+    }
+    else {
+      // past the end of the media, leave zeroed
+      span = count;
+    }
+
+    block_no += span;
+    data     += span * BPB_SECTOR_SIZE;
+    count    -= span;
+  }
+
+#if TINYUF2_WRITE_OVERLAY
+  overlay_apply(first_block, total_count, first_data);
+#endif
+}
+
+void uf2_read_block (uint32_t block_no, uint8_t *data) {
+  uf2_read_blocks(block_no, 1, data);
+}
+
+void const* uf2_read_mapped (uint32_t block_no, uint32_t count) {
+#if TINYUF2_CURRENT_BIN
+  if ( !board_flash_mapped || block_no < FS_START_CLUSTERS_SECTOR || block_no >= BPB_TOTAL_SECTORS ) return NULL;
+
+  // only whole sectors of CURRENT.BIN data are plain flash contents, its padding is generated
+  FileContent_t const * inf = &info[FID_BIN];
+  uint32_t const sectionRelativeSector = block_no - FS_START_CLUSTERS_SECTOR;
+  uint32_t const fileFirstSector = (inf->cluster_start - 2) * BPB_SECTORS_PER_CLUSTER;
+  if ( !inf->size || sectionRelativeSector < fileFirstSector ) return NULL;
+
+  uint32_t const offset = (sectionRelativeSector - fileFirstSector) * BPB_SECTOR_SIZE;
+  if ( offset >= inf->size || count * BPB_SECTOR_SIZE > inf->size - offset ) return NULL;
+
+#if TINYUF2_WRITE_OVERLAY
+  if ( overlay_covers(block_no, count) ) return NULL;
+#endif
+
+  return board_flash_mapped(BOARD_FLASH_APP_START + offset, count * BPB_SECTOR_SIZE);
+#else
+  (void) block_no;
+  (void) count;
+  return NULL;
+#endif
+}
+
+/*------------------------------------------------------------------*/
+/* Write UF2
+ *------------------------------------------------------------------*/
+
+/**
+ * Write an uf2 block wrapped by 512 bytes (a 4096-byte sector holds 8 of them).
+ * @return number of bytes processed, only 3 following values
+ *  -1 : if not an uf2 block
+ * 512 : write is successful (UF2_BLOCK_SIZE)
+ *   0 : is busy with flashing, tinyusb stack will call write_block again with the same parameters later on
+ */
+// Find entry of a partially written group, NULL if not found
+static WrittenGroup* find_written_group(WriteState *state, uint32_t group) {
+  // sequential writes hit the most recently used entry
+  WrittenGroup* entry = &state->writtenGroups[state->writtenLast];
+  if ( entry->mask && entry->group == group ) return entry;
+
+  for ( uint32_t i = 0; i < CFG_UF2_WRITTEN_GROUPS; i++ ) {
+    entry = &state->writtenGroups[i];
+    if ( entry->mask && entry->group == group ) {
+      state->writtenLast = i;
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static bool is_block_written(WriteState *state, uint32_t block_no) {
+  uint32_t const group = block_no / WRITTEN_GROUP_SIZE;
+
+  if ( state->writtenSummary[group / 8] & (1 << (group % 8)) ) return true;
+
+  WrittenGroup const* entry = find_written_group(state, group);
+  return entry && (entry->mask & (1ULL << (block_no % WRITTEN_GROUP_SIZE)));
+}
+
+// True if mark_block_written() can track the block: its group is complete, has an entry or one is free.
+// Blocks are checked before being programmed, so that numWritten counts exactly what is on flash
+static bool can_track_block(WriteState *state, uint32_t block_no) {
+  uint32_t const group = block_no / WRITTEN_GROUP_SIZE;
+
+  if ( state->writtenSummary[group / 8] & (1 << (group % 8)) ) return true;
+  if ( find_written_group(state, group) ) return true;
+
+  for ( uint32_t i = 0; i < CFG_UF2_WRITTEN_GROUPS; i++ ) {
+    if ( state->writtenGroups[i].mask == 0 ) return true;
+  }
+
+  return false;
+}
+
+// Mark block as written, return true if it was not written before.
+// A block that can not be tracked (all group entries in use) is not counted either, so that
+// completion is never reported before all blocks are really written.
+static bool mark_block_written(WriteState *state, uint32_t block_no) {
+  uint32_t const group = block_no / WRITTEN_GROUP_SIZE;
+  uint8_t const summary_mask = 1 << (group % 8);
+  uint64_t const bit = 1ULL << (block_no % WRITTEN_GROUP_SIZE);
+
+  // whole group is already written
+  if ( state->writtenSummary[group / 8] & summary_mask ) return false;
+
+  WrittenGroup* entry = find_written_group(state, group);
+  if ( !entry ) {
+    // allocate a free entry
+    for ( uint32_t i = 0; i < CFG_UF2_WRITTEN_GROUPS; i++ ) {
+      if ( state->writtenGroups[i].mask == 0 ) {
+        entry = &state->writtenGroups[i];
+        entry->group = group;
+        state->writtenLast = i;
+        break;
+      }
+    }
+
+    if ( !entry ) {
+      TUF2_LOG1("Too many partially written groups, block %lu not tracked\r\n", block_no);
+      return false;
+    }
+  }
+
+  if ( entry->mask & bit ) return false;
+  entry->mask |= bit;
+
+  // group is complete when all its blocks below numBlocks are written
+  uint32_t const first = group * WRITTEN_GROUP_SIZE;
+  uint32_t const count = (state->numBlocks > first) ? (state->numBlocks - first) : WRITTEN_GROUP_SIZE;
+  uint64_t const full = (count >= WRITTEN_GROUP_SIZE) ? UINT64_MAX : ((1ULL << count) - 1);
+
+  if ( (entry->mask & full) == full ) {
+    state->writtenSummary[group / 8] |= summary_mask;
+    entry->mask = 0; // release entry
+  }
+
+  return true;
+}
+
+// Find additional family registered by board, NULL if not supported
+static board_uf2_family_t const* find_uf2_family(uint32_t family_id) {
+  if ( !board_uf2_families ) return NULL;
+
+  uint32_t count = 0;
+  board_uf2_family_t const* families = board_uf2_families(&count);
+
+  for ( uint32_t i = 0; i < count; i++ ) {
+    if ( families[i].family_id == family_id ) return &families[i];
+  }
+
+  return NULL;
+}
+
+// flush main flash and all additional families
+static void flush_all_families(void) {
+  board_flash_flush();
+#if TINYUF2_IDLE_HASH
+  // flash holds what was written, background run may proceed
+  _idle_hash.dirty = false;
+#endif
+
+  if ( board_uf2_families ) {
+    uint32_t count = 0;
+    board_uf2_family_t const* families = board_uf2_families(&count);
+
+    for ( uint32_t i = 0; i < count; i++ ) {
+      if ( families[i].flush ) families[i].flush();
+    }
+  }
+}
+
+void uf2_flush(void) {
+  uf2_write_commit();
+  flush_all_families();
+}
+
+#if TINYUF2_UF2_LZ4
+#include "lz4.h"
+
+TUF2_DFU_NOINIT static uint8_t _lz4_buf[UF2_LZ4_MAX_SIZE] __attribute__((aligned(4)));
+#endif
+
+// Decoded payloads are larger than a uf2 block, they are written in chunks not crossing 256-byte
+// boundaries like uncompressed payloads so that every backend handles them
+static bool payload_write(bool (*write)(uint32_t, void const*, uint32_t), uint32_t addr, uint8_t const* data, uint32_t len) {
+  bool ret = true;
+
+  while (len > sizeof(((UF2_Block*) 0)->data)) {
+    uint32_t const count = 256 - (addr & 0xff);
+    if ( !write(addr, data, count) ) {
+      uf2_event(UF2_EVENT_WRITE_FAIL, addr);
+      ret = false;
+    }
+    addr += count;
+    data += count;
+    len  -= count;
+  }
+
+  if ( !write(addr, data, len) ) {
+    uf2_event(UF2_EVENT_WRITE_FAIL, addr);
+    ret = false;
+  }
+  return ret;
+}
+
+// Generic family payloads queued for board_flash_write_v(). They point into the buffer passed to
+// uf2_write_block() and are submitted by uf2_write_commit() before that buffer is reused.
+#define FLASH_VEC_MAX  16
+
+static board_flash_vec_t _flash_vec[FLASH_VEC_MAX];
+static uint32_t _flash_vec_count = 0;
+
+void uf2_write_commit(void) {
+  if ( _flash_vec_count == 0 ) return;
+
+#if TINYUF2_STATS
+  uint32_t const t_write = uf2_stats_now();
+#endif
+  if ( !board_flash_write_v(_flash_vec, _flash_vec_count) ) uf2_event(UF2_EVENT_WRITE_FAIL, _flash_vec[0].addr);
+  _flash_vec_count = 0;
+#if TINYUF2_STATS
+  _stats.write_cycles += uf2_stats_now() - t_write;
+#endif
+}
+
+static bool flash_vec_overlaps(uint32_t addr, uint32_t len) {
+  for ( uint32_t i = 0; i < _flash_vec_count; i++ ) {
+    if ( addr < _flash_vec[i].addr + _flash_vec[i].len && _flash_vec[i].addr < addr + len ) return true;
+  }
+  return false;
+}
+
+// Program generic family payload, batched when the port has board_flash_write_v()
+static void flash_write_queued(uint32_t addr, uint8_t const* data, uint32_t len, bool in_place) {
+  if ( !board_flash_write_v ) {
+    payload_write(board_flash_write, addr, data, len);
+    return;
+  }
+
+  if ( _flash_vec_count == FLASH_VEC_MAX ) uf2_write_commit();
+
+  _flash_vec[_flash_vec_count].addr = addr;
+  _flash_vec[_flash_vec_count].data = data;
+  _flash_vec[_flash_vec_count].len  = len;
+  _flash_vec_count++;
+
+  // decoded payload lives in a shared buffer overwritten by the next block
+  if ( !in_place ) uf2_write_commit();
+}
+
+#if TINYUF2_RAW_LUN
+void uf2_write_raw(uint32_t addr, uint8_t const* data, uint32_t len) {
+  // image is changed outside of uf2 tracking
+#if TINYUF2_APP_FOOTER
+  app_footer_invalidate();
+#endif
+#if TINYUF2_IDLE_HASH
+  idle_hash_invalidate();
+#endif
+#if TINYUF2_CURRENT_CRC
+  _current_crc.valid = false;
+  _current_crc.run_ok = false;
+#endif
+#if TINYUF2_SECTORS_CRC
+  sectors_crc_invalidate(addr, len);
+#endif
+  uf2_write_commit();
+  payload_write(board_flash_write, addr, data, len);
+}
+#endif
+
+#if TINYUF2_UF2_TAGS || TINYUF2_RESUME
+// Walk extension tags following the payload, pos is 0 for the first tag. Returns value of the next
+// tag with its type and length, NULL when there is none left
+static uint8_t const* tag_next(UF2_Block const* bl, uint32_t* pos, uint32_t* type, uint32_t* len) {
+  if ( !*pos ) {
+    uint32_t end = bl->payloadSize;
+#if TINYUF2_UF2_AES
+    if ( bl->flags & UF2_FLAG_AES ) end += UF2_AES_NONCE_SIZE;
+#endif
+    *pos = (end + 3) & ~3UL;
+  }
+
+  if ( *pos + 4 > sizeof(bl->data) ) return NULL;
+
+  uint8_t const* tag = bl->data + *pos;
+  uint32_t const size = tag[0];
+  if ( size < 4 || size > sizeof(bl->data) - *pos ) return NULL;
+
+  *type = tag[1] | (tag[2] << 8) | ((uint32_t) tag[3] << 16);
+  *len = size - 4;
+  *pos = (*pos + size + 3) & ~3UL;
+  return tag + 4;
+}
+#endif
+
+#if TINYUF2_RESUME
+#if TINYUF2_SIGNED_UF2
+  #error "TINYUF2_RESUME skips blocks written before, TINYUF2_SIGNED_UF2 hashes the whole image as it is written"
+#endif
+
+// Journal follow-up of the file being written
+static struct {
+  bool     tracking;  // blocks arrive in order of increasing addresses, journal is advanced
+  uint32_t next;      // block expected next
+  uint32_t end;       // end address of the latest block
+  uint32_t keep;      // flash below is from the interrupted session of a resumed file, not pre-erased
+} _resume;
+
+static void resume_save(board_resume_log_t* log) {
+  log->magic = RESUME_LOG_MAGIC;
+  log->check = resume_check(log);
+}
+
+// Image ID from the SHA-2 tag of a block, false if it has none
+static bool resume_image_id(UF2_Block const* bl, uint32_t id[2]) {
+  uint32_t pos = 0, type = 0, len = 0;
+  uint8_t const* value;
+
+  if ( !(bl->flags & UF2_FLAG_EXTENSION_TAGS) ) return false;
+
+  while ( (value = tag_next(bl, &pos, &type, &len)) != NULL ) {
+    if ( type == UF2_TAG_SHA2 && len >= 8 ) {
+      memcpy(id, value, 8);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// First block of a file: resume it if the journal has the same image, otherwise start the journal over
+static void resume_start(WriteState* state, UF2_Block const* bl) {
+  board_resume_log_t* log = TINYUF2_RESUME_PTR;
+  uint32_t id[2];
+
+  memset(&_resume, 0, sizeof(_resume));
+
+  if ( !resume_image_id(bl, id) || !bl->numBlocks || bl->numBlocks >= MAX_BLOCKS ) {
+    // flash is about to change with a file that can not be resumed
+    log->magic = 0;
+    return;
+  }
+
+  if ( resume_valid(log) && log->image_id[0] == id[0] && log->image_id[1] == id[1] &&
+       log->num_blocks == bl->numBlocks && log->done && log->done < bl->numBlocks ) {
+    TUF2_LOG1("Resume: from block %lu of %lu\r\n", log->done, log->num_blocks);
+    uf2_event(UF2_EVENT_RESUME, log->done);
+
+    // blocks in flash count as written, the host may still send them again
+    state->numBlocks = bl->numBlocks;
+    for ( uint32_t i = 0; i < log->done; i++ ) {
+      if ( mark_block_written(state, i) ) state->numWritten++;
+    }
+
+    _resume.next = log->done;
+    _resume.end = log->addr;
+    _resume.keep = log->addr;
+  } else {
+    log->image_id[0] = id[0];
+    log->image_id[1] = id[1];
+    log->num_blocks = bl->numBlocks;
+    log->done = 0;
+    log->addr = 0;
+    resume_save(log);
+  }
+
+  _resume.tracking = true;
+}
+
+// Block about to be written: once the file moves on to another erase unit with all blocks so far wholly
+// below it, these are flushed and recorded as done
+static void resume_block(UF2_Block const* bl, uint32_t addr, uint32_t len) {
+  flash_sector_t unit;
+
+  // blocks already taken into account may be rewritten by the host
+  if ( !_resume.tracking || bl->blockNo < _resume.next ) return;
+
+  if ( bl->blockNo != _resume.next || bl->familyID != BOARD_UF2_FAMILY_ID || addr < _resume.end ||
+#if BOARD_FLASH_APP_START > 0
+       addr < BOARD_FLASH_APP_START ||
+#endif
+       !flash_sector_find(&uf2_flash_info()->geometry, addr, &unit) ) {
+    // out of order, other family or outside of main flash: journal stays where it is
+    _resume.tracking = false;
+    return;
+  }
+
+  board_resume_log_t* log = TINYUF2_RESUME_PTR;
+  if ( bl->blockNo > log->done && unit.addr >= _resume.end ) {
+    uf2_flush();
+    log->done = bl->blockNo;
+    log->addr = unit.addr;
+    resume_save(log);
+  }
+
+  _resume.next++;
+  _resume.end = addr + len;
+}
+#endif
+
+#if TINYUF2_PRE_ERASE
+#if TINYUF2_DELTA_FLASH
+  #error "TINYUF2_PRE_ERASE erases units regardless of their contents, incompatible with TINYUF2_DELTA_FLASH"
+#endif
+
+#if TINYUF2_CONFIG_TXT
+  #define PRE_ERASE_CONFIRM  (uf2_config()->pre_erase) // 0 disables pre-erase
+#else
+  #define PRE_ERASE_CONFIRM  UF2_PRE_ERASE_CONFIRM
+#endif
+
+static struct {
+  uint32_t base;      // address of block 0 implied by the latest block
+  uint32_t payload;   // payload size of the latest block
+  uint32_t matched;   // consecutive blocks implying the same base
+  uint32_t next;      // next address to erase
+  uint32_t end;
+  bool     scheduled; // once per boot, later files rely on erase on first write
+} _pre_erase;
+
+// Schedule erase of the image extent once blocks agree on addr = base + blockNo * payload
+static void pre_erase_track(UF2_Block const* bl, uint32_t addr, uint32_t len) {
+  if ( _pre_erase.scheduled || !board_flash_erase_ahead || !PRE_ERASE_CONFIRM || bl->blockNo >= bl->numBlocks ) return;
+
+  uint32_t const base = addr - bl->blockNo * len;
+  if ( base != _pre_erase.base || len != _pre_erase.payload ) {
+    _pre_erase.base = base;
+    _pre_erase.payload = len;
+    _pre_erase.matched = 0;
+  }
+  if ( ++_pre_erase.matched < PRE_ERASE_CONFIRM ) return;
+  _pre_erase.scheduled = true;
+
+  uint32_t const flash_end = BOARD_FLASH_ADDR_ZERO + board_flash_size();
+  uint64_t const image_end = (uint64_t) base + (uint64_t) bl->numBlocks * len;
+  uint32_t start = (base <= BOARD_FLASH_APP_START) ? BOARD_FLASH_APP_START : base;
+  uint32_t end = (image_end < flash_end) ? (uint32_t) image_end : flash_end;
+#if TINYUF2_RESUME
+  if ( start < _resume.keep ) start = _resume.keep;
+#endif
+
+  // whole erase units only, contents around the image in a partial unit are left to the first write
+  flash_geometry_t const* geo = &uf2_flash_info()->geometry;
+  flash_sector_t unit;
+  if ( flash_sector_find(geo, start, &unit) && unit.addr != start ) start = unit.addr + unit.size;
+  if ( flash_sector_find(geo, end, &unit) ) end = unit.addr;
+
+  if ( start < end ) {
+    TUF2_LOG1("Pre-erase: %08lX - %08lX\r\n", start, end);
+    _pre_erase.next = start;
+    _pre_erase.end = end;
+  }
+}
+
+bool uf2_pre_erase_task(void) {
+  if ( _pre_erase.next >= _pre_erase.end ) return false;
+
+  uint32_t const count = board_flash_erase_ahead(_pre_erase.next, _pre_erase.end - _pre_erase.next);
+#if TINYUF2_SECTORS_CRC
+  sectors_crc_invalidate(_pre_erase.next, count);
+#endif
+  _pre_erase.next = count ? (_pre_erase.next + count) : _pre_erase.end;
+
+  return _pre_erase.next < _pre_erase.end;
+}
+#endif
+
+#if TINYUF2_RAM_APP
+static bool is_ram_app_addr(uint32_t addr, uint32_t len) {
+  uint32_t const offset = addr - BOARD_RAM_APP_ADDR; // wraps for addresses below the region
+  return (offset < BOARD_RAM_APP_SIZE) && (len <= BOARD_RAM_APP_SIZE - offset);
+}
+#endif
+
+// All blocks are written: program cached data and finalize image
+static void write_complete(void) {
+  uf2_write_commit();
+  flush_all_families();
+#if TINYUF2_PRE_ERASE
+  // extent may have been overestimated e.g by blocks of other families
+  _pre_erase.end = _pre_erase.next;
+#endif
+
+#if TINYUF2_SIGNED_UF2
+  if ( !uf2_sign_verify() ) sign_reject();
+#endif
+
+#if TINYUF2_CURRENT_CRC
+  current_crc_complete();
+#endif
+#if TINYUF2_APP_FOOTER
+  app_footer_complete();
+#endif
+
+#if TINYUF2_RESUME
+  // nothing left to resume
+  TINYUF2_RESUME_PTR->magic = 0;
+#endif
+}
+
+#if TINYUF2_UF2_TAGS
+// Check extension tags following the payload, false if they name another board
+static bool tags_match(UF2_Block const* bl) {
+  uint32_t pos = 0, type = 0, len = 0;
+  uint8_t const* value;
+
+  while ( (value = tag_next(bl, &pos, &type, &len)) != NULL ) {
+    if ( type == UF2_TAG_DESCRIPTION ) {
+      while ( len && value[len - 1] == 0 ) len--;
+      if ( len != sizeof(UF2_BOARD_ID) - 1 || memcmp(value, UF2_BOARD_ID, len) ) {
+        TUF2_LOG1("Tags: file is not for " UF2_BOARD_ID "\r\n");
+        return false;
+      }
+    }
+#ifdef BOARD_UF2_DEVICE_TYPE
+    else if ( type == UF2_TAG_DEVICE_TYPE && len >= 4 ) {
+      uint32_t device_type;
+      memcpy(&device_type, value, 4);
+      if ( device_type != (uint32_t) BOARD_UF2_DEVICE_TYPE ) {
+        TUF2_LOG1("Tags: device type 0x%08lX is not 0x%08lX\r\n", device_type, (uint32_t) BOARD_UF2_DEVICE_TYPE);
+        return false;
+      }
+    }
+#endif
+  }
+
+  return true;
+}
+#endif
+
+#if TINYUF2_VERIFY_UF2
+// Compare payload of a UF2_FLAG_VERIFY block with flash, a block the host rewrites is counted once
+static void verify_block(WriteState *state, UF2_Block const *bl, uint32_t addr, uint8_t const *payload, uint32_t len) {
+  if ( !state->verify ) {
+    // first block of the file replaces previous result
+    memset(&_verify, 0, sizeof(_verify));
+    _verify.result = VERIFY_RUNNING;
+    state->verify = true;
+  }
+  _verify.total = bl->numBlocks;
+
+  if ( bl->blockNo < MAX_BLOCKS && is_block_written(state, bl->blockNo) ) return;
+  _verify.blocks++;
+
+  uint32_t const offset = addr - BOARD_FLASH_ADDR_ZERO;
+  if ( bl->familyID != BOARD_UF2_FAMILY_ID || offset > _flash_size || len > _flash_size - offset ) {
+    _verify.unchecked++;
+  } else if ( !flash_matches(addr, payload, len) ) {
+    if ( !_verify.mismatched ) {
+      TUF2_LOG1("Verify: first mismatch at %08lX\r\n", addr);
+      _verify.first_mismatch = addr;
+    }
+    _verify.mismatched++;
+  }
+}
+
+static void verify_complete(void) {
+  _verify.result = _verify.mismatched ? VERIFY_FAIL : VERIFY_PASS;
+  TUF2_LOG1("Verify: %lu blocks, %lu mismatched, %lu unchecked\r\n", _verify.blocks, _verify.mismatched,
+            _verify.unchecked);
+}
+#endif
+
+// All blocks of the file are received: complete write, or verification of a UF2_FLAG_VERIFY file
+static void file_complete(WriteState const *state) {
+  (void) state;
+#if TINYUF2_VERIFY_UF2
+  if ( state->verify ) {
+    verify_complete();
+    return;
+  }
+#endif
+  write_complete();
+}
+
+#if TINYUF2_UF2_FILL
+// Pattern of the current fill block, programmed chunk by chunk like a payload
+TUF2_DFU_NOINIT static uint32_t _fill_buf[64];
+
+// Erase the whole erase units at the start of a range filled with erased value, bytes done from addr
+static uint32_t fill_erase(uint32_t addr, uint32_t len) {
+  flash_geometry_t const* geo = &uf2_flash_info()->geometry;
+  flash_sector_t unit;
+  uint32_t done = 0;
+
+  // queued payloads may be in the units about to be erased
+  uf2_write_commit();
+
+  while ( done < len && flash_sector_find(geo, addr + done, &unit) && unit.addr == addr + done &&
+          unit.size <= len - done ) {
+    if ( board_flash_erase_ahead(unit.addr, unit.size) < unit.size ) break;
+    done += unit.size;
+  }
+
+#if TINYUF2_SECTORS_CRC
+  sectors_crc_invalidate(addr, done);
+#endif
+
+  return done;
+}
+#endif
+
+// Program one payload of a block according to its family, false if the family is not supported.
+// unchanged is cleared unless it already matched flash (TINYUF2_DELTA_FLASH)
+static TUF2_HOT bool write_payload(WriteState *state, UF2_Block const *bl, uint32_t addr, uint8_t const *payload,
+                                   uint32_t len, bool *unchanged) {
+  bool matched = false;
+#if TINYUF2_STATS
+  uint32_t t_write;
+  bool programmed = false;
+#endif
+
+#if TINYUF2_VERIFY_UF2
+  if ( bl->flags & UF2_FLAG_VERIFY ) {
+    // nothing is erased or programmed
+    verify_block(state, bl, addr, payload, len);
+  } else
+#endif
+#if TINYUF2_SIGNED_UF2
+  if ( bl->flags & UF2_FLAG_SIGNATURE ) {
+    if ( bl->familyID != BOARD_UF2_FAMILY_ID ) return false;
+    uf2_sign_set(payload, len, addr);
+  } else
+#endif
+#if TINYUF2_RAM_APP
+  if ( bl->familyID == BOARD_UF2_FAMILY_ID && is_ram_app_addr(addr, len) ) {
+    // image linked for RAM, nothing is erased or programmed
+    memcpy((void*) addr, payload, len);
+    state->ramApp = true;
+#if TINYUF2_STATS
+    _stats.bytes += len;
+#endif
+  } else
+#endif
+  if (bl->familyID == BOARD_UF2_FAMILY_ID) {
+    // generic family ID
+    // Host may rewrite blocks it already sent (e.g macOS). Programming them again would land on
+    // an already programmed region of an erase unit that is only erased once per session.
+    bool const rewrite = (bl->blockNo < MAX_BLOCKS) && is_block_written(state, bl->blockNo);
+
+#if TINYUF2_PRE_ERASE
+    // image extent is predicted from payload sizes, fill chunks would overestimate it
+    if ( !(bl->flags & UF2_FLAG_FILL) ) pre_erase_track(bl, addr, len);
+#endif
+
+    // flash contents are compared below, a queued payload at the same place must be programmed first
+    if ( flash_vec_overlaps(addr, len) ) uf2_write_commit();
+
+    // padding or gap on flash erased in this session reads erased already, nothing to program
+    bool const blank = !rewrite && board_flash_erased && is_erased_payload(addr, payload, len) &&
+                       board_flash_erased(addr, len);
+
+#if TINYUF2_DELTA_FLASH
+    // skip payload that already matches flash contents, unless its erase unit is erased by the first
+    // write to it: payloads of the unit skipped before would be lost. A rewrite lands on a unit that
+    // was already handled in this session
+    matched = blank || flash_matches(addr, payload, len);
+    bool const preserved = rewrite || (board_flash_preserved && board_flash_preserved(addr, len));
+    if ( !blank && !(matched && preserved) )
+#else
+    if ( !blank && !(rewrite && flash_matches(addr, payload, len)) )
+#endif
+    {
+      if ( rewrite ) {
+        // units assembled over their current contents take it, elsewhere it would program over words
+        // already programmed in this session: not programmed, the host is told the write failed
+        if ( !(board_flash_preserved && board_flash_preserved(addr, len)) ) {
+          TUF2_LOG1("Rewrite block %lu with different contents, rejected\r\n", bl->blockNo);
+          state->rewriteConflict = true;
+          return true;
+        }
+        TUF2_LOG1("Rewrite block %lu with different contents\r\n", bl->blockNo);
+      }
+#if TINYUF2_APP_FOOTER
+      app_footer_invalidate();
+#endif
+#if TINYUF2_STATS
+      t_write = uf2_stats_now();
+#endif
+      flash_write_queued(addr, payload, len, payload == bl->data);
+#if TINYUF2_STATS
+      _stats.write_cycles += uf2_stats_now() - t_write;
+      _stats.bytes += len;
+      programmed = true;
+#endif
+    }
+
+#if TINYUF2_STATS
+    if ( rewrite ) _stats.retries++;
+    if ( !programmed ) _stats.skipped++;
+#endif
+
+#if TINYUF2_CURRENT_CRC
+    current_crc_track(addr, payload, len);
+#endif
+#if TINYUF2_SECTORS_CRC
+    sectors_crc_invalidate(addr, len);
+#endif
+#if TINYUF2_APP_FOOTER
+    app_footer_track(addr, len);
+#endif
+#if TINYUF2_SIGNED_UF2
+    uf2_sign_track(addr, payload, len);
+#endif
+  }else {
+    board_uf2_family_t const* family = find_uf2_family(bl->familyID);
+
+    // TODO family matches VID/PID
+    if ( !family ) {
+#if TINYUF2_EVENT_LOG
+      // multi-family files would flood the ring, only changes are recorded
+      static uint32_t last_family = 0;
+      if ( bl->familyID != last_family ) {
+        last_family = bl->familyID;
+        uf2_event(UF2_EVENT_FAMILY, bl->familyID);
+      }
+#endif
+      return false;
+    }
+
+#if TINYUF2_STATS
+    t_write = uf2_stats_now();
+#endif
+    payload_write(family->write, addr, payload, len);
+#if TINYUF2_STATS
+    _stats.write_cycles += uf2_stats_now() - t_write;
+    _stats.bytes += len;
+#endif
+  }
+
+  if ( !matched ) *unchanged = false;
+  return true;
+}
+
+static TUF2_HOT int write_block(uint32_t block_no, uint8_t *data, WriteState *state) {
+  (void) block_no;
+  UF2_Block *bl = (void*) data;
+
+  if ( !is_uf2_block(bl) ) return -1;
+  if ( bl->payloadSize == 0 || bl->payloadSize > sizeof(bl->data) ) {
+    uf2_event(UF2_EVENT_BLOCK_INVALID, bl->blockNo);
+    return -1;
+  }
+
+#if TINYUF2_UF2_TAGS
+  // a file for another board is dropped as a whole before anything is erased, also its blocks that
+  // carry no tags
+  if ( state->wrongBoard && bl->numBlocks == state->wrongBoard ) return -1;
+  if ( (bl->flags & UF2_FLAG_EXTENSION_TAGS) && !tags_match(bl) ) {
+    state->wrongBoard = bl->numBlocks;
+    uf2_event(UF2_EVENT_WRONG_BOARD, bl->numBlocks);
+    return -1;
+  }
+#endif
+
+  uint32_t addr = bl->targetAddr;
+  uint8_t const* payload = bl->data;
+  uint32_t len = bl->payloadSize;
+
+#if TINYUF2_UF2_AES
+  if ( bl->flags & UF2_FLAG_AES ) {
+    if ( len + UF2_AES_NONCE_SIZE > sizeof(bl->data) ||
+         !uf2_aes_decrypt(addr, bl->data, len, bl->data + len) ) {
+      TUF2_LOG1("AES: invalid block %lu\r\n", bl->blockNo);
+      uf2_event(UF2_EVENT_BLOCK_INVALID, bl->blockNo);
+      return -1;
+    }
+  }
+#endif
+
+#if TINYUF2_UF2_LZ4
+  if ( bl->flags & UF2_FLAG_LZ4 ) {
+    len = lz4_decode(bl->data, bl->payloadSize, _lz4_buf, sizeof(_lz4_buf));
+    if ( len == 0 ) {
+      TUF2_LOG1("LZ4: invalid block %lu\r\n", bl->blockNo);
+      uf2_event(UF2_EVENT_BLOCK_INVALID, bl->blockNo);
+      return -1;
+    }
+    payload = _lz4_buf;
+  }
+#endif
+
+  // payload can be up to 476 bytes and cross flash page/sector boundaries, backends handle
+  // the split. Word alignment is required since most parts program at least 32-bit at a time
+  if ( (len | addr) & 3 ) {
+    uf2_event(UF2_EVENT_BLOCK_INVALID, bl->blockNo);
+    return -1;
+  }
+
+#if TINYUF2_UF2_FILL
+  uint32_t fill_left = 0;
+  if ( bl->flags & UF2_FLAG_FILL ) {
+    UF2_Fill fill;
+    memcpy(&fill, payload, sizeof(fill));
+    if ( len != sizeof(UF2_Fill) || !fill.length || (fill.length & 3) || fill.length > UINT32_MAX - addr ||
+         (bl->flags & (UF2_FLAG_VERIFY | UF2_FLAG_SIGNATURE)) ) {
+      uf2_event(UF2_EVENT_BLOCK_INVALID, bl->blockNo);
+      return -1;
+    }
+    for ( uint32_t i = 0; i < sizeof(_fill_buf) / 4; i++ ) _fill_buf[i] = fill.pattern;
+    payload = (uint8_t const*) _fill_buf;
+    fill_left = fill.length;
+  }
+#endif
+
+  // block that could not be counted is not programmed either, the host is told the write failed
+  if ( bl->numBlocks && bl->blockNo < MAX_BLOCKS && !can_track_block(state, bl->blockNo) ) {
+    TUF2_LOG1("Too many partially written groups, block %lu rejected\r\n", bl->blockNo);
+    state->untracked = true;
+    return UF2_BLOCK_SIZE;
+  }
+
+#if TINYUF2_RESUME
+  if ( !(bl->flags & UF2_FLAG_VERIFY) ) {
+    if ( !state->numBlocks ) resume_start(state, bl);
+#if TINYUF2_UF2_FILL
+    resume_block(bl, addr, fill_left ? fill_left : len);
+#else
+    resume_block(bl, addr, len);
+#endif
+  }
+#endif
+
+#if TINYUF2_UF2_FILL
+  // erased range: whole erase units are erased only, without programming the erased value
+  if ( fill_left && bl->familyID == BOARD_UF2_FAMILY_ID && board_flash_erase_ahead &&
+#if BOARD_FLASH_APP_START > 0
+       addr >= BOARD_FLASH_APP_START &&
+#endif
+       _fill_buf[0] == uf2_flash_info()->erased_word ) {
+    uint32_t const erased = fill_erase(addr, fill_left);
+    addr += erased;
+    fill_left -= erased;
+  }
+#endif
+
+  // cleared by write_payload() unless payload matched flash (TINYUF2_DELTA_FLASH)
+  bool unchanged = true;
+
+#if TINYUF2_STATS
+  uint32_t const t_start = uf2_stats_now();
+#endif
+
+#if TINYUF2_UF2_FILL
+  if ( bl->flags & UF2_FLAG_FILL ) {
+    // range is programmed in chunks of the pattern, or nothing is left once erased
+    while ( fill_left ) {
+      uint32_t const count = (fill_left < sizeof(_fill_buf)) ? fill_left : sizeof(_fill_buf);
+      if ( !write_payload(state, bl, addr, payload, count, &unchanged) ) return -1;
+      addr += count;
+      fill_left -= count;
+    }
+  } else
+#endif
+  if ( !write_payload(state, bl, addr, payload, len, &unchanged) ) return -1;
+
+#if TINYUF2_STATS
+  stats_block(t_start, uf2_stats_now());
+#endif
+
+  //------------- Update written blocks -------------//
+  if ( bl->numBlocks ) {
+    // Update state num blocks if needed
+    if ( state->numBlocks != bl->numBlocks ) {
+      if ( bl->numBlocks >= MAX_BLOCKS || state->numBlocks ) {
+        state->numBlocks = 0xffffffff;
+      }
+      else {
+        state->numBlocks = bl->numBlocks;
+      }
+    }
+
+    if ( bl->blockNo < MAX_BLOCKS ) {
+      // only increase written number with new write (possibly prevent overwriting from OS)
+      if ( mark_block_written(state, bl->blockNo) ) {
+        state->numWritten++;
+
+#if TINYUF2_DELTA_FLASH
+        if (unchanged) state->numUnchanged++;
+        update_info_delta(state);
+#endif
+      }
+
+      // flush last blocks
+      // numWritten stays smaller than numBlocks if blocks are rejected, see uf2_write_finish()
+      if ( state->numWritten >= state->numBlocks ) {
+#if TINYUF2_DELTA_FLASH
+        TUF2_LOG1("Delta: %lu of %lu blocks unchanged\r\n", state->numUnchanged, state->numWritten);
+#endif
+        uf2_event(UF2_EVENT_COMPLETE, state->numBlocks);
+        file_complete(state);
+      }
+    }
+  }
+
+  return UF2_BLOCK_SIZE;
+}
+
+TUF2_HOT int uf2_write_block (uint32_t block_no, uint8_t *data, WriteState *state) {
+  int const result = write_block(block_no, data, state);
+
+#if TINYUF2_IDLE_COMPLETE
+  // valid block of the file that is not programmed (e.g unsupported family), counted once so that
+  // the file can still be completed by uf2_write_finish()
+  UF2_Block const* bl = (UF2_Block const*) data;
+  if ( result < 0 && is_uf2_block(bl) && state->numBlocks && bl->numBlocks == state->numBlocks &&
+       bl->blockNo < MAX_BLOCKS && mark_block_written(state, bl->blockNo) ) {
+    state->numRejected++;
+  }
+#endif
+
+  return result;
+}
+
+#if TINYUF2_IDLE_COMPLETE
+// Read back image written in order from application start (TINYUF2_CURRENT_CRC), true if not tracked
+static bool write_verify(void) {
+#if TINYUF2_CURRENT_CRC
+  if ( _current_crc.run_ok ) {
+    uint32_t const len = _current_crc.run_addr - BOARD_FLASH_APP_START;
+    return flash_crc32(BOARD_FLASH_APP_START, len) == _current_crc.run_crc;
+  }
+#endif
+  return true;
+}
+
+bool uf2_write_finish(WriteState *state) {
+  if ( state->aborted || !state->numBlocks || state->numWritten >= state->numBlocks ) return false;
+  if ( state->numWritten + state->numRejected < state->numBlocks ) return false;
+
+  TUF2_LOG1("Finish: %lu of %lu blocks written, %lu rejected\r\n", state->numWritten, state->numBlocks,
+            state->numRejected);
+  uf2_event(UF2_EVENT_COMPLETE, state->numBlocks);
+  file_complete(state);
+
+  if ( !state->verify && !write_verify() ) {
+    TUF2_LOG1("Finish: image does not match written payload\r\n");
+    state->aborted = true;
+    return false;
+  }
+
+  state->numWritten = state->numBlocks;
+  return true;
+}
+#endif
+
+#if TINYUF2_MULTI_SESSION
+void uf2_write_rearm(WriteState *state) {
+  memset(state, 0, sizeof(WriteState));
+#if TINYUF2_PRE_ERASE
+  memset(&_pre_erase, 0, sizeof(_pre_erase));
+#endif
+  write_session_init();
+
+  if ( board_flash_session_reset ) board_flash_session_reset();
+}
+
+bool uf2_is_reboot_marker(uint32_t block_no, uint8_t const *data) {
+  if ( block_no < FS_START_ROOTDIR_SECTOR || block_no >= FS_START_CLUSTERS_SECTOR ) return false;
+
+  for ( uint32_t i = 0; i < UF2_BLOCK_SIZE / sizeof(DirEntry); i++ ) {
+    DirEntry const* d = (DirEntry const*) data + i;
+    if ( d->name[0] == 0 ) break;
+    if ( (uint8_t) d->name[0] == 0xe5 || d->attrs == 0x0f ) continue; // deleted, long name part
+
+    if ( !memcmp(d->name, "REBOOT  ", 8) ) return true;
+  }
+
+  return false;
+}
+#endif
@@ -2,20 +2,43 @@
 
 // all https://makecode.com/_VrfEKzV4xfvq
 
+// 32x32 icons, pre-rendered from their run-length encoding: one word per column, bit n is row n
+
 // https://makecode.com/_7VxXm3JMPXfM - file
 // https://makecode.com/_LuEUCsPEKUbs - download
-const uint8_t fileLogo[] = {
-32, 32, 71, 140, 201, 151, 1, 2, 146, 1, 2, 146, 63, 2, 151, 9, 153, 9, 153, 9, 146, 1, 9, 146, 3, 9, 146, 7, 9, 137, 205, 72, 140, 206, 36, 139, 207, 18, 138, 206, 36, 139, 205, 72, 149, 7, 9, 146, 3, 9, 146, 1, 9, 153, 9, 153, 9, 153, 9, 148, 63, 2, 146, 1, 2, 146, 1, 2, 146, 201, 191, 191, 191, 174
+const uint32_t fileLogo[] = {
+  0x001ff000, 0x00101000, 0x00101000, 0x0013f000,
+  0x00120000, 0x00120000, 0x00120000, 0x00120400,
+  0x00120c00, 0x00121c00, 0x00123ffe, 0x00127ffe,
+  0x0012fffe, 0x00127ffe, 0x00123ffe, 0x00121c00,
+  0x00120c00, 0x00120400, 0x00120000, 0x00120000,
+  0x00120000, 0x0013f000, 0x00101000, 0x00101000,
+  0x001ff000, 0x00000000, 0x00000000, 0x00000000,
+  0x00000000, 0x00000000, 0x00000000, 0x00000000
 };
 
 // https://makecode.com/_9b0RcK5yRa12
-const uint8_t pendriveLogo[] = {
-32, 32, 59, 137, 215, 137, 1, 143, 1, 8, 146, 203, 149, 3, 8, 146, 3, 8, 146, 115, 8, 146, 115, 8, 146, 3, 8, 146, 3, 8, 146, 115, 8, 146, 115, 8, 146, 3, 8, 146, 3, 8, 146, 203, 149, 1, 8, 146, 1, 8, 146, 1, 120, 211, 191, 191, 191, 191, 191, 191, 191, 135
+const uint32_t pendriveLogo[] = {
+  0xfffffe00, 0x80000200, 0x80000200, 0x800003ff,
+  0x80000201, 0x80000201, 0x80000239, 0x80000239,
+  0x80000201, 0x80000201, 0x80000239, 0x80000239,
+  0x80000201, 0x80000201, 0x800003ff, 0x80000200,
+  0x80000200, 0xfffffe00, 0x00000000, 0x00000000,
+  0x00000000, 0x00000000, 0x00000000, 0x00000000,
+  0x00000000, 0x00000000, 0x00000000, 0x00000000,
+  0x00000000, 0x00000000, 0x00000000, 0x00000000
 };
 
 // https://makecode.com/_TTqbj705L4mr
-const uint8_t arrowLogo[] = {
-32, 32, 54, 137, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 151, 201, 146, 211, 142, 209, 144, 207, 146, 205, 148, 203, 150, 201, 152, 199, 154, 31, 154, 7, 154, 1, 191, 191, 191, 175
+const uint32_t arrowLogo[] = {
+  0x0003fe00, 0x0003fe00, 0x0003fe00, 0x0003fe00,
+  0x0003fe00, 0x0003fe00, 0x0003fe00, 0x0003fe00,
+  0x0003fe00, 0x0003fe00, 0x0003fe00, 0x0003fe00,
+  0x0003fe00, 0x0003fe00, 0x0003fe00, 0x007ffff0,
+  0x003fffe0, 0x001fffc0, 0x000fff80, 0x0007ff00,
+  0x0003fe00, 0x0001fc00, 0x0000f800, 0x00007000,
+  0x00002000, 0x00000000, 0x00000000, 0x00000000,
+  0x00000000, 0x00000000, 0x00000000, 0x00000000
 };
 
 const uint8_t font8[] = {
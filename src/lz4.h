@@ -0,0 +1,91 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef LZ4_H_
+#define LZ4_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+//--------------------------------------------------------------------+
+// LZ4 block (raw format) decoder for compressed uf2 payloads (TINYUF2_UF2_LZ4) and compressed
+// self-update images (TINYUF2_SELF_UPDATE_LZ4), both produced by tools/uf2lz4.py.
+// Header only since self-update applications only build port sources.
+//--------------------------------------------------------------------+
+
+// Read LZ4 length extension bytes, false if input ends before the last one
+static inline bool lz4_length(uint8_t const** in, uint8_t const* in_end, uint32_t* len) {
+  uint8_t b;
+  do {
+    if (*in >= in_end) return false;
+    b = *(*in)++;
+    *len += b;
+  } while (b == 255);
+
+  return true;
+}
+
+// Decode a LZ4 block (raw format) into out, return decoded length or 0 if malformed or larger than out_size
+static inline uint32_t lz4_decode(uint8_t const* in, uint32_t in_len, uint8_t* out, uint32_t out_size) {
+  uint8_t const* const in_end = in + in_len;
+  uint32_t pos = 0;
+
+  while (in < in_end) {
+    uint8_t const token = *in++;
+
+    // literals
+    uint32_t len = token >> 4;
+    if (len == 15 && !lz4_length(&in, in_end, &len)) return 0;
+    if (len > (uint32_t) (in_end - in) || len > out_size - pos) return 0;
+
+    memcpy(out + pos, in, len);
+    in  += len;
+    pos += len;
+
+    // last sequence has literals only
+    if (in == in_end) break;
+
+    // match: offset then length, copied byte by byte since it may overlap its own output
+    if (in_end - in < 2) return 0;
+    uint32_t const offset = in[0] | (in[1] << 8);
+    in += 2;
+    if (offset == 0 || offset > pos) return 0;
+
+    len = token & 0x0f;
+    if (len == 15 && !lz4_length(&in, in_end, &len)) return 0;
+    len += 4;
+    if (len > out_size - pos) return 0;
+
+    while (len--) {
+      out[pos] = out[pos - offset];
+      pos++;
+    }
+  }
+
+  return pos;
+}
+
+#endif
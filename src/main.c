@@ -46,34 +46,136 @@ uint8_t RGB_OFF[]           = { 0x00, 0x00, 0x00 };
 
 static volatile uint32_t _timer_count = 0;
 
+// indicator is updated from main loop, no main loop with RTOS
+#if TINYUF2_TIMER_DEFER && (CFG_TUSB_OS == OPT_OS_NONE || CFG_TUSB_OS == OPT_OS_PICO)
+  #define TIMER_DEFER 1
+static volatile bool _timer_pending = false;
+static void indicator_task(void);
+#else
+  #define TIMER_DEFER 0
+#endif
+
+#if TINYUF2_BOOT_TRACE
+  #define BOOT_TRACE(_phase) do { TINYUF2_BOOT_TRACE_PTR->_phase = board_cycle_count ? board_cycle_count() : 0; } while(0)
+#else
+  #define BOOT_TRACE(_phase) do {} while(0)
+#endif
+
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
 static bool check_dfu_mode(void);
+static void dfu_mode(void);
+
+#if TUF2_LOG && TINYUF2_LOG_DEFER
+static void log_flush(void);
+#endif
 
 int main(void) {
+#if TINYUF2_BOOT_TRACE
+  TINYUF2_BOOT_TRACE_PTR->magic = 0;
+#endif
+  BOOT_TRACE(start);
+#if TINYUF2_STATS
+  uf2_stats_mount(UF2_MOUNT_BOOT);
+#endif
+#if TINYUF2_EVENT_LOG
+  uf2_event_init();
+#endif
+
   board_init();
   if (board_init2) board_init2();
+  BOOT_TRACE(init);
   TUF2_LOG1("TinyUF2\r\n");
 
 #if TINYUF2_PROTECT_BOOTLOADER
-  board_flash_protect_bootloader(true);
+  uf2_event(UF2_EVENT_PROTECT, board_flash_protect_bootloader(true));
+#endif
+
+#if TINYUF2_STAGED_UPDATE
+  // image staged by the application replaces it before it is checked
+  uf2_staged_apply();
 #endif
 
   // if not DFU mode, jump to App
   if (!check_dfu_mode()) {
+    BOOT_TRACE(dfu_check);
     TU_LOG1("Jump to application\r\n");
+#if TUF2_LOG && TINYUF2_LOG_DEFER
+    log_flush();
+#endif
     if (board_teardown) board_teardown();
     if (board_teardown2) board_teardown2();
+#if TINYUF2_BOOT_TRACE
+    BOOT_TRACE(jump);
+    TINYUF2_BOOT_TRACE_PTR->magic = BOOT_TRACE_MAGIC;
+#endif
+    uf2_event(UF2_EVENT_APP_JUMP, BOARD_FLASH_APP_START);
     board_app_jump();
     TU_LOG1("Failed to jump\r\n");
     while (1) {}
   }
 
+  uf2_event(UF2_EVENT_DFU, 0);
+  dfu_mode();
+}
+
+#if TINYUF2_WARM_DFU
+// DFU mode entered from the running application without reset (service table dfu()), clocks and
+// power are kept as handed over when the port provides board_init_warm()
+void uf2_dfu_warm(void) {
+#if TINYUF2_EVENT_LOG
+  uf2_event_init();
+#endif
+  if (board_init_warm) {
+    board_init_warm();
+  } else {
+    board_init();
+  }
+  if (board_init2) board_init2();
+  TUF2_LOG1("TinyUF2 warm entry\r\n");
+
+#if TINYUF2_PROTECT_BOOTLOADER
+  uf2_event(UF2_EVENT_PROTECT, board_flash_protect_bootloader(true));
+#endif
+
+  uf2_event(UF2_EVENT_DFU, 1);
+  dfu_mode();
+  while (1) {}
+}
+#endif
+
+static void dfu_mode(void) {
   TUF2_LOG1("Start DFU mode\r\n");
+#if TINYUF2_CONFIG_TXT
+  uf2_config_init();
+  if (board_dfu_clock_boost && uf2_config()->clock_boost) board_dfu_clock_boost();
+#else
+  if (board_dfu_clock_boost) board_dfu_clock_boost();
+#endif
   board_dfu_init();
+#if !TINYUF2_DEFER_FLASH_INIT
   board_flash_init();
   uf2_init();
+#endif
+  msc_init();
+#if TINYUF2_FAST_MOUNT
+  usb_desc_init();
+#endif
+
+#if TINYUF2_SD_FLASH
+  // firmware found on SD card is flashed without usb host
+  if (uf2_sd_flash()) board_dfu_complete();
+#endif
+
+#if TINYUF2_ARENA_SIZE
+  // SD card buffers are no longer needed, arena is reused by usb
+  uf2_arena_phase(UF2_PHASE_USB);
+#endif
+
+#if TINYUF2_PROFILE
+  uf2_profile_start();
+#endif
 
   tud_init(BOARD_TUD_RHPORT);
 
@@ -87,22 +189,111 @@ int main(void) {
 #if CFG_TUSB_OS == OPT_OS_NONE || CFG_TUSB_OS == OPT_OS_PICO
   while(1) {
     tud_task();
+
+#if TINYUF2_DEFER_FLASH_INIT
+    // usb is up, nothing below may touch flash before it is
+    if ( uf2_deferred_init_task() ) continue;
+#endif
+
+#if TIMER_DEFER
+    indicator_task();
+#endif
+
+    // any work left that does not wait for a usb event
+    bool busy = false;
+#if TINYUF2_ASYNC_WRITE || TINYUF2_PRE_ERASE || TINYUF2_IDLE_COMPLETE
+    // program queued uf2 blocks (or erase ahead) while usb hardware receives the next transfer
+    busy |= msc_write_task();
+#endif
+#if TINYUF2_READ_AHEAD
+    // read the next span of a sequential read while usb sends the current one
+    busy |= msc_read_task();
+#endif
+#if TINYUF2_UAS
+    busy |= uas_task();
+#endif
+#if CFG_TUD_VENDOR
+    busy |= vendor_task();
+#endif
+#if CFG_TUD_DFU
+    busy |= dfu_task();
+#endif
+#if CFG_TUD_CDC
+    busy |= cdc_task();
+#endif
+#if TINYUF2_LOG_DEFER
+    busy |= log_task();
+#endif
+#if TINYUF2_PROFILE
+    busy |= profile_task();
+#endif
+#if TINYUF2_IDLE_HASH
+    // hash flash only when nothing else is going on, one step per pass
+    if ( !busy && !tud_task_event_ready() ) busy = uf2_hash_task();
+#endif
+
+#if TINYUF2_IDLE_SLEEP
+    if ( !busy ) board_idle();
+#else
+    (void) busy;
+#endif
   }
 #endif
 }
 
+#if TINYUF2_DEFER_FLASH_INIT
+static volatile bool _flash_ready = false;
+
+bool uf2_flash_ready(void) {
+  return _flash_ready;
+}
+
+bool uf2_deferred_init_task(void) {
+  if ( _flash_ready ) return false;
+
+  board_flash_init();
+  uf2_init();
+  _flash_ready = true;
+  return true;
+}
+#endif
+
 // return true if start DFU mode, else App mode
 static bool check_dfu_mode(void) {
+#if TINYUF2_DBL_TAP_DFU
+  uf2_event(UF2_EVENT_DBL_TAP, TINYUF2_DBL_TAP_REG);
+#endif
+
+#if TINYUF2_WARM_DFU && TINYUF2_DBL_TAP_DFU
+  // application asked for DFU directly, skip app checks (e.g footer CRC) and double tap window
+  if (TINYUF2_DBL_TAP_REG == DBL_TAP_MAGIC_WARM) {
+    TUF2_LOG1("Warm DFU\r\n");
+    TINYUF2_DBL_TAP_REG = 0;
+    return true;
+  }
+#endif
+
   // Check if app is valid
   if (!board_app_valid()) {
     TUF2_LOG1("App invalid\r\n");
+    uf2_event(UF2_EVENT_APP_INVALID, 0);
     return true;
   }
   if (board_app_valid2 && !board_app_valid2()) {
     TUF2_LOG1("App invalid\r\n");
+    uf2_event(UF2_EVENT_APP_INVALID, 1);
     return true;
   }
 
+#if TINYUF2_APP_FOOTER
+  // footer is only written once flashing completed
+  if (!uf2_app_footer_valid(TINYUF2_APP_FOOTER == 2)) {
+    TUF2_LOG1("App footer invalid\r\n");
+    uf2_event(UF2_EVENT_APP_INVALID, 2);
+    return true;
+  }
+#endif
+
 #if TINYUF2_DBL_TAP_DFU
    TUF2_LOG1_HEX(TINYUF2_DBL_TAP_REG);
 
@@ -119,6 +310,14 @@ static bool check_dfu_mode(void) {
       TINYUF2_DBL_TAP_REG = 0;
       return true;
 
+#if TINYUF2_RAW_LUN
+    case DBL_TAP_MAGIC_RAW_LUN:
+      TUF2_LOG1("Raw flash LUN\r\n");
+      TINYUF2_DBL_TAP_REG = 0;
+      msc_raw_lun_enable();
+      return true;
+#endif
+
     case DBL_TAP_MAGIC_ERASE_APP:
       TUF2_LOG1("Erase app\r\n");
       TINYUF2_DBL_TAP_REG = 0;
@@ -134,6 +333,10 @@ static bool check_dfu_mode(void) {
   // Register our first reset for double reset detection
   TINYUF2_DBL_TAP_REG = DBL_TAP_MAGIC;
 
+#if TINYUF2_DBL_TAP_DEFERRED
+  // application clears the register when the double tap window has passed
+  return false;
+#else
   _timer_count = 0;
   board_timer_start(1);
 
@@ -153,6 +356,7 @@ static bool check_dfu_mode(void) {
   board_led_write(0x00);
 
   TINYUF2_DBL_TAP_REG = 0;
+#endif
 #endif
 
   return false;
@@ -164,6 +368,9 @@ static bool check_dfu_mode(void) {
 
 // Invoked when device is plugged and configured
 void tud_mount_cb(void) {
+#if TINYUF2_STATS
+  uf2_stats_mount(UF2_MOUNT_CONFIGURED);
+#endif
   indicator_set(STATE_USB_PLUGGED);
 }
 
@@ -176,32 +383,52 @@ void tud_umount_cb(void) {
 // Indicator
 //--------------------------------------------------------------------+
 
+// timer interval while writing, also the resolution of TINYUF2_IDLE_COMPLETE
+#define INDICATOR_WRITING_MS  25
+
 static uint32_t indicator_state = STATE_BOOTLOADER_STARTED;
 static uint8_t indicator_rgb[3];
 
+// color last sent to the strip, a strip update can be costly (bit-banged or RMT transaction) and is
+// skipped when the color does not change
+static uint8_t indicator_rgb_shown[3];
+static bool indicator_rgb_valid = false;
+
+static void indicator_rgb_write(uint8_t const rgb[3]) {
+  if (indicator_rgb_valid && 0 == memcmp(indicator_rgb_shown, rgb, 3)) return;
+
+  memcpy(indicator_rgb_shown, rgb, 3);
+  indicator_rgb_valid = true;
+  board_rgb_write(rgb);
+}
+
 void indicator_set(uint32_t state) {
   indicator_state = state;
   switch (state) {
     case STATE_USB_UNPLUGGED:
       board_timer_start(1);
       memcpy(indicator_rgb, RGB_USB_UNMOUNTED, 3);
-      board_rgb_write(indicator_rgb);
+      indicator_rgb_write(indicator_rgb);
       break;
 
     case STATE_USB_PLUGGED:
       board_timer_start(5);
       memcpy(indicator_rgb, RGB_USB_MOUNTED, 3);
-      board_rgb_write(indicator_rgb);
+      indicator_rgb_write(indicator_rgb);
       break;
 
     case STATE_WRITING_STARTED:
-      board_timer_start(25);
+      board_timer_start(INDICATOR_WRITING_MS);
       memcpy(indicator_rgb, RGB_WRITING, 3);
+#if !TINYUF2_RGB_WRITING_BLINK
+      // solid while writing, strip is not touched from timer
+      indicator_rgb_write(indicator_rgb);
+#endif
       break;
 
     case STATE_WRITING_FINISHED:
       board_timer_stop();
-      board_rgb_write(RGB_WRITING);
+      indicator_rgb_write(RGB_WRITING);
       break;
 
     default:
@@ -209,15 +436,14 @@ void indicator_set(uint32_t state) {
   }
 }
 
-void board_timer_handler(void) {
-  _timer_count++;
-
+// update indicator for current tick
+static void indicator_tick(uint32_t count) {
   switch (indicator_state) {
     case STATE_USB_UNPLUGGED:
     case STATE_USB_PLUGGED: {
       // Fading with LED TODO option to skip for unsupported MCUs
-      uint8_t duty = _timer_count & 0xff;
-      if (_timer_count & 0x100) duty = 255 - duty;
+      uint8_t duty = count & 0xff;
+      if (count & 0x100) duty = 255 - duty;
       board_led_write(duty);
 
       // Skip RGB fading since it is too similar to CircuitPython
@@ -229,13 +455,15 @@ void board_timer_handler(void) {
 
     case STATE_WRITING_STARTED: {
       // Fast toggle with both LED and RGB
-      bool is_on = _timer_count & 0x01;
+      bool is_on = count & 0x01;
 
       // fast blink LED if available
       board_led_write(is_on ? 0xff : 0x000);
 
+#if TINYUF2_RGB_WRITING_BLINK
       // blink RGB if available
-      board_rgb_write(is_on ? indicator_rgb : RGB_OFF);
+      indicator_rgb_write(is_on ? indicator_rgb : RGB_OFF);
+#endif
       break;
     }
 
@@ -244,6 +472,29 @@ void board_timer_handler(void) {
   }
 }
 
+void board_timer_handler(void) {
+  _timer_count++;
+
+#if TINYUF2_IDLE_COMPLETE
+  if (indicator_state == STATE_WRITING_STARTED) msc_write_idle_tick(INDICATOR_WRITING_MS);
+#endif
+
+#if TIMER_DEFER
+  _timer_pending = true;
+#else
+  indicator_tick(_timer_count);
+#endif
+}
+
+#if TIMER_DEFER
+// ticks elapsed since last iteration are coalesced into one update
+static void indicator_task(void) {
+  if ( !_timer_pending ) return;
+  _timer_pending = false;
+  indicator_tick(_timer_count);
+}
+#endif
+
 //--------------------------------------------------------------------+
 // Logger newlib retarget
 //--------------------------------------------------------------------+
@@ -260,9 +511,97 @@ TU_ATTR_USED int _write (int fhdl, const void *buf, size_t count) {
 #if defined(LOGGER_RTT)
   SEGGER_RTT_Write(0, (char*) buf, (int) count);
   return count;
+#elif TINYUF2_CDC_LOG
+  return cdc_log_write(buf, count);
 #else
   return board_uart_write(buf, count);
 #endif
 }
 
 #endif
+
+//--------------------------------------------------------------------+
+// Deferred log
+//--------------------------------------------------------------------+
+
+#if TUF2_LOG && TINYUF2_LOG_DEFER
+#include <stdarg.h>
+
+#define LOG_DEFER_ARGS 5
+
+TU_VERIFY_STATIC((TINYUF2_LOG_DEFER_COUNT & (TINYUF2_LOG_DEFER_COUNT - 1)) == 0, "TINYUF2_LOG_DEFER_COUNT must be power of 2");
+
+typedef struct {
+  char const* format;
+  uint32_t args[LOG_DEFER_ARGS];
+} log_entry_t;
+
+// single producer (TUF2_LOG) single consumer (log_task), indices are free running
+static struct {
+  log_entry_t entries[TINYUF2_LOG_DEFER_COUNT];
+  volatile uint32_t wr;
+  volatile uint32_t rd;
+  uint32_t dropped;
+} _log;
+
+int tuf2_log_defer(char const* format, ...) {
+#if TINYUF2_CONFIG_TXT
+  // muted by log = 0 in CONFIG.TXT, output before uf2_config_init() is kept
+  if ( uf2_config()->magic == CONFIG_MAGIC && !uf2_config()->log ) return 0;
+#endif
+
+  if ( _log.wr - _log.rd >= TINYUF2_LOG_DEFER_COUNT ) {
+    _log.dropped++;
+    return 0;
+  }
+
+  log_entry_t* entry = &_log.entries[_log.wr & (TINYUF2_LOG_DEFER_COUNT - 1)];
+  entry->format = format;
+
+  // only fetch as many arguments as there are conversions
+  uint32_t count = 0;
+  for ( char const* p = format; *p && count < LOG_DEFER_ARGS; p++ ) {
+    if ( *p != '%' ) continue;
+    if ( *(p + 1) == '%' ) {
+      p++;
+    } else {
+      count++;
+    }
+  }
+
+  va_list ap;
+  va_start(ap, format);
+  for ( uint32_t i = 0; i < count; i++ ) {
+    entry->args[i] = va_arg(ap, uint32_t);
+  }
+  va_end(ap);
+
+  _log.wr++;
+  return 0;
+}
+
+static void log_print(void) {
+  log_entry_t const* entry = &_log.entries[_log.rd & (TINYUF2_LOG_DEFER_COUNT - 1)];
+  printf(entry->format, entry->args[0], entry->args[1], entry->args[2], entry->args[3], entry->args[4]);
+  _log.rd++;
+
+  if ( _log.dropped && _log.rd == _log.wr ) {
+    printf("%lu log entries dropped\r\n", _log.dropped);
+    _log.dropped = 0;
+  }
+}
+
+static void log_flush(void) {
+  while ( _log.rd != _log.wr ) log_print();
+}
+#endif
+
+bool log_task(void) {
+#if TUF2_LOG && TINYUF2_LOG_DEFER
+  // output may block (uart), only print one entry when there is no pending usb event
+  if ( !tud_task_event_ready() && _log.rd != _log.wr ) log_print();
+  return _log.rd != _log.wr;
+#else
+  return false;
+#endif
+}
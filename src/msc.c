@@ -24,6 +24,7 @@
 
 #include "tusb.h"
 #include "uf2.h"
+#include "spsc.h"
 
 //--------------------------------------------------------------------+
 // MACRO TYPEDEF CONSTANT ENUM
@@ -35,7 +36,381 @@
 static uint32_t _write_ms;
 #endif
 
-static WriteState _wr_state = {0};
+// read/write callbacks always work on whole sectors
+TU_VERIFY_STATIC(CFG_TUD_MSC_BUFSIZE % CFG_UF2_SECTOR_SIZE == 0, "MSC buffer must hold whole sectors");
+
+TUF2_DFU_NOINIT static WriteState _wr_state;
+
+#if TINYUF2_MULTI_SESSION
+static uint32_t _files_done = 0;      // files completed without reset
+static bool _reboot_pending = false;  // REBOOT file created, reset once the WRITE10 is done
+#endif
+
+// Program uf2 block at disk position block (512-byte units), non-uf2 block is kept by the write overlay
+static int write_uf2_block(uint32_t block, uint8_t* data) {
+  int const result = uf2_write_block(block / UF2_BLOCKS_PER_SECTOR, data, &_wr_state);
+#if TINYUF2_WRITE_OVERLAY
+  if (result < 0) uf2_overlay_write(block, data);
+#endif
+#if TINYUF2_MULTI_SESSION
+  if (result < 0 && uf2_is_reboot_marker(block / UF2_BLOCKS_PER_SECTOR, data)) _reboot_pending = true;
+#endif
+#if TINYUF2_CONFIG_TXT
+  // saved copy of CONFIG.TXT, wherever the host put it
+  if (result < 0) (void) uf2_config_parse(data, UF2_BLOCK_SIZE);
+#endif
+  return result;
+}
+
+#if TINYUF2_WRITE_TRACE
+static struct {
+  msc_trace_t runs[TINYUF2_WRITE_TRACE];
+  uint32_t count;
+  uint32_t dropped;
+  bool new_cmd;   // next block starts a WRITE10 command
+} _trace;
+
+// Record block accepted from host, extending the last run if contiguous
+static void trace_block(uint32_t block, uint8_t const* data) {
+  UF2_Block const* bl = (UF2_Block const*) data;
+  bool const is_uf2 = bl->magicStart0 == UF2_MAGIC_START0 && bl->magicStart1 == UF2_MAGIC_START1 &&
+                      bl->magicEnd == UF2_MAGIC_END;
+  uint32_t const uf2_block = is_uf2 ? bl->blockNo : MSC_TRACE_NOT_UF2;
+  bool const new_cmd = _trace.new_cmd;
+  _trace.new_cmd = false;
+
+  if (_trace.count && !_trace.dropped && !new_cmd) {
+    msc_trace_t* run = &_trace.runs[_trace.count - 1];
+    bool const next = is_uf2 ? (run->uf2_block != MSC_TRACE_NOT_UF2 && uf2_block == run->uf2_block + run->count)
+                             : (run->uf2_block == MSC_TRACE_NOT_UF2);
+    if (next && block == run->block + run->count && run->count < UINT16_MAX) {
+      run->count++;
+      return;
+    }
+  }
+
+  if (_trace.count < TINYUF2_WRITE_TRACE) {
+    _trace.runs[_trace.count++] = (msc_trace_t) {
+      .block = block, .uf2_block = uf2_block, .count = 1, .flags = new_cmd ? MSC_TRACE_FLAG_CMD : 0
+    };
+  } else {
+    _trace.dropped++;
+  }
+}
+
+uint32_t msc_write_trace(msc_trace_t const** runs, uint32_t* dropped) {
+  *runs = _trace.runs;
+  *dropped = _trace.dropped;
+  return _trace.count;
+}
+#endif
+
+#if TINYUF2_ASYNC_WRITE
+// Number of 512-byte uf2 blocks that can be queued, default to double buffering of the MSC buffer
+#ifndef TINYUF2_ASYNC_WRITE_DEPTH
+#define TINYUF2_ASYNC_WRITE_DEPTH  (2*CFG_TUD_MSC_BUFSIZE/512)
+#endif
+
+#if TINYUF2_ASYNC_WRITE_DEPTH & (TINYUF2_ASYNC_WRITE_DEPTH - 1)
+  #error "TINYUF2_ASYNC_WRITE_DEPTH must be a power of 2"
+#endif
+
+// Write queue is filled by WRITE10 callback and drained by msc_write_task() through a SPSC ring
+// (src/spsc.h). Both run in the same (usb) thread context, which also lets the callback drain the
+// oldest block itself when the queue is full.
+typedef struct {
+  uint32_t block; // disk position in 512-byte units
+  uint8_t data[512] TU_ATTR_ALIGNED(4);
+} write_queue_item_t;
+
+#if TINYUF2_ARENA_SIZE
+// taken from the arena on first write (usb phase), blocks are programmed in place if it does not fit
+static write_queue_item_t* _wr_queue = NULL;
+
+static bool write_queue_ready(void) {
+  static bool allocated = false;
+  if (!allocated) {
+    allocated = true;
+    _wr_queue = uf2_arena_alloc(TINYUF2_ASYNC_WRITE_DEPTH * sizeof(write_queue_item_t));
+  }
+  return _wr_queue != NULL;
+}
+#else
+TUF2_DFU_NOINIT static write_queue_item_t _wr_queue[TINYUF2_ASYNC_WRITE_DEPTH];
+
+static inline bool write_queue_ready(void) {
+  return true;
+}
+#endif
+static spsc_ring_t _wr_ring = { .mask = TINYUF2_ASYNC_WRITE_DEPTH - 1 };
+
+static inline uint32_t write_queue_count(void) {
+  return spsc_count(&_wr_ring);
+}
+
+// program the oldest queued block
+static void write_queue_pop(void) {
+  write_queue_item_t* item = &_wr_queue[spsc_read_slot(&_wr_ring)];
+  (void) write_uf2_block(item->block, item->data);
+  uf2_write_commit();
+  spsc_read_release(&_wr_ring);
+}
+#endif
+
+static void write_progress_check(void);
+
+void msc_init(void) {
+  // not zeroed by the C runtime (TUF2_DFU_NOINIT)
+  memset(&_wr_state, 0, sizeof(_wr_state));
+}
+
+// Program everything received so far: queued blocks, then port and family caches
+static void write_flush(void) {
+#if TINYUF2_ASYNC_WRITE
+  while (write_queue_count()) write_queue_pop();
+#endif
+  uf2_flush();
+#if TINYUF2_DATA_LUN
+  (void) data_lun_flush();
+#endif
+
+#if TINYUF2_IDLE_COMPLETE
+  // host is done for now, file is complete if only rejected blocks are missing
+  (void) uf2_write_finish(&_wr_state);
+#endif
+
+  // queue may have held the last blocks of the file
+  write_progress_check();
+}
+
+#if TINYUF2_IDLE_COMPLETE
+// ms since last WRITE10 callback, advanced from timer interrupt
+static volatile uint32_t _wr_idle_ms = 0;
+
+void msc_write_idle_tick(uint32_t ms) {
+  _wr_idle_ms += ms;
+}
+#endif
+
+// A uf2 block split across WRITE10 callbacks (odd host transfer boundaries or nonzero offset)
+// is reassembled here before being processed.
+static struct {
+  uint32_t block; // disk position of the block, in 512-byte units
+  uint32_t len;   // bytes received so far, 0 if none
+  uint8_t data[UF2_BLOCK_SIZE] TU_ATTR_ALIGNED(4);
+} _wr_partial;
+
+// Host pause (TINYUF2_IDLE_COMPLETE timer) after which cached data is committed while power is low.
+// Port caches commit completed erase units on their own
+#define POWER_LOW_COMMIT_MS  25
+
+// board_power_low() with transitions passed on to board_flash_power_save()
+static bool power_low(void) {
+  static bool low = false;
+  bool const now_low = board_power_low && board_power_low();
+
+  if (now_low != low) {
+    low = now_low;
+    if (low) {
+      TUF2_LOG1("Power low\r\n");
+    } else {
+      TUF2_LOG1("Power ok\r\n");
+    }
+    if (board_flash_power_save) board_flash_power_save(low);
+  }
+
+  return low;
+}
+
+// Process a complete 512-byte block, return false if uf2_write_block() is busy
+static bool write_block(uint32_t block, uint8_t* data) {
+  // flash power save follows supply before anything is programmed
+  (void) power_low();
+
+#if TINYUF2_ASYNC_WRITE
+  if (write_queue_ready()) {
+    // Returning less than bufsize would make tinyusb re-invoke this callback immediately without
+    // letting msc_write_task() run, therefore program the oldest block in place when queue is full.
+    if (write_queue_count() >= TINYUF2_ASYNC_WRITE_DEPTH) {
+      write_queue_pop();
+    }
+
+    write_queue_item_t* item = &_wr_queue[spsc_write_slot(&_wr_ring)];
+    item->block = block;
+    memcpy(item->data, data, UF2_BLOCK_SIZE);
+    spsc_write_commit(&_wr_ring);
+#if TINYUF2_WRITE_TRACE
+    trace_block(block, data);
+#endif
+    return true;
+  }
+#endif
+
+  // Consider non-uf2 block write as successful
+  // only busy with flashing if write_block returns 0
+  if (0 == write_uf2_block(block, data)) return false;
+#if TINYUF2_WRITE_TRACE
+  trace_block(block, data);
+#endif
+  return true;
+}
+
+#if TINYUF2_DATA_LUN
+// LUN 1 is the data region of the port with its own sector cache, see src/data_lun.c
+#define MSC_DATA_LUN  1
+#endif
+
+#if TINYUF2_RAW_LUN
+// Next LUN maps flash from BOARD_FLASH_APP_START 1:1 without uf2 wrapping, only present when DFU mode
+// is entered with DBL_TAP_MAGIC_RAW_LUN. Writes go through board_flash_write() and its caches.
+#define MSC_RAW_LUN   (1 + TINYUF2_DATA_LUN)
+
+static bool _raw_lun_enabled = false;
+static bool _raw_written = false;
+
+void msc_raw_lun_enable(void) {
+  _raw_lun_enabled = true;
+}
+
+static uint32_t raw_lun_sectors(void) {
+  return (BOARD_FLASH_ADDR_ZERO + board_flash_size() - BOARD_FLASH_APP_START) / CFG_UF2_SECTOR_SIZE;
+}
+
+// Flash address of byte offset within lba, false if len bytes from there exceed the lun
+static bool raw_lun_addr(uint32_t lba, uint32_t offset, uint32_t len, uint32_t* addr) {
+  uint32_t const size = raw_lun_sectors() * CFG_UF2_SECTOR_SIZE;
+  if (lba >= raw_lun_sectors()) return false;
+
+  uint32_t const pos = lba * CFG_UF2_SECTOR_SIZE + offset;
+  if (pos > size || len > size - pos) return false;
+
+  *addr = BOARD_FLASH_APP_START + pos;
+  return true;
+}
+
+#endif
+
+#if TINYUF2_RAW_LUN || TINYUF2_DATA_LUN
+// Invoked when received GET_MAX_LUN request, return number of LUNs
+uint8_t tud_msc_get_maxlun_cb(void) {
+#if TINYUF2_RAW_LUN
+  if (_raw_lun_enabled) return 2 + TINYUF2_DATA_LUN;
+#endif
+  return 1 + TINYUF2_DATA_LUN;
+}
+#endif
+
+// Fill data with count sectors from lba of lun, false if out of range
+static bool read_sectors(uint8_t lun, uint32_t lba, uint32_t count, uint8_t* data) {
+#if TINYUF2_DATA_LUN
+  if (lun == MSC_DATA_LUN) return data_lun_read(lba, 0, data, count * CFG_UF2_SECTOR_SIZE);
+#endif
+#if TINYUF2_RAW_LUN
+  if (lun == MSC_RAW_LUN) {
+    uint32_t addr;
+    if (!raw_lun_addr(lba, 0, count * CFG_UF2_SECTOR_SIZE, &addr)) return false;
+    board_flash_read(addr, data, count * CFG_UF2_SECTOR_SIZE);
+    return true;
+  }
+#endif
+#if !TINYUF2_RAW_LUN && !TINYUF2_DATA_LUN
+  (void) lun;
+#endif
+
+  // fill all whole sectors of the buffer at once, region dispatch is done per span
+  uf2_read_blocks(lba, count, data);
+  return true;
+}
+
+void const* msc_read_mapped(uint8_t lun, uint32_t lba, uint32_t offset, uint32_t len) {
+#if TINYUF2_DEFER_FLASH_INIT
+  if (!uf2_flash_ready()) return NULL;
+#endif
+#if TINYUF2_DATA_LUN
+  if (lun == MSC_DATA_LUN) return NULL;
+#endif
+#if TINYUF2_RAW_LUN
+  if (lun == MSC_RAW_LUN) {
+    uint32_t addr;
+    if (!board_flash_mapped || !raw_lun_addr(lba, offset, len, &addr)) return NULL;
+    return board_flash_mapped(addr, len);
+  }
+#endif
+#if !TINYUF2_RAW_LUN && !TINYUF2_DATA_LUN
+  (void) lun;
+#endif
+
+  if (offset || (len % CFG_UF2_SECTOR_SIZE)) return NULL;
+  return uf2_read_mapped(lba, len / CFG_UF2_SECTOR_SIZE);
+}
+
+#if TINYUF2_READ_AHEAD
+// A READ10 callback continuing where the previous one ended is sequential: the span following it is
+// read by msc_read_task() into _ra_buf while usb sends the current one, the next callback only copies
+// it. Any WRITE10 drops the prefetched span.
+static struct {
+  uint32_t lba;     // first sector of prefetched span
+  uint32_t count;   // sectors in _ra_buf, 0 if none
+  uint32_t next;    // sector following the last READ10 callback
+  uint32_t span;    // sectors of the last READ10 callback
+  uint8_t  lun;
+  bool     pending; // prefetch of next requested
+} _ra;
+
+#if TINYUF2_ARENA_SIZE
+// taken from the arena on first read (usb phase), no read-ahead if it does not fit
+static uint8_t* _ra_buf = NULL;
+
+static bool read_ahead_ready(void) {
+  static bool allocated = false;
+  if (!allocated) {
+    allocated = true;
+    _ra_buf = uf2_arena_alloc(CFG_TUD_MSC_BUFSIZE);
+  }
+  return _ra_buf != NULL;
+}
+#else
+TUF2_DFU_NOINIT static uint8_t _ra_buf[CFG_TUD_MSC_BUFSIZE] TU_ATTR_ALIGNED(4);
+
+static inline bool read_ahead_ready(void) {
+  return true;
+}
+#endif
+
+// Serve a READ10 callback from the prefetched span if it matches, then schedule the next one
+static bool read_ahead(uint8_t lun, uint32_t lba, uint32_t count, uint8_t* data) {
+  bool const hit = _ra.count && (_ra.lun == lun) && (_ra.lba == lba) && (_ra.count >= count);
+  bool const sequential = (_ra.lun == lun) && (_ra.next == lba);
+
+  if (hit) memcpy(data, _ra_buf, count * CFG_UF2_SECTOR_SIZE);
+
+  _ra.count = 0;
+  _ra.lun = lun;
+  _ra.next = lba + count;
+  _ra.span = count;
+#if TINYUF2_CONFIG_TXT
+  _ra.pending = sequential && uf2_config()->read_ahead && read_ahead_ready();
+#else
+  _ra.pending = sequential && read_ahead_ready();
+#endif
+
+  return hit;
+}
+
+#endif
+
+bool msc_read_task(void) {
+#if TINYUF2_READ_AHEAD
+  if (_ra.pending) {
+    _ra.pending = false;
+    if (read_sectors(_ra.lun, _ra.next, _ra.span, _ra_buf)) {
+      _ra.lba = _ra.next;
+      _ra.count = _ra.span;
+    }
+  }
+#endif
+  return false;
+}
 
 //--------------------------------------------------------------------+
 // tinyusb callbacks
@@ -50,24 +425,133 @@ void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16
   const char pid[] = "UF2 Bootloader";
   const char rev[] = "1.0";
 
+#if TINYUF2_DATA_LUN
+  if (lun == MSC_DATA_LUN) {
+    const char data_pid[] = "UF2 Data";
+    memcpy(vendor_id, vid, strlen(vid));
+    memcpy(product_id, data_pid, strlen(data_pid));
+    memcpy(product_rev, rev, strlen(rev));
+    return;
+  }
+#endif
+
+#if TINYUF2_RAW_LUN
+  if (lun == MSC_RAW_LUN) {
+    const char raw_pid[] = "UF2 Raw Flash";
+    memcpy(vendor_id, vid, strlen(vid));
+    memcpy(product_id, raw_pid, strlen(raw_pid));
+    memcpy(product_rev, rev, strlen(rev));
+    return;
+  }
+#endif
+
   memcpy(vendor_id, vid, strlen(vid));
   memcpy(product_id, pid, strlen(pid));
   memcpy(product_rev, rev, strlen(rev));
 }
 
+// Sense data of a failed command for BOT (tinyusb) and UAS (TINYUF2_UAS)
+static void msc_set_sense(uint8_t lun, uint8_t sense_key, uint8_t asc, uint8_t ascq) {
+  tud_msc_set_sense(lun, sense_key, asc, ascq);
+#if TINYUF2_UAS
+  uas_set_sense(lun, sense_key, asc, ascq);
+#endif
+}
+
+#if TINYUF2_DEFER_FLASH_INIT
+// Flash is still being brought up after usb started: LOGICAL UNIT IS IN PROCESS OF BECOMING READY,
+// hosts retry TEST UNIT READY until it clears
+static bool msc_not_ready(uint8_t lun) {
+  if (uf2_flash_ready()) return false;
+  msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01);
+  return true;
+}
+#endif
+
 // Invoked when received Test Unit Ready command.
 // return true allowing host to read/write this LUN e.g SD card inserted
 bool tud_msc_test_unit_ready_cb(uint8_t lun) {
+#if TINYUF2_DEFER_FLASH_INIT
+  if (msc_not_ready(lun)) return false;
+#endif
+
+#if TINYUF2_DATA_LUN
+  // no medium if the board has no data region
+  if (lun == MSC_DATA_LUN) return data_lun_sectors() != 0;
+#else
   (void) lun;
+#endif
   return true;
 }
 
+// SBC-3 commands not defined by tinyusb
+#define SBC_CMD_SYNCHRONIZE_CACHE_10      0x35
+#define SBC_CMD_SERVICE_ACTION_IN_16      0x9E
+#define SBC_SA_READ_CAPACITY_16           0x10
+#define SBC_CMD_MODE_SENSE_10             0x5A
+
+#define SBC_MODE_PAGE_CACHING             0x08
+#define SBC_MODE_PAGE_ALL                 0x3F
+
+// Write hint in sectors: one flash erase unit. It can only be given as READ CAPACITY(16) physical block
+// size: tinyusb answers every INQUIRY itself (EVPD included), so Block Limits VPD page cannot be served
+#define MSC_ERASE_SECTORS     TU_MAX(BOARD_FLASH_ERASE_SIZE / CFG_UF2_SECTOR_SIZE, 1)
+
+static void put_be16(uint8_t* p, uint16_t value) {
+  p[0] = (uint8_t) (value >> 8);
+  p[1] = (uint8_t) value;
+}
+
+static void put_be32(uint8_t* p, uint32_t value) {
+  put_be16(p, (uint16_t) (value >> 16));
+  put_be16(p + 2, (uint16_t) value);
+}
+
+// READ CAPACITY(16) also reports the erase unit as physical block size
+static int32_t scsi_read_capacity16(uint8_t lun, uint8_t resp[32]) {
+  uint32_t block_count;
+  uint16_t block_size;
+  tud_msc_capacity_cb(lun, &block_count, &block_size);
+  if (block_count == 0) return -1;
+
+  memset(resp, 0, 32);
+  put_be32(resp + 4, block_count - 1);      // last LBA, upper 32 bits are 0
+  put_be32(resp + 8, CFG_UF2_SECTOR_SIZE);
+  resp[13] = (uint8_t) __builtin_ctz(MSC_ERASE_SECTORS); // logical blocks per physical block exponent
+  return 32;
+}
+
+#if TINYUF2_FAST_MOUNT
+// MODE SENSE(10) with caching page, so that hosts probing it do not fall back to retries and defaults
+// before mounting. Write cache is reported enabled: data is only guaranteed on flash after SYNCHRONIZE CACHE
+static int32_t scsi_mode_sense10(uint8_t lun, uint8_t const scsi_cmd[16], uint8_t resp[64]) {
+  uint8_t const page = scsi_cmd[2] & 0x3F;
+  bool const changeable = (scsi_cmd[2] >> 6) == 1;
+
+  if (page != SBC_MODE_PAGE_CACHING && page != SBC_MODE_PAGE_ALL) {
+    msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x24, 0x00);
+    return -1;
+  }
+
+  // 8-byte header without block descriptor, then 20-byte caching page
+  memset(resp, 0, 8 + 20);
+  put_be16(resp, 8 + 20 - 2);   // mode data length
+  resp[8] = SBC_MODE_PAGE_CACHING;
+  resp[9] = 0x12;
+  if (!changeable) resp[10] = 0x04; // WCE
+
+  uint16_t const alloc_len = (uint16_t) ((scsi_cmd[7] << 8) | scsi_cmd[8]);
+  return TU_MIN(8 + 20, alloc_len);
+}
+#endif
+
 // Callback invoked when received an SCSI command not in built-in list below
 // - READ_CAPACITY10, READ_FORMAT_CAPACITY, INQUIRY, MODE_SENSE6, REQUEST_SENSE
 // - READ10 and WRITE10 has their own callbacks
 int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, uint16_t bufsize) {
+  uint8_t resp[64];
   void const* response = NULL;
-  uint16_t resplen = 0;
+  int32_t resplen = 0;
 
   // most scsi handled is input
   bool in_xfer = true;
@@ -78,9 +562,32 @@ int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, u
       resplen = 0;
       break;
 
+    case SBC_CMD_SYNCHRONIZE_CACHE_10:
+      // host expects written data to be on the medium when this completes
+      write_flush();
+      resplen = 0;
+      break;
+
+    case SBC_CMD_SERVICE_ACTION_IN_16:
+      if ((scsi_cmd[1] & 0x1F) == SBC_SA_READ_CAPACITY_16) {
+        resplen = scsi_read_capacity16(lun, resp);
+        response = resp;
+      } else {
+        msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x24, 0x00);
+        resplen = -1;
+      }
+      break;
+
+#if TINYUF2_FAST_MOUNT
+    case SBC_CMD_MODE_SENSE_10:
+      resplen = scsi_mode_sense10(lun, scsi_cmd, resp);
+      response = resp;
+      break;
+#endif
+
     default:
       // Set Sense = Invalid Command Operation
-      tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
+      msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
 
       // negative means error -> tinyusb could stall and/or response with failed status
       resplen = -1;
@@ -104,50 +611,218 @@ int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, u
 // Callback invoked when received READ10 command.
 // Copy disk's data to buffer (up to bufsize) and return number of copied bytes.
 int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
-  (void) lun;
-  memset(buffer, 0, bufsize);
+#if TINYUF2_DEFER_FLASH_INIT
+  if (msc_not_ready(lun)) return -1;
+#endif
+
+#if TINYUF2_DATA_LUN
+  if (lun == MSC_DATA_LUN && (offset || (bufsize % CFG_UF2_SECTOR_SIZE))) {
+    return data_lun_read(lba, offset, buffer, bufsize) ? (int32_t) bufsize : -1;
+  }
+#endif
+#if TINYUF2_RAW_LUN
+  if (lun == MSC_RAW_LUN && (offset || (bufsize % CFG_UF2_SECTOR_SIZE))) {
+    uint32_t addr;
+    if (!raw_lun_addr(lba, offset, bufsize, &addr)) return -1;
+    board_flash_read(addr, buffer, bufsize);
+    return (int32_t) bufsize;
+  }
+#endif
 
   // since we return block size each, offset should always be zero
   TU_ASSERT(offset == 0, -1);
 
+  uint32_t const count = bufsize / CFG_UF2_SECTOR_SIZE;
+#if TINYUF2_READ_AHEAD
+  if (read_ahead(lun, lba, count, buffer)) return count * CFG_UF2_SECTOR_SIZE;
+#endif
+  if (!read_sectors(lun, lba, count, buffer)) return -1;
+
+  return count * CFG_UF2_SECTOR_SIZE;
+}
+
+// Process WRITE10 data, reassembling uf2 blocks split across callbacks. Return number of consumed bytes
+static int32_t write10_process(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+  // position of buffer on disk: block index (a sector may hold several uf2 blocks) and offset within it
+  uint32_t block = lba * UF2_BLOCKS_PER_SECTOR + offset / UF2_BLOCK_SIZE;
+  uint32_t skip = offset % UF2_BLOCK_SIZE;
   uint32_t count = 0;
 
-  while (count < bufsize) {
-    uf2_read_block(lba, buffer);
+  if (_wr_partial.len) {
+    if (block == _wr_partial.block && skip == _wr_partial.len) {
+      // continue block received partially by previous callback
+      uint32_t const n = (UF2_BLOCK_SIZE - skip < bufsize) ? (UF2_BLOCK_SIZE - skip) : bufsize;
+      memcpy(_wr_partial.data + skip, buffer, n);
+      _wr_partial.len += n;
+      count = n;
+
+      if (_wr_partial.len < UF2_BLOCK_SIZE) return (int32_t) count;
+
+      // block is complete, uf2_write_block() being busy is not retried since data is consumed
+      _wr_partial.len = 0;
+      (void) write_block(block, _wr_partial.data);
+      uf2_write_commit();
+      block++;
+      skip = 0;
+    } else {
+      // not contiguous with the pending data, drop it
+      TUF2_LOG1("Drop partial block %lu\r\n", _wr_partial.block);
+      _wr_partial.len = 0;
+    }
+  }
 
-    lba++;
-    buffer += 512;
-    count += 512;
+  if (skip) {
+    // starts in the middle of a block whose head was not received, cannot be a uf2 block
+    uint32_t const n = (UF2_BLOCK_SIZE - skip < bufsize) ? (UF2_BLOCK_SIZE - skip) : bufsize;
+    count = n;
+    if (skip + n == UF2_BLOCK_SIZE) block++;
+  }
+
+  // whole blocks are processed in place
+  while (bufsize - count >= UF2_BLOCK_SIZE) {
+    if (!write_block(block, buffer + count)) break;
+    block++;
+    count += UF2_BLOCK_SIZE;
+  }
+  uf2_write_commit();
+
+  // keep the head of a block split by the transfer boundary
+  if (count < bufsize && bufsize - count < UF2_BLOCK_SIZE) {
+    _wr_partial.block = block;
+    _wr_partial.len = bufsize - count;
+    memcpy(_wr_partial.data, buffer + count, _wr_partial.len);
+    count = bufsize;
   }
 
-  return count;
+  return (int32_t) count;
 }
 
 // Callback invoked when received WRITE10 command.
 // Process data in buffer to disk's storage and return number of written bytes
 int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
-  (void) lun;
-  (void) offset;
+#if TINYUF2_DEFER_FLASH_INIT
+  if (msc_not_ready(lun)) return -1;
+#endif
 
-  uint32_t count = 0;
-  while (count < bufsize) {
-    // Consider non-uf2 block write as successful
-    // only break if write_block is busy with flashing (return 0)
-    if (0 == uf2_write_block(lba, buffer, &_wr_state)) break;
+#if TINYUF2_READ_AHEAD
+  // prefetched data may no longer match
+  _ra.count = 0;
+  _ra.pending = false;
+#endif
 
-    lba++;
-    buffer += 512;
-    count += 512;
+#if TINYUF2_DATA_LUN
+  if (lun == MSC_DATA_LUN) {
+    return data_lun_write(lba, offset, buffer, bufsize) ? (int32_t) bufsize : -1;
   }
+#endif
 
-  return count;
+#if TINYUF2_RAW_LUN
+  if (lun == MSC_RAW_LUN) {
+    uint32_t addr;
+    if (!raw_lun_addr(lba, offset, bufsize, &addr)) return -1;
+    if (!_raw_written) {
+      _raw_written = true;
+      indicator_set(STATE_WRITING_STARTED);
+    }
+    uf2_write_raw(addr, buffer, bufsize);
+    return (int32_t) bufsize;
+  }
+#endif
+
+#if TINYUF2_WRITE_TRACE
+  if (offset == 0) _trace.new_cmd = true;
+#endif
+#if TINYUF2_IDLE_COMPLETE
+  _wr_idle_ms = 0;
+#endif
+
+#if TINYUF2_STATS
+  // time since previous callback returned is spent waiting for host/bus
+  static uint32_t last_return = 0;
+  uint32_t const now = uf2_stats_now();
+  if (last_return) uf2_stats_usb_wait(now - last_return);
+
+  int32_t result = write10_process(lba, offset, buffer, bufsize);
+  last_return = uf2_stats_now();
+#else
+  int32_t result = write10_process(lba, offset, buffer, bufsize);
+#endif
+
+  // block not programmed fails the command (raised by the queue worker with TINYUF2_ASYNC_WRITE, the
+  // next command fails then): rewrite over this session's data, or one partially written group too many
+  if (_wr_state.rewriteConflict) {
+    msc_set_sense(lun, SCSI_SENSE_DATA_PROTECT, 0x27, 0x00);
+    result = -1;
+  } else if (_wr_state.untracked) {
+    msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0C, 0x00); // write error
+    result = -1;
+  }
+  _wr_state.rewriteConflict = false;
+  _wr_state.untracked = false;
+
+  return result;
 }
 
 // Callback invoked when WRITE10 command is completed (status received and accepted by host).
 void tud_msc_write10_complete_cb(uint8_t lun) {
   (void) lun;
+  write_progress_check();
+}
+
+bool msc_write_task(void) {
+#if TINYUF2_ASYNC_WRITE
+  if (write_queue_count()) {
+    // program one block per call so that tud_task() is serviced in between
+    write_queue_pop();
+    write_progress_check();
+
+    return true;
+  }
+#endif
+
+#if TINYUF2_IDLE_COMPLETE
+  if (_wr_idle_ms >= TINYUF2_IDLE_COMPLETE) {
+    _wr_idle_ms = 0;
+    write_flush();
+  }
+#endif
+
+  if (power_low()) {
+#if TINYUF2_IDLE_COMPLETE
+    // commit cached data as soon as the host pauses so that a brown-out loses the least
+    static uint32_t flushed = 0;
+    if (_wr_idle_ms >= POWER_LOW_COMMIT_MS && _wr_state.numWritten != flushed) {
+      flushed = _wr_state.numWritten;
+      uf2_flush();
+    }
+#endif
+    // no speculative erase
+    return false;
+  }
+
+#if TINYUF2_PRE_ERASE
+  // nothing to program, erase ahead while waiting for the host
+  return uf2_pre_erase_task();
+#else
+  return false;
+#endif
+}
+
+// Update indicator and complete DFU process when all blocks are written
+static void write_progress_check(void) {
   static bool first_write = true;
 
+#if TINYUF2_MULTI_SESSION
+  if (_reboot_pending) {
+    _reboot_pending = false;
+    write_flush();
+
+    TUF2_LOG1("Reboot after %lu files\r\n", _files_done);
+    indicator_set(STATE_WRITING_FINISHED);
+    board_dfu_complete();
+  }
+#endif
+
   // abort the DFU, uf2 block failed integrity check
   if (_wr_state.aborted) {
     // aborted and reset
@@ -163,8 +838,19 @@ void tud_msc_write10_complete_cb(uint8_t lun) {
       indicator_set(STATE_WRITING_STARTED);
     }
 
+#if TINYUF2_DISPLAY
+    screen_draw_progress(_wr_state.numWritten, _wr_state.numBlocks);
+#endif
+
+    if (board_write_progress) board_write_progress(_wr_state.numWritten, _wr_state.numBlocks);
+
     // All block of uf2 file is complete --> complete DFU process
-    if (_wr_state.numWritten >= _wr_state.numBlocks) {
+    // blocks still pending in the write queue are not yet accounted for
+    if (_wr_state.numWritten >= _wr_state.numBlocks
+#if TINYUF2_ASYNC_WRITE
+        && write_queue_count() == 0
+#endif
+       ) {
       #if DEBUG_SPEED_TEST
       uint32_t const wr_byte = _wr_state.numWritten*256;
       _write_ms = esp_log_timestamp()-_write_ms;
@@ -174,6 +860,24 @@ void tud_msc_write10_complete_cb(uint8_t lun) {
 
       TUF2_LOG1("Writing finished\r\n");
       indicator_set(STATE_WRITING_FINISHED);
+#if TINYUF2_DATA_LUN
+      // files copied to the data LUN must not be lost by the reset
+      (void) data_lun_flush();
+#endif
+#if TINYUF2_RAM_APP
+      if (_wr_state.ramApp) board_ram_app_start(BOARD_RAM_APP_ADDR);
+#endif
+#if TINYUF2_MULTI_SESSION
+      // next file is written as in a new session, reset is left to eject or REBOOT file
+      uf2_write_rearm(&_wr_state);
+      first_write = true;
+      _files_done++;
+      return;
+#endif
+#if TINYUF2_VERIFY_UF2
+      // nothing was programmed, stay mounted so that VERIFY.TXT can be read
+      if (_wr_state.verify) return;
+#endif
       board_dfu_complete();
 
       // board_dfu_complete() should not return
@@ -186,24 +890,61 @@ void tud_msc_write10_complete_cb(uint8_t lun) {
 // Invoked when received SCSI_CMD_READ_CAPACITY_10 and SCSI_CMD_READ_FORMAT_CAPACITY to determine the disk size
 // Application update block count and block size
 void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size) {
+#if TINYUF2_STATS
+  uf2_stats_mount(UF2_MOUNT_CAPACITY);
+#endif
+  *block_size = CFG_UF2_SECTOR_SIZE;
+#if TINYUF2_DEFER_FLASH_INIT
+  // no medium yet, READ CAPACITY fails
+  if (msc_not_ready(lun)) {
+    *block_count = 0;
+    return;
+  }
+#endif
+  *block_count = uf2_num_sectors();
+#if TINYUF2_DATA_LUN
+  if (lun == MSC_DATA_LUN) *block_count = data_lun_sectors();
+#endif
+#if TINYUF2_RAW_LUN
+  if (lun == MSC_RAW_LUN) *block_count = raw_lun_sectors();
+#endif
+#if !TINYUF2_RAW_LUN && !TINYUF2_DATA_LUN
   (void) lun;
-
-  *block_count = CFG_UF2_NUM_BLOCKS;
-  *block_size = 512;
+#endif
 }
 
 // Invoked when received Start Stop Unit command
 // - Start = 0 : stopped power mode, if load_eject = 1 : unload disk storage
 // - Start = 1 : active mode, if load_eject = 1 : load disk storage
 bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject) {
+#if !TINYUF2_RAW_LUN
   (void) lun;
+#endif
   (void) power_condition;
 
   if (load_eject) {
     if (start) {
       // load disk storage
     } else {
-      // unload disk storage
+      // unload disk storage: host is done, do not leave data in caches
+      write_flush();
+
+#if TINYUF2_MULTI_SESSION
+      if (_files_done) {
+        TUF2_LOG1("Ejected after %lu files\r\n", _files_done);
+        indicator_set(STATE_WRITING_FINISHED);
+        board_dfu_complete();
+      }
+#endif
+
+#if TINYUF2_RAW_LUN
+      // raw image is complete once its lun is ejected
+      if (lun == MSC_RAW_LUN && _raw_written) {
+        TUF2_LOG1("Raw flash ejected\r\n");
+        indicator_set(STATE_WRITING_FINISHED);
+        board_dfu_complete();
+      }
+#endif
     }
   }
 
@@ -0,0 +1,144 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Sampling profiler (TINYUF2_PROFILE)
+//
+// A periodic port interrupt (board_profile_start()) records the PC it interrupted into a ring of
+// TINYUF2_PROFILE_SAMPLES. Samples are drained as raw 32-bit little endian words over RTT up channel 1
+// (LOGGER_RTT) by profile_task(), or read with CDC_CMD_PROFILE (TINYUF2_CDC_FLASH). tools/pcprofile.py
+// symbolizes them against the ELF into a flat profile. The interrupt runs at highest priority so that
+// time spent in other interrupts (usb, flash) is sampled as well. Samples that do not fit are counted.
+//
+// On Cortex-M the port's timer handler is a naked branch to uf2_profile_isr(), which reads the PC from the
+// exception frame, calls board_profile_ack() and records it. Other cores call uf2_profile_sample()
+// with the interrupted PC (e.g mepc on RISC-V).
+//--------------------------------------------------------------------+
+
+#if TINYUF2_PROFILE
+
+#if defined(LOGGER_RTT)
+#include "SEGGER_RTT.h"
+
+#define PROFILE_RTT_CHANNEL   1
+#endif
+
+#if TINYUF2_PROFILE_SAMPLES & (TINYUF2_PROFILE_SAMPLES - 1)
+  #error "TINYUF2_PROFILE_SAMPLES must be power of 2"
+#endif
+
+// indices are free running, masked on access. Written by the interrupt, read by the main loop
+static struct {
+  volatile uint32_t wr;
+  volatile uint32_t rd;
+  volatile uint32_t dropped;
+  uint32_t pc[TINYUF2_PROFILE_SAMPLES];
+} _profile;
+
+#if defined(LOGGER_RTT)
+static uint8_t _profile_rtt[1024] __attribute__((aligned(4)));
+#endif
+
+void uf2_profile_sample(uint32_t pc) {
+  uint32_t const wr = _profile.wr;
+  if (wr - _profile.rd >= TINYUF2_PROFILE_SAMPLES) {
+    _profile.dropped++;
+    return;
+  }
+
+  _profile.pc[wr & (TINYUF2_PROFILE_SAMPLES - 1)] = pc;
+  _profile.wr = wr + 1;
+}
+
+#if defined(__ARM_ARCH_PROFILE) && (__ARM_ARCH_PROFILE == 'M')
+// frame is the exception stack frame: r0-r3, r12, lr, pc, xpsr
+__attribute__((used)) static void profile_frame(uint32_t const* frame) {
+  board_profile_ack();
+  uf2_profile_sample(frame[6]);
+}
+
+// Still on the exception entry stack, lr is EXC_RETURN: profile_frame() returns from the exception.
+// Only uses ARMv6-M instructions
+__attribute__((naked)) void uf2_profile_isr(void) {
+  __asm volatile(
+      "mov   r0, lr         \n"
+      "movs  r1, #4         \n"
+      "tst   r0, r1         \n"
+      "bne   1f             \n"
+      "mrs   r0, msp        \n"
+      "b     2f             \n"
+      "1:                   \n"
+      "mrs   r0, psp        \n"
+      "2:                   \n"
+      "ldr   r1, =profile_frame \n"
+      "bx    r1             \n"
+      ".ltorg               \n");
+}
+#endif
+
+void uf2_profile_start(void) {
+#if defined(LOGGER_RTT)
+  SEGGER_RTT_ConfigUpBuffer(PROFILE_RTT_CHANNEL, "Profile", _profile_rtt, sizeof(_profile_rtt),
+                            SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+#endif
+  board_profile_start(TINYUF2_PROFILE);
+}
+
+uint32_t uf2_profile_read(uint32_t* pc, uint32_t count, uint32_t* dropped) {
+  uint32_t const rd = _profile.rd;
+  uint32_t const avail = _profile.wr - rd;
+  if (count > avail) count = avail;
+
+  for (uint32_t i = 0; i < count; i++) {
+    pc[i] = _profile.pc[(rd + i) & (TINYUF2_PROFILE_SAMPLES - 1)];
+  }
+  _profile.rd = rd + count;
+
+  *dropped = _profile.dropped;
+  _profile.dropped = 0;
+
+  return count;
+}
+
+bool profile_task(void) {
+#if defined(LOGGER_RTT)
+  uint32_t const rd = _profile.rd;
+  uint32_t const idx = rd & (TINYUF2_PROFILE_SAMPLES - 1);
+  uint32_t count = _profile.wr - rd;
+  if (!count) return false;
+
+  // contiguous part of the ring, whole samples or nothing
+  if (count > TINYUF2_PROFILE_SAMPLES - idx) count = TINYUF2_PROFILE_SAMPLES - idx;
+  if (count > sizeof(_profile_rtt) / 8) count = sizeof(_profile_rtt) / 8;
+
+  if (SEGGER_RTT_Write(PROFILE_RTT_CHANNEL, &_profile.pc[idx], 4 * count)) _profile.rd = rd + count;
+#endif
+
+  // samples are produced continuously, never keeps the main loop busy
+  return false;
+}
+
+#endif
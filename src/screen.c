@@ -27,7 +27,6 @@
 #if TINYUF2_DISPLAY
 
 #include <string.h>
-#include <stdlib.h>
 
 // Overlap 4x chars by this much.
 #define CHAR4_KERNING 3
@@ -54,111 +53,139 @@ enum
 };
 
 // 16-bit 565 color from 24-bit 888 format
-const uint16_t palette[] = {
-  COL(0x000000), // 0
-  COL(0xffffff), // 1
-  COL(0xff2121), // 2
-  COL(0xff93c4), // 3
-  COL(0xff8135), // 4
-  COL(0xfff609), // 5
-  COL(0x249ca3), // 6
-  COL(0x78dc52), // 7
-  COL(0x003fad), // 8
-  COL(0x87f2ff), // 9
-  COL(0x8e2ec4), // 10
-
-  COL(0xa4839f), // 11
-  COL(0x5c406c), // 12
-  COL(0xe5cdc4), // 13
-  COL(0x91463d), // 14
-  COL(0x000000), // 15
+#define PAL_0   COL(0x000000)
+#define PAL_1   COL(0xffffff)
+#define PAL_2   COL(0xff2121)
+#define PAL_3   COL(0xff93c4)
+#define PAL_4   COL(0xff8135)
+#define PAL_5   COL(0xfff609)
+#define PAL_6   COL(0x249ca3)
+#define PAL_7   COL(0x78dc52)
+#define PAL_8   COL(0x003fad)
+#define PAL_9   COL(0x87f2ff)
+#define PAL_10  COL(0x8e2ec4)
+
+#define PAL_11  COL(0xa4839f)
+#define PAL_12  COL(0x5c406c)
+#define PAL_13  COL(0xe5cdc4)
+#define PAL_14  COL(0x91463d)
+#define PAL_15  COL(0x000000)
+
+// Pair of pixels (low nibble first) to two big-endian 565 colors, a column is expanded with one
+// lookup per byte of frame_buf. Built by the preprocessor so that it lives in flash.
+#define PAIR(c0, c1)  { (uint8_t) ((c0) >> 8), (uint8_t) ((c0) & 0xff), (uint8_t) ((c1) >> 8), (uint8_t) ((c1) & 0xff) }
+#define PAIR_E(h, l)  PAIR(PAL_##l, PAL_##h)
+#define PAIR_ROW(h) \
+  PAIR_E(h, 0), PAIR_E(h, 1), PAIR_E(h, 2),  PAIR_E(h, 3),  PAIR_E(h, 4),  PAIR_E(h, 5),  PAIR_E(h, 6),  PAIR_E(h, 7), \
+  PAIR_E(h, 8), PAIR_E(h, 9), PAIR_E(h, 10), PAIR_E(h, 11), PAIR_E(h, 12), PAIR_E(h, 13), PAIR_E(h, 14), PAIR_E(h, 15)
+
+// Native 565 colors, handed to board_display_expand() for its CLUT
+static const uint16_t palette[16] = {
+  PAL_0, PAL_1, PAL_2,  PAL_3,  PAL_4,  PAL_5,  PAL_6,  PAL_7,
+  PAL_8, PAL_9, PAL_10, PAL_11, PAL_12, PAL_13, PAL_14, PAL_15,
+};
+
+static const uint8_t pair_lut[256][4] = {
+  PAIR_ROW(0),  PAIR_ROW(1),  PAIR_ROW(2),  PAIR_ROW(3),  PAIR_ROW(4),  PAIR_ROW(5),  PAIR_ROW(6),  PAIR_ROW(7),
+  PAIR_ROW(8),  PAIR_ROW(9),  PAIR_ROW(10), PAIR_ROW(11), PAIR_ROW(12), PAIR_ROW(13), PAIR_ROW(14), PAIR_ROW(15),
 };
 
-// TODO only buffer partial screen to save SRAM
-// ESP32s2 can only statically allocated DRAM up to 160KB.
-// the remaining 160KB can only be allocated at runtime as heap.
-//static uint8_t frame_buf[DISPLAY_WIDTH * DISPLAY_HEIGHT];
-static uint8_t* frame_buf;
+// Screen is composed and sent in bands of columns, only a band is buffered (column-major, 4-bit palette
+// index packed two rows per byte, even row in low nibble) and the whole scene is drawn clipped to it.
+// Columns can then be redrawn on their own.
+#ifndef DISPLAY_BAND_WIDTH
+#define DISPLAY_BAND_WIDTH  16
+#endif
+
+// bytes per column, odd height is padded with one unused pixel
+#define COLUMN_BYTES  ((DISPLAY_HEIGHT + 1) / 2)
+
+TUF2_DISPLAY_RAM static uint8_t frame_buf[DISPLAY_BAND_WIDTH * COLUMN_BYTES];
+static int _band_x; // first column of band in frame_buf
+
+// Columns in display format (big-endian 565). Port may still be sending the previous column when
+// board_display_draw_line() returns, so the next one is converted into the other buffer.
+TUF2_DISPLAY_RAM static uint16_t _line_buf[2][2 * COLUMN_BYTES] __attribute__((aligned(4)));
+static uint8_t _line_idx;
+
+// Flashing progress bar along the bottom, with percentage on the right
+#define PROGRESS_H      8
+#define PROGRESS_Y      (DISPLAY_HEIGHT - PROGRESS_H)
+#define PROGRESS_TEXT_X (DISPLAY_WIDTH - 4 * 6)
+#define PROGRESS_W      (PROGRESS_TEXT_X - 2)
+
+static struct {
+  uint32_t width;   // filled columns
+  uint32_t percent;
+  bool started;
+} _progress;
 
 extern const uint8_t font8[];
-extern const uint8_t fileLogo[];
-extern const uint8_t pendriveLogo[];
-extern const uint8_t arrowLogo[];
+extern const uint32_t fileLogo[];
+extern const uint32_t pendriveLogo[];
+extern const uint32_t arrowLogo[];
+
+#define ICON_SIZE 32
+
+// column x of band, NULL if x is outside of band
+static inline uint8_t* band_column(int x) {
+  if (x < _band_x || x >= _band_x + DISPLAY_BAND_WIDTH) return NULL;
+  return frame_buf + (x - _band_x) * COLUMN_BYTES;
+}
+
+static inline void set_pixel(uint8_t* col, int y, int color) {
+  uint8_t* p = col + (y >> 1);
+  if (y & 1) {
+    *p = (uint8_t) ((*p & 0x0f) | (color << 4));
+  } else {
+    *p = (uint8_t) ((*p & 0xf0) | color);
+  }
+}
+
+// fill rows [y, y+h) of column, whole bytes at once
+static void fill_column(uint8_t* col, int y, int h, int color) {
+  int const end = y + h;
+  if ((y & 1) && y < end) set_pixel(col, y++, color);
+  if ((end & 1) && y < end) set_pixel(col, end - 1, color);
+  if (y < end) memset(col + (y >> 1), color * 0x11, (size_t) ((end - y) >> 1));
+}
+
+// fill set bits of mask (bit n is row y + n * scale) in runs, no per-pixel work
+static void fill_mask(uint8_t* col, int y, uint32_t mask, int scale, int color) {
+  int j = 0;
+  while (mask) {
+    int const skip = __builtin_ctz(mask);
+    mask >>= skip;
+    j += skip;
+
+    int const run = (~mask) ? __builtin_ctz(~mask) : 32;
+    fill_column(col, y + j * scale, run * scale, color);
+    mask = (run < 32) ? (mask >> run) : 0;
+    j += run;
+  }
+}
 
 // print character with font size = 1
 static void printch(int x, int y, int color, const uint8_t *fnt) {
-    for (int i = 0; i < 6; ++i) {
-        uint8_t *p = frame_buf + (x + i) * DISPLAY_HEIGHT + y;
-        uint8_t mask = 0x01;
-        for (int j = 0; j < 8; ++j) {
-            if (*fnt & mask)
-                *p = color;
-            p++;
-            mask <<= 1;
-        }
-        fnt++;
+    for (int i = 0; i < 6; ++i, fnt++) {
+        uint8_t *p = band_column(x + i);
+        if (p) fill_mask(p, y, *fnt, 1, color);
     }
 }
 
-// print character with font size = 4
+// print character with font size = 4, each font column covers 4 screen columns
 static void printch4(int x, int y, int color, const uint8_t *fnt) {
     for (int i = 0; i < 6 * 4; ++i) {
-        uint8_t *p = frame_buf + (x + i) * DISPLAY_HEIGHT + y;
-        uint8_t mask = 0x01;
-        for (int j = 0; j < 8; ++j) {
-            for (int k = 0; k < 4; ++k) {
-                if (*fnt & mask)
-                    *p = color;
-                p++;
-            }
-            mask <<= 1;
-        }
-        if ((i & 3) == 3)
-            fnt++;
+        uint8_t *p = band_column(x + i);
+        if (p) fill_mask(p, y, fnt[i / 4], 4, color);
     }
 }
 
-// print icon
-static void printicon(int x, int y, int color, const uint8_t *icon) {
-    int w = *icon++;
-    int h = *icon++;
-    int sz = *icon++;
-
-    uint8_t mask = 0x80;
-    int runlen = 0;
-    int runbit = 0;
-    uint8_t lastb = 0x00;
-
-    for (int i = 0; i < w; ++i) {
-        uint8_t *p = frame_buf + (x + i) * DISPLAY_HEIGHT + y;
-        for (int j = 0; j < h; ++j) {
-            int c = 0;
-            if (mask != 0x80) {
-                if (lastb & mask)
-                    c = 1;
-                mask <<= 1;
-            } else if (runlen) {
-                if (runbit)
-                    c = 1;
-                runlen--;
-            } else {
-                if (sz-- <= 0) {
-                  //TU_LOG1("Screen Panic code = 10");
-                }
-                lastb = *icon++;
-                if (lastb & 0x80) {
-                    runlen = lastb & 63;
-                    runbit = lastb & 0x40;
-                } else {
-                    mask = 0x01;
-                }
-                --j;
-                continue; // restart
-            }
-            if (c)
-                *p = color;
-            p++;
-        }
+// print pre-rendered icon
+static void printicon(int x, int y, int color, const uint32_t *icon) {
+    for (int i = 0; i < ICON_SIZE; ++i) {
+        uint8_t *p = band_column(x + i);
+        if (p) fill_mask(p, y, icon[i], 1, color);
     }
 }
 
@@ -207,41 +234,19 @@ static void print4 (int x, int y, int color, const char *text)
   }
 }
 
-// Send the whole buffer data to display controller
-static void draw_screen (void)
-{
-  uint8_t *p = frame_buf;
-  for ( int i = 0; i < DISPLAY_WIDTH; ++i )
-  {
-    uint8_t cc[DISPLAY_HEIGHT * 2];
-    uint32_t dst = 0;
-    for ( int j = 0; j < DISPLAY_HEIGHT; ++j )
-    {
-      uint16_t color = palette[*p++ & 0xf];
-      cc[dst++] = color >> 8;
-      cc[dst++] = color & 0xff;
-    }
-
-    board_display_draw_line(i, (uint16_t*) cc, DISPLAY_HEIGHT);
-  }
-}
-
 // draw color bar
 static void drawBar (int y, int h, int color)
 {
-  for ( int x = 0; x < DISPLAY_WIDTH; ++x )
+  for ( int x = _band_x; x < _band_x + DISPLAY_BAND_WIDTH; ++x )
   {
-    memset(frame_buf + x * DISPLAY_HEIGHT + y, color, h);
+    fill_column(band_column(x), y, h, color);
   }
 }
 
-// draw drag & drop screen
-void screen_draw_drag (void)
+// draw whole drag & drop screen clipped to current band
+static void draw_scene (void)
 {
-  frame_buf = malloc(DISPLAY_WIDTH * DISPLAY_HEIGHT);
-  if (!frame_buf) return;
-
-  memset(frame_buf, 0, DISPLAY_WIDTH * DISPLAY_HEIGHT);
+  memset(frame_buf, 0, sizeof(frame_buf));
 
   drawBar(0, 52, COLOR_GREEN);
   drawBar(52, 55, COLOR_BLUE);
@@ -265,9 +270,85 @@ void screen_draw_drag (void)
   print(10, DRAG - 12, COLOR_WHITE, "firmware.uf2");
   print(90, DRAG - 12, COLOR_WHITE, UF2_VOLUME_LABEL);
 
-  draw_screen();
+  if ( _progress.started )
+  {
+    for ( int x = _band_x; x < _band_x + DISPLAY_BAND_WIDTH && x < (int) _progress.width; ++x )
+    {
+      fill_column(band_column(x), PROGRESS_Y, PROGRESS_H, COLOR_GREEN);
+    }
+
+    char text[5];
+    uint32_t const pct = _progress.percent;
+    int n = 0;
+    if ( pct >= 100 ) text[n++] = '1';
+    if ( pct >= 10 ) text[n++] = (char) ('0' + (pct / 10) % 10);
+    text[n++] = (char) ('0' + pct % 10);
+    text[n++] = '%';
+    text[n] = 0;
+    print(PROGRESS_TEXT_X, PROGRESS_Y, COLOR_WHITE, text);
+  }
+}
+
+// Compose and send columns [x0, x1) to display controller, one band at a time
+static void draw_columns (int x0, int x1)
+{
+  for ( _band_x = x0; _band_x < x1; _band_x += DISPLAY_BAND_WIDTH )
+  {
+    draw_scene();
+
+    int const band_end = (_band_x + DISPLAY_BAND_WIDTH < x1) ? (_band_x + DISPLAY_BAND_WIDTH) : x1;
+    for ( int x = _band_x; x < band_end; ++x )
+    {
+      uint8_t const *p = band_column(x);
+      uint8_t *cc = (uint8_t*) _line_buf[_line_idx];
+      if ( !(board_display_expand && board_display_expand(cc, p, 2 * COLUMN_BYTES, palette)) )
+      {
+        for ( int j = 0; j < COLUMN_BYTES; ++j, cc += 4 )
+        {
+          memcpy(cc, pair_lut[*p++], 4);
+        }
+      }
+
+      board_display_draw_line(x, _line_buf[_line_idx], DISPLAY_HEIGHT);
+      _line_idx ^= 1;
+    }
+  }
+}
+
+// draw drag & drop screen
+void screen_draw_drag (void)
+{
+  draw_columns(0, DISPLAY_WIDTH);
+}
+
+// update flashing progress, only the newly filled columns and the percentage are redrawn
+void screen_draw_progress (uint32_t done, uint32_t total)
+{
+  if ( total == 0 ) return;
+  if ( done > total ) done = total;
+
+  uint32_t const width = (uint32_t) (((uint64_t) PROGRESS_W * done) / total);
+  uint32_t const percent = (uint32_t) ((100ULL * done) / total);
 
-  free(frame_buf);
+  if ( !_progress.started )
+  {
+    _progress.started = true;
+    _progress.percent = percent;
+    draw_columns(PROGRESS_TEXT_X, DISPLAY_WIDTH);
+  }
+
+  if ( width > _progress.width )
+  {
+    uint32_t const prev = _progress.width;
+    _progress.width = width;
+    draw_columns((int) prev, (int) width);
+  }
+
+  if ( percent != _progress.percent )
+  {
+    _progress.percent = percent;
+    draw_columns(PROGRESS_TEXT_X, DISPLAY_WIDTH);
+  }
 }
 
 #endif
@@ -0,0 +1,183 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Flash from SD card (TINYUF2_SD_FLASH)
+//
+// TINYUF2_SD_FLASH_FILE is read from the first FAT volume of the card (FatFs, read-only, see
+// src/ffconf.h) and its blocks are passed to uf2_write_block() as if written via MSC. The cluster
+// chain is looked up once (FF_USE_FASTSEEK link map), then each fragment of the file is read straight
+// from the card SD_FLASH_BLOCKS sectors per board_sd_read() regardless of cluster size, bypassing
+// f_read() and the FatFs sector window. f_read() is only used if the file is too fragmented for the map.
+// The file is not removed (read-only), it is flashed again on every entry of DFU mode while the
+// card is inserted. TINYUF2_DELTA_FLASH avoids re-programming an unchanged image.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_SD_FLASH
+
+#include "ff.h"
+#include "diskio.h"
+
+// uf2 blocks per f_read()
+#define SD_FLASH_BLOCKS   16
+
+// fragments of the file covered by the fast seek link map, 2 entries per fragment plus 1
+#define SD_FLASH_CLMT     (2 * 8 + 1)
+
+static FATFS _sd_fs;
+static FIL _sd_file;
+static WriteState _sd_state;
+#define SD_FLASH_BUF_SIZE (SD_FLASH_BLOCKS * UF2_BLOCK_SIZE)
+
+#if TINYUF2_ARENA_SIZE
+static uint8_t* _sd_buf; // boot phase of the arena
+#else
+static uint8_t _sd_buf[SD_FLASH_BUF_SIZE] __attribute__((aligned(4)));
+#endif
+static uint32_t _sd_block_no;
+static DSTATUS _sd_status = STA_NOINIT;
+
+#if FF_USE_FASTSEEK
+static DWORD _sd_clmt[SD_FLASH_CLMT];
+#endif
+
+//--------------------------------------------------------------------+
+// FatFs disk IO, single drive
+//--------------------------------------------------------------------+
+
+DSTATUS disk_status(BYTE pdrv) {
+  return pdrv ? STA_NOINIT : _sd_status;
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+  if ( pdrv ) return STA_NOINIT;
+
+  _sd_status = board_sd_init() ? 0 : STA_NOINIT;
+  return _sd_status;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
+  if ( pdrv || _sd_status ) return RES_NOTRDY;
+  return board_sd_read((uint32_t) sector, buff, count) ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
+  (void) buff;
+  if ( pdrv ) return RES_PARERR;
+
+  // nothing is cached by the read-only volume
+  return (cmd == CTRL_SYNC) ? RES_OK : RES_PARERR;
+}
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+// Pass count bytes of buffer to uf2 engine, true when done (complete or aborted)
+static bool sd_flash_blocks(uint32_t count) {
+  for ( uint32_t i = 0; i + UF2_BLOCK_SIZE <= count; i += UF2_BLOCK_SIZE ) {
+    (void) uf2_write_block(_sd_block_no++, _sd_buf + i, &_sd_state);
+  }
+  uf2_write_commit();
+
+  return _sd_state.aborted || (_sd_state.numBlocks && _sd_state.numWritten >= _sd_state.numBlocks);
+}
+
+#if FF_USE_FASTSEEK
+// Read file by its link map: { map size, (cluster count, first cluster) per fragment, 0 }
+static void sd_flash_direct(void) {
+  uint32_t remain = (uint32_t) _sd_file.obj.objsize;
+  DWORD const* frag = _sd_clmt + 1;
+
+  while ( remain && frag[0] ) {
+    uint32_t lba = (uint32_t) (_sd_fs.database + _sd_fs.csize * (frag[1] - 2));
+    uint32_t sectors = frag[0] * _sd_fs.csize;
+    frag += 2;
+
+    while ( remain && sectors ) {
+      uint32_t const n = (sectors < SD_FLASH_BLOCKS) ? sectors : SD_FLASH_BLOCKS;
+      if ( !board_sd_read(lba, _sd_buf, n) ) return;
+      lba += n;
+      sectors -= n;
+
+      uint32_t const count = (remain < n * UF2_BLOCK_SIZE) ? remain : (n * UF2_BLOCK_SIZE);
+      remain -= count;
+      if ( sd_flash_blocks(count) ) return;
+    }
+  }
+}
+#endif
+
+bool uf2_sd_flash(void) {
+#if TINYUF2_ARENA_SIZE
+  _sd_buf = uf2_arena_alloc(SD_FLASH_BUF_SIZE);
+  if ( _sd_buf == NULL ) return false;
+#endif
+
+  if ( FR_OK != f_mount(&_sd_fs, "", 1) ) return false;
+
+  bool complete = false;
+
+  if ( FR_OK == f_open(&_sd_file, TINYUF2_SD_FLASH_FILE, FA_READ) ) {
+    TUF2_LOG1("SD: flashing %s\r\n", TINYUF2_SD_FLASH_FILE);
+    indicator_set(STATE_WRITING_STARTED);
+    _sd_block_no = 0;
+
+#if FF_USE_FASTSEEK
+    _sd_clmt[0] = SD_FLASH_CLMT;
+    _sd_file.cltbl = _sd_clmt;
+    if ( FR_OK == f_lseek(&_sd_file, CREATE_LINKMAP) ) {
+      sd_flash_direct();
+    } else
+#endif
+    {
+      // too fragmented for the link map, FAT is followed by f_read()
+#if FF_USE_FASTSEEK
+      _sd_file.cltbl = NULL;
+#endif
+      UINT count;
+      while ( FR_OK == f_read(&_sd_file, _sd_buf, SD_FLASH_BUF_SIZE, &count) ) {
+        if ( sd_flash_blocks(count) || count < SD_FLASH_BUF_SIZE ) break;
+      }
+    }
+
+    f_close(&_sd_file);
+
+    complete = !_sd_state.aborted && _sd_state.numBlocks && _sd_state.numWritten >= _sd_state.numBlocks;
+    if ( !complete ) {
+      // keep what is written consistent, remaining blocks can still be written via usb
+      TUF2_LOG1("SD: incomplete, %lu of %lu blocks\r\n", _sd_state.numWritten, _sd_state.numBlocks);
+      uf2_flush();
+    }
+
+    indicator_set(STATE_WRITING_FINISHED);
+  }
+
+  f_unmount("");
+  return complete;
+}
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Flash service table (TINYUF2_SERVICE_TABLE)
+//
+// The application finds board_service_t at the address its bootloader port gives section
+// .tinyuf2_service, checks magic/version/size and calls init(). That re-runs the bootloader data and bss
+// initialization (board_service_ram_init()), so RAM from ram_start to ram_end must be left to the
+// bootloader until the next reset, then board_flash_init() starts a fresh flash session: sectors are
+// erased once on first write, cached data is held until flush(), erase() is board_flash_erase_ahead()
+// (TINYUF2_PRE_ERASE). With TINYUF2_STAGED_UPDATE an image written to the staging region is marked
+// with stage() and applied by the bootloader at the next reset (src/staged.c). Writes are limited to
+// word aligned data outside the bootloader, the caller must not overwrite the code it runs from (e.g
+// write a second slot or external flash). Calls run on the caller's stack, are not reentrant and must
+// not be made from interrupts. Ports with interrupt driven flash are not supported, the vector table
+// stays the application's. The exception is dfu() (TINYUF2_WARM_DFU), which leaves the application for
+// DFU mode: without reset through board_dfu_warm_enter() when the port has it (no init() needed),
+// otherwise with DBL_TAP_MAGIC_WARM and a reset.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_SERVICE_TABLE
+
+#define SERVICE_CHUNK   256
+
+static bool _service_ready;
+
+static bool service_addr_valid(uint32_t addr, uint32_t len) {
+  uint32_t const offset = addr - BOARD_FLASH_ADDR_ZERO;
+#if TINYUF2_STAGED_UPDATE
+  // staging region may be outside of internal flash, e.g external flash
+  uint32_t const staging_offset = addr - BOARD_STAGING_ADDR;
+  if ( (staging_offset < BOARD_STAGING_SIZE) && (len <= BOARD_STAGING_SIZE - staging_offset) ) return true;
+#endif
+  return (addr >= BOARD_FLASH_APP_START) && (offset < board_flash_size()) && (len <= board_flash_size() - offset);
+}
+
+static bool service_init(void) {
+  board_service_ram_init();
+  board_flash_init();
+  _service_ready = true;
+  return true;
+}
+
+static bool service_write(uint32_t addr, void const* data, uint32_t len) {
+  if ( !_service_ready || ((addr | len) & 3) || !service_addr_valid(addr, len) ) return false;
+
+  uint8_t const* src = (uint8_t const*) data;
+
+  // same chunks as uf2 payloads, never crossing a 256-byte boundary
+  while ( len ) {
+    uint32_t const room = SERVICE_CHUNK - (addr & (SERVICE_CHUNK - 1));
+    uint32_t const count = (len < room) ? len : room;
+    if ( !board_flash_write(addr, src, count) ) return false;
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+
+  return true;
+}
+
+static void service_flush(void) {
+  if ( _service_ready ) board_flash_flush();
+}
+
+static uint32_t service_erase(uint32_t addr, uint32_t len) {
+  if ( !_service_ready || !board_flash_erase_ahead || !service_addr_valid(addr, len) ) return 0;
+  return board_flash_erase_ahead(addr, len);
+}
+
+static uint32_t service_hash(uint32_t addr, uint32_t len) {
+  return uf2_flash_crc32(addr, len);
+}
+
+#if TINYUF2_STAGED_UPDATE
+static bool service_stage(uint32_t len) {
+  if ( !_service_ready ) return false;
+  board_flash_flush();
+  return uf2_staged_commit(len);
+}
+#endif
+
+#if TINYUF2_WARM_DFU
+// runs on bootloader stack with its vector table
+static void service_dfu_entry(void) {
+  board_service_ram_init();
+  uf2_dfu_warm();
+}
+
+static void service_dfu(void) {
+  if ( board_dfu_warm_enter ) board_dfu_warm_enter(service_dfu_entry);
+
+#if TINYUF2_DBL_TAP_DFU
+  TINYUF2_DBL_TAP_REG = DBL_TAP_MAGIC_WARM;
+#endif
+  board_reset();
+}
+#endif
+
+board_service_t const _board_service __attribute__((section(".tinyuf2_service"), used)) = {
+  .magic     = SERVICE_MAGIC,
+  .version   = SERVICE_VERSION,
+  .size      = sizeof(board_service_t),
+  .ram_start = _board_service_ram_start,
+  .ram_end   = _board_service_ram_end,
+
+  .init      = service_init,
+  .write     = service_write,
+  .flush     = service_flush,
+  .erase     = service_erase,
+  .hash      = service_hash,
+  .read      = board_flash_read,
+  .info      = uf2_flash_info,
+
+#if TINYUF2_STAGED_UPDATE
+  .stage        = service_stage,
+  .staging_addr = BOARD_STAGING_ADDR,
+  .staging_size = BOARD_STAGING_SIZE,
+#endif
+
+#if TINYUF2_WARM_DFU
+  .dfu          = service_dfu,
+#endif
+};
+
+#endif
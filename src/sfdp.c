@@ -0,0 +1,150 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "sfdp.h"
+
+#define SFDP_SIGNATURE      0x50444653UL // "SFDP"
+#define SFDP_BFPT_ID        0xFF00       // basic flash parameter table
+#define SFDP_BFPT_DWORDS    16           // parsed up to JESD216B
+
+static inline uint32_t bits(uint32_t value, uint8_t lsb, uint8_t count) {
+  return (value >> lsb) & ((1UL << count) - 1);
+}
+
+static inline uint32_t u32_le(uint8_t const* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Typical erase time: count and units (1ms, 16ms, 128ms, 1s)
+static uint32_t erase_time_ms(uint32_t count, uint32_t units) {
+  static uint16_t const unit_ms[] = { 1, 16, 128, 1000 };
+  return (count + 1) * unit_ms[units];
+}
+
+// Fast read with mode + wait clocks, from a BFPT read descriptor (16-bit half dword)
+static void read_select(sfdp_flash_t* flash, uint8_t mode, uint32_t desc) {
+  if (mode <= flash->read_mode || bits(desc, 8, 8) == 0) return;
+
+  flash->read_mode = mode;
+  flash->read_opcode = (uint8_t) bits(desc, 8, 8);
+  flash->read_dummy = (uint8_t) (bits(desc, 0, 5) + bits(desc, 5, 3));
+}
+
+bool sfdp_probe(sfdp_flash_t* flash, sfdp_read_t read) {
+  uint8_t header[8];
+  uint32_t dw[SFDP_BFPT_DWORDS];
+
+  memset(flash, 0, sizeof(sfdp_flash_t));
+
+  if (!read(0, header, sizeof(header)) || u32_le(header) != SFDP_SIGNATURE) return false;
+
+  // parameter headers follow the sfdp header, BFPT is mandatory and normally the first one
+  uint32_t const nph = header[6] + 1u;
+  uint32_t ptr = 0, len = 0;
+
+  for (uint32_t i = 0; i < nph; i++) {
+    uint8_t ph[8];
+    if (!read(8 + i * 8, ph, sizeof(ph))) return false;
+
+    if ((ph[0] | (ph[7] << 8)) == SFDP_BFPT_ID) {
+      len = ph[3];
+      ptr = ph[4] | (ph[5] << 8) | ((uint32_t) ph[6] << 16);
+      break;
+    }
+  }
+
+  if (len < 9) return false; // JESD216 BFPT has at least 9 dwords
+  if (len > SFDP_BFPT_DWORDS) len = SFDP_BFPT_DWORDS;
+
+  uint8_t raw[SFDP_BFPT_DWORDS * 4];
+  memset(raw, 0xff, sizeof(raw));
+  if (!read(ptr, raw, len * 4)) return false;
+  for (uint32_t i = 0; i < SFDP_BFPT_DWORDS; i++) dw[i] = u32_le(raw + 4 * i);
+
+  // 1st dword: address bytes and supported fast reads
+  uint32_t const addr_mode = bits(dw[0], 17, 2);
+  flash->addr_bytes = (addr_mode == 2) ? 4 : 3;
+
+  // 2nd dword: density in bits
+  if (dw[1] & 0x80000000UL) {
+    uint32_t const n = bits(dw[1], 0, 31);
+    if (n < 3 || n > 34) return false;
+    flash->size = 1UL << (n - 3);
+  } else {
+    flash->size = (dw[1] + 1) / 8;
+  }
+  if (flash->size > 16UL * 1024 * 1024 && addr_mode != 0) flash->addr_bytes = 4;
+
+  flash->read_mode = SFDP_READ_1_1_1;
+  flash->read_opcode = 0x0B;
+  flash->read_dummy = 8;
+  if (dw[0] & (1UL << 16)) read_select(flash, SFDP_READ_1_1_2, bits(dw[3], 0, 16));
+  if (dw[0] & (1UL << 20)) read_select(flash, SFDP_READ_1_2_2, bits(dw[3], 16, 16));
+  if (dw[0] & (1UL << 22)) read_select(flash, SFDP_READ_1_1_4, bits(dw[2], 16, 16));
+  if (dw[0] & (1UL << 21)) read_select(flash, SFDP_READ_1_4_4, bits(dw[2], 0, 16));
+
+  // 8th, 9th dword: erase types (size as power of 2), 10th: typical erase times
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+    uint32_t const desc = bits(dw[7 + i / 2], (i % 2) * 16, 16);
+    uint32_t const n = bits(desc, 0, 8);
+    if (n == 0 || n > 31) continue;
+
+    flash->erase[count].size = 1UL << n;
+    flash->erase[count].opcode = (uint8_t) bits(desc, 8, 8);
+    flash->erase[count].time_ms = (len >= 10) ? erase_time_ms(bits(dw[9], 4 + 7 * i, 5), bits(dw[9], 9 + 7 * i, 2)) : 0;
+    count++;
+  }
+
+  // no erase type table (early parts): 4K erase from 1st dword
+  if (count == 0 && bits(dw[0], 0, 2) == 1) {
+    flash->erase[0].size = 4096;
+    flash->erase[0].opcode = (uint8_t) bits(dw[0], 8, 8);
+    count = 1;
+  }
+
+  // sort by size (insertion, up to 4 entries)
+  for (uint32_t i = 1; i < count; i++) {
+    for (uint32_t j = i; j > 0 && flash->erase[j].size < flash->erase[j - 1].size; j--) {
+      sfdp_erase_t const tmp = flash->erase[j];
+      flash->erase[j] = flash->erase[j - 1];
+      flash->erase[j - 1] = tmp;
+    }
+  }
+
+  // 11th dword: page size as power of 2
+  flash->page_size = (len >= 11) ? (1UL << bits(dw[10], 4, 4)) : 256;
+
+  return flash->size != 0 && count != 0;
+}
+
+int sfdp_erase_type(sfdp_flash_t const* flash, uint32_t addr, uint32_t len) {
+  for (int i = SFDP_ERASE_TYPES - 1; i >= 0; i--) {
+    uint32_t const size = flash->erase[i].size;
+    if (size && size <= len && (addr & (size - 1)) == 0) return i;
+  }
+  return -1;
+}
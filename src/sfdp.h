@@ -0,0 +1,78 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SFDP_H_
+#define SFDP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//--------------------------------------------------------------------+
+// JEDEC Serial Flash Discoverable Parameters (JESD216) for external NOR flash.
+// Transport independent: port reads the SFDP area with SFDP_READ_CMD and picks commands and erase
+// granularity from the result instead of hardcoding them per part.
+//--------------------------------------------------------------------+
+
+// Read SFDP: single line, 3-byte address, 8 dummy clocks
+#define SFDP_READ_CMD       0x5A
+
+#define SFDP_ERASE_TYPES    4
+
+// Read modes as instruction-address-data lines, faster is higher
+typedef enum {
+  SFDP_READ_1_1_1 = 0, // fast read 0x0B
+  SFDP_READ_1_1_2,
+  SFDP_READ_1_2_2,
+  SFDP_READ_1_1_4,
+  SFDP_READ_1_4_4,
+} sfdp_read_mode_t;
+
+typedef struct {
+  uint32_t size;          // 0 if not supported
+  uint32_t time_ms;       // typical erase time, 0 if unknown
+  uint8_t  opcode;
+} sfdp_erase_t;
+
+typedef struct {
+  uint32_t size;          // bytes
+  uint32_t page_size;     // program page size
+  uint8_t  addr_bytes;    // 3 or 4 (part larger than 16MB or 4-byte address only)
+
+  sfdp_erase_t erase[SFDP_ERASE_TYPES]; // sorted by size, smallest first
+
+  uint8_t read_mode;      // fastest single instruction line read, sfdp_read_mode_t
+  uint8_t read_opcode;
+  uint8_t read_dummy;     // mode + wait clocks
+} sfdp_flash_t;
+
+// Read len bytes of the SFDP area at addr with SFDP_READ_CMD
+typedef bool (*sfdp_read_t)(uint32_t addr, void* buffer, uint32_t len);
+
+// Probe SFDP header and basic flash parameter table, false if the part has no (valid) SFDP
+bool sfdp_probe(sfdp_flash_t* flash, sfdp_read_t read);
+
+// Largest supported erase type for [addr, addr+len) that is aligned at addr, -1 if none
+int sfdp_erase_type(sfdp_flash_t const* flash, uint32_t addr, uint32_t len);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Signed uf2 images (TINYUF2_SIGNED_UF2), see tools/uf2sign.py
+//
+// A block with UF2_FLAG_SIGNATURE carries the ECDSA P-256 signature of the SHA-256 of the image
+// [targetAddr, targetAddr + length). Payload of BOARD_UF2_FAMILY_ID is hashed while it streams in,
+// as long as it arrives in address order from the start of the image. Otherwise (out of order,
+// gaps, rewrites) the image is hashed again from flash once the file is complete.
+// TINYUF2_SIGN_KEY_HEADER defines TINYUF2_SIGN_PUBKEY, the 64-byte public key (X then Y, big endian).
+// SHA-256 uses board_sha256_*() if implemented (hardware), ECDSA is micro-ecc.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_SIGNED_UF2
+
+#include "uECC.h"
+#include TINYUF2_SIGN_KEY_HEADER
+
+static uint8_t const _pubkey[64] = TINYUF2_SIGN_PUBKEY;
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t count;     // bytes hashed
+  uint8_t  buf[64];
+} sha256_t;
+
+static struct {
+  sha256_t sha;
+  uint32_t start;     // image start of incremental hash
+  uint32_t next;      // address following the last hashed payload
+  bool     in_order;  // incremental hash covers [start, next)
+
+  uint32_t min;       // range of written payload
+  uint32_t max;
+
+  bool     has_sig;
+  uint32_t sig_addr;  // start of signed range
+  UF2_Signature sig;
+} _sign;
+
+//--------------------------------------------------------------------+
+// SHA-256 (FIPS 180-4)
+//--------------------------------------------------------------------+
+
+static uint32_t const _sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(_x, _n)  (((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+static void sha256_block(uint32_t state[8], uint8_t const* data) {
+  uint32_t w[64];
+  for ( uint32_t i = 0; i < 16; i++ ) {
+    w[i] = ((uint32_t) data[4*i] << 24) | ((uint32_t) data[4*i+1] << 16) | ((uint32_t) data[4*i+2] << 8) | data[4*i+3];
+  }
+  for ( uint32_t i = 16; i < 64; i++ ) {
+    uint32_t const s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+    uint32_t const s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+  for ( uint32_t i = 0; i < 64; i++ ) {
+    uint32_t const t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + _sha256_k[i] + w[i];
+    uint32_t const t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void sha256_init(sha256_t* sha) {
+  static uint32_t const init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  if ( board_sha256_init ) {
+    board_sha256_init();
+    return;
+  }
+
+  memcpy(sha->state, init, sizeof(init));
+  sha->count = 0;
+}
+
+static void sha256_update(sha256_t* sha, void const* data, uint32_t len) {
+  if ( board_sha256_update ) {
+    board_sha256_update(data, len);
+    return;
+  }
+
+  uint8_t const* p = (uint8_t const*) data;
+  uint32_t used = (uint32_t) (sha->count & 63);
+  sha->count += len;
+
+  if ( used ) {
+    uint32_t const n = (len < 64 - used) ? len : (64 - used);
+    memcpy(sha->buf + used, p, n);
+    p += n;
+    len -= n;
+    if ( used + n < 64 ) return;
+    sha256_block(sha->state, sha->buf);
+  }
+
+  for ( ; len >= 64; p += 64, len -= 64 ) sha256_block(sha->state, p);
+  memcpy(sha->buf, p, len);
+}
+
+static void sha256_final(sha256_t* sha, uint8_t hash[32]) {
+  if ( board_sha256_final ) {
+    board_sha256_final(hash);
+    return;
+  }
+
+  uint64_t const bits = sha->count * 8;
+  uint8_t pad[72] = { 0x80 };
+  uint32_t const used = (uint32_t) (sha->count & 63);
+  uint32_t const pad_len = (used < 56 ? 56 : 120) - used;
+
+  for ( uint32_t i = 0; i < 8; i++ ) pad[pad_len + i] = (uint8_t) (bits >> (56 - 8*i));
+  sha256_update(sha, pad, pad_len + 8);
+
+  for ( uint32_t i = 0; i < 8; i++ ) {
+    hash[4*i]   = (uint8_t) (sha->state[i] >> 24);
+    hash[4*i+1] = (uint8_t) (sha->state[i] >> 16);
+    hash[4*i+2] = (uint8_t) (sha->state[i] >> 8);
+    hash[4*i+3] = (uint8_t) sha->state[i];
+  }
+}
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+void uf2_sign_reset(void) {
+  memset(&_sign, 0, sizeof(_sign));
+  _sign.min = UINT32_MAX;
+}
+
+void uf2_sign_track(uint32_t addr, void const* data, uint32_t len) {
+  if ( addr < _sign.min ) _sign.min = addr;
+  if ( addr + len > _sign.max ) _sign.max = addr + len;
+
+  if ( !_sign.next ) {
+    // first payload starts the incremental hash
+    sha256_init(&_sign.sha);
+    _sign.start = addr;
+    _sign.next = addr;
+    _sign.in_order = true;
+  }
+
+  if ( _sign.in_order && addr == _sign.next ) {
+    sha256_update(&_sign.sha, data, len);
+    _sign.next += len;
+  } else {
+    _sign.in_order = false;
+  }
+}
+
+void uf2_sign_set(void const* payload, uint32_t len, uint32_t addr) {
+  if ( len < sizeof(UF2_Signature) ) return;
+
+  memcpy(&_sign.sig, payload, sizeof(UF2_Signature));
+  _sign.sig_addr = addr;
+  _sign.has_sig = true;
+}
+
+bool uf2_sign_verify(void) {
+  uint32_t const start = _sign.sig_addr;
+  uint32_t const end = start + _sign.sig.length;
+
+  if ( !_sign.has_sig || !_sign.sig.length ) {
+    TUF2_LOG1("Signature: missing\r\n");
+    return false;
+  }
+
+  // everything written must be covered by the signature
+  if ( _sign.max && (_sign.min < start || _sign.max > end) ) {
+    TUF2_LOG1("Signature: image written outside of signed range\r\n");
+    return false;
+  }
+
+#if TINYUF2_STATS
+  uint32_t const t_start = uf2_stats_now();
+#endif
+  uint8_t hash[32];
+
+  if ( _sign.in_order && _sign.start == start && _sign.next == end ) {
+    sha256_final(&_sign.sha, hash);
+  } else {
+    // hash signed range from flash, 256 bytes at a time
+    uint32_t buf[64];
+    sha256_init(&_sign.sha);
+    for ( uint32_t addr = start; addr < end; addr += sizeof(buf) ) {
+      uint32_t const count = (end - addr < sizeof(buf)) ? (end - addr) : sizeof(buf);
+      board_flash_read(addr, buf, count);
+      sha256_update(&_sign.sha, buf, count);
+    }
+    sha256_final(&_sign.sha, hash);
+  }
+
+  bool const valid = uECC_verify(_pubkey, hash, sizeof(hash), _sign.sig.signature, uECC_secp256r1());
+  TUF2_LOG1("Signature: %s\r\n", valid ? "valid" : "invalid");
+
+#if TINYUF2_STATS
+  uf2_stats_verify(uf2_stats_now() - t_start);
+#endif
+
+  return valid;
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SPSC_H_
+#define SPSC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//--------------------------------------------------------------------+
+// Lock-free single producer / single consumer ring and buffer pool.
+// Hands work from one context to another (usb callback to main loop, ISR to task, core to core)
+// without masking interrupts or an OS primitive, so the same code runs bare metal and on FreeRTOS.
+//
+// The ring only manages slot indices, slots are an array of any type owned by the caller with
+// depth (power of 2) entries. Producer fills slot spsc_write_slot() then spsc_write_commit(),
+// consumer uses slot spsc_read_slot() then spsc_read_release(). Each index is written by one side
+// only, published with release and read by the other side with acquire ordering: slot contents are
+// visible before the index moving past it (dmb on Cortex-M, fence on RISC-V, memw on Xtensa).
+//--------------------------------------------------------------------+
+
+#define SPSC_NONE   UINT32_MAX
+
+typedef struct {
+  uint32_t head;    // slots written, producer only
+  uint32_t tail;    // slots released, consumer only
+  uint32_t mask;    // depth - 1
+} spsc_ring_t;
+
+// Payload descriptor for the slot array of a ring, buffer usually comes from a spsc_pool_t
+typedef struct {
+  uint32_t addr;    // e.g flash address or disk block
+  uint32_t len;
+  void* buf;
+} spsc_payload_t;
+
+static inline void spsc_init(spsc_ring_t* ring, uint32_t depth) {
+  ring->head = 0;
+  ring->tail = 0;
+  ring->mask = depth - 1;
+}
+
+// Slots in use, exact from either side for its own index, a lower bound of the other side's work
+static inline uint32_t spsc_count(spsc_ring_t const* ring) {
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+//------------- Producer -------------//
+
+// Index of the slot to fill, SPSC_NONE if full
+static inline uint32_t spsc_write_slot(spsc_ring_t* ring) {
+  uint32_t const head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  // slots released by the consumer are no longer read
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) return SPSC_NONE;
+  return head & ring->mask;
+}
+
+// Publish the slot filled after spsc_write_slot()
+static inline void spsc_write_commit(spsc_ring_t* ring) {
+  __atomic_store_n(&ring->head, __atomic_load_n(&ring->head, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+//------------- Consumer -------------//
+
+// Index of the oldest slot, SPSC_NONE if empty
+static inline uint32_t spsc_read_slot(spsc_ring_t* ring) {
+  uint32_t const tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  // contents of slots committed by the producer are visible
+  if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) return SPSC_NONE;
+  return tail & ring->mask;
+}
+
+// Hand the slot used after spsc_read_slot() back to the producer
+static inline void spsc_read_release(spsc_ring_t* ring) {
+  __atomic_store_n(&ring->tail, __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+//--------------------------------------------------------------------+
+// Buffer pool of count (power of 2) buffers of size bytes in memory given by the caller. Free
+// buffers are a ring in the other direction: the consumer of the payloads puts them back, their
+// producer gets them. ids holds count entries
+//--------------------------------------------------------------------+
+typedef struct {
+  spsc_ring_t ring;
+  uint16_t* ids;
+  uint8_t* mem;
+  uint32_t size;
+} spsc_pool_t;
+
+static inline void spsc_pool_init(spsc_pool_t* pool, void* mem, uint32_t size, uint32_t count, uint16_t* ids) {
+  spsc_init(&pool->ring, count);
+  pool->ids = ids;
+  pool->mem = (uint8_t*) mem;
+  pool->size = size;
+
+  for (uint32_t i = 0; i < count; i++) ids[i] = (uint16_t) i;
+  pool->ring.head = count;
+}
+
+// Producer side: free buffer, NULL if all are in flight
+static inline void* spsc_pool_get(spsc_pool_t* pool) {
+  uint32_t const slot = spsc_read_slot(&pool->ring);
+  if (slot == SPSC_NONE) return NULL;
+
+  void* buf = pool->mem + pool->ids[slot] * pool->size;
+  spsc_read_release(&pool->ring);
+  return buf;
+}
+
+// Consumer side: buffer from spsc_pool_get() is done with
+static inline void spsc_pool_put(spsc_pool_t* pool, void const* buf) {
+  // never full: there are only count buffers
+  uint32_t const slot = spsc_write_slot(&pool->ring);
+  pool->ids[slot] = (uint16_t) (((uint8_t const*) buf - pool->mem) / pool->size);
+  spsc_write_commit(&pool->ring);
+}
+
+#endif
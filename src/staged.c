@@ -0,0 +1,180 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Staged update (TINYUF2_STAGED_UPDATE)
+//
+// The application downloads a new image into the staging region at BOARD_STAGING_ADDR, laid out as it
+// is to run from BOARD_FLASH_APP_START, then writes a UF2_AppFooter with UF2_STAGED_MAGIC in the last
+// 16 bytes of the region (service table stage() or uf2_staged_commit()). The image must end before the
+// erase unit holding the footer, that unit is erased to invalidate it.
+//
+// At the next reset footer and image CRC are checked before the application is, then the image is
+// applied with the fastest way the port has:
+// - board_staged_swap(): the staged bank becomes the application bank, nothing is copied
+// - otherwise it is copied erase unit by erase unit, units already holding the staged contents are
+//   neither erased nor programmed. The footer is invalidated only once the copy is verified, so an
+//   interrupted copy is resumed at the next reset.
+// With TINYUF2_APP_FOOTER the image is always copied and the application footer written for it.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_STAGED_UPDATE
+
+#if TINYUF2_SIGNED_UF2
+  #error "TINYUF2_STAGED_UPDATE bypasses TINYUF2_SIGNED_UF2"
+#endif
+
+#define STAGED_FOOTER_ADDR  (BOARD_STAGING_ADDR + BOARD_STAGING_SIZE - sizeof(UF2_AppFooter))
+#define STAGED_CHUNK        256
+
+static void staged_footer_make(UF2_AppFooter* footer, uint32_t magic, uint32_t len, uint32_t crc) {
+  footer->magic = magic;
+  footer->length = len;
+  footer->crc32 = crc;
+  footer->check = ~(footer->magic ^ footer->length ^ footer->crc32);
+}
+
+// Largest image: before the erase unit of the staging footer, within the application region and
+// below the staging region or the application footer if these follow the application
+static uint32_t staged_max_len(void) {
+  flash_sector_t footer_unit = { 0, STAGED_FOOTER_ADDR, 0 };
+  flash_sector_find(&uf2_flash_info()->geometry, STAGED_FOOTER_ADDR, &footer_unit);
+  uint32_t max_len = footer_unit.addr - BOARD_STAGING_ADDR;
+
+  uint32_t app_end = BOARD_FLASH_ADDR_ZERO + board_flash_size();
+#if TINYUF2_APP_FOOTER
+  app_end = BOARD_APP_FOOTER_ADDR;
+#endif
+  if ( BOARD_STAGING_ADDR > BOARD_FLASH_APP_START && BOARD_STAGING_ADDR < app_end ) app_end = BOARD_STAGING_ADDR;
+
+  if ( app_end - BOARD_FLASH_APP_START < max_len ) max_len = app_end - BOARD_FLASH_APP_START;
+  return max_len;
+}
+
+void uf2_staged_invalidate(void) {
+  uint32_t erased[sizeof(UF2_AppFooter) / 4];
+  memset(erased, 0xff, sizeof(erased));
+  board_flash_write(STAGED_FOOTER_ADDR, erased, sizeof(erased));
+  board_flash_flush();
+}
+
+bool uf2_staged_commit(uint32_t len) {
+  if ( len == 0 || len > staged_max_len() ) return false;
+
+  UF2_AppFooter footer;
+  staged_footer_make(&footer, UF2_STAGED_MAGIC, len, uf2_flash_crc32(BOARD_STAGING_ADDR, len));
+  board_flash_write(STAGED_FOOTER_ADDR, &footer, sizeof(footer));
+  board_flash_flush();
+
+  TUF2_LOG1("Staged: length %lu, crc32 0x%08lX\r\n", footer.length, footer.crc32);
+  return true;
+}
+
+// Copy units of the staged image that differ from the application, return units copied
+static uint32_t staged_copy(uint32_t len) {
+  flash_geometry_t const* geo = &uf2_flash_info()->geometry;
+  uint8_t src[STAGED_CHUNK] __attribute__((aligned(4)));
+  uint8_t dst[STAGED_CHUNK] __attribute__((aligned(4)));
+  uint32_t copied = 0;
+
+  for ( uint32_t offset = 0; offset < len; ) {
+    flash_sector_t unit;
+    if ( !flash_sector_find(geo, BOARD_FLASH_APP_START + offset, &unit) ) break;
+
+    uint32_t end = unit.addr + unit.size - BOARD_FLASH_APP_START;
+    if ( end > len ) end = len;
+
+    bool same = true;
+    for ( uint32_t pos = offset; pos < end && same; pos += STAGED_CHUNK ) {
+      uint32_t const count = (end - pos < STAGED_CHUNK) ? (end - pos) : STAGED_CHUNK;
+      board_flash_read(BOARD_STAGING_ADDR + pos, src, count);
+      board_flash_read(BOARD_FLASH_APP_START + pos, dst, count);
+      same = (0 == memcmp(src, dst, count));
+    }
+
+    if ( !same ) {
+      for ( uint32_t pos = offset; pos < end; pos += STAGED_CHUNK ) {
+        // last word of an unaligned image is padded with what follows it in the staging region
+        uint32_t const count = (end - pos < STAGED_CHUNK) ? ((end - pos + 3) & ~3UL) : STAGED_CHUNK;
+        board_flash_read(BOARD_STAGING_ADDR + pos, src, count);
+        board_flash_write(BOARD_FLASH_APP_START + pos, src, count);
+      }
+      copied++;
+    }
+
+    offset = end;
+  }
+
+  board_flash_flush();
+  return copied;
+}
+
+bool uf2_staged_apply(void) {
+  UF2_AppFooter footer;
+  board_flash_read(STAGED_FOOTER_ADDR, &footer, sizeof(footer));
+
+  if ( footer.magic != UF2_STAGED_MAGIC ) return false;
+  if ( footer.check != ~(footer.magic ^ footer.length ^ footer.crc32) ) return false;
+
+  board_flash_init();
+
+  if ( footer.length == 0 || footer.length > staged_max_len() ||
+       uf2_flash_crc32(BOARD_STAGING_ADDR, footer.length) != footer.crc32 ) {
+    TUF2_LOG1("Staged image invalid\r\n");
+    uf2_staged_invalidate();
+    return false;
+  }
+
+  TUF2_LOG1("Staged image: length %lu, crc32 0x%08lX\r\n", footer.length, footer.crc32);
+  indicator_set(STATE_WRITING_STARTED);
+
+#if !TINYUF2_APP_FOOTER
+  // does not return once switched
+  if ( board_staged_swap && board_staged_swap(footer.length) ) {
+    indicator_set(STATE_WRITING_FINISHED);
+    return true;
+  }
+#endif
+
+  uint32_t const copied = staged_copy(footer.length);
+  bool const ok = (uf2_flash_crc32(BOARD_FLASH_APP_START, footer.length) == footer.crc32);
+  TUF2_LOG1("Staged copy: %lu units %s\r\n", copied, ok ? "OK" : "failed");
+
+  if ( ok ) {
+#if TINYUF2_APP_FOOTER
+    UF2_AppFooter app_footer;
+    staged_footer_make(&app_footer, UF2_APP_FOOTER_MAGIC, footer.length, footer.crc32);
+    board_flash_write(BOARD_APP_FOOTER_ADDR, &app_footer, sizeof(app_footer));
+    board_flash_flush();
+#endif
+    uf2_staged_invalidate();
+  }
+
+  indicator_set(STATE_WRITING_FINISHED);
+  return ok;
+}
+
+#endif
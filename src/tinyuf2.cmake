@@ -6,12 +6,26 @@
 
 function (add_tinyuf2 TARGET)
   target_sources(${TARGET} PUBLIC
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/aes_ctr.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/arena.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/cdc.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/config.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/data_lun.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/dfu.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/ghostfat.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/images.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/main.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/msc.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/profile.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/screen.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/sd_flash.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/service.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/sfdp.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/signature.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/staged.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/uas.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/usb_descriptors.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/vendor.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/board_api.h
     )
   target_include_directories(${TARGET} PUBLIC
@@ -0,0 +1,715 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "uf2.h"
+#include "uas.h"
+
+//--------------------------------------------------------------------+
+// USB Attached SCSI (TINYUF2_UAS), descriptor in usb_descriptors.c
+//
+// Registered as application class driver ahead of the tinyusb MSC driver. Alternate setting 0 of the
+// MSC interface is Bulk-Only Transport and forwarded to tinyusb, alternate setting 1 is UAS. Command
+// IUs are received into a queue while the current command is processed, which is serialized: READY
+// IU, data phase and Sense IU. SCSI commands answered by tinyusb for BOT are answered here, others as
+// well as READ10/WRITE10 go to the tud_msc_*_cb() callbacks of msc.c. A WRITE10 chunk only partially
+// consumed (write queue full) is resumed by uas_task(). READ10 data that is plain memory mapped flash
+// (msc_read_mapped()) is sent from flash in place instead of being copied into the transfer buffer.
+//--------------------------------------------------------------------+
+
+#if TINYUF2_UAS
+
+#define UAS_QUEUE_DEPTH   4
+
+// Largest data-in transfer sent in place, a single transfer descriptor on all controllers
+#define UAS_MAPPED_XFER_MAX   16384
+
+#define SCSI_STATUS_GOOD            0x00
+#define SCSI_STATUS_CHECK_CONDITION 0x02
+
+enum {
+  UAS_STAGE_IDLE = 0,
+  UAS_STAGE_READY,    // READY IU to send or in flight
+  UAS_STAGE_DATA,     // data transfer in flight, or READ10 to retry
+  UAS_STAGE_WRITE,    // received WRITE10 data to pass to the callback
+  UAS_STAGE_STATUS,   // Sense IU to send or in flight
+};
+
+typedef struct {
+  uint16_t tag;
+  uint8_t  lun;
+  uint8_t  cdb[16];
+} uas_cmd_t;
+
+static struct {
+  uint8_t rhport;
+  uint8_t itf_num;
+  uint8_t alt;
+  uint8_t ep_bot_in, ep_bot_out;
+  uint8_t ep_cmd, ep_status, ep_in, ep_out;
+  uint16_t ep_size;
+  tusb_desc_interface_t const* desc_bot;
+  tusb_desc_interface_t const* desc_uas;
+  uint8_t const* desc_end;
+
+  // received command IUs
+  uas_cmd_t queue[UAS_QUEUE_DEPTH];
+  uint8_t head;
+  uint8_t count;
+  bool cmd_armed;
+
+  // response IU of a task management function, sent ahead of anything else
+  bool resp_pending;
+  uint16_t resp_tag;
+  uint8_t resp_code;
+
+  bool status_busy;
+  bool status_is_resp;
+
+  // current command
+  uas_cmd_t cmd;
+  uint8_t stage;
+  bool iu_sent;
+  bool data_in;
+  bool zlp;           // data-in shorter than allocation length ends on a packet boundary
+  uint8_t status;
+  uint32_t lba;
+  uint32_t total;     // data phase length
+  uint32_t xferred;   // data-in sent or data-out consumed
+  uint32_t chunk;     // bytes received in buffer (WRITE10)
+  uint32_t consumed;  // bytes of chunk accepted by the callback
+
+  uint8_t sense_key, sense_asc, sense_ascq;
+} _uas;
+
+CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN static uint8_t _uas_cmd_buf[64];
+CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN static uint8_t _uas_status_buf[64];
+CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN static uint8_t _uas_buf[CFG_TUD_MSC_BUFSIZE];
+
+static void put_be16(uint8_t* p, uint16_t value) {
+  p[0] = (uint8_t) (value >> 8);
+  p[1] = (uint8_t) value;
+}
+
+static void put_be32(uint8_t* p, uint32_t value) {
+  put_be16(p, (uint16_t) (value >> 16));
+  put_be16(p + 2, (uint16_t) value);
+}
+
+static uint16_t get_be16(uint8_t const* p) {
+  return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_be32(uint8_t const* p) {
+  return ((uint32_t) get_be16(p) << 16) | get_be16(p + 2);
+}
+
+void uas_set_sense(uint8_t lun, uint8_t sense_key, uint8_t add_sense_code, uint8_t add_sense_qualifier) {
+  (void) lun;
+  _uas.sense_key = sense_key;
+  _uas.sense_asc = add_sense_code;
+  _uas.sense_ascq = add_sense_qualifier;
+}
+
+static void fill_sense(uint8_t resp[18]) {
+  memset(resp, 0, 18);
+  resp[0] = 0x70; // current error, fixed format
+  resp[2] = _uas.sense_key;
+  resp[7] = 18 - 8;
+  resp[12] = _uas.sense_asc;
+  resp[13] = _uas.sense_ascq;
+}
+
+static uint8_t max_lun(void) {
+  return tud_msc_get_maxlun_cb ? tud_msc_get_maxlun_cb() : 1;
+}
+
+// Allocation length of a data-in command, where the CDB group puts it
+static uint32_t alloc_len(uint8_t const cdb[16]) {
+  if (cdb[0] == SCSI_CMD_INQUIRY) return get_be16(cdb + 3);
+  if (cdb[0] == SCSI_CMD_READ_CAPACITY_10) return 8; // fixed length
+
+  switch (cdb[0] >> 5) {
+    case 0:  return cdb[4];
+    case 1:
+    case 2:  return get_be16(cdb + 7);
+    case 4:  return get_be32(cdb + 10);
+    case 5:  return get_be32(cdb + 6);
+    default: return 0;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Pipes
+//--------------------------------------------------------------------+
+
+static void cmd_arm(void) {
+  // a full queue holds off the host: command pipe is NAKed until a slot is free
+  if (_uas.cmd_armed || _uas.resp_pending || _uas.count == UAS_QUEUE_DEPTH) return;
+  _uas.cmd_armed = usbd_edpt_xfer(_uas.rhport, _uas.ep_cmd, _uas_cmd_buf, sizeof(_uas_cmd_buf));
+}
+
+static void status_send(void) {
+  if (_uas.status_busy) return;
+  uint8_t* iu = _uas_status_buf;
+  uint16_t len;
+
+  memset(iu, 0, sizeof(_uas_status_buf));
+  if (_uas.resp_pending) {
+    iu[0] = UAS_IU_RESPONSE;
+    put_be16(iu + 2, _uas.resp_tag);
+    iu[7] = _uas.resp_code;
+    len = UAS_RESPONSE_IU_LEN;
+    _uas.status_is_resp = true;
+  } else if ((_uas.stage == UAS_STAGE_READY || _uas.stage == UAS_STAGE_STATUS) && !_uas.iu_sent) {
+    put_be16(iu + 2, _uas.cmd.tag);
+    if (_uas.stage == UAS_STAGE_READY) {
+      iu[0] = _uas.data_in ? UAS_IU_READ_READY : UAS_IU_WRITE_READY;
+      len = UAS_READY_IU_LEN;
+    } else {
+      iu[0] = UAS_IU_SENSE;
+      iu[6] = _uas.status;
+      len = UAS_SENSE_IU_LEN;
+      if (_uas.status != SCSI_STATUS_GOOD) {
+        // sense data is always returned with the status, no REQUEST SENSE follows
+        put_be16(iu + 14, 18);
+        fill_sense(iu + UAS_SENSE_IU_LEN);
+        len += 18;
+        uas_set_sense(_uas.cmd.lun, SCSI_SENSE_NONE, 0, 0);
+      }
+    }
+    _uas.iu_sent = true;
+    _uas.status_is_resp = false;
+  } else {
+    return;
+  }
+
+  _uas.status_busy = usbd_edpt_xfer(_uas.rhport, _uas.ep_status, iu, len);
+}
+
+// Respond to command with status, default sense if a failed callback did not set one
+static void cmd_status(uint8_t status, uint8_t sense_key, uint8_t asc, uint8_t ascq) {
+  if (status != SCSI_STATUS_GOOD && _uas.sense_key == SCSI_SENSE_NONE) {
+    uas_set_sense(_uas.cmd.lun, sense_key, asc, ascq);
+  }
+  _uas.status = status;
+  _uas.stage = UAS_STAGE_STATUS;
+  _uas.iu_sent = false;
+}
+
+static void cmd_fail(uint8_t sense_key, uint8_t asc, uint8_t ascq) {
+  cmd_status(SCSI_STATUS_CHECK_CONDITION, sense_key, asc, ascq);
+}
+
+// Response in buffer is sent as data-in, cut to allocation length
+static void cmd_data_in(uint32_t len) {
+  uint32_t const alloc = alloc_len(_uas.cmd.cdb);
+  if (len > alloc) len = alloc;
+
+  if (len == 0) {
+    cmd_status(SCSI_STATUS_GOOD, 0, 0, 0);
+    return;
+  }
+  _uas.data_in = true;
+  _uas.total = len;
+  _uas.zlp = (len < alloc) && !(len % _uas.ep_size);
+  _uas.stage = UAS_STAGE_READY;
+  _uas.iu_sent = false;
+}
+
+//--------------------------------------------------------------------+
+// SCSI
+//--------------------------------------------------------------------+
+
+static uint32_t scsi_inquiry(uint8_t lun, uint8_t* resp) {
+  memset(resp, 0, 36);
+  if (lun >= max_lun()) {
+    resp[0] = 0x7F; // no logical unit
+    return 36;
+  }
+  resp[1] = 0x80;   // removable
+  resp[2] = 2;      // same version as tinyusb reports for BOT
+  resp[3] = 2;
+  resp[4] = 36 - 5;
+  tud_msc_inquiry_cb(lun, resp + 8, resp + 16, resp + 32);
+  return 36;
+}
+
+// Commands tinyusb answers itself for BOT, -1 if not one of them
+static int32_t scsi_builtin(uint8_t lun, uint8_t const cdb[16], uint8_t* resp) {
+  uint32_t block_count;
+  uint16_t block_size;
+
+  switch (cdb[0]) {
+    case SCSI_CMD_TEST_UNIT_READY:
+      if (!tud_msc_test_unit_ready_cb(lun)) {
+        cmd_fail(SCSI_SENSE_NOT_READY, 0x3A, 0x00);
+      } else {
+        cmd_status(SCSI_STATUS_GOOD, 0, 0, 0);
+      }
+      return 0;
+
+    case SCSI_CMD_START_STOP_UNIT:
+      if (!tud_msc_start_stop_cb(lun, cdb[4] >> 4, cdb[4] & 0x01, cdb[4] & 0x02)) {
+        cmd_fail(SCSI_SENSE_NOT_READY, 0x04, 0x00);
+      } else {
+        cmd_status(SCSI_STATUS_GOOD, 0, 0, 0);
+      }
+      return 0;
+
+    case SCSI_CMD_INQUIRY:
+      if (cdb[1] & 0x01) return -1; // vital product data
+      cmd_data_in(scsi_inquiry(lun, resp));
+      return 0;
+
+    case SCSI_CMD_REQUEST_SENSE:
+      fill_sense(resp);
+      uas_set_sense(lun, SCSI_SENSE_NONE, 0, 0);
+      cmd_data_in(18);
+      return 0;
+
+    case SCSI_CMD_READ_CAPACITY_10:
+    case SCSI_CMD_READ_FORMAT_CAPACITY:
+      tud_msc_capacity_cb(lun, &block_count, &block_size);
+      if (block_count == 0 || block_size == 0) {
+        cmd_fail(SCSI_SENSE_NOT_READY, 0x3A, 0x00);
+      } else if (cdb[0] == SCSI_CMD_READ_CAPACITY_10) {
+        put_be32(resp, block_count - 1);
+        put_be32(resp + 4, block_size);
+        cmd_data_in(8);
+      } else {
+        // capacity list header, formatted media descriptor
+        put_be32(resp, 8);
+        put_be32(resp + 4, block_count);
+        put_be32(resp + 8, block_size);
+        resp[8] = 0x02;
+        cmd_data_in(12);
+      }
+      return 0;
+
+    case SCSI_CMD_MODE_SENSE_6:
+      memset(resp, 0, 4);
+      resp[0] = 4 - 1;
+      if (tud_msc_is_writable_cb && !tud_msc_is_writable_cb(lun)) resp[2] = 0x80;
+      cmd_data_in(4);
+      return 0;
+
+    default:
+      return -1;
+  }
+}
+
+static void cmd_start(void) {
+  _uas.cmd = _uas.queue[_uas.head];
+  _uas.head = (uint8_t) ((_uas.head + 1) % UAS_QUEUE_DEPTH);
+  _uas.count--;
+  cmd_arm();
+
+  uint8_t const lun = _uas.cmd.lun;
+  uint8_t const* cdb = _uas.cmd.cdb;
+
+  _uas.data_in = false;
+  _uas.zlp = false;
+  _uas.total = 0;
+  _uas.xferred = 0;
+  _uas.chunk = 0;
+  _uas.consumed = 0;
+  if (cdb[0] != SCSI_CMD_REQUEST_SENSE) uas_set_sense(lun, SCSI_SENSE_NONE, 0, 0);
+
+  if (lun >= max_lun() && cdb[0] != SCSI_CMD_INQUIRY) {
+    cmd_fail(SCSI_SENSE_ILLEGAL_REQUEST, 0x25, 0x00);
+    return;
+  }
+
+  if (cdb[0] == SCSI_CMD_READ_10 || cdb[0] == SCSI_CMD_WRITE_10) {
+    _uas.lba = get_be32(cdb + 2);
+    _uas.total = (uint32_t) get_be16(cdb + 7) * CFG_UF2_SECTOR_SIZE;
+    _uas.data_in = (cdb[0] == SCSI_CMD_READ_10);
+
+    if (!_uas.data_in && tud_msc_is_writable_cb && !tud_msc_is_writable_cb(lun)) {
+      cmd_fail(SCSI_SENSE_DATA_PROTECT, 0x27, 0x00);
+    } else if (_uas.total == 0) {
+      cmd_status(SCSI_STATUS_GOOD, 0, 0, 0);
+    } else {
+      _uas.stage = UAS_STAGE_READY;
+      _uas.iu_sent = false;
+    }
+    return;
+  }
+
+  if (scsi_builtin(lun, cdb, _uas_buf) == 0) return;
+
+  int32_t const resplen = tud_msc_scsi_cb(lun, cdb, _uas_buf, CFG_TUD_MSC_BUFSIZE);
+  if (resplen < 0) {
+    cmd_fail(SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
+  } else {
+    cmd_data_in((uint32_t) resplen);
+  }
+}
+
+// Next data transfer of the current command, false if READ10 data is not available yet
+static bool data_next(void) {
+  uint32_t const len = TU_MIN(_uas.total - _uas.xferred, (uint32_t) CFG_TUD_MSC_BUFSIZE);
+  uint8_t const op = _uas.cmd.cdb[0];
+
+  if (!_uas.data_in) {
+    return usbd_edpt_xfer(_uas.rhport, _uas.ep_out, _uas_buf, (uint16_t) len);
+  }
+
+  if (op == SCSI_CMD_READ_10) {
+    uint32_t const lba = _uas.lba + _uas.xferred / CFG_UF2_SECTOR_SIZE;
+    uint32_t const offset = _uas.xferred % CFG_UF2_SECTOR_SIZE;
+
+    // data straight from memory mapped flash is sent in place by the endpoint, in larger transfers
+    uint32_t const mapped_len = TU_MIN(_uas.total - _uas.xferred, (uint32_t) UAS_MAPPED_XFER_MAX);
+    void const* mapped = msc_read_mapped(_uas.cmd.lun, lba, offset, mapped_len);
+    if (mapped) return usbd_edpt_xfer(_uas.rhport, _uas.ep_in, (uint8_t*) (uintptr_t) mapped, (uint16_t) mapped_len);
+
+    int32_t const count = tud_msc_read10_cb(_uas.cmd.lun, lba, offset, _uas_buf, len);
+    if (count < 0) {
+      // host cancels its data transfer when status arrives
+      cmd_fail(SCSI_SENSE_NOT_READY, 0x3A, 0x00);
+      return true;
+    }
+    if (count == 0) return false;
+    return usbd_edpt_xfer(_uas.rhport, _uas.ep_in, _uas_buf, (uint16_t) count);
+  }
+
+  // response prepared when the command started
+  return usbd_edpt_xfer(_uas.rhport, _uas.ep_in, _uas_buf, (uint16_t) len);
+}
+
+// Pass received WRITE10 data to the callback, false if it must be resumed later
+static bool write_process(void) {
+  while (_uas.consumed < _uas.chunk) {
+    int32_t const count = tud_msc_write10_cb(_uas.cmd.lun, _uas.lba + _uas.xferred / CFG_UF2_SECTOR_SIZE,
+                                             _uas.xferred % CFG_UF2_SECTOR_SIZE, _uas_buf + _uas.consumed,
+                                             _uas.chunk - _uas.consumed);
+    if (count < 0) {
+      cmd_fail(SCSI_SENSE_NOT_READY, 0x3A, 0x00);
+      return true;
+    }
+    if (count == 0) return false;
+
+    _uas.consumed += (uint32_t) count;
+    _uas.xferred += (uint32_t) count;
+  }
+
+  if (_uas.xferred < _uas.total) {
+    _uas.stage = UAS_STAGE_DATA;
+    if (!data_next()) cmd_fail(SCSI_SENSE_ABORTED_COMMAND, 0x00, 0x00);
+  } else {
+    cmd_status(SCSI_STATUS_GOOD, 0, 0, 0);
+  }
+  return true;
+}
+
+// Move current command forward, false if it waits for something else than a usb event
+static bool uas_advance(void) {
+  bool ready = true;
+
+  if (_uas.stage == UAS_STAGE_IDLE && _uas.count) cmd_start();
+  if (_uas.stage == UAS_STAGE_WRITE) ready = write_process();
+  status_send();
+
+  return ready;
+}
+
+static void cmd_receive(uint8_t const* iu, uint32_t len) {
+  uint16_t const tag = get_be16(iu + 2);
+
+  if (iu[0] == UAS_IU_COMMAND && len >= UAS_COMMAND_IU_LEN) {
+    uas_cmd_t* cmd = &_uas.queue[(_uas.head + _uas.count) % UAS_QUEUE_DEPTH];
+    cmd->tag = tag;
+    cmd->lun = iu[9];   // single level lun
+    memcpy(cmd->cdb, iu + 16, 16);
+    _uas.count++;
+    return;
+  }
+
+  _uas.resp_tag = tag;
+  _uas.resp_pending = true;
+
+  if (iu[0] != UAS_IU_TASK_MGMT || len < UAS_TASK_MGMT_IU_LEN) {
+    _uas.resp_code = UAS_RC_INVALID_IU;
+    return;
+  }
+
+  uint16_t const task_tag = get_be16(iu + 6);
+  bool found = (_uas.stage != UAS_STAGE_IDLE && _uas.cmd.tag == task_tag);
+
+  switch (iu[4]) {
+    case UAS_TMF_ABORT_TASK:
+    case UAS_TMF_QUERY_TASK:
+      // queued command is dropped, the current one completes
+      for (uint8_t i = 0; i < _uas.count; i++) {
+        uas_cmd_t* cmd = &_uas.queue[(_uas.head + i) % UAS_QUEUE_DEPTH];
+        if (cmd->tag != task_tag) continue;
+        found = true;
+        if (iu[4] == UAS_TMF_ABORT_TASK) {
+          for (uint8_t j = i; j + 1 < _uas.count; j++) {
+            _uas.queue[(_uas.head + j) % UAS_QUEUE_DEPTH] = _uas.queue[(_uas.head + j + 1) % UAS_QUEUE_DEPTH];
+          }
+          _uas.count--;
+        }
+        break;
+      }
+      _uas.resp_code = (iu[4] == UAS_TMF_QUERY_TASK && found) ? UAS_RC_TMF_SUCCEEDED : UAS_RC_TMF_COMPLETE;
+      break;
+
+    case UAS_TMF_ABORT_TASK_SET:
+    case UAS_TMF_CLEAR_TASK_SET:
+    case UAS_TMF_LUN_RESET:
+    case UAS_TMF_IT_NEXUS_RESET:
+      _uas.count = 0;
+      _uas.resp_code = UAS_RC_TMF_COMPLETE;
+      break;
+
+    default:
+      _uas.resp_code = UAS_RC_TMF_NOT_SUPPORTED;
+      break;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Class driver
+//--------------------------------------------------------------------+
+
+static void uas_stop(void) {
+  _uas.count = 0;
+  _uas.head = 0;
+  _uas.stage = UAS_STAGE_IDLE;
+  _uas.cmd_armed = false;
+  _uas.resp_pending = false;
+  _uas.status_busy = false;
+}
+
+static void uas_init(void) {
+  mscd_init();
+  tu_memclr(&_uas, sizeof(_uas));
+}
+
+static void uas_reset(uint8_t rhport) {
+  mscd_reset(rhport);
+  tu_memclr(&_uas, sizeof(_uas));
+}
+
+// Endpoints of the alternate setting (BOT or UAS) up to the next interface descriptor, UAS ones are opened
+static bool alt_open(tusb_desc_interface_t const* desc_itf, uint8_t const* end) {
+  uint8_t pipe_ep = 0;
+  bool const uas = (desc_itf == _uas.desc_uas);
+
+  for (uint8_t const* p = tu_desc_next(desc_itf); p < end && tu_desc_type(p) != TUSB_DESC_INTERFACE;
+       p = tu_desc_next(p)) {
+    if (tu_desc_type(p) == UAS_DESC_PIPE_USAGE && pipe_ep) {
+      switch (p[2]) {
+        case UAS_PIPE_COMMAND:  _uas.ep_cmd = pipe_ep; break;
+        case UAS_PIPE_STATUS:   _uas.ep_status = pipe_ep; break;
+        case UAS_PIPE_DATA_IN:  _uas.ep_in = pipe_ep; break;
+        case UAS_PIPE_DATA_OUT: _uas.ep_out = pipe_ep; break;
+        default: break;
+      }
+      pipe_ep = 0;
+    } else if (tu_desc_type(p) == TUSB_DESC_ENDPOINT) {
+      tusb_desc_endpoint_t const* desc_ep = (tusb_desc_endpoint_t const*) p;
+      if (!uas) {
+        if (tu_edpt_dir(desc_ep->bEndpointAddress) == TUSB_DIR_IN) {
+          _uas.ep_bot_in = desc_ep->bEndpointAddress;
+        } else {
+          _uas.ep_bot_out = desc_ep->bEndpointAddress;
+        }
+        continue;
+      }
+      TU_ASSERT(usbd_edpt_open(_uas.rhport, desc_ep));
+      pipe_ep = desc_ep->bEndpointAddress;
+      _uas.ep_size = tu_edpt_packet_size(desc_ep);
+    }
+  }
+  return true;
+}
+
+static uint16_t uas_open(uint8_t rhport, tusb_desc_interface_t const* desc_itf, uint16_t max_len) {
+  // BOT alternate setting is opened by tinyusb
+  uint16_t const bot_len = mscd_open(rhport, desc_itf, max_len);
+  TU_VERIFY(bot_len, 0);
+
+  _uas.rhport = rhport;
+  _uas.itf_num = desc_itf->bInterfaceNumber;
+  _uas.alt = 0;
+  _uas.desc_bot = desc_itf;
+  _uas.desc_uas = NULL;
+  alt_open(desc_itf, ((uint8_t const*) desc_itf) + bot_len);
+
+  // claim the UAS alternate setting that follows
+  uint8_t const* p = ((uint8_t const*) desc_itf) + bot_len;
+  uint8_t const* end = ((uint8_t const*) desc_itf) + max_len;
+  tusb_desc_interface_t const* alt = (tusb_desc_interface_t const*) p;
+  if (p + sizeof(tusb_desc_interface_t) > end || tu_desc_type(p) != TUSB_DESC_INTERFACE ||
+      alt->bInterfaceNumber != _uas.itf_num || alt->bInterfaceProtocol != UAS_PROTOCOL) {
+    return bot_len;
+  }
+
+  _uas.desc_uas = alt;
+  p = tu_desc_next(p);
+  while (p < end && tu_desc_type(p) != TUSB_DESC_INTERFACE && tu_desc_type(p) != TUSB_DESC_INTERFACE_ASSOCIATION) {
+    p = tu_desc_next(p);
+  }
+  _uas.desc_end = p;
+  return (uint16_t) (p - (uint8_t const*) desc_itf);
+}
+
+static void alt_close(uint8_t const eps[], uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (eps[i]) usbd_edpt_close(_uas.rhport, eps[i]);
+  }
+}
+
+static bool set_interface(uint8_t rhport, uint8_t alt) {
+  if (alt == _uas.alt) return true;
+  TU_VERIFY(alt <= 1 && (alt == 0 || _uas.desc_uas));
+
+  if (alt == 1) {
+    // pending CBW transfer is cancelled, BOT endpoints are idle until alternate setting 0
+    uint8_t const bot[] = { _uas.ep_bot_in, _uas.ep_bot_out };
+    alt_close(bot, 2);
+
+    uas_stop();
+    TU_ASSERT(alt_open(_uas.desc_uas, _uas.desc_end));
+    _uas.alt = 1;
+    cmd_arm();
+  } else {
+    uint8_t const uas[] = { _uas.ep_cmd, _uas.ep_status, _uas.ep_in, _uas.ep_out };
+    alt_close(uas, 4);
+    uas_stop();
+    _uas.alt = 0;
+
+    // endpoints of BOT are opened again with reset state and a new CBW transfer
+    uint8_t const bot[] = { _uas.ep_bot_in, _uas.ep_bot_out };
+    alt_close(bot, 2);
+    mscd_reset(rhport);
+    TU_ASSERT(mscd_open(rhport, _uas.desc_bot, sizeof(tusb_desc_interface_t) + 2 * sizeof(tusb_desc_endpoint_t)));
+  }
+  return true;
+}
+
+static bool uas_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request) {
+  if (request->bmRequestType_bit.type == TUSB_REQ_TYPE_STANDARD &&
+      request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_INTERFACE) {
+    if (stage != CONTROL_STAGE_SETUP) return true;
+
+    switch (request->bRequest) {
+      case TUSB_REQ_GET_INTERFACE:
+        return tud_control_xfer(rhport, request, &_uas.alt, 1);
+
+      case TUSB_REQ_SET_INTERFACE:
+        TU_VERIFY(set_interface(rhport, (uint8_t) request->wValue));
+        return tud_control_status(rhport, request);
+
+      default:
+        return false;
+    }
+  }
+
+  return mscd_control_xfer_cb(rhport, stage, request);
+}
+
+static bool uas_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes) {
+  if (_uas.alt == 0) return mscd_xfer_cb(rhport, ep_addr, result, xferred_bytes);
+
+  if (ep_addr == _uas.ep_cmd) {
+    _uas.cmd_armed = false;
+    if (result == XFER_RESULT_SUCCESS && xferred_bytes >= UAS_READY_IU_LEN) {
+      cmd_receive(_uas_cmd_buf, xferred_bytes);
+    }
+    cmd_arm();
+  } else if (ep_addr == _uas.ep_status) {
+    _uas.status_busy = false;
+    if (_uas.status_is_resp) {
+      _uas.resp_pending = false;
+      cmd_arm();
+    } else if (_uas.stage == UAS_STAGE_READY) {
+      _uas.stage = UAS_STAGE_DATA;
+      (void) data_next();
+    } else if (_uas.stage == UAS_STAGE_STATUS) {
+      _uas.stage = UAS_STAGE_IDLE;
+      // status accepted by host, as for BOT after CSW
+      if (_uas.cmd.cdb[0] == SCSI_CMD_WRITE_10) tud_msc_write10_complete_cb(_uas.cmd.lun);
+    }
+  } else if (ep_addr == _uas.ep_in && _uas.stage == UAS_STAGE_DATA) {
+    _uas.xferred += xferred_bytes;
+    if (_uas.xferred < _uas.total) {
+      (void) data_next();
+    } else if (_uas.zlp) {
+      _uas.zlp = false;
+      usbd_edpt_xfer(rhport, _uas.ep_in, NULL, 0);
+    } else {
+      cmd_status(SCSI_STATUS_GOOD, 0, 0, 0);
+    }
+  } else if (ep_addr == _uas.ep_out && _uas.stage == UAS_STAGE_DATA) {
+    if (result != XFER_RESULT_SUCCESS || xferred_bytes == 0) {
+      cmd_fail(SCSI_SENSE_ABORTED_COMMAND, 0x00, 0x00);
+    } else {
+      _uas.chunk = xferred_bytes;
+      _uas.consumed = 0;
+      _uas.stage = UAS_STAGE_WRITE;
+    }
+  }
+
+  (void) uas_advance();
+  return true;
+}
+
+static usbd_class_driver_t const _uas_driver = {
+#if CFG_TUSB_DEBUG >= 2
+  .name            = "UAS",
+#endif
+  .init            = uas_init,
+  .reset           = uas_reset,
+  .open            = uas_open,
+  .control_xfer_cb = uas_control_xfer_cb,
+  .xfer_cb         = uas_xfer_cb,
+  .sof             = NULL,
+};
+
+usbd_class_driver_t const* usbd_app_driver_get_cb(uint8_t* driver_count) {
+  *driver_count = 1;
+  return &_uas_driver;
+}
+
+bool uas_task(void) {
+  if (_uas.alt == 0) return false;
+
+  // READ10 data not available yet, or WRITE10 data not consumed while the write queue is full
+  if (_uas.stage == UAS_STAGE_DATA && _uas.data_in && !usbd_edpt_busy(_uas.rhport, _uas.ep_in) &&
+      _uas.cmd.cdb[0] == SCSI_CMD_READ_10) {
+    if (!data_next()) return true;
+    status_send();
+    return false;
+  }
+
+  return !uas_advance();
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef UAS_H_
+#define UAS_H_
+
+//--------------------------------------------------------------------+
+// USB Attached SCSI (UAS) over USB 2.0 (TINYUF2_UAS), see src/uas.c. Offered as alternate setting 1
+// of the MSC interface next to Bulk-Only Transport, without streams: the device announces each data
+// phase with a READ READY or WRITE READY IU on the status pipe.
+//--------------------------------------------------------------------+
+
+#define UAS_PROTOCOL            0x62  // bInterfaceProtocol of the UAS alternate setting
+#define UAS_DESC_PIPE_USAGE     0x24  // class specific descriptor following each endpoint
+
+// Pipe usage of the endpoints
+enum {
+  UAS_PIPE_COMMAND = 1,
+  UAS_PIPE_STATUS,
+  UAS_PIPE_DATA_IN,
+  UAS_PIPE_DATA_OUT,
+};
+
+// Information unit IDs
+enum {
+  UAS_IU_COMMAND     = 0x01,
+  UAS_IU_SENSE       = 0x03,
+  UAS_IU_RESPONSE    = 0x04,
+  UAS_IU_TASK_MGMT   = 0x05,
+  UAS_IU_READ_READY  = 0x06,
+  UAS_IU_WRITE_READY = 0x07,
+};
+
+// Task management functions
+enum {
+  UAS_TMF_ABORT_TASK     = 0x01,
+  UAS_TMF_ABORT_TASK_SET = 0x02,
+  UAS_TMF_CLEAR_TASK_SET = 0x04,
+  UAS_TMF_LUN_RESET      = 0x08,
+  UAS_TMF_IT_NEXUS_RESET = 0x10,
+  UAS_TMF_QUERY_TASK     = 0x80,
+};
+
+// Response IU codes
+enum {
+  UAS_RC_TMF_COMPLETE      = 0x00,
+  UAS_RC_INVALID_IU        = 0x02,
+  UAS_RC_TMF_NOT_SUPPORTED = 0x04,
+  UAS_RC_TMF_SUCCEEDED     = 0x08,
+};
+
+#define UAS_COMMAND_IU_LEN      32  // header and 16-byte CDB, additional CDB bytes are ignored
+#define UAS_TASK_MGMT_IU_LEN    16
+#define UAS_SENSE_IU_LEN        16  // without sense data
+#define UAS_RESPONSE_IU_LEN     8
+#define UAS_READY_IU_LEN        4
+
+// Length of the alternate setting: interface and 4 endpoints each followed by its pipe usage
+#define TUD_UAS_DESC_LEN        (9 + 4 * (7 + 4))
+
+// Interface number, string index, EP command (out), status (in), data in, data out address, EP size
+#define TUD_UAS_DESCRIPTOR(_itfnum, _stridx, _epcmd, _epstatus, _epin, _epout, _epsize) \
+  /* Interface, alternate setting 1 */\
+  9, TUSB_DESC_INTERFACE, _itfnum, 1, 4, TUSB_CLASS_MSC, MSC_SUBCLASS_SCSI, UAS_PROTOCOL, _stridx,\
+  7, TUSB_DESC_ENDPOINT, _epcmd, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0,\
+  4, UAS_DESC_PIPE_USAGE, UAS_PIPE_COMMAND, 0,\
+  7, TUSB_DESC_ENDPOINT, _epstatus, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0,\
+  4, UAS_DESC_PIPE_USAGE, UAS_PIPE_STATUS, 0,\
+  7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0,\
+  4, UAS_DESC_PIPE_USAGE, UAS_PIPE_DATA_IN, 0,\
+  7, TUSB_DESC_ENDPOINT, _epout, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0,\
+  4, UAS_DESC_PIPE_USAGE, UAS_PIPE_DATA_OUT, 0
+
+#endif
@@ -43,7 +43,7 @@ SOFTWARE.
 // #define UF2_VERSION         "0.0.0"
 
 // The largest flash size that is supported by the board, in bytes, default is 4MB
-// Flash size is constrained by RAM, a 4MB size requires 2kB RAM, see MAX_BLOCKS
+// Written blocks are tracked with 1 bit per 64 blocks (33 bytes for 4MB) plus CFG_UF2_WRITTEN_GROUPS, see WriteState
 // Largest tested is 256MB, with 0x300000 blocks (1.5GB), 64 sectors per cluster
 #ifndef CFG_UF2_FLASH_SIZE
     #define CFG_UF2_FLASH_SIZE          (4*1024*1024)
@@ -55,11 +55,38 @@ SOFTWARE.
     #define CFG_UF2_NUM_BLOCKS          (0x10109)
 #endif
 
+// Logical sector size of the exposed filesystem: 512 or 4096 bytes. uf2 blocks are always 512 bytes,
+// a 4096-byte sector carries 8 of them. CFG_TUD_MSC_BUFSIZE must be a multiple of the sector size
+#ifndef CFG_UF2_SECTOR_SIZE
+    #define CFG_UF2_SECTOR_SIZE         (512)
+#endif
+
+// Number of logical sectors exposed to the host
+#define UF2_NUM_SECTORS (CFG_UF2_NUM_BLOCKS / (CFG_UF2_SECTOR_SIZE / 512))
+
+// uf2 blocks are 512 bytes regardless of the sector size
+#define UF2_BLOCK_SIZE          (512)
+#define UF2_BLOCKS_PER_SECTOR   (CFG_UF2_SECTOR_SIZE / UF2_BLOCK_SIZE)
+
 // Sectors per FAT cluster, must be increased proportionally for larger filesystems
 #ifndef CFG_UF2_SECTORS_PER_CLUSTER
     #define CFG_UF2_SECTORS_PER_CLUSTER (1)
 #endif
 
+// Use FAT32 layout, needed for filesystems with more than ~65k clusters (e.g >32MB with 512-byte clusters).
+// CFG_UF2_NUM_BLOCKS must then provide at least 65557 clusters
+#ifndef CFG_UF2_FAT32
+    #define CFG_UF2_FAT32               (0)
+#endif
+
+// Number of partially written 64-block groups that can be tracked at the same time.
+// Hosts write mostly in order, a group is released as soon as all its blocks are written. A block of
+// yet another group is neither programmed nor counted and its write fails, the host copying again
+// completes the file
+#ifndef CFG_UF2_WRITTEN_GROUPS
+    #define CFG_UF2_WRITTEN_GROUPS      (32)
+#endif
+
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
@@ -73,14 +100,70 @@ SOFTWARE.
 #define UF2_FLAG_NOFLASH    0x00000001
 #define UF2_FLAG_FAMILYID   0x00002000
 
+// Extension tags follow the payload at 4-byte aligned offsets: size (1 byte, including the 4-byte
+// header, 0 ends the list) and type (3 bytes little endian), then the value
+#define UF2_FLAG_EXTENSION_TAGS 0x00008000
+#define UF2_TAG_VERSION         0x9fc7bc // firmware version, UTF-8 semver string
+#define UF2_TAG_DESCRIPTION     0x650d9d // target device, UTF-8 string (UF2_BOARD_ID for TinyUF2)
+#define UF2_TAG_DEVICE_TYPE     0xc8a729 // target device type, 32-bit number
+#define UF2_TAG_SHA2            0xb46db0 // SHA-2 checksum of firmware, image ID of TINYUF2_RESUME
+
+// TinyUF2 extension (TINYUF2_UF2_LZ4): payload is a LZ4 block (raw format, no frame) decoding to at most
+// UF2_LZ4_MAX_SIZE bytes at targetAddr, payloadSize is the compressed size. Such blocks also carry
+// UF2_FLAG_NOFLASH so that bootloaders without support skip them instead of flashing compressed data
+#define UF2_FLAG_LZ4        0x00100000
+#define UF2_LZ4_MAX_SIZE    1024
+
+// TinyUF2 extension (TINYUF2_SIGNED_UF2): payload is UF2_Signature of the image starting at targetAddr.
+// Also carries UF2_FLAG_NOFLASH, the block is never programmed
+#define UF2_FLAG_SIGNATURE  0x00200000
+
+// TinyUF2 extension (TINYUF2_UF2_AES): payload is AES-128-CTR encrypted, UF2_AES_NONCE_SIZE-byte nonce
+// follows it in data (not counted in payloadSize). targetAddr is 16-byte aligned. Applied before LZ4
+// decoding when both flags are set. Also carries UF2_FLAG_NOFLASH
+#define UF2_FLAG_AES        0x00400000
+#define UF2_AES_NONCE_SIZE  12
+
+// TinyUF2 extension (TINYUF2_VERIFY_UF2): payload is compared against flash at targetAddr, never
+// programmed. Also carries UF2_FLAG_NOFLASH
+#define UF2_FLAG_VERIFY     0x00800000
+
+// TinyUF2 extension (TINYUF2_UF2_FILL): payload is UF2_Fill, the range from targetAddr is filled with
+// a repeated 32-bit pattern, or only erased when it is the erased value. Also carries UF2_FLAG_NOFLASH
+#define UF2_FLAG_FILL       0x01000000
+
 #define MAX_BLOCKS (CFG_UF2_FLASH_SIZE / 256 + 100)
+
+#define WRITTEN_GROUP_SIZE  64
+
+// Written blocks of a partially written group
+typedef struct {
+    uint32_t group;           // block number / WRITTEN_GROUP_SIZE
+    uint64_t mask;            // written blocks in group, zero if entry is free
+} WrittenGroup;
+
 typedef struct {
     uint32_t numBlocks;
     uint32_t numWritten;
 
     bool aborted;             // aborting update and reset
 
-    uint8_t writtenMask[MAX_BLOCKS / 8 + 1];
+    bool rewriteConflict;     // rewritten block differs from flash programmed in this session, not written
+    bool untracked;           // block of one group too many (CFG_UF2_WRITTEN_GROUPS), not written
+
+    uint32_t numUnchanged;    // written blocks whose payload already matched flash (TINYUF2_DELTA_FLASH)
+
+    bool ramApp;              // blocks were copied to RAM application region (TINYUF2_RAM_APP)
+
+    uint32_t numRejected;     // valid blocks of the file not programmed (TINYUF2_IDLE_COMPLETE)
+
+    uint32_t wrongBoard;      // numBlocks of the file rejected by its tags, 0 if none (TINYUF2_UF2_TAGS)
+
+    bool verify;              // file is compared against flash, not written (TINYUF2_VERIFY_UF2)
+
+    uint8_t writtenSummary[MAX_BLOCKS / WRITTEN_GROUP_SIZE / 8 + 1]; // bit set if whole group is written
+    WrittenGroup writtenGroups[CFG_UF2_WRITTEN_GROUPS];
+    uint32_t writtenLast;     // index of most recently used entry in writtenGroups
 } WriteState;
 
 typedef struct {
@@ -101,9 +184,266 @@ typedef struct {
     uint32_t magicEnd;
 } UF2_Block;
 
+// Application footer at BOARD_APP_FOOTER_ADDR (TINYUF2_APP_FOOTER)
+#define UF2_APP_FOOTER_MAGIC 0x46325554 // "TUF2"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t length;   // image length from BOARD_FLASH_APP_START
+    uint32_t crc32;    // CRC32 of image, same as CURRENT.CRC
+    uint32_t check;    // ~(magic ^ length ^ crc32)
+} UF2_AppFooter;
+
+// Footer of an image staged by the application (TINYUF2_STAGED_UPDATE): UF2_AppFooter with this
+// magic in the last 16 bytes of the staging region, length from BOARD_STAGING_ADDR
+#define UF2_STAGED_MAGIC 0x53325554 // "TU2S"
+
+// CONFIG.TXT (TINYUF2_CONFIG_TXT): header line then a fixed width "key = value" line per tunable
+#define UF2_CONFIG_HEADER     "# TinyUF2 config, edit values and save\r\n"
+#define UF2_CONFIG_KEYS       4
+#define UF2_CONFIG_LINE_LEN   26 // 12 characters key, "= ", 10 digits value, CRLF
+#define UF2_CONFIG_TXT_SIZE   (sizeof(UF2_CONFIG_HEADER) - 1 + UF2_CONFIG_KEYS * UF2_CONFIG_LINE_LEN)
+
+// Blocks implying the same image start before its extent is trusted (TINYUF2_PRE_ERASE), default
+// of pre_erase in CONFIG.TXT
+#define UF2_PRE_ERASE_CONFIRM 4
+
+// Payload of UF2_FLAG_SIGNATURE block
+typedef struct {
+  uint32_t length;         // signed image length from targetAddr
+  uint8_t  signature[64];  // ECDSA P-256 (r then s, big endian) of SHA-256 of image
+} UF2_Signature;
+
+// Payload of UF2_FLAG_FILL block
+typedef struct {
+  uint32_t length;         // bytes from targetAddr, multiple of 4
+  uint32_t pattern;        // little endian word repeated over the range
+} UF2_Fill;
 
 void uf2_init(void);
+uint32_t uf2_num_sectors(void);
 void uf2_read_block(uint32_t block_no, uint8_t *data);
+void uf2_read_blocks(uint32_t block_no, uint32_t count, uint8_t *data);
+
+// Flash contents of count sectors from block_no to be sent in place, NULL if they are generated or
+// board_flash_mapped() can not provide them (file other than CURRENT.BIN, padding, overlay, cache)
+void const* uf2_read_mapped(uint32_t block_no, uint32_t count);
 int  uf2_write_block(uint32_t block_no, uint8_t *data, WriteState *state);
 
+// Complete the file when all blocks missing from numWritten were received but rejected
+// (TINYUF2_IDLE_COMPLETE): flush, verify and mark it written. True if completed
+bool uf2_write_finish(WriteState *state);
+
+// Clear state of the completed file for the next one (TINYUF2_MULTI_SESSION)
+void uf2_write_rearm(WriteState *state);
+
+// True if data written at sector block_no is a root directory entry of file REBOOT (TINYUF2_MULTI_SESSION)
+bool uf2_is_reboot_marker(uint32_t block_no, uint8_t const *data);
+
+// Advance idle time since the last WRITE10 while writing (TINYUF2_IDLE_COMPLETE), from timer
+void msc_write_idle_tick(uint32_t ms);
+
+// Keep a non-uf2 block written by host at disk position block (512-byte units) for later reads (TINYUF2_WRITE_OVERLAY)
+void uf2_overlay_write(uint32_t block, uint8_t const *data);
+
+// Program data of the raw flash LUN (TINYUF2_RAW_LUN) at addr, word aligned and up to CFG_TUD_MSC_BUFSIZE
+void uf2_write_raw(uint32_t addr, uint8_t const* data, uint32_t len);
+
+// Reset write state of MSC on DFU entry, after uf2_init()
+void msc_init(void);
+
+// Expose raw flash LUN for this session (TINYUF2_RAW_LUN), must be called before usb is started
+void msc_raw_lun_enable(void);
+
+// Data LUN (TINYUF2_DATA_LUN): sector count, 0 if the board has no data region
+uint32_t data_lun_sectors(void);
+
+// Read/write len bytes from byte offset within lba of the data LUN, false if out of range or failed
+bool data_lun_read(uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t len);
+bool data_lun_write(uint32_t lba, uint32_t offset, uint8_t const* buffer, uint32_t len);
+
+// Program the cached erase unit of the data LUN, false if it failed
+bool data_lun_flush(void);
+
+// Sampling profiler (TINYUF2_PROFILE): start it, record an interrupted PC from the profiler interrupt,
+// Cortex-M handler that does both, and take up to count oldest samples (dropped since last call)
+void uf2_profile_start(void);
+void uf2_profile_sample(uint32_t pc);
+void uf2_profile_isr(void);
+uint32_t uf2_profile_read(uint32_t* pc, uint32_t count, uint32_t* dropped);
+
+// Drain profiler samples over RTT (TINYUF2_PROFILE), must be called periodically when it is enabled
+bool profile_task(void);
+
+// Build all string descriptors (TINYUF2_FAST_MOUNT), must be called before usb is started
+void usb_desc_init(void);
+
+// Program payloads queued for board_flash_write_v(), before the buffer passed to uf2_write_block() is reused
+void uf2_write_commit(void);
+
+// Program all cached data: board_flash_flush() and flush of every uf2 family
+void uf2_flush(void);
+
+// Flash TINYUF2_SD_FLASH_FILE from SD card (TINYUF2_SD_FLASH), true if the whole uf2 file was written
+bool uf2_sd_flash(void);
+
+// Phases of the bootloader sharing the buffer arena (TINYUF2_ARENA_SIZE)
+enum {
+  UF2_PHASE_BOOT = 0, // before usb is started e.g flashing from SD card
+  UF2_PHASE_USB,      // usb running
+};
+
+// Start phase, buffers allocated in the previous phase are released
+void uf2_arena_phase(uint8_t phase);
+
+// 8-byte aligned buffer valid until the phase ends, NULL if it does not fit
+void* uf2_arena_alloc(uint32_t size);
+
+// Load tunables of TINYUF2_CONFIG_TXT at DFU entry, defaults if none were written
+void uf2_config_init(void);
+
+// Parse a block written by the host if it is CONFIG.TXT (starts with its header), true if it was
+bool uf2_config_parse(uint8_t const* data, uint32_t len);
+
+// Render CONFIG.TXT, fixed size UF2_CONFIG_TXT_SIZE
+void uf2_config_render(char* buf);
+
+// Tasks below return true if they have more work to do without waiting for a usb event
+
+// Advance background CURRENT.CRC/SECTORS.CRC computation (TINYUF2_IDLE_HASH), must be called when
+// no other task has work
+bool uf2_hash_task(void);
+
+// Erase one step of the predicted image extent (TINYUF2_PRE_ERASE), called by msc_write_task()
+bool uf2_pre_erase_task(void);
+
+// Program uf2 blocks queued by WRITE10, must be called periodically when TINYUF2_ASYNC_WRITE,
+// TINYUF2_PRE_ERASE or TINYUF2_IDLE_COMPLETE is enabled
+bool msc_write_task(void);
+
+// Bring up flash and the virtual disk after usb started (TINYUF2_DEFER_FLASH_INIT), true on the call doing it.
+// Called by the main loop, or once by the usb task with RTOS
+bool uf2_deferred_init_task(void);
+
+// False until uf2_deferred_init_task() is done (TINYUF2_DEFER_FLASH_INIT)
+bool uf2_flash_ready(void);
+
+// Prefetch the span following a sequential READ10 (TINYUF2_READ_AHEAD), must be called periodically
+bool msc_read_task(void);
+
+// READ10 data of lun to be sent in place from memory mapped flash, NULL if it must be read by
+// tud_msc_read10_cb() into the transfer buffer
+void const* msc_read_mapped(uint8_t lun, uint32_t lba, uint32_t offset, uint32_t len);
+
+// Resume UAS commands waiting for the write queue or read data (TINYUF2_UAS), must be called periodically
+bool uas_task(void);
+
+// Sense data of the failing UAS command (TINYUF2_UAS), set along with tud_msc_set_sense() by msc.c
+void uas_set_sense(uint8_t lun, uint8_t sense_key, uint8_t add_sense_code, uint8_t add_sense_qualifier);
+
+// Process raw flash commands of the vendor interface, must be called periodically when CFG_TUD_VENDOR is enabled
+bool vendor_task(void);
+
+// Program DFU downloaded block, must be called periodically when CFG_TUD_DFU is enabled
+bool dfu_task(void);
+
+// Process CDC flash commands and send pending CDC output (responses, log), must be called periodically
+// when CFG_TUD_CDC is enabled
+bool cdc_task(void);
+
+// Copy log output into the CDC log buffer (TINYUF2_CDC_LOG), never blocks
+int cdc_log_write(void const* buf, int len);
+
+// Print deferred log entries (TINYUF2_LOG_DEFER), must be called periodically when it is enabled
+bool log_task(void);
+
+// Host write pattern (TINYUF2_WRITE_TRACE): consecutive 512-byte blocks written in the same WRITE10
+// command holding consecutive uf2 blocks (or only non-uf2 blocks) form a run
+#define MSC_TRACE_NOT_UF2   0xFFFFFFFFUL  // uf2_block of a run of non-uf2 blocks
+#define MSC_TRACE_FLAG_CMD  0x0001        // run starts a WRITE10 command
+
+typedef struct {
+  uint32_t block;     // disk position of first block, in 512-byte units
+  uint32_t uf2_block; // blockNo of first uf2 block, MSC_TRACE_NOT_UF2 for non-uf2 blocks
+  uint16_t count;     // blocks in run
+  uint16_t flags;
+} msc_trace_t;
+
+// Recorded runs, dropped is set to the number of runs that did not fit. Cleared by reset only
+uint32_t msc_write_trace(msc_trace_t const** runs, uint32_t* dropped);
+
+// Flashing statistics (TINYUF2_STATS), durations are in board_cycle_count() cycles
+uint32_t uf2_stats_now(void);
+void uf2_stats_erase(uint32_t cycles);
+void uf2_stats_usb_wait(uint32_t cycles);
+void uf2_stats_verify(uint32_t cycles);
+uint32_t uf2_stats_text(char const** text);
+
+// Mount timeline (TINYUF2_STATS): first occurrence of each phase in cycles since UF2_MOUNT_BOOT
+enum {
+  UF2_MOUNT_BOOT = 0,   // main() entered, reference of the other phases
+  UF2_MOUNT_CONFIGURED, // usb configured by host
+  UF2_MOUNT_CAPACITY,   // first READ CAPACITY, host sees the medium
+  UF2_MOUNT_ROOT_DIR,   // first root directory read, host mounts the filesystem
+  UF2_MOUNT_COUNT
+};
+
+void uf2_stats_mount(uint32_t phase);
+
+// Signed images (TINYUF2_SIGNED_UF2), see src/signature.c
+void uf2_sign_reset(void);
+void uf2_sign_track(uint32_t addr, void const* data, uint32_t len);
+void uf2_sign_set(void const* payload, uint32_t len, uint32_t addr);
+bool uf2_sign_verify(void);
+
+// Encrypted payloads (TINYUF2_UF2_AES), see src/aes_ctr.c. Decrypt in place, false if not possible
+void uf2_aes_reset(void);
+bool uf2_aes_decrypt(uint32_t addr, uint8_t* data, uint32_t len, uint8_t const nonce[UF2_AES_NONCE_SIZE]);
+
+// Record erase of a port defined erase unit (TINYUF2_WEAR_LOG), cycles from uf2_stats_now()
+void uf2_wear_erase(uint32_t unit, uint32_t cycles);
+
+// Event IDs of the event log (TINYUF2_EVENT_LOG), with their argument
+enum {
+  UF2_EVENT_NONE = 0,
+  UF2_EVENT_BOOT,           // bootloader started, arg: boot count
+  UF2_EVENT_DBL_TAP,        // arg: double tap register before it is cleared
+  UF2_EVENT_APP_INVALID,    // arg: 0 board_app_valid(), 1 board_app_valid2(), 2 app footer
+  UF2_EVENT_PROTECT,        // arg: board_flash_protect_bootloader() result
+  UF2_EVENT_APP_JUMP,       // arg: BOARD_FLASH_APP_START
+  UF2_EVENT_DFU,            // DFU mode started, arg: 1 if entered from application (TINYUF2_WARM_DFU)
+  UF2_EVENT_BLOCK_INVALID,  // uf2 block with bad payload size, alignment or encoding, arg: blockNo
+  UF2_EVENT_FAMILY,         // uf2 block of an unsupported family (once per family change), arg: familyID
+  UF2_EVENT_WRONG_BOARD,    // file rejected by its tags (TINYUF2_UF2_TAGS), arg: numBlocks
+  UF2_EVENT_WRITE_FAIL,     // flash write backend failed, arg: address
+  UF2_EVENT_SIGN_REJECT,    // image failed signature check (TINYUF2_SIGNED_UF2), arg: 0
+  UF2_EVENT_COMPLETE,       // all blocks written, arg: numBlocks
+  UF2_EVENT_FLASH_TIMEOUT,  // flash operation overran its deadline (TINYUF2_FLASH_TIMEOUT), arg: address
+  UF2_EVENT_FLASH_FAILED,   // operation given up after TINYUF2_FLASH_RETRIES, arg: address
+  UF2_EVENT_RESUME,         // interrupted file resumed (TINYUF2_RESUME), arg: first block left to write
+  UF2_EVENT_COUNT
+};
+
+// Start logging for this boot, resets the log if its magic does not match. Events are appended
+// with uf2_event() from board_api.h
+void uf2_event_init(void);
+
+// Apply the staged image if its footer and CRC are valid (TINYUF2_STAGED_UPDATE), before the
+// application is checked. Returns false if there was nothing to apply or it failed
+bool uf2_staged_apply(void);
+
+// Write the staging footer for len bytes at BOARD_STAGING_ADDR, false if len does not fit
+bool uf2_staged_commit(uint32_t len);
+
+// Run DFU mode after a warm entry from the application (TINYUF2_WARM_DFU), RAM must already be
+// initialized. No return
+void uf2_dfu_warm(void);
+
+// CRC32 of flash contents (TINYUF2_CURRENT_CRC, TINYUF2_APP_FOOTER, TINYUF2_CDC_FLASH, TINYUF2_SERVICE_TABLE or
+// TINYUF2_STAGED_UPDATE), same as CURRENT.CRC
+uint32_t uf2_flash_crc32(uint32_t addr, uint32_t len);
+
+// Check application footer (TINYUF2_APP_FOOTER), also compare image CRC if verify_image is set
+bool uf2_app_footer_valid(bool verify_image);
+
 #endif
@@ -25,6 +25,7 @@
 
 #include "board_api.h"
 #include "tusb.h"
+#include "uas.h"
 
 // Interface number
 enum {
@@ -33,6 +34,12 @@ enum {
   ITF_NUM_CDC_DATA,
 #endif
   ITF_NUM_MSC,
+#if CFG_TUD_VENDOR
+  ITF_NUM_VENDOR,
+#endif
+#if CFG_TUD_DFU
+  ITF_NUM_DFU,
+#endif
   ITF_NUM_TOTAL
 };
 
@@ -47,6 +54,12 @@ enum {
   STRID_CDC_DATA,
 #endif
   STRID_MSC,
+#if CFG_TUD_VENDOR
+  STRID_VENDOR,
+#endif
+#if CFG_TUD_DFU
+  STRID_DFU,
+#endif
 };
 
 //--------------------------------------------------------------------+
@@ -55,7 +68,12 @@ enum {
 tusb_desc_device_t TINYUF2_CONST desc_device = {
     .bLength            = sizeof(tusb_desc_device_t),
     .bDescriptorType    = TUSB_DESC_DEVICE,
+#if CFG_TUD_VENDOR
+    // 2.1 for BOS descriptor (WebUSB, MS OS 2.0)
+    .bcdUSB             = 0x0210,
+#else
     .bcdUSB             = 0x0200,
+#endif
 #if CFG_TUD_CDC
     // Use Interface Association Descriptor (IAD) for CDC
     .bDeviceClass       = TUSB_CLASS_MISC,
@@ -87,7 +105,8 @@ uint8_t const* tud_descriptor_device_cb(void) {
 //--------------------------------------------------------------------+
 
 #define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_MSC_DESC_LEN + \
-                           CFG_TUD_CDC*TUD_CDC_DESC_LEN + CFG_TUD_VENDOR*TUD_VENDOR_DESC_LEN)
+                           CFG_TUD_CDC*TUD_CDC_DESC_LEN + CFG_TUD_VENDOR*TUD_VENDOR_DESC_LEN + \
+                           CFG_TUD_DFU*TUD_DFU_DESC_LEN(1) + TINYUF2_UAS*TUD_UAS_DESC_LEN)
 
 // MSC is mandatory, use endpoint 1
 #define EPNUM_MSC_OUT     0x01
@@ -104,6 +123,33 @@ uint8_t const* tud_descriptor_device_cb(void) {
   #define EPNUM_CDC_IN      0x83
 #endif
 
+// Vendor (raw flash) endpoints follow CDC if enabled, Board/Port can force numbering as well
+#if defined(BOARD_EPNUM_VENDOR_OUT) && defined(BOARD_EPNUM_VENDOR_IN)
+  #define EPNUM_VENDOR_OUT  BOARD_EPNUM_VENDOR_OUT
+  #define EPNUM_VENDOR_IN   BOARD_EPNUM_VENDOR_IN
+#elif CFG_TUD_CDC
+  #define EPNUM_VENDOR_OUT  0x04
+  #define EPNUM_VENDOR_IN   0x84
+#else
+  #define EPNUM_VENDOR_OUT  0x02
+  #define EPNUM_VENDOR_IN   0x82
+#endif
+
+// UAS alternate setting of MSC (TINYUF2_UAS) uses the next two endpoint numbers: command and status
+// then data out and in. Board/Port can force numbering as well
+#if defined(BOARD_EPNUM_UAS_CMD) && defined(BOARD_EPNUM_UAS_STATUS) && \
+    defined(BOARD_EPNUM_UAS_DATA_IN) && defined(BOARD_EPNUM_UAS_DATA_OUT)
+  #define EPNUM_UAS_CMD       BOARD_EPNUM_UAS_CMD
+  #define EPNUM_UAS_STATUS    BOARD_EPNUM_UAS_STATUS
+  #define EPNUM_UAS_DATA_IN   BOARD_EPNUM_UAS_DATA_IN
+  #define EPNUM_UAS_DATA_OUT  BOARD_EPNUM_UAS_DATA_OUT
+#else
+  #define EPNUM_UAS_CMD       ((EPNUM_VENDOR_OUT & 0x0F) + CFG_TUD_VENDOR)
+  #define EPNUM_UAS_STATUS    (0x80 | EPNUM_UAS_CMD)
+  #define EPNUM_UAS_DATA_OUT  (EPNUM_UAS_CMD + 1)
+  #define EPNUM_UAS_DATA_IN   (0x80 | EPNUM_UAS_DATA_OUT)
+#endif
+
 uint8_t TINYUF2_CONST desc_configuration[] = {
     // Config number, interface count, string index, total length, attribute, power in mA
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
@@ -113,6 +159,20 @@ uint8_t TINYUF2_CONST desc_configuration[] = {
 #endif
     // Interface number, string index, EP Out & EP In address, EP size
     TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, STRID_MSC, EPNUM_MSC_OUT, EPNUM_MSC_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
+#if TINYUF2_UAS
+    // Interface number, string index, EP command, status, data in & data out address, EP size
+    TUD_UAS_DESCRIPTOR(ITF_NUM_MSC, STRID_MSC, EPNUM_UAS_CMD, EPNUM_UAS_STATUS, EPNUM_UAS_DATA_IN,
+                       EPNUM_UAS_DATA_OUT, TUD_OPT_HIGH_SPEED ? 512 : 64),
+#endif
+#if CFG_TUD_VENDOR
+    // Interface number, string index, EP Out & IN address, EP size
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, STRID_VENDOR, EPNUM_VENDOR_OUT, EPNUM_VENDOR_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
+#endif
+#if CFG_TUD_DFU
+    // Interface number, Alternate count, starting string index, attributes, detach timeout, transfer size
+    TUD_DFU_DESCRIPTOR(ITF_NUM_DFU, 1, STRID_DFU, DFU_ATTR_CAN_DOWNLOAD | DFU_ATTR_CAN_UPLOAD | DFU_ATTR_MANIFESTATION_TOLERANT,
+                       1000, CFG_TUD_DFU_XFER_BUFSIZE),
+#endif
 };
 
 
@@ -126,6 +186,119 @@ uint8_t const* tud_descriptor_configuration_cb(uint8_t index) {
   return desc_configuration;
 }
 
+#if CFG_TUD_VENDOR
+//--------------------------------------------------------------------+
+// BOS Descriptor
+// WebUSB landing page is UF2_INDEX_URL. MS OS 2.0 descriptor makes Windows bind WinUSB to the
+// vendor (raw flash) interface without an inf file
+//--------------------------------------------------------------------+
+
+enum {
+  VENDOR_REQUEST_WEBUSB = 1,
+  VENDOR_REQUEST_MICROSOFT = 2
+};
+
+#define BOS_TOTAL_LEN      (TUD_BOS_DESC_LEN + TUD_BOS_WEBUSB_DESC_LEN + TUD_BOS_MICROSOFT_OS_DESC_LEN)
+#define MS_OS_20_DESC_LEN  0xB2
+
+uint8_t TINYUF2_CONST desc_bos[] = {
+    // total length, number of device caps
+    TUD_BOS_DESCRIPTOR(BOS_TOTAL_LEN, 2),
+
+    // Vendor Code, iLandingPage
+    TUD_BOS_WEBUSB_DESCRIPTOR(VENDOR_REQUEST_WEBUSB, 1),
+
+    // Microsoft OS 2.0 descriptor
+    TUD_BOS_MS_OS_20_DESCRIPTOR(MS_OS_20_DESC_LEN, VENDOR_REQUEST_MICROSOFT)
+};
+
+uint8_t const* tud_descriptor_bos_cb(void) {
+  return desc_bos;
+}
+
+uint8_t TINYUF2_CONST desc_ms_os_20[] = {
+    // Set header: length, type, windows version, total length
+    U16_TO_U8S_LE(0x000A), U16_TO_U8S_LE(MS_OS_20_SET_HEADER_DESCRIPTOR), U32_TO_U8S_LE(0x06030000), U16_TO_U8S_LE(MS_OS_20_DESC_LEN),
+
+    // Configuration subset header: length, type, configuration index, reserved, configuration total length
+    U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_CONFIGURATION), 0, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A),
+
+    // Function Subset header: length, type, first interface, reserved, subset length
+    U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_FUNCTION), ITF_NUM_VENDOR, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A - 0x08),
+
+    // MS OS 2.0 Compatible ID descriptor: length, type, compatible ID, sub compatible ID
+    U16_TO_U8S_LE(0x0014), U16_TO_U8S_LE(MS_OS_20_FEATURE_COMPATBLE_ID), 'W', 'I', 'N', 'U', 'S', 'B', 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // sub-compatible
+
+    // MS OS 2.0 Registry property descriptor: length, type
+    U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A - 0x08 - 0x08 - 0x14), U16_TO_U8S_LE(MS_OS_20_FEATURE_REG_PROPERTY),
+    // wPropertyDataType (REG_MULTI_SZ), wPropertyNameLength, PropertyName "DeviceInterfaceGUIDs\0" in UTF-16
+    U16_TO_U8S_LE(0x0007), U16_TO_U8S_LE(0x002A),
+    'D', 0x00, 'e', 0x00, 'v', 0x00, 'i', 0x00, 'c', 0x00, 'e', 0x00, 'I', 0x00, 'n', 0x00, 't', 0x00, 'e', 0x00,
+    'r', 0x00, 'f', 0x00, 'a', 0x00, 'c', 0x00, 'e', 0x00, 'G', 0x00, 'U', 0x00, 'I', 0x00, 'D', 0x00, 's', 0x00, 0x00, 0x00,
+    // wPropertyDataLength, PropertyData: interface GUID of TinyUF2 raw flash, double null terminated
+    U16_TO_U8S_LE(0x0050),
+    '{', 0x00, 'F', 0x00, '9', 0x00, 'D', 0x00, '0', 0x00, '5', 0x00, 'E', 0x00, 'B', 0x00, '6', 0x00, '-', 0x00,
+    '4', 0x00, 'E', 0x00, '2', 0x00, '7', 0x00, '-', 0x00, '4', 0x00, '8', 0x00, 'D', 0x00, '9', 0x00, '-', 0x00,
+    'A', 0x00, 'D', 0x00, 'E', 0x00, '8', 0x00, '-', 0x00, '4', 0x00, '4', 0x00, 'A', 0x00, 'A', 0x00, '0', 0x00,
+    '2', 0x00, '5', 0x00, 'A', 0x00, 'C', 0x00, '8', 0x00, '0', 0x00, 'C', 0x00, '}', 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+TU_VERIFY_STATIC(sizeof(desc_ms_os_20) == MS_OS_20_DESC_LEN, "Incorrect size");
+
+// WebUSB URL descriptor, UF2_INDEX_URL without its scheme
+static uint8_t _desc_url[3 + 128];
+
+static uint8_t const* webusb_url_desc(void) {
+  char const* url = UF2_INDEX_URL;
+  uint8_t scheme = 0; // http://
+
+  if (0 == strncmp(url, "https://", 8)) {
+    scheme = 1;
+    url += 8;
+  } else if (0 == strncmp(url, "http://", 7)) {
+    url += 7;
+  }
+
+  uint8_t const len = (uint8_t) tu_min32(strlen(url), sizeof(_desc_url) - 3);
+  _desc_url[0] = 3 + len;
+  _desc_url[1] = 3; // WebUSB URL type
+  _desc_url[2] = scheme;
+  memcpy(&_desc_url[3], url, len);
+
+  return _desc_url;
+}
+
+// Invoked when a control transfer occurred on an interface of this class
+// Driver response accordingly to the request and the transfer stage (setup/data/ack)
+// return false to stall control endpoint (e.g unsupported request)
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request) {
+  // nothing to do with DATA & ACK stage
+  if (stage != CONTROL_STAGE_SETUP) return true;
+  if (request->bmRequestType_bit.type != TUSB_REQ_TYPE_VENDOR) return false;
+
+  switch (request->bRequest) {
+    case VENDOR_REQUEST_WEBUSB: {
+      // match vendor request in BOS descriptor, get landing page url
+      uint8_t const* url = webusb_url_desc();
+      return tud_control_xfer(rhport, request, (void*) (uintptr_t) url, url[0]);
+    }
+
+    case VENDOR_REQUEST_MICROSOFT:
+      if (request->wIndex == 7) {
+        // Get Microsoft OS 2.0 compatible descriptor
+        uint16_t total_len;
+        memcpy(&total_len, desc_ms_os_20 + 8, 2);
+        return tud_control_xfer(rhport, request, (void*) (uintptr_t) desc_ms_os_20, total_len);
+      }
+      return false;
+
+    default:
+      return false;
+  }
+}
+#endif
+
 //--------------------------------------------------------------------+
 // String Descriptors
 //--------------------------------------------------------------------+
@@ -144,19 +317,23 @@ char const* string_desc_arr[] = {
     NULL,
 #endif
     "UF2",                         // 4: MSC Interface
+#if CFG_TUD_VENDOR
+    "TinyUF2 Flash",               // 5: Vendor Interface (raw flash)
+#endif
+#if CFG_TUD_DFU
+    "TinyUF2 DFU",                 // 6: DFU alt 0 (application)
+#endif
 };
 
 static uint16_t _desc_str[48 + 1];
 
-// Invoked when received GET STRING DESCRIPTOR request
-// Application return pointer to descriptor, whose contents must exist long enough for transfer to complete
-uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
-  (void) langid;
+// Build string descriptor of index into desc, capped at max_count characters. Return NULL if there is none
+static uint16_t const* desc_string_build(uint8_t index, uint16_t* desc, uint16_t max_count) {
   uint8_t chr_count;
 
   switch (index) {
     case STRID_LANGID:
-      memcpy(&_desc_str[1], string_desc_arr[0], 2);
+      memcpy(&desc[1], string_desc_arr[0], 2);
       chr_count = 1;
       break;
 
@@ -164,6 +341,7 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
     case STRID_SERIAL: {
       uint8_t serial_id[16] TU_ATTR_ALIGNED(4);
       uint8_t serial_len = board_usb_get_serial(serial_id);
+      if (2 * serial_len > max_count) serial_len = max_count / 2;
       chr_count = 2 * serial_len;
 
       for (uint8_t i = 0; i < serial_len; i++) {
@@ -172,7 +350,7 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
               '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
           };
           uint8_t nibble = (serial_id[i] >> (j * 4)) & 0xf;
-          _desc_str[1 + i * 2 + (1 - j)] = nibble_to_hex[nibble]; // UTF-16-LE
+          desc[1 + i * 2 + (1 - j)] = nibble_to_hex[nibble]; // UTF-16-LE
         }
       }
       break;
@@ -182,23 +360,57 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
       // Convert ASCII string into UTF-16
       if (!(index < sizeof(string_desc_arr) / sizeof(string_desc_arr[0]))) return NULL;
 
-      uint16_t const max_count = (sizeof(_desc_str) / sizeof(_desc_str[0])) - 1;
-
       const char* str = string_desc_arr[index];
+      if (str == NULL) return NULL;
       chr_count = strlen(str);
 
       // Cap at max char
       if (chr_count > max_count) chr_count = max_count;
 
       for (uint8_t i = 0; i < chr_count; i++) {
-        _desc_str[1 + i] = str[i];
+        desc[1 + i] = str[i];
       }
       break;
     }
   }
 
   // first byte is length (including header), second byte is string type
-  _desc_str[0] = (TUSB_DESC_STRING << 8) | (2 * chr_count + 2);
+  desc[0] = (TUSB_DESC_STRING << 8) | (2 * chr_count + 2);
+
+  return desc;
+}
+
+#if TINYUF2_FAST_MOUNT
+// All strings are built once before usb is started, so that enumeration does not wait on serial
+// readout (efuse, flash unique ID command) or conversion. Strings that do not fit fall back to the callback
+static uint16_t _desc_pool[160];
+static uint16_t const* _desc_fast[sizeof(string_desc_arr) / sizeof(string_desc_arr[0])];
+
+void usb_desc_init(void) {
+  uint16_t used = 0;
+
+  for (uint8_t i = 0; i < sizeof(_desc_fast) / sizeof(_desc_fast[0]); i++) {
+    uint16_t const max_count = (sizeof(_desc_str) / sizeof(_desc_str[0])) - 1;
+    if (desc_string_build(i, _desc_str, max_count) == NULL) continue;
+
+    uint16_t const count = (_desc_str[0] & 0xff) / 2;
+    if (used + count > sizeof(_desc_pool) / sizeof(_desc_pool[0])) continue;
+
+    memcpy(&_desc_pool[used], _desc_str, 2 * count);
+    _desc_fast[i] = &_desc_pool[used];
+    used += count;
+  }
+}
+#endif
+
+// Invoked when received GET STRING DESCRIPTOR request
+// Application return pointer to descriptor, whose contents must exist long enough for transfer to complete
+uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+  (void) langid;
+
+#if TINYUF2_FAST_MOUNT
+  if (index < sizeof(_desc_fast) / sizeof(_desc_fast[0]) && _desc_fast[index]) return _desc_fast[index];
+#endif
 
-  return _desc_str;
+  return desc_string_build(index, _desc_str, (sizeof(_desc_str) / sizeof(_desc_str[0])) - 1);
 }
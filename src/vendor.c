@@ -0,0 +1,220 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Ha Thach (tinyusb.org) for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tusb.h"
+#include "uf2.h"
+
+//--------------------------------------------------------------------+
+// Raw flash protocol over the vendor bulk interface (CFG_TUD_VENDOR), see tools/fastflash.py
+//
+// Raw payload is streamed to board_flash_write() without FAT emulation or uf2 wrapping.
+// All fields are little endian. Host sends a 16-byte command: magic, cmd, addr, len
+// - RAW_CMD_INFO  : reply raw_info_t
+// - RAW_CMD_WRITE : followed by len bytes to program at addr, both word aligned and within the
+//                   application region. A status is replied after every RAW_ACK_WINDOW bytes
+//                   programmed and after the last byte, host keeps at most RAW_ACK_WINDOWS in flight
+// - RAW_CMD_FLUSH : board_flash_flush(), reply status
+// - RAW_CMD_RESET : board_flash_flush() then board_dfu_complete(), no reply
+// Status is magic, error, value (bytes of the current write programmed so far). Anything else
+// than a valid command is answered with RAW_ERR_CMD and pending input is discarded.
+// Note: application footer and CURRENT.CRC tracking only apply to uf2 files written via MSC
+//--------------------------------------------------------------------+
+
+#if CFG_TUD_VENDOR
+
+#define RAW_MAGIC         0x4C465554 // "TUFL"
+#define RAW_ACK_WINDOW    4096
+#define RAW_ACK_WINDOWS   2
+
+enum {
+  RAW_CMD_INFO = 0,
+  RAW_CMD_WRITE,
+  RAW_CMD_FLUSH,
+  RAW_CMD_RESET,
+};
+
+enum {
+  RAW_ERR_OK = 0,
+  RAW_ERR_CMD,      // invalid magic or command
+  RAW_ERR_ADDR,     // address/length unaligned or outside application region
+};
+
+typedef struct TU_ATTR_PACKED {
+  uint32_t magic;
+  uint32_t cmd;
+  uint32_t addr;
+  uint32_t len;
+} raw_cmd_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint32_t magic;
+  uint32_t error;
+  uint32_t value;
+} raw_status_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint32_t magic;
+  uint32_t error;
+  uint32_t flash_addr;  // BOARD_FLASH_ADDR_ZERO
+  uint32_t flash_size;
+  uint32_t app_start;   // BOARD_FLASH_APP_START
+  uint32_t family_id;   // BOARD_UF2_FAMILY_ID
+  uint32_t ack_window;
+  uint32_t ack_windows;
+} raw_info_t;
+
+TU_VERIFY_STATIC(sizeof(raw_cmd_t) == 16, "raw command must be 16 bytes");
+
+// Current write command. Payload is programmed in chunks not crossing 256-byte boundaries,
+// the same as uf2 payloads so that every backend handles them
+static struct {
+  uint32_t addr;    // address of chunk being received
+  uint32_t remain;  // bytes of command not yet programmed
+  uint32_t done;    // bytes of command programmed
+  uint32_t count;   // bytes of chunk received so far
+  uint8_t chunk[256] TU_ATTR_ALIGNED(4);
+} _raw;
+
+static void raw_reply(void const* data, uint32_t len) {
+  tud_vendor_write(data, len);
+  tud_vendor_write_flush();
+}
+
+static void raw_status(uint32_t error, uint32_t value) {
+  raw_status_t const status = { .magic = RAW_MAGIC, .error = error, .value = value };
+  raw_reply(&status, sizeof(status));
+}
+
+static bool raw_addr_valid(uint32_t addr, uint32_t len) {
+  uint32_t const flash_end = BOARD_FLASH_ADDR_ZERO + board_flash_size();
+
+  if ( len == 0 || ((addr | len) & 3) ) return false;
+  return (addr >= BOARD_FLASH_APP_START) && (addr < flash_end) && (len <= flash_end - addr);
+}
+
+static void raw_command(raw_cmd_t const* cmd) {
+  if ( cmd->magic != RAW_MAGIC ) {
+    TUF2_LOG1("Raw: invalid command\r\n");
+    tud_vendor_read_flush();
+    raw_status(RAW_ERR_CMD, 0);
+    return;
+  }
+
+  switch ( cmd->cmd ) {
+    case RAW_CMD_INFO: {
+      raw_info_t const info = {
+        .magic       = RAW_MAGIC,
+        .error       = RAW_ERR_OK,
+        .flash_addr  = BOARD_FLASH_ADDR_ZERO,
+        .flash_size  = board_flash_size(),
+        .app_start   = BOARD_FLASH_APP_START,
+        .family_id   = BOARD_UF2_FAMILY_ID,
+        .ack_window  = RAW_ACK_WINDOW,
+        .ack_windows = RAW_ACK_WINDOWS,
+      };
+      raw_reply(&info, sizeof(info));
+      break;
+    }
+
+    case RAW_CMD_WRITE:
+      if ( !raw_addr_valid(cmd->addr, cmd->len) ) {
+        TUF2_LOG1("Raw: invalid write %08lX len %lu\r\n", cmd->addr, cmd->len);
+        tud_vendor_read_flush();
+        raw_status(RAW_ERR_ADDR, 0);
+        break;
+      }
+
+      indicator_set(STATE_WRITING_STARTED);
+      _raw.addr = cmd->addr;
+      _raw.remain = cmd->len;
+      _raw.done = 0;
+      _raw.count = 0;
+      break;
+
+    case RAW_CMD_FLUSH:
+      board_flash_flush();
+      raw_status(RAW_ERR_OK, 0);
+      break;
+
+    case RAW_CMD_RESET:
+      TUF2_LOG1("Raw: writing finished\r\n");
+      board_flash_flush();
+      indicator_set(STATE_WRITING_FINISHED);
+      board_dfu_complete();
+
+      // board_dfu_complete() should not return
+      while (1) {}
+      break;
+
+    default:
+      TUF2_LOG1("Raw: unknown command %lu\r\n", cmd->cmd);
+      tud_vendor_read_flush();
+      raw_status(RAW_ERR_CMD, 0);
+      break;
+  }
+}
+
+// receive payload of current write command, program one chunk per call
+static void raw_write_task(void) {
+  uint32_t const size = tu_min32(_raw.remain, sizeof(_raw.chunk) - (_raw.addr & (sizeof(_raw.chunk) - 1)));
+
+  _raw.count += tud_vendor_read(_raw.chunk + _raw.count, size - _raw.count);
+  if ( _raw.count < size ) return;
+
+  board_flash_write(_raw.addr, _raw.chunk, size);
+
+  _raw.addr += size;
+  _raw.remain -= size;
+  _raw.done += size;
+  _raw.count = 0;
+
+  // ack when a window boundary is crossed
+  if ( _raw.remain == 0 || (_raw.done / RAW_ACK_WINDOW) != ((_raw.done - size) / RAW_ACK_WINDOW) ) {
+    raw_status(RAW_ERR_OK, _raw.done);
+  }
+}
+
+#endif
+
+bool vendor_task(void) {
+#if CFG_TUD_VENDOR
+  if ( !tud_vendor_mounted() ) {
+    _raw.remain = 0;
+    return false;
+  }
+
+  if ( _raw.remain ) {
+    raw_write_task();
+  } else if ( tud_vendor_available() >= sizeof(raw_cmd_t) ) {
+    raw_cmd_t cmd;
+    tud_vendor_read(&cmd, sizeof(cmd));
+    raw_command(&cmd);
+  }
+
+  // received data not processed yet
+  return _raw.remain ? (tud_vendor_available() > 0) : (tud_vendor_available() >= sizeof(raw_cmd_t));
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,182 @@
+import struct
+import sys
+
+import click
+import usb.core
+import usb.util
+
+# Raw flash protocol of TinyUF2 vendor interface (CFG_TUD_VENDOR), see src/vendor.c
+RAW_ITF_NAME = 'TinyUF2 Flash'
+RAW_MAGIC = 0x4C465554
+RAW_CMD_INFO = 0
+RAW_CMD_WRITE = 1
+RAW_CMD_FLUSH = 2
+RAW_CMD_RESET = 3
+
+RAW_ERRORS = {1: 'invalid command', 2: 'invalid address or length'}
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_NOT_MAIN_FLASH = 0x00000001
+UF2_FLAG_FAMILY_ID = 0x00002000
+
+
+class RawFlash:
+    def __init__(self, vid, pid, dev=None):
+        if dev is None:
+            ids = {}
+            if vid is not None:
+                ids['idVendor'] = vid
+            if pid is not None:
+                ids['idProduct'] = pid
+            dev = usb.core.find(custom_match=lambda d: self._vendor_itf(d) is not None, **ids)
+        if dev is None:
+            raise click.ClickException('No TinyUF2 device with raw flash interface found')
+        self.dev = dev
+
+        itf = self._vendor_itf(self.dev)
+        if self.dev.is_kernel_driver_active(itf.bInterfaceNumber):
+            self.dev.detach_kernel_driver(itf.bInterfaceNumber)
+        usb.util.claim_interface(self.dev, itf.bInterfaceNumber)
+
+        self.ep_out = usb.util.find_descriptor(itf, custom_match=lambda e: usb.util.endpoint_direction(
+            e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
+        self.ep_in = usb.util.find_descriptor(itf, custom_match=lambda e: usb.util.endpoint_direction(
+            e.bEndpointAddress) == usb.util.ENDPOINT_IN)
+
+    @classmethod
+    def find_all(cls, vid=None, pid=None):
+        """All devices with raw flash interface, e.g for flashing several boards at once"""
+        ids = {}
+        if vid is not None:
+            ids['idVendor'] = vid
+        if pid is not None:
+            ids['idProduct'] = pid
+        return list(usb.core.find(find_all=True, custom_match=lambda d: cls._vendor_itf(d) is not None, **ids))
+
+    @staticmethod
+    def _vendor_itf(dev):
+        # vendor class interface named by TinyUF2 usb_descriptors.c
+        for cfg in dev:
+            for itf in cfg:
+                try:
+                    if itf.bInterfaceClass == 0xFF and usb.util.get_string(dev, itf.iInterface) == RAW_ITF_NAME:
+                        return itf
+                except (usb.core.USBError, ValueError):
+                    pass
+        return None
+
+    def command(self, cmd, addr=0, length=0):
+        self.ep_out.write(struct.pack('<4I', RAW_MAGIC, cmd, addr, length))
+
+    def status(self, timeout=5000):
+        # several statuses may arrive in one transfer, the last one is the most recent
+        data = bytes(self.ep_in.read(64, timeout))
+        value = 0
+        for off in range(0, len(data) - 11, 12):
+            magic, error, value = struct.unpack_from('<3I', data, off)
+            if magic != RAW_MAGIC:
+                raise click.ClickException('Invalid response')
+            if error:
+                raise click.ClickException(f'Device error: {RAW_ERRORS.get(error, error)}')
+        return value
+
+    def info(self):
+        self.command(RAW_CMD_INFO)
+        data = bytes(self.ep_in.read(64, 5000))
+        magic, error = struct.unpack_from('<2I', data)
+        if magic != RAW_MAGIC or error:
+            raise click.ClickException('Invalid response')
+        keys = ('flash_addr', 'flash_size', 'app_start', 'family_id', 'ack_window', 'ack_windows')
+        return dict(zip(keys, struct.unpack_from('<6I', data, 8)))
+
+    def write(self, addr, payload, window, windows, progress=None):
+        self.command(RAW_CMD_WRITE, addr, len(payload))
+
+        # keep at most 'windows' unacknowledged windows in flight
+        sent = 0
+        acked = 0
+        while acked < len(payload):
+            while sent < len(payload) and sent - acked < window * windows:
+                chunk = payload[sent:sent + window]
+                self.ep_out.write(chunk)
+                sent += len(chunk)
+            acked = self.status()
+            if progress:
+                progress(acked)
+
+    def flush(self):
+        self.command(RAW_CMD_FLUSH)
+        self.status()
+
+    def reset(self):
+        self.command(RAW_CMD_RESET)
+
+
+def uf2_runs(data, family_id):
+    """Collect payloads of uf2 file matching family into contiguous (address, bytes) runs"""
+    runs = []
+    for off in range(0, len(data), 512):
+        block = data[off:off + 512]
+        start0, start1, flags, addr, size = struct.unpack_from('<5I', block)
+        fam = struct.unpack_from('<I', block, 28)[0]
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or \
+                struct.unpack_from('<I', block, 508)[0] != UF2_MAGIC_END:
+            continue
+        if flags & UF2_FLAG_NOT_MAIN_FLASH:
+            continue
+        if (flags & UF2_FLAG_FAMILY_ID) and fam != family_id:
+            continue
+
+        payload = block[32:32 + size]
+        if runs and runs[-1][0] + len(runs[-1][1]) == addr:
+            runs[-1][1].extend(payload)
+        else:
+            runs.append((addr, bytearray(payload)))
+    return runs
+
+
+@click.command()
+@click.argument('file', type=click.Path(exists=True, dir_okay=False))
+@click.option('--vid', default=None, help='USB vendor ID (hex), any if not specified')
+@click.option('--pid', default=None, help='USB product ID (hex), any if not specified')
+@click.option('--address', default=None, help='Target address of .bin file (hex), application start by default')
+@click.option('--no-reset', is_flag=True, help='Do not reset into application when done')
+def fastflash(file, vid, pid, address, no_reset):
+    """
+    Program a .bin or .uf2 FILE through TinyUF2 raw flash vendor interface, bypassing MSC.
+    """
+    dev = RawFlash(int(vid, 16) if vid else None, int(pid, 16) if pid else None)
+    info = dev.info()
+    print(f"Flash {info['flash_size'] // 1024} KB at 0x{info['flash_addr']:08X}, "
+          f"application at 0x{info['app_start']:08X}, family 0x{info['family_id']:08X}")
+
+    with open(file, 'rb') as f:
+        data = f.read()
+
+    if file.lower().endswith('.uf2'):
+        runs = uf2_runs(data, info['family_id'])
+    else:
+        addr = int(address, 16) if address else info['app_start']
+        runs = [(addr, bytearray(data))]
+
+    for addr, payload in runs:
+        # pad to word size with erased value
+        payload += b'\xff' * (-len(payload) % 4)
+        print(f'Writing {len(payload)} bytes at 0x{addr:08X}')
+        dev.write(addr, bytes(payload), info['ack_window'], info['ack_windows'])
+
+    dev.flush()
+    print('Done')
+
+    if not no_reset:
+        dev.reset()
+
+
+if __name__ == '__main__':
+    try:
+        fastflash()
+    except usb.core.USBError as e:
+        print(f'Error: {e}')
+        sys.exit(1)
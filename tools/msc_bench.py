@@ -0,0 +1,145 @@
+import os
+import struct
+import time
+
+import click
+import serial
+
+# Copy a generated uf2 file to a mounted TinyUF2 drive and time it. With --capture, the MSC write
+# pattern seen by the device (TINYUF2_WRITE_TRACE) is read through the CDC flash protocol
+# (TINYUF2_CDC_FLASH, see src/cdc.c) and saved for replay by test_ghostfat bench:
+#   make BOARD=<board> bench BENCH_ARGS="-u bench.uf2 -t trace.txt"
+CDC_MAGIC = 0x43465554
+CDC_CMD_INFO = 0
+CDC_CMD_STATS = 5
+CDC_CMD_TRACE = 8
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_FAMILY_ID = 0x00002000
+UF2_PAYLOAD = 256
+
+MSC_TRACE_NOT_UF2 = 0xFFFFFFFF
+MSC_TRACE_FLAG_CMD = 0x0001
+
+
+class CdcFlash:
+    def __init__(self, port):
+        self.ser = serial.Serial(port, timeout=2)
+        self.ser.reset_input_buffer()
+
+    def command(self, cmd, addr=0, length=0):
+        self.ser.write(struct.pack('<4I', CDC_MAGIC, cmd, addr, length))
+
+        # log output may precede the reply, scan for the magic
+        data = b''
+        magic = struct.pack('<I', CDC_MAGIC)
+        while True:
+            chunk = self.ser.read(1)
+            if not chunk:
+                raise click.ClickException('No reply from device')
+            data = (data + chunk)[-4:]
+            if data == magic:
+                break
+
+        error, value, length = struct.unpack('<3I', self.ser.read(12))
+        payload = self.ser.read(length)
+        if len(payload) != length:
+            raise click.ClickException('Reply truncated')
+        return error, value, payload
+
+    def info(self):
+        error, _, payload = self.command(CDC_CMD_INFO)
+        if error:
+            raise click.ClickException('Device does not support CDC flash protocol')
+        keys = ('flash_addr', 'flash_size', 'app_start', 'family_id')
+        return dict(zip(keys, struct.unpack_from('<4I', payload)))
+
+
+def make_uf2(addr, size, family, num_blocks):
+    """Random payload at addr, num_blocks may exceed the blocks generated to hold off completion"""
+    count = (size + UF2_PAYLOAD - 1) // UF2_PAYLOAD
+    out = bytearray()
+    for num in range(count):
+        out += struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, UF2_FLAG_FAMILY_ID,
+                           addr + num * UF2_PAYLOAD, UF2_PAYLOAD, num, num_blocks or count, family)
+        out += os.urandom(UF2_PAYLOAD).ljust(476, b'\x00')
+        out += struct.pack('<I', UF2_MAGIC_END)
+    return bytes(out)
+
+
+def save_trace(path, payload, dropped):
+    with open(path, 'w') as f:
+        f.write('# block uf2_block count flags (TINYUF2_WRITE_TRACE), uf2_block -1 for non-uf2 blocks\n')
+        if dropped:
+            f.write(f'# {dropped} runs dropped\n')
+        for off in range(0, len(payload) - 11, 12):
+            block, uf2_block, count, flags = struct.unpack_from('<2I2H', payload, off)
+            uf2 = -1 if uf2_block == MSC_TRACE_NOT_UF2 else uf2_block
+            f.write(f'{block} {uf2} {count} {flags}\n')
+    return len(payload) // 12
+
+
+@click.command()
+@click.argument('drive', type=click.Path(exists=True, file_okay=False))
+@click.option('--size', default=1024, help='Image size in KB')
+@click.option('--port', default=None, help='CDC port of the device, e.g /dev/ttyACM0')
+@click.option('--family', default=None, help='UF2 family ID (hex), from device by default')
+@click.option('--address', default=None, help='Target address (hex), application start of device by default')
+@click.option('--capture', default=None, type=click.Path(dir_okay=False), help='Save host write pattern to file')
+@click.option('--save', default=None, type=click.Path(dir_okay=False), help='Save generated uf2 file')
+def msc_bench(drive, size, port, family, address, capture, save):
+    """
+    Copy a generated uf2 of SIZE KB to TinyUF2 DRIVE (mount point) and report throughput.
+    The application on the device is overwritten with random data.
+    """
+    dev = CdcFlash(port) if port else None
+    info = dev.info() if dev else {}
+
+    if capture and not dev:
+        raise click.ClickException('--capture requires --port')
+    if family is None and 'family_id' not in info:
+        raise click.ClickException('--family or --port is required')
+    if address is None and 'app_start' not in info:
+        raise click.ClickException('--address or --port is required')
+
+    family = int(family, 16) if family else info['family_id']
+    addr = int(address, 16) if address else info['app_start']
+
+    # when capturing, numBlocks is one more than sent so that the device does not reset after the copy
+    count = (size * 1024 + UF2_PAYLOAD - 1) // UF2_PAYLOAD
+    data = make_uf2(addr, size * 1024, family, count + 1 if capture else 0)
+    if save:
+        with open(save, 'wb') as f:
+            f.write(data)
+
+    path = os.path.join(drive, 'BENCH.UF2')
+    start = time.monotonic()
+    try:
+        with open(path, 'wb') as f:
+            f.write(data)
+            f.flush()
+            os.fsync(f.fileno())
+    except OSError as e:
+        # drive may already be gone when the device resets on completion
+        print(f'Note: {e}')
+    elapsed = time.monotonic() - start
+
+    print(f'Copied {len(data) // 1024} KB ({count} blocks, {size} KB payload) in {elapsed:.2f} s: '
+          f'{size / elapsed:.1f} KB/s payload')
+
+    if capture:
+        error, dropped, payload = dev.command(CDC_CMD_TRACE)
+        if error:
+            raise click.ClickException('Device is not built with TINYUF2_WRITE_TRACE')
+        runs = save_trace(capture, payload, dropped)
+        print(f'Captured {runs} runs to {capture}' + (f', {dropped} dropped' if dropped else ''))
+
+        error, _, payload = dev.command(CDC_CMD_STATS)
+        if not error:
+            print(payload.decode(errors='replace'))
+
+
+if __name__ == '__main__':
+    msc_bench()
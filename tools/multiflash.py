@@ -0,0 +1,278 @@
+import glob
+import os
+import struct
+import sys
+import threading
+import time
+
+import click
+import serial
+from serial.tools import list_ports
+
+import uf2raw
+
+# Flash many TinyUF2 boards connected to one host at once. Devices are told apart by their USB
+# serial number (board_usb_get_serial), each one is written by its own worker thread using the
+# fastest path available:
+#   vendor  raw flash vendor interface (CFG_TUD_VENDOR, tools/fastflash.py), requires pyusb
+#   raw     uf2 written straight to the block device (tools/uf2raw.py), Linux only, requires root
+#   copy    uf2 copied to the mounted drive
+# With --touch, boards running an application are reset into the bootloader first with the
+# 1200 baud trick of tools/touch1200.py.
+try:
+    import usb.core
+    import usb.util
+    from fastflash import RawFlash, uf2_runs
+except ImportError:
+    RawFlash = None
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_FAMILY_ID = 0x00002000
+UF2_PAYLOAD = 256
+
+
+def bin_to_uf2(data, addr, family):
+    count = (len(data) + UF2_PAYLOAD - 1) // UF2_PAYLOAD
+    out = bytearray()
+    for num in range(count):
+        payload = data[num * UF2_PAYLOAD:(num + 1) * UF2_PAYLOAD]
+        out += struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, UF2_FLAG_FAMILY_ID,
+                           addr + num * UF2_PAYLOAD, UF2_PAYLOAD, num, count, family)
+        out += payload.ljust(476, b'\x00')
+        out += struct.pack('<I', UF2_MAGIC_END)
+    return bytes(out)
+
+
+class Firmware:
+    """Firmware converted once per target, shared by all workers"""
+
+    def __init__(self, path, address, family):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        self.is_uf2 = path.lower().endswith('.uf2')
+        self.address = address
+        self.family = family
+        self._lock = threading.Lock()
+        self._uf2 = self.data if self.is_uf2 else None
+        self._runs = {}
+
+    def uf2(self):
+        with self._lock:
+            if self._uf2 is None:
+                if self.address is None or self.family is None:
+                    raise click.ClickException('--address and --family are required to write .bin over MSC')
+                self._uf2 = bin_to_uf2(self.data, self.address, self.family)
+            return self._uf2
+
+    def runs(self, info):
+        """(address, payload) runs for the vendor interface of a device"""
+        with self._lock:
+            key = (info['family_id'], info['app_start'])
+            if key not in self._runs:
+                if self.is_uf2:
+                    runs = uf2_runs(self.data, info['family_id'])
+                else:
+                    runs = [(self.address if self.address is not None else info['app_start'], bytearray(self.data))]
+                # pad to word size with erased value
+                self._runs[key] = [(addr, bytes(payload + b'\xff' * (-len(payload) % 4))) for addr, payload in runs]
+            return self._runs[key]
+
+
+class Target:
+    def __init__(self, serial_number, method, handle):
+        self.serial = serial_number
+        self.method = method
+        self.handle = handle  # usb device, block device or mount point
+        self.total = 0
+        self.done = 0
+        self.elapsed = 0.0
+        self.error = None
+
+    def progress(self, done):
+        self.done = done
+
+
+def _usb_serial(path):
+    # walk sysfs from a block device up to its usb device
+    path = os.path.realpath(path)
+    while path != '/':
+        if os.path.exists(os.path.join(path, 'idVendor')) and os.path.exists(os.path.join(path, 'serial')):
+            with open(os.path.join(path, 'serial')) as f:
+                return f.read().strip()
+        path = os.path.dirname(path)
+    return None
+
+
+def _mount_points():
+    mounts = {}
+    try:
+        with open('/proc/mounts') as f:
+            for line in f:
+                dev, mnt = line.split()[:2]
+                mounts[dev] = mnt.replace('\\040', ' ')
+    except OSError:
+        pass
+    return mounts
+
+
+def find_msc(use_raw):
+    """serial -> (method, handle) of TinyUF2 drives, Linux sysfs"""
+    found = {}
+    mounts = _mount_points()
+    for block in glob.glob('/sys/block/sd*'):
+        dev = '/dev/' + os.path.basename(block)
+        serial_number = _usb_serial(os.path.join(block, 'device'))
+        if not serial_number:
+            continue
+        # whole disk (superfloppy) or its first partition
+        mnt = mounts.get(dev) or mounts.get(dev + '1')
+        if mnt and not os.path.exists(os.path.join(mnt, 'INFO_UF2.TXT')):
+            continue
+        if use_raw and os.access(dev, os.W_OK):
+            found[serial_number] = ('raw', dev)
+        elif mnt:
+            found[serial_number] = ('copy', mnt)
+    return found
+
+
+def find_targets(vid, pid, methods, serials):
+    targets = {}
+    if 'vendor' in methods and RawFlash is not None:
+        for dev in RawFlash.find_all(vid, pid):
+            try:
+                serial_number = dev.serial_number
+            except (usb.core.USBError, ValueError):
+                continue
+            targets[serial_number] = Target(serial_number, 'vendor', dev)
+
+    if 'raw' in methods or 'copy' in methods:
+        for serial_number, (method, handle) in find_msc('raw' in methods).items():
+            if serial_number not in targets and method in methods:
+                targets[serial_number] = Target(serial_number, method, handle)
+
+    if serials:
+        targets = {s: t for s, t in targets.items() if s in serials}
+    return sorted(targets.values(), key=lambda t: t.serial)
+
+
+def touch_applications(vid, pid, serials):
+    count = 0
+    for port in list_ports.comports():
+        if port.vid is None or (vid is not None and port.vid != vid) or (pid is not None and port.pid != pid):
+            continue
+        if serials and port.serial_number not in serials:
+            continue
+        try:
+            serial.Serial(port.device, 1200).close()
+            count += 1
+        except serial.SerialException as e:
+            print(f'{port.device}: {e}')
+    return count
+
+
+def flash_target(target, fw, hint):
+    start = time.monotonic()
+    try:
+        if target.method == 'vendor':
+            dev = RawFlash(None, None, target.handle)
+            info = dev.info()
+            runs = fw.runs(info)
+            target.total = sum(len(payload) for _, payload in runs)
+            base = 0
+            for addr, payload in runs:
+                dev.write(addr, payload, info['ack_window'], info['ack_windows'],
+                          lambda acked, base=base: target.progress(base + acked))
+                base += len(payload)
+            dev.flush()
+            target.elapsed = time.monotonic() - start
+            dev.reset()
+        else:
+            data = fw.uf2()
+            target.total = len(data)
+            if target.method == 'raw':
+                uf2raw.raw_write(target.handle, data, hint[1], hint[0], target.progress, verbose=False)
+            else:
+                path = os.path.join(target.handle, 'FIRMWARE.UF2')
+                try:
+                    with open(path, 'wb') as f:
+                        for off in range(0, len(data), 64 * 1024):
+                            f.write(data[off:off + 64 * 1024])
+                            target.progress(min(off + 64 * 1024, len(data)))
+                        f.flush()
+                        os.fsync(f.fileno())
+                except OSError:
+                    # drive may already be gone when the device resets on completion
+                    if target.done < len(data):
+                        raise
+            target.elapsed = time.monotonic() - start
+    except Exception as e:
+        target.error = str(e) or type(e).__name__
+        target.elapsed = time.monotonic() - start
+
+
+@click.command()
+@click.argument('file', type=click.Path(exists=True, dir_okay=False))
+@click.option('--vid', default=None, help='USB vendor ID (hex), any if not specified')
+@click.option('--pid', default=None, help='USB product ID (hex), any if not specified')
+@click.option('--serial', 'serials', multiple=True, help='Only flash device with this USB serial, repeatable')
+@click.option('--method', 'methods', multiple=True, type=click.Choice(['vendor', 'raw', 'copy']),
+              help='Allowed write paths, fastest available is used. All by default')
+@click.option('--address', default=None, help='Target address of .bin file (hex), application start by default')
+@click.option('--family', default=None, help='UF2 family ID (hex) to convert .bin for MSC devices')
+@click.option('--info', default=None, type=click.Path(exists=True, dir_okay=False),
+              help='INFO_UF2.TXT with Raw-Write hint, applied to raw path of all devices')
+@click.option('--touch', is_flag=True, help='Reset boards running an application into bootloader first')
+@click.option('--wait', default=3.0, help='Seconds to wait for bootloaders to enumerate after --touch')
+def multiflash(file, vid, pid, serials, methods, address, family, info, touch, wait):
+    """
+    Write FILE (.uf2 or .bin) to all connected TinyUF2 devices in parallel.
+    """
+    vid = int(vid, 16) if vid else None
+    pid = int(pid, 16) if pid else None
+    methods = methods or ('vendor', 'raw', 'copy')
+
+    if touch:
+        print(f'Reset {touch_applications(vid, pid, serials)} application(s) into bootloader')
+        time.sleep(wait)
+
+    targets = find_targets(vid, pid, methods, serials)
+    if not targets:
+        raise click.ClickException('No TinyUF2 device found')
+
+    fw = Firmware(file, int(address, 16) if address else None, int(family, 16) if family else None)
+    hint = uf2raw.read_hint(info) if info else (None, None)
+
+    print(f'Flashing {len(targets)} device(s): ' + ', '.join(f'{t.serial} ({t.method})' for t in targets))
+    workers = [threading.Thread(target=flash_target, args=(t, fw, hint), daemon=True) for t in targets]
+    start = time.monotonic()
+    for w in workers:
+        w.start()
+
+    while any(w.is_alive() for w in workers):
+        line = '  '.join(f'{t.serial[-8:]} {100 * t.done // t.total if t.total else 0:3d}%' for t in targets)
+        print('\r' + line, end='', flush=True)
+        time.sleep(0.25)
+    print()
+    elapsed = time.monotonic() - start
+
+    failed = 0
+    total = 0
+    for t in targets:
+        if t.error:
+            failed += 1
+            print(f'{t.serial:24s} {t.method:6s} FAIL {t.error}')
+        else:
+            total += t.total
+            rate = t.total / 1e6 / t.elapsed if t.elapsed else 0
+            print(f'{t.serial:24s} {t.method:6s} OK   {t.total / 1024:8.1f} KB {t.elapsed:6.2f} s {rate:6.2f} MB/s')
+
+    print(f'{len(targets) - failed} of {len(targets)} devices flashed in {elapsed:.2f} s, '
+          f'line throughput {total / 1e6 / elapsed:.2f} MB/s')
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    multiflash()
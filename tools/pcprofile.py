@@ -0,0 +1,102 @@
+import bisect
+import collections
+import struct
+import subprocess
+import time
+
+import click
+
+from msc_bench import CdcFlash
+
+# Flat profile of the bootloader from the PC samples of its sampling profiler (TINYUF2_PROFILE, see
+# src/profile.c). Samples are 32-bit little endian PCs, read through the CDC flash protocol
+# (TINYUF2_CDC_FLASH) with --port, or from a capture of RTT up channel 1 (LOGGER_RTT), e.g
+#   JLinkRTTLogger -Device <mcu> -If SWD -Speed 4000 -RTTChannel 1 profile.bin
+# Start the capture, copy a firmware to the drive, then:
+#   python pcprofile.py _build/<board>/tinyuf2-<board>.elf --raw profile.bin
+CDC_CMD_PROFILE = 9
+
+# samples per CDC command, device replies with fewer when its ring is drained
+CDC_PROFILE_LEN = 64 * 4
+
+
+def load_symbols(elf, nm):
+    """Sorted (start, end, name) of functions in elf"""
+    out = subprocess.run([nm, '-n', '-S', '--defined-only', elf], capture_output=True, text=True, check=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 4 and parts[2] in 'tTwW':
+            # thumb bit of function symbols
+            start = int(parts[0], 16) & ~1
+            symbols.append((start, start + int(parts[1], 16), parts[3]))
+    symbols.sort()
+    return symbols
+
+
+def read_cdc(port, seconds, save):
+    dev = CdcFlash(port)
+    samples = bytearray()
+    dropped = 0
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        error, lost, payload = dev.command(CDC_CMD_PROFILE, 0, CDC_PROFILE_LEN)
+        if error:
+            raise click.ClickException('Device is not built with TINYUF2_PROFILE')
+        samples += payload
+        dropped += lost
+        if len(payload) < CDC_PROFILE_LEN:
+            time.sleep(0.01)
+
+    if save:
+        with open(save, 'wb') as f:
+            f.write(samples)
+    return bytes(samples), dropped
+
+
+@click.command()
+@click.argument('elf', type=click.Path(exists=True, dir_okay=False))
+@click.option('--port', default=None, help='CDC port of the device, e.g /dev/ttyACM0')
+@click.option('--seconds', default=10.0, help='Sampling time with --port')
+@click.option('--save', default=None, type=click.Path(dir_okay=False), help='Save samples read with --port')
+@click.option('--raw', default=None, type=click.Path(exists=True, dir_okay=False),
+              help='Samples captured from RTT channel 1 or saved with --save')
+@click.option('--nm', default='arm-none-eabi-nm', help='nm of the toolchain')
+@click.option('--top', default=30, help='Number of functions listed')
+def profile(elf, port, seconds, save, raw, nm, top):
+    """
+    Print flat profile of ELF from sampling profiler PCs, read from the device or a capture.
+    """
+    if bool(port) == bool(raw):
+        raise click.ClickException('Exactly one of --port or --raw is required')
+
+    if port:
+        print(f'Sampling for {seconds:.0f} s')
+        data, dropped = read_cdc(port, seconds, save)
+    else:
+        with open(raw, 'rb') as f:
+            data = f.read()
+        dropped = 0
+
+    pcs = [pc for (pc,) in struct.iter_unpack('<I', data[:len(data) & ~3])]
+    if not pcs:
+        raise click.ClickException('No samples')
+
+    symbols = load_symbols(elf, nm)
+    starts = [s[0] for s in symbols]
+    hits = collections.Counter()
+    for pc in pcs:
+        i = bisect.bisect_right(starts, pc) - 1
+        if i >= 0 and pc < max(symbols[i][1], symbols[i][0] + 1):
+            hits[symbols[i][2]] += 1
+        else:
+            hits[f'?{pc:08X}'] += 1
+
+    print(f'{len(pcs)} samples' + (f', {dropped} dropped' if dropped else ''))
+    print(f'{"samples":>8} {"%":>6}  function')
+    for name, count in hits.most_common(top):
+        print(f'{count:8d} {100 * count / len(pcs):6.2f}  {name}')
+
+
+if __name__ == '__main__':
+    profile()
@@ -0,0 +1,66 @@
+import os
+import struct
+
+import click
+from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+
+# AES encrypted uf2 payloads accepted by TinyUF2 built with TINYUF2_UF2_AES, see src/aes_ctr.c
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_NOT_MAIN_FLASH = 0x00000001
+UF2_FLAG_AES = 0x00400000
+
+UF2_PAYLOAD_MAX = 476
+UF2_AES_NONCE_SIZE = 12
+
+
+def aes_ctr(key, nonce, addr, data):
+    """Key stream is aligned to the address space: counter block is nonce || big endian (addr / 16)"""
+    counter = nonce + struct.pack('>I', addr >> 4)
+    return Cipher(algorithms.AES(key), modes.CTR(counter)).encryptor().update(data)
+
+
+@click.command()
+@click.argument('file', type=click.Path(exists=True, dir_okay=False))
+@click.option('--key', '-k', required=True, help='AES-128 key (32 hex digits), as provisioned on the board')
+@click.option('--output', '-o', required=True, type=click.Path(dir_okay=False), help='Encrypted uf2 file')
+def uf2aes(file, key, output):
+    """
+    Encrypt payloads of uf2 FILE for TinyUF2 built with TINYUF2_UF2_AES, a new nonce is used for every
+    file. Run it after uf2lz4.py to encrypt compressed payloads. Encrypted blocks are ignored by
+    bootloaders without support.
+    """
+    key = bytes.fromhex(key)
+    if len(key) != 16:
+        raise click.ClickException('Key must be 16 bytes')
+    nonce = os.urandom(UF2_AES_NONCE_SIZE)
+
+    with open(file, 'rb') as f:
+        data = bytearray(f.read())
+
+    count = 0
+    for off in range(0, len(data), 512):
+        start0, start1, flags, addr, size = struct.unpack_from('<5I', data, off)
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or \
+                struct.unpack_from('<I', data, off + 508)[0] != UF2_MAGIC_END:
+            continue
+        if flags & UF2_FLAG_AES:
+            raise click.ClickException('Input is already encrypted')
+        if addr & 15 or size + UF2_AES_NONCE_SIZE > UF2_PAYLOAD_MAX:
+            raise click.ClickException(f'Block at 0x{addr:08X} can not be encrypted')
+
+        payload = off + 32
+        data[payload:payload + size] = aes_ctr(key, nonce, addr, bytes(data[payload:payload + size]))
+        data[payload + size:payload + size + UF2_AES_NONCE_SIZE] = nonce
+        struct.pack_into('<I', data, off + 8, flags | UF2_FLAG_AES | UF2_FLAG_NOT_MAIN_FLASH)
+        count += 1
+
+    with open(output, 'wb') as f:
+        f.write(data)
+
+    click.echo(f'{count} blocks encrypted')
+
+
+if __name__ == '__main__':
+    uf2aes()
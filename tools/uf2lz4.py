@@ -0,0 +1,162 @@
+import struct
+
+import click
+
+# LZ4 compressed uf2 payloads accepted by TinyUF2 built with TINYUF2_UF2_LZ4, see src/uf2.h.
+# With --carray, a bootloader .bin is compressed for apps/self_update built with TINYUF2_SELF_UPDATE_LZ4
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_NOT_MAIN_FLASH = 0x00000001
+UF2_FLAG_FAMILY_ID = 0x00002000
+UF2_FLAG_LZ4 = 0x00100000
+
+UF2_PAYLOAD_MAX = 476
+UF2_LZ4_MAX_SIZE = 1024
+SELF_UPDATE_LZ4_CHUNK = 4096
+
+
+def _lz4_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def _lz4_sequence(out, literals, offset=0, match=0):
+    token = min(len(literals), 15) << 4
+    if offset:
+        token |= min(match - 4, 15)
+    out.append(token)
+    if len(literals) >= 15:
+        _lz4_length(out, len(literals) - 15)
+    out += literals
+    if offset:
+        out += struct.pack('<H', offset)
+        if match - 4 >= 15:
+            _lz4_length(out, match - 4 - 15)
+
+
+def lz4_compress(data):
+    """Greedy LZ4 block (raw format) compressor, good enough for firmware images"""
+    out = bytearray()
+    table = {}
+    anchor = 0
+    pos = 0
+
+    # format requires the last match to start 12 bytes and end 5 bytes before the end
+    while pos < len(data) - 12:
+        key = data[pos:pos + 4]
+        ref = table.get(key)
+        table[key] = pos
+        if ref is None or pos - ref > 0xFFFF:
+            pos += 1
+            continue
+
+        match = 4
+        while pos + match < len(data) - 5 and data[ref + match] == data[pos + match]:
+            match += 1
+
+        _lz4_sequence(out, data[anchor:pos], pos - ref, match)
+        pos += match
+        anchor = pos
+
+    _lz4_sequence(out, data[anchor:])
+    return bytes(out)
+
+
+def uf2_runs(data):
+    """Collect flash payloads of uf2 file into contiguous (family, flags, address, bytes) runs"""
+    runs = []
+    for off in range(0, len(data), 512):
+        block = data[off:off + 512]
+        start0, start1, flags, addr, size, _, _, family = struct.unpack_from('<8I', block)
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or \
+                struct.unpack_from('<I', block, 508)[0] != UF2_MAGIC_END:
+            continue
+        if flags & (UF2_FLAG_NOT_MAIN_FLASH | UF2_FLAG_LZ4):
+            raise click.ClickException('Input must be a plain uf2 file')
+
+        payload = block[32:32 + size]
+        last = runs[-1] if runs else None
+        if last and last[0] == family and last[1] == flags and last[2] + len(last[3]) == addr:
+            last[3].extend(payload)
+        else:
+            runs.append((family, flags, addr, bytearray(payload)))
+    return runs
+
+
+def compress_run(addr, payload):
+    """Split a run into (address, flag, data) blocks, largest span whose compressed size fits a block"""
+    blocks = []
+    pos = 0
+    while pos < len(payload):
+        # span ends on a 256-byte boundary unless it is the end of the run
+        for size in range(UF2_LZ4_MAX_SIZE - ((addr + pos) & 0xFF), 0, -256):
+            span = bytes(payload[pos:pos + size])
+            packed = lz4_compress(span)
+            if len(packed) <= UF2_PAYLOAD_MAX and len(packed) < len(span) and len(span) > 256:
+                blocks.append((addr + pos, UF2_FLAG_LZ4 | UF2_FLAG_NOT_MAIN_FLASH, packed))
+                pos += len(span)
+                break
+        else:
+            # not worth compressing, keep a plain 256-byte block
+            size = 256 - ((addr + pos) & 0xFF)
+            blocks.append((addr + pos, 0, bytes(payload[pos:pos + size])))
+            pos += size
+    return blocks
+
+
+def self_update_carray(data):
+    """C source of bindata[] for apps/self_update: LZ4 blocks of SELF_UPDATE_LZ4_CHUNK decoded bytes,
+    each prefixed by its 16-bit length, so that the image is decoded sector by sector"""
+    stream = bytearray()
+    for off in range(0, len(data), SELF_UPDATE_LZ4_CHUNK):
+        packed = lz4_compress(data[off:off + SELF_UPDATE_LZ4_CHUNK])
+        stream += struct.pack('<H', len(packed)) + packed
+
+    lines = [', '.join(f'0x{b:02x}' for b in stream[off:off + 16]) for off in range(0, len(stream), 16)]
+    return (f'// bootloader compressed by tools/uf2lz4.py --carray for TINYUF2_SELF_UPDATE_LZ4\n'
+            f'const unsigned long bindata_len = {len(data)};\n'
+            f'const unsigned long bindata_lz4_len = {len(stream)};\n'
+            f'const unsigned char bindata[] __attribute__((aligned(16))) = {{\n'
+            + ',\n'.join(lines) + '\n};\n'), len(stream)
+
+
+@click.command()
+@click.argument('file', type=click.Path(exists=True, dir_okay=False))
+@click.option('--output', '-o', required=True, type=click.Path(dir_okay=False), help='Compressed uf2 file')
+@click.option('--carray', is_flag=True, help='FILE is a bootloader .bin, write C array for apps/self_update')
+def uf2lz4(file, output, carray):
+    """
+    Compress payloads of uf2 FILE for TinyUF2 built with TINYUF2_UF2_LZ4. Compressed blocks are
+    ignored by bootloaders without support.
+    """
+    with open(file, 'rb') as f:
+        data = f.read()
+
+    if carray:
+        source, size = self_update_carray(data)
+        with open(output, 'w') as f:
+            f.write(source)
+        click.echo(f'{len(data)} bytes compressed to {size} bytes')
+        return
+
+    blocks = []
+    for family, flags, addr, payload in uf2_runs(data):
+        # pad to word size with erased value
+        payload += b'\xff' * (-len(payload) % 4)
+        blocks += [(family, flags | extra, baddr, bdata) for baddr, extra, bdata in compress_run(addr, payload)]
+
+    with open(output, 'wb') as f:
+        for num, (family, flags, addr, payload) in enumerate(blocks):
+            f.write(struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, flags, addr, len(payload),
+                                num, len(blocks), family))
+            f.write(payload.ljust(UF2_PAYLOAD_MAX, b'\x00'))
+            f.write(struct.pack('<I', UF2_MAGIC_END))
+
+    click.echo(f'{len(data) // 512} blocks compressed to {len(blocks)} blocks')
+
+
+if __name__ == '__main__':
+    uf2lz4()
@@ -0,0 +1,267 @@
+import hashlib
+import re
+import struct
+
+import click
+
+# Rewrite an uf2 (or bin) file for the flash geometry of a TinyUF2 board: payloads are sorted and
+# grouped per erase unit, each unit is filled completely with erased value so that it is written
+# sequentially in one go, and numBlocks is set to the exact block count. Erase unit size is given
+# with --erase-size (BOARD_FLASH_ERASE_SIZE of the port) or read from the Raw-Write line of
+# INFO_UF2.TXT (TINYUF2_RAW_WRITE_HINT), which gives an upper bound when sectors are larger.
+# --board-id and --fw-version add extension tags to every block, TinyUF2 built with TINYUF2_UF2_TAGS
+# rejects a file whose board ID is not its UF2_BOARD_ID before anything is erased.
+# --fill replaces runs of a repeated word (gaps, padding, erased ranges) by a single fill block for
+# TinyUF2 built with TINYUF2_UF2_FILL.
+# --image-id tags every block with a SHA-256 of the image, TinyUF2 built with TINYUF2_RESUME journals the
+# progress of the file by it, so that an interrupted write can be completed with uf2raw.py --resume.
+# --verify makes TinyUF2 built with TINYUF2_VERIFY_UF2 compare the image against flash instead of
+# writing it, the result is in VERIFY.TXT.
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_NOT_MAIN_FLASH = 0x00000001
+UF2_FLAG_FAMILY_ID = 0x00002000
+UF2_FLAG_EXTENSION_TAGS = 0x00008000
+UF2_FLAG_VERIFY = 0x00800000
+UF2_FLAG_FILL = 0x01000000
+UF2_TAG_VERSION = 0x9fc7bc
+UF2_TAG_DESCRIPTION = 0x650d9d
+UF2_TAG_SHA2 = 0xb46db0
+
+UF2_PAYLOAD = 256
+UF2_PAYLOAD_MAX = 476  # dense blocks, TinyUF2 accepts payloads up to the full data area
+DEFAULT_ERASE_SIZE = 4096
+
+HINT_RE = re.compile(r'Raw-Write: LBA 0x[0-9A-Fa-f]+, chunk 0x([0-9A-Fa-f]+) bytes')
+
+
+def uf2_blocks(data):
+    """Parse uf2 file into (flags, address, family, payload) blocks"""
+    blocks = []
+    for off in range(0, len(data), 512):
+        block = data[off:off + 512]
+        start0, start1, flags, addr, size, _, _, family = struct.unpack_from('<8I', block)
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or \
+                struct.unpack_from('<I', block, 508)[0] != UF2_MAGIC_END:
+            continue
+        blocks.append((flags, addr, family, bytes(block[32:32 + size])))
+    return blocks
+
+
+def make_tags(board_id, version, image_id=None):
+    """Extension tags: size (header included) and 3-byte type, each padded to 4 bytes, zero terminated"""
+    out = b''
+    for tag_type, value in ((UF2_TAG_DESCRIPTION, board_id), (UF2_TAG_VERSION, version), (UF2_TAG_SHA2, image_id)):
+        if value:
+            if isinstance(value, str):
+                value = value.encode()
+            if len(value) > 251:
+                raise click.ClickException(f'Tag value too long: {value}')
+            tag = bytes([4 + len(value)]) + tag_type.to_bytes(3, 'little') + value
+            out += tag.ljust((len(tag) + 3) // 4 * 4, b'\x00')
+    return out + b'\x00' * 4 if out else out
+
+
+def image_digest(blocks):
+    """SHA-256 of target address, family and payload of all blocks, in file order"""
+    sha = hashlib.sha256()
+    for flags, addr, family, payload in blocks:
+        sha.update(struct.pack('<4I', flags, addr, family, len(payload)) + payload)
+    return sha.digest()
+
+
+def erase_size_of(info):
+    with open(info, 'r', errors='replace') as f:
+        m = HINT_RE.search(f.read())
+    if not m:
+        raise click.ClickException(f'{info} has no Raw-Write line, use --erase-size')
+    # chunk holds one erase unit of 256-byte payloads in 512-byte blocks
+    return int(m.group(1), 16) // 2
+
+
+def erase_units(blocks, erase_size):
+    """Main flash payloads as {(family flag, family, unit address): bytearray(erase_size)}, uncovered bytes erased"""
+    units = {}
+    for flags, addr, family, payload in blocks:
+        if flags & UF2_FLAG_NOT_MAIN_FLASH:
+            continue
+        pos = 0
+        while pos < len(payload):
+            base = (addr + pos) - (addr + pos) % erase_size
+            key = (flags & UF2_FLAG_FAMILY_ID, family, base)
+            unit = units.setdefault(key, bytearray(b'\xff' * erase_size))
+            off = addr + pos - base
+            count = min(len(payload) - pos, erase_size - off)
+            unit[off:off + count] = payload[pos:pos + count]
+            pos += count
+    return units
+
+
+def unit_blocks(key, unit, payload_size, drop_erased):
+    """Payload blocks of one erase unit in address order"""
+    flags, family, base = key
+    erased = unit == b'\xff' * len(unit)
+    out = []
+    for off in range(0, len(unit), payload_size):
+        payload = bytes(unit[off:off + payload_size])
+        # unit is erased anyway when it has data, blank payloads need not be programmed
+        if drop_erased and not erased and payload == b'\xff' * len(payload):
+            continue
+        out.append((flags, base + off, family, payload))
+    return out
+
+
+def fill_blocks(blocks):
+    """Merge consecutive payloads made of one repeated word into fill blocks, blocks are in address order"""
+    out = []
+    run = None  # [flags, address, family, length, word, first payload length]
+    for flags, addr, family, payload in blocks + [(0, 0, 0, None)]:
+        word = None
+        if payload is not None and not flags & UF2_FLAG_NOT_MAIN_FLASH and len(payload) % 4 == 0 and \
+                payload == payload[:4] * (len(payload) // 4):
+            word = payload[:4]
+        if run and word == run[4] and (flags, family) == (run[0], run[2]) and addr == run[1] + run[3]:
+            run[3] += len(payload)
+            continue
+        if run:
+            # a single payload is kept as data, it costs one block either way
+            if run[3] > run[5]:
+                out.append((run[0] | UF2_FLAG_FILL | UF2_FLAG_NOT_MAIN_FLASH, run[1], run[2],
+                            struct.pack('<I', run[3]) + run[4]))
+            else:
+                out.append((run[0], run[1], run[2], run[4] * (run[3] // 4)))
+            run = None
+        if payload is None:
+            break
+        if word is not None:
+            run = [flags, addr, family, len(payload), word, len(payload)]
+        else:
+            out.append((flags, addr, family, payload))
+    return out
+
+
+def verify_blocks(blocks, payload_size):
+    """Main flash payloads as they are, without erased padding which would be compared too"""
+    out = []
+    for flags, addr, family, payload in blocks:
+        if flags & UF2_FLAG_NOT_MAIN_FLASH:
+            continue
+        if (addr | len(payload)) % 4:
+            raise click.ClickException(f'Payload at 0x{addr:08X} is not word aligned, cannot be verified')
+        for off in range(0, len(payload), payload_size):
+            out.append((flags | UF2_FLAG_VERIFY | UF2_FLAG_NOT_MAIN_FLASH, addr + off, family,
+                        payload[off:off + payload_size]))
+    return out
+
+
+@click.command()
+@click.argument('file', type=click.Path(exists=True, dir_okay=False))
+@click.option('--output', '-o', required=True, type=click.Path(dir_okay=False), help='Optimized uf2 file')
+@click.option('--erase-size', default=None, help='Erase unit size in bytes (hex), BOARD_FLASH_ERASE_SIZE of the port')
+@click.option('--info', default=None, type=click.Path(exists=True, dir_okay=False),
+              help='INFO_UF2.TXT of the board, for erase unit size')
+@click.option('--address', default=None, help='Target address of .bin file (hex)')
+@click.option('--family', default=None, help='UF2 family ID (hex) of .bin file')
+@click.option('--drop-erased', is_flag=True,
+              help='Drop all-0xFF payloads of written units. Only for ports that erase the whole unit '
+                   'without restoring untouched bytes (no RAM cache or TINYUF2_FLASH_CACHE)')
+@click.option('--dense', is_flag=True, help='476-byte payloads, needs TinyUF2 or another bootloader accepting them')
+@click.option('--lz4', is_flag=True, help='Compress payloads for TINYUF2_UF2_LZ4, see uf2lz4.py')
+@click.option('--board-id', default=None, help='Tag blocks with the UF2_BOARD_ID of the target (TINYUF2_UF2_TAGS)')
+@click.option('--fw-version', default=None, help='Tag blocks with firmware version string')
+@click.option('--fill', is_flag=True, help='Replace runs of a repeated word by fill blocks (TINYUF2_UF2_FILL)')
+@click.option('--image-id', is_flag=True, help='Tag blocks with SHA-256 of the image for resume (TINYUF2_RESUME)')
+@click.option('--verify', is_flag=True, help='Compare against flash instead of writing (TINYUF2_VERIFY_UF2)')
+@click.option('--sign', 'sign_key', default=None, type=click.Path(exists=True, dir_okay=False),
+              help='Sign for TINYUF2_SIGNED_UF2 with this ECDSA P-256 key (PEM), see uf2sign.py')
+def uf2opt(file, output, erase_size, info, address, family, drop_erased, dense, lz4, board_id, fw_version, fill,
+           image_id, verify, sign_key):
+    """
+    Rewrite uf2 or bin FILE in erase unit order for TinyUF2.
+    """
+    if sum(bool(opt) for opt in (dense, lz4, sign_key)) > 1:
+        raise click.ClickException('--dense, --lz4 and --sign are exclusive')
+    if sign_key and drop_erased:
+        raise click.ClickException('Signed image must be contiguous, --drop-erased is not allowed')
+    if verify and (sign_key or lz4):
+        raise click.ClickException('--verify is exclusive with --sign and --lz4')
+    if fill and (sign_key or lz4 or verify):
+        raise click.ClickException('--fill is exclusive with --sign, --lz4 and --verify')
+    if image_id and (sign_key or verify):
+        raise click.ClickException('--image-id is exclusive with --sign and --verify')
+
+    if erase_size:
+        erase_size = int(erase_size, 16)
+    elif info:
+        erase_size = erase_size_of(info)
+    else:
+        erase_size = DEFAULT_ERASE_SIZE
+    if erase_size % UF2_PAYLOAD:
+        raise click.ClickException('Erase unit size must be a multiple of 256')
+
+    with open(file, 'rb') as f:
+        data = f.read()
+
+    if file.lower().endswith('.uf2'):
+        blocks = uf2_blocks(data)
+        if not blocks:
+            raise click.ClickException('No uf2 block found')
+    else:
+        if address is None or family is None:
+            raise click.ClickException('--address and --family are required for .bin file')
+        blocks = [(UF2_FLAG_FAMILY_ID, int(address, 16), int(family, 16), data)]
+
+    # blocks not for main flash (e.g files, already compressed or signed) are kept as they are
+    out = [blk for blk in blocks if blk[0] & UF2_FLAG_NOT_MAIN_FLASH]
+    units = erase_units(blocks, erase_size)
+
+    if verify:
+        out += verify_blocks(blocks, UF2_PAYLOAD_MAX if dense else UF2_PAYLOAD)
+    elif sign_key:
+        import ecdsa
+        import uf2sign
+        with open(sign_key, 'rb') as f:
+            sk = ecdsa.SigningKey.from_pem(f.read())
+        families = sorted({fam for _, fam, _ in units})
+        if len(families) != 1 or out:
+            raise click.ClickException('Signing requires a single family and no other blocks')
+        plain = [blk for key, unit in sorted(units.items()) for blk in unit_blocks(key, unit, UF2_PAYLOAD, False)]
+        out, start, image, digest = uf2sign.sign_blocks(sk, plain, families[0])
+        click.echo(f'Signed {len(image)} bytes at 0x{start:08X}, sha256 {digest.hex()}')
+    else:
+        for key, unit in sorted(units.items()):
+            if lz4:
+                import uf2lz4
+                flags, fam, base = key
+                out += [(flags | extra, baddr, fam, bdata) for baddr, extra, bdata in uf2lz4.compress_run(base, unit)]
+            else:
+                out += unit_blocks(key, unit, UF2_PAYLOAD_MAX if dense else UF2_PAYLOAD, drop_erased)
+        if fill:
+            out = fill_blocks(out)
+
+    image_sha = image_digest(out) if image_id else None
+    tags = make_tags(board_id, fw_version, image_sha)
+    with open(output, 'wb') as f:
+        for num, (flags, addr, fam, payload) in enumerate(out):
+            data = payload
+            if tags:
+                data = payload.ljust((len(payload) + 3) // 4 * 4, b'\x00') + tags
+                if len(data) > UF2_PAYLOAD_MAX:
+                    raise click.ClickException(f'No room for tags after {len(payload)}-byte payload of block {num}')
+                flags |= UF2_FLAG_EXTENSION_TAGS
+            f.write(struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, flags, addr,
+                                len(payload), num, len(out), fam))
+            f.write(data.ljust(UF2_PAYLOAD_MAX, b'\x00'))
+            f.write(struct.pack('<I', UF2_MAGIC_END))
+
+    if verify:
+        click.echo(f'{len(blocks)} blocks rewritten to {len(out)} blocks to verify')
+    else:
+        click.echo(f'{len(blocks)} blocks rewritten to {len(out)} blocks, {len(units)} erase units of {erase_size} bytes')
+    if image_sha:
+        click.echo(f'Image ID {int.from_bytes(image_sha[:4], "little"):08X}{int.from_bytes(image_sha[4:8], "little"):08X}')
+
+
+if __name__ == '__main__':
+    uf2opt()
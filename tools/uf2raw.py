@@ -0,0 +1,240 @@
+import mmap
+import os
+import re
+import struct
+import sys
+import time
+
+import click
+
+# Write an uf2 file straight to the block device of a TinyUF2 drive, bypassing the host filesystem.
+# GhostFAT accepts uf2 blocks at any LBA, so the file is written in strictly sequential chunks of
+# whole erase units without FAT allocation or metadata writes in between. Chunk size and first LBA
+# are advertised in INFO_UF2.TXT when built with TINYUF2_RAW_WRITE_HINT:
+#   Raw-Write: LBA 0x00000050, chunk 0x00002000 bytes
+#
+# Linux:   sudo python3 uf2raw.py /dev/sdX firmware.uf2 (device is opened with O_DIRECT)
+# Windows: python uf2raw.py \\.\E: firmware.uf2 (run as administrator, volume is locked and dismounted)
+#
+# --resume completes a write that was interrupted (TINYUF2_RESUME): INFO_UF2.TXT of the drive names the image
+# and the first block left to write, only the blocks from there are sent when the file has the same image ID
+# (tools/uf2opt.py --image-id).
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_BLOCK_SIZE = 512
+UF2_PAYLOAD = 256
+UF2_FLAG_EXTENSION_TAGS = 0x00008000
+UF2_TAG_SHA2 = 0xb46db0
+
+GHOSTFAT_OEM = b'UF2 UF2 '
+DEFAULT_ERASE_SIZE = 4096
+BOOT_READ_SIZE = 4096  # covers 4Kn drives, also a valid O_DIRECT length
+
+FSCTL_LOCK_VOLUME = 0x00090018
+FSCTL_DISMOUNT_VOLUME = 0x00090020
+
+HINT_RE = re.compile(r'Raw-Write: LBA 0x([0-9A-Fa-f]+), chunk 0x([0-9A-Fa-f]+) bytes')
+RESUME_RE = re.compile(r'Resume: image 0x([0-9A-Fa-f]{16}), block 0x([0-9A-Fa-f]+) of 0x([0-9A-Fa-f]+)')
+
+
+def aligned_buffer(size):
+    # anonymous mapping is page aligned as required by O_DIRECT
+    return mmap.mmap(-1, size)
+
+
+class RawDevice:
+    def __init__(self, path):
+        flags = os.O_RDWR | getattr(os, 'O_BINARY', 0)
+        if sys.platform.startswith('linux'):
+            flags |= os.O_DIRECT | os.O_SYNC
+        self.fd = os.open(path, flags)
+
+        if sys.platform == 'win32':
+            self._win_lock()
+
+    def _win_lock(self):
+        # writes to the sectors of a mounted volume are rejected unless it is locked
+        import ctypes
+        import msvcrt
+        handle = msvcrt.get_osfhandle(self.fd)
+        returned = ctypes.c_ulong()
+        for code in (FSCTL_LOCK_VOLUME, FSCTL_DISMOUNT_VOLUME):
+            if not ctypes.windll.kernel32.DeviceIoControl(handle, code, None, 0, None, 0,
+                                                          ctypes.byref(returned), None):
+                raise click.ClickException(f'Cannot lock volume (error {ctypes.GetLastError()})')
+
+    def read(self, offset, length):
+        buf = aligned_buffer(length)
+        os.lseek(self.fd, offset, os.SEEK_SET)
+        count = os.readv(self.fd, [buf]) if hasattr(os, 'readv') else self._read_into(buf)
+        if count != length:
+            raise click.ClickException(f'Short read at offset {offset}')
+        return bytes(buf)
+
+    def _read_into(self, buf):
+        data = os.read(self.fd, len(buf))
+        buf[:len(data)] = data
+        return len(data)
+
+    def write(self, offset, buf):
+        os.lseek(self.fd, offset, os.SEEK_SET)
+        if os.write(self.fd, buf) != len(buf):
+            raise click.ClickException(f'Short write at offset {offset}')
+
+    def close(self):
+        os.close(self.fd)
+
+
+def parse_boot_sector(boot):
+    if boot[3:11] != GHOSTFAT_OEM:
+        raise click.ClickException('Not a TinyUF2 drive (boot sector OEM is not "UF2 UF2 ")')
+
+    sector_size, per_cluster, reserved, fats, root_entries, total16 = struct.unpack_from('<HBHBHH', boot, 11)
+    per_fat16, = struct.unpack_from('<H', boot, 22)
+    total32, = struct.unpack_from('<I', boot, 32)
+    per_fat = per_fat16 or struct.unpack_from('<I', boot, 36)[0]
+
+    root_sectors = (root_entries * 32 + sector_size - 1) // sector_size
+    data_lba = reserved + fats * per_fat + root_sectors
+    return sector_size, data_lba, total16 or total32
+
+
+def read_hint(info_path, required=True):
+    with open(info_path, 'r', errors='replace') as f:
+        m = HINT_RE.search(f.read())
+    if not m and not required:
+        return None, None
+    if not m:
+        raise click.ClickException(f'{info_path} has no Raw-Write line, device is not built with TINYUF2_RAW_WRITE_HINT')
+    return int(m.group(1), 16), int(m.group(2), 16)
+
+
+def read_resume(info_path):
+    """(image ID, first block left, block count) journaled by the device, block count is 0 if nothing to resume"""
+    with open(info_path, 'r', errors='replace') as f:
+        m = RESUME_RE.search(f.read())
+    if not m:
+        raise click.ClickException(f'{info_path} has no Resume line, device is not built with TINYUF2_RESUME')
+    return m.group(1).upper(), int(m.group(2), 16), int(m.group(3), 16)
+
+
+def image_id(block):
+    """Image ID as shown by the device, from the SHA-2 tag of an uf2 block, None if it has none"""
+    flags, = struct.unpack_from('<I', block, 8)
+    size, = struct.unpack_from('<I', block, 16)
+    pos = 32 + (size + 3) // 4 * 4
+    while flags & UF2_FLAG_EXTENSION_TAGS and pos + 4 <= UF2_BLOCK_SIZE - 4:
+        tag_size = block[pos]
+        if tag_size < 4:
+            break
+        if int.from_bytes(block[pos + 1:pos + 4], 'little') == UF2_TAG_SHA2 and tag_size >= 12:
+            return '%08X%08X' % struct.unpack_from('<2I', block, pos + 4)
+        pos += (tag_size + 3) // 4 * 4
+    return None
+
+
+def resume_data(data, info_path):
+    """Blocks of data the device still needs"""
+    resume_id, first, total = read_resume(info_path)
+    if not total:
+        print('Nothing to resume, writing the whole file')
+        return data
+
+    num_blocks, = struct.unpack_from('<I', data, 24)
+    if image_id(data[:UF2_BLOCK_SIZE]) != resume_id or num_blocks != total or len(data) // UF2_BLOCK_SIZE != total:
+        raise click.ClickException(f'Device has blocks of image {resume_id} ({total} blocks), not of this file')
+    block_no, = struct.unpack_from('<I', data, first * UF2_BLOCK_SIZE + 20)
+    if block_no != first:
+        raise click.ClickException('Blocks are not in order, file can not be resumed')
+
+    print(f'Resuming image {resume_id} from block {first} of {total}')
+    return data[first * UF2_BLOCK_SIZE:]
+
+
+def check_uf2(data):
+    if not data or len(data) % UF2_BLOCK_SIZE:
+        raise click.ClickException('uf2 file size is not a multiple of 512')
+    for off in range(0, len(data), UF2_BLOCK_SIZE):
+        start0, start1 = struct.unpack_from('<2I', data, off)
+        end, = struct.unpack_from('<I', data, off + UF2_BLOCK_SIZE - 4)
+        if (start0, start1, end) != (UF2_MAGIC_START0, UF2_MAGIC_START1, UF2_MAGIC_END):
+            raise click.ClickException(f'Invalid uf2 block {off // UF2_BLOCK_SIZE}')
+
+
+def raw_write(device, data, chunk=None, lba=None, progress=None, verbose=True):
+    """Write uf2 data to DEVICE, chunk and lba default to what the boot sector implies. Returns seconds taken"""
+    dev = RawDevice(device)
+    try:
+        sector_size, data_lba, total_sectors = parse_boot_sector(dev.read(0, BOOT_READ_SIZE))
+
+        # without hint: standard payload uf2 blocks of a 4 KB erase unit, from an aligned data region LBA
+        chunk = chunk or DEFAULT_ERASE_SIZE // UF2_PAYLOAD * UF2_BLOCK_SIZE
+        chunk = (chunk + sector_size - 1) // sector_size * sector_size
+        chunk_sectors = chunk // sector_size
+        if lba is None:
+            lba = (data_lba + chunk_sectors - 1) // chunk_sectors * chunk_sectors
+
+        # whole sectors, uf2 blocks padding a partial sector are ignored by the device
+        padded = len(data) + (-len(data) % sector_size)
+        if lba + padded // sector_size > total_sectors:
+            raise click.ClickException(f'{padded} bytes at LBA 0x{lba:X} exceed drive of {total_sectors} sectors')
+
+        buf = aligned_buffer(chunk)
+        if verbose:
+            print(f'Writing {len(data) // 1024} KB at LBA 0x{lba:X} in chunks of {chunk} bytes '
+                  f'({sector_size}-byte sectors)')
+
+        start = time.monotonic()
+        for off in range(0, padded, chunk):
+            part = data[off:off + chunk]
+            length = (len(part) + sector_size - 1) // sector_size * sector_size
+            buf[:length] = part.ljust(length, b'\x00')
+            try:
+                dev.write(lba * sector_size + off, memoryview(buf)[:length])
+            except OSError as e:
+                # device resets as soon as the last block is written
+                if off + length < padded:
+                    raise click.ClickException(f'Write at offset {off} failed: {e}')
+                if verbose:
+                    print(f'Note: {e}')
+            if progress:
+                progress(min(off + length, len(data)))
+        return time.monotonic() - start
+    finally:
+        try:
+            dev.close()
+        except OSError:
+            pass
+
+
+@click.command()
+@click.argument('device')
+@click.argument('uf2file', type=click.Path(exists=True, dir_okay=False))
+@click.option('--info', default=None, type=click.Path(exists=True, dir_okay=False),
+              help='INFO_UF2.TXT of the drive, for chunk size and first LBA')
+@click.option('--chunk', default=None, help='Chunk size in bytes (hex), overrides --info')
+@click.option('--lba', default=None, help='First LBA (hex), overrides --info')
+@click.option('--resume', is_flag=True, help='Only write the blocks left by an interrupted write, needs --info')
+def uf2raw(device, uf2file, info, chunk, lba, resume):
+    """
+    Write UF2FILE to the raw block DEVICE of a TinyUF2 drive in sequential, erase aligned chunks.
+    """
+    with open(uf2file, 'rb') as f:
+        data = f.read()
+    check_uf2(data)
+    if resume:
+        if not info:
+            raise click.ClickException('--resume needs INFO_UF2.TXT of the drive (--info)')
+        data = resume_data(data, info)
+
+    hint_lba, hint_chunk = read_hint(info, required=not resume) if info else (None, None)
+    chunk = int(chunk, 16) if chunk else hint_chunk
+    lba = int(lba, 16) if lba is not None else hint_lba
+
+    elapsed = raw_write(device, data, chunk, lba)
+    print(f'Wrote {len(data) // 1024} KB in {elapsed:.2f} s: {len(data) / 1024 / elapsed:.1f} KB/s')
+
+
+if __name__ == '__main__':
+    uf2raw()
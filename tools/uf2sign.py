@@ -0,0 +1,116 @@
+import hashlib
+import struct
+
+import click
+import ecdsa
+
+# Signed uf2 images accepted by TinyUF2 built with TINYUF2_SIGNED_UF2, see src/signature.c
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_NOT_MAIN_FLASH = 0x00000001
+UF2_FLAG_FAMILY_ID = 0x00002000
+UF2_FLAG_SIGNATURE = 0x00200000
+
+UF2_PAYLOAD_MAX = 476
+
+
+def uf2_blocks(data):
+    """Parse uf2 file into (flags, address, family, payload) blocks"""
+    blocks = []
+    for off in range(0, len(data), 512):
+        block = data[off:off + 512]
+        start0, start1, flags, addr, size, _, _, family = struct.unpack_from('<8I', block)
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or \
+                struct.unpack_from('<I', block, 508)[0] != UF2_MAGIC_END:
+            continue
+        if flags & UF2_FLAG_SIGNATURE:
+            raise click.ClickException('Input is already signed')
+        blocks.append((flags, addr, family, bytes(block[32:32 + size])))
+    return blocks
+
+
+def image_of(blocks, family_id):
+    """Flash image (start, bytes) of family, gaps are filled with erased value so that they are programmed"""
+    payloads = [(addr, payload) for flags, addr, family, payload in blocks
+                if family == family_id and not flags & UF2_FLAG_NOT_MAIN_FLASH]
+    if not payloads:
+        raise click.ClickException(f'No flash payload of family 0x{family_id:08X}')
+
+    start = min(addr for addr, _ in payloads)
+    end = max(addr + len(payload) for addr, payload in payloads)
+    image = bytearray(b'\xff' * (end - start + (-(end - start) % 4)))
+    for addr, payload in payloads:
+        image[addr - start:addr - start + len(payload)] = payload
+    return start, bytes(image)
+
+
+def sign_blocks(sk, blocks, family_id):
+    """Blocks of the signed file: other blocks, contiguous 256-byte image blocks, signature block"""
+    start, image = image_of(blocks, family_id)
+
+    out = [(flags, addr, fam, payload) for flags, addr, fam, payload in blocks
+           if fam != family_id or flags & UF2_FLAG_NOT_MAIN_FLASH]
+    out += [(UF2_FLAG_FAMILY_ID, start + off, family_id, image[off:off + 256]) for off in range(0, len(image), 256)]
+
+    digest = hashlib.sha256(image).digest()
+    signature = sk.sign_digest_deterministic(digest, hashfunc=hashlib.sha256, sigencode=ecdsa.util.sigencode_string)
+    out.append((UF2_FLAG_FAMILY_ID | UF2_FLAG_NOT_MAIN_FLASH | UF2_FLAG_SIGNATURE, start, family_id,
+                struct.pack('<I', len(image)) + signature))
+    return out, start, image, digest
+
+
+def key_header(vk):
+    point = vk.to_string()
+    lines = [', '.join(f'0x{b:02x}' for b in point[i:i + 16]) for i in range(0, len(point), 16)]
+    body = ', \\\n  '.join(lines)
+    return ('// Public key of signed uf2 images (TINYUF2_SIGNED_UF2), generated by tools/uf2sign.py\n'
+            '#define TINYUF2_SIGN_PUBKEY { \\\n  ' + body + ' \\\n}\n')
+
+
+@click.command()
+@click.argument('file', type=click.Path(exists=True, dir_okay=False), required=False)
+@click.option('--key', '-k', required=True, type=click.Path(exists=True, dir_okay=False),
+              help='ECDSA P-256 private key (PEM), e.g openssl ecparam -name prime256v1 -genkey -noout')
+@click.option('--output', '-o', type=click.Path(dir_okay=False), help='Signed uf2 file')
+@click.option('--family', default=None, help='Family ID of signed image (hex), first block family by default')
+@click.option('--header', type=click.Path(dir_okay=False), help='Write public key as sign_key.h')
+def uf2sign(file, key, output, family, header):
+    """
+    Sign uf2 FILE for TinyUF2 built with TINYUF2_SIGNED_UF2: image is rewritten as contiguous 256-byte
+    blocks followed by a signature block. Use --header to generate the board's sign_key.h.
+    """
+    with open(key, 'rb') as f:
+        sk = ecdsa.SigningKey.from_pem(f.read())
+    if sk.curve != ecdsa.NIST256p:
+        raise click.ClickException('Key must be ECDSA P-256 (prime256v1)')
+
+    if header:
+        with open(header, 'w') as f:
+            f.write(key_header(sk.get_verifying_key()))
+
+    if not file:
+        return
+    if not output:
+        raise click.ClickException('Missing --output')
+
+    with open(file, 'rb') as f:
+        blocks = uf2_blocks(f.read())
+    if not blocks:
+        raise click.ClickException('No uf2 block found')
+
+    family_id = int(family, 16) if family else blocks[0][2]
+    out, start, image, digest = sign_blocks(sk, blocks, family_id)
+
+    with open(output, 'wb') as f:
+        for num, (flags, addr, fam, payload) in enumerate(out):
+            f.write(struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, flags, addr,
+                                len(payload), num, len(out), fam))
+            f.write(payload.ljust(UF2_PAYLOAD_MAX, b'\x00'))
+            f.write(struct.pack('<I', UF2_MAGIC_END))
+
+    click.echo(f'Signed {len(image)} bytes at 0x{start:08X}, sha256 {digest.hex()}')
+
+
+if __name__ == '__main__':
+    uf2sign()
@@ -0,0 +1,120 @@
+import os
+import struct
+import zlib
+
+import click
+
+from uf2opt import UF2_FLAG_FAMILY_ID, UF2_FLAG_NOT_MAIN_FLASH, UF2_MAGIC_END, UF2_MAGIC_START0, \
+    UF2_MAGIC_START1, UF2_PAYLOAD, uf2_blocks
+
+# Update a TinyUF2 board built with TINYUF2_SECTORS_CRC by sending only the erase units that changed.
+# SECTORS.CRC (in DIAG/ with TINYUF2_DIAG_DIR) lists address, size and CRC32 of every erase unit of the
+# application region. Each unit of the image is laid over erased value and compared with the listed CRC,
+# the delta uf2 holds the payloads of the units that differ plus anything past the last listed unit.
+# Units of flash the image does not cover are left as they are.
+MANIFEST_NAMES = (os.path.join('DIAG', 'SECTORS.CRC'), 'SECTORS.CRC')
+
+
+def read_manifest(path):
+    """[(address, size, crc)] of SECTORS.CRC, zero size lines are padding"""
+    units = []
+    with open(path, 'r', errors='replace') as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) != 3:
+                continue
+            addr, size, crc = (int(v, 16) for v in fields)
+            if size:
+                units.append((addr, size, crc))
+    return units
+
+
+def image_blocks(file, address, family):
+    """(flags, address, family, payload) blocks of main flash from .uf2 or .bin"""
+    with open(file, 'rb') as f:
+        data = f.read()
+
+    if file.lower().endswith('.uf2'):
+        blocks = [b for b in uf2_blocks(data) if not b[0] & UF2_FLAG_NOT_MAIN_FLASH]
+        if family is not None:
+            blocks = [b for b in blocks if not b[0] & UF2_FLAG_FAMILY_ID or b[2] == family]
+        return blocks
+
+    if address is None or family is None:
+        raise click.ClickException('--address and --family are required for .bin file')
+    return [(UF2_FLAG_FAMILY_ID, address + off, family, data[off:off + UF2_PAYLOAD])
+            for off in range(0, len(data), UF2_PAYLOAD)]
+
+
+def changed_blocks(blocks, units):
+    """Blocks covering units whose CRC differs, with count of changed and compared units"""
+    expected = {}
+    for flags, addr, family, payload in blocks:
+        for i, (base, size, _) in enumerate(units):
+            if addr < base + size and addr + len(payload) > base:
+                unit = expected.setdefault(i, bytearray(b'\xff' * size))
+                start = max(addr, base)
+                end = min(addr + len(payload), base + size)
+                unit[start - base:end - base] = payload[start - addr:end - addr]
+
+    changed = {i for i, unit in expected.items() if zlib.crc32(unit) != units[i][2]}
+    listed_end = units[-1][0] + units[-1][1] if units else 0
+
+    out = []
+    for block in blocks:
+        addr, payload = block[1], block[3]
+        overlaps = [i for i, (base, size, _) in enumerate(units) if addr < base + size and addr + len(payload) > base]
+        if addr + len(payload) > listed_end or any(i in changed for i in overlaps):
+            out.append(block)
+    return out, len(changed), len(expected)
+
+
+def write_uf2(path, blocks):
+    with open(path, 'wb') as f:
+        for num, (flags, addr, family, payload) in enumerate(blocks):
+            f.write(struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, flags, addr, len(payload), num,
+                                len(blocks), family))
+            f.write(payload.ljust(476, b'\x00'))
+            f.write(struct.pack('<I', UF2_MAGIC_END))
+        f.flush()
+        os.fsync(f.fileno())
+
+
+@click.command()
+@click.argument('file', type=click.Path(exists=True, dir_okay=False))
+@click.argument('manifest', type=click.Path(exists=True))
+@click.option('--output', '-o', default=None, type=click.Path(dir_okay=False),
+              help='Delta uf2 file, written to the drive as DELTA.UF2 if MANIFEST is its mount point')
+@click.option('--address', default=None, help='Target address of .bin file (hex)')
+@click.option('--family', default=None, help='UF2 family ID (hex), required for .bin, filters .uf2')
+def uf2sync(file, manifest, output, address, family):
+    """
+    Write the erase units of FILE (.uf2 or .bin) that differ from MANIFEST (SECTORS.CRC or drive mount point).
+    """
+    drive = None
+    if os.path.isdir(manifest):
+        drive = manifest
+        names = [os.path.join(drive, n) for n in MANIFEST_NAMES if os.path.exists(os.path.join(drive, n))]
+        if not names:
+            raise click.ClickException(f'No SECTORS.CRC on {drive}, TinyUF2 must be built with TINYUF2_SECTORS_CRC')
+        manifest = names[0]
+    if output is None:
+        if drive is None:
+            raise click.ClickException('--output is required when MANIFEST is a file')
+        output = os.path.join(drive, 'DELTA.UF2')
+
+    units = read_manifest(manifest)
+    blocks = image_blocks(file, int(address, 16) if address else None, int(family, 16) if family else None)
+    delta, changed, compared = changed_blocks(blocks, units)
+
+    print(f'{changed} of {compared} erase unit(s) changed, {len(delta)} of {len(blocks)} blocks')
+    if not delta:
+        print('Flash already matches image, nothing written')
+        return
+
+    write_uf2(output, delta)
+    print(f'Wrote {output}')
+
+
+if __name__ == '__main__':
+    uf2sync()